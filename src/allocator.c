@@ -0,0 +1,156 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Authors:        David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#include <string.h>
+#include "config.h"
+#ifdef WITH_JEMALLOC
+#include <sys/types.h>
+#include <jemalloc/jemalloc.h>
+#endif
+#include "common.h"
+#include "allocator.h"
+
+gint allocator_decay=-1;
+
+#ifdef WITH_JEMALLOC
+static gboolean allocator_enabled=FALSE;
+static GMutex *arenas_mutex=NULL;
+// slot -> arena index, 0 is not created yet as arena 0 is the default one
+static unsigned arenas[ALLOCATOR_MAX_ARENAS];
+static const gchar *arena_names[ALLOCATOR_MAX_ARENAS];
+static gint next_worker=0;
+static size_t page_size=4096;
+
+static
+void set_arena_decay(unsigned arena){
+  gchar name[64];
+  ssize_t decay=allocator_decay;
+  g_snprintf(name, sizeof(name), "arena.%u.dirty_decay_ms", arena);
+  mallctl(name, NULL, NULL, &decay, sizeof(decay));
+  g_snprintf(name, sizeof(name), "arena.%u.muzzy_decay_ms", arena);
+  mallctl(name, NULL, NULL, &decay, sizeof(decay));
+}
+
+void initialize_allocator(){
+  const char *version=NULL;
+  size_t sz=sizeof(version);
+  if (mallctl("version", &version, &sz, NULL, 0)){
+    g_warning("jemalloc is not the allocator of the process, the threads use the default arenas");
+    return;
+  }
+  sz=sizeof(page_size);
+  mallctl("arenas.page", &page_size, &sz, NULL, 0);
+  if (allocator_decay >= 0){
+    ssize_t decay=allocator_decay;
+    unsigned narenas=0, i;
+    // the arenas created later and the ones that already exist
+    if (mallctl("arenas.dirty_decay_ms", NULL, NULL, &decay, sizeof(decay)) ||
+        mallctl("arenas.muzzy_decay_ms", NULL, NULL, &decay, sizeof(decay)))
+      g_warning("Not able to set the decay of jemalloc to %d ms", allocator_decay);
+    sz=sizeof(narenas);
+    mallctl("arenas.narenas", &narenas, &sz, NULL, 0);
+    for (i=0; i < narenas; i++)
+      set_arena_decay(i);
+  }
+  memset(arenas, 0, sizeof(arenas));
+  arenas_mutex=g_mutex_new();
+  allocator_enabled=TRUE;
+  g_message("Using jemalloc %s with an arena per worker thread", version);
+}
+
+/* The workers are assigned round robin over ALLOCATOR_MAX_ARENAS slots, the
+   threads of --daemon are created again on every run and reuse the arenas */
+void set_thread_arena(enum affinity_group group){
+  if (!allocator_enabled)
+    return;
+  guint slot;
+  if (group == AFFINITY_WORKERS)
+    slot=AFFINITY_GROUPS + (guint)g_atomic_int_add(&next_worker, 1) % (ALLOCATOR_MAX_ARENAS - AFFINITY_GROUPS);
+  else
+    slot=group;
+  g_mutex_lock(arenas_mutex);
+  if (arenas[slot] == 0){
+    unsigned arena=0;
+    size_t sz=sizeof(arena);
+    if (mallctl("arenas.create", &arena, &sz, NULL, 0)){
+      g_mutex_unlock(arenas_mutex);
+      g_warning("Not able to create a jemalloc arena for a %s thread", affinity_group_name[group]);
+      return;
+    }
+    arenas[slot]=arena;
+    arena_names[slot]=affinity_group_name[group];
+  }
+  unsigned arena=arenas[slot];
+  g_mutex_unlock(arenas_mutex);
+  if (mallctl("thread.arena", NULL, NULL, &arena, sizeof(arena)))
+    g_warning("Not able to bind a %s thread to the jemalloc arena %u", affinity_group_name[group], arena);
+}
+
+static
+size_t arena_stat(unsigned arena, const gchar *stat){
+  gchar name[64];
+  size_t value=0, sz=sizeof(value);
+  g_snprintf(name, sizeof(name), "stats.arenas.%u.%s", arena, stat);
+  if (mallctl(name, &value, &sz, NULL, 0))
+    return 0;
+  return value;
+}
+
+#define MB(x) ((gdouble)(x) / 1024 / 1024)
+
+// The stats are a snapshot taken when the epoch is refreshed
+void message_allocator_stats(){
+  if (!allocator_enabled)
+    return;
+  guint64 epoch=1;
+  size_t sz=sizeof(epoch);
+  size_t allocated=0, active=0, resident=0;
+  mallctl("epoch", &epoch, &sz, &epoch, sz);
+  sz=sizeof(size_t);
+  if (mallctl("stats.allocated", &allocated, &sz, NULL, 0) ||
+      mallctl("stats.active", &active, &sz, NULL, 0) ||
+      mallctl("stats.resident", &resident, &sz, NULL, 0))
+    return;
+  GString *line=g_string_sized_new(512);
+  guint slot;
+  g_mutex_lock(arenas_mutex);
+  for (slot=0; slot < ALLOCATOR_MAX_ARENAS; slot++){
+    if (arenas[slot] == 0)
+      continue;
+    g_string_append_printf(line, " | %s#%u: %.1f MB active, %.1f MB dirty", arena_names[slot], arenas[slot],
+        MB(arena_stat(arenas[slot], "pactive") * page_size), MB(arena_stat(arenas[slot], "pdirty") * page_size));
+  }
+  g_mutex_unlock(arenas_mutex);
+  g_message("Memory: %.1f MB resident, %.1f MB active, %.1f MB allocated%s", MB(resident), MB(active), MB(allocated), line->str);
+  g_string_free(line, TRUE);
+}
+
+#else
+
+void initialize_allocator(){
+  if (allocator_decay >= 0)
+    g_warning("--allocator-decay is only available when built WITH_JEMALLOC");
+}
+
+void set_thread_arena(enum affinity_group group){
+  (void) group;
+}
+
+void message_allocator_stats(){
+}
+
+#endif
@@ -0,0 +1,38 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Authors:        David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#ifndef _src_allocator_h
+#define _src_allocator_h
+
+#include <glib.h>
+#include "cpu_affinity.h"
+
+/* When built WITH_JEMALLOC every worker thread allocates from its own arena
+   and the other thread groups share one arena per group, so the buffers that
+   move between the stages of the pipeline are not all served by the same
+   arenas. --allocator-decay sets how long the unused pages are kept before
+   they are returned to the system. The statistics of the arenas are logged
+   with --queue-stats-interval */
+#define ALLOCATOR_MAX_ARENAS 64
+
+extern gint allocator_decay;
+
+void initialize_allocator();
+void set_thread_arena(enum affinity_group group);
+void message_allocator_stats();
+
+#endif
@@ -63,3 +63,25 @@ char * checksum_events_structure_from_database(MYSQL *conn, char *database, char
   return generic_checksum(conn, database, table, "SELECT COALESCE(LOWER(CONV(BIT_XOR(CAST(CRC32(REPLACE(REPLACE(REPLACE(REPLACE(EVENT_DEFINITION, CHAR(32), ''), CHAR(13), ''), CHAR(10), ''), CHAR(9), '')) AS UNSIGNED)), 10, 16)), 0) AS crc FROM information_schema.events WHERE EVENT_SCHEMA='%s';",0);
 }
 
+
+/* Order independent checksum of the rows of a chunk, so it can be calculated
+   on both sides with the same WHERE clause, no matter the order in which the
+   rows were inserted. Each row is hashed with the first 64 bits of MD5, as
+   CRC32 is linear and too narrow to be XORed over millions of rows */
+char * checksum_chunk(MYSQL *conn, const char *database, const char *table, const gchar *expression, const gchar *partition, const gchar *where, guint64 *rows){
+  const char *q=identifier_quote_character_str;
+  char *query = g_strdup_printf("SELECT COALESCE(LOWER(CONV(BIT_XOR(CAST(CONV(LEFT(MD5(%s), 16), 16, 10) AS UNSIGNED)), 10, 16)), 0), COUNT(*) FROM %s%s%s.%s%s%s %s %s %s",
+      expression, q, database, q, q, table, q, partition ? partition : "", where && *where ? "WHERE" : "", where ? where : "");
+  struct M_ROW *mr = m_store_result_row(conn, query, m_warning, m_warning, "Error dumping chunk checksum (%s.%s)", database, table);
+  g_free(query);
+  char * r=NULL;
+  if (mr->row){
+    r=g_strdup(mr->row[0]);
+    *rows=g_ascii_strtoull(mr->row[1], NULL, 10);
+  }
+  if (mr->res)
+    m_store_result_row_free(mr);
+  else
+    g_free(mr);
+  return r;
+}
@@ -15,6 +15,7 @@
     Authors:        David Ducos, Percona (david dot ducos at percona dot com)
 */
 
+#include <glib.h>
 #include <mysql.h>
 #ifndef _src_checksum_h
 #define _src_checksum_h
@@ -27,4 +28,5 @@ char * checksum_events_structure_from_database(MYSQL *conn, char *database, char
 char * checksum_view_structure(MYSQL *conn, char *database, char *table);
 char * checksum_database_defaults(MYSQL *conn, char *database, char *table);
 char * checksum_table_indexes(MYSQL *conn, char *database, char *table);
+char * checksum_chunk(MYSQL *conn, const char *database, const char *table, const gchar *expression, const gchar *partition, const gchar *where, guint64 *rows);
 #endif
@@ -29,11 +29,16 @@
 #include "config.h"
 #include "connection.h"
 #include "common_options.h"
+#include "throttle_control.h"
+#include "logging.h"
+#include "memory_budget.h"
 //#include "mydumper_global.h"
 
 extern gboolean help;
 guint errors=0;
 GList *ignore_errors_list=NULL;
+// called before a query is sent, mydumper discards the next chunk it prefetched
+void (*before_query)(MYSQL *conn)=NULL;
 GAsyncQueue *stream_queue = NULL;
 gboolean use_defer= FALSE;
 gboolean check_row_count= FALSE;
@@ -236,6 +241,10 @@ void load_per_table_info_from_key_file(GKeyFile *kf, struct configuration_per_ta
             value = g_key_file_get_value(kf,groups[i],keys[j],&error);
             g_hash_table_insert(cpt->all_rows_per_table, g_strdup(groups[i]), g_strdup(value));
           }
+          if (g_strcmp0(keys[j],"shard_column") == 0){
+            value = g_key_file_get_value(kf,groups[i],keys[j],&error);
+            g_hash_table_insert(cpt->all_shard_column_per_table, g_strdup(groups[i]), g_strdup(value));
+          }
 
         }
       }
@@ -340,8 +349,35 @@ void free_hash(GHashTable * set_session_hash){
   }
 }
 
+/* Sends every statement of ss in a single round trip. The server stops at the
+ * first statement that fails, so FALSE means that the caller must run them
+ * one by one to know which one */
+gboolean execute_gstring_batch(MYSQL *conn, GString *ss)
+{
+  int status=0;
+  MYSQL_RES *res=NULL;
+  if (ss == NULL || ss->len == 0)
+    return TRUE;
+  if (mysql_set_server_option(conn, MYSQL_OPTION_MULTI_STATEMENTS_ON))
+    return FALSE;
+  if (mysql_real_query(conn, ss->str, ss->len)){
+    status=1;
+  }else{
+    do {
+      res=mysql_store_result(conn);
+      if (res)
+        mysql_free_result(res);
+    } while ((status=mysql_next_result(conn)) == 0);
+  }
+  mysql_set_server_option(conn, MYSQL_OPTION_MULTI_STATEMENTS_OFF);
+  return status < 0;
+}
+
 void execute_gstring(MYSQL *conn, GString *ss)
 {
+  // the multi-statement switch costs 2 round trips, only worth it on long lists
+  if (ss != NULL && strcount(ss->str) > 3 && execute_gstring_batch(conn, ss))
+    return;
   if (ss != NULL ){
     gchar** line=g_strsplit(ss->str, ";\n", -1);
     int i=0;
@@ -726,7 +762,8 @@ gboolean stream_arguments_callback(const gchar *option_name,const gchar *value,
 void check_num_threads()
 {
   if (!num_threads) {
-    num_threads= g_get_num_processors();
+    // with --auto-threads it is only the maximum
+    num_threads= auto_threads ? 2 * g_get_num_processors() : g_get_num_processors();
     g_assert(num_threads > 0);
   }
 
@@ -737,6 +774,8 @@ void check_num_threads()
 }
 
 void m_message(const char *fmt, ...){
+  if (!log_level_enabled(G_LOG_LEVEL_MESSAGE))
+    return;
   va_list    args;
   va_start(args, fmt);
   gchar *c=g_strdup_vprintf(fmt,args);
@@ -745,6 +784,8 @@ void m_message(const char *fmt, ...){
 }
 
 void m_warning(const char *fmt, ...){
+  if (!log_level_enabled(G_LOG_LEVEL_WARNING))
+    return;
   va_list    args;
   va_start(args, fmt);
   gchar *c=g_strdup_vprintf(fmt,args);
@@ -868,6 +909,110 @@ gboolean read_data(FILE *file, GString *data,
   return FALSE;
 }
 
+#define STATEMENT_READER_BUFFER_SIZE 1048576
+
+struct statement_reader * new_statement_reader(FILE *file){
+  struct statement_reader *sr=g_new0(struct statement_reader, 1);
+  sr->file=file;
+  sr->size=STATEMENT_READER_BUFFER_SIZE;
+  memory_track(MEMORY_READ_BUFFERS, &(sr->memory_reserved), sr->size + 1);
+  sr->buffer=g_malloc(sr->size + 1);
+  return sr;
+}
+
+void free_statement_reader(struct statement_reader *sr){
+  memory_track(MEMORY_READ_BUFFERS, &(sr->memory_reserved), 0);
+  g_free(sr->buffer);
+  g_free(sr);
+}
+
+// Following reads are going to return the statements in [offset, offset+length)
+gboolean set_statement_reader_range(struct statement_reader *sr, guint64 offset, guint64 length){
+  if (fseek(sr->file, offset, SEEK_SET))
+    return FALSE;
+  sr->start=0;
+  sr->scanned=0;
+  sr->end=0;
+  sr->saved_position=0;
+  sr->eof=FALSE;
+  sr->limited=TRUE;
+  sr->remaining=length;
+  sr->offset=offset;
+  return TRUE;
+}
+
+// Position in the file after the last statement returned
+guint64 statement_reader_offset(struct statement_reader *sr){
+  return sr->offset + sr->start;
+}
+
+/*
+  Makes *statement point to the next statement, which is the data until the
+  next line that ends with ";\n", or the remaining data at EOF. The statement
+  is '\0' terminated inside the reader buffer and it is valid until the next
+  call. Newlines are found with memchr over the whole buffer instead of
+  reading line by line.
+*/
+gboolean read_statement(struct statement_reader *sr, gchar **statement, gsize *length, gboolean *eof, guint *line){
+  gchar *nl;
+  size_t r;
+  // Restore the byte that we replaced by '\0' on the previous call
+  if (sr->saved_position){
+    sr->buffer[sr->saved_position]=sr->saved_char;
+    sr->saved_position=0;
+  }
+  for (;;){
+    while (sr->scanned < sr->end && (nl=memchr(sr->buffer + sr->scanned, '\n', sr->end - sr->scanned))){
+      (*line)++;
+      sr->scanned= nl - sr->buffer + 1;
+      if (nl > sr->buffer + sr->start && *(nl-1) == ';'){
+        *statement= sr->buffer + sr->start;
+        *length= sr->scanned - sr->start;
+        sr->start= sr->scanned;
+        sr->saved_position= sr->scanned;
+        sr->saved_char= sr->buffer[sr->scanned];
+        sr->buffer[sr->scanned]='\0';
+        *eof=FALSE;
+        return TRUE;
+      }
+    }
+    sr->scanned=sr->end;
+    if (sr->eof){
+      *statement= sr->buffer + sr->start;
+      *length= sr->end - sr->start;
+      sr->buffer[sr->end]='\0';
+      sr->start= sr->end;
+      *eof=TRUE;
+      return TRUE;
+    }
+    // Move the pending statement to the beginning, and grow if it is full
+    if (sr->start > 0){
+      memmove(sr->buffer, sr->buffer + sr->start, sr->end - sr->start);
+      sr->offset+=sr->start;
+      sr->end-=sr->start;
+      sr->scanned-=sr->start;
+      sr->start=0;
+    }
+    if (sr->end == sr->size){
+      memory_track(MEMORY_READ_BUFFERS, &(sr->memory_reserved), sr->size * 2 + 1);
+      sr->size*=2;
+      sr->buffer=g_realloc(sr->buffer, sr->size + 1);
+    }
+    r=sr->size - sr->end;
+    if (sr->limited && r > sr->remaining)
+      r=sr->remaining;
+    r= r > 0 ? fread(sr->buffer + sr->end, 1, r, sr->file) : 0;
+    if (sr->limited)
+      sr->remaining-=r;
+    sr->end+=r;
+    if (r == 0){
+      if (ferror(sr->file))
+        return FALSE;
+      sr->eof=TRUE;
+    }
+  }
+}
+
 gchar *m_date_time_new_now_local(){
   GString *datetimestr=g_string_sized_new(26);
   GDateTime *datetime = g_date_time_new_now_local();
@@ -1050,10 +1195,12 @@ void set_thread_name(const char *format, ...)
   __thread_name= __name_buf;
 }
 
-void trace(const char *format, ...)
+const char *get_thread_name(){
+  return __thread_name;
+}
+
+void m_trace(const char *format, ...)
 {
-  if (!debug)
-    return;
   char format2[1024];
   char msg[1024];
   if (__thread_name)
@@ -1073,6 +1220,10 @@ void print_int(const char*_key, int val){
   printf("%s%*s= %d\n",_key, WIDTH-(int)(strlen(_key)),"", val);
 }
 
+void print_double(const char*_key, gdouble val){
+  printf("%s%*s= %g\n",_key, WIDTH-(int)(strlen(_key)),"", val);
+}
+
 void print_string(const char*_key, const char *val){
   if (val)
     printf("%s%*s= %s\n",_key, WIDTH-(int)(strlen(_key)),"", val);
@@ -1116,60 +1267,146 @@ void finish_alter_table(GString * alter_table_statement){
     g_string_append(alter_table_statement,";\n");
 }
 
-int global_process_create_table_statement (gchar * statement, GString *create_table_statement, GString *alter_table_statement, GString *alter_table_constraint_statement, gchar *real_table, gboolean split_indexes){
+// Name of a quoted identifier that starts after the quote, doubled quotes included
+static
+gchar *quoted_identifier(const gchar *from){
+  const gchar *to=from;
+  while (*to && !(*to == identifier_quote_character && to[1] != identifier_quote_character))
+    to+= *to == identifier_quote_character ? 2 : 1;
+  return *to ? g_strndup(from, to - from) : NULL;
+}
+
+static
+enum table_line_type classify_table_line(struct table_definition *def, gchar *line){
+  const char q=identifier_quote_character;
+  if (def->name == NULL && g_strstr_len(line, -1, "CREATE TABLE ")){
+    // the name is the identifier before the (
+    gchar *from=strchr(line, q), *to;
+    if (from){
+      for (to=from + 1; *to; to++){
+        if (*to == q){
+          gchar *c=to + 1;
+          while (g_ascii_isspace(*c))
+            c++;
+          if (*c == '(' && to > from + 1){
+            def->name=g_strndup(from + 1, to - from - 1);
+            break;
+          }
+        }
+      }
+    }
+    return TABLE_LINE_OTHER;
+  }
+  if (g_str_has_prefix(line, "  ")){
+    gchar *c=line + 2;
+    if (*c == q){
+      gchar *column=quoted_identifier(c + 1);
+      if (column == NULL)
+        return TABLE_LINE_OTHER;
+      if (g_strrstr(c, "AUTO_INCREMENT")){
+        g_free(def->auto_increment_column);
+        def->auto_increment_column=g_strdup(column);
+      }
+      g_ptr_array_add(def->columns, column);
+      return TABLE_LINE_COLUMN;
+    }
+    if (g_str_has_prefix(c, "PRIMARY KEY"))
+      return TABLE_LINE_PRIMARY_KEY;
+    if (g_str_has_prefix(c, "FULLTEXT"))
+      return TABLE_LINE_FULLTEXT;
+    if (g_str_has_prefix(c, "KEY") || g_str_has_prefix(c, "UNIQUE") || g_str_has_prefix(c, "SPATIAL") || g_str_has_prefix(c, "INDEX"))
+      return TABLE_LINE_INDEX;
+    if (g_str_has_prefix(c, "CONSTRAINT"))
+      return TABLE_LINE_CONSTRAINT;
+    return TABLE_LINE_OTHER;
+  }
+  if (*line == ')'){
+    gchar *engine=g_strrstr(line, "ENGINE=");
+    if (engine){
+      engine+=strlen("ENGINE=");
+      def->engine=g_strndup(engine, strcspn(engine, " ;"));
+    }
+    return TABLE_LINE_OPTIONS;
+  }
+  return TABLE_LINE_OTHER;
+}
+
+/* Single pass over the statement, the result is kept on the table so it is
+   not parsed again for the indexes, the constraints or the columns */
+struct table_definition *parse_table_definition(const gchar *statement){
+  struct table_definition *def=g_new0(struct table_definition, 1);
+  guint allocated=0;
+  def->buffer=g_strdup(statement);
+  def->columns=g_ptr_array_new_with_free_func(g_free);
+  gchar *line=def->buffer, *next;
+  while (line){
+    next=strchr(line, '\n');
+    if (next)
+      *next='\0';
+    if (def->num_lines == allocated){
+      allocated= allocated ? allocated * 2 : 64;
+      def->lines=g_renew(struct table_line, def->lines, allocated);
+    }
+    struct table_line *tl=&(def->lines[def->num_lines++]);
+    tl->text=line;
+    tl->type=classify_table_line(def, line);
+    line= next ? next + 1 : NULL;
+  }
+  return def;
+}
+
+void free_table_definition(struct table_definition *def){
+  if (def == NULL)
+    return;
+  g_free(def->buffer);
+  g_free(def->name);
+  g_free(def->lines);
+  g_ptr_array_free(def->columns, TRUE);
+  g_free(def->auto_increment_column);
+  g_free(def->engine);
+  g_free(def);
+}
+
+int process_table_definition(struct table_definition *def, GString *create_table_statement, GString *alter_table_statement, GString *alter_table_constraint_statement, gchar *real_table, gboolean split_indexes){
   int flag=0;
-  gchar** split_file= g_strsplit(statement, "\n", -1);
-  gchar *autoinc_column=NULL;
+  // an index that starts with the AUTO_INCREMENT column is kept
+  gchar *autoinc_column= def->auto_increment_column ? g_strdup_printf("(`%s`", def->auto_increment_column) : NULL;
   append_alter_table(alter_table_statement, real_table);
   append_alter_table(alter_table_constraint_statement, real_table);
   int fulltext_counter=0;
-  int i=0;
-  gchar *engine_pos=NULL;
-  for (i=0; i < (int)g_strv_length(split_file);i++){
-    if (split_indexes &&( g_strstr_len(split_file[i],5,"  KEY")
-      || g_strstr_len(split_file[i],8,"  UNIQUE")
-      || g_strstr_len(split_file[i],9,"  SPATIAL")
-      || g_strstr_len(split_file[i],10,"  FULLTEXT")
-      || g_strstr_len(split_file[i],7,"  INDEX")
-      )){
-      // Ignore if the first column of the index is the AUTO_INCREMENT column
-      if ((autoinc_column != NULL) && (g_strrstr(split_file[i],autoinc_column))){
-        g_string_append(create_table_statement, split_file[i]);
+  guint i=0;
+  for (i=0; i < def->num_lines; i++){
+    struct table_line *tl=&(def->lines[i]);
+    if (split_indexes && (tl->type == TABLE_LINE_INDEX || tl->type == TABLE_LINE_FULLTEXT)){
+      if ((autoinc_column != NULL) && (g_strrstr(tl->text,autoinc_column))){
+        g_string_append(create_table_statement, tl->text);
         g_string_append_c(create_table_statement,'\n');
       }else{
         flag|=IS_ALTER_TABLE_PRESENT;
-        if (g_strrstr(split_file[i],"  FULLTEXT")) fulltext_counter++;
+        if (tl->type == TABLE_LINE_FULLTEXT) fulltext_counter++;
         if (fulltext_counter>1){
           fulltext_counter=1;
           finish_alter_table(alter_table_statement);
           append_alter_table(alter_table_statement,real_table);
         }
         g_string_append(alter_table_statement,"\n ADD");
-        g_string_append(alter_table_statement, split_file[i]);
+        g_string_append(alter_table_statement, tl->text);
       }
+    }else if (tl->type == TABLE_LINE_CONSTRAINT){
+      flag|=INCLUDE_CONSTRAINT;
+      g_string_append(alter_table_constraint_statement,"\n ADD");
+      g_string_append(alter_table_constraint_statement, tl->text);
     }else{
-      if (g_strstr_len(split_file[i],12,"  CONSTRAINT")){
-        flag|=INCLUDE_CONSTRAINT;
-        g_string_append(alter_table_constraint_statement,"\n ADD");
-        g_string_append(alter_table_constraint_statement, split_file[i]);
-      }else{
-        if (g_strrstr(split_file[i],"AUTO_INCREMENT")){
-          gchar** autoinc_split=g_strsplit(split_file[i],"`",3);
-          autoinc_column=g_strdup_printf("(`%s`", autoinc_split[1]);
-        }
-        g_string_append(create_table_statement, split_file[i]);
-        g_string_append_c(create_table_statement,'\n');
-      }
-    }
-    engine_pos=g_strrstr(split_file[i],"ENGINE=");
-    if (engine_pos){
-      engine_pos+=7;
-      guint j=0;
-      for( j=0; j<g_strv_length(optimize_key_engines); j++)
-        if (g_str_has_prefix(engine_pos, optimize_key_engines[j]))
-          flag|=IS_TRX_TABLE;
+      g_string_append(create_table_statement, tl->text);
+      g_string_append_c(create_table_statement,'\n');
     }
   }
+  if (def->engine){
+    for (i=0; i<g_strv_length(optimize_key_engines); i++)
+      if (g_str_has_prefix(def->engine, optimize_key_engines[i]))
+        flag|=IS_TRX_TABLE;
+  }
+  g_free(autoinc_column);
   g_string_replace(create_table_statement,",\n)","\n)", 0);
   finish_alter_table(alter_table_statement);
   finish_alter_table(alter_table_constraint_statement);
@@ -1190,6 +1427,8 @@ void initialize_conf_per_table(struct configuration_per_table *cpt){
   cpt->all_partition_regex_per_table=g_hash_table_new ( g_str_hash, g_str_equal );
 
   cpt->all_rows_per_table=g_hash_table_new ( g_str_hash, g_str_equal );
+
+  cpt->all_shard_column_per_table=g_hash_table_new ( g_str_hash, g_str_equal );
 }
 
 gboolean str_list_has_str(gchar ** str_list, const gchar* str){
@@ -1321,6 +1560,8 @@ static void m_log(MYSQL *conn, void log_fun_1(const char *, ...), void log_fun_2
 }
 
 static gboolean m_queryv(  MYSQL *conn, const gchar *query, void log_fun_1(const char *, ...), void log_fun_2(const char *, ...), const char *fmt, va_list args){
+  if (before_query)
+    before_query(conn);
   if (mysql_query(conn, query)){
     m_log(conn, log_fun_1, log_fun_2, fmt, args);
     return TRUE;
@@ -1487,3 +1728,95 @@ void *monitor_throttling_thread (void *queue){
 
   return NULL;
 }
+
+// Buffers are cached per thread first and then shared, so a thread that
+// restores file after file reuses the same buffers. The pooled buffers are
+// taken from the --max-memory budget
+struct gstring_pool_cache{
+  GString *slots[GSTRING_POOL_THREAD_CLASSES][GSTRING_POOL_THREAD_SLOTS];
+  guint count[GSTRING_POOL_THREAD_CLASSES];
+};
+
+static __thread struct gstring_pool_cache *gstring_pool_cache=NULL;
+static GAsyncQueue *gstring_pool[GSTRING_POOL_CLASSES];
+// drains the cache of a thread when it ends
+static GPrivate *gstring_pool_cache_owner=NULL;
+
+static
+void gstring_pool_free(GString *str){
+  memory_release_idle(MEMORY_POOLED_BUFFERS, str->allocated_len);
+  g_string_free(str, TRUE);
+}
+
+static
+void gstring_pool_push(guint c, GString *str){
+  if (g_async_queue_length(gstring_pool[c]) < GSTRING_POOL_GLOBAL_SLOTS)
+    g_async_queue_push(gstring_pool[c], str);
+  else
+    gstring_pool_free(str);
+}
+
+// Runs on the thread that ends, its buffers go to the shared pool
+static
+void gstring_pool_cache_end(gpointer data){
+  struct gstring_pool_cache *cache=data;
+  guint c;
+  for (c=0; c<GSTRING_POOL_THREAD_CLASSES; c++)
+    while (cache->count[c] > 0){
+      cache->count[c]--;
+      gstring_pool_push(c, cache->slots[c][cache->count[c]]);
+    }
+  g_free(cache);
+}
+
+void initialize_gstring_pool(){
+  guint i;
+  gstring_pool_cache_owner=g_private_new(gstring_pool_cache_end);
+  for (i=0; i<GSTRING_POOL_CLASSES; i++)
+    gstring_pool[i]=g_async_queue_new();
+}
+
+GString *gstring_pool_get(gsize size){
+  guint c=0;
+  GString *str=NULL;
+  while (c < GSTRING_POOL_CLASSES && ((gsize)GSTRING_POOL_MIN_SIZE << c) < size)
+    c++;
+  if (c == GSTRING_POOL_CLASSES || gstring_pool[0] == NULL)
+    return g_string_sized_new(size);
+  if (c < GSTRING_POOL_THREAD_CLASSES && gstring_pool_cache && gstring_pool_cache->count[c] > 0){
+    gstring_pool_cache->count[c]--;
+    str=gstring_pool_cache->slots[c][gstring_pool_cache->count[c]];
+  }else
+    str=g_async_queue_try_pop(gstring_pool[c]);
+  if (str == NULL)
+    return g_string_sized_new(((gsize)GSTRING_POOL_MIN_SIZE << c) - 1);
+  memory_release_idle(MEMORY_POOLED_BUFFERS, str->allocated_len);
+  g_string_truncate(str, 0);
+  return str;
+}
+
+void gstring_pool_put(GString *str){
+  guint c=0;
+  if (gstring_pool[0] == NULL || str->allocated_len < GSTRING_POOL_MIN_SIZE ||
+      str->allocated_len >= ((gsize)GSTRING_POOL_MIN_SIZE << GSTRING_POOL_CLASSES) ||
+      !memory_reserve_idle(MEMORY_POOLED_BUFFERS, str->allocated_len)){
+    g_string_free(str, TRUE);
+    return;
+  }
+  // the class that can be served with this buffer
+  while (c + 1 < GSTRING_POOL_CLASSES && ((gsize)GSTRING_POOL_MIN_SIZE << (c + 1)) <= str->allocated_len)
+    c++;
+  if (c >= GSTRING_POOL_THREAD_CLASSES){
+    gstring_pool_push(c, str);
+    return;
+  }
+  if (gstring_pool_cache == NULL){
+    gstring_pool_cache=g_new0(struct gstring_pool_cache, 1);
+    g_private_set(gstring_pool_cache_owner, gstring_pool_cache);
+  }
+  if (gstring_pool_cache->count[c] < GSTRING_POOL_THREAD_SLOTS){
+    gstring_pool_cache->slots[c][gstring_pool_cache->count[c]]=str;
+    gstring_pool_cache->count[c]++;
+  }else
+    gstring_pool_push(c, str);
+}
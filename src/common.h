@@ -50,12 +50,17 @@
 #define ZSTD "zstd"
 #define ZSTD_EXTENSION ".zst"
 #define GZIP_EXTENSION ".gz"
+// Seek table of the zstd seekable format, on a skippable frame at the end
+#define SEEKABLE_SKIPPABLE_MAGIC 0x184D2A5E
+#define SEEKABLE_MAGIC 0x8F92EAB1
+#define SEEKABLE_FOOTER_SIZE 9
 #define EMPTY_STRING ""
 #define CAST "CAST("
 #define AS_BINARY "AS BINARY)"
 #define BINARY_CHARSET "binary"
 #define AUTO_CHARSET "auto"
 extern GList *ignore_errors_list;
+extern void (*before_query)(MYSQL *conn);
 extern const gchar *start_replica;
 extern const gchar *stop_replica;
 extern const gchar *start_replica_sql_thread;
@@ -91,6 +96,7 @@ struct configuration_per_table{
   GHashTable *all_object_to_export;
   GHashTable *all_partition_regex_per_table;
   GHashTable *all_rows_per_table;
+  GHashTable *all_shard_column_per_table;
 };
 
 struct M_ROW{
@@ -98,10 +104,62 @@ struct M_ROW{
   MYSQL_ROW row;
 };
 
+/* A CREATE TABLE as SHOW CREATE TABLE writes it, split once in its lines:
+   the header, a line per column, index or constraint and the options */
+enum table_line_type { TABLE_LINE_OTHER, TABLE_LINE_COLUMN, TABLE_LINE_PRIMARY_KEY, TABLE_LINE_INDEX, TABLE_LINE_FULLTEXT, TABLE_LINE_CONSTRAINT, TABLE_LINE_OPTIONS };
+
+struct table_line {
+  enum table_line_type type;
+  gchar *text;
+};
+
+struct table_definition {
+  // copy of the statement, every line is NUL terminated
+  gchar *buffer;
+  gchar *name;
+  struct table_line *lines;
+  guint num_lines;
+  // names of the columns, in order and as they are quoted
+  GPtrArray *columns;
+  gchar *auto_increment_column;
+  gchar *engine;
+};
+
+struct statement_reader{
+  FILE *file;
+  gchar *buffer;
+  gsize size;
+  gsize start;
+  gsize scanned;
+  gsize end;
+  gsize saved_position;
+  gchar saved_char;
+  gboolean eof;
+  // set by set_statement_reader_range(), bytes that are left to read
+  gboolean limited;
+  guint64 remaining;
+  // position in the file of buffer[0]
+  guint64 offset;
+  // bytes of buffer reserved from --max-memory
+  gsize memory_reserved;
+};
+
 #define STREAM_BUFFER_SIZE 1000000
 #define STREAM_BUFFER_SIZE_NO_STREAM 100
+// --stream-lanes framed protocol: the magic is sent once, then every frame is
+// a type byte, the file id and the payload length as big endian 32 bits
+// integers and the payload. OPEN payload is the 64 bits file size followed by
+// the filename, CLOSE and END have no payload
+#define STREAM_LANES_MAGIC "\n-- MYDUMPER_STREAM_LANES 1\n"
+#define STREAM_FRAME_HEADER_SIZE 9
+#define STREAM_FRAME_OPEN 'O'
+#define STREAM_FRAME_DATA 'D'
+#define STREAM_FRAME_CLOSE 'C'
+#define STREAM_FRAME_END 'E'
 #define DEFAULTS_FILE "/etc/mydumper.cnf"
 struct function_pointer;
+struct format_item;
+struct masquerade_cache;
 typedef gchar * (*fun_ptr)(gchar **,gulong*, struct function_pointer*);
 
 struct function_pointer{
@@ -115,12 +173,19 @@ struct function_pointer{
   // Used inside the function
   GList *parse;
   GList *delimiters;
-  GHashTable *memory;
+  struct masquerade_cache *memory;
   gboolean replace_null;
   guint max_length;
   guint null_max_length;
-  GList *unique_list;
+  GHashTable *unique_set;
   gboolean unique;
+  // random_format items compiled into an array by parse_random_format
+  struct format_item **program;
+  guint program_length;
+  // seeded from the keyed hash of the value when --masquerade-key is used
+  gboolean deterministic;
+  GMutex *unique_mutex;
+  struct masquerade_cache *cache;
 };
 
 gchar * remove_new_line(gchar *to);
@@ -131,6 +196,7 @@ gboolean m_remove(gchar * directory, const gchar * filename);
 GKeyFile * load_config_file(gchar * config_file);
 void load_config_group(GKeyFile *kf, GOptionContext *context, const gchar * group);
 void execute_gstring(MYSQL *conn, GString *ss);
+gboolean execute_gstring_batch(MYSQL *conn, GString *ss);
 gchar *replace_escaped_strings(gchar *c);
 void escape_tab_with(gchar *to);
 void load_hash_from_key_file(GKeyFile *kf, GHashTable * set_session_hash, const gchar * group_variables);
@@ -169,9 +235,15 @@ void m_message(const char *fmt, ...);
 void load_hash_of_all_variables_perproduct_from_key_file(GKeyFile *kf, GHashTable * set_session_hash, const gchar *str);
 GRecMutex * g_rec_mutex_new();
 gboolean read_data(FILE *file, GString *data, gboolean *eof, guint *line);
+struct statement_reader * new_statement_reader(FILE *file);
+void free_statement_reader(struct statement_reader *sr);
+gboolean read_statement(struct statement_reader *sr, gchar **statement, gsize *length, gboolean *eof, guint *line);
+gboolean set_statement_reader_range(struct statement_reader *sr, guint64 offset, guint64 length);
+guint64 statement_reader_offset(struct statement_reader *sr);
 gchar *m_date_time_new_now_local();
 
 void print_int(const char*_key, int val);
+void print_double(const char*_key, gdouble val);
 void print_string(const char*_key, const char *val);
 void print_bool(const char*_key, gboolean val);
 void print_list(const char*_key, GList *list);
@@ -183,7 +255,12 @@ char * backtick_protect(char *r);
 char * newline_protect(char *r);
 char * newline_unprotect(char *r);
 void set_thread_name(const char *format, ...);
-extern void trace(const char *format, ...);
+const char *get_thread_name();
+extern gboolean debug;
+extern void m_trace(const char *format, ...);
+// debug is checked before the arguments are evaluated and formatted
+#define trace(...) \
+  do { if (G_UNLIKELY(debug)) m_trace(__VA_ARGS__); } while (0)
 #define message(...) \
   if (debug) \
     trace(__VA_ARGS__); \
@@ -205,7 +282,9 @@ g_string_replace (GString     *string,
 extern guint g_get_num_processors (void);
 #endif
 char *show_warnings_if_possible(MYSQL *conn);
-int global_process_create_table_statement (gchar * statement, GString *create_table_statement, GString *alter_table_statement, GString *alter_table_constraint_statement, gchar *real_table, gboolean split_indexes);
+struct table_definition *parse_table_definition(const gchar *statement);
+void free_table_definition(struct table_definition *def);
+int process_table_definition(struct table_definition *def, GString *create_table_statement, GString *alter_table_statement, GString *alter_table_constraint_statement, gchar *real_table, gboolean split_indexes);
 void initialize_conf_per_table(struct configuration_per_table *cpt);
 void parse_object_to_export(struct object_to_export *object_to_export,gchar *val);
 gchar *build_dbt_key(gchar *a, gchar *b);
@@ -228,3 +307,14 @@ void *monitor_throttling_thread (void *queue);
 gchar *set_names_statement_template(gchar *_set_names);
 void execute_set_names(MYSQL *conn, gchar *_set_names);
 gchar * common_build_schema_table_filename(gchar *_directory, char *database, char *table, const char *suffix);
+// GString pool by size class, the smallest is GSTRING_POOL_MIN_SIZE and each
+// class doubles the previous one
+#define GSTRING_POOL_MIN_SIZE 4096
+#define GSTRING_POOL_CLASSES 15
+#define GSTRING_POOL_THREAD_SLOTS 4
+// bigger classes are only kept in the shared pool
+#define GSTRING_POOL_THREAD_CLASSES 9
+#define GSTRING_POOL_GLOBAL_SLOTS 64
+void initialize_gstring_pool();
+GString *gstring_pool_get(gsize size);
+void gstring_pool_put(GString *str);
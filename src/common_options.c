@@ -22,6 +22,14 @@
 #include "common.h"
 #include "config.h"
 #include "common_options.h"
+#include "memory_budget.h"
+#include "cpu_affinity.h"
+#include "allocator.h"
+#include "metrics.h"
+#include "throttle_control.h"
+#include "span_trace.h"
+#include "queue_stats.h"
+#include "run_report.h"
 char *defaults_file = NULL;
 char *defaults_extra_file = NULL;
 
@@ -179,12 +187,42 @@ GOptionEntry common_entries[] = {
     {"throttle", 0, G_OPTION_FLAG_OPTIONAL_ARG, G_OPTION_ARG_CALLBACK, &common_arguments_callback,
       "Expects a string like Threads_running=10. It will check the SHOW GLOBAL STATUS and if it is higher, it will increase the sleep time between SELECT. "
       "If option is used without parameters it will use Threads_running and the amount of threads", NULL},
+    {"throttle-control", 0, 0, G_OPTION_ARG_STRING, &throttle_control,
+      "Reduces the amount of statements running on the server instead of sleeping when the server is under pressure, --throttle is not applied while it is used. "
+      "Expects a list like threads_running=40,replica_lag=30,history_length=1000000, any of them can be omitted", NULL},
+    {"auto-threads", 0, 0, G_OPTION_ARG_NONE, &auto_threads,
+      "Starts with a few statements running at the same time and allows more while the rows or bytes per second improve, "
+      "stopping when --throttle-control reports the server as saturated. --threads is the maximum, twice the CPUs when not set. "
+      "mydumper writes the result in the metadata and myloader starts from it", NULL},
+    {"max-memory", 0, 0, G_OPTION_ARG_INT, &max_memory,
+      "Amount of MB that the row and statement buffers can use. When it is reached, the threads wait for memory to be released. Default: 0 (unlimited)", NULL},
+    {"metrics-listen", 0, 0, G_OPTION_ARG_STRING, &metrics_listen,
+      "Serve Prometheus metrics over HTTP on [host:]port. Without host it listens on all the addresses", NULL},
+    {"trace-file", 0, 0, G_OPTION_ARG_FILENAME, &trace_file,
+      "Write the spans of the chunks, writes and inserts to this file in Chrome trace format, it can be opened with Perfetto", NULL},
+    {"report", 0, 0, G_OPTION_ARG_NONE, &run_report,
+      "Logs a summary of the run when it ends: wall, busy and CPU time of each phase, CPU of each thread group "
+      "and the slowest tables and jobs", NULL},
+    {"report-file", 0, 0, G_OPTION_ARG_FILENAME, &run_report_file,
+      "Writes the summary of --report to this file as JSON", NULL},
+    {"cpu-affinity", 0, 0, G_OPTION_ARG_STRING, &cpu_affinity,
+      "CPUs of each thread group. numa spreads the threads of every group over the NUMA nodes, none disables it, "
+      "or a list like workers=0-7;compress=8-15 with the groups workers, schema, index, post, compress and io, "
+      "the groups not listed use numa. Default: numa", NULL},
+    {"queue-stats-interval", 0, 0, G_OPTION_ARG_INT, &queue_stats_interval,
+      "Logs the depth, the jobs per second and the time waiting of every queue of the pipeline each N seconds. "
+      "The same values are always served by --metrics-listen. When built WITH_JEMALLOC it also logs the resident "
+      "and active memory of the process and of each arena. Default: 0 (disabled)", NULL},
+    {"allocator-decay", 0, 0, G_OPTION_ARG_INT, &allocator_decay,
+      "Milliseconds that jemalloc keeps the unused pages of the arenas before returning them to the system, "
+      "0 returns them at once. Only when built WITH_JEMALLOC. Default: -1 (jemalloc default)", NULL},
     {NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL}};
 
 GOptionEntry common_filter_entries[] = {
     {"omit-from-file", 'O', 0, G_OPTION_ARG_STRING, &tables_skiplist_file,
       "File containing a list of database.table entries to skip, one per line "
-      "(skips before applying regex option)", NULL},
+      "(skips before applying regex option). Entries ending with * skip every name "
+      "that starts with them, like db.tmp_*", NULL},
     {"tables-list", 'T', 0, G_OPTION_ARG_STRING, &tables_list,
       "Comma delimited table list to dump (does not exclude regex option). "
       "Table name must include database name. For instance: test.t1,test.t2", NULL},
@@ -24,6 +24,7 @@
 #include "config.h"
 #include "connection.h"
 #include "common.h"
+#include "run_report.h"
 
 char *hostname = NULL;
 char *username = NULL;
@@ -49,6 +50,8 @@ gchar *ssl_mode=NULL;
 #endif
 
 gboolean compress_protocol = FALSE;
+gchar *compression_algorithms = NULL;
+guint zstd_compression_level = 0;
 gboolean enable_cleartext_plugin = FALSE;
 
 #if defined(HAVE_MY_BOOL)
@@ -91,6 +94,10 @@ GOptionEntry connection_entries[] = {
      "The protocol to use for connection (tcp, socket)", NULL},
     {"compress-protocol", 'C', 0, G_OPTION_ARG_NONE, &compress_protocol,
      "Use compression on the MySQL connection", NULL},
+    {"compression-algorithms", 0, 0, G_OPTION_ARG_STRING, &compression_algorithms,
+     "Permitted compression algorithms on the MySQL connection, in order of preference: zstd, zlib, uncompressed", NULL},
+    {"zstd-compression-level", 0, 0, G_OPTION_ARG_INT, &zstd_compression_level,
+     "Compression level of zstd on the MySQL connection, from 1 to 22. Default: 3", NULL},
 #ifdef WITH_SSL
     {"ssl", 0, 0, G_OPTION_ARG_NONE, &ssl, "Connect using SSL", NULL},
     {"ssl-mode", 0, 0, G_OPTION_ARG_STRING, &ssl_mode,
@@ -133,6 +140,71 @@ void set_connection_defaults_file_and_group(gchar *cdf, const gchar *group){
 void initialize_connection(const gchar *app){
   program_name=app;
   set_names_statement=set_names_statement_template(set_names_in_conn_by_default);
+  if (zstd_compression_level > 22)
+    m_critical("--zstd-compression-level must be between 1 and 22");
+  if (compression_algorithms){
+    gchar **list=g_strsplit(compression_algorithms, ",", 0);
+    guint i;
+    for (i=0; list[i]; i++){
+      g_strstrip(list[i]);
+      if (g_ascii_strcasecmp(list[i], "zstd") && g_ascii_strcasecmp(list[i], "zlib") && g_ascii_strcasecmp(list[i], "uncompressed"))
+        m_critical("Compression algorithm %s is not valid, it must be zstd, zlib or uncompressed", list[i]);
+    }
+    g_strfreev(list);
+  }
+#if defined(LIBMARIADB) || MYSQL_VERSION_ID < 80018
+  // Only zlib is available through MYSQL_OPT_COMPRESS
+  if (compression_algorithms && g_ascii_strcasecmp(compression_algorithms, "uncompressed")){
+    g_warning("This client library does not support --compression-algorithms, zlib compression is used");
+    compress_protocol=TRUE;
+  }
+  if (zstd_compression_level)
+    g_warning("This client library does not support zstd, --zstd-compression-level is ignored");
+#endif
+}
+
+gboolean wire_compression_enabled(){
+#if defined(LIBMARIADB) || MYSQL_VERSION_ID < 80018
+  return compress_protocol;
+#else
+  return compress_protocol || (compression_algorithms && g_ascii_strcasecmp(compression_algorithms, "uncompressed"));
+#endif
+}
+
+/* The server counts the bytes of the connection once compressed. They are
+   compared with the payload that the caller accounted: the values fetched by
+   mydumper or the statements and files sent by myloader */
+void report_wire_compression(MYSQL *conn, const gchar *label, guint64 payload_bytes, gboolean sent){
+  if (!wire_compression_enabled() || conn == NULL)
+    return;
+  const gchar *query="SHOW SESSION STATUS WHERE Variable_name IN ('Bytes_sent','Bytes_received','Compression','Compression_algorithm')";
+  if (mysql_query(conn, query)){
+    g_warning("%s: not able to get the compression status: %s", label, mysql_error(conn));
+    return;
+  }
+  MYSQL_RES *res=mysql_store_result(conn);
+  if (res == NULL)
+    return;
+  MYSQL_ROW row;
+  guint64 wire_bytes=0;
+  const gchar *algorithm=compress_protocol ? "zlib" : compression_algorithms;
+  gchar *compression=NULL;
+  while ((row=mysql_fetch_row(res))){
+    if (row[0] == NULL || row[1] == NULL)
+      continue;
+    if (!g_ascii_strcasecmp(row[0], sent ? "Bytes_received" : "Bytes_sent"))
+      wire_bytes=g_ascii_strtoull(row[1], NULL, 10);
+    else if (!g_ascii_strcasecmp(row[0], "Compression_algorithm") && *row[1])
+      algorithm=row[1];
+    else if (!g_ascii_strcasecmp(row[0], "Compression"))
+      compression=row[1];
+  }
+  if (compression && g_ascii_strcasecmp(compression, "ON"))
+    g_message("%s: the connection is not compressed, the server did not accept it", label);
+  else if (wire_bytes > 0)
+    g_message("%s: %s wire compression, %"G_GUINT64_FORMAT" bytes %s as %"G_GUINT64_FORMAT" on the wire, ratio %.2f",
+              label, algorithm, payload_bytes, sent ? "sent" : "received", wire_bytes, (gdouble)payload_bytes / wire_bytes);
+  mysql_free_result(res);
 }
 
 
@@ -181,6 +253,10 @@ void configure_connection(MYSQL *conn) {
   g_free(version);
   
   m_options(conn, MYSQL_OPT_COMPRESS, compress_protocol, NULL);
+#if !defined(LIBMARIADB) && MYSQL_VERSION_ID >= 80018
+  m_options(conn, MYSQL_OPT_COMPRESSION_ALGORITHMS, compression_algorithms != NULL, compression_algorithms);
+  m_options(conn, MYSQL_OPT_ZSTD_COMPRESSION_LEVEL, zstd_compression_level > 0, &zstd_compression_level);
+#endif
   m_options(conn, MYSQL_OPT_PROTOCOL, protocol!=MYSQL_PROTOCOL_DEFAULT, &protocol);
 
 #ifdef WITH_SSL
@@ -308,16 +384,29 @@ void print_connection_details_once(){
 }
 
 
-void m_connect(MYSQL *conn){
+static
+void real_connect(MYSQL *conn, const gchar *host, guint host_port, const gchar *socket_file){
+  struct report_mark mark;
+  report_start(&mark);
   configure_connection(conn);
-  if (!mysql_real_connect(conn, hostname, username, password, default_connection_database?default_connection_database:"INFORMATION_SCHEMA", port,
-                          socket_path, 0)) {
-    m_critical("Error connection to database: %s", mysql_error(conn));
+  if (!mysql_real_connect(conn, host, username, password, default_connection_database?default_connection_database:"INFORMATION_SCHEMA", host_port,
+                          socket_file, 0)) {
+    m_critical("Error connection to database%s%s: %s", host ? " on " : "", host ? host : "", mysql_error(conn));
   }
   print_connection_details_once();
 
 //  if (set_names_statement)
     m_query_warning(conn, set_names_statement, "Not able to execute SET NAMES statement at connect", NULL);
+  report_end(REPORT_CONNECT, &mark, 0);
+}
+
+void m_connect(MYSQL *conn){
+  real_connect(conn, hostname, port, socket_path);
+}
+
+// Same credentials and options, on another server
+void m_connect_to_host(MYSQL *conn, const gchar *host, guint host_port){
+  real_connect(conn, host, host_port ? host_port : port, NULL);
 }
 
 void hide_password(int argc, char *argv[]){
@@ -344,5 +433,8 @@ void ask_password(){
   if (sizeof(password) == 0 || (password == NULL && askPassword)) {
     password = passwordPrompt();
   }
+  // the shards of --shard-hosts receive the password in the environment
+  if (password == NULL && g_getenv("MYSQL_PWD"))
+    password = g_strdup(g_getenv("MYSQL_PWD"));
 }
 
@@ -21,9 +21,12 @@
 void initialize_connection(const gchar *app);
 void set_connection_defaults_file_and_group(gchar *cdf, const gchar *group);
 void m_connect(MYSQL *conn);
+void m_connect_to_host(MYSQL *conn, const gchar *host, guint host_port);
 void hide_password(int argc, char *argv[]);
 void ask_password();
 GOptionGroup * load_connection_entries(GOptionContext *context);
+gboolean wire_compression_enabled();
+void report_wire_compression(MYSQL *conn, const gchar *label, guint64 payload_bytes, gboolean sent);
 
 extern char *hostname;
 extern char *username;
@@ -40,5 +43,7 @@ extern gboolean ssl;
 extern gchar *ssl_mode;
 extern char *cipher;
 extern gboolean compress_protocol;
+extern gchar *compression_algorithms;
+extern guint zstd_compression_level;
 extern char *protocol_str;
 #endif
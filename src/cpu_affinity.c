@@ -0,0 +1,191 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Authors:        David Ducos, Percona (david dot ducos at percona dot com)
+*/
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include "common.h"
+#include "cpu_affinity.h"
+#include "allocator.h"
+#include "run_report.h"
+
+gchar *cpu_affinity=NULL;
+
+const gchar *affinity_group_name[AFFINITY_GROUPS]={"workers", "schema", "index", "post", "compress", "io"};
+
+#ifdef __linux__
+#define MAX_NUMA_NODES 64
+
+static gboolean affinity_enabled=FALSE;
+static cpu_set_t process_cpus;
+static cpu_set_t node_cpus[MAX_NUMA_NODES];
+static guint num_nodes=0;
+static cpu_set_t group_cpus[AFFINITY_GROUPS];
+static gboolean group_explicit[AFFINITY_GROUPS];
+// the nodes with CPUs of the group, the threads are assigned round robin
+static guint group_nodes[AFFINITY_GROUPS][MAX_NUMA_NODES];
+static guint group_num_nodes[AFFINITY_GROUPS];
+static gint group_next[AFFINITY_GROUPS];
+
+// Parses lists like 0-3,8,10-11, the format of the sysfs cpulist files
+static
+gboolean parse_cpu_list(const gchar *list, cpu_set_t *set){
+  CPU_ZERO(set);
+  gchar **ranges=g_strsplit(list, ",", 0);
+  gboolean r=TRUE;
+  guint i;
+  for (i=0; ranges[i] != NULL && r; i++){
+    gchar *range=g_strstrip(ranges[i]);
+    if (*range == '\0')
+      continue;
+    gchar *end=NULL;
+    guint64 from=g_ascii_strtoull(range, &end, 10), to=from;
+    if (end == range)
+      r=FALSE;
+    else if (*end == '-')
+      to=g_ascii_strtoull(end + 1, &end, 10);
+    if (*end != '\0' || to < from || to >= CPU_SETSIZE)
+      r=FALSE;
+    for (; r && from <= to; from++)
+      CPU_SET(from, set);
+  }
+  g_strfreev(ranges);
+  return r;
+}
+
+static
+void load_numa_nodes(){
+  GDir *dir=g_dir_open("/sys/devices/system/node", 0, NULL);
+  if (!dir)
+    return;
+  const gchar *name=NULL;
+  while ((name=g_dir_read_name(dir)) && num_nodes < MAX_NUMA_NODES){
+    if (!g_str_has_prefix(name, "node") || !g_ascii_isdigit(name[4]))
+      continue;
+    gchar *filename=g_strdup_printf("/sys/devices/system/node/%s/cpulist", name);
+    gchar *content=NULL;
+    if (g_file_get_contents(filename, &content, NULL, NULL) && parse_cpu_list(g_strstrip(content), &(node_cpus[num_nodes]))){
+      // only the CPUs that we are allowed to use, nodes without them are memory only
+      CPU_AND(&(node_cpus[num_nodes]), &(node_cpus[num_nodes]), &process_cpus);
+      if (CPU_COUNT(&(node_cpus[num_nodes])) > 0)
+        num_nodes++;
+    }
+    g_free(content);
+    g_free(filename);
+  }
+  g_dir_close(dir);
+}
+
+static
+void parse_cpu_affinity(){
+  gchar **groups=g_strsplit(cpu_affinity, ";", 0);
+  guint i, g;
+  for (i=0; groups[i] != NULL; i++){
+    gchar *item=g_strstrip(groups[i]);
+    if (*item == '\0')
+      continue;
+    gchar *equal=g_strstr_len(item, -1, "=");
+    if (!equal)
+      m_critical("--cpu-affinity expects numa, none or a list like workers=0-7;compress=8-15, got %s", item);
+    *equal='\0';
+    for (g=0; g<AFFINITY_GROUPS; g++)
+      if (!g_ascii_strcasecmp(g_strstrip(item), affinity_group_name[g]))
+        break;
+    if (g == AFFINITY_GROUPS)
+      m_critical("--cpu-affinity group %s is not one of workers, schema, index, post, compress or io", item);
+    if (!parse_cpu_list(equal + 1, &(group_cpus[g])))
+      m_critical("--cpu-affinity has an invalid CPU list for %s: %s", item, equal + 1);
+    CPU_AND(&(group_cpus[g]), &(group_cpus[g]), &process_cpus);
+    if (CPU_COUNT(&(group_cpus[g])) == 0)
+      m_critical("--cpu-affinity CPUs of %s are not available to the process", item);
+    group_explicit[g]=TRUE;
+  }
+  g_strfreev(groups);
+}
+
+void initialize_cpu_affinity(){
+  guint g, n;
+  if (cpu_affinity && !g_ascii_strcasecmp(cpu_affinity, "none"))
+    return;
+  // taskset and cgroups limits are respected
+  if (sched_getaffinity(0, sizeof(process_cpus), &process_cpus)){
+    g_warning("Not able to get the CPU affinity of the process: %s", strerror(errno));
+    return;
+  }
+  load_numa_nodes();
+  for (g=0; g<AFFINITY_GROUPS; g++)
+    group_cpus[g]=process_cpus;
+  if (cpu_affinity && g_ascii_strcasecmp(cpu_affinity, "numa"))
+    parse_cpu_affinity();
+  for (g=0; g<AFFINITY_GROUPS; g++){
+    for (n=0; n<num_nodes; n++){
+      cpu_set_t in_node;
+      CPU_AND(&in_node, &(group_cpus[g]), &(node_cpus[n]));
+      if (CPU_COUNT(&in_node) > 0)
+        group_nodes[g][group_num_nodes[g]++]=n;
+    }
+    if (group_explicit[g] || group_num_nodes[g] > 1)
+      affinity_enabled=TRUE;
+  }
+  if (affinity_enabled)
+    g_message("CPU affinity enabled over %u NUMA nodes", num_nodes);
+}
+
+// Called by each thread when it starts, before allocating its buffers
+void set_thread_affinity(enum affinity_group group){
+  set_thread_arena(group);
+  report_thread_start(group);
+  if (!affinity_enabled)
+    return;
+  cpu_set_t set=group_cpus[group];
+  if (group_num_nodes[group] > 1){
+    guint n=group_nodes[group][(guint)g_atomic_int_add(&(group_next[group]), 1) % group_num_nodes[group]];
+    CPU_AND(&set, &set, &(node_cpus[n]));
+  }else if (!group_explicit[group])
+    return;
+  if (sched_setaffinity(0, sizeof(set), &set))
+    g_warning("Not able to set the CPU affinity of a %s thread: %s", affinity_group_name[group], strerror(errno));
+}
+
+/* Runs in the compression child after fork. Without an explicit list it
+   keeps the mask of the thread that forked it, which is on the node where
+   the data is written */
+void set_compress_affinity(){
+  if (affinity_enabled && group_explicit[AFFINITY_COMPRESS])
+    sched_setaffinity(0, sizeof(group_cpus[AFFINITY_COMPRESS]), &(group_cpus[AFFINITY_COMPRESS]));
+}
+
+#else
+
+void initialize_cpu_affinity(){
+  if (cpu_affinity && g_ascii_strcasecmp(cpu_affinity, "none"))
+    g_warning("--cpu-affinity is only available on Linux");
+}
+
+void set_thread_affinity(enum affinity_group group){
+  set_thread_arena(group);
+  report_thread_start(group);
+}
+
+void set_compress_affinity(){
+}
+
+#endif
@@ -0,0 +1,43 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Authors:        David Ducos, Percona (david dot ducos at percona dot com)
+*/
+#ifndef _src_cpu_affinity_h
+#define _src_cpu_affinity_h
+
+#include <glib.h>
+
+/* --cpu-affinity places every thread group on its own set of CPUs. By
+   default the threads of a group are spread over the NUMA nodes, each one
+   only running on the CPUs of its node, so the buffers it touches first are
+   allocated on the local memory */
+enum affinity_group {
+  AFFINITY_WORKERS,
+  AFFINITY_SCHEMA,
+  AFFINITY_INDEX,
+  AFFINITY_POST,
+  AFFINITY_COMPRESS,
+  AFFINITY_IO,
+  AFFINITY_GROUPS
+};
+
+extern gchar *cpu_affinity;
+extern const gchar *affinity_group_name[AFFINITY_GROUPS];
+
+void initialize_cpu_affinity();
+void set_thread_affinity(enum affinity_group group);
+void set_compress_affinity();
+
+#endif
@@ -32,6 +32,144 @@
 
 gchar *logfile;
 FILE *logoutfile;
+GLogLevelFlags log_dropped_levels = 0;
+
+/* Lines for --logfile are queued in a bounded ring and written by one thread.
+ * Every slot has a sequence number: producers claim a position with a CAS on
+ * the head and publish the line by moving the sequence, so they never wait
+ * for the writer. If the ring is full, or it is an error that aborts, the
+ * line is written synchronously */
+#define LOG_RING_SIZE 4096
+#define LOG_RING_MASK (LOG_RING_SIZE - 1)
+
+struct log_slot {
+  guint sequence;
+  GString *line;
+};
+
+static struct log_slot log_ring[LOG_RING_SIZE];
+static guint log_ring_head = 0;
+static guint log_ring_tail = 0;
+static GThread *log_writer_thread = NULL;
+static gboolean log_writer_shutdown = FALSE;
+// cleared by stop_async_log(), the lines are not queued from then on
+static gint log_ring_accepting = FALSE;
+// producers between checking log_ring_accepting and pushing the line
+static gint log_ring_producers = 0;
+
+static
+void write_log_line(const gchar *line, gsize len) {
+  if (write(fileno(logoutfile), line, len) <= 0) {
+    fprintf(stderr, "Cannot write to log file with error %d.  Exiting...",
+            errno);
+  }
+}
+
+static
+gboolean log_ring_push(GString *line) {
+  guint pos = g_atomic_int_get((gint *)&log_ring_head);
+  struct log_slot *slot = NULL;
+  gint dif = 0;
+  for (;;) {
+    slot = &log_ring[pos & LOG_RING_MASK];
+    dif = (gint)(g_atomic_int_get((gint *)&slot->sequence) - pos);
+    if (dif == 0) {
+      if (g_atomic_int_compare_and_exchange((gint *)&log_ring_head, pos, pos + 1))
+        break;
+      pos = g_atomic_int_get((gint *)&log_ring_head);
+    } else if (dif < 0) {
+      return FALSE;
+    } else
+      pos = g_atomic_int_get((gint *)&log_ring_head);
+  }
+  slot->line = line;
+  g_atomic_int_set((gint *)&slot->sequence, pos + 1);
+  return TRUE;
+}
+
+// only the writer thread pops
+static
+GString *log_ring_pop() {
+  struct log_slot *slot = &log_ring[log_ring_tail & LOG_RING_MASK];
+  if (g_atomic_int_get((gint *)&slot->sequence) != log_ring_tail + 1)
+    return NULL;
+  GString *line = slot->line;
+  slot->line = NULL;
+  g_atomic_int_set((gint *)&slot->sequence, log_ring_tail + LOG_RING_SIZE);
+  log_ring_tail++;
+  return line;
+}
+
+static
+guint drain_log_ring(GString *batch) {
+  GString *line = NULL;
+  guint lines = 0;
+  g_string_set_size(batch, 0);
+  while ((line = log_ring_pop())) {
+    g_string_append_len(batch, line->str, line->len);
+    g_string_free(line, TRUE);
+    lines++;
+  }
+  if (batch->len > 0)
+    write_log_line(batch->str, batch->len);
+  return lines;
+}
+
+static
+void *log_writer(void *data) {
+  (void)data;
+  GString *batch = g_string_sized_new(65536);
+  gulong idle = 100;
+  while (!g_atomic_int_get(&log_writer_shutdown)) {
+    if (drain_log_ring(batch)) {
+      idle = 100;
+    } else {
+      // nobody wakes us up, so the poll backs off while there is no log
+      g_usleep(idle);
+      if (idle < 10000)
+        idle *= 2;
+    }
+  }
+  drain_log_ring(batch);
+  g_string_free(batch, TRUE);
+  return NULL;
+}
+
+void start_async_log() {
+  guint i = 0;
+  if (log_writer_thread)
+    return;
+  for (i = 0; i < LOG_RING_SIZE; i++)
+    log_ring[i].sequence = i;
+  log_writer_thread = g_thread_new("log_writer", log_writer, NULL);
+  g_atomic_int_set(&log_ring_accepting, TRUE);
+  atexit(stop_async_log);
+}
+
+/* The lines logged from now on are written synchronously. The producers
+ * that already decided to queue a line push it before the writer does its
+ * last drain, so no line is left in the ring */
+void stop_async_log() {
+  GThread *thread = log_writer_thread;
+  if (!thread)
+    return;
+  g_atomic_int_set(&log_ring_accepting, FALSE);
+  while (g_atomic_int_get(&log_ring_producers) > 0)
+    g_usleep(100);
+  g_atomic_int_set(&log_writer_shutdown, TRUE);
+  g_thread_join(thread);
+  log_writer_thread = NULL;
+}
+
+static
+gboolean queue_log_line(GString *line) {
+  gboolean queued = FALSE;
+  g_atomic_int_inc(&log_ring_producers);
+  if (g_atomic_int_get(&log_ring_accepting))
+    queued = log_ring_push(line);
+  g_atomic_int_dec_and_test(&log_ring_producers);
+  return queued;
+}
 
 void no_log(const gchar *log_domain, GLogLevelFlags log_level,
             const gchar *message, gpointer user_data) {
@@ -75,10 +213,10 @@ void write_log_file(const gchar *log_domain, GLogLevelFlags log_level,
     g_string_append(message_out, " [ERROR] - ");
   }
 
-  g_string_append_printf(message_out, "%s\n", message);
-  if (write(fileno(logoutfile), message_out->str, message_out->len) <= 0) {
-    fprintf(stderr, "Cannot write to log file with error %d.  Exiting...",
-            errno);
-  }
+  g_string_append(message_out, message);
+  g_string_append_c(message_out, '\n');
+  if (!(log_level & G_LOG_LEVEL_ERROR) && queue_log_line(message_out))
+    return;
+  write_log_line(message_out->str, message_out->len);
   g_string_free(message_out, TRUE);
 }
@@ -24,6 +24,12 @@
 // variables
 extern gchar *logfile;
 extern FILE *logoutfile;
+// levels that set_verbose() sends to no_log
+extern GLogLevelFlags log_dropped_levels;
+
+static inline gboolean log_level_enabled(GLogLevelFlags level){
+  return !(log_dropped_levels & level);
+}
 
 // functions
 void no_log(const gchar *log_domain, GLogLevelFlags log_level,
@@ -32,4 +38,7 @@ void no_log(const gchar *log_domain, GLogLevelFlags log_level,
 void write_log_file(const gchar *log_domain, GLogLevelFlags log_level,
                     const gchar *message, gpointer user_data);
 
+void start_async_log();
+void stop_async_log();
+
 #endif
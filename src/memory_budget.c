@@ -0,0 +1,161 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Authors:        David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#include "memory_budget.h"
+
+guint max_memory=0;
+
+static GMutex *memory_mutex=NULL;
+static GCond *memory_cond=NULL;
+static guint64 memory_used=0;
+static guint64 memory_current[MEMORY_KINDS];
+static guint64 memory_peak[MEMORY_KINDS];
+static guint64 memory_waits=0;
+static guint64 memory_overshoots=0;
+// buffers holding a reservation, and how many of them are waiting to grow
+static guint memory_holders=0;
+static guint memory_waiting_holders=0;
+
+static const gchar *memory_kind_name[MEMORY_KINDS]={"row buffers", "read buffers", "statements", "pooled buffers"};
+
+void initialize_memory_budget(){
+  memory_mutex=g_mutex_new();
+  memory_cond=g_cond_new();
+}
+
+static
+gboolean over_budget(gsize size){
+  return max_memory > 0 && memory_used > 0 && memory_used + size > (guint64)max_memory * 1024 * 1024;
+}
+
+/* A buffer holding nothing can always wait. A holder only waits while
+   another holder is running, as that one can still release memory: the
+   last running holder overshoots instead of waiting for the others, which
+   might be waiting for it. The holders are the buffers and not the threads,
+   as a buffer can be released by a thread that did not reserve it, and a
+   thread also overshoots when nothing was released for MEMORY_WAIT_TIMEOUT
+   seconds */
+static
+void reserve(enum memory_kind kind, gsize size, gsize held){
+  if (size == 0)
+    return;
+  g_mutex_lock(memory_mutex);
+  if (over_budget(size)){
+    if (held == 0 || memory_holders - memory_waiting_holders > 1){
+      memory_waits++;
+      if (memory_waits == 1)
+        g_message("Memory budget of %u MB reached, waiting for %s to be released", max_memory, memory_kind_name[kind]);
+      guint64 used=memory_used;
+      GTimeVal deadline;
+      if (held > 0)
+        memory_waiting_holders++;
+      while (over_budget(size) && (held == 0 || memory_holders - memory_waiting_holders > 0)){
+        g_get_current_time(&deadline);
+        g_time_val_add(&deadline, MEMORY_WAIT_TIMEOUT * G_USEC_PER_SEC);
+        if (!g_cond_timed_wait(memory_cond, memory_mutex, &deadline)){
+          if (memory_used >= used)
+            break;
+          used=memory_used;
+        }
+      }
+      if (held > 0)
+        memory_waiting_holders--;
+    }
+    if (over_budget(size)){
+      memory_overshoots++;
+      if (memory_overshoots == 1)
+        g_message("Memory budget of %u MB exceeded to grow %s", max_memory, memory_kind_name[kind]);
+    }
+  }
+  memory_used+=size;
+  memory_current[kind]+=size;
+  if (memory_current[kind] > memory_peak[kind])
+    memory_peak[kind]=memory_current[kind];
+  if (held == 0)
+    memory_holders++;
+  g_mutex_unlock(memory_mutex);
+}
+
+static
+void release(enum memory_kind kind, gsize size, gboolean last){
+  g_mutex_lock(memory_mutex);
+  memory_used-=size;
+  memory_current[kind]-=size;
+  // a waiting holder might be the last running one now
+  if (last)
+    memory_holders--;
+  g_cond_broadcast(memory_cond);
+  g_mutex_unlock(memory_mutex);
+}
+
+/* Idle buffers, as the ones kept by a pool, do not belong to any thread and
+   never wait: they are only kept when the budget has room for them */
+gboolean memory_reserve_idle(enum memory_kind kind, gsize size){
+  gboolean fits;
+  g_mutex_lock(memory_mutex);
+  fits= max_memory == 0 || memory_used + size <= (guint64)max_memory * 1024 * 1024;
+  if (fits){
+    memory_used+=size;
+    memory_current[kind]+=size;
+    if (memory_current[kind] > memory_peak[kind])
+      memory_peak[kind]=memory_current[kind];
+  }
+  g_mutex_unlock(memory_mutex);
+  return fits;
+}
+
+void memory_release_idle(enum memory_kind kind, gsize size){
+  release(kind, size, FALSE);
+}
+
+/* Moves the reservation of a buffer to its new size. *reserved is what the
+   buffer holds, so it can be released from any thread. It is cheap when the
+   size did not change, so it can be called per row */
+void memory_track(enum memory_kind kind, gsize *reserved, gsize size){
+  if (*reserved == size)
+    return;
+  if (size > *reserved)
+    reserve(kind, size - *reserved, *reserved);
+  else
+    release(kind, *reserved - size, size == 0);
+  *reserved=size;
+}
+
+/* What str->allocated_len is going to be once it holds len bytes, so the
+   growth can be reserved before the GString grows: it doubles to the next
+   power of two that fits len and its '\0' */
+gsize memory_string_size(GString *str, gsize len){
+  gsize size=1;
+  if (len < str->allocated_len)
+    return str->allocated_len;
+  while (size < len + 1 && size > 0)
+    size<<=1;
+  return size > 0 ? size : len + 1;
+}
+
+void print_memory_usage(){
+  guint i;
+  g_mutex_lock(memory_mutex);
+  for (i=0; i<MEMORY_KINDS; i++)
+    if (memory_peak[i] > 0)
+      g_message("Memory used by %s: %" G_GUINT64_FORMAT " bytes, peak %" G_GUINT64_FORMAT " bytes", memory_kind_name[i], memory_current[i], memory_peak[i]);
+  if (memory_waits > 0)
+    g_message("Memory budget was exhausted %" G_GUINT64_FORMAT " times", memory_waits);
+  if (memory_overshoots > 0)
+    g_message("Memory budget was exceeded %" G_GUINT64_FORMAT " times", memory_overshoots);
+  g_mutex_unlock(memory_mutex);
+}
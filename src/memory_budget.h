@@ -0,0 +1,46 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Authors:        David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#ifndef _src_memory_budget_h
+#define _src_memory_budget_h
+
+#include <glib.h>
+
+/* Process wide budget set with --max-memory. Buffers reserve their growth
+   from it, before they grow. While it is exhausted, buffers wait for it to
+   be released, but the last buffer holding a reservation that is not
+   waiting exceeds it */
+#define MEMORY_WAIT_TIMEOUT 5
+
+enum memory_kind {
+  MEMORY_ROW_BUFFERS,
+  MEMORY_READ_BUFFERS,
+  MEMORY_STATEMENTS,
+  MEMORY_POOLED_BUFFERS,
+  MEMORY_KINDS
+};
+
+extern guint max_memory;
+
+void initialize_memory_budget();
+void memory_track(enum memory_kind kind, gsize *reserved, gsize size);
+gboolean memory_reserve_idle(enum memory_kind kind, gsize size);
+void memory_release_idle(enum memory_kind kind, gsize size);
+gsize memory_string_size(GString *str, gsize len);
+void print_memory_usage();
+
+#endif
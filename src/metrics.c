@@ -0,0 +1,270 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Authors:        David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netdb.h>
+
+#include "common.h"
+#include "metrics.h"
+
+gchar *metrics_listen=NULL;
+
+// upper bounds in seconds, the last bucket is +Inf
+static const gdouble metrics_buckets[]={0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1, 5, 10, 30, 60, 300};
+#define METRICS_BUCKETS (sizeof(metrics_buckets)/sizeof(metrics_buckets[0]))
+
+struct metrics_histogram {
+  const gchar *name;
+  const gchar *help;
+  guint64 buckets[METRICS_BUCKETS];
+  guint64 count;
+  gdouble sum;
+};
+
+static GMutex *metrics_mutex=NULL;
+static GMutex *metrics_conf_mutex=NULL;
+static GList *metrics_histograms=NULL;
+static void *metrics_conf=NULL;
+static void (*write_metrics_entries)(GString *content, void *conf)=NULL;
+static GThread *metrics_thread=NULL;
+static int metrics_socket=-1;
+static gboolean metrics_shutdown=FALSE;
+
+struct metrics_histogram *new_metrics_histogram(const gchar *name, const gchar *help){
+  if (!metrics_listen)
+    return NULL;
+  struct metrics_histogram *h=g_new0(struct metrics_histogram, 1);
+  h->name=name;
+  h->help=help;
+  g_mutex_lock(metrics_mutex);
+  metrics_histograms=g_list_append(metrics_histograms, h);
+  g_mutex_unlock(metrics_mutex);
+  return h;
+}
+
+void metrics_observe(struct metrics_histogram *h, gint64 usec){
+  if (h == NULL)
+    return;
+  gdouble seconds=(gdouble)usec / G_USEC_PER_SEC;
+  guint i=0;
+  g_mutex_lock(metrics_mutex);
+  for (i=0; i < METRICS_BUCKETS; i++)
+    if (seconds <= metrics_buckets[i])
+      h->buckets[i]++;
+  h->count++;
+  h->sum+=seconds;
+  g_mutex_unlock(metrics_mutex);
+}
+
+void append_metrics_header(GString *content, const gchar *name, const gchar *type, const gchar *help){
+  g_string_append_printf(content, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+// label values escape backslash, double quote and new line
+void append_metrics_label(GString *content, const gchar *name, const gchar *value){
+  g_string_append_printf(content, "%s=\"", name);
+  for (; *value; value++){
+    switch (*value){
+      case '\\':
+      case '"':
+        g_string_append_c(content, '\\');
+        g_string_append_c(content, *value);
+        break;
+      case '\n':
+        g_string_append(content, "\\n");
+        break;
+      default:
+        g_string_append_c(content, *value);
+    }
+  }
+  g_string_append_c(content, '"');
+}
+
+static
+void append_metrics_histograms(GString *content){
+  guint i=0;
+  g_mutex_lock(metrics_mutex);
+  for (GList *l=metrics_histograms; l; l=l->next){
+    struct metrics_histogram *h=l->data;
+    append_metrics_header(content, h->name, "histogram", h->help);
+    for (i=0; i < METRICS_BUCKETS; i++)
+      g_string_append_printf(content, "%s_bucket{le=\"%g\"} %"G_GUINT64_FORMAT"\n", h->name, metrics_buckets[i], h->buckets[i]);
+    g_string_append_printf(content, "%s_bucket{le=\"+Inf\"} %"G_GUINT64_FORMAT"\n", h->name, h->count);
+    g_string_append_printf(content, "%s_sum %f\n%s_count %"G_GUINT64_FORMAT"\n", h->name, h->sum, h->name, h->count);
+  }
+  g_mutex_unlock(metrics_mutex);
+}
+
+void metrics_set_conf(void *conf){
+  if (!metrics_listen)
+    return;
+  g_mutex_lock(metrics_conf_mutex);
+  metrics_conf=conf;
+  g_mutex_unlock(metrics_conf_mutex);
+}
+
+static
+gboolean metrics_send(int fd, const gchar *buf, gsize len){
+  ssize_t w=0;
+  while (len > 0){
+    w=send(fd, buf, len, MSG_NOSIGNAL);
+    if (w < 0){
+      if (errno == EINTR)
+        continue;
+      return FALSE;
+    }
+    buf+=w;
+    len-=w;
+  }
+  return TRUE;
+}
+
+static
+void metrics_answer(int fd, GString *content, GString *response){
+  gchar request[4096];
+  gsize len=0;
+  ssize_t r=0;
+  // we only need the request line, but the headers are drained so the
+  // client does not get a reset before reading the answer
+  while (len < sizeof(request) - 1){
+    r=recv(fd, request + len, sizeof(request) - 1 - len, 0);
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r <= 0)
+      break;
+    len+=r;
+    request[len]='\0';
+    if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n"))
+      break;
+  }
+  request[len]='\0';
+
+  g_string_set_size(content, 0);
+  if (!g_str_has_prefix(request, "GET ")){
+    g_string_assign(response, "HTTP/1.0 405 Method Not Allowed\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+  }else if (!g_str_has_prefix(request, "GET /metrics") && !g_str_has_prefix(request, "GET / ")){
+    g_string_assign(response, "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+  }else{
+    g_mutex_lock(metrics_conf_mutex);
+    write_metrics_entries(content, metrics_conf);
+    g_mutex_unlock(metrics_conf_mutex);
+    append_metrics_histograms(content);
+    g_string_printf(response, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\nContent-Length: %"G_GSIZE_FORMAT"\r\nConnection: close\r\n\r\n", content->len);
+  }
+  if (metrics_send(fd, response->str, response->len) && content->len > 0)
+    metrics_send(fd, content->str, content->len);
+}
+
+static
+void *metrics_thread_worker(void *data){
+  (void) data;
+  GString *content=g_string_sized_new(4096);
+  GString *response=g_string_sized_new(256);
+  struct timeval timeout={2, 0};
+  int fd=-1;
+  while (!metrics_shutdown){
+    fd=accept(metrics_socket, NULL, NULL);
+    if (fd < 0){
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      if (!metrics_shutdown)
+        g_warning("Metrics listener stopped: %s", strerror(errno));
+      break;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    metrics_answer(fd, content, response);
+    close(fd);
+  }
+  g_string_free(content, TRUE);
+  g_string_free(response, TRUE);
+  return NULL;
+}
+
+static
+int metrics_bind(const gchar *host, const gchar *port){
+  struct addrinfo hints, *res=NULL, *ai=NULL;
+  int fd=-1, one=1, e=0;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family=AF_UNSPEC;
+  hints.ai_socktype=SOCK_STREAM;
+  hints.ai_flags=AI_PASSIVE;
+  e=getaddrinfo(host, port, &hints, &res);
+  if (e)
+    m_critical("Could not resolve --metrics-listen %s: %s", metrics_listen, gai_strerror(e));
+  for (ai=res; ai; ai=ai->ai_next){
+    fd=socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0)
+      continue;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (!bind(fd, ai->ai_addr, ai->ai_addrlen) && !listen(fd, 16))
+      break;
+    close(fd);
+    fd=-1;
+  }
+  freeaddrinfo(res);
+  return fd;
+}
+
+void initialize_metrics(void _write_metrics_entries(GString *content, void *conf)){
+  if (!metrics_listen)
+    return;
+  metrics_mutex=g_mutex_new();
+  metrics_conf_mutex=g_mutex_new();
+  write_metrics_entries=_write_metrics_entries;
+
+  // [host:]port, the host can be a bracketed IPv6 address
+  gchar *host=NULL;
+  const gchar *port=metrics_listen;
+  gchar *colon=g_strrstr(metrics_listen, ":");
+  if (colon){
+    host=g_strndup(metrics_listen, colon - metrics_listen);
+    port=colon + 1;
+    if (host[0] == '[' && host[strlen(host) - 1] == ']'){
+      gchar *tmp=g_strndup(host + 1, strlen(host) - 2);
+      g_free(host);
+      host=tmp;
+    }
+  }
+  if (strlen(port) == 0 || atoi(port) <= 0)
+    m_critical("--metrics-listen expects [host:]port, got %s", metrics_listen);
+
+  metrics_socket=metrics_bind(host && strlen(host) > 0 ? host : NULL, port);
+  if (metrics_socket < 0)
+    m_critical("Could not listen on %s for metrics: %s", metrics_listen, strerror(errno));
+  g_free(host);
+
+  g_message("Serving metrics on http://%s/metrics", metrics_listen);
+  metrics_thread=m_thread_new("metrics", metrics_thread_worker, NULL, "Metrics thread could not be created");
+}
+
+void stop_metrics(){
+  if (!metrics_listen || metrics_thread == NULL)
+    return;
+  metrics_shutdown=TRUE;
+  // wakes up the accept() so the thread can be joined
+  shutdown(metrics_socket, SHUT_RDWR);
+  g_thread_join(metrics_thread);
+  close(metrics_socket);
+  metrics_thread=NULL;
+}
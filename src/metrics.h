@@ -0,0 +1,38 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Authors:        David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#ifndef _src_metrics_h
+#define _src_metrics_h
+
+#include <glib.h>
+
+/* Prometheus text exposition served over HTTP with --metrics-listen.
+   Histograms are registered once and observed from any thread, the
+   gauges are appended by the program callback on every scrape */
+struct metrics_histogram;
+
+extern gchar *metrics_listen;
+
+void initialize_metrics(void _write_metrics_entries(GString *content, void *conf));
+void metrics_set_conf(void *conf);
+void stop_metrics();
+struct metrics_histogram *new_metrics_histogram(const gchar *name, const gchar *help);
+void metrics_observe(struct metrics_histogram *h, gint64 usec);
+void append_metrics_header(GString *content, const gchar *name, const gchar *type, const gchar *help);
+void append_metrics_label(GString *content, const gchar *name, const gchar *value);
+
+#endif
@@ -34,9 +34,16 @@
 #include "mydumper.h"
 #include "mydumper_start_dump.h"
 #include "mydumper_daemon_thread.h"
+#include "mydumper_incremental.h"
+#include "mydumper_content_store.h"
+#include "mydumper_file_manifest.h"
+#include "mydumper_bundle.h"
+#include "mydumper_copy.h"
 #include "mydumper_global.h"
 #include "mydumper_arguments.h"
 #include "mydumper_file_handler.h"
+#include "mydumper_pmm.h"
+#include "mydumper_shards.h"
 
 const char DIRECTORY[] = "export";
 
@@ -72,6 +79,8 @@ void print_help(){
     print_string("socket",socket_path);
     print_string("protocol", protocol_str);
     print_bool("compress-protocol",compress_protocol);
+    print_string("compression-algorithms",compression_algorithms);
+    print_int("zstd-compression-level",zstd_compression_level);
 #ifdef WITH_SSL
     print_bool("ssl",ssl);
     print_string("ssl-mode",ssl_mode);
@@ -86,11 +95,18 @@ void print_help(){
     print_string("database",source_db);
     print_string("ignore-engines",ignore_engines_str);
     print_string("where",where_option);
+    print_double("sample",sample_percent);
+    print_bool("sample-follow-fk",sample_follow_fk);
+    print_int("sample-seed",sample_seed);
     print_int("updated-since",updated_since);
     print_string("partition-regex",partition_regex);
     print_string("omit-from-file",tables_skiplist_file);
     print_string("tables-list",tables_list);
     print_string("tidb-snapshot",tidb_snapshot);
+    print_string("replica-hosts",replica_hosts);
+    print_int("replica-wait-timeout",replica_wait_timeout);
+    print_string("shard-hosts",shard_hosts);
+    print_int("shard-parallel",shard_parallel);
     print_bool("use-savepoints",use_savepoints);
     print_bool("no-backup-locks",no_backup_locks);
     print_int("trx-tables",trx_tables);
@@ -99,23 +115,37 @@ void print_help(){
     print_string("pmm-resolution",pmm_resolution);
     print_int("exec-threads",num_exec_threads);
     print_string("exec",exec_command);
+    print_int("exec-queue-size",exec_queue_size);
     print_string("exec-per-thread",exec_per_thread);
     print_string("exec-per-thread-extension",exec_per_thread_extension);
+    print_string("upload-url",upload_url);
+    print_string("copy-to",copy_to);
+    print_int("upload-threads",num_upload_threads);
+    print_int("upload-part-size",upload_part_size);
+    print_int("upload-max-in-flight",upload_max_in_flight);
     print_int("long-query-retries",longquery_retries);
     print_int("long-query-retry-interval",longquery_retry_interval);
     print_int("long-query-guard",longquery);
     print_bool("kill-long-queries",killqueries);
     print_int("max-threads-per-table",max_threads_per_table);
+    print_bool("chunk-stealing",chunk_stealing);
 //    print_string("char-deep",);
 //    print_string("char-chunk",);
     print_string("rows",g_strdup_printf("%"G_GUINT64_FORMAT":%"G_GUINT64_FORMAT":%"G_GUINT64_FORMAT,min_chunk_step_size, starting_chunk_step_size, max_chunk_step_size));
     print_bool("split-partitions",split_partitions);
+    print_bool("sub-chunk-partitions",sub_chunk_partitions);
+    print_bool("pre-split-chunks",pre_split_chunks);
+    print_bool("tidb-region-chunks",tidb_region_chunks);
+    print_string("chunk-profile",chunk_profile);
+    print_bool("no-chunk-plan-guard",!chunk_plan_guard);
     print_bool("checksum-all",dump_checksums);
     print_bool("data-checksums",data_checksums);
+    print_bool("file-checksums",file_checksums);
     print_bool("schema-checksums",schema_checksums);
     print_bool("routine-checksums",routine_checksums);
     print_bool("no-schemas",no_schemas);
     print_bool("all-tablespaces",dump_tablespaces);
+    print_bool("transportable-tablespaces",transportable_tablespaces);
     print_bool("no-data",no_data);
     print_bool("triggers",dump_triggers);
     print_bool("events",dump_events);
@@ -124,6 +154,7 @@ void print_help(){
     print_bool("no-views",no_dump_views);
     print_bool("load-data",load_data);
     print_bool("csv",csv);
+    print_bool("into-outfile",into_outfile);
     print_bool("clickhouse",clickhouse);
     print_bool("include-header",include_header);
     print_string("fields-terminated-by",fields_terminated_by_ld);
@@ -138,6 +169,7 @@ void print_help(){
     print_bool("hex-blob",hex_blob);
     print_bool("skip-definer",skip_definer);
     print_int("statement-size",statement_size);
+    print_bool("adaptive-statement-size",adaptive_statement_size);
     print_bool("tz-utc",skip_tz);
     print_bool("skip-tz-utc",skip_tz);
     print_string("set-names", set_names_in_conn_by_default || set_names_in_conn_for_sct ? g_strdup_printf("%s,%s",set_names_in_conn_for_sct,set_names_in_conn_by_default):NULL);
@@ -151,18 +183,47 @@ void print_help(){
     print_bool("compress",compress_method!=NULL);
     print_bool("use-defer",use_defer);
     print_bool("check-row-count",check_row_count);
+    print_bool("prefetch-rows",prefetch_rows);
+    print_int("blob-slice-size",blob_slice_size);
+    print_bool("prefetch-catalog",prefetch_catalog);
+    print_int("schema-threads",num_schema_threads);
+    print_int("max-queued-jobs",max_queued_jobs);
+    print_int("max-queued-jobs-memory",max_queued_jobs_memory);
+    print_bool("data-index",data_index);
+    print_bool("seekable-zstd",seekable_zstd);
+    print_bool("file-manifest",file_manifest);
+    print_int("bundle-tables-under",bundle_tables_under);
+    print_string("io-mode",io_mode_str);
+    print_int("async-writers",num_async_writers);
+    print_int("async-write-buffers",async_write_buffers);
     print_bool("daemon",daemon_mode);
     print_int("snapshot-interval",snapshot_interval);
     print_int("snapshot-count",snapshot_count);
+    print_bool("incremental",incremental_snapshot);
+    print_bool("content-store",content_store);
     print_bool("help",help);
     print_string("outputdir",output_directory);
     print_bool("clear",clear_dumpdir);
     print_bool("dirty",dirty_dumpdir);
     print_bool("merge",merge_dumpdir);
     print_bool("stream",stream);
+    print_int("stream-lanes",stream_lanes);
     print_string("logfile",logfile);
     print_string("disk-limits",disk_limits);
+    print_bool("masquerade-filename",masquerade_filename);
+    print_string("masquerade-key",masquerade_key);
+    print_int("masquerade-cache-size",masquerade_cache_size);
     print_int("threads",num_threads);
+    print_int("max-memory",max_memory);
+    print_int("queue-stats-interval",queue_stats_interval);
+    print_string("cpu-affinity",cpu_affinity);
+    print_int("allocator-decay",allocator_decay);
+    print_string("metrics-listen",metrics_listen);
+    print_string("throttle-control",throttle_control);
+    print_bool("auto-threads",auto_threads);
+    print_string("trace-file",trace_file);
+    print_bool("report",run_report);
+    print_string("report-file",run_report_file);
     print_bool("version",program_version);
     print_bool("verbose",verbose);
     print_bool("debug",debug);
@@ -249,6 +310,10 @@ int main(int argc, char *argv[]) {
 
   if (compress_method==NULL && exec_per_thread==NULL) {
     exec_per_thread_extension=EMPTY_STRING;
+  }else if (compress_method!=NULL && exec_per_thread==NULL && is_in_process_compression_available(compress_method)){
+    // No need of external processes, files are compressed by the working threads
+    set_in_process_compression(compress_method);
+    exec_per_thread_extension= g_ascii_strcasecmp(compress_method, GZIP) ? ZSTD_EXTENSION : GZIP_EXTENSION;
   }else{
     set_pipe_backup();
 
@@ -273,6 +338,45 @@ int main(int argc, char *argv[]) {
   }
 
   initialize_set_names();
+  initialize_memory_budget();
+  initialize_cpu_affinity();
+  initialize_allocator();
+
+  // offsets are only useful if myloader can seek on the data file
+  if (data_index && (output_format != SQL_INSERT || strlen(exec_per_thread_extension) > 0)){
+    g_warning("--data-index is only available with --format INSERT and without compression, disabling it");
+    data_index=FALSE;
+  }
+
+  // the names of the files that are not on disk can not be listed
+  if (file_manifest && (stream || content_store)){
+    g_warning("--file-manifest is not compatible with --stream or --content-store, disabling it");
+    file_manifest=FALSE;
+  }
+
+  // the bundles are only written into the directory
+  if (bundle_tables_under > 0 && (stream || exec_command || upload_url || content_store || incremental_snapshot))
+    m_critical("--bundle-tables-under is not compatible with --stream, --exec, --upload-url, --content-store or --incremental");
+  // the manifest lists the files before they are moved into their bundle
+  if (bundle_tables_under > 0 && file_manifest)
+    m_critical("--bundle-tables-under is not compatible with --file-manifest");
+
+  if (incremental_snapshot){
+    if (!daemon_mode)
+      m_critical("--incremental requires --daemon");
+    if (stream)
+      m_critical("--incremental is not compatible with --stream");
+    if (snapshot_count < 2)
+      m_critical("--incremental needs --snapshot-count of at least 2, as the files are linked from the previous snapshot");
+    data_checksums=TRUE;
+  }
+
+  if (content_store){
+    if (!daemon_mode)
+      m_critical("--content-store requires --daemon");
+    if (stream || exec_command)
+      m_critical("--content-store is not compatible with --stream or --exec");
+  }
 
   if (debug) {
     set_debug();
@@ -296,12 +400,23 @@ int main(int argc, char *argv[]) {
 
   g_message("MyDumper backup version: %s", VERSION);
 
+  // the dumps of the shards are executed with the same arguments
+  if (shard_hosts_in_use()){
+    int r=run_shards(argc, argv);
+    g_option_context_free(context);
+    exit(r);
+  }
+
   // Startmodifying file in disk, creating objects and backup
 
   hide_password(argc, argv);
   ask_password();
 
   initialize_pmm();
+  initialize_metrics(&write_mydumper_metrics_entries);
+  initialize_spans("mydumper");
+  initialize_run_report("mydumper");
+  start_queue_stats();
 
   create_dir(output_directory);
 
@@ -316,9 +431,15 @@ int main(int argc, char *argv[]) {
     start_dump(&conf);
   }
 
+  stop_queue_stats();
+  stop_metrics();
+  finish_spans();
+  finish_run_report();
   free_set_names();
+  print_memory_usage();
 
   if (logoutfile) {
+    stop_async_log();
     fclose(logoutfile);
   }
 
@@ -30,3 +30,12 @@
 #include "../server_detect.h"
 #include "../pmm_thread.h"
 #include "../checksum.h"
+#include "../row_binary.h"
+#include "../memory_budget.h"
+#include "../cpu_affinity.h"
+#include "../allocator.h"
+#include "../throttle_control.h"
+#include "../metrics.h"
+#include "../span_trace.h"
+#include "../queue_stats.h"
+#include "../run_report.h"
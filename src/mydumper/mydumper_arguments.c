@@ -26,6 +26,13 @@
 #include "mydumper_global.h"
 #include "mydumper_arguments.h"
 #include "mydumper_common.h"
+#include "mydumper_file_handler.h"
+#include "mydumper_incremental.h"
+#include "mydumper_content_store.h"
+#include "mydumper_file_manifest.h"
+#include "mydumper_bundle.h"
+#include "mydumper_copy.h"
+#include "mydumper_clickhouse.h"
 
 extern guint64 min_integer_chunk_step_size;
 extern guint64 max_integer_chunk_step_size;
@@ -38,6 +45,8 @@ const gchar *rows_file_extension=SQL;
 guint output_format=SQL_INSERT;
 gchar *output_directory_str = NULL;
 gboolean masquerade_filename=FALSE;
+gchar *masquerade_key=NULL;
+guint masquerade_cache_size=0;
 guint trx_tables=1;
 gboolean use_single_column=FALSE;
 const gchar *table_engine_for_view_dependency=MEMORY;
@@ -48,14 +57,13 @@ gboolean arguments_callback(const gchar *option_name,const gchar *value, gpointe
   *error=NULL;
   if (g_strstr_len(option_name,10,"--compress") || g_strstr_len(option_name,2,"-c")){
     if (value==NULL){
-      if (g_find_program_in_path(ZSTD)){
+      if (is_in_process_compression_available(ZSTD) || g_find_program_in_path(ZSTD)){
         compress_method=ZSTD;
         return TRUE;
-      }else if (g_find_program_in_path(GZIP)){
-        compress_method=GZIP;
-        return TRUE;
       }
-      return FALSE;
+      // gzip is always available as zlib is linked in
+      compress_method=GZIP;
+      return TRUE;
     }
     if (!g_ascii_strcasecmp(value,GZIP)){
       compress_method=GZIP;
@@ -90,6 +98,11 @@ gboolean arguments_callback(const gchar *option_name,const gchar *value, gpointe
       split_integer_tables=parse_rows_per_chunk(value, &min_chunk_step_size, &starting_chunk_step_size, &max_chunk_step_size, "Invalid option on --rows");
     return TRUE;
   }
+  if (!g_strcmp0(option_name,"--table-order")){
+    if (value==NULL || !set_table_order(value))
+      m_critical("--table-order accepts: size, rows or none");
+    return TRUE;
+  }
   if (g_strstr_len(option_name,8,"--format")){
     if (value==NULL)
       return FALSE;
@@ -115,6 +128,22 @@ gboolean arguments_callback(const gchar *option_name,const gchar *value, gpointe
 			output_format=CLICKHOUSE;
       return TRUE;
     }
+    if (!g_ascii_strcasecmp(value,CLICKHOUSE_ROWBINARY_ARG)){
+      clickhouse=TRUE;
+      rows_file_extension=CLICKHOUSE_ROWBINARY_EXTENSION;
+      output_format=CLICKHOUSE_ROWBINARY;
+      return TRUE;
+    }
+    if (!g_ascii_strcasecmp(value,PARQUET_ARG)){
+      rows_file_extension=PARQUET_EXTENSION;
+      output_format=PARQUET;
+      return TRUE;
+    }
+    if (!g_ascii_strcasecmp(value,BINARY_ARG)){
+      rows_file_extension=ROW_BINARY_EXTENSION;
+      output_format=BINARY;
+      return TRUE;
+    }
   }
   if (!g_strcmp0(option_name,"--trx-consistency-only")){
     m_critical("--trx-consistency-only is deprecated use --trx-tables instead");
@@ -153,6 +182,10 @@ gboolean arguments_callback(const gchar *option_name,const gchar *value, gpointe
       sync_thread_lock_mode=SAFE_NO_LOCK;
       return TRUE;
     }
+    if (!g_ascii_strcasecmp(value,"BINLOG_DELTA")){
+      sync_thread_lock_mode=BINLOG_DELTA;
+      return TRUE;
+    }
   }
   if (!g_strcmp0(option_name,"--success-on-1146")){
     m_critical("--success-on-1146 is deprecated use --ignore-errors instead");
@@ -200,15 +233,25 @@ static GOptionEntry entries[] = {
       "It will stream over STDOUT once the files has been written. "
       "Since v0.12.7-1, accepts NO_DELETE, NO_STREAM_AND_NO_DELETE and TRADITIONAL "
       "which is the default value and used if no parameter is given and also NO_STREAM since v0.16.3-1", NULL},
+    {"stream-lanes", 0, 0, G_OPTION_ARG_INT, &stream_lanes,
+      "Amount of threads that send files at the same time when --stream is used. "
+      "With more than 1 the files are sent in frames that myloader demultiplexes. Default: 1", NULL},
     {"logfile", 'L', 0, G_OPTION_ARG_FILENAME, &logfile,
       "Log file name to use, by default stdout is used", NULL},
     {"disk-limits", 0, 0, G_OPTION_ARG_STRING, &disk_limits,
       "Set the limit to pause and resume if determines there is no enough disk space."
       "Accepts values like: '<resume>:<pause>' in MB."
       "For instance: 100:500 will pause when there is only 100MB free and will "
-      "resume if 500MB are available", NULL },
+      "resume if 500MB are available. In between, the amount of threads dumping is reduced "
+      "depending on the free space projected from the rate it is consumed", NULL },
     {"masquerade-filename", 0, 0, G_OPTION_ARG_NONE, &masquerade_filename,
       "Masquerades the filenames", NULL},
+    {"masquerade-key", 0, 0, G_OPTION_ARG_STRING, &masquerade_key,
+      "Key used to hash the values, it makes the random masquerade functions deterministic: "
+      "the same value is masked with the same output in every table, chunk and execution", NULL},
+    {"masquerade-cache-size", 0, 0, G_OPTION_ARG_INT, &masquerade_cache_size,
+      "Amount of values cached per masquerade function, the regex and deterministic functions "
+      "are computed once per distinct value. Default: 0, no cache", NULL},
     {"ftwrl-max-wait-time", 0, 0, G_OPTION_ARG_INT, &ftwrl_max_wait_time,
       "Sets the max time that we are going to wait before kill the FLUSH TABLES related commands. Default: 60", NULL},
     {"ftwrl-timeout-retries", 0, 0, G_OPTION_ARG_INT, &ftwrl_timeout_retries,
@@ -238,7 +281,22 @@ static GOptionEntry extra_entries[] = {
     {"use-defer", 0, 0, G_OPTION_ARG_NONE, &use_defer,
       "Use defer integer sharding until all non-integer PK tables processed (saves RSS for huge quantities of tables)", NULL},
     {"check-row-count", 0, 0, G_OPTION_ARG_NONE, &check_row_count,
-      "Run SELECT COUNT(*) and fail mydumper if dumped row count is different", NULL},
+      "Run a SELECT COUNT(*) of each table after its data and fail mydumper if the rows of its chunks are different", NULL},
+    {"prefetch-rows", 0, 0, G_OPTION_ARG_NONE, &prefetch_rows,
+      "Read the rows of a chunk on a separate thread while the previous rows are written, and send the query of the next integer chunk once the rows of the current one were read", NULL},
+    {"blob-slice-size", 0, 0, G_OPTION_ARG_INT, &blob_slice_size,
+      "Read the chunks of tables with BLOB, TEXT or JSON columns with a prepared statement and write "
+      "the values bigger than this amount of bytes in slices of this size. Not used with --format binary or parquet. Default: 0, disabled", NULL},
+    {"schema-threads", 0, 0, G_OPTION_ARG_INT, &num_schema_threads,
+      "Number of threads with their own connection that dump the table schemas, views and triggers, "
+      "sending many SHOW CREATE TABLE per round trip. Needs a DDL lock or --no-data. Default: 0, the working threads dump them", NULL},
+    {"max-queued-jobs", 0, 0, G_OPTION_ARG_INT, &max_queued_jobs,
+      "Maximum number of schema and post data jobs waiting to be processed while the jobs are created, 0 means no limit. Default: 200000", NULL},
+    {"max-queued-jobs-memory", 0, 0, G_OPTION_ARG_INT, &max_queued_jobs_memory,
+      "Maximum memory in MB of the schema and post data jobs waiting to be processed, 0 means no limit. Default: 100", NULL},
+    {"prefetch-catalog", 0, 0, G_OPTION_ARG_NONE, &prefetch_catalog,
+      "Read columns, indexes and partitions of all the tables from information_schema before the "
+      "tables are discovered instead of querying them table by table. In daemon mode the unchanged tables are reused", NULL},
     {NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL}};
 
 static GOptionEntry lock_entries[] = {
@@ -251,7 +309,9 @@ static GOptionEntry lock_entries[] = {
       "This option is deprecated use --sync-thread-lock-mode instead", NULL},
     {"sync-thread-lock-mode", 0, 0, G_OPTION_ARG_CALLBACK , &arguments_callback,
       "There are 4 modes that can be use to sync: SAFE_NO_LOCK, FTWRL, LOCK_ALL and GTID. "
-      "If you don't need a consistent backup, use: NO_LOCK. More info https://mydumper.github.io/mydumper/docs/html/locks.html. "
+      "If you don't need a consistent backup, use: NO_LOCK. BINLOG_DELTA takes no lock nor long snapshot, the row events of the binlog written "
+      "while the tables were dumped are applied by myloader after the data, it needs binlog_format=ROW and binlog_row_image=FULL. "
+      "More info https://mydumper.github.io/mydumper/docs/html/locks.html. "
       "Default: AUTO which uses the best option depending on the database vendor", NULL},
     {"use-savepoints", 0, 0, G_OPTION_ARG_NONE, &use_savepoints,
       "Use savepoints to reduce metadata locking issues, needs SUPER privilege", NULL},
@@ -268,6 +328,18 @@ static GOptionEntry lock_entries[] = {
       "Locks will take longer to be released, as it needs to determine which tables are not transactional and export them before releasing global lock", NULL},
     {"skip-ddl-locks", 0, 0, G_OPTION_ARG_NONE, &skip_ddl_locks, 
       "Do not send DDL locks when possible", NULL},
+    {"replica-hosts", 0, 0, G_OPTION_ARG_STRING, &replica_hosts,
+      "Comma separated list of host[:port] of GTID replicas of --host. The replicas are stopped at the position "
+      "taken under the global lock and the working threads are spread over them and --host", NULL},
+    {"replica-wait-timeout", 0, 0, G_OPTION_ARG_INT, &replica_wait_timeout,
+      "Seconds to wait for a replica to reach the position, otherwise it is not used. Default: 300", NULL},
+    {"shard-hosts", 0, 0, G_OPTION_ARG_STRING, &shard_hosts,
+      "Comma separated list of host[:port] of shards that are dumped with the same options, each one into its own "
+      "subdirectory of the output directory with its own snapshot and metadata. Each shard is dumped by its own mydumper process, "
+      "the threads are not shared between the shards", NULL},
+    {"shard-parallel", 0, 0, G_OPTION_ARG_INT, &shard_parallel,
+      "Number of shards of --shard-hosts that are dumped at the same time, each one with --threads, so at most --shard-parallel "
+      "times --threads connections. Default: 4", NULL},
     {NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL}};
 
 static GOptionEntry query_running_entries[] = {
@@ -285,11 +357,25 @@ static GOptionEntry exec_entries[] = {
     {"exec-threads", 0, 0, G_OPTION_ARG_INT, &num_exec_threads,
       "Amount of threads to use with --exec", NULL},
     {"exec", 0, 0, G_OPTION_ARG_STRING, &exec_command,
-      "Command to execute using the file as parameter", NULL},
+      "Command to execute using the file as parameter. Use 'upload' to send the files to --upload-url from the exec threads, without forking", NULL},
+    {"exec-queue-size", 0, 0, G_OPTION_ARG_INT, &exec_queue_size,
+      "Size in MB of the closed files waiting for --exec, the dump threads wait once it is reached. 0 means unlimited. Default: 1024", NULL},
     {"exec-per-thread",0, 0, G_OPTION_ARG_STRING, &exec_per_thread,
       "Set the command that will receive by STDIN and write in the STDOUT into the output file", NULL},
     {"exec-per-thread-extension",0, 0, G_OPTION_ARG_STRING, &exec_per_thread_extension,
       "Set the extension for the STDOUT file when --exec-per-thread is used", NULL},
+    {"upload-url", 0, 0, G_OPTION_ARG_STRING, &upload_url,
+      "Uploads the files to an S3 compatible object storage as they are closed, like https://host/bucket/prefix. "
+      "Credentials are taken from AWS_ACCESS_KEY_ID, AWS_SECRET_ACCESS_KEY, AWS_SESSION_TOKEN and AWS_REGION", NULL},
+    {"upload-threads", 0, 0, G_OPTION_ARG_INT, &num_upload_threads,
+      "Amount of files and of parts uploaded at the same time with --upload-url. Default: 4", NULL},
+    {"copy-to", 0, 0, G_OPTION_ARG_STRING, &copy_to,
+      "Copies the databases, tables, data and the rest of the objects to host[:port] with the same credentials, without writing their files. "
+      "Secondary indexes and constraints of InnoDB tables are added at the end, then the routines, events, views and triggers", NULL},
+    {"upload-part-size", 0, 0, G_OPTION_ARG_INT, &upload_part_size,
+      "Files bigger than this amount of MB are sent with multipart uploads. Default: 16", NULL},
+    {"upload-max-in-flight", 0, 0, G_OPTION_ARG_INT, &upload_max_in_flight,
+      "Maximum amount of MB read from the files and not uploaded yet. Default: 256", NULL},
     {NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL}};
 
 static GOptionEntry daemon_entries[] = {
@@ -299,13 +385,23 @@ static GOptionEntry daemon_entries[] = {
       "Interval between each dump snapshot (in minutes), requires --daemon, "
       "default 60", NULL},
     {"snapshot-count", 'X', 0, G_OPTION_ARG_INT, &snapshot_count, "number of snapshots, default 2", NULL},
+    {"incremental", 0, 0, G_OPTION_ARG_NONE, &incremental_snapshot,
+      "Hard links the data files of the tables that did not change since the previous snapshot "
+      "instead of dumping them again, requires --daemon and enables --data-checksums", NULL},
+    {"content-store", 0, 0, G_OPTION_ARG_NONE, &content_store,
+      "Stores each file once, named by the hash of its content, in the blobs directory and "
+      "writes a manifest on each snapshot directory, requires --daemon", NULL},
     {NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL}};
 
 static GOptionEntry chunks_entries[] = {
     {"max-time-per-select", 0, 0, G_OPTION_ARG_INT, &max_time_per_select,
       "Maximum amount of seconds that a select should take. Default: 2", NULL},
+    {"table-order", 0, 0, G_OPTION_ARG_CALLBACK, &arguments_callback,
+      "Order to dump the tables: size (Data_length, largest first), rows (largest first) or none (discovery order). Default: size", NULL},
     {"max-threads-per-table", 0, 0, G_OPTION_ARG_INT, &max_threads_per_table,
-      "Maximum number of threads per table to use", NULL},
+      "Maximum number of threads per table to use. With --chunk-stealing it is a soft limit", NULL},
+    {"chunk-stealing", 0, 0, G_OPTION_ARG_NONE, &chunk_stealing,
+      "A thread that has no other table to dump takes a chunk of the table with more rows left, even over --max-threads-per-table", NULL},
     {"use-single-column", 0, 0, G_OPTION_ARG_NONE, &use_single_column, 
       "It will ignore if the table has multiple columns and use only the first column to split the table", NULL},
     {"rows", 'r', 0, G_OPTION_ARG_CALLBACK, &arguments_callback,
@@ -314,13 +410,27 @@ static GOptionEntry chunks_entries[] = {
       "This set the MIN and MAX limit when even if --rows is 0", NULL},
     {"split-partitions", 0, 0, G_OPTION_ARG_NONE, &split_partitions,
       "Dump partitions into separate files. This option overrides the --rows option for partitioned tables.", NULL},
+    {"sub-chunk-partitions", 0, 0, G_OPTION_ARG_NONE, &sub_chunk_partitions,
+      "With --split-partitions, the partitions with more rows than --rows are split in chunks by the primary key, "
+      "which can be dumped by several threads", NULL},
+    {"no-chunk-plan-guard", 0, G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE, &chunk_plan_guard,
+      "Do not EXPLAIN the chunk queries to add FORCE INDEX on the chunking index when the plan is not a range scan", NULL},
+    {"chunk-profile", 0, 0, G_OPTION_ARG_FILENAME, &chunk_profile,
+      "File where the step size reached on each table is saved at the end of the dump and loaded at the start of the next one", NULL},
+    {"pre-split-chunks", 0, 0, G_OPTION_ARG_NONE, &pre_split_chunks,
+      "Split integer tables in as many chunks as threads before the dump starts, using the histogram or the index statistics", NULL},
+    {"tidb-region-chunks", 0, 0, G_OPTION_ARG_NONE, &tidb_region_chunks,
+      "On TiDB, split the tables with an integer clustered primary key at their region boundaries and "
+      "alternate the chunks between the leader stores. It has precedence over --pre-split-chunks", NULL},
     {NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL}};
 
 static GOptionEntry checksum_entries[] = {
     {"checksum-all", 'M', 0, G_OPTION_ARG_NONE, &dump_checksums,
       "Dump checksums for all elements", NULL},
     {"data-checksums", 0, 0, G_OPTION_ARG_NONE, &data_checksums,
-      "Dump table checksums with the data", NULL},
+      "Dump a checksum of every chunk with the data, myloader verifies each one when its files are restored", NULL},
+    {"file-checksums", 0, 0, G_OPTION_ARG_NONE, &file_checksums,
+      "Writes on the metadata a crc32 of every file, computed while it is written, of its content and of the bytes on disk. myloader verifies the content while it restores the file", NULL},
     {"schema-checksums", 0, 0, G_OPTION_ARG_NONE, &schema_checksums,
       "Dump schema table and view creation checksums", NULL},
     {"routine-checksums", 0, 0, G_OPTION_ARG_NONE, &routine_checksums,
@@ -334,6 +444,13 @@ static GOptionEntry filter_entries[] = {
       "Comma delimited list of storage engines to ignore", NULL},
     {"where", 0, 0, G_OPTION_ARG_STRING, &where_option,
       "Dump only selected records.", NULL },
+    {"sample", 0, 0, G_OPTION_ARG_DOUBLE, &sample_percent,
+      "Dump this percentage of the rows of each table, reading random ranges of the first integer column of the key. "
+      "Tables without an integer key get their first rows", NULL },
+    {"sample-follow-fk", 0, 0, G_OPTION_ARG_NONE, &sample_follow_fk,
+      "With --sample, dump the rows whose parent rows were sampled instead of sampling the tables with foreign keys", NULL },
+    {"sample-seed", 0, 0, G_OPTION_ARG_INT, &sample_seed,
+      "Seed of the ranges picked by --sample, the same seed picks the same ranges. Default: 0", NULL },
     {"updated-since", 'U', 0, G_OPTION_ARG_INT, &updated_since,
       "Use Update_time to dump only tables updated in the last U days", NULL},
     {"partition-regex", 0, 0, G_OPTION_ARG_STRING, &partition_regex,
@@ -345,6 +462,9 @@ static GOptionEntry objects_entries[] = {
       "Do not dump table schemas with the data and triggers", NULL},
     {"all-tablespaces", 'Y', 0 , G_OPTION_ARG_NONE, &dump_tablespaces,
       "Dump all the tablespaces.", NULL},
+    {"transportable-tablespaces", 0, 0, G_OPTION_ARG_NONE, &transportable_tablespaces,
+      "Copies the .ibd and .cfg of the InnoDB tables with their own tablespace, locked with FLUSH TABLES FOR EXPORT, instead of their rows. "
+      "mydumper has to run on the database host with read access to the datadir. Not compatible with FLUSH TABLES WITH READ LOCK", NULL},
     {"no-data", 'd', 0, G_OPTION_ARG_NONE, &no_data, 
       "Do not dump table data", NULL},
     {"triggers", 'G', 0, G_OPTION_ARG_NONE, &dump_triggers, 
@@ -372,8 +492,11 @@ static GOptionEntry statement_entries[] = {
       "Automatically enables --load-data and set variables to export in CSV format. "
       "This option will be deprecated on future releases use --format", NULL },
     {"format", 0, 0, G_OPTION_ARG_CALLBACK, &arguments_callback,
-      "Set the output format which can be INSERT, LOAD_DATA, CSV or CLICKHOUSE. "
+      "Set the output format which can be INSERT, LOAD_DATA, CSV, CLICKHOUSE, CLICKHOUSE_ROWBINARY, PARQUET or BINARY. "
       "Default: INSERT", NULL },
+    {"into-outfile", 0, 0, G_OPTION_ARG_NONE, &into_outfile,
+      "With --format LOAD_DATA or CSV, the server writes the rows of each chunk with SELECT INTO OUTFILE. "
+      "mydumper has to run on the database host and the output directory has to be writable by the server", NULL},
     {"include-header", 0, 0, G_OPTION_ARG_NONE, &include_header, 
       "When --load-data or --csv is used, it will include the header with the column name", NULL},
     {"fields-terminated-by", 0, 0, G_OPTION_ARG_STRING, &fields_terminated_by_ld,
@@ -405,6 +528,22 @@ static GOptionEntry statement_entries[] = {
       "Removes DEFINER from the CREATE statement. By default, statements are not modified", NULL},
     {"statement-size", 's', 0, G_OPTION_ARG_INT, &statement_size,
       "Attempted size of INSERT statement in bytes, default 1000000", NULL},
+    {"adaptive-statement-size", 0, 0, G_OPTION_ARG_NONE, &adaptive_statement_size,
+      "Sizes the statements of each table from the average row of its first chunk: up to --statement-size and 5000 rows, with at least 16 rows for wide tables and no more than a quarter of max_allowed_packet", NULL},
+    {"data-index", 0, 0, G_OPTION_ARG_NONE, &data_index,
+      "Writes a .idx file next to each data file with the offset and rows of every INSERT, which allows myloader to restore a file with several threads", NULL},
+    {"file-manifest", 0, 0, G_OPTION_ARG_NONE, &file_manifest,
+      "Writes " FILE_MANIFEST " with the type, table, part, size and rows of every file, myloader uses it instead of listing the directory", NULL},
+    {"bundle-tables-under", 0, 0, G_OPTION_ARG_INT, &bundle_tables_under,
+      "The files of the tables smaller than this size in MB are packed into a few bundle files per database, indexed by " BUNDLE_INDEX ". 0 disables it, default 0", NULL},
+    {"seekable-zstd", 0, 0, G_OPTION_ARG_NONE, &seekable_zstd,
+      "With in-process zstd compression, the files are written in independent frames that end on a statement, with a seek table, which allows myloader to restore a file with several threads", NULL},
+    {"io-mode", 0, 0, G_OPTION_ARG_STRING, &io_mode_str,
+      "How the files are written: buffered, fadvise, which releases the written pages from the page cache, or direct, which uses O_DIRECT. Default: buffered", NULL},
+    {"async-writers", 0, 0, G_OPTION_ARG_INT, &num_async_writers,
+      "Amount of threads that write the output files, so the dump threads do not wait for the storage. Default: 0 (disabled)", NULL},
+    {"async-write-buffers", 0, 0, G_OPTION_ARG_INT, &async_write_buffers,
+      "Amount of buffers waiting to be written by the --async-writers. Default: 64", NULL},
     {"tz-utc", 0, G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE, &skip_tz,
       "SET TIME_ZONE='+00:00' at top of dump to allow dumping of TIMESTAMP data "
       "when a server has data in different time zones or data is being moved "
@@ -22,11 +22,18 @@
 #define LOAD_DATA_ARG "LOAD_DATA"
 #define CSV_ARG "CSV"
 #define CLICKHOUSE_ARG "CLICKHOUSE"
+#define PARQUET_ARG "PARQUET"
+#define BINARY_ARG "BINARY"
+#define CLICKHOUSE_ROWBINARY_ARG "CLICKHOUSE_ROWBINARY"
 #define SQL_INSERT 0
 #define LOAD_DATA 1
 #define CSV 2
 #define CLICKHOUSE 3
+#define PARQUET 4
+#define BINARY 5
+#define CLICKHOUSE_ROWBINARY 6
 #define SQL "sql"
 #define DAT "dat"
+#define PARQUET_EXTENSION "parquet"
 #define MEMORY "MEMORY"
 GOptionContext * load_contex_entries();
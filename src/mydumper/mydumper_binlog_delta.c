@@ -0,0 +1,632 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#include <mysql.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <zlib.h>
+#include "mydumper.h"
+#include "mydumper_global.h"
+#include "mydumper_common.h"
+#include "mydumper_write.h"
+#include "mydumper_working_thread.h"
+#include "mydumper_binlog_delta.h"
+
+#if !defined(LIBMARIADB) && MYSQL_VERSION_ID >= 80000
+#define BINLOG_DELTA_SUPPORTED
+#endif
+
+#define BINLOG_DUMP_NON_BLOCK 1
+#define BINLOG_DELTA_WRITE_SIZE 1048576
+
+#define EVENT_HEADER_SIZE 19
+#define EVENT_TYPE_OFFSET 4
+#define EVENT_LEN_OFFSET 9
+#define LOG_POS_OFFSET 13
+#define TABLE_ID_SIZE 6
+#define STMT_END_F 1
+#define CHECKSUM_ALG_CRC32 1
+#define CHECKSUM_SIZE 4
+
+enum binlog_event_type {
+  QUERY_EVENT=2,
+  ROTATE_EVENT=4,
+  FORMAT_DESCRIPTION_EVENT=15,
+  TABLE_MAP_EVENT=19,
+  WRITE_ROWS_EVENT_V1=23,
+  UPDATE_ROWS_EVENT_V1=24,
+  DELETE_ROWS_EVENT_V1=25,
+  WRITE_ROWS_EVENT=30,
+  UPDATE_ROWS_EVENT=31,
+  DELETE_ROWS_EVENT=32,
+  PARTIAL_UPDATE_ROWS_EVENT=39
+};
+
+extern gchar *initial_source_log;
+extern gchar *initial_source_pos;
+
+struct binlog_delta{
+  int file;
+  gchar *filename;
+  guint64 size;
+  GString *buffer;
+  guint checksum_size;
+  gboolean format_description_written;
+  // table_id of the TABLE_MAP events of the dumped tables -> binlog_table
+  GHashTable *dumped_table_ids;
+  // events of the statement that is being read
+  GPtrArray *statement;
+  gboolean statement_has_rows;
+  GHashTable *databases;
+  guint64 statements;
+  gboolean ddl_warned;
+};
+
+// the columns of a TABLE_MAP event, to find where each row image ends
+struct binlog_table{
+  guint columns;
+  guchar *types;
+  guint *metadata;
+};
+
+#ifdef BINLOG_DELTA_SUPPORTED
+static
+guint64 read_uint(const guchar *b, guint bytes){
+  guint64 r=0;
+  guint i;
+  for (i=bytes; i > 0; i--)
+    r= (r << 8) | b[i-1];
+  return r;
+}
+
+static
+void write_uint32(guchar *b, guint32 v){
+  guint i;
+  for (i=0; i < 4; i++, v>>=8)
+    b[i]= v & 0xff;
+}
+
+// length encoded integer, p is moved after it
+static
+gboolean read_packed_uint(const guchar **p, const guchar *end, guint64 *value){
+  guint bytes;
+  if (*p >= end)
+    return FALSE;
+  if (**p < 251){
+    *value=**p;
+    (*p)++;
+    return TRUE;
+  }
+  bytes= **p == 252 ? 2 : **p == 253 ? 3 : 8;
+  if (*p + 1 + bytes > end)
+    return FALSE;
+  *value=read_uint(*p + 1, bytes);
+  *p+=1 + bytes;
+  return TRUE;
+}
+
+static
+void free_binlog_table(struct binlog_table *bt){
+  if (bt == NULL)
+    return;
+  g_free(bt->types);
+  g_free(bt->metadata);
+  g_free(bt);
+}
+
+// The metadata of each column type, as Table_map_log_event writes it
+static
+gboolean read_column_metadata(guchar type, const guchar **p, const guchar *end, guint *metadata){
+  guint bytes;
+  switch (type){
+    case MYSQL_TYPE_FLOAT: case MYSQL_TYPE_DOUBLE: case MYSQL_TYPE_BLOB: case MYSQL_TYPE_GEOMETRY:
+    case MYSQL_TYPE_JSON: case MYSQL_TYPE_TIMESTAMP2: case MYSQL_TYPE_DATETIME2: case MYSQL_TYPE_TIME2:
+      bytes=1;
+      break;
+    case MYSQL_TYPE_VARCHAR: case MYSQL_TYPE_VAR_STRING: case MYSQL_TYPE_BIT:
+    case MYSQL_TYPE_NEWDECIMAL: case MYSQL_TYPE_STRING: case MYSQL_TYPE_ENUM: case MYSQL_TYPE_SET:
+      bytes=2;
+      break;
+    default:
+      *metadata=0;
+      return TRUE;
+  }
+  if (*p + bytes > end)
+    return FALSE;
+  if (bytes == 1)
+    *metadata=(*p)[0];
+  else if (type == MYSQL_TYPE_VARCHAR || type == MYSQL_TYPE_VAR_STRING || type == MYSQL_TYPE_BIT)
+    // little endian, BIT is bits % 8 and bytes
+    *metadata=(*p)[0] | ((*p)[1] << 8);
+  else
+    // real type and length, or precision and scale
+    *metadata=((*p)[0] << 8) | (*p)[1];
+  *p+=bytes;
+  return TRUE;
+}
+
+static
+struct binlog_table *parse_table_map(struct binlog_delta *bd, const guchar *columns, const guchar *ev, guint len){
+  const guchar *p=columns, *end=ev + len - bd->checksum_size, *metadata_end=NULL;
+  guint64 count=0, metadata_len=0;
+  guint i;
+  if (!read_packed_uint(&p, end, &count) || p + count > end)
+    return NULL;
+  struct binlog_table *bt=g_new0(struct binlog_table, 1);
+  bt->columns=count;
+  bt->types=g_new(guchar, count);
+  memcpy(bt->types, p, count);
+  bt->metadata=g_new0(guint, count);
+  p+=count;
+  if (!read_packed_uint(&p, end, &metadata_len) || p + metadata_len > end){
+    free_binlog_table(bt);
+    return NULL;
+  }
+  metadata_end=p + metadata_len;
+  for (i=0; i < bt->columns; i++)
+    if (!read_column_metadata(bt->types[i], &p, metadata_end, &(bt->metadata[i]))){
+      free_binlog_table(bt);
+      return NULL;
+    }
+  return bt;
+}
+
+static const guint decimal_digit_bytes[10]={0, 1, 1, 2, 2, 3, 3, 4, 4, 4};
+
+// Bytes of a value of the row image, as Field::unpack() reads it
+static
+gboolean binlog_field_size(guchar type, guint metadata, const guchar *p, const guchar *end, guint64 *size){
+  guint bytes, length, real_type;
+  switch (type){
+    case MYSQL_TYPE_TINY: case MYSQL_TYPE_YEAR:
+      *size=1;
+      return TRUE;
+    case MYSQL_TYPE_SHORT:
+      *size=2;
+      return TRUE;
+    case MYSQL_TYPE_INT24: case MYSQL_TYPE_DATE: case MYSQL_TYPE_NEWDATE: case MYSQL_TYPE_TIME:
+      *size=3;
+      return TRUE;
+    case MYSQL_TYPE_LONG: case MYSQL_TYPE_TIMESTAMP:
+      *size=4;
+      return TRUE;
+    case MYSQL_TYPE_LONGLONG: case MYSQL_TYPE_DATETIME:
+      *size=8;
+      return TRUE;
+    case MYSQL_TYPE_FLOAT: case MYSQL_TYPE_DOUBLE:
+      *size=metadata;
+      return TRUE;
+    case MYSQL_TYPE_NULL:
+      *size=0;
+      return TRUE;
+    // the fractional seconds take a byte every 2 digits
+    case MYSQL_TYPE_TIMESTAMP2:
+      *size=4 + (metadata + 1) / 2;
+      return TRUE;
+    case MYSQL_TYPE_DATETIME2:
+      *size=5 + (metadata + 1) / 2;
+      return TRUE;
+    case MYSQL_TYPE_TIME2:
+      *size=3 + (metadata + 1) / 2;
+      return TRUE;
+    case MYSQL_TYPE_BIT:
+      *size=((metadata >> 8) * 8 + (metadata & 0xff) + 7) / 8;
+      return TRUE;
+    case MYSQL_TYPE_NEWDECIMAL:
+      // 4 bytes every 9 digits of the integer and of the fractional part
+      length=(metadata >> 8) - (metadata & 0xff);
+      *size=(length / 9) * 4 + decimal_digit_bytes[length % 9] + ((metadata & 0xff) / 9) * 4 + decimal_digit_bytes[(metadata & 0xff) % 9];
+      return TRUE;
+    case MYSQL_TYPE_VARCHAR: case MYSQL_TYPE_VAR_STRING:
+      bytes= metadata > 255 ? 2 : 1;
+      break;
+    case MYSQL_TYPE_BLOB: case MYSQL_TYPE_GEOMETRY: case MYSQL_TYPE_JSON:
+      bytes=metadata;
+      if (bytes < 1 || bytes > 4)
+        return FALSE;
+      break;
+    case MYSQL_TYPE_STRING: case MYSQL_TYPE_ENUM: case MYSQL_TYPE_SET:
+      real_type=metadata >> 8;
+      length=metadata & 0xff;
+      // CHAR longer than 255 keeps the high bits of its length in the type
+      if (metadata >= 256 && (real_type & 0x30) != 0x30){
+        length|=((real_type & 0x30) ^ 0x30) << 4;
+        real_type|=0x30;
+      }
+      if (metadata >= 256 && (real_type == MYSQL_TYPE_ENUM || real_type == MYSQL_TYPE_SET)){
+        *size=length;
+        return TRUE;
+      }
+      bytes= length > 255 ? 2 : 1;
+      break;
+    default:
+      return FALSE;
+  }
+  if (p + bytes > end)
+    return FALSE;
+  *size=bytes + read_uint(p, bytes);
+  return TRUE;
+}
+
+// Length of the row image at p, with the columns that are set on present
+static
+gboolean row_image_length(struct binlog_table *bt, guint width, const guchar *present, const guchar *p, const guchar *end, guint *length){
+  const guchar *start=p, *null_bitmap=p;
+  guint i, n=0;
+  guint64 size=0;
+  for (i=0; i < width; i++)
+    if (present[i / 8] & (1 << (i % 8)))
+      n++;
+  p+=(n + 7) / 8;
+  if (n == 0 || p > end)
+    return FALSE;
+  n=0;
+  for (i=0; i < width; i++){
+    if (!(present[i / 8] & (1 << (i % 8))))
+      continue;
+    if (null_bitmap[n / 8] & (1 << (n % 8))){
+      n++;
+      continue;
+    }
+    n++;
+    if (!binlog_field_size(bt->types[i], bt->metadata[i], p, end, &size) || p + size > end)
+      return FALSE;
+    p+=size;
+  }
+  *length=p - start;
+  return TRUE;
+}
+
+static
+void finish_rows_event(struct binlog_delta *bd, GByteArray *event, guchar type, gboolean end_of_statement){
+  guint16 flags=read_uint(event->data + EVENT_HEADER_SIZE + TABLE_ID_SIZE, 2);
+  if (!end_of_statement)
+    flags&=~STMT_END_F;
+  event->data[EVENT_HEADER_SIZE + TABLE_ID_SIZE]= flags & 0xff;
+  event->data[EVENT_TYPE_OFFSET]=type;
+  if (bd->checksum_size)
+    g_byte_array_set_size(event, event->len + CHECKSUM_SIZE);
+  write_uint32(event->data + EVENT_LEN_OFFSET, event->len);
+  if (bd->checksum_size)
+    write_uint32(event->data + event->len - CHECKSUM_SIZE, crc32(0L, event->data, event->len - CHECKSUM_SIZE));
+}
+
+/* With rbr_exec_mode=IDEMPOTENT the UPDATE of a row that is not on the
+   target is skipped, so a row moved by its key from a chunk that was read
+   later into one that was read before would be lost. The UPDATE is added
+   as the DELETE of its before images and the WRITE of its after images,
+   which inserts or replaces the row */
+static
+gboolean split_update_rows(struct binlog_delta *bd, struct binlog_table *bt, const guchar *ev, guint len){
+  guchar type=ev[EVENT_TYPE_OFFSET];
+  gboolean v2= type == UPDATE_ROWS_EVENT;
+  guint post_header=TABLE_ID_SIZE + 2 + (v2 ? read_uint(ev + EVENT_HEADER_SIZE + TABLE_ID_SIZE + 2, 2) : 0);
+  const guchar *body=ev + EVENT_HEADER_SIZE + post_header, *end=ev + len - bd->checksum_size, *p=body;
+  guint64 width=0;
+  guint before_length=0, after_length=0, bitmap_length;
+  if (bt == NULL || body > end || !read_packed_uint(&p, end, &width) || width > bt->columns)
+    return FALSE;
+  bitmap_length=(width + 7) / 8;
+  const guchar *before_columns=p, *after_columns=p + bitmap_length;
+  p=after_columns + bitmap_length;
+  if (p > end)
+    return FALSE;
+  GByteArray *deletes=g_byte_array_sized_new(len), *writes=g_byte_array_sized_new(len);
+  // same header, post header and width, each with its columns
+  g_byte_array_append(deletes, ev, before_columns - ev);
+  g_byte_array_append(deletes, before_columns, bitmap_length);
+  g_byte_array_append(writes, ev, before_columns - ev);
+  g_byte_array_append(writes, after_columns, bitmap_length);
+  while (p < end){
+    if (!row_image_length(bt, width, before_columns, p, end, &before_length) ||
+        !row_image_length(bt, width, after_columns, p + before_length, end, &after_length)){
+      g_byte_array_unref(deletes);
+      g_byte_array_unref(writes);
+      return FALSE;
+    }
+    g_byte_array_append(deletes, p, before_length);
+    g_byte_array_append(writes, p + before_length, after_length);
+    p+=before_length + after_length;
+  }
+  finish_rows_event(bd, deletes, v2 ? DELETE_ROWS_EVENT : DELETE_ROWS_EVENT_V1, FALSE);
+  finish_rows_event(bd, writes, v2 ? WRITE_ROWS_EVENT : WRITE_ROWS_EVENT_V1, TRUE);
+  g_ptr_array_add(bd->statement, deletes);
+  g_ptr_array_add(bd->statement, writes);
+  return TRUE;
+}
+
+static
+void flush_binlog_delta(struct binlog_delta *bd){
+  if (bd->buffer->len == 0)
+    return;
+  if (!write_data(bd->file, bd->buffer)){
+    g_critical("Could not write the binlog delta into %s", bd->filename);
+    errors++;
+  }
+  bd->size+=bd->buffer->len;
+  g_string_set_size(bd->buffer, 0);
+}
+
+// events are written as mysqlbinlog does, in BINLOG statements
+static
+void append_binlog_statement(struct binlog_delta *bd, GPtrArray *events){
+  guint i;
+  g_string_append(bd->buffer, "BINLOG '\n");
+  for (i=0; i < events->len; i++){
+    GByteArray *ev=g_ptr_array_index(events, i);
+    gchar *encoded=g_base64_encode(ev->data, ev->len);
+    g_string_append(bd->buffer, encoded);
+    g_string_append_c(bd->buffer, '\n');
+    g_free(encoded);
+  }
+  g_string_append(bd->buffer, "';\n");
+  bd->statements++;
+  if (bd->buffer->len > BINLOG_DELTA_WRITE_SIZE)
+    flush_binlog_delta(bd);
+}
+
+static
+gboolean is_rows_event(guchar type){
+  return (type >= WRITE_ROWS_EVENT_V1 && type <= DELETE_ROWS_EVENT_V1) ||
+         (type >= WRITE_ROWS_EVENT && type <= DELETE_ROWS_EVENT) ||
+         type == PARTIAL_UPDATE_ROWS_EVENT;
+}
+
+/* The rows of the tables that were not dumped are not in the statement, the
+   last event that is kept has to close it */
+static
+void end_statement(struct binlog_delta *bd){
+  if (bd->statement_has_rows){
+    GByteArray *last=g_ptr_array_index(bd->statement, bd->statement->len - 1);
+    guint16 flags=read_uint(last->data + EVENT_HEADER_SIZE + TABLE_ID_SIZE, 2);
+    if (!(flags & STMT_END_F)){
+      flags|=STMT_END_F;
+      last->data[EVENT_HEADER_SIZE + TABLE_ID_SIZE]= flags & 0xff;
+      if (bd->checksum_size)
+        write_uint32(last->data + last->len - CHECKSUM_SIZE, crc32(0L, last->data, last->len - CHECKSUM_SIZE));
+    }
+    append_binlog_statement(bd, bd->statement);
+  }
+  g_ptr_array_set_size(bd->statement, 0);
+  bd->statement_has_rows=FALSE;
+}
+
+static
+void add_to_statement(struct binlog_delta *bd, const guchar *ev, guint len){
+  GByteArray *copy=g_byte_array_sized_new(len);
+  g_byte_array_append(copy, ev, len);
+  g_ptr_array_add(bd->statement, copy);
+}
+
+static
+void process_table_map(struct binlog_delta *bd, const guchar *ev, guint len){
+  const guchar *body=ev + EVENT_HEADER_SIZE + TABLE_ID_SIZE + 2;
+  gint64 table_id=read_uint(ev + EVENT_HEADER_SIZE, TABLE_ID_SIZE);
+  gchar *database=g_strndup((const gchar *)body + 1, body[0]);
+  const guchar *table_name=body + 1 + body[0] + 1;
+  gchar *table=g_strndup((const gchar *)table_name + 1, table_name[0]);
+  gchar *key=build_dbt_key(database, table);
+  if (g_hash_table_lookup(all_dbts, key)){
+    gint64 *id=g_new(gint64, 1);
+    *id=table_id;
+    g_hash_table_replace(bd->dumped_table_ids, id, parse_table_map(bd, table_name + 1 + table_name[0] + 1, ev, len));
+    add_to_statement(bd, ev, len);
+  }else
+    // the table_id of a dumped table can be reused by another table
+    g_hash_table_remove(bd->dumped_table_ids, &table_id);
+  g_free(key);
+  g_free(database);
+  g_free(table);
+}
+
+static
+void process_rows(struct binlog_delta *bd, const guchar *ev, guint len){
+  gint64 table_id=read_uint(ev + EVENT_HEADER_SIZE, TABLE_ID_SIZE);
+  guint16 flags=read_uint(ev + EVENT_HEADER_SIZE + TABLE_ID_SIZE, 2);
+  guchar type=ev[EVENT_TYPE_OFFSET];
+  if (g_hash_table_contains(bd->dumped_table_ids, &table_id)){
+    if ((type == UPDATE_ROWS_EVENT || type == UPDATE_ROWS_EVENT_V1) &&
+        !split_update_rows(bd, g_hash_table_lookup(bd->dumped_table_ids, &table_id), ev, len)){
+      g_critical("Could not decode an UPDATE in the binlog delta, a row moved by it between chunks might be lost");
+      errors++;
+      add_to_statement(bd, ev, len);
+    }else if (type != UPDATE_ROWS_EVENT && type != UPDATE_ROWS_EVENT_V1)
+      add_to_statement(bd, ev, len);
+    bd->statement_has_rows=TRUE;
+  }
+  if (flags & STMT_END_F)
+    end_statement(bd);
+}
+
+// a DDL on a dumped database changes the tables that the delta is applied on
+static
+void process_query(struct binlog_delta *bd, const guchar *ev, guint len){
+  const guchar *post_header=ev + EVENT_HEADER_SIZE;
+  guint db_len=post_header[8];
+  guint status_vars_len=read_uint(post_header + 11, 2);
+  const gchar *database=(const gchar *)post_header + 13 + status_vars_len;
+  const gchar *query=database + db_len + 1;
+  gint query_len=(const gchar *)ev + len - bd->checksum_size - query;
+  if (bd->ddl_warned || query_len <= 0)
+    return;
+  if (!g_ascii_strncasecmp(query, "BEGIN", 5) || !g_ascii_strncasecmp(query, "COMMIT", 6) ||
+      !g_ascii_strncasecmp(query, "ROLLBACK", 8) || !g_ascii_strncasecmp(query, "SAVEPOINT", 9) ||
+      !g_ascii_strncasecmp(query, "XA ", 3))
+    return;
+  gchar *db=g_strndup(database, db_len);
+  if (g_hash_table_contains(bd->databases, db)){
+    g_warning("A statement was executed on %s while it was dumped, the binlog delta might not be applied: %.*s", db, query_len, query);
+    bd->ddl_warned=TRUE;
+  }
+  g_free(db);
+}
+
+static
+void process_format_description(struct binlog_delta *bd, const guchar *ev, guint len){
+  bd->checksum_size= ev[len - CHECKSUM_SIZE - 1] == CHECKSUM_ALG_CRC32 ? CHECKSUM_SIZE : 0;
+  if (bd->format_description_written)
+    return;
+  // the rows events are decoded by the server with it
+  GPtrArray *events=g_ptr_array_new_with_free_func((GDestroyNotify)g_byte_array_unref);
+  GByteArray *copy=g_byte_array_sized_new(len);
+  g_byte_array_append(copy, ev, len);
+  g_ptr_array_add(events, copy);
+  append_binlog_statement(bd, events);
+  g_ptr_array_free(events, TRUE);
+  bd->format_description_written=TRUE;
+}
+
+static
+void read_binlog_delta(struct binlog_delta *bd, gchar *end_log, guint64 end_pos){
+  MYSQL *binlog_conn=mysql_init(NULL);
+  m_connect(binlog_conn);
+  m_query_critical(binlog_conn, "SET @source_binlog_checksum=@@global.binlog_checksum, @master_binlog_checksum=@@global.binlog_checksum", "Failed to set the binlog checksum of the session", NULL);
+  struct M_ROW *mr=m_store_result_row(binlog_conn, "SELECT @@global.binlog_checksum", m_critical, m_critical, "Failed to get binlog_checksum", NULL);
+  // the fake ROTATE event is sent before the FORMAT_DESCRIPTION event
+  bd->checksum_size= g_ascii_strcasecmp(mr->row[0], "CRC32") ? 0 : CHECKSUM_SIZE;
+  m_store_result_row_free(mr);
+  MYSQL_RPL rpl;
+  memset(&rpl, 0, sizeof(rpl));
+  rpl.file_name=initial_source_log;
+  rpl.file_name_length=strlen(initial_source_log);
+  rpl.start_position=g_ascii_strtoull(initial_source_pos, NULL, 10);
+  rpl.flags=BINLOG_DUMP_NON_BLOCK;
+  if (mysql_binlog_open(binlog_conn, &rpl))
+    m_critical("Could not read the binlog from %s:%s: %s", initial_source_log, initial_source_pos, mysql_error(binlog_conn));
+  gchar *current_log=g_strdup(initial_source_log);
+  for (;;){
+    if (mysql_binlog_fetch(binlog_conn, &rpl))
+      m_critical("Could not read the binlog at %s: %s", current_log, mysql_error(binlog_conn));
+    // EOF, the end of the binlog was reached
+    if (rpl.size == 0)
+      break;
+    // the packet starts with the OK byte
+    const guchar *ev=rpl.buffer + 1;
+    guint len=rpl.size - 1;
+    if (len < EVENT_HEADER_SIZE || read_uint(ev + EVENT_LEN_OFFSET, 4) != len)
+      m_critical("Unexpected event in the binlog at %s", current_log);
+    guint64 log_pos=read_uint(ev + LOG_POS_OFFSET, 4);
+    switch (ev[EVENT_TYPE_OFFSET]){
+      case ROTATE_EVENT:
+        g_free(current_log);
+        current_log=g_strndup((const gchar *)ev + EVENT_HEADER_SIZE + 8, len - EVENT_HEADER_SIZE - 8 - bd->checksum_size);
+        break;
+      case FORMAT_DESCRIPTION_EVENT:
+        process_format_description(bd, ev, len);
+        break;
+      case TABLE_MAP_EVENT:
+        process_table_map(bd, ev, len);
+        break;
+      case QUERY_EVENT:
+        process_query(bd, ev, len);
+        break;
+      default:
+        if (is_rows_event(ev[EVENT_TYPE_OFFSET]))
+          process_rows(bd, ev, len);
+    }
+    if (g_strcmp0(current_log, end_log) > 0 || (!g_strcmp0(current_log, end_log) && log_pos >= end_pos))
+      break;
+  }
+  mysql_binlog_close(binlog_conn, &rpl);
+  mysql_close(binlog_conn);
+  g_free(current_log);
+}
+#endif
+
+void start_binlog_delta(MYSQL *conn){
+#ifndef BINLOG_DELTA_SUPPORTED
+  (void) conn;
+  m_critical("--sync-thread-lock-mode BINLOG_DELTA needs mydumper built with the MySQL 8.0 client library");
+#else
+  if (!is_mysql_like() || get_product() == SERVER_TYPE_MARIADB)
+    m_critical("--sync-thread-lock-mode BINLOG_DELTA is only supported on MySQL and Percona Server");
+  struct M_ROW *mr=m_store_result_row(conn, "SELECT @@log_bin, @@binlog_format, @@binlog_row_image", m_critical, m_critical, "Failed to get the binlog configuration", NULL);
+  if (g_strcmp0(mr->row[0], "1") || g_ascii_strcasecmp(mr->row[1], "ROW") || g_ascii_strcasecmp(mr->row[2], "FULL"))
+    m_critical("--sync-thread-lock-mode BINLOG_DELTA needs log_bin, binlog_format=ROW and binlog_row_image=FULL");
+  m_store_result_row_free(mr);
+  // the rows events of a compressed transaction are not sent one by one
+  mr=m_store_result_row(conn, "SELECT @@binlog_transaction_compression", NULL, NULL, "binlog_transaction_compression not found", NULL);
+  if (mr->row && !g_strcmp0(mr->row[0], "1"))
+    m_critical("--sync-thread-lock-mode BINLOG_DELTA can not be used with binlog_transaction_compression");
+  m_store_result_row_free(mr);
+  // the UPDATEs are applied as a DELETE and a WRITE of the whole after image
+  mr=m_store_result_row(conn, "SELECT @@binlog_row_value_options", NULL, NULL, "binlog_row_value_options not found", NULL);
+  if (mr->row && mr->row[0] && strstr(mr->row[0], "PARTIAL_JSON"))
+    m_critical("--sync-thread-lock-mode BINLOG_DELTA can not be used with binlog_row_value_options=PARTIAL_JSON");
+  m_store_result_row_free(mr);
+  g_message("Executing in BINLOG_DELTA mode, each chunk is read in its own transaction and the binlog of the dump is written into %s", BINLOG_DELTA_FILENAME);
+#endif
+}
+
+/* The chunks were read at different points of time between the start and the
+   end of the dump. The row events in between are applied by myloader with
+   rbr_exec_mode=IDEMPOTENT after the data: a row that is already in a chunk is
+   overwritten and a DELETE of a row that is not there is skipped. An UPDATE
+   would be skipped too when its before image is not there, so it is written
+   as a DELETE and a WRITE of the after image, see split_update_rows(), and
+   every row ends at the value it had at the end position */
+void write_binlog_delta(MYSQL *conn, FILE *mdfile){
+  if (sync_thread_lock_mode != BINLOG_DELTA)
+    return;
+#ifdef BINLOG_DELTA_SUPPORTED
+  gchar *end_log=NULL, *end_pos=NULL, *end_gtid=NULL;
+  get_binlog_position(conn, &end_log, &end_pos, &end_gtid);
+  if (initial_source_log == NULL || end_log == NULL)
+    m_critical("Could not get the binlog position of the dump window");
+  g_message("Reading the binlog delta from %s:%s to %s:%s", initial_source_log, initial_source_pos, end_log, end_pos);
+
+  struct binlog_delta bd;
+  memset(&bd, 0, sizeof(bd));
+  bd.filename=g_build_filename(dump_directory, BINLOG_DELTA_FILENAME, NULL);
+  bd.file=m_open(&bd.filename, "w");
+  if (bd.file < 0){
+    g_critical("Could not create output file %s (%d)", bd.filename, errno);
+    errors++;
+    g_free(bd.filename);
+    return;
+  }
+  bd.buffer=g_string_sized_new(BINLOG_DELTA_WRITE_SIZE);
+  bd.dumped_table_ids=g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, (GDestroyNotify)free_binlog_table);
+  bd.statement=g_ptr_array_new_with_free_func((GDestroyNotify)g_byte_array_unref);
+  bd.databases=g_hash_table_new(g_str_hash, g_str_equal);
+  GHashTableIter iter;
+  struct db_table *dbt=NULL;
+  g_hash_table_iter_init(&iter, all_dbts);
+  while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&dbt))
+    g_hash_table_add(bd.databases, dbt->database->source_database);
+
+  g_string_append(bd.buffer, "/*!50701 SET SESSION rbr_exec_mode=IDEMPOTENT*/;\n");
+  read_binlog_delta(&bd, end_log, g_ascii_strtoull(end_pos, NULL, 10));
+  end_statement(&bd);
+  flush_binlog_delta(&bd);
+  m_close(0, bd.file, bd.filename, bd.size, NULL);
+  g_message("Binlog delta written, %"G_GUINT64_FORMAT" statements", bd.statements);
+
+  write_source_section(mdfile, end_log, end_pos, end_gtid);
+  g_hash_table_destroy(bd.databases);
+  g_ptr_array_free(bd.statement, TRUE);
+  g_hash_table_destroy(bd.dumped_table_ids);
+  g_string_free(bd.buffer, TRUE);
+  g_free(end_log);
+  g_free(end_pos);
+  g_free(end_gtid);
+#else
+  (void) conn;
+  (void) mdfile;
+#endif
+}
@@ -0,0 +1,34 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#if !defined(mydumper_mydumper_binlog_delta)
+#define mydumper_mydumper_binlog_delta
+
+#include <mysql.h>
+#include <glib.h>
+#include <stdio.h>
+
+#define BINLOG_DELTA_FILENAME "binlog-delta.sql"
+
+/* With --sync-thread-lock-mode BINLOG_DELTA there is no global lock nor
+   consistent snapshot. Once the data is dumped the row events of the dumped
+   tables between the binlog position of the start and of the end of the dump
+   are written into BINLOG_DELTA_FILENAME, in order, as BINLOG statements. The
+   [source] section of the metadata has the end position */
+void start_binlog_delta(MYSQL *conn);
+void write_binlog_delta(MYSQL *conn, FILE *mdfile);
+#endif
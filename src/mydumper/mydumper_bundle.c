@@ -0,0 +1,202 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+#include <glib/gstdio.h>
+
+#include "mydumper.h"
+#include "mydumper_global.h"
+#include "mydumper_bundle.h"
+
+/* --bundle-tables-under: the files of the tables smaller than it are
+ * appended, once they are complete, to the bundle of their database and
+ * removed. BUNDLE_INDEX has one "filename<TAB>bundle<TAB>offset<TAB>length"
+ * line per file, so myloader reads them from the bundle with their own name.
+ * A new bundle of the database is started when it reaches BUNDLE_FILE_SIZE.
+ *
+ * The files are still written, closed and compressed one by one, and then
+ * copied into the bundle, so the dump writes the data of these tables twice.
+ * Writing them straight into the bundle would leave the compression, the
+ * --file-checksums and the --io-mode handling of m_open()/m_close() out.
+ * The copy is done by the kernel with sendfile(), and it costs about as much
+ * as writing the file did. What the bundles save is on the myloader side and
+ * on the filesystem, which only keeps a few files per database */
+guint bundle_tables_under=0;
+static FILE *bundle_index_file=NULL;
+static GMutex *bundle_mutex=NULL;
+// database_name_in_filename -> struct bundle
+static GHashTable *bundles=NULL;
+static guint bundled_files=0;
+
+#define BUNDLE_FILE_SIZE 1073741824
+#define BUNDLE_COPY_SIZE 1048576
+
+struct bundle {
+  FILE *file;
+  gchar *name;
+  guint number;
+  guint64 size;
+};
+
+static
+void close_bundle(struct bundle *b){
+  if (b->file && fclose(b->file)){
+    g_critical("Could not close bundle %s: %s", b->name, strerror(errno));
+    errors++;
+  }
+  b->file=NULL;
+  g_free(b->name);
+  b->name=NULL;
+}
+
+static
+void free_bundle(struct bundle *b){
+  close_bundle(b);
+  g_free(b);
+}
+
+void initialize_bundle(){
+  if (bundle_tables_under == 0)
+    return;
+  if (bundle_mutex == NULL)
+    bundle_mutex=g_mutex_new();
+  bundles=g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)free_bundle);
+  gchar *filename=g_build_filename(dump_directory, BUNDLE_INDEX, NULL);
+  bundle_index_file=g_fopen(filename, "w");
+  if (!bundle_index_file)
+    m_critical("Couldn't create bundle index %s (%s)", filename, strerror(errno));
+  g_free(filename);
+  bundled_files=0;
+}
+
+void finalize_bundle(){
+  if (bundle_index_file == NULL)
+    return;
+  g_hash_table_destroy(bundles);
+  bundles=NULL;
+  fclose(bundle_index_file);
+  bundle_index_file=NULL;
+  g_message("%u files were packed into bundles", bundled_files);
+}
+
+// Called with bundle_mutex
+static
+struct bundle *get_bundle(const gchar *database, gsize length){
+  struct bundle *b=g_hash_table_lookup(bundles, database);
+  if (b == NULL){
+    b=g_new0(struct bundle, 1);
+    g_hash_table_insert(bundles, g_strdup(database), b);
+  }else if (b->file && b->size > 0 && b->size + length > BUNDLE_FILE_SIZE){
+    close_bundle(b);
+    b->number++;
+  }
+  if (b->file == NULL){
+    b->name=g_strdup_printf("%s.%05u" BUNDLE_EXTENSION, database, b->number);
+    gchar *path=g_build_filename(dump_directory, b->name, NULL);
+    b->file=g_fopen(path, "w");
+    if (!b->file)
+      m_critical("Couldn't create bundle %s (%s)", path, strerror(errno));
+    g_free(path);
+    b->size=0;
+  }
+  return b;
+}
+
+// The bundle is only written through its descriptor, never with stdio
+static
+gboolean copy_into_bundle(int in, int out, guint64 length){
+  guint64 copied=0;
+  ssize_t n;
+#ifdef __linux__
+  while (copied < length){
+    n=sendfile(out, in, NULL, length - copied);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    copied+=n;
+  }
+#endif
+  // without sendfile, the rest is copied from where it stopped
+  if (copied == length)
+    return TRUE;
+  gchar *buffer=g_malloc(BUNDLE_COPY_SIZE);
+  ssize_t w;
+  while (copied < length && (n=read(in, buffer, BUNDLE_COPY_SIZE)) > 0){
+    ssize_t written=0;
+    while (written < n && (w=write(out, buffer + written, n - written)) > 0)
+      written+=w;
+    if (written < n)
+      break;
+    copied+=n;
+  }
+  g_free(buffer);
+  return copied == length;
+}
+
+/* Called when the file is complete on disk. Returns TRUE if it was moved
+ * into a bundle. gzip files are opened by name by myloader, so they are kept */
+gboolean bundle_file(const gchar *filename, struct db_table *dbt){
+  if (bundle_index_file == NULL || dbt == NULL || g_str_has_suffix(filename, GZIP_EXTENSION))
+    return FALSE;
+  guint64 limit=(guint64)bundle_tables_under * 1024 * 1024;
+  if (dbt->data_length >= limit)
+    return FALSE;
+  int in=open(filename, O_RDONLY);
+  struct stat st;
+  if (in < 0 || fstat(in, &st)){
+    g_warning("Could not read %s to add it into its bundle: %s", filename, strerror(errno));
+    if (in >= 0)
+      close(in);
+    return FALSE;
+  }
+  guint64 length=st.st_size;
+  // the statistics of the table might be outdated
+  if (length >= limit){
+    close(in);
+    return FALSE;
+  }
+  gchar *basename=g_path_get_basename(filename);
+  g_mutex_lock(bundle_mutex);
+  struct bundle *b=get_bundle(dbt->database->database_name_in_filename, length);
+  gboolean ok=copy_into_bundle(in, fileno(b->file), length);
+  if (ok){
+    fprintf(bundle_index_file, "%s\t%s\t%"G_GUINT64_FORMAT"\t%"G_GUINT64_FORMAT"\n", basename, b->name, b->size, length);
+    fflush(bundle_index_file);
+    b->size+=length;
+    bundled_files++;
+  }else{
+    // the file stays in the directory, the bundle continues after its end
+    g_critical("Could not add %s into bundle %s: %s", filename, b->name, strerror(errno));
+    errors++;
+    close_bundle(b);
+    b->number++;
+  }
+  g_mutex_unlock(bundle_mutex);
+  close(in);
+  if (ok && g_unlink(filename))
+    g_warning("Could not remove %s after adding it into its bundle: %s", filename, strerror(errno));
+  g_free(basename);
+  return ok;
+}
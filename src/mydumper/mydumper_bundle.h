@@ -0,0 +1,31 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#ifndef _src_mydumper_bundle_h
+#define _src_mydumper_bundle_h
+#include <glib.h>
+
+#define BUNDLE_INDEX "metadata.bundles"
+#define BUNDLE_EXTENSION ".bundle"
+
+extern guint bundle_tables_under;
+
+struct db_table;
+void initialize_bundle();
+void finalize_bundle();
+gboolean bundle_file(const gchar *filename, struct db_table *dbt);
+#endif
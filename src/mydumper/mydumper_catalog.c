@@ -0,0 +1,355 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+
+#include <string.h>
+#include <stdlib.h>
+#include <mysql.h>
+#include <glib.h>
+#include "common.h"
+#include "server_detect.h"
+#include "mydumper_common.h"
+#include "mydumper_global.h"
+#include "mydumper_catalog.h"
+
+// over this amount of changed tables the reload reads the whole schemas again
+#define CATALOG_MAX_RELOAD_LIST 500
+
+gboolean prefetch_catalog=FALSE;
+
+static GHashTable *catalog=NULL;
+static gboolean catalog_partitions=FALSE;
+
+// nullable is YES or empty, as in SHOW INDEX and STATISTICS
+struct catalog_index_column *new_catalog_index_column(const gchar *key_name, const gchar *non_unique, const gchar *seq, const gchar *column, const gchar *cardinality, const gchar *nullable){
+  struct catalog_index_column *cic=g_new(struct catalog_index_column, 1);
+  cic->key_name=g_strdup(key_name);
+  cic->non_unique=g_strcmp0(non_unique, "0") != 0;
+  cic->seq=seq ? strtoul(seq, NULL, 10) : 0;
+  cic->column=g_strdup(column);
+  cic->cardinality=cardinality ? strtoull(cardinality, NULL, 10) : 0;
+  cic->nullable=g_strcmp0(nullable, "YES") == 0;
+  return cic;
+}
+
+void free_catalog_index_column(struct catalog_index_column *cic){
+  g_free(cic->key_name);
+  g_free(cic->column);
+  g_free(cic);
+}
+
+static
+struct catalog_table *new_catalog_table(const gchar *create_time, const gchar *rows){
+  struct catalog_table *ct=g_new0(struct catalog_table, 1);
+  ct->create_time=g_strdup(create_time);
+  ct->has_rows=rows != NULL;
+  ct->rows=rows ? strtoull(rows, NULL, 10) : 0;
+  ct->selectable_fields=g_ptr_array_new_with_free_func(g_free);
+  return ct;
+}
+
+static
+void free_catalog_table(struct catalog_table *ct){
+  g_free(ct->create_time);
+  g_free(ct->fingerprint);
+  g_ptr_array_free(ct->selectable_fields, TRUE);
+  g_list_free_full(ct->index_columns, (GDestroyNotify)free_catalog_index_column);
+  g_list_free_full(ct->partitions, g_free);
+  g_free(ct);
+}
+
+static
+GHashTable *new_catalog_hash(){
+  return g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)free_catalog_table);
+}
+
+static
+void drop_catalog(){
+  if (catalog)
+    g_hash_table_destroy(catalog);
+  catalog=NULL;
+}
+
+// same format than build_dbt_key() without allocating per row
+static
+void catalog_key(GString *key, const gchar *database, const gchar *table){
+  g_string_printf(key, "%c%s%c.%c%s%c", identifier_quote_character, database, identifier_quote_character, identifier_quote_character, table, identifier_quote_character);
+}
+
+// rows come ordered by schema and table, so consecutive rows reuse the entry
+static
+struct catalog_table *catalog_row_table(MYSQL_ROW row, GString *key, GString *last_key, struct catalog_table **last){
+  catalog_key(key, row[0], row[1]);
+  if (last_key->len == 0 || strcmp(key->str, last_key->str)){
+    g_string_assign(last_key, key->str);
+    *last=g_hash_table_lookup(catalog, key->str);
+  }
+  // only the tables that are not already loaded are filled
+  return *last && !(*last)->loaded ? *last : NULL;
+}
+
+static
+GString *catalog_schema_filter(MYSQL *conn, gchar **databases){
+  GString *filter=g_string_new("TABLE_SCHEMA ");
+  guint i=0;
+  if (databases && g_strv_length(databases) > 0){
+    g_string_append(filter, "IN (");
+    for (i=0; databases[i]; i++){
+      gchar *escaped=escape_string(conn, databases[i]);
+      g_string_append_printf(filter, "%s'%s'", i > 0 ? "," : "", escaped);
+      g_free(escaped);
+    }
+    g_string_append_c(filter, ')');
+  }else
+    g_string_append(filter, "NOT IN ('information_schema','performance_schema')");
+  return filter;
+}
+
+// the keys are built from the unescaped names, so the list of tables to
+// reload is kept as pairs of escaped names
+static
+void catalog_append_reload(MYSQL *conn, GString *reload, const gchar *database, const gchar *table){
+  gchar *d=escape_string(conn, (gchar *)database), *t=escape_string(conn, (gchar *)table);
+  g_string_append_printf(reload, "%s(TABLE_SCHEMA='%s' AND TABLE_NAME='%s')", reload->len > 0 ? " OR " : "", d, t);
+  g_free(d);
+  g_free(t);
+}
+
+static
+MYSQL_RES *catalog_query(MYSQL *conn, const gchar *select, const gchar *from, const gchar *where, const gchar *filter, const gchar *order){
+  gchar *query=g_strdup_printf("SELECT %s FROM information_schema.%s WHERE %s%s(%s) ORDER BY %s", select, from, where, strlen(where) > 0 ? " AND " : "", filter, order);
+  MYSQL_RES *res=m_store_result(conn, query, m_warning, "Failed to prefetch information_schema.%s: %s", from, query);
+  g_free(query);
+  return res;
+}
+
+static
+gboolean load_catalog_columns(MYSQL *conn, const gchar *filter, GString *key, GString *last_key){
+  MYSQL_RES *res=catalog_query(conn, "TABLE_SCHEMA, TABLE_NAME, COLUMN_NAME, COLUMN_TYPE, EXTRA", "COLUMNS", "", filter,
+                               "TABLE_SCHEMA, TABLE_NAME, ORDINAL_POSITION");
+  if (!res)
+    return FALSE;
+  MYSQL_ROW row;
+  struct catalog_table *last=NULL, *ct=NULL;
+  g_string_set_size(last_key, 0);
+  while ((row=mysql_fetch_row(res))){
+    if (!(ct=catalog_row_table(row, key, last_key, &last)))
+      continue;
+    const gchar *extra=row[4] ? row[4] : "";
+    if (row[3] && !g_ascii_strcasecmp(row[3], "json"))
+      ct->has_json_fields=TRUE;
+    if (strstr(extra, "GENERATED") && !strstr(extra, "DEFAULT_GENERATED"))
+      ct->has_generated_fields=TRUE;
+    if (!strstr(extra, "VIRTUAL GENERATED") && !strstr(extra, "STORED GENERATED"))
+      g_ptr_array_add(ct->selectable_fields, g_strdup(row[2]));
+  }
+  mysql_free_result(res);
+  return TRUE;
+}
+
+// SHOW INDEX lists PRIMARY first and then the unique indexes, this order
+// keeps that for get_primary_key()
+static
+gboolean load_catalog_statistics(MYSQL *conn, const gchar *filter, GString *key, GString *last_key){
+  MYSQL_RES *res=catalog_query(conn, "TABLE_SCHEMA, TABLE_NAME, INDEX_NAME, NON_UNIQUE, SEQ_IN_INDEX, COLUMN_NAME, CARDINALITY, NULLABLE", "STATISTICS", "", filter,
+                               "TABLE_SCHEMA, TABLE_NAME, INDEX_NAME<>'PRIMARY', NON_UNIQUE, INDEX_NAME, SEQ_IN_INDEX");
+  if (!res)
+    return FALSE;
+  MYSQL_ROW row;
+  struct catalog_table *last=NULL, *ct=NULL;
+  g_string_set_size(last_key, 0);
+  while ((row=mysql_fetch_row(res))){
+    if (!(ct=catalog_row_table(row, key, last_key, &last)))
+      continue;
+    ct->index_columns=g_list_append(ct->index_columns, new_catalog_index_column(row[2], row[3], row[4], row[5], row[6], row[7]));
+  }
+  mysql_free_result(res);
+  return TRUE;
+}
+
+static
+gboolean load_catalog_partitions(MYSQL *conn, const gchar *filter, GString *key, GString *last_key){
+  MYSQL_RES *res=catalog_query(conn, "TABLE_SCHEMA, TABLE_NAME, PARTITION_NAME", "PARTITIONS", "PARTITION_NAME IS NOT NULL", filter,
+                               "TABLE_SCHEMA, TABLE_NAME, PARTITION_ORDINAL_POSITION, SUBPARTITION_ORDINAL_POSITION");
+  if (!res)
+    return FALSE;
+  MYSQL_ROW row;
+  struct catalog_table *last=NULL, *ct=NULL, *tail_table=NULL;
+  GList *tail=NULL;
+  g_string_set_size(last_key, 0);
+  while ((row=mysql_fetch_row(res))){
+    if (!(ct=catalog_row_table(row, key, last_key, &last)))
+      continue;
+    if (ct != tail_table){
+      tail_table=ct;
+      tail=NULL;
+    }
+    // subpartitions repeat the name of their partition
+    if (tail && !strcmp(tail->data, row[2]))
+      continue;
+    GList *l=g_list_append(NULL, g_strdup(row[2]));
+    if (tail){
+      tail->next=l;
+      l->prev=tail;
+    }else
+      ct->partitions=l;
+    tail=l;
+  }
+  mysql_free_result(res);
+  return TRUE;
+}
+
+/* CREATE_TIME does not change with every ALTER TABLE, an online or instant
+   ALTER keeps it. A sum of the crc32 of the definition of each column, index
+   column and partition of every table is compared too, it is computed by the
+   server so the views are not read whole. Keys of the tables to their
+   fingerprint, NULL when it could not be read */
+static const gchar *catalog_fingerprint_queries[]={
+  "COLUMNS", "CONCAT_WS(':', ORDINAL_POSITION, COLUMN_NAME, COLUMN_TYPE, EXTRA, IS_NULLABLE, COLLATION_NAME)", "",
+  "STATISTICS", "CONCAT_WS(':', INDEX_NAME, NON_UNIQUE, SEQ_IN_INDEX, COLUMN_NAME, NULLABLE)", "",
+  "PARTITIONS", "CONCAT_WS(':', PARTITION_NAME, SUBPARTITION_NAME, PARTITION_ORDINAL_POSITION)", "PARTITION_NAME IS NOT NULL AND ",
+  NULL};
+
+static
+void free_fingerprint(GString *fingerprint){
+  g_string_free(fingerprint, TRUE);
+}
+
+static
+GHashTable *load_catalog_fingerprints(MYSQL *conn, const gchar *filter){
+  GHashTable *fingerprints=g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)free_fingerprint);
+  guint i;
+  MYSQL_ROW row;
+  for (i=0; catalog_fingerprint_queries[i]; i+=3){
+    gchar *query=g_strdup_printf("SELECT TABLE_SCHEMA, TABLE_NAME, COUNT(*), SUM(CRC32(%s)) FROM information_schema.%s WHERE %s(%s) GROUP BY TABLE_SCHEMA, TABLE_NAME",
+        catalog_fingerprint_queries[i+1], catalog_fingerprint_queries[i], catalog_fingerprint_queries[i+2], filter);
+    MYSQL_RES *res=m_store_result(conn, query, m_warning, "Failed to read the fingerprint of information_schema.%s: %s", catalog_fingerprint_queries[i], query);
+    g_free(query);
+    if (!res){
+      g_hash_table_destroy(fingerprints);
+      return NULL;
+    }
+    while ((row=mysql_fetch_row(res))){
+      gchar *lkey=build_dbt_key(row[0], row[1]);
+      GString *fingerprint=g_hash_table_lookup(fingerprints, lkey);
+      if (fingerprint == NULL){
+        fingerprint=g_string_new(NULL);
+        g_hash_table_insert(fingerprints, lkey, fingerprint);
+      }else
+        g_free(lkey);
+      g_string_append_printf(fingerprint, "%s=%s/%s;", catalog_fingerprint_queries[i], row[2], row[3] ? row[3] : "");
+    }
+    mysql_free_result(res);
+  }
+  return fingerprints;
+}
+
+void initialize_catalog(MYSQL *conn, gchar **databases){
+  if (!prefetch_catalog)
+    return;
+  GDateTime *start=g_date_time_new_now_local();
+
+  // TABLE_ROWS is used as estimation, so it must not come from the 8.0 cache
+  if ((get_product() == SERVER_TYPE_MYSQL || get_product() == SERVER_TYPE_PERCONA || get_product() == SERVER_TYPE_RDS) && get_major() >= 8)
+    m_query(conn, "SET SESSION information_schema_stats_expiry=0", m_warning, "Failed to set information_schema_stats_expiry", NULL);
+
+  GString *filter=catalog_schema_filter(conn, databases);
+  MYSQL_RES *res=catalog_query(conn, "TABLE_SCHEMA, TABLE_NAME, CREATE_TIME, TABLE_ROWS", "TABLES", "TABLE_TYPE='BASE TABLE'", filter->str,
+                               "TABLE_SCHEMA, TABLE_NAME");
+  if (!res){
+    drop_catalog();
+    g_string_free(filter, TRUE);
+    g_date_time_unref(start);
+    return;
+  }
+
+  // tables with the same CREATE_TIME and fingerprint are moved from the
+  // previous snapshot
+  GHashTable *fingerprints= daemon_mode ? load_catalog_fingerprints(conn, filter->str) : NULL;
+  GHashTable *previous=catalog;
+  GString *reload=g_string_new("");
+  guint reused=0, reloaded=0;
+  gpointer orig_key=NULL, value=NULL;
+  MYSQL_ROW row;
+  catalog=new_catalog_hash();
+  while ((row=mysql_fetch_row(res))){
+    gchar *lkey=build_dbt_key(row[0], row[1]);
+    GString *fingerprint= fingerprints ? g_hash_table_lookup(fingerprints, lkey) : NULL;
+    struct catalog_table *ct=NULL;
+    if (previous && row[2] && fingerprints && g_hash_table_lookup_extended(previous, lkey, &orig_key, &value) &&
+        !g_strcmp0(((struct catalog_table *)value)->create_time, row[2]) &&
+        !g_strcmp0(((struct catalog_table *)value)->fingerprint, fingerprint ? fingerprint->str : NULL)){
+      g_hash_table_steal(previous, orig_key);
+      g_free(orig_key);
+      ct=value;
+      ct->has_rows=row[3] != NULL;
+      ct->rows=row[3] ? strtoull(row[3], NULL, 10) : 0;
+      reused++;
+    }else{
+      ct=new_catalog_table(row[2], row[3]);
+      ct->fingerprint= fingerprint ? g_strdup(fingerprint->str) : NULL;
+      if (reloaded < CATALOG_MAX_RELOAD_LIST)
+        catalog_append_reload(conn, reload, row[0], row[1]);
+      reloaded++;
+    }
+    g_hash_table_insert(catalog, lkey, ct);
+  }
+  mysql_free_result(res);
+  if (previous)
+    g_hash_table_destroy(previous);
+  if (fingerprints)
+    g_hash_table_destroy(fingerprints);
+
+  if (reloaded > 0){
+    GString *key=g_string_sized_new(256), *last_key=g_string_sized_new(256);
+    const gchar *f=reused > 0 && reloaded <= CATALOG_MAX_RELOAD_LIST ? reload->str : filter->str;
+    if (!load_catalog_columns(conn, f, key, last_key) || !load_catalog_statistics(conn, f, key, last_key)){
+      g_warning("Catalog prefetch failed, the tables are going to be inspected one by one");
+      drop_catalog();
+    }else
+      catalog_partitions=load_catalog_partitions(conn, f, key, last_key);
+    g_string_free(key, TRUE);
+    g_string_free(last_key, TRUE);
+  }
+
+  if (catalog){
+    GHashTableIter iter;
+    g_hash_table_iter_init(&iter, catalog);
+    while (g_hash_table_iter_next(&iter, NULL, &value))
+      ((struct catalog_table *)value)->loaded=TRUE;
+    GDateTime *end=g_date_time_new_now_local();
+    g_message("Catalog of %u tables prefetched in %.3f seconds, %u reused from the previous snapshot",
+              g_hash_table_size(catalog), (gdouble)g_date_time_difference(end, start) / G_TIME_SPAN_SECOND, reused);
+    g_date_time_unref(end);
+  }
+  g_string_free(reload, TRUE);
+  g_string_free(filter, TRUE);
+  g_date_time_unref(start);
+}
+
+struct catalog_table *get_catalog_table(gchar *database, gchar *table){
+  if (!catalog)
+    return NULL;
+  gchar *lkey=build_dbt_key(database, table);
+  struct catalog_table *ct=g_hash_table_lookup(catalog, lkey);
+  g_free(lkey);
+  return ct;
+}
+
+gboolean catalog_has_partitions(){
+  return catalog != NULL && catalog_partitions;
+}
@@ -0,0 +1,58 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#ifndef _src_mydumper_catalog_h
+#define _src_mydumper_catalog_h
+#include <glib.h>
+#include <mysql.h>
+
+/* Columns, indexes and partitions of every base table, read from
+   information_schema with one query per view before the tables are
+   discovered. It is only written before the working threads start, so the
+   lookups do not lock. In daemon mode the tables whose CREATE_TIME and
+   fingerprint did not change are kept for the next snapshot */
+struct catalog_index_column {
+  gchar *key_name;
+  gboolean non_unique;
+  guint seq;
+  gchar *column;
+  guint64 cardinality;
+  gboolean nullable;
+};
+
+struct catalog_table {
+  gchar *create_time;
+  // of its columns, indexes and partitions, only in daemon mode
+  gchar *fingerprint;
+  gboolean has_rows;
+  guint64 rows;
+  gboolean has_json_fields;
+  gboolean has_generated_fields;
+  // names of the columns that are not generated, in ordinal order
+  GPtrArray *selectable_fields;
+  // PRIMARY first, then the unique indexes
+  GList *index_columns;
+  GList *partitions;
+  gboolean loaded;
+};
+
+struct catalog_index_column *new_catalog_index_column(const gchar *key_name, const gchar *non_unique, const gchar *seq, const gchar *column, const gchar *cardinality, const gchar *nullable);
+void free_catalog_index_column(struct catalog_index_column *cic);
+void initialize_catalog(MYSQL *conn, gchar **databases);
+struct catalog_table *get_catalog_table(gchar *database, gchar *table);
+gboolean catalog_has_partitions();
+#endif
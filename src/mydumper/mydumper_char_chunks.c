@@ -0,0 +1,369 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    Domas Mituzas, Facebook ( domas at fb dot com )
+                    Mark Leith, Oracle Corporation (mark dot leith at oracle dot com)
+                    Andrew Hutchings, MariaDB Foundation (andrew at mariadb dot org)
+                    Max Bubenick, Percona RDBA (max dot bubenick at percona dot com)
+                    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#include <mysql.h>
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "mydumper.h"
+#include "mydumper_start_dump.h"
+#include "mydumper_chunks.h"
+#include "mydumper_database.h"
+#include "mydumper_jobs.h"
+#include "mydumper_global.h"
+#include "mydumper_working_thread.h"
+#include "mydumper_write.h"
+#include "mydumper_char_chunks.h"
+#include "mydumper_common.h"
+#include "mydumper_chunk_profile.h"
+
+extern guint max_time_per_select;
+
+static
+union chunk_step *new_char_step(gboolean is_binary, guint64 step, guint64 min_css, guint64 max_css, gchar *cmin, gchar *cmax, struct chunk_step_item *split_from){
+  union chunk_step * cs = g_new0(union chunk_step, 1);
+  cs->char_step.cmin = cmin;
+  cs->char_step.cmax = cmax;
+  cs->char_step.cursor = NULL;
+  cs->char_step.step = step > 0 ? step : 1;
+  cs->char_step.min_chunk_step_size = min_css;
+  cs->char_step.max_chunk_step_size = max_css;
+  cs->char_step.is_binary = is_binary;
+  cs->char_step.generation = 0;
+  cs->char_step.splitting = FALSE;
+  cs->char_step.unsplittable = FALSE;
+  cs->char_step.split_from = split_from;
+  return cs;
+}
+
+struct chunk_step_item *new_char_step_item(gchar *field, gboolean is_binary, guint deep, guint64 part, guint64 step, guint64 min_css, guint64 max_css, gchar *cmin, gchar *cmax, struct chunk_step_item *split_from){
+  struct chunk_step_item *csi = g_new0(struct chunk_step_item, 1);
+  csi->chunk_step = new_char_step(is_binary, step, min_css, max_css, cmin, cmax, split_from);
+  csi->chunk_type=CHAR;
+  csi->position=0;
+  csi->next=NULL;
+  csi->status = UNASSIGNED;
+  csi->chunk_functions.process = &process_char_chunk;
+  csi->chunk_functions.free = &free_char_step_item;
+  csi->chunk_functions.get_next = &get_next_char_chunk;
+  csi->where=g_string_new("");
+  // NULLs are only possible on unique keys and dumped with the first chunk
+  csi->include_null = cmin == NULL && split_from == NULL;
+  csi->prefix = NULL;
+  csi->field = g_strdup(field);
+  csi->mutex = g_mutex_new();
+  csi->part = part;
+  csi->deep = deep;
+  csi->needs_refresh=FALSE;
+  csi->multicolumn=FALSE;
+  return csi;
+}
+
+void free_char_step_item(struct chunk_step_item *csi){
+  if (csi && csi->chunk_step){
+    g_free(csi->chunk_step->char_step.cmin);
+    g_free(csi->chunk_step->char_step.cmax);
+    g_free(csi->chunk_step->char_step.cursor);
+    g_free(csi->chunk_step);
+    csi->chunk_step=NULL;
+  }
+  if (csi->where){
+    g_string_free(csi->where, TRUE);
+    csi->where=NULL;
+  }
+  if (csi->field){
+    g_free(csi->field);
+    csi->field=NULL;
+  }
+  if (csi->mutex){
+    g_mutex_free(csi->mutex);
+    csi->mutex=NULL;
+  }
+}
+
+static
+gchar *get_char_literal(MYSQL *conn, gboolean is_binary, const gchar *value, gulong length){
+  gchar *literal = NULL;
+  if (is_binary){
+    if (length == 0)
+      return g_strdup("''");
+    literal = g_new(gchar, length * 2 + 3);
+    literal[0] = '0';
+    literal[1] = 'x';
+    m_hex_string(literal + 2, value, length);
+    return literal;
+  }
+  literal = g_new(gchar, length * 2 + 3);
+  literal[0] = '\'';
+  gulong l = mysql_real_escape_string(conn, literal + 1, value, length);
+  literal[l + 1] = '\'';
+  literal[l + 2] = '\0';
+  return literal;
+}
+
+static
+void append_char_condition(GString *where, gchar *field, const gchar *op, const gchar *literal){
+  if (where->len > 0)
+    g_string_append(where, " AND ");
+  g_string_append_printf(where, "%s%s%s %s %s", identifier_quote_character_str, field, identifier_quote_character_str, op, literal);
+}
+
+static
+GString *get_char_where(gchar *field, const gchar *cmin, const gchar *cursor, const gchar *cmax, gboolean include_null){
+  GString *where = g_string_new("");
+  if (cmin)
+    append_char_condition(where, field, ">", cmin);
+  if (cursor)
+    append_char_condition(where, field, "<=", cursor);
+  if (cmax)
+    append_char_condition(where, field, "<=", cmax);
+  if (include_null && where->len > 0){
+    g_string_prepend(where, " IS NULL OR (");
+    g_string_prepend(where, identifier_quote_character_str);
+    g_string_prepend(where, field);
+    g_string_prepend(where, identifier_quote_character_str);
+    g_string_prepend(where, "(");
+    g_string_append(where, "))");
+  }
+  return where;
+}
+
+/* Keyset seek: returns the value that is offset rows after cmin and not
+   after cmax in the index order */
+static
+gboolean get_char_cursor(MYSQL *conn, struct db_table *dbt, struct chunk_step_item *csi, const gchar *cmin, const gchar *cmax, guint64 offset, gchar **cursor){
+  gchar *query = NULL;
+  GString *where = get_char_where(csi->field, cmin, NULL, cmax, FALSE);
+  *cursor = NULL;
+  MYSQL_RES *res = m_store_result(conn, query = g_strdup_printf(
+                        "SELECT %s %s%s%s FROM %s%s%s.%s%s%s WHERE %s%s%s IS NOT NULL %s %s ORDER BY %s%s%s ASC LIMIT %"G_GUINT64_FORMAT",1",
+                        is_mysql_like() ? "/*!40001 SQL_NO_CACHE */": "",
+                        identifier_quote_character_str, csi->field, identifier_quote_character_str,
+                        identifier_quote_character_str, dbt->database->source_database, identifier_quote_character_str, identifier_quote_character_str, dbt->table, identifier_quote_character_str,
+                        identifier_quote_character_str, csi->field, identifier_quote_character_str,
+                        where->len > 0 ? "AND" : "", where->str,
+                        identifier_quote_character_str, csi->field, identifier_quote_character_str,
+                        offset), NULL, "Query to get the next char cursor failed", NULL);
+  trace("get_char_cursor: %s", query);
+  g_free(query);
+  g_string_free(where, TRUE);
+  if (!res)
+    return FALSE;
+  MYSQL_ROW row = mysql_fetch_row(res);
+  if (row == NULL || row[0] == NULL){
+    mysql_free_result(res);
+    return FALSE;
+  }
+  gulong *lengths = mysql_fetch_lengths(res);
+  *cursor = get_char_literal(conn, csi->chunk_step->char_step.is_binary, row[0], lengths[0]);
+  mysql_free_result(res);
+  return TRUE;
+}
+
+/* A chunk split from another one takes the second half of what is pending
+   on it. The split point is searched without holding the mutex, so it is
+   only applied if the other chunk didn't move in the meantime */
+static
+gboolean set_char_split_point(MYSQL *conn, struct db_table *dbt, struct chunk_step_item *csi){
+  struct chunk_step_item *parent = csi->chunk_step->char_step.split_from;
+  struct char_step *pcs = &(parent->chunk_step->char_step);
+  gchar *base=NULL, *pcmax=NULL, *split=NULL;
+  guint generation=0;
+  guint64 step=0, rows=0;
+  gboolean r=FALSE, retry=TRUE;
+  while (retry && !shutdown_triggered){
+    retry=FALSE;
+    g_mutex_lock(parent->mutex);
+    if (parent->status == COMPLETED || (parent->status == DUMPING_CHUNK && pcs->cursor == NULL)){
+      // it is on its last step
+      g_mutex_unlock(parent->mutex);
+      break;
+    }
+    base = g_strdup(parent->status == DUMPING_CHUNK ? pcs->cursor : pcs->cmin);
+    pcmax = g_strdup(pcs->cmax);
+    generation = pcs->generation;
+    step = pcs->step;
+    g_mutex_unlock(parent->mutex);
+
+    GString *where = get_char_where(csi->field, base, NULL, pcmax, FALSE);
+    rows = get_rows_from_explain(conn, dbt, where->len > 0 ? where : NULL, csi->field);
+    g_string_free(where, TRUE);
+    if (rows / 2 > step && get_char_cursor(conn, dbt, csi, base, pcmax, rows / 2, &split)){
+      g_mutex_lock(parent->mutex);
+      if (pcs->generation == generation){
+        g_free(pcs->cmax);
+        pcs->cmax = g_strdup(split);
+        g_mutex_lock(csi->mutex);
+        csi->chunk_step->char_step.cmin = split;
+        csi->chunk_step->char_step.cmax = pcmax;
+        csi->chunk_step->char_step.step = step;
+        csi->chunk_step->char_step.split_from = NULL;
+        g_mutex_unlock(csi->mutex);
+        split = NULL;
+        pcmax = NULL;
+        r=TRUE;
+      }else
+        retry=TRUE;
+      g_mutex_unlock(parent->mutex);
+    }
+    g_free(base);
+    g_free(pcmax);
+    g_free(split);
+    base=NULL;
+    pcmax=NULL;
+    split=NULL;
+  }
+  g_mutex_lock(parent->mutex);
+  pcs->splitting=FALSE;
+  if (!r)
+    pcs->unsplittable=TRUE;
+  g_mutex_unlock(parent->mutex);
+  trace("Split point for chunk %"G_GUINT64_FORMAT" in `%s`.`%s` %s", csi->part, dbt->database->source_database, dbt->table, r ? "found" : "not found");
+  return r;
+}
+
+// csi->mutex is LOCKED
+struct chunk_step_item *split_char_step_item(struct chunk_step_item *csi){
+  struct char_step *cs=&(csi->chunk_step->char_step);
+  if (csi->status==COMPLETED || cs->splitting || cs->unsplittable || cs->split_from!=NULL)
+    return NULL;
+  // The boundaries of the new chunk are set by the thread that process it
+  cs->splitting=TRUE;
+  struct chunk_step_item *new_csi=new_char_step_item(csi->field, cs->is_binary, csi->deep+1, csi->part+pow(2,csi->deep), cs->step, cs->min_chunk_step_size, cs->max_chunk_step_size, NULL, NULL, csi);
+  new_csi->status=ASSIGNED;
+  csi->deep++;
+  return new_csi;
+}
+
+// dbt->chunks_mutex is LOCKED
+struct chunk_step_item *get_next_char_chunk(struct db_table *dbt){
+  GList *l=dbt->chunks;
+  struct chunk_step_item *csi=NULL, *new_csi=NULL;
+  while (l!=NULL){
+    csi=l->data;
+    g_mutex_lock(csi->mutex);
+    if (csi->status==UNASSIGNED){
+      csi->status=ASSIGNED;
+      g_mutex_unlock(csi->mutex);
+      return csi;
+    }
+    new_csi=split_char_step_item(csi);
+    if (new_csi){
+      dbt->chunks=g_list_append(dbt->chunks,new_csi);
+      g_mutex_unlock(csi->mutex);
+      return new_csi;
+    }
+    g_mutex_unlock(csi->mutex);
+    l=l->next;
+  }
+  return NULL;
+}
+
+void process_char_chunk(struct table_job *tj, struct chunk_step_item *csi){
+  struct thread_data *td = tj->td;
+  struct db_table *dbt = tj->dbt;
+  struct char_step *cs = &(csi->chunk_step->char_step);
+  gchar *cmin=NULL, *cmax=NULL, *cursor=NULL;
+  gboolean found=FALSE;
+  guint64 step=0;
+
+  if (cs->split_from != NULL && !set_char_split_point(td->thrconn, dbt, csi)){
+    g_mutex_lock(csi->mutex);
+    csi->status=COMPLETED;
+    g_mutex_unlock(csi->mutex);
+    return;
+  }
+
+  for(;;){
+    check_pause_resume(td);
+    if (shutdown_triggered) {
+      g_message("Thread %d: Job has been cacelled",td->thread_id);
+      return;
+    }
+
+// Step 1: Looking for the last value of this step
+    g_mutex_lock(csi->mutex);
+    cmin=g_strdup(cs->cmin);
+    cmax=g_strdup(cs->cmax);
+    step=cs->step;
+    g_mutex_unlock(csi->mutex);
+
+    found=get_char_cursor(td->thrconn, dbt, csi, cmin, cmax, step - 1, &cursor);
+
+// Step 2: Building the WHERE clause, cmax might have been changed by a split
+    g_mutex_lock(csi->mutex);
+    g_free(cmax);
+    cmax=g_strdup(cs->cmax);
+    g_free(cs->cursor);
+    cs->cursor=cursor;
+    cs->generation++;
+    csi->status=DUMPING_CHUNK;
+    GString *where=get_char_where(csi->field, cmin, cursor, cmax, csi->include_null);
+    g_string_assign(csi->where, where->str);
+    g_string_free(where, TRUE);
+    g_mutex_unlock(csi->mutex);
+
+// Step 3: Executing query and writing data
+    g_string_set_size(tj->where,0);
+    g_string_append(tj->where, csi->where->str);
+    trace("Thread %d: C-Chunk 3: WHERE in TJ: %s", td->thread_id, tj->where->str);
+    float filesize=tj->filesize;
+    GDateTime *from = g_date_time_new_now_local();
+    write_table_job_into_file(tj);
+    GDateTime *to = g_date_time_new_now_local();
+    GTimeSpan diff=g_date_time_difference(to,from);
+    // the file might have been rotated while writing
+    filesize= tj->filesize >= filesize ? tj->filesize - filesize : tj->filesize;
+    g_date_time_unref(from);
+    g_date_time_unref(to);
+    g_atomic_int_inc(dbt->chunks_completed);
+    g_free(cmin);
+    g_free(cmax);
+
+// Step 4: Updating step length and min
+    g_mutex_lock(csi->mutex);
+    csi->include_null=FALSE;
+    if (!found){
+      csi->status=COMPLETED;
+      g_mutex_unlock(csi->mutex);
+      break;
+    }
+    if (diff>0 && tj->num_rows_of_last_run>0)
+      cs->step=tj->num_rows_of_last_run*max_time_per_select*G_TIME_SPAN_SECOND/diff;
+    else
+      cs->step*=2;
+    if (cs->max_chunk_step_size !=0 && cs->step > cs->max_chunk_step_size)
+      cs->step = cs->max_chunk_step_size;
+    if (cs->min_chunk_step_size !=0 && cs->step < cs->min_chunk_step_size)
+      cs->step = cs->min_chunk_step_size;
+    if (cs->step == 0)
+      cs->step = 1;
+    update_chunk_profile(dbt, cs->step, tj->num_rows_of_last_run, filesize, diff);
+    g_free(cs->cmin);
+    cs->cmin=cs->cursor;
+    cs->cursor=NULL;
+    cs->generation++;
+    csi->status=ASSIGNED;
+    g_mutex_unlock(csi->mutex);
+  }
+}
@@ -0,0 +1,55 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    Domas Mituzas, Facebook ( domas at fb dot com )
+                    Mark Leith, Oracle Corporation (mark dot leith at oracle dot com)
+                    Andrew Hutchings, MariaDB Foundation (andrew at mariadb dot org)
+                    Max Bubenick, Percona RDBA (max dot bubenick at percona dot com)
+                    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+#if !defined(mydumper_mydumper_char_chunks)
+#define mydumper_mydumper_char_chunks
+
+#include "mydumper_chunks.h"
+
+/* Boundaries are kept as SQL literals, so the comparisons are always done
+   by the server using the column collation */
+struct char_step {
+  // exclusive lower bound, NULL on the first chunk of the table
+  gchar *cmin;
+  // inclusive upper bound, NULL on the last chunk of the table
+  gchar *cmax;
+  // inclusive upper bound of the step that is being dumped, NULL if the
+  // step reaches cmax
+  gchar *cursor;
+  guint64 step;
+  guint64 min_chunk_step_size;
+  guint64 max_chunk_step_size;
+  gboolean is_binary;
+  // incremented every time that cmin or cursor changes
+  guint generation;
+  // there is a chunk split from this one looking for its split point
+  gboolean splitting;
+  // the last split didn't find a split point, the chunk is not split again
+  gboolean unsplittable;
+  // the chunk that this one has been split from, until the split point is set
+  struct chunk_step_item *split_from;
+};
+#endif
+
+struct chunk_step_item *new_char_step_item(gchar *field, gboolean is_binary, guint deep, guint64 part, guint64 step, guint64 min_css, guint64 max_css, gchar *cmin, gchar *cmax, struct chunk_step_item *split_from);
+struct chunk_step_item *get_next_char_chunk(struct db_table *dbt);
+struct chunk_step_item *split_char_step_item(struct chunk_step_item *csi);
+void process_char_chunk(struct table_job *tj, struct chunk_step_item *csi);
+void free_char_step_item(struct chunk_step_item *csi);
@@ -0,0 +1,94 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#include <glib/gstdio.h>
+#include <stdlib.h>
+
+#include "mydumper_global.h"
+#include "mydumper_chunk_profile.h"
+
+/* The chunk profile keeps, per table, the step size reached at the end of
+   the last dump, so the next one starts with it instead of learning it
+   again from the starting step size. */
+
+gchar *chunk_profile=NULL;
+static GKeyFile *chunk_profile_kf=NULL;
+
+void initialize_chunk_profile(){
+  if (chunk_profile == NULL)
+    return;
+  chunk_profile_kf=g_key_file_new();
+  if (g_file_test(chunk_profile, G_FILE_TEST_EXISTS)){
+    GError *error=NULL;
+    if (!g_key_file_load_from_file(chunk_profile_kf, chunk_profile, G_KEY_FILE_KEEP_COMMENTS, &error)){
+      g_warning("Chunk profile %s could not be loaded: %s", chunk_profile, error->message);
+      g_error_free(error);
+    }
+  }
+}
+
+guint64 get_chunk_profile_step(struct db_table *dbt){
+  if (chunk_profile_kf == NULL || !g_key_file_has_group(chunk_profile_kf, dbt->key))
+    return 0;
+  gchar *value=g_key_file_get_value(chunk_profile_kf, dbt->key, "step", NULL);
+  guint64 step= value ? strtoull(value, NULL, 10) : 0;
+  g_free(value);
+  if (step > 0)
+    trace("Chunk profile for %s starts with step %"G_GUINT64_FORMAT, dbt->key, step);
+  return step;
+}
+
+// Called after every timed chunk, step is the one calculated for the next chunk
+void update_chunk_profile(struct db_table *dbt, guint64 step, guint64 rows, guint64 bytes, GTimeSpan diff){
+  if (chunk_profile_kf == NULL)
+    return;
+  g_mutex_lock(dbt->rows_lock);
+  dbt->profile_step=step;
+  dbt->profile_rows+=rows;
+  dbt->profile_bytes+=bytes;
+  dbt->profile_time+=diff;
+  g_mutex_unlock(dbt->rows_lock);
+}
+
+void write_chunk_profile(){
+  if (chunk_profile_kf == NULL)
+    return;
+  struct db_table *dbt=NULL;
+  GHashTableIter iter;
+  gchar *lkey;
+  g_hash_table_iter_init(&iter, all_dbts);
+  // Tables that were not dumped in this run keep their previous values
+  while (g_hash_table_iter_next(&iter, (gpointer *) &lkey, (gpointer *) &dbt)){
+    if (dbt->profile_step == 0)
+      continue;
+    g_key_file_set_uint64(chunk_profile_kf, dbt->key, "step", dbt->profile_step);
+    if (dbt->profile_time > 0)
+      g_key_file_set_uint64(chunk_profile_kf, dbt->key, "rows_per_second", dbt->profile_rows * G_TIME_SPAN_SECOND / dbt->profile_time);
+    if (dbt->profile_rows > 0)
+      g_key_file_set_uint64(chunk_profile_kf, dbt->key, "bytes_per_row", dbt->profile_bytes / dbt->profile_rows);
+  }
+  GError *error=NULL;
+  gsize length=0;
+  gchar *data=g_key_file_to_data(chunk_profile_kf, &length, NULL);
+  if (!g_file_set_contents(chunk_profile, data, length, &error)){
+    g_warning("Chunk profile %s could not be saved: %s", chunk_profile, error->message);
+    g_error_free(error);
+  }
+  g_free(data);
+  g_key_file_free(chunk_profile_kf);
+  chunk_profile_kf=NULL;
+}
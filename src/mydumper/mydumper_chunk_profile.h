@@ -0,0 +1,26 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+#if !defined(mydumper_mydumper_chunk_profile)
+#define mydumper_mydumper_chunk_profile
+
+#include "mydumper_table.h"
+
+void initialize_chunk_profile();
+guint64 get_chunk_profile_step(struct db_table *dbt);
+void update_chunk_profile(struct db_table *dbt, guint64 step, guint64 rows, guint64 bytes, GTimeSpan diff);
+void write_chunk_profile();
+#endif
@@ -31,17 +31,25 @@
 #include "mydumper_chunks.h"
 #include "mydumper_integer_chunks.h"
 #include "mydumper_partition_chunks.h"
+#include "mydumper_char_chunks.h"
+#include "mydumper_chunk_profile.h"
 #include "mydumper_create_jobs.h"
+#include "mydumper_incremental.h"
+#include "mydumper_catalog.h"
+#include "mydumper_sample.h"
 
 extern guint64 min_integer_chunk_step_size;
 
 GAsyncQueue *give_me_another_transactional_chunk_step_queue;
 GAsyncQueue *give_me_another_non_transactional_chunk_step_queue;
 GThread *chunk_builder=NULL;
+gboolean chunk_stealing=FALSE;
 
 void initialize_chunk(){
   give_me_another_transactional_chunk_step_queue=g_async_queue_new();
   give_me_another_non_transactional_chunk_step_queue=g_async_queue_new();
+  register_queue_stats("transactional_chunk_request", give_me_another_transactional_chunk_step_queue);
+  register_queue_stats("non_transactional_chunk_request", give_me_another_non_transactional_chunk_step_queue);
 }
 
 void start_chunk_builder(struct configuration *conf){
@@ -51,6 +59,8 @@ void start_chunk_builder(struct configuration *conf){
 }
 
 void finalize_chunk(){
+  unregister_queue_stats(give_me_another_transactional_chunk_step_queue);
+  unregister_queue_stats(give_me_another_non_transactional_chunk_step_queue);
   g_async_queue_unref(give_me_another_transactional_chunk_step_queue); 
   g_async_queue_unref(give_me_another_non_transactional_chunk_step_queue);
   if (!no_data){
@@ -78,18 +88,21 @@ struct chunk_step_item * new_none_chunk_step(){
   return csi;
 }
 
-struct chunk_step_item * initialize_chunk_step_item (MYSQL *conn, struct db_table *dbt, guint position, guint64 rows, GString *prefix) {
+struct chunk_step_item * initialize_chunk_step_item (MYSQL *conn, struct db_table *dbt, guint position, guint64 rows, GString *prefix, const gchar *partition) {
   struct chunk_step_item * csi=NULL;
 
   gchar *field=g_list_nth_data(dbt->primary_key, position);
+  if (!field)
+    return new_none_chunk_step();
   gchar *query = NULL;
   /* Get minimum/maximum */
   struct M_ROW *mr = m_store_result_row(conn, query = g_strdup_printf(
-                        "SELECT %s MIN(%s%s%s),MAX(%s%s%s),LEFT(MIN(%s%s%s),1),LEFT(MAX(%s%s%s),1) FROM %s%s%s.%s%s%s %s %s %s %s",
+                        "SELECT %s MIN(%s%s%s),MAX(%s%s%s),LEFT(MIN(%s%s%s),1),LEFT(MAX(%s%s%s),1) FROM %s%s%s.%s%s%s%s %s %s %s %s",
                         is_mysql_like()? "/*!40001 SQL_NO_CACHE */":"",
                         identifier_quote_character_str, field, identifier_quote_character_str, identifier_quote_character_str, field, identifier_quote_character_str,
                         identifier_quote_character_str, field, identifier_quote_character_str, identifier_quote_character_str, field, identifier_quote_character_str,
                         identifier_quote_character_str, dbt->database->source_database, identifier_quote_character_str, identifier_quote_character_str, dbt->table, identifier_quote_character_str,
+                        partition ? partition : "",
                         where_option || (prefix && prefix->len>0) ? "WHERE" : "", where_option ? where_option : "", where_option && (prefix && prefix->len>0) ? "AND" : "", prefix && prefix->len>0 ? prefix->str : ""),
                         m_message, NULL, "It is NONE with minmax == NULL", NULL);
 //  g_message("Query: %s", query);
@@ -157,6 +170,13 @@ struct chunk_step_item * initialize_chunk_step_item (MYSQL *conn, struct db_tabl
 //            max_chunk_step_size=rows/num_threads;
             max_chunk_step_size=diff_btwn_max_min/((log(percentage_of_fragmentation )+1)*num_threads);
         }
+        // The step size reached on the previous dump has precedence
+        if (!dbt->is_fixed_length){
+          guint64 profile_step=get_chunk_profile_step(dbt);
+          if (profile_step > 0)
+            _starting_chunk_step_size= dbt->max_chunk_step_size != 0 && profile_step > dbt->max_chunk_step_size ?
+                                         dbt->max_chunk_step_size : profile_step;
+        }
         if (_starting_chunk_step_size < dbt->min_chunk_step_size)
           _starting_chunk_step_size=dbt->min_chunk_step_size;
 
@@ -184,16 +204,31 @@ struct chunk_step_item * initialize_chunk_step_item (MYSQL *conn, struct db_tabl
     case MYSQL_TYPE_VAR_STRING:
       // If primary key has multiple columns and just the first column is integer, we disable the multicolumn logic
       trace("String type %d", position);
-      m_store_result_row_free(mr);
-      if (position>0)
+      if (position>0){
+        m_store_result_row_free(mr);
         dbt->multicolumn=FALSE;
-      else
-        return new_none_chunk_step();
+      }else{
+        // The table is split by keyset seeks over the first column
+        gboolean is_binary = fields[0].charsetnr == 63;
+        m_store_result_row_free(mr);
+        // The step size reached on the previous dump has precedence
+        guint64 _starting_chunk_step_size = dbt->is_fixed_length ? 0 : get_chunk_profile_step(dbt);
+        if (_starting_chunk_step_size == 0)
+          _starting_chunk_step_size = dbt->starting_chunk_step_size != 0 ?
+                                        dbt->starting_chunk_step_size :
+                                        rows/num_threads;
+        if (dbt->max_chunk_step_size != 0 && _starting_chunk_step_size > dbt->max_chunk_step_size)
+          _starting_chunk_step_size = dbt->max_chunk_step_size;
+        if (_starting_chunk_step_size < dbt->min_chunk_step_size)
+          _starting_chunk_step_size = dbt->min_chunk_step_size;
+        trace("Char PK found on `%s`.`%s`",dbt->database->source_database, dbt->table);
+        return new_char_step_item(field, is_binary, 0, 0, _starting_chunk_step_size, dbt->min_chunk_step_size, dbt->max_chunk_step_size, NULL, NULL, NULL);
+      }
       break;
     default:
       // If primary key has multiple columns and just the first column is integer, we disable the multicolumn logic
       m_store_result_row_free(mr);
-      g_message("It is NONE: default");
+      trace("`%s`.`%s` can not be split by `%s`, type %d", dbt->database->source_database, dbt->table, field, fields[0].type);
       if (position>0)
         dbt->multicolumn=FALSE;
       else
@@ -262,23 +297,48 @@ void set_chunk_strategy_for_dbt(MYSQL *conn, struct db_table *dbt){
   g_mutex_lock(dbt->chunks_mutex);
   struct chunk_step_item * csi = NULL;
   guint64 rows;
-  if (check_row_count) {
-    rows= get_rows_from_count(conn, dbt, NULL);
-  } else
+  if (incremental_snapshot && reuse_unchanged_table(conn, dbt)){
+    // no chunks, the data files were linked from the previous snapshot
+    dbt->status=READY;
+    g_mutex_unlock(dbt->chunks_mutex);
+    return;
+  }
+  struct catalog_table *ct=NULL;
+  if ((ct=get_catalog_table(dbt->database->source_database, dbt->table)) && ct->has_rows)
+    // same estimation than EXPLAIN, already read by the catalog prefetch
+    rows= ct->rows;
+  else
     rows= get_rows_from_explain(conn, dbt, NULL ,NULL);
-  g_message("%s.%s has %s%"G_GINT64_FORMAT" rows", dbt->database->source_database, dbt->table,
-            (check_row_count ? "": "~"), rows);
+  g_message("%s.%s has ~%"G_GINT64_FORMAT" rows", dbt->database->source_database, dbt->table, rows);
   dbt->rows_total= rows;
+  gboolean sampled=is_sampled_dump();
+  // the rows are selected by the ranges of the parents
+  if (sampled && sample_follow_fk && sample_by_foreign_keys(conn, dbt))
+    sampled=FALSE;
   if (rows > dbt->min_chunk_step_size){
     GList *partitions=NULL;
-    if (split_partitions || dbt->partition_regex){
+    if (!sampled && (split_partitions || dbt->partition_regex)){
       partitions = get_partitions_for_table(conn, dbt);
     }
     if (partitions){
       csi=new_real_partition_step_item(partitions,0,0);
     }else{
       if (dbt->split_integer_tables) {
-        csi = initialize_chunk_step_item(conn, dbt, 0, rows, NULL);
+        csi = initialize_chunk_step_item(conn, dbt, 0, rows, NULL, NULL);
+        // Without PK, the next index with an integer or char leading column
+        while (csi->chunk_type == NONE && use_next_chunk_index(dbt)){
+          g_free(csi);
+          trace("Trying `%s`.`%s` by `%s`", dbt->database->source_database, dbt->table, (gchar *)dbt->primary_key->data);
+          csi = initialize_chunk_step_item(conn, dbt, 0, rows, NULL, NULL);
+        }
+        if (csi->chunk_type == NONE){
+          if (dbt->primary_key)
+            g_warning("%s.%s can not be split by `%s` nor by other index, it is going to be dumped by a single thread",
+                      dbt->database->source_database, dbt->table, (gchar *)dbt->primary_key->data);
+          else
+            g_warning("%s.%s has no index to split it by, it is going to be dumped by a single thread",
+                      dbt->database->source_database, dbt->table);
+        }
       }else{
         csi = new_none_chunk_step();
       }
@@ -286,9 +346,48 @@ void set_chunk_strategy_for_dbt(MYSQL *conn, struct db_table *dbt){
   }else{
     csi = new_none_chunk_step();
   }
+  GList *seeds=NULL, *l;
+  if (sampled){
+    if (csi->chunk_type == INTEGER)
+      seeds=sample_integer_step_item(dbt, csi);
+    else{
+      if (csi->chunk_type != NONE){
+        if (csi->chunk_functions.free)
+          csi->chunk_functions.free(csi);
+        g_free(csi);
+        csi=new_none_chunk_step();
+      }
+      sample_whole_table(conn, dbt, rows);
+    }
+  }
 //  dbt->initial_chunk_step=csi;
   dbt->chunks=g_list_prepend(dbt->chunks,csi);
   g_async_queue_push(dbt->chunks_queue, csi);
+  for (l=seeds; l; l=l->next){
+    dbt->chunks=g_list_append(dbt->chunks,l->data);
+    g_async_queue_push(dbt->chunks_queue, l->data);
+  }
+  g_list_free(seeds);
+  seeds=NULL;
+  if (tidb_region_chunks && !sampled && csi->chunk_type == INTEGER && get_product() == SERVER_TYPE_TIDB)
+    seeds = split_integer_step_item_by_tidb_regions(conn, dbt, csi);
+  if (seeds){
+    for (l=seeds; l; l=l->next){
+      dbt->chunks=g_list_append(dbt->chunks,l->data);
+      g_async_queue_push(dbt->chunks_queue, l->data);
+    }
+    g_list_free(seeds);
+  }else if (pre_split_chunks && !sampled && csi->chunk_type == INTEGER){
+    guint parts = dbt->max_threads_per_table < num_threads ? dbt->max_threads_per_table : num_threads;
+    if (parts > 1 && rows / parts > dbt->min_chunk_step_size){
+      seeds = pre_split_integer_step_item(conn, dbt, csi, parts);
+      for (l=seeds; l; l=l->next){
+        dbt->chunks=g_list_append(dbt->chunks,l->data);
+        g_async_queue_push(dbt->chunks_queue, l->data);
+      }
+      g_list_free(seeds);
+    }
+  }
   dbt->status=READY;
   g_mutex_unlock(dbt->chunks_mutex);
 }
@@ -384,6 +483,42 @@ next:
     g_mutex_unlock(dbt_list->mutex);
 
   }
+
+  // --chunk-stealing: every table is at its max_threads_per_table, instead
+  // of leaving the thread idle it steals a chunk from the table with more
+  // rows remaining
+  if (!finish && !are_there_jobs_defining && chunk_stealing){
+    struct db_table *victim=NULL;
+    guint64 remaining, victim_remaining=0;
+    g_mutex_lock(dbt_list->mutex);
+    for (iter=dbt_list->list; iter; iter=iter->next){
+      dbt=iter->data;
+      g_mutex_lock(dbt->chunks_mutex);
+      if (dbt->status == READY && dbt->chunks != NULL &&
+          ((struct chunk_step_item *)g_list_first(dbt->chunks)->data)->chunk_type != NONE){
+        // the rows are added by the writers with __sync_fetch_and_add
+        guint64 rows=__sync_fetch_and_add(&(dbt->rows), 0);
+        remaining= dbt->rows_total > rows ? dbt->rows_total - rows : 0;
+        if (victim == NULL || remaining > victim_remaining){
+          victim=dbt;
+          victim_remaining=remaining;
+        }
+      }
+      g_mutex_unlock(dbt->chunks_mutex);
+    }
+    if (victim){
+      g_mutex_lock(victim->chunks_mutex);
+      lcs=((struct chunk_step_item *)g_list_first(victim->chunks)->data)->chunk_functions.get_next(victim);
+      if (lcs!=NULL){
+        trace("Stealing chunk from `%s`.`%s` with %d threads running", victim->database->source_database, victim->table, victim->current_threads_running);
+        victim->current_threads_running++;
+        *dbt_pointer=victim;
+        *csi=lcs;
+      }
+      g_mutex_unlock(victim->chunks_mutex);
+    }
+    g_mutex_unlock(dbt_list->mutex);
+  }
   return are_there_jobs_defining;
 }
 
@@ -413,7 +548,7 @@ void table_job_enqueue(struct table_queuing *q)
   gboolean are_there_jobs_defining=FALSE;
   g_message("Starting to enqueue %s tables", q->descr);
   for (;;) {
-    g_async_queue_pop(q->request_chunk);
+    m_async_queue_pop(q->request_chunk);
     if (shutdown_triggered) {
       break;
     }
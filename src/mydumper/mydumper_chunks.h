@@ -30,6 +30,7 @@ union chunk_step;
 
 #include "mydumper_integer_chunks.h"
 #include "mydumper_partition_chunks.h"
+#include "mydumper_char_chunks.h"
 
 enum chunk_type{
   NONE,
@@ -55,6 +56,7 @@ struct chunk_functions{
 
 union chunk_step {
   struct integer_step integer_step;
+  struct char_step char_step;
   struct partition_step partition_step;
 };
 
@@ -93,7 +95,7 @@ void *chunk_builder_thread(struct configuration *conf);
 void finalize_chunk();
 extern GAsyncQueue *give_me_another_transactional_chunk_step_queue;
 extern GAsyncQueue *give_me_another_non_transactional_chunk_step_queue;
-struct chunk_step_item * initialize_chunk_step_item (MYSQL *conn, struct db_table *dbt, guint position, guint64 rows, GString *local_where) ;
+struct chunk_step_item * initialize_chunk_step_item (MYSQL *conn, struct db_table *dbt, guint position, guint64 rows, GString *local_where, const gchar *partition) ;
 void build_where_clause_on_table_job(struct table_job *tj);
 guint64 get_rows_from_explain(MYSQL * conn, struct db_table *dbt, GString *where, gchar *field);
 guint64 get_rows_from_count(MYSQL * conn, struct db_table *dbt, GString *where);
@@ -0,0 +1,303 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "mydumper_clickhouse.h"
+
+// values of 256 bits, enough for Decimal(76, S)
+#define DECIMAL_WORDS 8
+// longer than any DECIMAL(65, S), DOUBLE or DATETIME(6) as text
+#define NUMBER_BUFFER_SIZE 128
+
+enum clickhouse_type {
+  CH_INT,
+  CH_FLOAT32,
+  CH_FLOAT64,
+  CH_DECIMAL,
+  CH_DATE32,
+  CH_DATETIME64,
+  CH_STRING
+};
+
+static
+void append_varint(GString *out, guint64 value){
+  while (value >= 0x80){
+    g_string_append_c(out, (gchar)((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+  g_string_append_c(out, (gchar)value);
+}
+
+static
+void append_string(GString *out, const gchar *value, gsize length){
+  append_varint(out, length);
+  g_string_append_len(out, value, length);
+}
+
+static
+void append_le(GString *out, guint64 value, guint bytes){
+  guint i;
+  for (i = 0; i < bytes; i++, value >>= 8)
+    g_string_append_c(out, (gchar)(value & 0xFF));
+}
+
+/* bytes of the integer types, the precision and scale for the decimals and
+   the fractional digits for DateTime64 */
+static
+enum clickhouse_type get_clickhouse_type(MYSQL_FIELD *field, guint *bytes, guint *precision, guint *scale){
+  *bytes=0;
+  *precision=0;
+  *scale=field->decimals;
+  switch (field->type){
+    case MYSQL_TYPE_TINY:
+      *bytes=1;
+      return CH_INT;
+    case MYSQL_TYPE_SHORT:
+    case MYSQL_TYPE_YEAR:
+      *bytes=2;
+      return CH_INT;
+    case MYSQL_TYPE_INT24:
+    case MYSQL_TYPE_LONG:
+      *bytes=4;
+      return CH_INT;
+    case MYSQL_TYPE_LONGLONG:
+    case MYSQL_TYPE_BIT:
+      *bytes=8;
+      return CH_INT;
+    case MYSQL_TYPE_FLOAT:
+      return CH_FLOAT32;
+    case MYSQL_TYPE_DOUBLE:
+      return CH_FLOAT64;
+    case MYSQL_TYPE_DECIMAL:
+    case MYSQL_TYPE_NEWDECIMAL:
+      // the length counts the sign and the decimal point
+      *precision=field->length - (field->decimals > 0 ? 1 : 0) - (field->flags & UNSIGNED_FLAG ? 0 : 1);
+      if (*precision > 76)
+        *precision=76;
+      if (*precision < *scale || *precision == 0)
+        *precision= *scale > 0 ? *scale : 1;
+      *bytes= *precision <= 9 ? 4 : *precision <= 18 ? 8 : *precision <= 38 ? 16 : 32;
+      return CH_DECIMAL;
+    case MYSQL_TYPE_DATE:
+    case MYSQL_TYPE_NEWDATE:
+      return CH_DATE32;
+    case MYSQL_TYPE_DATETIME:
+    case MYSQL_TYPE_TIMESTAMP:
+      if (*scale > 6)
+        *scale=0;
+      return CH_DATETIME64;
+    default:
+      // TIME has no type in ClickHouse
+      return CH_STRING;
+  }
+}
+
+void clickhouse_append_header(GString *out, MYSQL_FIELD *fields, guint num_fields){
+  guint i, bytes, precision, scale;
+  GString *type=g_string_new(NULL);
+  append_varint(out, num_fields);
+  for (i = 0; i < num_fields; i++)
+    append_string(out, fields[i].name, fields[i].name_length);
+  for (i = 0; i < num_fields; i++){
+    gboolean is_unsigned= fields[i].type == MYSQL_TYPE_YEAR || fields[i].type == MYSQL_TYPE_BIT || (fields[i].flags & UNSIGNED_FLAG);
+    switch (get_clickhouse_type(&(fields[i]), &bytes, &precision, &scale)){
+      case CH_INT:
+        g_string_printf(type, "%sInt%u", is_unsigned ? "U" : "", bytes * 8);
+        break;
+      case CH_FLOAT32:
+        g_string_assign(type, "Float32");
+        break;
+      case CH_FLOAT64:
+        g_string_assign(type, "Float64");
+        break;
+      case CH_DECIMAL:
+        g_string_printf(type, "Decimal(%u, %u)", precision, scale);
+        break;
+      case CH_DATE32:
+        g_string_assign(type, "Date32");
+        break;
+      case CH_DATETIME64:
+        g_string_printf(type, "DateTime64(%u, 'UTC')", scale);
+        break;
+      case CH_STRING:
+        g_string_assign(type, "String");
+        break;
+    }
+    if (!(fields[i].flags & NOT_NULL_FLAG)){
+      g_string_prepend(type, "Nullable(");
+      g_string_append_c(type, ')');
+    }
+    append_string(out, type->str, type->len);
+  }
+  g_string_free(type, TRUE);
+}
+
+// days since 1970-01-01 of a date of the proleptic Gregorian calendar
+static
+gint64 days_from_civil(gint64 y, guint m, guint d){
+  y-= m <= 2;
+  gint64 era= (y >= 0 ? y : y - 399) / 400;
+  guint yoe= (guint)(y - era * 400);
+  guint doy= (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+  guint doe= yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + (gint64)doe - 719468;
+}
+
+// zero dates and parts are stored as 1970-01-01
+static
+gint64 parse_days(const gchar *value, const gchar **end){
+  guint y=0, m=0, d=0;
+  gint n=0;
+  if (sscanf(value, "%u-%u-%u%n", &y, &m, &d, &n) < 3 || m == 0 || d == 0){
+    *end=value + n;
+    return 0;
+  }
+  *end=value + n;
+  return days_from_civil(y, m, d);
+}
+
+static
+gint64 parse_datetime(const gchar *value, guint scale){
+  const gchar *p=NULL;
+  guint h=0, mi=0, s=0, i;
+  gint64 ticks=parse_days(value, &p) * 86400;
+  gint n=0;
+  if (sscanf(p, " %u:%u:%u%n", &h, &mi, &s, &n) == 3)
+    p+=n;
+  ticks+= h * 3600 + mi * 60 + s;
+  if (*p == '.')
+    p++;
+  for (i = 0; i < scale; i++){
+    ticks*=10;
+    if (g_ascii_isdigit(*p))
+      ticks+= *p++ - '0';
+  }
+  return ticks;
+}
+
+// two's complement of the scaled value, little endian
+static
+void append_decimal(GString *out, const gchar *value, gulong length, guint bytes, guint scale){
+  guint32 words[DECIMAL_WORDS]={0};
+  guint i, w, fraction=0;
+  gboolean negative=FALSE, in_fraction=FALSE;
+  for (i = 0; i < length; i++){
+    gchar c=value[i];
+    if (c == '-'){
+      negative=TRUE;
+      continue;
+    }
+    if (c == '.'){
+      in_fraction=TRUE;
+      continue;
+    }
+    if (!g_ascii_isdigit(c) || (in_fraction && fraction == scale))
+      continue;
+    if (in_fraction)
+      fraction++;
+    guint64 carry=c - '0';
+    for (w = 0; w < DECIMAL_WORDS; w++){
+      carry+= (guint64)words[w] * 10;
+      words[w]=(guint32)carry;
+      carry>>=32;
+    }
+  }
+  for (; fraction < scale; fraction++){
+    guint64 carry=0;
+    for (w = 0; w < DECIMAL_WORDS; w++){
+      carry+= (guint64)words[w] * 10;
+      words[w]=(guint32)carry;
+      carry>>=32;
+    }
+  }
+  if (negative){
+    guint64 carry=1;
+    for (w = 0; w < DECIMAL_WORDS; w++){
+      carry+= (guint32)~words[w];
+      words[w]=(guint32)carry;
+      carry>>=32;
+    }
+  }
+  for (w = 0; w < bytes / 4; w++)
+    append_le(out, words[w], 4);
+}
+
+// BIT is received as big endian bytes
+static
+guint64 bit_value(const gchar *value, gulong length){
+  guint64 v=0;
+  gulong i;
+  for (i = 0; i < length && i < 8; i++)
+    v= (v << 8) | (guint8)value[i];
+  return v;
+}
+
+void clickhouse_append_value(GString *out, MYSQL_FIELD *field, const gchar *value, gulong length){
+  guint bytes, precision, scale;
+  if (!(field->flags & NOT_NULL_FLAG)){
+    g_string_append_c(out, value == NULL ? 1 : 0);
+    if (value == NULL)
+      return;
+  }
+  // a NOT NULL column has no NULLs, unless it was masqueraded
+  if (value == NULL){
+    value="";
+    length=0;
+  }
+  // numbers and dates are parsed from a NUL terminated copy
+  gchar v[NUMBER_BUFFER_SIZE];
+  gulong n= length < NUMBER_BUFFER_SIZE ? length : NUMBER_BUFFER_SIZE - 1;
+  const gchar *end=NULL;
+  union { gfloat f; guint32 i; } f32;
+  union { gdouble f; guint64 i; } f64;
+  enum clickhouse_type type=get_clickhouse_type(field, &bytes, &precision, &scale);
+  if (type != CH_STRING){
+    memcpy(v, value, n);
+    v[n]='\0';
+  }
+  switch (type){
+    case CH_INT:
+      if (field->type == MYSQL_TYPE_BIT)
+        append_le(out, bit_value(value, length), bytes);
+      else if (field->flags & UNSIGNED_FLAG || field->type == MYSQL_TYPE_YEAR)
+        append_le(out, g_ascii_strtoull(v, NULL, 10), bytes);
+      else
+        append_le(out, (guint64)g_ascii_strtoll(v, NULL, 10), bytes);
+      break;
+    case CH_FLOAT32:
+      f32.f=(gfloat)g_ascii_strtod(v, NULL);
+      append_le(out, f32.i, 4);
+      break;
+    case CH_FLOAT64:
+      f64.f=g_ascii_strtod(v, NULL);
+      append_le(out, f64.i, 8);
+      break;
+    case CH_DECIMAL:
+      append_decimal(out, v, n, bytes, scale);
+      break;
+    case CH_DATE32:
+      append_le(out, (guint64)parse_days(v, &end), 4);
+      break;
+    case CH_DATETIME64:
+      append_le(out, (guint64)parse_datetime(v, scale), 8);
+      break;
+    case CH_STRING:
+      append_string(out, value, length);
+      break;
+  }
+}
@@ -0,0 +1,34 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#if !defined(mydumper_mydumper_clickhouse)
+#define mydumper_mydumper_clickhouse
+
+#include <mysql.h>
+#include <glib.h>
+
+#define CLICKHOUSE_ROWBINARY_EXTENSION "rowbinary"
+#define CLICKHOUSE_ROWBINARY_FORMAT "RowBinaryWithNamesAndTypes"
+
+/* RowBinaryWithNamesAndTypes for INSERT ... FROM INFILE on ClickHouse. The
+   header has the column names and the ClickHouse types that are mapped from
+   the MYSQL_FIELD, every row has the values encoded as those types. DATETIME
+   and TIMESTAMP are taken as UTC, which is the time zone of the session
+   unless --skip-tz-utc is used */
+void clickhouse_append_header(GString *out, MYSQL_FIELD *fields, guint num_fields);
+void clickhouse_append_value(GString *out, MYSQL_FIELD *field, const gchar *value, gulong length);
+#endif
@@ -49,6 +49,7 @@ const char *routine_type[]= {"FUNCTION", "PROCEDURE", "PACKAGE", "PACKAGE BODY"}
 guint nroutines= 4;
 
 void initialize_common(){
+  initialize_hex_string();
   ref_table_mutex = g_mutex_new();
   ref_table=g_hash_table_new_full ( g_str_hash, g_str_equal, &g_free, &g_free );
 }
@@ -213,84 +214,132 @@ gchar * build_rows_filename(char *database, char *table, guint64 part, guint sub
   return build_filename(database, table, part, sub_part, rows_file_extension, NULL);
 }
 
-unsigned long m_real_escape_string(MYSQL *conn, char *to, const gchar *from, unsigned long length){
-  (void) conn;
-  (void) to;
-  (void) from;
-  guint to_length = 2*length+1;
+/* Charsets where a multi-byte sequence can carry 0x5c as trailing byte. The
+ * escape kernel below is byte oriented, so we hand those to the client lib. */
+gboolean is_escape_unsafe_charset(MYSQL *conn){
+  const char *cs= conn ? mysql_character_set_name(conn) : NULL;
+  if (!cs)
+    return FALSE;
+  switch (cs[0]){
+    case 'b': return !g_ascii_strcasecmp(cs, "big5");
+    case 'c': return !g_ascii_strcasecmp(cs, "cp932");
+    case 'g': return !g_ascii_strcasecmp(cs, "gbk") || !g_ascii_strcasecmp(cs, "gb18030");
+    case 's': return !g_ascii_strcasecmp(cs, "sjis");
+  }
+  return FALSE;
+}
+
+/* Escape code for each byte, 0 when the byte is copied as is */
+static const char escape_code[256]={
+  [0]='0', ['\n']='n', ['\r']='r', ['\\']='\\', ['\'']='\'', ['"']='"', ['\032']='Z'
+};
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+/* Returns a bitmask with the bytes of the 16 bytes block that need escaping */
+static inline
+int escape_mask_16(const gchar *from, gchar extra_1, gchar extra_2){
+  __m128i b = _mm_loadu_si128((const __m128i *)from);
+  __m128i m = _mm_cmpeq_epi8(b, _mm_setzero_si128());
+  m = _mm_or_si128(m, _mm_cmpeq_epi8(b, _mm_set1_epi8('\n')));
+  m = _mm_or_si128(m, _mm_cmpeq_epi8(b, _mm_set1_epi8('\r')));
+  m = _mm_or_si128(m, _mm_cmpeq_epi8(b, _mm_set1_epi8('\\')));
+  m = _mm_or_si128(m, _mm_cmpeq_epi8(b, _mm_set1_epi8('\'')));
+  m = _mm_or_si128(m, _mm_cmpeq_epi8(b, _mm_set1_epi8('"')));
+  m = _mm_or_si128(m, _mm_cmpeq_epi8(b, _mm_set1_epi8('\032')));
+  m = _mm_or_si128(m, _mm_cmpeq_epi8(b, _mm_set1_epi8(extra_1)));
+  m = _mm_or_si128(m, _mm_cmpeq_epi8(b, _mm_set1_epi8(extra_2)));
+  return _mm_movemask_epi8(m);
+}
+#endif
+
+/* Escape code of c, extra_1 and extra_2 are escaped with themselves. Pass 0
+ * when there is no extra character to escape. */
+static inline
+char get_escape_code(gchar c, gchar extra_1, gchar extra_2){
+  char escape = escape_code[(guchar)c];
+  if (!escape && (c == extra_1 || c == extra_2))
+    escape = c;
+  return escape;
+}
+
+static inline
+unsigned long escape_into(char *to, const gchar *from, unsigned long length, gchar escape_char, gchar extra_1, gchar extra_2){
   const char *to_start = to;
-  const char *end, *to_end = to_start + (to_length ? to_length - 1 : 2 * length);;
-  int tmp_length = 0;
-  for (end = from + length; from < end; from++) {
-    char escape = 0;
-/*    if (use_mb_flag && (tmp_length = my_ismbchar(charset_info, from, end))) {
-      if (to + tmp_length > to_end) {
-        overflow = true;
-        break;
-      }
-      while (tmp_length--) *to++ = *from++;
-      from--;
+  const gchar *end = from + length;
+  char escape;
+#ifdef __SSE2__
+  while (end - from >= 16){
+    int mask = escape_mask_16(from, extra_1, extra_2);
+    if (mask == 0){
+      memcpy(to, from, 16);
+      to+=16;
+      from+=16;
       continue;
     }
-*/
-    /*
- *      If the next character appears to begin a multi-byte character, we
- *      escape that first byte of that apparent multi-byte character. (The
- *      character just looks like a multi-byte character -- if it were actually
- *      a multi-byte character, it would have been passed through in the test
- *      above.)
- *      Without this check, we can create a problem by converting an invalid
- *      multi-byte character into a valid one. For example, 0xbf27 is not
- *      a valid GBK character, but 0xbf5c is. (0x27 = ', 0x5c = \)
- *      */
-
-//    tmp_length = use_mb_flag ? my_mbcharlen_ptr(charset_info, from, end) : 0;
-
-    if (tmp_length > 1)
-      escape = *from;
-    else
-      switch (*from) {
-        case 0: /* Must be escaped for 'mysql' */
-          escape = '0';
-          break;
-        case '\n': /* Must be escaped for logs */
-          escape = 'n';
-          break;
-        case '\r':
-          escape = 'r';
-          break;
-        case '\\':
-          escape = '\\';
-          break;
-        case '\'':
-          escape = '\'';
-          break;
-        case '"': /* Better safe than sorry */
-          escape = '"';
-          break;
-        case '\032': /* This gives problems on Win32 */
-          escape = 'Z';
-          break;
-      }
+    int skip = __builtin_ctz(mask);
+    memcpy(to, from, skip);
+    to+=skip;
+    from+=skip;
+    *to++ = escape_char;
+    *to++ = get_escape_code(*from, extra_1, extra_2);
+    from++;
+  }
+#endif
+  for (; from < end; from++) {
+    escape = get_escape_code(*from, extra_1, extra_2);
     if (escape) {
-      if (to + 2 > to_end) {
-//        overflow = true;
-        break;
-      }
-      *to++ = *fields_escaped_by;
+      *to++ = escape_char;
       *to++ = escape;
-    } else {
-      if (to + 1 > to_end) {
-//        overflow = true;
-        break;
-      }
+    } else
       *to++ = *from;
-    }
   }
   *to = 0;
+  return (unsigned long)(to - to_start);
+}
 
-  return //overflow ? (size_t)-1 : 
-         (size_t)(to - to_start);
+/* Same escaping as mysql_real_escape_string(), using escape_char as prefix.
+ * `to` must have room for 2*length+1 bytes. Runs of bytes that do not need
+ * escaping are copied in blocks. Returns the length written, without the
+ * ending '\0'. */
+unsigned long m_real_escape_string(MYSQL *conn, char *to, const gchar *from, unsigned long length, gchar escape_char){
+  if (is_escape_unsafe_charset(conn)){
+    unsigned long l=mysql_real_escape_string(conn, to, from, length);
+    if (escape_char != '\\')
+      m_replace_char_with_char('\\', escape_char, to, l);
+    return l;
+  }
+  return escape_into(to, from, length, escape_char, 0, 0);
+}
+
+/* Appends the LOAD DATA/CSV encoding of from to `to` in a single pass: the
+ * mysql_real_escape_string() set plus terminated_by and enclosed_by are
+ * prefixed with escaped_by. */
+void m_load_data_escape_string_append(MYSQL *conn, GString *to, const gchar *from, unsigned long length, gchar escaped_by, gchar terminated_by, gchar enclosed_by){
+  gsize start=to->len;
+  if (is_escape_unsafe_charset(conn)){
+    // The client library keeps multi-byte sequences intact, then we add the
+    // escaping of terminated_by and enclosed_by from the end
+    g_string_set_size(to, start + length * 3 + 1);
+    unsigned long l=m_real_escape_string(conn, to->str + start, from, length, escaped_by);
+    gchar *p=to->str + start, *q;
+    unsigned long i, n=0;
+    for (i=0; i<l; i++)
+      if (!escape_code[(guchar)p[i]] && (p[i] == terminated_by || p[i] == enclosed_by))
+        n++;
+    g_string_truncate(to, start + l + n);
+    q=p + l + n;
+    for (i=l; n>0 && i>0; i--){
+      *--q = p[i-1];
+      if (!escape_code[(guchar)p[i-1]] && (p[i-1] == terminated_by || p[i-1] == enclosed_by)){
+        *--q = escaped_by;
+        n--;
+      }
+    }
+    return;
+  }
+  g_string_set_size(to, start + length * 2 + 1);
+  g_string_truncate(to, start + escape_into(to->str + start, from, length, escaped_by, terminated_by, enclosed_by));
 }
 
 void m_escape_char_with_char(gchar neddle, gchar repl, gchar *to, unsigned long length){
@@ -320,7 +369,100 @@ void m_replace_char_with_char(gchar neddle, gchar repl, gchar *from, unsigned lo
   }
 }
 
-void determine_show_table_status_columns(MYSQL_RES *result, guint *ecol, guint *ccol, guint *collcol, guint *rowscol){
+/* Hex encoding with the same output as mysql_hex_string(): two uppercase
+ * digits per byte and an ending '\0'. Blocks are encoded with SIMD, the
+ * AVX2 version is picked on runtime by initialize_hex_string(), and the tail
+ * uses a table with both digits of each byte. */
+static char hex_pairs[512];
+
+static inline
+unsigned long hex_string_tail(char *to, const gchar *from, unsigned long length){
+  unsigned long i;
+  for (i = 0; i < length; i++)
+    memcpy(to + 2*i, hex_pairs + 2*(guchar)from[i], 2);
+  to[2*length]='\0';
+  return 2*length;
+}
+
+#if defined(__SSE2__)
+static inline
+__m128i hex_digits_16(__m128i nibbles){
+  // '0' + n, plus the 7 characters between '9' and 'A' when n > 9
+  __m128i over = _mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9));
+  nibbles = _mm_add_epi8(nibbles, _mm_set1_epi8('0'));
+  return _mm_add_epi8(nibbles, _mm_and_si128(over, _mm_set1_epi8(7)));
+}
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+static
+unsigned long hex_string_baseline(char *to, const gchar *from, unsigned long length){
+  unsigned long done = 0;
+#if defined(__SSE2__)
+  const __m128i low_nibble = _mm_set1_epi8(0x0f);
+  for (; length - done >= 16; done += 16){
+    __m128i b = _mm_loadu_si128((const __m128i *)(from + done));
+    __m128i hi = hex_digits_16(_mm_and_si128(_mm_srli_epi16(b, 4), low_nibble));
+    __m128i lo = hex_digits_16(_mm_and_si128(b, low_nibble));
+    _mm_storeu_si128((__m128i *)(to + 2*done), _mm_unpacklo_epi8(hi, lo));
+    _mm_storeu_si128((__m128i *)(to + 2*done + 16), _mm_unpackhi_epi8(hi, lo));
+  }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+  const uint8x16_t digits = vld1q_u8((const uint8_t *)"0123456789ABCDEF");
+  const uint8x16_t low_nibble = vdupq_n_u8(0x0f);
+  for (; length - done >= 16; done += 16){
+    uint8x16_t b = vld1q_u8((const uint8_t *)(from + done));
+    uint8x16x2_t pairs;
+    pairs.val[0] = vqtbl1q_u8(digits, vshrq_n_u8(b, 4));
+    pairs.val[1] = vqtbl1q_u8(digits, vandq_u8(b, low_nibble));
+    // vst2 interleaves the high and the low digits
+    vst2q_u8((uint8_t *)(to + 2*done), pairs);
+  }
+#endif
+  return 2*done + hex_string_tail(to + 2*done, from + done, length - done);
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+__attribute__((target("avx2")))
+static
+unsigned long hex_string_avx2(char *to, const gchar *from, unsigned long length){
+  unsigned long done = 0;
+  const __m256i digits = _mm256_setr_epi8(
+      '0','1','2','3','4','5','6','7','8','9','A','B','C','D','E','F',
+      '0','1','2','3','4','5','6','7','8','9','A','B','C','D','E','F');
+  const __m256i low_nibble = _mm256_set1_epi8(0x0f);
+  for (; length - done >= 32; done += 32){
+    __m256i b = _mm256_loadu_si256((const __m256i *)(from + done));
+    __m256i hi = _mm256_shuffle_epi8(digits, _mm256_and_si256(_mm256_srli_epi16(b, 4), low_nibble));
+    __m256i lo = _mm256_shuffle_epi8(digits, _mm256_and_si256(b, low_nibble));
+    // the unpacks work per 128 bits lane, the permutes put the lanes in order
+    __m256i first = _mm256_unpacklo_epi8(hi, lo);
+    __m256i second = _mm256_unpackhi_epi8(hi, lo);
+    _mm256_storeu_si256((__m256i *)(to + 2*done), _mm256_permute2x128_si256(first, second, 0x20));
+    _mm256_storeu_si256((__m256i *)(to + 2*done + 32), _mm256_permute2x128_si256(first, second, 0x31));
+  }
+  return 2*done + hex_string_baseline(to + 2*done, from + done, length - done);
+}
+#endif
+
+unsigned long (*m_hex_string)(char *to, const gchar *from, unsigned long length)=&hex_string_baseline;
+
+void initialize_hex_string(){
+  guint i;
+  for (i = 0; i < 256; i++){
+    hex_pairs[2*i]="0123456789ABCDEF"[i >> 4];
+    hex_pairs[2*i+1]="0123456789ABCDEF"[i & 0x0f];
+  }
+#if defined(__x86_64__) && defined(__GNUC__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    m_hex_string=&hex_string_avx2;
+#endif
+}
+
+void determine_show_table_status_columns(MYSQL_RES *result, guint *ecol, guint *ccol, guint *collcol, guint *rowscol, guint *datacol){
   MYSQL_FIELD *fields = mysql_fetch_fields(result);
   guint i = 0;
   for (i = 0; i < mysql_num_fields(result); i++) {
@@ -332,6 +474,8 @@ void determine_show_table_status_columns(MYSQL_RES *result, guint *ecol, guint *
       *collcol = i;
     else if (!strcasecmp(fields[i].name, "Rows"))
       *rowscol = i;
+    else if (!strcasecmp(fields[i].name, "Data_length"))
+      *datacol = i;
   }
   g_assert(*ecol > 0);
   g_assert(*ccol > 0);
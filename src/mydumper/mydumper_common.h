@@ -42,10 +42,14 @@ gchar * build_filename(char *database, char *table, guint64 part, guint sub_part
 //gchar * build_filename(char *database, char *table, guint part, guint sub_part, const gchar *extension);
 gchar * build_sql_filename(char *database, char *table, guint64 part, guint sub_part);
 gchar * build_rows_filename(char *database, char *table, guint64 part, guint sub_part);
-void determine_show_table_status_columns(MYSQL_RES *result, guint *ecol, guint *ccol, guint *collcol, guint *rowscol);
+void determine_show_table_status_columns(MYSQL_RES *result, guint *ecol, guint *ccol, guint *collcol, guint *rowscol, guint *datacol);
 void determine_explain_columns(MYSQL_RES *result, guint *rowscol);
 void determine_charset_and_coll_columns_from_show(MYSQL_RES *result, guint *charcol, guint *collcol);
-unsigned long m_real_escape_string(MYSQL *conn, char *to, const gchar *from, unsigned long length);
+gboolean is_escape_unsafe_charset(MYSQL *conn);
+extern unsigned long (*m_hex_string)(char *to, const gchar *from, unsigned long length);
+void initialize_hex_string();
+unsigned long m_real_escape_string(MYSQL *conn, char *to, const gchar *from, unsigned long length, gchar escape_char);
+void m_load_data_escape_string_append(MYSQL *conn, GString *to, const gchar *from, unsigned long length, gchar escaped_by, gchar terminated_by, gchar enclosed_by);
 void m_replace_char_with_char(gchar neddle, gchar replace, gchar *from, unsigned long length);
 void m_escape_char_with_char(gchar neddle, gchar replace, gchar *to, unsigned long length);
 void free_common();
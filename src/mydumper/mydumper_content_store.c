@@ -0,0 +1,262 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+
+#include "mydumper.h"
+#include "mydumper_global.h"
+#include "mydumper_common.h"
+#include "mydumper_content_store.h"
+
+/* --content-store: every file is kept once in output_directory/blobs under
+ * the SHA256 of its content, and each snapshot only has a manifest with one
+ * "filename<TAB>blob" line per file, the blob is relative to the snapshot.
+ * Blobs that no snapshot references are removed when a dump finishes */
+gboolean content_store=FALSE;
+static gchar *blobs_directory=NULL;
+static FILE *manifest_file=NULL;
+static GMutex *manifest_mutex=NULL;
+static GHashTable *previous_manifest=NULL;
+static guint stored=0, deduplicated=0;
+
+#define CONTENT_STORE_BLOBS "blobs"
+#define CONTENT_STORE_BUFFER_SIZE 65536
+
+gchar *content_store_manifest_filename(){
+  return g_build_filename(dump_directory, CONTENT_STORE_MANIFEST, NULL);
+}
+
+void initialize_content_store(){
+  if (!content_store)
+    return;
+  if (manifest_mutex == NULL)
+    manifest_mutex=g_mutex_new();
+  blobs_directory=g_build_filename(output_directory, CONTENT_STORE_BLOBS, NULL);
+  create_dir(blobs_directory);
+  gchar *filename=content_store_manifest_filename();
+  manifest_file=g_fopen(filename, "w");
+  if (!manifest_file)
+    m_critical("Couldn't create manifest file %s (%s)", filename, strerror(errno));
+  g_free(filename);
+  stored=0;
+  deduplicated=0;
+}
+
+// the compression extension is kept, as myloader decides how to read a
+// file from its name
+static
+const gchar *blob_extension(const gchar *basename){
+  const gchar *ext=strrchr(basename, '.');
+  if (ext == NULL)
+    return "";
+  if (strlen(exec_per_thread_extension) > 0 && g_str_has_suffix(basename, exec_per_thread_extension)){
+    const gchar *prev=g_strrstr_len(basename, ext - basename, ".");
+    if (prev)
+      ext=prev;
+  }
+  return ext;
+}
+
+static
+gchar *hash_file(const gchar *filename){
+  int fd=open(filename, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+  GChecksum *checksum=g_checksum_new(G_CHECKSUM_SHA256);
+  guchar *buffer=g_new(guchar, CONTENT_STORE_BUFFER_SIZE);
+  ssize_t r;
+  while ((r=read(fd, buffer, CONTENT_STORE_BUFFER_SIZE)) != 0){
+    if (r < 0){
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    g_checksum_update(checksum, buffer, r);
+  }
+  close(fd);
+  g_free(buffer);
+  gchar *hash= r < 0 ? NULL : g_strdup(g_checksum_get_string(checksum));
+  g_checksum_free(checksum);
+  return hash;
+}
+
+static
+void append_manifest_entry(const gchar *filename, const gchar *blob){
+  g_mutex_lock(manifest_mutex);
+  fprintf(manifest_file, "%s\t%s\n", filename, blob);
+  g_mutex_unlock(manifest_mutex);
+}
+
+/* Moves the file into the store, or removes it if the blob was already
+ * there. Returns the path of the new blob, that still needs to be uploaded,
+ * or NULL */
+gchar *content_store_file(const gchar *filename){
+  gchar *hash=hash_file(filename);
+  if (hash == NULL){
+    g_critical("Could not read %s to add it into the content store: %s", filename, strerror(errno));
+    errors++;
+    return NULL;
+  }
+  gchar *basename=g_path_get_basename(filename);
+  gchar prefix[3]={hash[0], hash[1], '\0'};
+  gchar *blob_name=g_strdup_printf("%s%s", hash, blob_extension(basename));
+  gchar *directory=g_build_filename(blobs_directory, prefix, NULL);
+  gchar *blob=g_build_filename(directory, blob_name, NULL);
+  gchar *relative=g_build_filename("..", CONTENT_STORE_BLOBS, prefix, blob_name, NULL);
+  gchar *r=NULL;
+  g_free(hash);
+  g_free(blob_name);
+
+  if (g_mkdir(directory, 0750) && errno != EEXIST){
+    g_critical("Could not create content store directory %s: %s", directory, strerror(errno));
+    errors++;
+    goto cleanup;
+  }
+  // link() fails if the blob exists, so two threads storing the same
+  // content at the same time keep only one copy
+  if (link(filename, blob) == 0){
+    g_atomic_int_inc(&stored);
+    r=g_strdup(blob);
+  }else if (errno == EEXIST){
+    g_atomic_int_inc(&deduplicated);
+  }else{
+    g_critical("Could not add %s into the content store as %s: %s", filename, blob, strerror(errno));
+    errors++;
+    goto cleanup;
+  }
+  if (g_unlink(filename))
+    g_warning("Could not remove %s after storing it: %s", filename, strerror(errno));
+  append_manifest_entry(basename, relative);
+
+cleanup:
+  g_free(basename);
+  g_free(directory);
+  g_free(blob);
+  g_free(relative);
+  return r;
+}
+
+static
+GHashTable *read_manifest(const gchar *filename){
+  gchar *content=NULL;
+  if (!g_file_get_contents(filename, &content, NULL, NULL))
+    return NULL;
+  GHashTable *manifest=g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  gchar **lines=g_strsplit(content, "\n", -1);
+  g_free(content);
+  gchar *tab;
+  guint i;
+  for (i=0; lines[i]; i++){
+    tab=strchr(lines[i], '\t');
+    if (tab == NULL)
+      continue;
+    g_hash_table_insert(manifest, g_strndup(lines[i], tab - lines[i]), g_strdup(tab + 1));
+  }
+  g_strfreev(lines);
+  return manifest;
+}
+
+static
+const gchar *previous_entry(const gchar *previous_directory, const gchar *filename){
+  g_mutex_lock(manifest_mutex);
+  if (previous_manifest == NULL){
+    gchar *path=g_build_filename(previous_directory, CONTENT_STORE_MANIFEST, NULL);
+    previous_manifest=read_manifest(path);
+    if (previous_manifest == NULL)
+      previous_manifest=g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    g_free(path);
+  }
+  const gchar *blob=g_hash_table_lookup(previous_manifest, filename);
+  g_mutex_unlock(manifest_mutex);
+  return blob;
+}
+
+gboolean content_store_has_previous(const gchar *previous_directory, const gchar *filename){
+  return previous_entry(previous_directory, filename) != NULL;
+}
+
+// --incremental: the file is the same blob that the previous snapshot used
+gboolean content_store_reuse(const gchar *previous_directory, const gchar *filename){
+  const gchar *blob=previous_entry(previous_directory, filename);
+  if (blob == NULL)
+    return FALSE;
+  append_manifest_entry(filename, blob);
+  return TRUE;
+}
+
+static
+void remove_unreferenced_blobs(){
+  GHashTable *referenced=g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  GHashTableIter iter;
+  gchar *path, *blob;
+  guint i, removed=0;
+  for (i=0; i < snapshot_count; i++){
+    gchar *number=g_strdup_printf("%u", i);
+    path=g_build_filename(output_directory, number, CONTENT_STORE_MANIFEST, NULL);
+    GHashTable *manifest=read_manifest(path);
+    g_free(number);
+    g_free(path);
+    if (manifest == NULL)
+      continue;
+    g_hash_table_iter_init(&iter, manifest);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&blob))
+      g_hash_table_add(referenced, g_path_get_basename(blob));
+    g_hash_table_destroy(manifest);
+  }
+
+  const gchar *prefix, *name;
+  GDir *blobs=g_dir_open(blobs_directory, 0, NULL), *dir;
+  while (blobs && (prefix=g_dir_read_name(blobs))){
+    gchar *directory=g_build_filename(blobs_directory, prefix, NULL);
+    dir=g_dir_open(directory, 0, NULL);
+    while (dir && (name=g_dir_read_name(dir))){
+      if (g_hash_table_contains(referenced, name))
+        continue;
+      path=g_build_filename(directory, name, NULL);
+      if (g_unlink(path))
+        g_warning("Could not remove unreferenced blob %s: %s", path, strerror(errno));
+      else
+        removed++;
+      g_free(path);
+    }
+    if (dir)
+      g_dir_close(dir);
+    g_free(directory);
+  }
+  if (blobs)
+    g_dir_close(blobs);
+  g_hash_table_destroy(referenced);
+  g_message("Content store: %u new blobs, %u files deduplicated, %u unreferenced blobs removed", stored, deduplicated, removed);
+}
+
+void finalize_content_store(){
+  if (!content_store || manifest_file == NULL)
+    return;
+  fclose(manifest_file);
+  manifest_file=NULL;
+  if (previous_manifest)
+    g_hash_table_destroy(previous_manifest);
+  previous_manifest=NULL;
+  if (!shutdown_triggered)
+    remove_unreferenced_blobs();
+  g_free(blobs_directory);
+  blobs_directory=NULL;
+}
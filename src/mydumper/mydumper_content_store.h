@@ -0,0 +1,32 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#ifndef _src_mydumper_content_store_h
+#define _src_mydumper_content_store_h
+#include <glib.h>
+
+#define CONTENT_STORE_MANIFEST "manifest"
+
+extern gboolean content_store;
+
+void initialize_content_store();
+void finalize_content_store();
+gchar *content_store_file(const gchar *filename);
+gchar *content_store_manifest_filename();
+gboolean content_store_has_previous(const gchar *previous_directory, const gchar *filename);
+gboolean content_store_reuse(const gchar *previous_directory, const gchar *filename);
+#endif
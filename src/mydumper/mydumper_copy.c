@@ -0,0 +1,354 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include "mydumper.h"
+#include "mydumper_global.h"
+#include "mydumper_arguments.h"
+#include "mydumper_database.h"
+#include "mydumper_content_store.h"
+#include "mydumper_file_manifest.h"
+#include "mydumper_copy.h"
+
+gchar *copy_to=NULL;
+
+static gchar *copy_host=NULL;
+static guint copy_port=0;
+static GAsyncQueue *copy_connections=NULL;
+
+// the files that are sent, by the descriptor returned to the writers
+struct copy_file {
+  MYSQL *conn;
+  GString *pending;
+  struct database *database;
+  struct db_table *dbt;
+  enum copy_file_kind kind;
+  gboolean started;
+};
+static GHashTable *copy_files=NULL;
+static GMutex *copy_files_mutex=NULL;
+
+/* The tables are created before their data and the databases before them.
+   The value is COPY_EXPECTED while the job is queued, COPY_CREATED after */
+#define COPY_EXPECTED GINT_TO_POINTER(1)
+#define COPY_CREATED GINT_TO_POINTER(2)
+static GHashTable *copy_created=NULL;
+static GMutex *copy_created_mutex=NULL;
+static GCond *copy_created_cond=NULL;
+
+struct copy_deferred {
+  struct database *database;
+  gchar *statement;
+};
+static GList *copy_deferred_indexes=NULL;
+static GList *copy_deferred_constraints=NULL;
+// the files of the kinds from COPY_POST, by kind
+#define COPY_DEFERRED_KINDS (COPY_TRIGGERS - COPY_POST + 1)
+static GList *copy_deferred_objects[COPY_DEFERRED_KINDS]={NULL};
+
+static __thread struct copy_file *copy_next=NULL;
+
+static int (*file_m_open)(char **filename, const char *type)=NULL;
+static int (*file_m_close)(guint thread_id, int file, gchar *filename, guint64 size, struct db_table * dbt)=NULL;
+
+static
+MYSQL *get_copy_connection(){
+  MYSQL *conn=g_async_queue_try_pop(copy_connections);
+  if (conn)
+    return conn;
+  conn=mysql_init(NULL);
+  m_connect_to_host(conn, copy_host, copy_port);
+  m_query_warning(conn, "SET SESSION UNIQUE_CHECKS=0", "Not able to disable the unique checks on %s", copy_host);
+  return conn;
+}
+
+// FALSE when nothing is going to create it
+static
+gboolean wait_copy_created(void *key){
+  gpointer state=NULL;
+  g_mutex_lock(copy_created_mutex);
+  while ((state=g_hash_table_lookup(copy_created, key)) == COPY_EXPECTED)
+    g_cond_wait(copy_created_cond, copy_created_mutex);
+  g_mutex_unlock(copy_created_mutex);
+  return state == COPY_CREATED;
+}
+
+static
+void set_copy_state(void *key, gpointer state){
+  g_mutex_lock(copy_created_mutex);
+  g_hash_table_insert(copy_created, key, state);
+  g_cond_broadcast(copy_created_cond);
+  g_mutex_unlock(copy_created_mutex);
+}
+
+static
+gboolean copy_use_database(MYSQL *conn, struct database *database){
+  gchar *query=g_strdup_printf("USE %c%s%c", identifier_quote_character, database->source_database, identifier_quote_character);
+  gboolean r=m_query_warning(conn, query, "Not able to use %s on %s", database->source_database, copy_host);
+  g_free(query);
+  return r;
+}
+
+static
+gboolean copy_query(MYSQL *conn, const gchar *query, gsize length){
+  gsize i=0;
+  while (i < length && g_ascii_isspace(query[i]))
+    i++;
+  if (i == length)
+    return TRUE;
+  if (mysql_real_query(conn, query, length)){
+    g_critical("Copy to %s failed: %s (%u) on %.*s", copy_host, mysql_error(conn), mysql_errno(conn), (int)MIN(length, 256), query);
+    errors++;
+    return FALSE;
+  }
+  MYSQL_RES *res=mysql_store_result(conn);
+  if (res)
+    mysql_free_result(res);
+  return TRUE;
+}
+
+/* The statements written by mydumper end with ";\n", the values escape the
+   new lines, so that is enough to cut them. The rest waits for the next write */
+static
+gboolean copy_pending_statements(struct copy_file *cf, gboolean last){
+  if (!cf->started){
+    cf->started=TRUE;
+    if (cf->kind == COPY_DATA)
+      wait_copy_created(cf->dbt);
+    else if (cf->kind == COPY_TABLE && !wait_copy_created(cf->database)){
+      // the database was found without its create job
+      gchar *query=g_strdup_printf("CREATE DATABASE IF NOT EXISTS %c%s%c", identifier_quote_character, cf->database->source_database, identifier_quote_character);
+      copy_query(cf->conn, query, strlen(query));
+      g_free(query);
+    }
+    if (cf->kind != COPY_DATABASE && !copy_use_database(cf->conn, cf->database))
+      return FALSE;
+  }
+  gsize from=0;
+  gchar *end=NULL;
+  gboolean r=TRUE;
+  while ((end=g_strstr_len(cf->pending->str + from, cf->pending->len - from, ";\n")) != NULL){
+    r=copy_query(cf->conn, cf->pending->str + from, end - cf->pending->str - from) && r;
+    from=end - cf->pending->str + 2;
+  }
+  if (last){
+    r=copy_query(cf->conn, cf->pending->str + from, cf->pending->len - from) && r;
+    from=cf->pending->len;
+  }
+  g_string_erase(cf->pending, 0, from);
+  return r;
+}
+
+static
+struct copy_file *get_copy_file(int file){
+  g_mutex_lock(copy_files_mutex);
+  struct copy_file *cf=g_hash_table_lookup(copy_files, GINT_TO_POINTER(file));
+  g_mutex_unlock(copy_files_mutex);
+  return cf;
+}
+
+/* The descriptor of /dev/null keeps the number unique among the real files
+   that are still written */
+static
+int m_open_copy(char **filename, const char *type){
+  struct copy_file *cf=copy_next;
+  if (cf == NULL)
+    return file_m_open(filename, type);
+  copy_next=NULL;
+  int fd=open("/dev/null", O_WRONLY);
+  if (fd < 0)
+    m_critical("Couldn't open /dev/null for %s: %s", *filename, strerror(errno));
+  if (cf->kind < COPY_POST)
+    cf->conn=get_copy_connection();
+  cf->pending=g_string_sized_new(statement_size);
+  g_mutex_lock(copy_files_mutex);
+  g_hash_table_insert(copy_files, GINT_TO_POINTER(fd), cf);
+  g_mutex_unlock(copy_files_mutex);
+  return fd;
+}
+
+static
+ssize_t m_write_copy(int file, const void *buf, size_t count){
+  struct copy_file *cf=get_copy_file(file);
+  if (cf == NULL)
+    return write(file, buf, count);
+  g_string_append_len(cf->pending, buf, count);
+  // the failed statements are already counted as errors
+  if (cf->kind < COPY_POST)
+    copy_pending_statements(cf, FALSE);
+  return count;
+}
+
+static
+int m_close_copy(guint thread_id, int file, gchar *filename, guint64 size, struct db_table * dbt){
+  struct copy_file *cf=get_copy_file(file);
+  if (cf == NULL)
+    return file_m_close(thread_id, file, filename, size, dbt);
+  g_mutex_lock(copy_files_mutex);
+  g_hash_table_remove(copy_files, GINT_TO_POINTER(file));
+  g_mutex_unlock(copy_files_mutex);
+  if (cf->kind >= COPY_POST){
+    struct copy_deferred *cd=g_new0(struct copy_deferred, 1);
+    cd->database=cf->database;
+    cd->statement=g_string_free(cf->pending, FALSE);
+    g_mutex_lock(copy_created_mutex);
+    copy_deferred_objects[cf->kind - COPY_POST]=g_list_prepend(copy_deferred_objects[cf->kind - COPY_POST], cd);
+    g_mutex_unlock(copy_created_mutex);
+  }else{
+    copy_pending_statements(cf, TRUE);
+    g_async_queue_push(copy_connections, cf->conn);
+    g_string_free(cf->pending, TRUE);
+  }
+  g_free(cf);
+  return close(file);
+}
+
+void initialize_copy(){
+  if (!copy_to)
+    return;
+  if (output_format != SQL_INSERT || compress_method || exec_per_thread || stream || exec_command || upload_url || content_store || num_async_writers > 0)
+    m_critical("--copy-to sends INSERT statements, it is not compatible with --format, --compress, --exec-per-thread, --stream, --exec, --upload-url, --content-store and --async-writers");
+  if (no_schemas || daemon_mode)
+    m_critical("--copy-to needs the schemas to create the tables on %s and it is not compatible with --daemon", copy_to);
+  // there are no data files to index or to list
+  if (data_index || file_manifest)
+    m_critical("--copy-to does not write the data files, it is not compatible with --data-index and --file-manifest");
+  copy_host=g_strdup(copy_to);
+  gchar *colon=g_strrstr(copy_host, ":");
+  if (colon){
+    *colon='\0';
+    copy_port=strtoul(colon + 1, NULL, 10);
+  }
+  copy_connections=g_async_queue_new();
+  copy_files=g_hash_table_new(g_direct_hash, g_direct_equal);
+  copy_files_mutex=g_mutex_new();
+  copy_created=g_hash_table_new(g_direct_hash, g_direct_equal);
+  copy_created_mutex=g_mutex_new();
+  copy_created_cond=g_cond_new();
+  // fails early if the target is not reachable
+  g_async_queue_push(copy_connections, get_copy_connection());
+  file_m_open=m_open;
+  file_m_close=m_close;
+  m_open=&m_open_copy;
+  m_write=&m_write_copy;
+  m_close=&m_close_copy;
+  g_message("Copying the databases, tables and data to %s", copy_to);
+}
+
+/* A database or a table whose create job is queued, the jobs that need it
+   wait until copy_created() is called, even if the job failed */
+void copy_expect(void *object){
+  if (copy_to)
+    set_copy_state(object, COPY_EXPECTED);
+}
+
+void copy_created(void *object){
+  if (copy_to)
+    set_copy_state(object, COPY_CREATED);
+}
+
+// The next m_open of this thread is sent to the target
+void copy_next_file(struct database *database, struct db_table *dbt, enum copy_file_kind kind){
+  if (!copy_to)
+    return;
+  struct copy_file *cf=g_new0(struct copy_file, 1);
+  cf->database=database;
+  cf->dbt=dbt;
+  cf->kind=kind;
+  copy_next=cf;
+}
+
+// Indexes and constraints are added once all the data is copied
+void copy_defer_statement(struct db_table *dbt, GString *statement, gboolean constraint){
+  struct copy_deferred *cd=g_new0(struct copy_deferred, 1);
+  cd->database=dbt->database;
+  cd->statement=g_strdup(statement->str);
+  g_mutex_lock(copy_created_mutex);
+  if (constraint)
+    copy_deferred_constraints=g_list_prepend(copy_deferred_constraints, cd);
+  else
+    copy_deferred_indexes=g_list_prepend(copy_deferred_indexes, cd);
+  g_mutex_unlock(copy_created_mutex);
+}
+
+static
+void *copy_deferred_thread(GAsyncQueue *queue){
+  struct copy_deferred *cd=NULL;
+  struct copy_file cf;
+  memset(&cf, 0, sizeof(cf));
+  cf.conn=get_copy_connection();
+  cf.pending=g_string_sized_new(statement_size);
+  cf.kind=COPY_DATABASE;
+  while ((cd=g_async_queue_pop(queue)) != GINT_TO_POINTER(-1)){
+    if (copy_use_database(cf.conn, cd->database)){
+      g_string_assign(cf.pending, cd->statement);
+      copy_pending_statements(&cf, TRUE);
+    }
+    g_free(cd->statement);
+    g_free(cd);
+  }
+  g_string_free(cf.pending, TRUE);
+  g_async_queue_push(copy_connections, cf.conn);
+  return NULL;
+}
+
+static
+void run_copy_deferred(GList *list, const gchar *what){
+  guint n=0, num=MIN(num_threads, g_list_length(list));
+  if (num == 0)
+    return;
+  g_message("Adding %u %s on %s", g_list_length(list), what, copy_host);
+  GAsyncQueue *queue=g_async_queue_new();
+  GThread **threads=g_new(GThread *, num);
+  for (GList *l=list; l; l=l->next)
+    g_async_queue_push(queue, l->data);
+  for (n=0; n < num; n++){
+    g_async_queue_push(queue, GINT_TO_POINTER(-1));
+    threads[n]=m_thread_new("copy_deferred", (GThreadFunc)copy_deferred_thread, queue, "Copy thread could not be created");
+  }
+  for (n=0; n < num; n++)
+    g_thread_join(threads[n]);
+  g_free(threads);
+  g_async_queue_unref(queue);
+  g_list_free(list);
+}
+
+/* Constraints after the indexes, they may need them. Then the routines, the
+   views over tables with their columns so a view can use another one, and
+   the triggers, once they can not fire on the copied rows */
+void finish_copy(){
+  if (!copy_to)
+    return;
+  const gchar *deferred_objects[COPY_DEFERRED_KINDS]={"routines and events files", "view placeholder tables", "views", "triggers files"};
+  guint i;
+  run_copy_deferred(copy_deferred_indexes, "table indexes");
+  copy_deferred_indexes=NULL;
+  run_copy_deferred(copy_deferred_constraints, "table constraints");
+  copy_deferred_constraints=NULL;
+  for (i=0; i < COPY_DEFERRED_KINDS; i++){
+    run_copy_deferred(copy_deferred_objects[i], deferred_objects[i]);
+    copy_deferred_objects[i]=NULL;
+  }
+  MYSQL *conn=NULL;
+  while ((conn=g_async_queue_try_pop(copy_connections)) != NULL)
+    mysql_close(conn);
+  g_message("Copy to %s finished", copy_to);
+}
@@ -0,0 +1,48 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#if !defined(mydumper_mydumper_copy)
+#define mydumper_mydumper_copy
+
+#include <glib.h>
+
+/* --copy-to sends the statements straight to another server instead of
+   writing the files. The routines, views and triggers are kept until the
+   data is copied, as myloader does with their files */
+enum copy_file_kind {
+  COPY_DATABASE,
+  COPY_TABLE,
+  COPY_DATA,
+  // sent by finish_copy(), in this order
+  COPY_POST,
+  COPY_VIEW_TABLE,
+  COPY_VIEW,
+  COPY_TRIGGERS
+};
+
+struct database;
+struct db_table;
+
+extern gchar *copy_to;
+
+void initialize_copy();
+void copy_expect(void *object);
+void copy_created(void *object);
+void copy_next_file(struct database *database, struct db_table *dbt, enum copy_file_kind kind);
+void copy_defer_statement(struct db_table *dbt, GString *statement, gboolean constraint);
+void finish_copy();
+#endif
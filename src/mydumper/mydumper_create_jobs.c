@@ -19,6 +19,7 @@
                     David Ducos, Percona (david dot ducos at percona dot com)
 */
 #include <gio/gio.h>
+#include <string.h>
 #include "mydumper_start_dump.h"
 #include "mydumper_common.h"
 #include "mydumper_jobs.h"
@@ -28,6 +29,11 @@
 #include "mydumper_arguments.h"
 #include "mydumper_create_jobs.h"
 #include "mydumper_chunks.h"
+#include "mydumper_write.h"
+#include "mydumper_parquet.h"
+#include "mydumper_file_manifest.h"
+#include "mydumper_schema_thread.h"
+#include "mydumper_copy.h"
 //
 // Enqueueing in initial_queue
 //
@@ -39,7 +45,7 @@ void initialize_create_jobs(struct configuration *_conf){
 }
 
 
-void create_job_to_dump_table(gboolean is_view, gboolean is_sequence, struct database *database, gchar *table, gchar *collation, gchar *engine){
+void create_job_to_dump_table(gboolean is_view, gboolean is_sequence, struct database *database, gchar *table, gchar *collation, gchar *engine, guint64 data_length, guint64 rows){
   struct job *j = g_new0(struct job, 1);
   struct dump_table_job *dtj= g_new0(struct dump_table_job, 1);
   dtj->is_view=is_view;
@@ -48,6 +54,8 @@ void create_job_to_dump_table(gboolean is_view, gboolean is_sequence, struct dat
   dtj->table=table;
   dtj->collation=collation;
   dtj->engine=engine;
+  dtj->data_length=data_length;
+  dtj->rows=rows;
   j->job_data = dtj;
   j->type = JOB_TABLE;
   g_async_queue_push(local_conf->initial_queue, j);
@@ -101,7 +109,7 @@ void create_job_to_dump_tablespaces(){
   j->job_data = (void *)ctj;
   j->type = JOB_CREATE_TABLESPACE;
   ctj->filename = build_tablespace_filename();
-  g_async_queue_push(local_conf->schema_queue, j);
+  m_async_queue_push_conservative(local_conf->schema_queue, j);
 }
 
 static
@@ -113,11 +121,12 @@ void create_database_related_job(struct database *database, enum job_type type,
   j->type = type;
   dj->filename = build_schema_filename(database->database_name_in_filename, suffix);
   dj->checksum_filename = checksum_filename;
-  g_async_queue_push(local_conf->schema_queue, j);
+  m_async_queue_push_conservative(local_conf->schema_queue, j);
   return;
 }
 
 void create_job_to_dump_table_schema(struct db_table *dbt) {
+  copy_expect(dbt);
   struct job *j = g_new0(struct job, 1);
   struct schema_job *sj = g_new0(struct schema_job, 1);
   j->job_data = (void *)sj;
@@ -126,10 +135,14 @@ void create_job_to_dump_table_schema(struct db_table *dbt) {
   sj->filename = build_schema_table_filename(dbt->database->database_name_in_filename, dbt->table_filename, "schema");
   sj->checksum_filename=schema_checksums;
   sj->checksum_index_filename=schema_checksums;
-  g_async_queue_push(local_conf->schema_queue, j);
+  if (schema_threads_enabled())
+    schema_threads_push(j);
+  else
+    m_async_queue_push_conservative(local_conf->schema_queue, j);
 }
 
 void create_job_to_dump_schema(struct database *database) {
+  copy_expect(database);
   create_database_related_job(database, JOB_CREATE_DATABASE, "schema-create", schema_checksums);
 }
 
@@ -156,7 +169,10 @@ void create_job_to_dump_triggers(MYSQL *conn, struct db_table *dbt) {
       st->dbt = dbt;
       st->filename = build_schema_table_filename(dbt->database->database_name_in_filename, dbt->table_filename, "schema-triggers");
       st->checksum_filename=routine_checksums;
-      g_async_queue_push(local_conf->post_data_queue, t);
+      if (schema_threads_enabled())
+        schema_threads_push(t);
+      else
+        m_async_queue_push_conservative(local_conf->post_data_queue, t);
     }
     mysql_free_result(result);
   }
@@ -170,7 +186,7 @@ void create_job_to_dump_schema_triggers(struct database *database) {
   st->database = database;
   st->filename = build_schema_filename(database->database_name_in_filename, "schema-triggers");
   st->checksum_filename=routine_checksums;
-  g_async_queue_push(local_conf->post_data_queue, t);
+  m_async_queue_push_conservative(local_conf->post_data_queue, t);
 }
 
 void create_job_to_dump_view(struct db_table *dbt) {
@@ -183,7 +199,10 @@ void create_job_to_dump_view(struct db_table *dbt) {
   vj->tmp_table_filename  = build_schema_table_filename(dbt->database->database_name_in_filename, dbt->table_filename, "schema");
   vj->view_filename = build_schema_table_filename(dbt->database->database_name_in_filename, dbt->table_filename, "schema-view");
   vj->checksum_filename = schema_checksums;
-  g_async_queue_push(local_conf->post_data_queue, j);
+  if (schema_threads_enabled())
+    schema_threads_push(j);
+  else
+    m_async_queue_push_conservative(local_conf->post_data_queue, j);
   return;
 }
 
@@ -195,7 +214,7 @@ void create_job_to_dump_sequence(struct db_table *dbt) {
   j->type = JOB_SEQUENCE;
   sj->filename = build_schema_table_filename(dbt->database->database_name_in_filename, dbt->table_filename, "schema-sequence");
   sj->checksum_filename=schema_checksums;
-  g_async_queue_push(local_conf->post_data_queue, j);
+  m_async_queue_push_conservative(local_conf->post_data_queue, j);
   return;
 }
 
@@ -206,7 +225,15 @@ void create_job_to_dump_checksum(struct db_table * dbt) {
   j->job_data = (void *)tcj;
   j->type = JOB_CHECKSUM;
   tcj->filename = build_meta_filename(dbt->database->database_name_in_filename, dbt->table_filename,"checksum");
-  g_async_queue_push(local_conf->post_data_queue, j);
+  m_async_queue_push_conservative(local_conf->post_data_queue, j);
+  return;
+}
+
+void create_job_to_count_rows(struct db_table * dbt) {
+  struct job *j = g_new0(struct job, 1);
+  j->job_data = (void *)dbt;
+  j->type = JOB_ROW_COUNT;
+  m_async_queue_push_conservative(local_conf->post_data_queue, j);
   return;
 }
 
@@ -214,8 +241,20 @@ void create_job_to_dump_checksum(struct db_table * dbt) {
 // Enqueueing in data tables queue
 //
 
+// table_jobs are created and freed for every chunk, the freed ones are kept
+// here to be reused
+static GAsyncQueue *free_table_jobs=NULL;
+
+void initialize_table_job_pool(){
+  free_table_jobs=g_async_queue_new();
+}
+
 struct table_job * new_table_job(struct db_table *dbt, char *partition, guint64 part, struct chunk_step_item *chunk_step_item){
-  struct table_job *tj = g_new0(struct table_job, 1);
+  struct table_job *tj = free_table_jobs ? g_async_queue_try_pop(free_table_jobs) : NULL;
+  if (tj)
+    memset(tj, 0, sizeof(struct table_job));
+  else
+    tj = g_new0(struct table_job, 1);
 // begin Refactoring: We should review this, as dbt->database should not be free, so it might be no need to g_strdup.
   // from the ref table?? TODO
 //  tj->database=dbt->database->source_database;
@@ -230,7 +269,12 @@ struct table_job * new_table_job(struct db_table *dbt, char *partition, guint64
   tj->rows=g_new0(struct table_job_file, 1);
   tj->rows->file = -1;
   tj->rows->filename = NULL;
-  if (output_format==SQL_INSERT)
+  tj->parquet=NULL;
+  tj->data_index= data_index ? gstring_pool_get(0) : NULL;
+  tj->data_index_offset=0;
+  tj->data_index_header_length=0;
+  tj->checksum_files=NULL;
+  if (output_format==SQL_INSERT || output_format==PARQUET || output_format==BINARY)
 		tj->sql=NULL;
 	else{
 		tj->sql=g_new0(struct table_job_file, 1);
@@ -243,7 +287,7 @@ struct table_job * new_table_job(struct db_table *dbt, char *partition, guint64
   tj->filesize=0;
 //  tj->char_chunk_part=char_chunk;
   tj->child_process=0;
-  tj->where=g_string_new("");
+  tj->where=gstring_pool_get(0);
   tj->num_rows_of_last_run=0;
   update_estimated_remaining_chunks_on_dbt(tj->dbt);
   return tj;
@@ -251,20 +295,33 @@ struct table_job * new_table_job(struct db_table *dbt, char *partition, guint64
 
 void free_table_job(struct table_job *tj){
   if (tj->sql && tj->sql->file >= 0){
+    file_manifest_set_rows(tj->sql->filename, tj->part, tj->sub_part, tj->rows ? tj->rows->rows : 0);
     if (tj->sql->file >= 0)
       m_close(tj->td->thread_id, tj->sql->file, tj->sql->filename, tj->filesize, tj->dbt);
     tj->sql->file=-1;
     tj->sql=NULL;
   }
   if (tj->rows){
-    if (tj->rows->file >= 0)
+    finish_parquet_file(tj);
+    write_data_index(tj);
+    if (tj->rows->file >= 0){
+      file_manifest_set_rows(tj->rows->filename, tj->part, tj->sub_part, tj->rows->rows);
       m_close(tj->td->thread_id, tj->rows->file, tj->rows->filename, tj->filesize, tj->dbt);
+    }
     tj->rows->file=-1;
     tj->rows=NULL;
   }
 
   if (tj->where!=NULL)
-    g_string_free(tj->where,TRUE);
+    gstring_pool_put(tj->where);
+  if (tj->next_where!=NULL)
+    g_string_free(tj->next_where, TRUE);
+  g_list_free_full(tj->checksum_files, g_free);
+
+  if (tj->parquet)
+    free_parquet_writer(tj->parquet);
+  if (tj->data_index)
+    gstring_pool_put(tj->data_index);
 
 //  if (tj->chunk_step_item){
 //    if (tj->chunk_step_item->chunk_functions.free)
@@ -272,7 +329,10 @@ void free_table_job(struct table_job *tj){
 //    g_free(tj->chunk_step_item);
 //    tj->chunk_step_item=NULL;
 //  }
-  g_free(tj);
+  if (free_table_jobs && g_async_queue_length(free_table_jobs) < (gint)num_threads * 4)
+    g_async_queue_push(free_table_jobs, tj);
+  else
+    g_free(tj);
 }
 
 void create_job_to_dump_chunk(struct db_table *dbt, char *partition, guint64 part, struct chunk_step_item *csi, void f(GAsyncQueue *,struct job *), GAsyncQueue *queue){
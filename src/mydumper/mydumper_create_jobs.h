@@ -32,6 +32,7 @@ enum job_type {
   JOB_DETERMINE_CHUNK_TYPE,
   JOB_TABLE,
   JOB_CHECKSUM,
+  JOB_ROW_COUNT,
   JOB_SCHEMA,
   JOB_VIEW,
   JOB_SEQUENCE,
@@ -54,6 +55,8 @@ struct dump_table_job{
   gchar *table;
   gchar *collation;
   gchar *engine;
+  guint64 data_length;
+  guint64 rows;
 };
 
 struct dump_database_job {
@@ -79,6 +82,8 @@ struct binlog_job {
 struct table_job_file{
   gchar *filename;
   int file;
+  // rows written since the file was opened, for --file-manifest
+  guint64 rows;
 };
 
 // directory / database . table . first number . second number . extension
@@ -104,6 +109,16 @@ struct table_job {
   int char_chunk_part;
   struct thread_data *td;
   guint64 num_rows_of_last_run;
+  // only used with --format PARQUET
+  struct parquet_writer *parquet;
+  // --data-index entries of the current rows file
+  GString *data_index;
+  guint64 data_index_offset;
+  gsize data_index_header_length;
+  // files used by the chunk that is being dumped, for its checksum
+  GList *checksum_files;
+  // where of the next chunk, its query is sent in advance with --prefetch-rows
+  GString *next_where;
 };
 
 #endif
@@ -125,10 +140,12 @@ void create_job_to_dump_table_schema(struct db_table *dbt);
 void create_job_to_dump_view(struct db_table *dbt);
 void create_job_to_dump_sequence(struct db_table *dbt);
 void create_job_to_dump_checksum(struct db_table * dbt);
+void create_job_to_count_rows(struct db_table * dbt);
 void create_job_to_dump_all_databases();
 void create_job_to_dump_database(struct database *database);
 void create_job_to_dump_schema(struct database* database);
 void create_job_to_dump_triggers(MYSQL *conn, struct db_table *dbt);
 void create_job_to_dump_schema_triggers(struct database *database);
-void create_job_to_dump_table(gboolean is_view, gboolean is_sequence, struct database *database, gchar *table, gchar *collation, gchar *engine);
+void create_job_to_dump_table(gboolean is_view, gboolean is_sequence, struct database *database, gchar *table, gchar *collation, gchar *engine, guint64 data_length, guint64 rows);
 void create_job_to_dump_table_list(gchar **table_list);
+void initialize_table_job_pool();
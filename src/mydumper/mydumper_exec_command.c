@@ -28,85 +28,163 @@
 #include "mydumper_start_dump.h"
 #include "mydumper_stream.h"
 #include "mydumper_file_handler.h"
-
-extern GAsyncQueue *stream_queue;
+#include "mydumper_upload.h"
+#include "mydumper_exec_command.h"
 
 GAsyncQueue *exec_queue;
 GThread **exec_command_thread = NULL;
 guint num_exec_threads = 4;
+guint exec_queue_size = 1024;
 gchar * global_bin = NULL;
-GHashTable* pid_file_table=NULL;
-GMutex *exec_mutex=NULL;
-void exec_this_command(gchar **c_arg,struct filename_queue_element * sqe){
+
+/* Pipeline of the closed files: the dump threads push the files and
+   only block when the files queued and not processed yet add up to more
+   than --exec-queue-size MB. Each file is handled by a pool thread, forking
+   the command or calling an in-process handler */
+static GMutex *exec_queued_mutex=NULL;
+static GCond *exec_queued_cond=NULL;
+static guint64 exec_queued_bytes=0;
+
+// timing of the handled files
+static struct metrics_histogram *exec_histogram=NULL;
+static guint exec_files=0;
+static gint64 exec_total_time=0;
+static gint64 exec_max_time=0;
+
+struct exec_handler{
+  const gchar *name;
+  gboolean (*handle)(gchar **c_arg, struct filename_queue_element *sqe);
+};
+
+static
+gboolean exec_this_command(gchar **c_arg, struct filename_queue_element *sqe){
   int childpid=vfork();
   if(!childpid){
     int fd=0;
     for (fd=3; fd<256; fd++) (void) close(fd);
     execv(global_bin,c_arg);
-  }else{
-    gchar *_key=NULL;
-    g_mutex_lock(exec_mutex);
-    _key=g_strdup_printf("%d",childpid);
-    g_hash_table_insert(pid_file_table,g_strdup(_key),sqe);
-    g_mutex_unlock(exec_mutex);
-    g_free(_key);
-    int wstatus;
-    int waitchildpid=wait(&wstatus);
-    // TODO: do we want to keep the file depending og the wstatus ??
-    if (no_delete == FALSE){
-      _key=g_strdup_printf("%d",waitchildpid);
-      g_mutex_lock(exec_mutex);
-      struct filename_queue_element *sqe2=g_hash_table_lookup(pid_file_table, g_strdup(_key));
-      g_mutex_unlock(exec_mutex);
-      if (sqe2!=NULL){
-        remove(sqe2->filename);
-        if (g_hash_table_contains(pid_file_table, _key))
-          g_hash_table_remove(pid_file_table, _key);
-        if (sqe2->done)
-          g_async_queue_push(sqe2->done, GINT_TO_POINTER(1));
-      }else{
-        g_error("pid not found: %s", _key);
-      }
-      g_free(_key);
+    _exit(127);
+  }
+  if (childpid < 0){
+    g_critical("Not able to fork %s: %s", global_bin, strerror(errno));
+    return FALSE;
+  }
+  int wstatus=0;
+  // other children, like the --exec-per-thread ones, are waited by their owners
+  while (waitpid(childpid, &wstatus, 0) < 0){
+    if (errno != EINTR){
+      g_critical("Not able to wait for %s: %s", global_bin, strerror(errno));
+      return FALSE;
     }
   }
+  if (!WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0){
+    g_warning("Command %s on %s ended with status %d", global_bin, sqe->filename, wstatus);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+static
+gboolean exec_upload(gchar **c_arg, struct filename_queue_element *sqe){
+  (void)c_arg;
+  return upload_file_in_process(sqe->filename);
+}
+
+// --exec values that are handled without forking
+static struct exec_handler builtin_exec_handlers[] = {
+  {"upload", &exec_upload},
+  {NULL, NULL}};
+
+static struct exec_handler *exec_handler=NULL;
+static struct exec_handler fork_exec_handler = {"fork", &exec_this_command};
+
+gboolean is_exec_command_builtin(const gchar *name){
+  return exec_handler && exec_handler != &fork_exec_handler && !g_strcmp0(exec_handler->name, name);
 }
 
+static
+void exec_queued_release(guint64 size){
+  g_mutex_lock(exec_queued_mutex);
+  exec_queued_bytes-= size;
+  g_cond_broadcast(exec_queued_cond);
+  g_mutex_unlock(exec_queued_mutex);
+}
 
 void exec_queue_push(struct db_table *dbt, gchar *filename){
-  GAsyncQueue *done = g_async_queue_new();
-  g_async_queue_push(exec_queue, new_filename_queue_element(dbt,filename,done));
-  g_async_queue_pop(done);
-  g_async_queue_unref(done);
+  GStatBuf st;
+  struct filename_queue_element *sqe=new_filename_queue_element(dbt,filename,NULL);
+  if (g_stat(filename, &st) == 0)
+    sqe->size=st.st_size;
+  gint64 start=0;
+  g_mutex_lock(exec_queued_mutex);
+  // a file bigger than the limit is queued alone
+  while (exec_queue_size > 0 && exec_queued_bytes > 0 && exec_queued_bytes + sqe->size > (guint64)exec_queue_size * 1024 * 1024){
+    if (!start)
+      start=g_get_monotonic_time();
+    g_cond_wait(exec_queued_cond, exec_queued_mutex);
+  }
+  exec_queued_bytes+= sqe->size;
+  g_mutex_unlock(exec_queued_mutex);
+  if (start)
+    queue_stats_producer_wait(exec_queue, g_get_monotonic_time() - start);
+  g_async_queue_push(exec_queue, sqe);
+}
+
+static
+void handle_exec_file(gchar **c_arg, struct filename_queue_element *sqe){
+  gint64 start=g_get_monotonic_time();
+  gboolean r=exec_handler->handle(c_arg, sqe);
+  gint64 elapsed=g_get_monotonic_time() - start;
+  if (exec_histogram)
+    metrics_observe(exec_histogram, elapsed);
+  g_mutex_lock(exec_queued_mutex);
+  exec_files++;
+  exec_total_time+=elapsed;
+  if (elapsed > exec_max_time)
+    exec_max_time=elapsed;
+  g_mutex_unlock(exec_queued_mutex);
+  trace("%s on %s took %.3f seconds", exec_handler->name, sqe->filename, (gdouble)elapsed / G_USEC_PER_SEC);
+  // the file is kept when the command failed
+  if (!r)
+    g_atomic_int_inc(&errors);
+  else if (no_delete == FALSE)
+    remove(sqe->filename);
+  exec_queued_release(sqe->size);
 }
 
 void *process_exec_command(void *data){
+  set_thread_affinity(AFFINITY_IO);
   (void)data;
   char * filename=NULL;
-  gchar *space=g_strstr_len(exec_command,-1," ");
-  gchar ** arguments=g_strsplit(space," ", 0);
-  gchar ** volatile c_arg=NULL;
+  gchar ** c_arg=NULL;
   guint i=0;
   GList *filename_pos=NULL;
   GList *iter;
-  c_arg=g_strdupv(arguments);
-  if (strlen(c_arg[g_strv_length(c_arg)-1])==0)
-    c_arg[g_strv_length(c_arg)-1]=NULL;
-  for(i=0; i<g_strv_length(c_arg); i++){
-    if (g_strcmp0(c_arg[i],"FILENAME") == 0){
-      int *c=g_new(int, 1);
-      *c=i;
-      filename_pos=g_list_prepend(filename_pos,c);
+  if (exec_handler == &fork_exec_handler){
+    gchar *space=g_strstr_len(exec_command,-1," ");
+    gchar ** arguments=g_strsplit(space ? space : " "," ", 0);
+    c_arg=g_strdupv(arguments);
+    g_strfreev(arguments);
+    if (g_strv_length(c_arg) > 0 && strlen(c_arg[g_strv_length(c_arg)-1])==0)
+      c_arg[g_strv_length(c_arg)-1]=NULL;
+    for(i=0; i<g_strv_length(c_arg); i++){
+      if (g_strcmp0(c_arg[i],"FILENAME") == 0){
+        int *c=g_new(int, 1);
+        *c=i;
+        filename_pos=g_list_prepend(filename_pos,c);
+      }
     }
-  }
 
-  if (!filename_pos)
-    g_warning("Common use case requires FILENAME on --exec.");
+    if (!filename_pos)
+      g_warning("Common use case requires FILENAME on --exec.");
+  }
 
   for(;;){
-    struct filename_queue_element * sqe=g_async_queue_pop(exec_queue);
+    struct filename_queue_element * sqe=m_async_queue_pop(exec_queue);
     filename=sqe->filename;
     if (strlen(filename) == 0){
+      g_free(filename);
+      g_free(sqe);
       break;
     }
     iter=filename_pos;
@@ -114,39 +192,55 @@ void *process_exec_command(void *data){
       c_arg[(*((guint *)(iter->data)))]=filename;
       iter=iter->next;
     }
-    exec_this_command(c_arg,sqe);
+    handle_exec_file(c_arg, sqe);
+    if (sqe->done)
+      g_async_queue_push(sqe->done, GINT_TO_POINTER(1));
+    g_free(filename);
+    g_free(sqe);
   }
+  g_list_free_full(filename_pos, g_free);
   return NULL;
 }
 
 void initialize_exec_command(){
   exec_queue = g_async_queue_new();
-  exec_mutex=g_mutex_new();
+  register_queue_stats("exec", exec_queue);
+  exec_queued_mutex=g_mutex_new();
+  exec_queued_cond=g_cond_new();
   exec_command_thread=g_new(GThread * , num_exec_threads) ;
-  gchar *space=g_strstr_len(exec_command,-1," ");
-  guint len = strlen(exec_command) - strlen(space);
-  while (len==0){
+  while (*exec_command == ' ')
     exec_command++;
-    space=g_strstr_len(exec_command,-1," ");
-    len = strlen(exec_command) - strlen(space);
-  }
-  global_bin=g_strndup(exec_command,len);
-  if (!g_file_test(global_bin, G_FILE_TEST_EXISTS)){
-    g_error("Command not found: %s", global_bin);
+  struct exec_handler *h;
+  for (h=builtin_exec_handlers; h->name; h++)
+    if (!g_strcmp0(exec_command, h->name))
+      exec_handler=h;
+  if (exec_handler){
+    g_message("Using the built-in %s handler on the closed files", exec_handler->name);
+  }else{
+    exec_handler=&fork_exec_handler;
+    gchar *space=g_strstr_len(exec_command,-1," ");
+    global_bin= space ? g_strndup(exec_command, space - exec_command) : g_strdup(exec_command);
+    if (!g_file_test(global_bin, G_FILE_TEST_EXISTS)){
+      g_error("Command not found: %s", global_bin);
+    }
   }
+  if (metrics_listen)
+    exec_histogram=new_metrics_histogram("mydumper_exec_command_seconds", "Time handling a closed file with --exec");
   guint i;
-  pid_file_table=g_hash_table_new_full ( g_str_hash, g_str_equal, &g_free, &g_free ); 
   for(i=0;i<num_exec_threads;i++){
-    exec_command_thread[i]=m_thread_new("exec_command", (GThreadFunc)process_exec_command, stream_queue, "Exec command thread could not be created");
+    exec_command_thread[i]=m_thread_new("exec_command", (GThreadFunc)process_exec_command, NULL, "Exec command thread could not be created");
   }
 }
 
 void wait_exec_command_to_finish(){
   guint i;
   for(i=0;i<num_exec_threads;i++){
-    g_async_queue_push(stream_queue, g_strdup(""));
+    g_async_queue_push(exec_queue, new_filename_queue_element(NULL, g_strdup(""), NULL));
   }
   for(i=0;i<num_exec_threads;i++){
     g_thread_join(exec_command_thread[i]);
   }
+  if (exec_files > 0)
+    g_message("Exec: %u files handled by %s, %.3f seconds on average and %.3f the slowest", exec_files, exec_handler->name,
+              (gdouble)exec_total_time / exec_files / G_USEC_PER_SEC, (gdouble)exec_max_time / G_USEC_PER_SEC);
 }
@@ -20,3 +20,4 @@ void load_exec_entries(GOptionGroup *main_group);
 void initialize_exec_command();
 void wait_exec_command_to_finish();
 void exec_queue_push(struct db_table *dbt, gchar *filename);
+gboolean is_exec_command_builtin(const gchar *name);
@@ -19,18 +19,34 @@
                     David Ducos, Percona (david dot ducos at percona dot com)
 */
 
+#define _GNU_SOURCE
 #include <gio/gio.h>
 #include <errno.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
 #include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <zlib.h>
 
+#include "../config.h"
+#ifdef WITH_ZSTD
+#include <zstd.h>
+#endif
 #include "mydumper_global.h"
 #include "mydumper_stream.h"
 #include "mydumper_exec_command.h"
+#include "mydumper_upload.h"
+#include "mydumper_database.h"
 #include "mydumper_file_handler.h"
+#include "mydumper_content_store.h"
+#include "mydumper_file_manifest.h"
+#include "mydumper_bundle.h"
+#include "mydumper_copy.h"
 
 // Shared variables
 int (*m_close)(guint thread_id, int file, gchar *filename, guint64 size, struct db_table * dbt) = NULL;
+ssize_t (*m_write)(int file, const void *buf, size_t count) = &write;
 
 // Static
 static GAsyncQueue *close_file_queue=NULL;
@@ -41,38 +57,306 @@ static GMutex *pipe_creation=NULL;
 static GThread * cft = NULL;
 static guint open_pipe=0;
 static gboolean is_pipe=FALSE;
+static gboolean in_process_compression=FALSE;
+static gboolean in_process_gzip=FALSE;
+// the compressor of each open file by its descriptor, set when it is opened
+// so the writes do not lock anything to find it
+static struct compressor **compressor_by_file=NULL;
+static guint compressor_by_file_size=0;
+static GAsyncQueue *available_compressors=NULL;
+gboolean seekable_zstd=FALSE;
+gchar *io_mode_str=NULL;
+static enum io_mode { IO_BUFFERED, IO_FADVISE, IO_DIRECT } io_mode=IO_BUFFERED;
+static GHashTable *output_file_hash=NULL;
+static GMutex *output_file_mutex=NULL;
+gboolean file_checksums=FALSE;
+static GHashTable *file_checksum_hash=NULL;
+static GMutex *file_checksum_mutex=NULL;
+// --async-writers
+guint num_async_writers=0;
+guint async_write_buffers=64;
+static GAsyncQueue **async_write_queues=NULL;
+static GAsyncQueue *free_async_writes=NULL;
+static GThread **async_writer_threads=NULL;
+// errno of the first failed write of each file, returned when it is closed
+static GHashTable *async_write_errors=NULL;
+static GMutex *async_write_errors_mutex=NULL;
+static ssize_t (*sync_m_write)(int file, const void *buf, size_t count) = NULL;
+static int (*sync_m_close)(guint thread_id, int file, gchar *filename, guint64 size, struct db_table * dbt) = NULL;
+// --io-mode fadvise and direct. The written pages are dropped from the page
+// cache, so a dump on the database host does not evict the pages of the server
+
+// fadvise drops the pages of a file once this amount has been written after them
+#define IO_FADVISE_BLOCK_SIZE 8388608
+// direct writes are done in blocks of this size, that is multiple of the alignment
+#define IO_DIRECT_BUFFER_SIZE 1048576
+#define IO_DIRECT_ALIGNMENT 4096
+
+struct output_file{
+  gboolean direct;
+  guint64 offset;
+  // writeback was started until flushed, pages before dropped are released
+  guint64 flushed;
+  guint64 dropped;
+  gchar *buffer;
+  gsize buffered;
+};
+
+static
+struct output_file *get_output_file(int file){
+  g_mutex_lock(output_file_mutex);
+  struct output_file *of=g_hash_table_lookup(output_file_hash, GINT_TO_POINTER(file));
+  g_mutex_unlock(output_file_mutex);
+  return of;
+}
+
+static
+void release_written_pages(struct output_file *of, int file){
+#ifdef __linux__
+  // writeback of the new block starts, the previous block is waited and dropped
+  sync_file_range(file, of->flushed, of->offset - of->flushed, SYNC_FILE_RANGE_WRITE);
+  if (of->flushed > of->dropped){
+    sync_file_range(file, of->dropped, of->flushed - of->dropped, SYNC_FILE_RANGE_WAIT_BEFORE|SYNC_FILE_RANGE_WRITE|SYNC_FILE_RANGE_WAIT_AFTER);
+    posix_fadvise(file, of->dropped, of->flushed - of->dropped, POSIX_FADV_DONTNEED);
+    of->dropped=of->flushed;
+  }
+#else
+  fdatasync(file);
+  posix_fadvise(file, of->dropped, of->offset - of->dropped, POSIX_FADV_DONTNEED);
+  of->dropped=of->offset;
+#endif
+  of->flushed=of->offset;
+}
+
+static
+gboolean write_file_fully(int file, const gchar *buf, size_t size){
+  size_t written = 0;
+  ssize_t r = 0;
+  while (written < size){
+    r=write(file, buf + written, size - written);
+    if (r < 0){
+      if (errno == EINTR)
+        continue;
+      return FALSE;
+    }
+    written += r;
+  }
+  return TRUE;
+}
+
+// Every write into a file of the dump, compressed or not, goes through here
+static
+ssize_t file_write(int file, const void *buf, size_t count){
+  struct output_file *of= output_file_hash ? get_output_file(file) : NULL;
+  if (of == NULL)
+    return write(file, buf, count);
+  if (!of->direct){
+    ssize_t r=write(file, buf, count);
+    if (r > 0){
+      of->offset+=r;
+      if (of->offset - of->flushed >= IO_FADVISE_BLOCK_SIZE)
+        release_written_pages(of, file);
+    }
+    return r;
+  }
+  // O_DIRECT needs aligned buffers, sizes and offsets
+  size_t copied=0, n;
+  while (copied < count){
+    n= IO_DIRECT_BUFFER_SIZE - of->buffered < count - copied ? IO_DIRECT_BUFFER_SIZE - of->buffered : count - copied;
+    memcpy(of->buffer + of->buffered, (const gchar *)buf + copied, n);
+    of->buffered+=n;
+    copied+=n;
+    if (of->buffered == IO_DIRECT_BUFFER_SIZE){
+      if (!write_file_fully(file, of->buffer, IO_DIRECT_BUFFER_SIZE))
+        return -1;
+      of->offset+=IO_DIRECT_BUFFER_SIZE;
+      of->buffered=0;
+    }
+  }
+  return count;
+}
+
+static
+void register_output_file(int file, gboolean direct){
+  struct output_file *of=g_new0(struct output_file, 1);
+  of->direct=direct;
+  if (direct && posix_memalign((void **)&(of->buffer), IO_DIRECT_ALIGNMENT, IO_DIRECT_BUFFER_SIZE))
+    m_critical("Could not allocate the buffer of --io-mode direct");
+  g_mutex_lock(output_file_mutex);
+  g_hash_table_insert(output_file_hash, GINT_TO_POINTER(file), of);
+  g_mutex_unlock(output_file_mutex);
+}
+
+// The tail of a direct file is not aligned, it is written without O_DIRECT
+static
+gboolean finish_output_file(int file){
+  struct output_file *of=get_output_file(file);
+  if (of == NULL)
+    return TRUE;
+  g_mutex_lock(output_file_mutex);
+  g_hash_table_remove(output_file_hash, GINT_TO_POINTER(file));
+  g_mutex_unlock(output_file_mutex);
+  gboolean ok=TRUE;
+  if (of->direct){
+    if (of->buffered > 0){
+      ok= fcntl(file, F_SETFL, fcntl(file, F_GETFL) & ~O_DIRECT) == 0 && write_file_fully(file, of->buffer, of->buffered);
+      fdatasync(file);
+      posix_fadvise(file, of->offset, of->buffered, POSIX_FADV_DONTNEED);
+    }
+    free(of->buffer);
+  }else{
+    fdatasync(file);
+    posix_fadvise(file, 0, 0, POSIX_FADV_DONTNEED);
+  }
+  g_free(of);
+  return ok;
+}
+
+/* --file-checksums: crc32 of the content of every file, as it is written, and
+   of the bytes that are on disk when they are compressed in-process. They
+   are written on the metadata, with the files of the table */
+struct file_checksum{
+  guint32 content;
+  guint32 stored;
+};
+
+static
+struct file_checksum *get_file_checksum(int file){
+  struct file_checksum *fc=g_hash_table_lookup(file_checksum_hash, GINT_TO_POINTER(file));
+  if (fc == NULL){
+    fc=g_new0(struct file_checksum, 1);
+    g_hash_table_insert(file_checksum_hash, GINT_TO_POINTER(file), fc);
+  }
+  return fc;
+}
+
+void update_file_checksum(int file, const void *buf, size_t count){
+  if (file_checksum_hash == NULL)
+    return;
+  g_mutex_lock(file_checksum_mutex);
+  struct file_checksum *fc=get_file_checksum(file);
+  fc->content=crc32(fc->content, buf, (uInt)count);
+  g_mutex_unlock(file_checksum_mutex);
+}
+
+static
+void update_stored_checksum(int file, const void *buf, size_t count){
+  if (file_checksum_hash == NULL)
+    return;
+  g_mutex_lock(file_checksum_mutex);
+  struct file_checksum *fc=get_file_checksum(file);
+  fc->stored=crc32(fc->stored, buf, (uInt)count);
+  g_mutex_unlock(file_checksum_mutex);
+}
+
+// filename is the name on disk, with the compression extension
+static
+void record_file_checksum(int file, const gchar *filename, struct db_table *dbt){
+  if (file_checksum_hash == NULL)
+    return;
+  g_mutex_lock(file_checksum_mutex);
+  struct file_checksum *fc=g_hash_table_lookup(file_checksum_hash, GINT_TO_POINTER(file));
+  g_hash_table_steal(file_checksum_hash, GINT_TO_POINTER(file));
+  g_mutex_unlock(file_checksum_mutex);
+  if (dbt == NULL || filename == NULL){
+    g_free(fc);
+    return;
+  }
+  guint32 content= fc ? fc->content : 0;
+  gchar *value;
+  // the external compressor of --exec-per-thread writes the file
+  if (in_process_compression)
+    value=g_strdup_printf("%08x;%08x", content, fc ? fc->stored : 0);
+  else if (!is_pipe)
+    value=g_strdup_printf("%08x;%08x", content, content);
+  else
+    value=g_strdup_printf("%08x;", content);
+  g_mutex_lock(dbt->chunks_mutex);
+  if (dbt->file_checksums == NULL)
+    dbt->file_checksums=g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  g_hash_table_replace(dbt->file_checksums, g_path_get_basename(filename), value);
+  g_mutex_unlock(dbt->chunks_mutex);
+  g_free(fc);
+}
+
 // FILE open/close without pipe
 int m_open_file(char **filename, const char *type ){
   (void) type;
-  int fd=open(*filename, O_CREAT|O_WRONLY|O_TRUNC, 0660 );
+  int fd=-1;
+  if (io_mode == IO_DIRECT){
+    fd=open(*filename, O_CREAT|O_WRONLY|O_TRUNC|O_DIRECT, 0660 );
+    // not every filesystem supports it, the file is written with fadvise
+    if (fd >= 0)
+      register_output_file(fd, TRUE);
+  }
+  if (fd < 0){
+    fd=open(*filename, O_CREAT|O_WRONLY|O_TRUNC, 0660 );
+    if (fd >= 0 && io_mode != IO_BUFFERED)
+      register_output_file(fd, FALSE);
+  }
   if (fd<0)
     m_critical("Couldn't open file(%s): %s", *filename, strerror(errno));
   return fd;
 }
 
+// The file is complete on disk, it is sent where it has to go
+static
+int file_closed(guint thread_id, gchar *filename, guint64 size, struct db_table * dbt, int r){
+  gint64 span=span_start();
+  if (size > 0){
+    file_manifest_add(filename, dbt);
+    if (content_store){
+      gchar *blob=content_store_file(filename);
+      if (blob && exec_command) exec_queue_push(dbt, blob);
+      else if (blob && upload_url) upload_queue_push(dbt, blob);
+      else g_free(blob);
+    }else if (bundle_file(filename, dbt)){
+      // read by myloader from the bundle
+    }else if (exec_command) exec_queue_push(dbt, g_strdup(filename));
+    else if (upload_url) upload_queue_push(dbt, g_strdup(filename));
+    else if (stream) stream_queue_push(dbt, g_strdup(filename));
+    span_end("m_close_file", span, dbt ? dbt->database->source_database : NULL, dbt ? dbt->table : NULL, -1, filename);
+  }else if (!build_empty_files){
+    if (filename){
+      if (remove(filename)) {
+        g_warning("Thread %d: Failed to remove empty file : %s", thread_id, filename);
+      }else{
+        g_debug("Thread %d: File removed: %s", thread_id, filename);
+      }
+    }
+    return r;
+  }
+  return 0;
+}
+
 int m_close_file(guint thread_id, int file, gchar *filename, guint64 size, struct db_table * dbt){
   if (file >= 0){
     trace("Closing file(%d): %s", file, filename);
-    int r=close(file);
-    if (size > 0){
-      if (exec_command)  exec_queue_push(dbt, g_strdup(filename));
-      else if (stream) stream_queue_push(dbt, g_strdup(filename));
-    }else if (!build_empty_files){
-      if (filename){
-        if (remove(filename)) {
-          g_warning("Thread %d: Failed to remove empty file : %s", thread_id, filename);
-        }else{
-          g_debug("Thread %d: File removed: %s", thread_id, filename);
-        }
-      }
-      return r;
+    if (output_file_hash && !finish_output_file(file)){
+      g_critical("Thread %d: Failed to write on %s (%d)", thread_id, filename, errno);
+      errors++;
     }
+    if (size > 0 || build_empty_files)
+      record_file_checksum(file, filename, dbt);
+    else
+      record_file_checksum(file, NULL, NULL);
+    return file_closed(thread_id, filename, size, dbt, close(file));
   }else{
     m_critical("Trying to close %s with fd: %d", filename, file); 
   }
   return 0;
 }
 
+/* --into-outfile renames the files written by the server into the backup,
+   when the file handler would write them as they are */
+gboolean m_open_writes_plain_files(){
+  return !in_process_compression && !is_pipe && !file_checksums;
+}
+
+void m_close_server_file(guint thread_id, gchar *filename, struct db_table * dbt){
+  file_closed(thread_id, filename, 1, dbt, 0);
+}
+
 // PIPE related functions 
 
 void close_file_queue_push(struct fifo *f){
@@ -114,6 +398,7 @@ int execute_file_per_thread( int p_in[2], int out){
     close(out);
     int fd=3;
     for (fd=3; fd<256; fd++) (void) close(fd);
+    set_compress_affinity();
     execv(exec_per_thread_cmd[0],exec_per_thread_cmd);
   }
   return childpid;
@@ -171,6 +456,10 @@ int m_close_pipe(guint thread_id, int file, gchar *filename, guint64 size, struc
   struct fifo *f=g_hash_table_lookup(fifo_hash,filename);
   g_mutex_unlock(fifo_table_mutex);
   if (f){
+    if (size > 0 || build_empty_files)
+      record_file_checksum(file, f->stdout_filename, dbt);
+    else
+      record_file_checksum(file, NULL, NULL);
     f->size=size;
     f->dbt=dbt;
     close_file_queue_push(f);
@@ -185,7 +474,15 @@ int m_close_pipe(guint thread_id, int file, gchar *filename, guint64 size, struc
 
 void final_step_close_file(guint thread_id, gchar *filename, struct fifo *f, float size, struct db_table * dbt) {
   if (size > 0){
-    if (stream) stream_queue_push(dbt,g_strdup(f->stdout_filename));
+    file_manifest_add(f->stdout_filename, dbt);
+    if (content_store){
+      gchar *blob=content_store_file(f->stdout_filename);
+      if (blob && exec_command) exec_queue_push(dbt, blob);
+      else if (blob && upload_url) upload_queue_push(dbt, blob);
+      else g_free(blob);
+    }else if (exec_command) exec_queue_push(dbt,g_strdup(f->stdout_filename));
+    else if (upload_url) upload_queue_push(dbt,g_strdup(f->stdout_filename));
+    else if (stream) stream_queue_push(dbt,g_strdup(f->stdout_filename));
   }else if (!build_empty_files){
     if (remove(f->stdout_filename)) {
       g_warning("Thread %d: Failed to remove empty file : %s", thread_id, f->stdout_filename);
@@ -196,10 +493,11 @@ void final_step_close_file(guint thread_id, gchar *filename, struct fifo *f, flo
 }
 
 void * close_file_thread(void *data){
+  set_thread_affinity(AFFINITY_IO);
   (void)data;
   struct fifo *f=NULL;
   for (;;){
-    f=g_async_queue_pop(close_file_queue);
+    f=m_async_queue_pop(close_file_queue);
     if (f->gpid == -10)
       break;
     g_mutex_lock(pipe_creation);
@@ -221,6 +519,403 @@ void * close_file_thread(void *data){
   return NULL;
 }
 
+// In-process compression. Each open file has its own compressor, that is
+// taken from available_compressors and returned on close, so the zlib/zstd
+// state is allocated once per thread and reused for every file.
+
+#define COMPRESS_OUT_BUFFER_SIZE 131072
+// size of compressor_by_file when there is no limit of open files
+#define COMPRESSED_FILES_MAX 1048576
+// --seekable-zstd ends a frame on the first statement end after this size
+#define SEEKABLE_FRAME_SIZE 4194304
+
+static
+struct compressor * new_compressor(){
+  struct compressor *c=g_new0(struct compressor, 1);
+  c->out=g_new(guchar, COMPRESS_OUT_BUFFER_SIZE);
+  if (in_process_gzip){
+    // 15+16 makes zlib write the gzip header and trailer
+    if (deflateInit2(&(c->zstream), Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+      m_critical("Could not initialize gzip compression");
+#ifdef WITH_ZSTD
+  }else{
+    c->zstd_cctx=ZSTD_createCCtx();
+    if (!c->zstd_cctx)
+      m_critical("Could not initialize zstd compression");
+#endif
+  }
+  if (seekable_zstd)
+    c->seek_table=g_array_new(FALSE, FALSE, sizeof(guint32) * 2);
+  return c;
+}
+
+static
+gboolean write_compressed_output(struct compressor *c, int file, size_t size){
+  size_t written = 0;
+  ssize_t r = 0;
+  while (written < size){
+    r=file_write(file, c->out + written, size - written);
+    if (r > 0)
+      update_stored_checksum(file, c->out + written, r);
+    if (r < 0){
+      if (errno == EINTR)
+        continue;
+      return FALSE;
+    }
+    written += r;
+  }
+  c->frame_out+=size;
+  return TRUE;
+}
+
+// Compresses count bytes of buf, or finishes the stream when finish is TRUE
+static
+gboolean compress_into_file(struct compressor *c, int file, const void *buf, size_t count, gboolean finish){
+  if (in_process_gzip){
+    int ret;
+    c->zstream.next_in=(Bytef *)buf;
+    c->zstream.avail_in=count;
+    do {
+      c->zstream.next_out=c->out;
+      c->zstream.avail_out=COMPRESS_OUT_BUFFER_SIZE;
+      ret=deflate(&(c->zstream), finish ? Z_FINISH : Z_NO_FLUSH);
+      if (ret == Z_STREAM_ERROR)
+        return FALSE;
+      if (!write_compressed_output(c, file, COMPRESS_OUT_BUFFER_SIZE - c->zstream.avail_out))
+        return FALSE;
+    } while (c->zstream.avail_out == 0 || (finish && ret != Z_STREAM_END));
+    return TRUE;
+  }
+#ifdef WITH_ZSTD
+  ZSTD_inBuffer input = { buf, count, 0 };
+  gboolean done=FALSE;
+  while (!done){
+    ZSTD_outBuffer output = { c->out, COMPRESS_OUT_BUFFER_SIZE, 0 };
+    size_t remaining=ZSTD_compressStream2(c->zstd_cctx, &output, &input, finish ? ZSTD_e_end : ZSTD_e_continue);
+    if (ZSTD_isError(remaining))
+      return FALSE;
+    if (!write_compressed_output(c, file, output.pos))
+      return FALSE;
+    done = finish ? remaining == 0 : input.pos == input.size;
+  }
+  return TRUE;
+#else
+  return FALSE;
+#endif
+}
+
+#ifdef WITH_ZSTD
+static
+void end_seekable_frame(struct compressor *c){
+  guint32 entry[2]={ (guint32)c->frame_out, (guint32)c->frame_in };
+  g_array_append_val(c->seek_table, entry);
+  c->frame_in=0;
+  c->frame_out=0;
+}
+
+static
+void put_le32(guchar *buf, guint32 value){
+  buf[0]=value & 0xff;
+  buf[1]=(value >> 8) & 0xff;
+  buf[2]=(value >> 16) & 0xff;
+  buf[3]=(value >> 24) & 0xff;
+}
+
+/* The seek table goes on a skippable frame, so the file can still be
+   decompressed by any zstd reader */
+static
+gboolean write_seek_table(struct compressor *c, int file){
+  guint i, n=c->seek_table->len;
+  gsize size=8 + n * 8 + SEEKABLE_FOOTER_SIZE;
+  guchar *buf=g_malloc(size), *p=buf;
+  put_le32(p, SEEKABLE_SKIPPABLE_MAGIC);
+  put_le32(p + 4, size - 8);
+  p+=8;
+  for (i = 0; i < n; i++, p+=8){
+    put_le32(p, g_array_index(c->seek_table, guint32, 2 * i));
+    put_le32(p + 4, g_array_index(c->seek_table, guint32, 2 * i + 1));
+  }
+  put_le32(p, n);
+  // no checksums
+  p[4]=0;
+  put_le32(p + 5, SEEKABLE_MAGIC);
+  size_t written=0;
+  ssize_t r;
+  while (written < size){
+    r=file_write(file, buf + written, size - written);
+    if (r > 0)
+      update_stored_checksum(file, buf + written, r);
+    if (r < 0){
+      if (errno == EINTR)
+        continue;
+      g_free(buf);
+      return FALSE;
+    }
+    written+=r;
+  }
+  g_free(buf);
+  g_array_set_size(c->seek_table, 0);
+  return TRUE;
+}
+#endif
+
+static
+struct compressor * get_compressor(int file){
+  if (file < 0 || (guint)file >= compressor_by_file_size)
+    return NULL;
+  return g_atomic_pointer_get(&(compressor_by_file[file]));
+}
+
+int m_open_compressed_file(char **filename, const char *type){
+  gchar *new_filename = g_strdup_printf("%s%s", *filename, exec_per_thread_extension);
+  int fd=m_open_file(&new_filename, type);
+  if (fd < 0){
+    g_free(new_filename);
+    return fd;
+  }
+  if ((guint)fd >= compressor_by_file_size){
+    g_critical("Couldn't compress file(%s): descriptor %d is over the limit of open files", new_filename, fd);
+    errors++;
+    close(fd);
+    g_free(new_filename);
+    return -1;
+  }
+  struct compressor *c=g_async_queue_try_pop(available_compressors);
+  if (!c)
+    c=new_compressor();
+  c->filename=new_filename;
+  g_atomic_pointer_set(&(compressor_by_file[fd]), c);
+  return fd;
+}
+
+ssize_t m_write_compressed(int file, const void *buf, size_t count){
+  struct compressor *c=get_compressor(file);
+  if (!c){
+    errno=EBADF;
+    return -1;
+  }
+#ifdef WITH_ZSTD
+  if (c->seek_table){
+    // a write that ends with a statement can end the frame, statements are
+    // not split between frames, so every frame can be restored on its own
+    c->frame_in+=count;
+    gboolean end_frame= c->frame_in >= SEEKABLE_FRAME_SIZE && count >= 2 && !memcmp((const gchar *)buf + count - 2, ";\n", 2);
+    if (!compress_into_file(c, file, buf, count, end_frame))
+      return -1;
+    if (end_frame)
+      end_seekable_frame(c);
+    return count;
+  }
+#endif
+  if (!compress_into_file(c, file, buf, count, FALSE))
+    return -1;
+  return count;
+}
+
+int m_close_compressed_file(guint thread_id, int file, gchar *filename, guint64 size, struct db_table * dbt){
+  (void) filename;
+  struct compressor *c=get_compressor(file);
+  if (!c){
+    g_warning("Compressed file %s not found", filename);
+    return m_close_file(thread_id, file, filename, size, dbt);
+  }
+  g_atomic_pointer_set(&(compressor_by_file[file]), NULL);
+#ifdef WITH_ZSTD
+  if (c->seek_table){
+    // the last frame might have been ended by the last statement
+    if (c->frame_in > 0 || c->seek_table->len == 0){
+      if (!compress_into_file(c, file, NULL, 0, TRUE)){
+        g_critical("Thread %d: Failed to finish compression of %s (%d)", thread_id, c->filename, errno);
+        errors++;
+      }
+      end_seekable_frame(c);
+    }
+    if (!write_seek_table(c, file)){
+      g_critical("Thread %d: Failed to write the seek table of %s (%d)", thread_id, c->filename, errno);
+      errors++;
+    }
+  }else
+#endif
+  if (!compress_into_file(c, file, NULL, 0, TRUE)){
+    g_critical("Thread %d: Failed to finish compression of %s (%d)", thread_id, c->filename, errno);
+    errors++;
+  }
+  if (in_process_gzip)
+    deflateReset(&(c->zstream));
+#ifdef WITH_ZSTD
+  else
+    ZSTD_CCtx_reset(c->zstd_cctx, ZSTD_reset_session_only);
+#endif
+  int r=m_close_file(thread_id, file, c->filename, size, dbt);
+  g_free(c->filename);
+  c->filename=NULL;
+  g_async_queue_push(available_compressors, c);
+  return r;
+}
+
+void set_in_process_compression(const gchar *method){
+  in_process_compression=TRUE;
+  in_process_gzip=!g_ascii_strcasecmp(method, GZIP);
+}
+
+gboolean is_in_process_compression_available(const gchar *method){
+#ifdef WITH_ZSTD
+  if (!g_ascii_strcasecmp(method, ZSTD))
+    return TRUE;
+#endif
+  return !g_ascii_strcasecmp(method, GZIP);
+}
+
+// Async writers: the dump threads copy the data into one of the
+// async_write_buffers and continue fetching rows, the writes of a file are
+// always done by the same writer thread, so they remain in order.
+// A job without data is a flush request, every file is flushed before it is
+// closed, so the writers are idle once the files are closed. A job without
+// done either ends the writer
+struct async_write{
+  int file;
+  GString *data;
+  GAsyncQueue *done;
+};
+
+static
+void *async_writer_thread(GAsyncQueue *queue){
+  set_thread_affinity(AFFINITY_IO);
+  struct async_write *aw=NULL;
+  size_t written;
+  ssize_t r;
+  gboolean failed;
+  for(;;){
+    aw=m_async_queue_pop(queue);
+    if (aw->data == NULL){
+      if (aw->done == NULL)
+        break;
+      g_async_queue_push(aw->done, GINT_TO_POINTER(1));
+      continue;
+    }
+    // the rest of a file is not written after a failed write
+    g_mutex_lock(async_write_errors_mutex);
+    failed=g_hash_table_contains(async_write_errors, GINT_TO_POINTER(aw->file));
+    g_mutex_unlock(async_write_errors_mutex);
+    written=0;
+    while (!failed && written < aw->data->len){
+      r=sync_m_write(aw->file, aw->data->str + written, aw->data->len - written);
+      if (r <= 0){
+        g_critical("Couldn't write data to a file(%d): %s", aw->file, strerror(errno));
+        errors++;
+        g_mutex_lock(async_write_errors_mutex);
+        g_hash_table_insert(async_write_errors, GINT_TO_POINTER(aw->file), GINT_TO_POINTER(r < 0 && errno ? errno : EIO));
+        g_mutex_unlock(async_write_errors_mutex);
+        break;
+      }
+      written+=r;
+    }
+    g_async_queue_push(free_async_writes, aw);
+  }
+  return NULL;
+}
+
+static
+ssize_t m_write_async(int file, const void *buf, size_t count){
+  struct async_write *aw=m_async_queue_pop(free_async_writes);
+  aw->file=file;
+  g_string_set_size(aw->data, 0);
+  g_string_append_len(aw->data, buf, count);
+  g_async_queue_push(async_write_queues[file % num_async_writers], aw);
+  return count;
+}
+
+// Returns the errno of the first failed write of the file, 0 when all were written
+static
+int async_write_flush(int file){
+  struct async_write flush={file, NULL, g_async_queue_new()};
+  g_async_queue_push(async_write_queues[file % num_async_writers], &flush);
+  g_async_queue_pop(flush.done);
+  g_async_queue_unref(flush.done);
+  g_mutex_lock(async_write_errors_mutex);
+  int error=GPOINTER_TO_INT(g_hash_table_lookup(async_write_errors, GINT_TO_POINTER(file)));
+  g_hash_table_remove(async_write_errors, GINT_TO_POINTER(file));
+  g_mutex_unlock(async_write_errors_mutex);
+  return error;
+}
+
+/* A file with a failed write is closed as an empty file, so it is not added
+   to the manifest, streamed, uploaded or executed, and it is removed */
+static
+int m_close_async(guint thread_id, int file, gchar *filename, guint64 size, struct db_table * dbt){
+  if (file < 0)
+    return sync_m_close(thread_id, file, filename, size, dbt);
+  int error=async_write_flush(file);
+  if (error == 0)
+    return sync_m_close(thread_id, file, filename, size, dbt);
+  g_critical("Thread %d: %s is incomplete, it is discarded: %s", thread_id, filename, strerror(error));
+  sync_m_close(thread_id, file, filename, 0, NULL);
+  if (build_empty_files && filename)
+    remove(filename);
+  errno=error;
+  return -1;
+}
+
+static
+void initialize_async_writers(){
+  guint i;
+  sync_m_write=m_write;
+  sync_m_close=m_close;
+  m_write=&m_write_async;
+  m_close=&m_close_async;
+  if (async_write_buffers < num_async_writers)
+    async_write_buffers=num_async_writers;
+  free_async_writes=g_async_queue_new();
+  for (i=0; i<async_write_buffers; i++){
+    struct async_write *aw=g_new0(struct async_write, 1);
+    aw->data=g_string_sized_new(statement_size);
+    g_async_queue_push(free_async_writes, aw);
+  }
+  register_queue_stats("free_async_writes", free_async_writes);
+  async_write_errors=g_hash_table_new(g_direct_hash, g_direct_equal);
+  async_write_errors_mutex=g_mutex_new();
+  async_write_queues=g_new(GAsyncQueue *, num_async_writers);
+  async_writer_threads=g_new(GThread *, num_async_writers);
+  for (i=0; i<num_async_writers; i++){
+    async_write_queues[i]=g_async_queue_new();
+    async_writer_threads[i]=m_thread_new("async_writer", (GThreadFunc)async_writer_thread, async_write_queues[i], "Async writer thread could not be created");
+  }
+}
+
+// The files are closed, the writers are idle. They are ended and the
+// synchronous functions are restored for the next dump of --daemon
+static
+void finish_async_writers(){
+  guint i;
+  struct async_write end={-1, NULL, NULL};
+  for (i=0; i<num_async_writers; i++)
+    g_async_queue_push(async_write_queues[i], &end);
+  for (i=0; i<num_async_writers; i++){
+    g_thread_join(async_writer_threads[i]);
+    g_async_queue_unref(async_write_queues[i]);
+  }
+  g_free(async_writer_threads);
+  async_writer_threads=NULL;
+  g_free(async_write_queues);
+  async_write_queues=NULL;
+  unregister_queue_stats(free_async_writes);
+  struct async_write *aw=NULL;
+  while ((aw=g_async_queue_try_pop(free_async_writes)) != NULL){
+    g_string_free(aw->data, TRUE);
+    g_free(aw);
+  }
+  g_async_queue_unref(free_async_writes);
+  free_async_writes=NULL;
+  g_hash_table_destroy(async_write_errors);
+  async_write_errors=NULL;
+  g_mutex_free(async_write_errors_mutex);
+  async_write_errors_mutex=NULL;
+  if (m_write == &m_write_async)
+    m_write=sync_m_write;
+  if (m_close == &m_close_async)
+    m_close=sync_m_close;
+}
+
 void wait_close_files(){
   if (is_pipe){
     struct fifo f;
@@ -230,6 +925,8 @@ void wait_close_files(){
     close_file_queue_push(&f);
     g_thread_join(cft);
   }
+  if (async_writer_threads)
+    finish_async_writers();
 }
 
 void set_pipe_backup(){
@@ -237,14 +934,55 @@ void set_pipe_backup(){
 }
 
 void initialize_file_handler(){
-  if (!is_pipe){
+  if (io_mode_str){
+    if (!g_ascii_strcasecmp(io_mode_str, "fadvise"))
+      io_mode=IO_FADVISE;
+    else if (!g_ascii_strcasecmp(io_mode_str, "direct"))
+      io_mode=IO_DIRECT;
+    else if (g_ascii_strcasecmp(io_mode_str, "buffered"))
+      m_critical("--io-mode must be buffered, fadvise or direct");
+  }
+  // the pipes of --exec-per-thread are not files
+  if (io_mode != IO_BUFFERED && is_pipe && !in_process_compression){
+    g_warning("--io-mode is not used with --exec-per-thread");
+    io_mode=IO_BUFFERED;
+  }
+  if (file_checksums){
+    file_checksum_hash=g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+    file_checksum_mutex=g_mutex_new();
+  }
+  if (io_mode != IO_BUFFERED){
+    output_file_hash=g_hash_table_new(g_direct_hash, g_direct_equal);
+    output_file_mutex=g_mutex_new();
+  }
+  // frames can only be ended by the in-process compressor
+  if (seekable_zstd && (!in_process_compression || in_process_gzip)){
+    g_warning("--seekable-zstd needs in-process zstd compression, disabling it");
+    seekable_zstd=FALSE;
+  }
+  if (in_process_compression){
+    m_open  = &m_open_compressed_file;
+    m_close = &m_close_compressed_file;
+    m_write = &m_write_compressed;
+    // descriptors are always below the limit of open files
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) || limit.rlim_cur == RLIM_INFINITY || limit.rlim_cur > COMPRESSED_FILES_MAX)
+      compressor_by_file_size=COMPRESSED_FILES_MAX;
+    else
+      compressor_by_file_size=limit.rlim_cur;
+    compressor_by_file=g_new0(struct compressor *, compressor_by_file_size);
+    available_compressors=g_async_queue_new();
+  }else if (!is_pipe){
     m_open  = &m_open_file;
     m_close = &m_close_file;
+    if (io_mode != IO_BUFFERED)
+      m_write = &file_write;
   }else{
     m_open  = &m_open_pipe;
     m_close = &m_close_pipe;
     available_pids = g_async_queue_new();
     close_file_queue=g_async_queue_new();
+    register_queue_stats("close_file", close_file_queue);
     guint i=0;
     for (i=0; i < (num_threads * 2); i++){
       release_pid();
@@ -255,6 +993,9 @@ void initialize_file_handler(){
 
     cft=m_thread_new("close_file", (GThreadFunc)close_file_thread, NULL, "Close file thread could not be created");
   }
+  if (num_async_writers > 0)
+    initialize_async_writers();
+  initialize_copy();
 }
 
 struct filename_queue_element * new_filename_queue_element(struct db_table *dbt,gchar *filename,GAsyncQueue *done){
@@ -20,12 +20,15 @@
 */
 #include <stdio.h>
 #include <stdlib.h>
+#include <zlib.h>
 
 
 struct filename_queue_element{
   struct db_table *dbt;
   gchar *filename;
   GAsyncQueue *done;
+  // file size, to bound the bytes queued on --exec
+  guint64 size;
 };
 
 
@@ -43,7 +46,20 @@ struct fifo{
   int error_number;
 };
 
+struct compressor{
+  gchar *filename;
+  z_stream zstream;
+  void *zstd_cctx;
+  guchar *out;
+  // --seekable-zstd, sizes of the frame in progress and of the ended ones
+  guint64 frame_in;
+  guint64 frame_out;
+  GArray *seek_table;
+};
+
 void set_pipe_backup();
+void set_in_process_compression(const gchar *method);
+gboolean is_in_process_compression_available(const gchar *method);
 void initialize_file_handler();
 int m_open_pipe(char **filename, const char *type);
 void release_pid();
@@ -0,0 +1,143 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#include <errno.h>
+#include <string.h>
+#include <glib/gstdio.h>
+
+#include "mydumper.h"
+#include "mydumper_global.h"
+#include "mydumper_arguments.h"
+#include "mydumper_file_manifest.h"
+#include "mydumper_binlog_delta.h"
+
+/* --file-manifest: one line per file of the backup with
+ * "type<TAB>database<TAB>table<TAB>part<TAB>sub_part<TAB>size<TAB>rows<TAB>filename",
+ * so myloader does not need to list the directory, classify each name and
+ * stat every data file */
+gboolean file_manifest=FALSE;
+static FILE *file_manifest_file=NULL;
+static GMutex *file_manifest_mutex=NULL;
+// basename without compression extension -> struct data_file_info
+static GHashTable *data_file_info=NULL;
+
+struct data_file_info {
+  guint part;
+  guint sub_part;
+  guint64 rows;
+};
+
+void initialize_file_manifest(){
+  if (!file_manifest)
+    return;
+  if (file_manifest_mutex == NULL)
+    file_manifest_mutex=g_mutex_new();
+  data_file_info=g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  gchar *filename=g_build_filename(dump_directory, FILE_MANIFEST, NULL);
+  file_manifest_file=g_fopen(filename, "w");
+  if (!file_manifest_file)
+    m_critical("Couldn't create file manifest %s (%s)", filename, strerror(errno));
+  g_free(filename);
+}
+
+void finalize_file_manifest(){
+  if (!file_manifest)
+    return;
+  fclose(file_manifest_file);
+  file_manifest_file=NULL;
+  g_hash_table_destroy(data_file_info);
+  data_file_info=NULL;
+}
+
+static
+gchar *file_manifest_key(const gchar *filename){
+  gchar *key=g_path_get_basename(filename);
+  if (strlen(exec_per_thread_extension) && g_str_has_suffix(key, exec_per_thread_extension))
+    key[strlen(key) - strlen(exec_per_thread_extension)]='\0';
+  return key;
+}
+
+// same names that myloader expects
+static
+const gchar *file_manifest_type(const gchar *key){
+  if (g_str_has_prefix(key, BINLOG_DELTA_FILENAME))
+    return "binlog-delta";
+  if (g_str_has_suffix(key, "-schema-create.sql"))
+    return "schema-create";
+  if (g_str_has_suffix(key, "-schema-view.sql"))
+    return "schema-view";
+  if (g_str_has_suffix(key, "-schema-sequence.sql"))
+    return "schema-sequence";
+  if (g_str_has_suffix(key, "-schema-triggers.sql"))
+    return "schema-triggers";
+  if (g_str_has_suffix(key, "-schema-post.sql"))
+    return "schema-post";
+  if (g_str_has_suffix(key, "-schema.sql"))
+    return "schema";
+  if (g_str_has_suffix(key, ".sql.idx"))
+    return "data-index";
+  if (g_str_has_suffix(key, "." SQL))
+    return "data";
+  if (g_str_has_suffix(key, ".dat"))
+    return "load-data";
+  if (g_str_has_suffix(key, "." ROW_BINARY_EXTENSION))
+    return "binary-data";
+  if (g_str_has_suffix(key, ".ibd"))
+    return "tablespace";
+  if (g_str_has_suffix(key, ".cfg"))
+    return "tablespace-cfg";
+  return "other";
+}
+
+// Called before the data file is closed
+void file_manifest_set_rows(const gchar *filename, guint part, guint sub_part, guint64 rows){
+  if (!file_manifest || filename == NULL)
+    return;
+  struct data_file_info *dfi=g_new(struct data_file_info, 1);
+  dfi->part=part;
+  dfi->sub_part=sub_part;
+  dfi->rows=rows;
+  gchar *key=file_manifest_key(filename);
+  g_mutex_lock(file_manifest_mutex);
+  g_hash_table_replace(data_file_info, key, dfi);
+  g_mutex_unlock(file_manifest_mutex);
+}
+
+// Called once the file is complete on disk
+void file_manifest_add(const gchar *filename, struct db_table *dbt){
+  if (!file_manifest || file_manifest_file == NULL)
+    return;
+  GStatBuf st;
+  guint64 size= g_stat(filename, &st) == 0 ? (guint64)st.st_size : 0;
+  gchar *basename=g_path_get_basename(filename);
+  gchar *key=file_manifest_key(filename);
+  g_mutex_lock(file_manifest_mutex);
+  struct data_file_info *dfi=g_hash_table_lookup(data_file_info, key);
+  fprintf(file_manifest_file, "%s\t%s\t%s\t%u\t%u\t%"G_GUINT64_FORMAT"\t%"G_GUINT64_FORMAT"\t%s\n",
+      file_manifest_type(key),
+      dbt ? dbt->database->database_name_in_filename : "",
+      dbt ? dbt->table_filename : "",
+      dfi ? dfi->part : 0, dfi ? dfi->sub_part : 0,
+      size, dfi ? dfi->rows : 0, basename);
+  // a consumer reads the manifest while the dump is running
+  fflush(file_manifest_file);
+  if (dfi)
+    g_hash_table_remove(data_file_info, key);
+  g_mutex_unlock(file_manifest_mutex);
+  g_free(key);
+  g_free(basename);
+}
@@ -0,0 +1,31 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#ifndef _src_mydumper_file_manifest_h
+#define _src_mydumper_file_manifest_h
+#include <glib.h>
+
+#define FILE_MANIFEST "metadata.files"
+
+extern gboolean file_manifest;
+
+struct db_table;
+void initialize_file_manifest();
+void finalize_file_manifest();
+void file_manifest_set_rows(const gchar *filename, guint part, guint sub_part, guint64 rows);
+void file_manifest_add(const gchar *filename, struct db_table *dbt);
+#endif
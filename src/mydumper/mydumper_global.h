@@ -18,6 +18,9 @@ extern gboolean insert_ignore;
 extern gboolean hex_blob;
 extern gchar *lines_terminated_by_ld;
 extern gchar *fields_terminated_by_ld;
+extern gchar *fields_terminated_by;
+extern gchar *lines_starting_by;
+extern gchar *lines_terminated_by;
 extern gboolean csv;
 extern gboolean clickhouse;
 extern gboolean include_header;
@@ -31,11 +34,19 @@ extern gboolean no_dump_views;
 extern gboolean views_as_tables;
 extern gboolean dump_checksums;
 extern gboolean split_partitions;
+extern gboolean sub_chunk_partitions;
+extern gboolean pre_split_chunks;
+extern gboolean tidb_region_chunks;
+extern gchar *chunk_profile;
+extern gboolean chunk_plan_guard;
+extern gboolean chunk_stealing;
+extern GCompareFunc table_order_function;
 extern guint char_deep;
 extern const gchar *exec_per_thread_extension;
 extern gchar *exec_per_thread;
 extern gboolean order_by_primary_key;
 extern guint num_exec_threads;
+extern guint exec_queue_size;
 extern guint snapshot_interval;
 extern int killqueries;
 extern int longquery;
@@ -51,6 +62,12 @@ extern int (*m_open)(char **filename, const char *);
 extern char * (*identifier_quote_character_protect)(char *r);
 struct db_table;
 extern int (*m_close)(guint thread_id, int file, gchar *filename, guint64 size, struct db_table * dbt);
+extern ssize_t (*m_write)(int file, const void *buf, size_t count);
+void update_file_checksum(int file, const void *buf, size_t count);
+gboolean m_open_writes_plain_files();
+void m_close_server_file(guint thread_id, gchar *filename, struct db_table * dbt);
+extern gboolean into_outfile;
+extern gboolean transportable_tablespaces;
 extern GAsyncQueue *start_scheduled_dump;
 extern gboolean daemon_mode;
 extern gboolean dump_events;
@@ -70,6 +87,7 @@ extern gboolean skip_definer;
 extern gboolean skip_constraints;
 extern gboolean skip_indexes;
 extern gboolean stream;
+extern guint stream_lanes;
 extern gboolean use_fifo;
 extern gboolean use_savepoints;
 extern gboolean clear_dumpdir;
@@ -81,6 +99,10 @@ extern gchar *source_db;
 extern gchar *disk_limits;
 extern gchar *dump_directory;
 extern gchar *exec_command;
+extern gchar *upload_url;
+extern guint num_upload_threads;
+extern guint upload_part_size;
+extern guint upload_max_in_flight;
 extern gchar *fields_escaped_by;
 extern gchar *output_directory;
 extern gchar *output_directory_str;
@@ -90,6 +112,9 @@ extern gchar *set_names_in_conn_by_default;
 extern gchar *tables_skiplist_file;
 extern gchar *tidb_snapshot;
 extern gchar *where_option;
+extern gdouble sample_percent;
+extern gboolean sample_follow_fk;
+extern guint sample_seed;
 extern GHashTable *all_where_per_table;
 extern gint database_counter;
 extern struct MList *transactional_table, *non_transactional_table;
@@ -113,6 +138,19 @@ extern guint num_threads;
 extern guint64 starting_chunk_step_size;
 extern guint snapshot_count;
 extern guint statement_size;
+extern gboolean adaptive_statement_size;
+extern gboolean prefetch_rows;
+extern guint blob_slice_size;
+extern gchar *replica_hosts;
+extern gchar *shard_hosts;
+extern guint shard_parallel;
+extern guint replica_wait_timeout;
+extern gboolean data_index;
+extern guint num_async_writers;
+extern guint async_write_buffers;
+extern gboolean seekable_zstd;
+extern gchar *io_mode_str;
+extern gboolean file_checksums;
 extern guint updated_since;
 extern int errno;
 extern int need_dummy_read;
@@ -138,6 +176,12 @@ extern guint output_format;
 extern struct function_pointer identity_function_pointer;
 extern GAsyncQueue *stream_queue;
 extern gboolean masquerade_filename;
+extern gchar *masquerade_key;
+extern guint masquerade_cache_size;
+extern gboolean prefetch_catalog;
+extern guint num_schema_threads;
+extern guint max_queued_jobs;
+extern guint max_queued_jobs_memory;
 extern enum sync_thread_lock_mode sync_thread_lock_mode;
 extern guint trx_tables;
 extern gboolean replica_stopped;
@@ -0,0 +1,266 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <glib/gstdio.h>
+
+#include "mydumper.h"
+#include "mydumper_global.h"
+#include "mydumper_database.h"
+#include "mydumper_write.h"
+#include "mydumper_arguments.h"
+#include "mydumper_content_store.h"
+#include "mydumper_file_manifest.h"
+#include "mydumper_exec_command.h"
+#include "mydumper_upload.h"
+#include "mydumper_incremental.h"
+
+/* --incremental: in daemon mode, a table whose checksum is the same as the
+ * one recorded on the previous snapshot is not dumped again, its data files
+ * are hard linked from the last_dump directory */
+gboolean incremental_snapshot=FALSE;
+static GKeyFile *previous_metadata=NULL;
+static gchar *previous_dump_directory=NULL;
+
+void initialize_incremental(){
+  if (!incremental_snapshot)
+    return;
+  gchar *last_dump=g_build_filename(output_directory, "last_dump", NULL);
+  gchar *target=g_file_read_link(last_dump, NULL);
+  g_free(last_dump);
+  if (target == NULL){
+    g_message("Incremental snapshot: there is no previous snapshot, all the tables will be dumped");
+    return;
+  }
+  previous_dump_directory=g_build_filename(output_directory, target, NULL);
+  g_free(target);
+  gchar *metadata=g_build_filename(previous_dump_directory, "metadata", NULL);
+  GError *error=NULL;
+  previous_metadata=g_key_file_new();
+  if (!g_key_file_load_from_file(previous_metadata, metadata, G_KEY_FILE_NONE, &error)){
+    g_warning("Incremental snapshot: could not read %s, all the tables will be dumped: %s", metadata, error->message);
+    g_error_free(error);
+    g_key_file_free(previous_metadata);
+    previous_metadata=NULL;
+  }else
+    g_message("Incremental snapshot: comparing against %s", previous_dump_directory);
+  g_free(metadata);
+}
+
+void finalize_incremental(){
+  if (previous_metadata)
+    g_key_file_free(previous_metadata);
+  previous_metadata=NULL;
+  g_free(previous_dump_directory);
+  previous_dump_directory=NULL;
+}
+
+static
+gboolean build_table_checksum_expression(MYSQL *conn, struct db_table *dbt){
+  gchar *query=g_strdup_printf("SELECT %s FROM %s%s%s.%s%s%s LIMIT 0",
+      dbt->select_fields ? dbt->select_fields->str : "*",
+      identifier_quote_character_str, dbt->database->source_database, identifier_quote_character_str,
+      identifier_quote_character_str, dbt->table, identifier_quote_character_str);
+  MYSQL_RES *result=m_store_result(conn, query, m_warning, "Incremental snapshot: could not get the columns of %s.%s", dbt->database->source_database, dbt->table);
+  g_free(query);
+  if (!result)
+    return FALSE;
+  build_chunk_checksum_expression(dbt, mysql_fetch_fields(result), mysql_num_fields(result));
+  mysql_free_result(result);
+  return TRUE;
+}
+
+// chunk_checksum_N = checksum;rows;partition;where;files...
+static
+GList *load_previous_chunks(const gchar *group){
+  GList *chunks=NULL;
+  gsize nkeys=0, len=0, i, f;
+  gchar **keys=g_key_file_get_keys(previous_metadata, group, &nkeys, NULL);
+  if (keys == NULL)
+    return NULL;
+  for (i=0; i < nkeys; i++){
+    if (!g_str_has_prefix(keys[i], "chunk_checksum_") || !g_strcmp0(keys[i], "chunk_checksum_expression"))
+      continue;
+    gchar **items=g_key_file_get_string_list(previous_metadata, group, keys[i], &len, NULL);
+    if (items == NULL || len < 4){
+      g_strfreev(items);
+      continue;
+    }
+    struct chunk_checksum *cc=g_new0(struct chunk_checksum, 1);
+    cc->checksum=g_strdup(items[0]);
+    cc->rows=g_ascii_strtoull(items[1], NULL, 10);
+    cc->partition=strlen(items[2]) ? g_strdup(items[2]) : NULL;
+    cc->where=g_strdup(items[3]);
+    for (f=4; f < len; f++)
+      cc->files=g_list_append(cc->files, g_strdup(items[f]));
+    chunks=g_list_prepend(chunks, cc);
+    g_strfreev(items);
+  }
+  g_strfreev(keys);
+  return chunks;
+}
+
+static
+void free_chunks(GList *chunks){
+  for (GList *l=chunks; l; l=l->next){
+    struct chunk_checksum *cc=l->data;
+    g_free(cc->checksum);
+    g_free(cc->partition);
+    g_free(cc->where);
+    g_list_free_full(cc->files, g_free);
+    g_free(cc);
+  }
+  g_list_free(chunks);
+}
+
+static
+gboolean link_previous_file(const gchar *filename, GList **linked){
+  // with --content-store the previous manifest entry is reused
+  if (content_store)
+    return content_store_reuse(previous_dump_directory, filename);
+  gchar *source=g_build_filename(previous_dump_directory, filename, NULL);
+  gchar *destination=g_build_filename(dump_directory, filename, NULL);
+  gboolean r=TRUE;
+  if (link(source, destination)){
+    g_warning("Incremental snapshot: could not link %s into %s: %s", source, dump_directory, strerror(errno));
+    g_free(destination);
+    r=FALSE;
+  }else
+    *linked=g_list_prepend(*linked, destination);
+  g_free(source);
+  return r;
+}
+
+static
+gboolean previous_file_exists(const gchar *filename){
+  if (content_store)
+    return content_store_has_previous(previous_dump_directory, filename);
+  gchar *path=g_build_filename(previous_dump_directory, filename, NULL);
+  gboolean exists=g_file_test(path, G_FILE_TEST_EXISTS);
+  g_free(path);
+  return exists;
+}
+
+// With LOAD DATA the chunk only records the statement file, the rows file
+// next to it has the same name with the rows extension
+static
+gboolean link_rows_file(const gchar *filename, GList **linked){
+  const gchar *sql=g_strrstr(filename, "." SQL);
+  if (sql == NULL || !g_strcmp0(rows_file_extension, SQL))
+    return TRUE;
+  gchar *stem=g_strndup(filename, sql - filename);
+  gchar *candidates[2]={
+    g_strdup_printf("%s.%s%s", stem, rows_file_extension, sql + strlen("." SQL)),
+    g_strdup_printf("%s.%s", stem, rows_file_extension)};
+  gboolean r=TRUE;
+  guint i;
+  for (i=0; i < 2; i++){
+    if (previous_file_exists(candidates[i])){
+      r=link_previous_file(candidates[i], linked);
+      break;
+    }
+  }
+  g_free(candidates[0]);
+  g_free(candidates[1]);
+  g_free(stem);
+  return r;
+}
+
+/* Called while the chunk strategy is defined, with dbt->chunks_mutex taken
+ * and on a connection that is already on the consistent snapshot. The
+ * checksum of the whole table is the BIT_XOR of the chunk checksums, so one
+ * query is enough to know that no chunk changed */
+gboolean reuse_unchanged_table(MYSQL *conn, struct db_table *dbt){
+  if (previous_metadata == NULL || !dbt->chunk_checksums || dbt->limit)
+    return FALSE;
+  gboolean r=FALSE;
+  GList *chunks=NULL, *linked=NULL, *l, *f;
+  gchar *checksum=NULL;
+  GString *where=NULL;
+  guint64 previous_checksum=0, previous_rows=0, rows=0;
+  gchar *lkey=build_dbt_key(dbt->database->database_name_in_filename, dbt->table_filename);
+  gchar *expression=g_key_file_get_string(previous_metadata, lkey, "chunk_checksum_expression", NULL);
+  if (expression == NULL)
+    goto cleanup;
+  // a different expression means that the columns changed
+  if (dbt->chunk_checksum_expression == NULL && !build_table_checksum_expression(conn, dbt))
+    goto cleanup;
+  if (g_strcmp0(expression, dbt->chunk_checksum_expression))
+    goto cleanup;
+  chunks=load_previous_chunks(lkey);
+  if (chunks == NULL)
+    goto cleanup;
+
+  for (l=chunks; l; l=l->next){
+    struct chunk_checksum *cc=l->data;
+    previous_checksum^=g_ascii_strtoull(cc->checksum, NULL, 16);
+    previous_rows+=cc->rows;
+  }
+
+  where=g_string_new("");
+  if (where_option)
+    g_string_append_printf(where, "(%s)", where_option);
+  if (dbt->where)
+    g_string_append_printf(where, "%s(%s)", where->len ? " AND " : "", dbt->where);
+  checksum=checksum_chunk(conn, dbt->database->source_database, dbt->table, dbt->chunk_checksum_expression, NULL, where->str, &rows);
+  if (checksum == NULL || g_ascii_strtoull(checksum, NULL, 16) != previous_checksum || rows != previous_rows)
+    goto cleanup;
+
+  // manifest entries can not be taken back, so all of them must be there
+  if (content_store)
+    for (l=chunks; l; l=l->next)
+      for (f=((struct chunk_checksum *)l->data)->files; f; f=f->next)
+        if (!previous_file_exists(f->data))
+          goto cleanup;
+
+  for (l=chunks; l; l=l->next)
+    for (f=((struct chunk_checksum *)l->data)->files; f; f=f->next)
+      if (!link_previous_file(f->data, &linked) || !link_rows_file(f->data, &linked)){
+        // it will be dumped, the files already linked are removed
+        for (GList *u=linked; u; u=u->next)
+          g_unlink(u->data);
+        goto cleanup;
+      }
+
+  g_message("%s.%s has not changed since the previous snapshot, %u files linked", dbt->database->source_database, dbt->table, g_list_length(linked));
+  // they are sent as the files that are written
+  for (GList *u=linked; u; u=u->next){
+    file_manifest_add(u->data, dbt);
+    if (exec_command)
+      exec_queue_push(dbt, g_strdup(u->data));
+    else if (upload_url)
+      upload_queue_push(dbt, g_strdup(u->data));
+  }
+  // the chunks are written again on the new metadata, in the same order
+  dbt->chunk_checksum_list=g_list_concat(chunks, dbt->chunk_checksum_list);
+  chunks=NULL;
+  dbt->rows=rows;
+  dbt->rows_total=rows;
+  r=TRUE;
+
+cleanup:
+  g_list_free_full(linked, g_free);
+  free_chunks(chunks);
+  if (where)
+    g_string_free(where, TRUE);
+  g_free(checksum);
+  g_free(expression);
+  g_free(lkey);
+  return r;
+}
@@ -0,0 +1,27 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#ifndef _src_mydumper_incremental_h
+#define _src_mydumper_incremental_h
+#include "mydumper_table.h"
+
+extern gboolean incremental_snapshot;
+
+void initialize_incremental();
+void finalize_incremental();
+gboolean reuse_unchanged_table(MYSQL *conn, struct db_table *dbt);
+#endif
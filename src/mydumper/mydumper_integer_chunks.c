@@ -37,12 +37,16 @@
 #include "mydumper_write.h"
 #include "mydumper_integer_chunks.h"
 #include "mydumper_common.h"
+#include "mydumper_chunk_profile.h"
+#include "mydumper_row_fetcher.h"
 
 
 guint64 min_integer_chunk_step_size=0;
 guint64 max_integer_chunk_step_size=0;
 
 guint max_time_per_select=MAX_TIME_PER_QUERY;
+gboolean pre_split_chunks=FALSE;
+gboolean tidb_region_chunks=FALSE;
 
 guint64 gint64_abs(gint64 a){
   if (a >= 0)
@@ -305,6 +309,14 @@ return ( !csi->chunk_step->integer_step.is_step_fixed_length  && (
 
 
 
+// csi->mutex is LOCKED
+// Used by the chunks that nest a single column integer step
+struct chunk_step_item *split_integer_step_item(struct chunk_step_item *csi){
+  if (csi->status == COMPLETED || csi->multicolumn || !is_splitable(csi))
+    return NULL;
+  return split_chunk_step(csi);
+}
+
 void update_where_on_integer_step(struct chunk_step_item * csi);
 
 struct chunk_step_item *clone_chunk_step_item(struct chunk_step_item *csi){
@@ -313,6 +325,47 @@ struct chunk_step_item *clone_chunk_step_item(struct chunk_step_item *csi){
 
 
 // dbt->chunks_mutex is LOCKED
+// Range that has not been dumped yet, used to compare chunks of the same table
+static
+guint64 get_integer_remaining_range(struct chunk_step_item *csi){
+  struct integer_step *ics=&(csi->chunk_step->integer_step);
+  if (ics->is_unsigned){
+    guint64 from= csi->status == DUMPING_CHUNK ? ics->type.unsign.cursor : ics->type.unsign.min;
+    return ics->type.unsign.max > from ? ics->type.unsign.max - from : 0;
+  }
+  gint64 from= csi->status == DUMPING_CHUNK ? ics->type.sign.cursor : ics->type.sign.min;
+  return ics->type.sign.max > from ? (guint64)ics->type.sign.max - (guint64)from : 0;
+}
+
+// Returns locked the single column chunk with the largest remaining range if
+// it is larger than the one of csi. Chunks that are busy are skipped, as we
+// never wait for them while holding csi->mutex
+static
+struct chunk_step_item *get_largest_integer_chunk(struct db_table *dbt, struct chunk_step_item *csi){
+  struct chunk_step_item *candidate, *largest=NULL;
+  guint64 largest_remaining=get_integer_remaining_range(csi), remaining;
+  GList *l;
+  for (l=dbt->chunks; l; l=l->next){
+    candidate=l->data;
+    if (candidate == csi || candidate->chunk_type != INTEGER || candidate->multicolumn || candidate->next != NULL)
+      continue;
+    if (!g_mutex_trylock(candidate->mutex))
+      continue;
+    if ((candidate->status == ASSIGNED || candidate->status == DUMPING_CHUNK) && is_splitable(candidate)){
+      remaining=get_integer_remaining_range(candidate);
+      if (remaining > largest_remaining){
+        if (largest)
+          g_mutex_unlock(largest->mutex);
+        largest=candidate;
+        largest_remaining=remaining;
+        continue;
+      }
+    }
+    g_mutex_unlock(candidate->mutex);
+  }
+  return largest;
+}
+
 struct chunk_step_item *get_next_integer_chunk(struct db_table *dbt){
   struct chunk_step_item *csi=NULL, *new_csi=NULL, *new_csi_next=NULL;
   if (dbt->chunks!=NULL){
@@ -412,7 +465,23 @@ struct chunk_step_item *get_next_integer_chunk(struct db_table *dbt){
         goto end;
       }
 
-      // it should be splittable, let's do it
+      // it should be splittable, but the chunk that is going to finish last
+      // is the one with the largest remaining range, so we split that one
+      struct chunk_step_item *largest=get_largest_integer_chunk(dbt, csi);
+      if (largest){
+        new_csi = split_chunk_step(largest);
+        if (new_csi){
+          trace("Splitting the largest chunk of `%s`.`%s` instead of part %"G_GUINT64_FORMAT, dbt->database->source_database, dbt->table, csi->part);
+          dbt->chunks=g_list_append(dbt->chunks,new_csi);
+          // largest was not popped, so it is still in the queue
+          g_async_queue_push(dbt->chunks_queue, csi);
+          g_async_queue_push(dbt->chunks_queue, new_csi);
+          g_mutex_unlock(largest->mutex);
+          g_mutex_unlock(csi->mutex);
+          return new_csi;
+        }
+        g_mutex_unlock(largest->mutex);
+      }
       new_csi = split_chunk_step(csi);
       if (new_csi){
         if (new_csi->chunk_step->integer_step.is_unsigned)
@@ -570,6 +639,49 @@ gboolean is_last(struct chunk_step_item *csi){
   return r;
 }
 
+/* With --prefetch-rows the query of the next step is sent while this one
+   is encoded. The next step is predicted with the current step size, and it
+   is the range that the next step takes if no thread split it meanwhile.
+   The step size that is learnt from this chunk is used from the one after */
+static
+void predict_next_integer_step(struct table_job *tj, struct chunk_step_item *csi){
+  struct integer_step *ics=&(csi->chunk_step->integer_step);
+  union type next;
+  if (!prefetch_rows || csi->multicolumn || ics->step == 0)
+    return;
+  g_mutex_lock(csi->mutex);
+  if (ics->is_unsigned){
+    next.unsign.min=ics->type.unsign.cursor + 1;
+    ics->has_prefetch= next.unsign.min > ics->type.unsign.cursor && next.unsign.min <= ics->type.unsign.max;
+    if (ics->has_prefetch){
+      next.unsign.cursor= ics->step > ics->type.unsign.max - next.unsign.min + 1 ? ics->type.unsign.max : next.unsign.min + ics->step - 1;
+      next.unsign.max=ics->type.unsign.max;
+    }
+  }else{
+    next.sign.min=ics->type.sign.cursor + 1;
+    ics->has_prefetch= ics->type.sign.cursor < G_MAXINT64 && next.sign.min <= ics->type.sign.max;
+    if (ics->has_prefetch){
+      next.sign.cursor= ics->step > gint64_abs(ics->type.sign.max - next.sign.min) + 1 ? ics->type.sign.max : next.sign.min + (gint64)ics->step - 1;
+      next.sign.max=ics->type.sign.max;
+    }
+  }
+  if (ics->has_prefetch){
+    ics->prefetch=next;
+    if (tj->next_where == NULL)
+      tj->next_where=g_string_new("");
+    g_string_set_size(tj->next_where, 0);
+    update_integer_where_on_gstring(tj->next_where, FALSE, csi->prefix, csi->field, ics->is_unsigned, next, TRUE);
+  }
+  g_mutex_unlock(csi->mutex);
+}
+
+// The step that was predicted is not going to be dumped by this job
+static
+void discard_next_integer_step(struct table_job *tj){
+  if (tj->td->row_fetcher)
+    row_fetcher_discard_prefetched(tj->td->row_fetcher);
+}
+
 guint process_integer_chunk_step(struct table_job *tj, struct chunk_step_item *csi){
   struct thread_data *td = tj->td;
   union chunk_step *cs = csi->chunk_step;
@@ -652,9 +764,7 @@ retry:
       trace("Thread %d: I-Chunk 2: cs->integer_step.type.sign.cursor: %lld", td->thread_id, cs->integer_step.type.sign.cursor);
     }
     update_where_on_integer_step(csi);
-    guint64 rows = check_row_count?
-                   get_rows_from_count  (td->thrconn, tj->dbt, csi->where):
-                   get_rows_from_explain(td->thrconn, tj->dbt, csi->where, csi->field);
+    guint64 rows = get_rows_from_explain(td->thrconn, tj->dbt, csi->where, csi->field);
     trace("Thread %d: I-Chunk 2: multicolumn and next == NULL with rows: %lld", td->thread_id, rows);
 
     guint64 tmpstep = csi->chunk_step->integer_step.is_unsigned?
@@ -681,7 +791,7 @@ retry:
         trace("Thread %d: I-Chunk 2: integer_step.step==1 min: %"G_GINT64_FORMAT" | max: %"G_GINT64_FORMAT, td->thread_id, csi->chunk_step->integer_step.type.sign.min, csi->chunk_step->integer_step.type.sign.max);
       }
       if (rows > tj->dbt->min_chunk_step_size){
-        csi->next = initialize_chunk_step_item(td->thrconn, tj->dbt, csi->position + 1, rows, csi->where);
+        csi->next = initialize_chunk_step_item(td->thrconn, tj->dbt, csi->position + 1, rows, csi->where, NULL);
         if (csi->next){
           csi->next->multicolumn=FALSE;
           trace("Thread %d: I-Chunk 2: New next with where %s | rows: %lld", td->thread_id, csi->where->str, rows);
@@ -695,7 +805,11 @@ retry:
 
   if (cs->integer_step.is_unsigned){
 
-    if (cs->integer_step.step > cs->integer_step.type.unsign.max - cs->integer_step.type.unsign.min + 1 )
+    // the range that was predicted, unless it was split meanwhile
+    if (cs->integer_step.has_prefetch && cs->integer_step.prefetch.unsign.min == cs->integer_step.type.unsign.min &&
+        cs->integer_step.prefetch.unsign.cursor <= cs->integer_step.type.unsign.max)
+      cs->integer_step.type.unsign.cursor = cs->integer_step.prefetch.unsign.cursor;
+    else if (cs->integer_step.step > cs->integer_step.type.unsign.max - cs->integer_step.type.unsign.min + 1 )
       cs->integer_step.type.unsign.cursor = cs->integer_step.type.unsign.max;
     else
       cs->integer_step.type.unsign.cursor = cs->integer_step.type.unsign.min + cs->integer_step.step - 1;
@@ -708,7 +822,10 @@ retry:
     cs->integer_step.estimated_remaining_steps=cs->integer_step.step>0?(cs->integer_step.type.unsign.max - cs->integer_step.type.unsign.cursor) / cs->integer_step.step:1;
   }else{
 
-    if (cs->integer_step.step > gint64_abs(cs->integer_step.type.sign.max - cs->integer_step.type.sign.min) + 1)
+    if (cs->integer_step.has_prefetch && cs->integer_step.prefetch.sign.min == cs->integer_step.type.sign.min &&
+        cs->integer_step.prefetch.sign.cursor <= cs->integer_step.type.sign.max)
+      cs->integer_step.type.sign.cursor = cs->integer_step.prefetch.sign.cursor;
+    else if (cs->integer_step.step > gint64_abs(cs->integer_step.type.sign.max - cs->integer_step.type.sign.min) + 1)
       cs->integer_step.type.sign.cursor = cs->integer_step.type.sign.max;
     else
       cs->integer_step.type.sign.cursor = cs->integer_step.type.sign.min + cs->integer_step.step - 1;
@@ -720,6 +837,7 @@ retry:
 
     cs->integer_step.estimated_remaining_steps=cs->integer_step.step>0?(cs->integer_step.type.sign.max - cs->integer_step.type.sign.cursor) / cs->integer_step.step:1;
   }
+  cs->integer_step.has_prefetch=FALSE;
 
 
   if (csi->next !=NULL && csi->status==UNSPLITTABLE){
@@ -765,9 +883,13 @@ retry:
       trace("Thread %d: I-Chunk 3: Last chunk on `%s`.`%s` no need to calculate anything else after finish", td->thread_id, tj->dbt->database->source_database, tj->dbt->table);
       write_table_job_into_file(tj);
     }else{
+      float filesize=tj->filesize;
       GDateTime *from = g_date_time_new_now_local();
+      predict_next_integer_step(tj, csi);
       write_table_job_into_file(tj);
       GDateTime *to = g_date_time_new_now_local();
+      // the file might have been rotated while writing
+      filesize= tj->filesize >= filesize ? tj->filesize - filesize : tj->filesize;
 
 // Step 3.1: Updating Step length
 
@@ -810,6 +932,7 @@ retry:
                               csi->chunk_step->integer_step.min_chunk_step_size :
                               cs->integer_step.step;
 
+      update_chunk_profile(tj->dbt, cs->integer_step.step, tj->num_rows_of_last_run, filesize, diff);
 //      trace("After checking: %ld == %ld | max_integer_chunk_step_size=%ld | min_integer_chunk_step_size=%ld", ant, cs->integer_step.step, max_integer_chunk_step_size, min_integer_chunk_step_size);
       g_mutex_unlock(csi->mutex);
     }
@@ -898,6 +1021,7 @@ void process_integer_chunk(struct table_job *tj, struct chunk_step_item *csi){
   g_string_set_size(tj->where,0);
   if (process_integer_chunk_step(tj, csi)){
     g_message("Thread %d: Job has been cacelled",td->thread_id);
+    discard_next_integer_step(tj);
     return;
   }
   g_atomic_int_inc(dbt->chunks_completed);
@@ -918,6 +1042,7 @@ void process_integer_chunk(struct table_job *tj, struct chunk_step_item *csi){
       g_string_set_size(tj->where,0);
       if (process_integer_chunk_step(tj, csi)){
         g_message("Thread %d: Job has been cacelled",td->thread_id);
+        discard_next_integer_step(tj);
         return;
       }
       g_atomic_int_inc(dbt->chunks_completed);
@@ -928,6 +1053,7 @@ void process_integer_chunk(struct table_job *tj, struct chunk_step_item *csi){
     cs->integer_step.estimated_remaining_steps=0;
   csi->status=COMPLETED;
   g_mutex_unlock(csi->mutex);
+  discard_next_integer_step(tj);
 
 }
 
@@ -1014,3 +1140,300 @@ void determine_if_we_can_go_deeper( struct chunk_step_item * csi, guint64 rows){
       csi->multicolumn=FALSE;
   }
 }
+
+/* Pre-splitting: the range of the first chunk is divided into parts with
+   a similar amount of rows before the dump starts. Values are handled as
+   offsets from min, which works for signed and unsigned columns. */
+
+static
+guint64 get_integer_step_value_offset(struct integer_step *ics, const gchar *value){
+  if (ics->is_unsigned)
+    return strtoull(value, NULL, 10) - ics->type.unsign.min;
+  return (guint64)strtoll(value, NULL, 10) - (guint64)ics->type.sign.min;
+}
+
+static
+void append_integer_step_range(GString *where, gchar *field, struct integer_step *ics, guint64 from, guint64 to){
+  if (ics->is_unsigned)
+    g_string_append_printf(where, "%"G_GUINT64_FORMAT" <= %s%s%s AND %s%s%s <= %"G_GUINT64_FORMAT,
+                           ics->type.unsign.min + from,
+                           identifier_quote_character_str, field, identifier_quote_character_str, identifier_quote_character_str, field, identifier_quote_character_str,
+                           ics->type.unsign.min + to);
+  else
+    g_string_append_printf(where, "%"G_GINT64_FORMAT" <= %s%s%s AND %s%s%s <= %"G_GINT64_FORMAT,
+                           (gint64)((guint64)ics->type.sign.min + from),
+                           identifier_quote_character_str, field, identifier_quote_character_str, identifier_quote_character_str, field, identifier_quote_character_str,
+                           (gint64)((guint64)ics->type.sign.min + to));
+}
+
+// Split points from an equi-height or singleton histogram, MySQL 8 only
+static
+guint get_split_points_from_histogram(MYSQL *conn, struct db_table *dbt, struct chunk_step_item *csi, guint64 range, guint parts, guint64 *split_points){
+  struct integer_step *ics=&(csi->chunk_step->integer_step);
+  gchar *query=NULL, *escaped_field=NULL;
+  if (get_product() != SERVER_TYPE_MYSQL || get_major() < 8)
+    return 0;
+  escaped_field=escape_string(conn, csi->field);
+  MYSQL_RES *res = m_store_result(conn, query = g_strdup_printf(
+                        "SELECT JSON_UNQUOTE(HISTOGRAM->'$.\"histogram-type\"'), b.v0, b.v1, b.v2 FROM information_schema.COLUMN_STATISTICS, "
+                        "JSON_TABLE(HISTOGRAM->'$.buckets', '$[*]' COLUMNS(v0 VARCHAR(64) PATH '$[0]', v1 VARCHAR(64) PATH '$[1]', v2 VARCHAR(64) PATH '$[2]')) b "
+                        "WHERE SCHEMA_NAME='%s' AND TABLE_NAME='%s' AND COLUMN_NAME='%s'",
+                        dbt->database->source_database_escaped, dbt->escaped_table, escaped_field), NULL, "Failed to get the histogram", NULL);
+  g_free(query);
+  g_free(escaped_field);
+  if (!res)
+    return 0;
+  MYSQL_ROW row;
+  guint n=0;
+  guint64 offset;
+  gdouble frequency;
+  while ((row = mysql_fetch_row(res)) && n < parts - 1){
+    if (row[0] == NULL)
+      continue;
+    // singleton buckets are [value, cumulative frequency] and equi-height
+    // buckets are [lower, upper, cumulative frequency, ...]
+    gboolean singleton = g_strcmp0(row[0], "singleton") == 0;
+    gchar *upper = singleton ? row[1] : row[2];
+    gchar *cumulative = singleton ? row[2] : row[3];
+    if (upper == NULL || cumulative == NULL)
+      continue;
+    frequency = g_ascii_strtod(cumulative, NULL);
+    offset = get_integer_step_value_offset(ics, upper);
+    // the buckets are sorted, a split point is added every 1/parts of the rows
+    if (frequency >= (gdouble)(n + 1) / parts && offset < range && (n == 0 || offset > split_points[n-1]))
+      split_points[n++]=offset;
+  }
+  mysql_free_result(res);
+  return n;
+}
+
+// Split points from the index statistics, the same that EXPLAIN uses
+static
+guint get_split_points_from_explain(MYSQL *conn, struct db_table *dbt, struct chunk_step_item *csi, guint64 range, guint parts, guint64 *split_points){
+  struct integer_step *ics=&(csi->chunk_step->integer_step);
+  GString *where=g_string_new("");
+  guint64 total, target, low, high, mid, rows;
+  guint n=0, k;
+  append_integer_step_range(where, csi->field, ics, 0, range);
+  total=get_rows_from_explain(conn, dbt, where, csi->field);
+  for (k=1; k<parts && total>0; k++){
+    target=total*k/parts;
+    low= n > 0 ? split_points[n-1] + 1 : 0;
+    high=range;
+    // first offset where the rows from min reaches the target
+    while (low < high){
+      mid=low + (high - low)/2;
+      g_string_set_size(where, 0);
+      append_integer_step_range(where, csi->field, ics, 0, mid);
+      rows=get_rows_from_explain(conn, dbt, where, csi->field);
+      if (rows >= target)
+        high=mid;
+      else
+        low=mid + 1;
+    }
+    if (low < range)
+      split_points[n++]=low;
+  }
+  g_string_free(where, TRUE);
+  return n;
+}
+
+/* The chunk keeps the values up to the first split point and a seed is
+   returned for each of the next ranges, in order */
+static
+GList *split_integer_step_item_at(struct chunk_step_item *csi, guint64 *split_points, guint n){
+  struct integer_step *ics=&(csi->chunk_step->integer_step);
+  GList *seeds=NULL;
+  // The seeds are the leaves of the split tree at this depth, so next splits
+  // keep the part numbers unique
+  guint deep=0, i;
+  while ((1U << deep) < n + 1)
+    deep++;
+  union type type;
+  struct chunk_step_item *seed=NULL;
+  for (i=0; i<n; i++){
+    if (ics->is_unsigned){
+      type.unsign.min=ics->type.unsign.min + split_points[i] + 1;
+      type.unsign.max=i + 1 < n ? ics->type.unsign.min + split_points[i+1] : ics->type.unsign.max;
+    }else{
+      type.sign.min=(gint64)((guint64)ics->type.sign.min + split_points[i] + 1);
+      type.sign.max=i + 1 < n ? (gint64)((guint64)ics->type.sign.min + split_points[i+1]) : ics->type.sign.max;
+    }
+    seed=new_integer_step_item(FALSE, csi->prefix, csi->field, ics->is_unsigned, type, deep, FALSE, ics->step, ics->min_chunk_step_size, ics->max_chunk_step_size, i + 1, FALSE, FALSE, NULL, csi->position, FALSE, ics->rows_in_explain/(n + 1));
+    update_where_on_integer_step(seed);
+    seeds=g_list_append(seeds, seed);
+  }
+  // The original chunk keeps the first part
+  if (ics->is_unsigned)
+    ics->type.unsign.max=ics->type.unsign.min + split_points[0];
+  else
+    ics->type.sign.max=(gint64)((guint64)ics->type.sign.min + split_points[0]);
+  ics->estimated_remaining_steps=ics->step > 0 ? split_points[0] / ics->step : 1;
+  ics->rows_in_explain=ics->rows_in_explain/(n + 1);
+  csi->deep=deep;
+  update_where_on_integer_step(csi);
+  return seeds;
+}
+
+static
+guint64 get_integer_step_range(struct integer_step *ics){
+  return ics->is_unsigned ?
+         ics->type.unsign.max - ics->type.unsign.min :
+         (guint64)ics->type.sign.max - (guint64)ics->type.sign.min;
+}
+
+GList *pre_split_integer_step_item(MYSQL *conn, struct db_table *dbt, struct chunk_step_item *csi, guint parts){
+  struct integer_step *ics=&(csi->chunk_step->integer_step);
+  if (parts < 2 || ics->is_step_fixed_length || csi->multicolumn || csi->position != 0)
+    return NULL;
+  guint64 range = get_integer_step_range(ics);
+  if (range < parts)
+    return NULL;
+  guint64 *split_points=g_new(guint64, parts);
+  guint n=get_split_points_from_histogram(conn, dbt, csi, range, parts, split_points);
+  if (n == 0)
+    n=get_split_points_from_explain(conn, dbt, csi, range, parts, split_points);
+  trace("Pre-split of `%s`.`%s` found %u split points", dbt->database->source_database, dbt->table, n);
+  GList *seeds= n > 0 ? split_integer_step_item_at(csi, split_points, n) : NULL;
+  g_free(split_points);
+  return seeds;
+}
+
+/* TiDB region chunks: the rows of a table with an integer clustered primary
+   key are stored by the key value, SHOW TABLE REGIONS gives the first value
+   of each region. The chunks are split at those values, so a query reads a
+   single region, and queued alternating the leader stores. */
+
+struct tidb_region_boundary{
+  guint64 offset;
+  gchar *store;
+};
+
+static
+gint compare_tidb_region_boundary(gconstpointer a, gconstpointer b){
+  const struct tidb_region_boundary *ra=a, *rb=b;
+  return ra->offset < rb->offset ? -1 : ra->offset > rb->offset;
+}
+
+static
+gchar *get_tidb_clustered_table_id(MYSQL *conn, struct db_table *dbt){
+  gchar *query=NULL, *table_id=NULL;
+  struct M_ROW *mr=m_store_result_row(conn, query=g_strdup_printf(
+                        "SELECT TIDB_TABLE_ID FROM information_schema.TABLES WHERE TABLE_SCHEMA='%s' AND TABLE_NAME='%s' AND TIDB_PK_TYPE='CLUSTERED'",
+                        dbt->database->source_database_escaped, dbt->escaped_table), m_warning, NULL, "Failed to get the TiDB table id", NULL);
+  g_free(query);
+  if (mr->row && mr->row[0])
+    table_id=g_strdup(mr->row[0]);
+  m_store_result_row_free(mr);
+  return table_id;
+}
+
+GList *split_integer_step_item_by_tidb_regions(MYSQL *conn, struct db_table *dbt, struct chunk_step_item *csi){
+  struct integer_step *ics=&(csi->chunk_step->integer_step);
+  if (ics->is_step_fixed_length || csi->multicolumn || csi->position != 0 || g_list_length(dbt->primary_key) != 1)
+    return NULL;
+  gchar *table_id=get_tidb_clustered_table_id(conn, dbt);
+  if (!table_id){
+    trace("`%s`.`%s` has no integer clustered key, regions are not used", dbt->database->source_database, dbt->table);
+    return NULL;
+  }
+  gchar *query=NULL;
+  MYSQL_RES *res = m_store_result(conn, query = g_strdup_printf("SHOW TABLE %s%s%s.%s%s%s REGIONS",
+                        identifier_quote_character_str, dbt->database->source_database, identifier_quote_character_str,
+                        identifier_quote_character_str, dbt->table, identifier_quote_character_str), m_warning, "Failed to get the regions", NULL);
+  g_free(query);
+  if (!res){
+    g_free(table_id);
+    return NULL;
+  }
+  guint i, start_col=1, store_col=4, num_fields=mysql_num_fields(res);
+  MYSQL_FIELD *fields=mysql_fetch_fields(res);
+  for (i=0; i<num_fields; i++){
+    if (!g_ascii_strcasecmp(fields[i].name, "START_KEY"))
+      start_col=i;
+    else if (!g_ascii_strcasecmp(fields[i].name, "LEADER_STORE_ID"))
+      store_col=i;
+  }
+  // Record keys are t_<table id>_r_<key value>
+  gchar *prefix=g_strdup_printf("t_%s_r_", table_id);
+  gsize prefix_len=strlen(prefix);
+  guint64 range=get_integer_step_range(ics);
+  GArray *boundaries=g_array_new(FALSE, FALSE, sizeof(struct tidb_region_boundary));
+  MYSQL_ROW row;
+  while ((row = mysql_fetch_row(res))){
+    if (start_col >= num_fields || store_col >= num_fields || !row[start_col] || !g_str_has_prefix(row[start_col], prefix))
+      continue;
+    gchar *end=NULL;
+    gint64 value=g_ascii_strtoll(row[start_col] + prefix_len, &end, 10);
+    if (end == row[start_col] + prefix_len || *end != '\0')
+      continue;
+    // The range before the region ends on the value before its first key
+    gboolean inside= ics->is_unsigned ?
+                     value > 0 && (guint64)value > ics->type.unsign.min && (guint64)value <= ics->type.unsign.max :
+                     value > ics->type.sign.min && value <= ics->type.sign.max;
+    if (!inside)
+      continue;
+    struct tidb_region_boundary b;
+    b.offset=(ics->is_unsigned ? (guint64)value - ics->type.unsign.min : (guint64)value - (guint64)ics->type.sign.min) - 1;
+    b.store=g_strdup(row[store_col] ? row[store_col] : "");
+    if (b.offset < range)
+      g_array_append_val(boundaries, b);
+    else
+      g_free(b.store);
+  }
+  mysql_free_result(res);
+  g_free(prefix);
+  g_free(table_id);
+  g_array_sort(boundaries, compare_tidb_region_boundary);
+
+  guint n=0;
+  guint64 *split_points=g_new(guint64, boundaries->len + 1);
+  GPtrArray *stores=g_ptr_array_new();
+  for (i=0; i<boundaries->len; i++){
+    struct tidb_region_boundary *b=&g_array_index(boundaries, struct tidb_region_boundary, i);
+    if (n > 0 && b->offset == split_points[n-1])
+      continue;
+    split_points[n++]=b->offset;
+    g_ptr_array_add(stores, b->store);
+  }
+  g_message("`%s`.`%s` is split in %u chunks on the TiDB regions", dbt->database->source_database, dbt->table, n + 1);
+  GList *seeds= n > 0 ? split_integer_step_item_at(csi, split_points, n) : NULL;
+  g_free(split_points);
+
+  // Round robin over the leader stores, keeping the order within each store
+  GHashTable *by_store=g_hash_table_new(g_str_hash, g_str_equal);
+  GPtrArray *store_order=g_ptr_array_new_with_free_func((GDestroyNotify)g_queue_free);
+  GList *l;
+  i=0;
+  for (l=seeds; l; l=l->next, i++){
+    gchar *store=g_ptr_array_index(stores, i);
+    GQueue *q=g_hash_table_lookup(by_store, store);
+    if (!q){
+      q=g_queue_new();
+      g_hash_table_insert(by_store, store, q);
+      g_ptr_array_add(store_order, q);
+    }
+    g_queue_push_tail(q, l->data);
+  }
+  g_list_free(seeds);
+  seeds=NULL;
+  gboolean pending=TRUE;
+  while (pending){
+    pending=FALSE;
+    for (i=0; i<store_order->len; i++){
+      gpointer seed=g_queue_pop_head(g_ptr_array_index(store_order, i));
+      if (seed){
+        seeds=g_list_prepend(seeds, seed);
+        pending=TRUE;
+      }
+    }
+  }
+  seeds=g_list_reverse(seeds);
+  g_hash_table_destroy(by_store);
+  g_ptr_array_free(store_order, TRUE);
+  g_ptr_array_free(stores, TRUE);
+  for (i=0; i<boundaries->len; i++)
+    g_free(g_array_index(boundaries, struct tidb_region_boundary, i).store);
+  g_array_free(boundaries, TRUE);
+  return seeds;
+}
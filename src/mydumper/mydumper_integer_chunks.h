@@ -54,6 +54,10 @@ struct integer_step {
   gboolean check_max;
   gboolean check_min;
   guint64 rows_in_explain;
+  // range of the next step whose query was sent in advance, see
+  // predict_next_integer_step()
+  gboolean has_prefetch;
+  union type prefetch;
 };
 #endif 
 
@@ -63,4 +67,8 @@ void free_integer_step(union chunk_step * cs);
 struct chunk_step_item *get_next_integer_chunk(struct db_table *dbt);
 void process_integer_chunk(struct table_job *tj, struct chunk_step_item *csi);
 gchar * get_integer_chunk_where(union chunk_step * chunk_step);
+void update_where_on_integer_step(struct chunk_step_item * csi);
 void update_integer_where_on_gstring(GString *where, gboolean include_null, GString *prefix, gchar * field, gboolean is_unsigned, union type type, gboolean use_cursor);
+struct chunk_step_item *split_integer_step_item(struct chunk_step_item *csi);
+GList *pre_split_integer_step_item(MYSQL *conn, struct db_table *dbt, struct chunk_step_item *csi, guint parts);
+GList *split_integer_step_item_by_tidb_regions(MYSQL *conn, struct db_table *dbt, struct chunk_step_item *csi);
@@ -0,0 +1,131 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#include <mysql.h>
+#include <string.h>
+#include <glib.h>
+
+#include "mydumper_start_dump.h"
+#include "mydumper_jobs.h"
+#include "mydumper_job_queue.h"
+
+guint max_queued_jobs=200000;
+guint max_queued_jobs_memory=100;
+
+struct job_queue *job_queue_new(guint max_jobs, guint64 max_bytes){
+  struct job_queue *queue=g_new0(struct job_queue, 1);
+  queue->mutex=g_mutex_new();
+  queue->not_empty=g_cond_new();
+  queue->not_full=g_cond_new();
+  queue->jobs=g_queue_new();
+  queue->max_jobs=max_jobs;
+  queue->max_bytes=max_bytes;
+  return queue;
+}
+
+static inline
+gboolean job_queue_is_full(struct job_queue *queue, guint64 size){
+  if (g_queue_is_empty(queue->jobs))
+    return FALSE;
+  return (queue->max_jobs > 0 && g_queue_get_length(queue->jobs) >= queue->max_jobs) ||
+         (queue->max_bytes > 0 && queue->bytes + size > queue->max_bytes);
+}
+
+void job_queue_push(struct job_queue *queue, struct job *job){
+  guint64 size=job_memory_size(job);
+  g_mutex_lock(queue->mutex);
+  while (job_queue_is_full(queue, size))
+    g_cond_wait(queue->not_full, queue->mutex);
+  job->queued_size=size;
+  queue->bytes+=size;
+  g_queue_push_tail(queue->jobs, job);
+  g_cond_signal(queue->not_empty);
+  g_mutex_unlock(queue->mutex);
+}
+
+static inline
+struct job *job_queue_take(struct job_queue *queue){
+  struct job *job=g_queue_pop_head(queue->jobs);
+  queue->bytes-=job->queued_size;
+  job->queued_size=0;
+  // every producer checks its own size
+  g_cond_broadcast(queue->not_full);
+  return job;
+}
+
+struct job *job_queue_pop(struct job_queue *queue){
+  g_mutex_lock(queue->mutex);
+  while (g_queue_is_empty(queue->jobs))
+    g_cond_wait(queue->not_empty, queue->mutex);
+  struct job *job=job_queue_take(queue);
+  g_mutex_unlock(queue->mutex);
+  return job;
+}
+
+struct job *job_queue_try_pop(struct job_queue *queue){
+  struct job *job=NULL;
+  g_mutex_lock(queue->mutex);
+  if (!g_queue_is_empty(queue->jobs))
+    job=job_queue_take(queue);
+  g_mutex_unlock(queue->mutex);
+  return job;
+}
+
+guint job_queue_length(struct job_queue *queue){
+  g_mutex_lock(queue->mutex);
+  guint length=g_queue_get_length(queue->jobs);
+  g_mutex_unlock(queue->mutex);
+  return length;
+}
+
+void job_queue_free(struct job_queue *queue){
+  g_queue_free(queue->jobs);
+  g_cond_free(queue->not_empty);
+  g_cond_free(queue->not_full);
+  g_mutex_free(queue->mutex);
+  g_free(queue);
+}
+
+static inline
+guint64 string_size(const gchar *s){
+  return s ? strlen(s) + 1 : 0;
+}
+
+guint64 job_memory_size(struct job *job){
+  guint64 size=sizeof(struct job);
+  switch (job->type){
+    case JOB_SCHEMA:
+    case JOB_TRIGGERS:
+      size+=sizeof(struct schema_job) + string_size(((struct schema_job *)job->job_data)->filename);
+      break;
+    case JOB_VIEW:
+      size+=sizeof(struct view_job) + string_size(((struct view_job *)job->job_data)->tmp_table_filename)
+                                    + string_size(((struct view_job *)job->job_data)->view_filename);
+      break;
+    case JOB_SEQUENCE:
+      size+=sizeof(struct sequence_job) + string_size(((struct sequence_job *)job->job_data)->filename);
+      break;
+    case JOB_CREATE_DATABASE:
+    case JOB_SCHEMA_POST:
+    case JOB_SCHEMA_TRIGGERS:
+      size+=sizeof(struct database_job) + string_size(((struct database_job *)job->job_data)->filename);
+      break;
+    default:
+      break;
+  }
+  return size;
+}
@@ -0,0 +1,47 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#if !defined(mydumper_mydumper_job_queue)
+#define mydumper_mydumper_job_queue
+
+#include <glib.h>
+#include "mydumper_start_dump.h"
+#include "mydumper_jobs.h"
+
+/* Multi producer, multi consumer queue of jobs with a limit on the number of
+   jobs and on their memory. A push waits on a condition until a pop makes
+   room, so the jobs are created at the speed they are consumed. A job that
+   is bigger than the limit is still accepted on an empty queue */
+struct job_queue {
+  GMutex *mutex;
+  GCond *not_empty;
+  GCond *not_full;
+  GQueue *jobs;
+  guint max_jobs;
+  guint64 max_bytes;
+  guint64 bytes;
+};
+
+struct job_queue *job_queue_new(guint max_jobs, guint64 max_bytes);
+void job_queue_push(struct job_queue *queue, struct job *job);
+struct job *job_queue_pop(struct job_queue *queue);
+struct job *job_queue_try_pop(struct job_queue *queue);
+guint job_queue_length(struct job_queue *queue);
+void job_queue_free(struct job_queue *queue);
+// approximate memory of the job while it is queued
+guint64 job_memory_size(struct job *job);
+#endif
@@ -29,6 +29,7 @@
 #include "mydumper_write.h"
 #include "mydumper_global.h"
 #include "mydumper_working_thread.h"
+#include "mydumper_copy.h"
 
 /* Program options */
 gboolean dump_triggers = FALSE;
@@ -107,6 +108,7 @@ static
 void write_schema_definition_into_file(MYSQL *conn, struct database *database, char *filename) {
   int outfile=0;
 
+  copy_next_file(database, NULL, COPY_DATABASE);
   outfile = m_open(&filename,"w");
 
   if (!outfile) {
@@ -147,11 +149,19 @@ void write_schema_definition_into_file(MYSQL *conn, struct database *database, c
   return;
 }
 
+// the SET NAMES that SHOW CREATE TABLE needs for this table
 static
-void write_table_definition_into_file(MYSQL *conn, struct db_table *dbt,
-                      char *filename, gboolean checksum_filename, gboolean checksum_index_filename) {
+gchar *get_set_names_for_sct(struct db_table *dbt){
+  if (!g_strcmp0(set_names_in_conn_for_sct, AUTO_CHARSET))
+    return dbt->character_set ? dbt->character_set : set_names_in_conn_by_default;
+  return set_names_in_conn_for_sct;
+}
+
+static
+void write_table_create_into_file(MYSQL *conn, struct db_table *dbt,
+                      char *filename, gboolean checksum_filename, gboolean checksum_index_filename, const gchar *create_table) {
   int outfile;
-  char *query = NULL;
+  copy_next_file(dbt->database, dbt, COPY_TABLE);
   outfile = m_open(&filename,"w");
 
   if (!outfile) {
@@ -164,13 +174,6 @@ void write_table_definition_into_file(MYSQL *conn, struct db_table *dbt,
   GString *statement = g_string_sized_new(statement_size);
 
   initialize_header_in_gstring(statement, set_names_in_file_for_sct);
-  if (!g_strcmp0(set_names_in_conn_for_sct, AUTO_CHARSET)){
-    if (dbt->character_set)
-      execute_set_names(conn, dbt->character_set);
-  }else
-    execute_set_names(conn, set_names_in_conn_for_sct);
-
-
 
   if (!write_data(outfile, statement)) {
     g_critical("Could not write schema data for %s.%s", dbt->database->source_database, dbt->table);
@@ -178,36 +181,39 @@ void write_table_definition_into_file(MYSQL *conn, struct db_table *dbt,
     return;
   }
 
-  query = g_strdup_printf("SHOW CREATE TABLE %c%s%c.%c%s%c", identifier_quote_character, dbt->database->source_database, identifier_quote_character, identifier_quote_character, dbt->table, identifier_quote_character);
-  struct M_ROW *mr = m_store_result_row(conn, query, m_critical, m_warning, "Error dumping schemas (%s.%s)", dbt->database->source_database, dbt->table);
-  g_free(query);
-  if (!mr->res){
-    m_store_result_row_free(mr);
-    goto end;
-  }
-
   g_string_set_size(statement, 0);
 
   if (schema_sequence_fix) {
-    gchar *create_table=NULL;
-    g_string_append(statement, create_table = filter_sequence_schemas(mr->row[1]));
-    g_free(create_table);
+    gchar *filtered=NULL;
+    g_string_append(statement, filtered = filter_sequence_schemas(create_table));
+    g_free(filtered);
   } else {
-    g_string_append(statement, mr->row[1]);
+    g_string_append(statement, create_table);
   }
-  m_store_result_row_free(mr);
 
   g_string_append(statement, ";\n");
 
   GString *alter_table_statement=g_string_sized_new(statement_size);
   GString *alter_table_constraint_statement=g_string_sized_new(statement_size);
   GString *create_table_statement=g_string_sized_new(statement_size);
-  int flag = global_process_create_table_statement(statement->str, create_table_statement, alter_table_statement, alter_table_constraint_statement, dbt->table, TRUE);
-  if ( !(flag & IS_TRX_TABLE) && trx_tables && sync_thread_lock_mode!=NO_LOCK){
+  free_table_definition(dbt->table_definition);
+  dbt->table_definition=parse_table_definition(statement->str);
+  int flag = process_table_definition(dbt->table_definition, create_table_statement, alter_table_statement, alter_table_constraint_statement, dbt->table, TRUE);
+  if ( !(flag & IS_TRX_TABLE) && trx_tables && sync_thread_lock_mode!=NO_LOCK && sync_thread_lock_mode!=BINLOG_DELTA){
     m_critical("Non transactional table found: `%s`.`%s` on a consistent backup attempt. Restart backup using --trx-tables=0 to indicate that you have non transactional tables.", dbt->database->source_database, dbt->table);
   }
 
-  if (skip_indexes || skip_constraints){
+  if (copy_to && (flag & IS_TRX_TABLE) && (flag & (IS_ALTER_TABLE_PRESENT | INCLUDE_CONSTRAINT))){
+    // the indexes are built on the target once the data is there
+    if (!write_data(outfile, create_table_statement)) {
+      g_critical("Could not copy schema for %s.%s", dbt->database->source_database, dbt->table);
+      errors++;
+    }
+    if ((flag & IS_ALTER_TABLE_PRESENT) && !skip_indexes)
+      copy_defer_statement(dbt, alter_table_statement, FALSE);
+    if ((flag & INCLUDE_CONSTRAINT) && !skip_constraints)
+      copy_defer_statement(dbt, alter_table_constraint_statement, TRUE);
+  }else if (skip_indexes || skip_constraints){
     if (!write_data(outfile, create_table_statement)) {
       g_critical("Could not write schema for %s.%s", dbt->database->source_database, dbt->table);
       errors++;
@@ -234,11 +240,97 @@ void write_table_definition_into_file(MYSQL *conn, struct db_table *dbt,
   
   if (checksum_index_filename)
     dbt->indexes_checksum=write_checksum_into_file(conn, dbt->database, dbt->table, checksum_table_indexes);
+}
 
-end:
-  execute_set_names(conn, set_names_in_conn_by_default);
+static
+void write_table_definition_into_file(MYSQL *conn, struct db_table *dbt,
+                      char *filename, gboolean checksum_filename, gboolean checksum_index_filename) {
+  char *query = NULL;
+  gchar *set_names=get_set_names_for_sct(dbt);
+  if (g_strcmp0(set_names, set_names_in_conn_by_default))
+    execute_set_names(conn, set_names);
 
-  return;
+  query = g_strdup_printf("SHOW CREATE TABLE %c%s%c.%c%s%c", identifier_quote_character, dbt->database->source_database, identifier_quote_character, identifier_quote_character, dbt->table, identifier_quote_character);
+  struct M_ROW *mr = m_store_result_row(conn, query, m_critical, m_warning, "Error dumping schemas (%s.%s)", dbt->database->source_database, dbt->table);
+  g_free(query);
+  if (mr->res && mr->row)
+    write_table_create_into_file(conn, dbt, filename, checksum_filename, checksum_index_filename, mr->row[1]);
+  m_store_result_row_free(mr);
+
+  if (g_strcmp0(set_names, set_names_in_conn_by_default))
+    execute_set_names(conn, set_names_in_conn_by_default);
+}
+
+/* Sends the SHOW CREATE TABLE of all the jobs in one multi-statement, with
+   a SET NAMES in between when the character set changes, and writes the
+   files once all the results were read. The jobs that are not answered,
+   because a statement failed, go through write_table_definition_into_file()
+   to report the error as usual */
+static
+void write_table_definitions_into_files(MYSQL *conn, struct schema_job **sjs, guint n) {
+  GString *query=g_string_sized_new(256 * n);
+  // statement number of every SHOW CREATE TABLE
+  guint *statement=g_new(guint, n);
+  gchar **creates=g_new0(gchar *, n);
+  gchar *current=set_names_in_conn_by_default, *set_names=NULL;
+  guint i=0, s=0, next=0;
+  int status=0;
+  for (i=0; i < n; i++){
+    set_names=get_set_names_for_sct(sjs[i]->dbt);
+    if (g_strcmp0(set_names, current)){
+      gchar *set_names_statement=set_names_statement_template(set_names);
+      g_string_append_printf(query, "%s;\n", set_names_statement);
+      g_free(set_names_statement);
+      current=set_names;
+      s++;
+    }
+    g_string_append_printf(query, "SHOW CREATE TABLE %c%s%c.%c%s%c;\n", identifier_quote_character, sjs[i]->dbt->database->source_database, identifier_quote_character, identifier_quote_character, sjs[i]->dbt->table, identifier_quote_character);
+    statement[i]=s++;
+  }
+  if (g_strcmp0(current, set_names_in_conn_by_default)){
+    gchar *set_names_statement=set_names_statement_template(set_names_in_conn_by_default);
+    g_string_append(query, set_names_statement);
+    g_free(set_names_statement);
+  }
+
+  if (!mysql_set_server_option(conn, MYSQL_OPTION_MULTI_STATEMENTS_ON)){
+    if (!mysql_real_query(conn, query->str, query->len)){
+      s=0;
+      do {
+        MYSQL_RES *res=mysql_store_result(conn);
+        if (res){
+          MYSQL_ROW row=mysql_fetch_row(res);
+          if (next < n && statement[next] == s && row)
+            creates[next]=g_strdup(row[1]);
+          mysql_free_result(res);
+        }
+        if (next < n && statement[next] == s)
+          next++;
+        s++;
+      } while ((status=mysql_next_result(conn)) == 0);
+      // a failed statement stops the batch and leaves the SET NAMES behind
+      if (status > 0)
+        execute_set_names(conn, set_names_in_conn_by_default);
+    }
+    mysql_set_server_option(conn, MYSQL_OPTION_MULTI_STATEMENTS_OFF);
+  }
+
+  for (i=0; i < n; i++){
+    if (creates[i]){
+      set_names=get_set_names_for_sct(sjs[i]->dbt);
+      gboolean checksums=sjs[i]->checksum_filename || sjs[i]->checksum_index_filename;
+      if (checksums && g_strcmp0(set_names, set_names_in_conn_by_default))
+        execute_set_names(conn, set_names);
+      write_table_create_into_file(conn, sjs[i]->dbt, sjs[i]->filename, sjs[i]->checksum_filename, sjs[i]->checksum_index_filename, creates[i]);
+      if (checksums && g_strcmp0(set_names, set_names_in_conn_by_default))
+        execute_set_names(conn, set_names_in_conn_by_default);
+      g_free(creates[i]);
+    }else
+      write_table_definition_into_file(conn, sjs[i]->dbt, sjs[i]->filename, sjs[i]->checksum_filename, sjs[i]->checksum_index_filename);
+  }
+  g_free(creates);
+  g_free(statement);
+  g_string_free(query, TRUE);
 }
 
 static
@@ -301,6 +393,7 @@ void write_triggers_definition_into_file_from_dbt(MYSQL *conn, struct db_table *
   int outfile;
   char *query = NULL;
 
+  copy_next_file(dbt->database, dbt, COPY_TRIGGERS);
   outfile = m_open(&filename,"w");
 
   if (!outfile) {
@@ -330,6 +423,7 @@ void write_triggers_definition_into_file_from_dbt(MYSQL *conn, struct db_table *
 }
 
 void write_triggers_definition_into_file_from_database(MYSQL *conn, struct database *database, char *filename, gboolean checksum_filename) {
+  copy_next_file(database, NULL, COPY_TRIGGERS);
   int outfile = m_open(&filename,"w");
 
   if (!outfile) {
@@ -368,6 +462,7 @@ void write_view_definition_into_file(MYSQL *conn, struct db_table *dbt, char *tm
     return;
   }
 
+  copy_next_file(dbt->database, dbt, COPY_VIEW_TABLE);
   outfile = m_open(&tmp_table_filename,"w");
   if (!outfile) {
     g_critical("Error: DB: %s Could not create output file (%d)", dbt->database->source_database,
@@ -432,6 +527,7 @@ void write_view_definition_into_file(MYSQL *conn, struct db_table *dbt, char *tm
     return;
   }
 
+  copy_next_file(dbt->database, dbt, COPY_VIEW);
   outfile = m_open(&view_filename,"w");
   if (!outfile) {
     g_critical("Error: DB: %s Could not create output file (%d)", dbt->database->source_database,
@@ -662,6 +758,7 @@ static
 void write_post_into_file(MYSQL *conn, struct database *database, char *filename, gboolean checksum_filename) {
   int outfile;
 
+  copy_next_file(database, NULL, COPY_POST);
   outfile = m_open(&filename,"w");
 
   if (!outfile) {
@@ -739,6 +836,7 @@ void do_JOB_CREATE_DATABASE(struct thread_data *td, struct job *job){
   g_message("Thread %d: dumping schema create for %s%s%s", td->thread_id,
             identifier_quote_character_str, masquerade_filename?dj->database->database_name_in_filename:dj->database->source_database, identifier_quote_character_str);
   write_schema_definition_into_file(td->thrconn, dj->database, dj->filename);
+  copy_created(dj->database);
   free_database_job(dj);
   g_free(job);
 }
@@ -798,10 +896,29 @@ void do_JOB_SCHEMA(struct thread_data *td, struct job *job){
                     identifier_quote_character_str, masquerade_filename?tj->dbt->database->database_name_in_filename:tj->dbt->database->source_database, identifier_quote_character_str,
                     identifier_quote_character_str, masquerade_filename?tj->dbt->table_filename:tj->dbt->table, identifier_quote_character_str);
   write_table_definition_into_file(td->thrconn, tj->dbt, tj->filename, tj->checksum_filename, tj->checksum_index_filename);
+  copy_created(tj->dbt);
   free_schema_job(tj);
   g_free(job);
 }
 
+void do_JOB_SCHEMA_BATCH(struct thread_data *td, struct job **jobs, guint n){
+  struct schema_job **sjs=g_new(struct schema_job *, n);
+  guint i=0;
+  for (i=0; i < n; i++){
+    sjs[i]=(struct schema_job *)jobs[i]->job_data;
+    g_message("Thread %d: dumping schema for %s%s%s.%s%s%s", td->thread_id,
+                    identifier_quote_character_str, masquerade_filename?sjs[i]->dbt->database->database_name_in_filename:sjs[i]->dbt->database->source_database, identifier_quote_character_str,
+                    identifier_quote_character_str, masquerade_filename?sjs[i]->dbt->table_filename:sjs[i]->dbt->table, identifier_quote_character_str);
+  }
+  write_table_definitions_into_files(td->thrconn, sjs, n);
+  for (i=0; i < n; i++){
+    copy_created(sjs[i]->dbt);
+    free_schema_job(sjs[i]);
+    g_free(jobs[i]);
+  }
+  g_free(sjs);
+}
+
 void do_JOB_TRIGGERS(struct thread_data *td, struct job *job){
   struct schema_job * tj = (struct schema_job *)job->job_data;
   g_message("Thread %d: dumping triggers for %s%s%s.%s%s%s", td->thread_id,
@@ -829,3 +946,32 @@ void do_JOB_CHECKSUM(struct thread_data *td, struct job *job){
   g_free(job);
 }
 
+/* --check-row-count: the rows of the table with the filters of the dump,
+   compared with the rows of all its chunks when the metadata is written */
+void do_JOB_ROW_COUNT(struct thread_data *td, struct job *job){
+  struct db_table *dbt = (struct db_table *)job->job_data;
+  GString *where=g_string_new(NULL);
+  if (where_option)
+    g_string_append_printf(where, "(%s)", where_option);
+  if (dbt->where)
+    g_string_append_printf(where, "%s(%s)", where->len ? " AND " : "", dbt->where);
+  gchar *query=g_strdup_printf("SELECT %s COUNT(*) FROM %s%s%s.%s%s%s %s %s",
+      is_mysql_like() ? "/*!40001 SQL_NO_CACHE */" : "",
+      identifier_quote_character_str, dbt->database->source_database, identifier_quote_character_str,
+      identifier_quote_character_str, dbt->table, identifier_quote_character_str,
+      where->len ? "WHERE" : "", where->str);
+  if (use_savepoints)
+    m_query_critical(td->thrconn, "SAVEPOINT mydumper", "Savepoint failed");
+  struct M_ROW *mr=m_store_result_row(td->thrconn, query, m_warning, m_warning, "Failed to count the rows of %s.%s", dbt->database->source_database, dbt->table);
+  if (mr->row && mr->row[0]){
+    dbt->rows_counted=g_ascii_strtoull(mr->row[0], NULL, 10);
+    dbt->has_rows_counted=TRUE;
+  }
+  m_store_result_row_free(mr);
+  if (use_savepoints)
+    m_query_critical(td->thrconn, "ROLLBACK TO SAVEPOINT mydumper", "Rollback to savepoint failed");
+  g_free(query);
+  g_string_free(where, TRUE);
+  g_free(job);
+}
+
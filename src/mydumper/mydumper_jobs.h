@@ -25,6 +25,8 @@
 struct job {
   enum job_type type;
   void *job_data;
+  // bytes accounted while it waits in a bounded queue
+  guint64 queued_size;
 };
 
 struct schema_metadata_job {
@@ -76,6 +78,8 @@ void do_JOB_SCHEMA_POST(struct thread_data *td, struct job *job);
 void do_JOB_VIEW(struct thread_data *td, struct job *job);
 void do_JOB_SEQUENCE(struct thread_data *td, struct job *job);
 void do_JOB_SCHEMA(struct thread_data *td, struct job *job);
+void do_JOB_SCHEMA_BATCH(struct thread_data *td, struct job **jobs, guint n);
 void do_JOB_TRIGGERS(struct thread_data *td, struct job *job);
 void do_JOB_SCHEMA_TRIGGERS(struct thread_data *td, struct job *job);
 void do_JOB_CHECKSUM(struct thread_data *td, struct job *job);
+void do_JOB_ROW_COUNT(struct thread_data *td, struct job *job);
@@ -22,15 +22,155 @@
 #include <gio/gio.h>
 #include <mysql.h>
 #include "mydumper_masquerade.h"
+#include "mydumper_masquerade_cache.h"
 #include "mydumper_common.h"
+#include "mydumper_global.h"
 #include "mydumper.h"
-struct function_pointer identity_function_pointer = {&identity_function, FALSE, NULL, NULL, NULL, NULL, FALSE, 0, 0, NULL, FALSE};
+struct function_pointer identity_function_pointer = {&identity_function, FALSE, NULL, NULL, NULL, NULL, FALSE, 0, 0, NULL, FALSE, NULL, 0, FALSE, NULL, NULL};
 
 GHashTable *file_hash = NULL;
 
-void initialize_masquerade(){
-  srand(clock());
+// xoshiro128** per thread, rand() and g_random_* take a global lock
+static __thread guint32 rng_state[4];
+static __thread gboolean rng_seeded=FALSE;
+static gint rng_seed_counter=0;
+// deterministic functions draw from a state seeded with the value hash
+static __thread guint32 rng_keyed_state[4];
+static __thread guint32 *rng_current=NULL;
+static guint64 masquerade_sip_key[2]={0, 0};
+// copies of the original value and of the cached output, reused per thread
+static __thread GString *masquerade_input=NULL;
+static __thread GString *masquerade_output=NULL;
+
+static
+guint64 splitmix64(guint64 *x){
+  guint64 z=(*x += 0x9e3779b97f4a7c15ULL);
+  z=(z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z=(z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+static
+void fill_rng_state(guint32 *state, guint64 seed){
+  guint64 a=splitmix64(&seed), b=splitmix64(&seed);
+  state[0]=a;
+  state[1]=a >> 32;
+  state[2]=b;
+  state[3]=(b >> 32) | 1;
+}
+
+static
+void m_rand_seed(){
+  fill_rng_state(rng_state, g_get_monotonic_time() ^ ((guint64)(guintptr)rng_state << 16) ^ ((guint64)g_atomic_int_add(&rng_seed_counter, 1) << 48));
+  rng_seeded=TRUE;
+  rng_current=rng_state;
+}
+
+#define SIPROUND do { \
+    v0 += v1; v1 = (v1 << 13) | (v1 >> 51); v1 ^= v0; v0 = (v0 << 32) | (v0 >> 32); \
+    v2 += v3; v3 = (v3 << 16) | (v3 >> 48); v3 ^= v2; \
+    v0 += v3; v3 = (v3 << 21) | (v3 >> 43); v3 ^= v0; \
+    v2 += v1; v1 = (v1 << 17) | (v1 >> 47); v1 ^= v2; v2 = (v2 << 32) | (v2 >> 32); \
+  } while (0)
+
+// SipHash-2-4
+static
+guint64 siphash24(const guint64 *k, const guchar *data, gsize len){
+  guint64 v0=0x736f6d6570736575ULL ^ k[0], v1=0x646f72616e646f6dULL ^ k[1];
+  guint64 v2=0x6c7967656e657261ULL ^ k[0], v3=0x7465646279746573ULL ^ k[1];
+  guint64 m=0, b=((guint64)len) << 56;
+  gsize i=0, left=len & 7;
+  for (i=0; i + 8 <= len; i+=8){
+    memcpy(&m, data + i, 8);
+    m=GUINT64_FROM_LE(m);
+    v3^=m;
+    SIPROUND;
+    SIPROUND;
+    v0^=m;
+  }
+  for (; left > 0; left--)
+    b|=((guint64)data[i + left - 1]) << (8 * (left - 1));
+  v3^=b;
+  SIPROUND;
+  SIPROUND;
+  v0^=b;
+  v2^=0xff;
+  SIPROUND;
+  SIPROUND;
+  SIPROUND;
+  SIPROUND;
+  return v0 ^ v1 ^ v2 ^ v3;
+}
+
+// attempt changes the sequence when UNIQUE has to generate another value
+static
+void m_rand_seed_keyed(const gchar *value, gsize len, guint attempt){
+  fill_rng_state(rng_keyed_state, siphash24(masquerade_sip_key, (const guchar *)value, len) + attempt * 0x9e3779b97f4a7c15ULL);
+  rng_current=rng_keyed_state;
+}
+
+static
+void m_rand_unkeyed(){
+  rng_current=rng_seeded ? rng_state : NULL;
+}
+
+static inline
+guint32 rotl32(guint32 x, int k){
+  return (x << k) | (x >> (32 - k));
+}
+
+static inline
+guint32 m_rand32(){
+  if (G_UNLIKELY(!rng_current))
+    m_rand_seed();
+  guint32 *s=rng_current;
+  guint32 result=rotl32(s[1] * 5, 7) * 9;
+  guint32 t=s[1] << 9;
+  s[2]^=s[0];
+  s[3]^=s[1];
+  s[1]^=s[2];
+  s[0]^=s[3];
+  s[2]^=t;
+  s[3]=rotl32(s[3], 11);
+  return result;
+}
+
+// value in [0, n)
+static inline
+guint32 m_rand_range(guint32 n){
+  return (guint32)(((guint64)m_rand32() * n) >> 32);
+}
+
+// the SipHash key is taken from the SHA-256 of --masquerade-key
+static
+void initialize_masquerade_key(){
+  guint8 digest[32];
+  gsize digest_len=sizeof(digest);
+  GChecksum *checksum=g_checksum_new(G_CHECKSUM_SHA256);
+  g_checksum_update(checksum, (const guchar *)masquerade_key, strlen(masquerade_key));
+  g_checksum_get_digest(checksum, digest, &digest_len);
+  g_checksum_free(checksum);
+  memcpy(masquerade_sip_key, digest, sizeof(masquerade_sip_key));
+}
+
+static inline
+GString *thread_buffer(GString **buffer){
+  if (G_UNLIKELY(*buffer == NULL))
+    *buffer=g_string_sized_new(256);
+  return *buffer;
+}
 
+static
+gboolean unique_add(struct function_pointer *fp, const gchar *value){
+  g_mutex_lock(fp->unique_mutex);
+  gboolean added=!g_hash_table_contains(fp->unique_set, value);
+  if (added)
+    g_hash_table_add(fp->unique_set, g_strdup(value));
+  g_mutex_unlock(fp->unique_mutex);
+  return added;
+}
+
+void initialize_masquerade(){
   file_hash = g_hash_table_new_full( g_str_hash, g_str_equal,  &g_free, &g_free );
 }
 
@@ -90,66 +230,73 @@ gchar * identity_function(gchar ** r, gulong* length,  struct function_pointer *
   return *r;
 }
 
+/* Values are generated in place over *r, a remembered value was generated
+ * from a key of the same length so it also fits in *r */
 gchar * random_basic_function(gchar ** r, gulong* length, struct function_pointer *fp, void (*random_funtion)(gchar *, guint) ){
   gchar *new_r=NULL;
-
-  if (fp && fp->memory && *r)
-    new_r=g_hash_table_lookup(fp->memory,*r);
-  if (new_r){
-    *length=strlen(new_r);
-    *r=g_strdup(new_r);
-    return *r;
+  struct masquerade_cache *map=fp->memory ? fp->memory : fp->cache;
+  GString *input=NULL, *output=NULL;
+  guint attempt=0;
+
+  if (map && *r){
+    output=thread_buffer(&masquerade_output);
+    if (masquerade_cache_lookup(map, *r, output)){
+      *length=output->len;
+      memcpy(*r, output->str, output->len + 1);
+      return *r;
+    }
   }
-  gchar*_key=NULL;
 
   if (*r){
-    if (fp && fp->memory)
-      _key=g_strdup(*r);
+    if (map || fp->deterministic){
+      input=thread_buffer(&masquerade_input);
+      g_string_assign(input, *r);
+    }
 
 retry:
+    if (fp->deterministic)
+      m_rand_seed_keyed(input->str, input->len, attempt++);
 
     random_funtion(*r,fp->max_length>0 && *length>fp->max_length?fp->max_length:*length);
 
-    if (fp && fp->unique){
-      if (g_list_find_custom(fp->unique_list,*r,(GCompareFunc)g_strcmp0)){
-        goto retry;
-      }
-      fp->unique_list=g_list_prepend(fp->unique_list,g_strdup(*r));
-    }
+    if (fp->unique && !unique_add(fp, *r))
+      goto retry;
 
-    if (fp && fp->memory)
-      g_hash_table_insert(fp->memory,_key,g_strdup(*r));
+    // other thread could have masked the same value meanwhile
+    if (map && !masquerade_cache_insert(map, input->str, *r, output))
+      memcpy(*r, output->str, output->len + 1);
 
     *length=strlen(*r);
 
   }else{
     // NULL value
-    if (fp && fp->replace_null){
+    if (fp->replace_null){
 retry2:
       new_r=g_new0(gchar, fp->null_max_length + 1);
 
       random_funtion(new_r, fp->null_max_length );
 
-      if (fp->unique){
-        if (g_list_find_custom(fp->unique_list,new_r,(GCompareFunc)g_strcmp0)){
-          g_free(new_r);
-          goto retry2;
-        }
-        fp->unique_list=g_list_prepend(fp->unique_list,g_strdup(new_r));
+      if (fp->unique && !unique_add(fp, new_r)){
+        g_free(new_r);
+        goto retry2;
       }
 
       *length=strlen(new_r);
-      return new_r;
     }
   }
-  return *r;
+  if (fp->deterministic)
+    m_rand_unkeyed();
+  return new_r ? new_r : *r;
 }
 
+// digits are written directly, the first one is never 0
 void m_random_int(gchar *r, guint len){
-  if (len > 8)
-    g_snprintf(r, len + 1, "%u%u", g_random_int(), g_random_int());
-  else
-    g_snprintf(r, len + 1,   "%u", g_random_int());
+  guint n;
+  if (len > 20)
+    len=20;
+  for (n = 0; n < len; n++)
+    r[n] = '0' + (n ? m_rand_range(10) : 1 + m_rand_range(9));
+  r[len] = '\0';
 }
 
 gchar * random_int_function(gchar ** r, gulong* length, struct function_pointer *fp){
@@ -162,7 +309,7 @@ void m_random_string(char *str, guint size){
 //    --size;
     size_t n;
     for (n = 0; n < size; n++) {
-      int _key = rand() % (int) (sizeof charset - 1);
+      int _key = m_rand_range(sizeof charset - 1);
       str[n] = charset[_key];
     }
     str[size] = '\0';
@@ -173,27 +320,28 @@ gchar * random_string_function(gchar ** r, gulong* length, struct function_point
   return random_basic_function(r,length,fp,&m_random_string);
 }
 
+// version 4 layout written in place, no need of g_uuid_string_random()
 void m_random_uuid(char *str, guint size){
-#ifndef WITH_GLIB_uuid_string_random
-const char charset[] = "0123456789abcdef";
+  const char charset[] = "0123456789abcdef";
   if (size) {
-//        --size;
     size_t n;
+    guint32 bits=0;
     for (n = 0; n < size; n++) {
-      if (str[n]!='-'){
-        if ( n==8 || n==13 || n==18 || n==23)
-          str[n] = '-';
-        else
-          str[n] = charset[rand() % (int) (sizeof charset - 1)];
+      if ( n==8 || n==13 || n==18 || n==23)
+        str[n] = '-';
+      else{
+        if (!(n & 7))
+          bits=m_rand32();
+        str[n] = charset[bits & 0xf];
+        bits >>= 4;
       }
     }
+    if (size >= 36){
+      str[14] = '4';
+      str[19] = charset[8 + (m_rand32() & 3)];
+    }
     str[size] = '\0';
  }
-#else
-  gchar *uuid=g_uuid_string_random();
-  g_strlcpy(str, uuid, strlen(str)+1);
-  g_free(uuid);
-#endif
 }
 
 gchar * random_uuid_function(gchar ** r, gulong* length, struct function_pointer *fp){
@@ -208,18 +356,18 @@ gboolean apply_format_item(gchar **original_p, gulong* max_len, struct format_it
   struct regex_item *ri=NULL;
   gulong new_max_len=0;
   guint new_i=0;
-  GString *new_r=NULL;
 
   switch (fi->type){
     case FORMAT_ITEM_FILE:
       fid = fi->data;
       if (fid->min < *max_len - *pos_in_string){
-        guint random_length       = fid->min < fid->max ?(guint) g_random_int_range(fid->min, (*max_len - *pos_in_string < fid->max ? *max_len - *pos_in_string : fid->max) + 1): fid->min;
+        guint upper               = *max_len - *pos_in_string < fid->max ? *max_len - *pos_in_string : fid->max;
+        guint random_length       = fid->min < fid->max ? fid->min + m_rand_range(upper - fid->min + 1) : fid->min;
         guint final_random_length = *pos_in_string+ random_length  > *max_len ? *max_len - *pos_in_string : random_length;
-        GList *list_of_string_of_lenght = (GList *) g_hash_table_lookup((GHashTable *)fid->data,GINT_TO_POINTER(final_random_length));
-        gchar *lala=g_list_nth_data(list_of_string_of_lenght, g_random_int_range(0,g_list_length(list_of_string_of_lenght)));
-//        g_message("pos_in_string: %d | Max len: %ld | random_length: %d | final_random_length: %d | Original: |%s| String: |%s|", *pos_in_string, *max_len,random_length,final_random_length, *original_p, lala);
-        g_strlcpy(&((*original_p)[*pos_in_string]), lala , final_random_length+1);
+        GPtrArray *strings_of_length = fid->by_length[final_random_length];
+        gchar *lala=g_ptr_array_index(strings_of_length, m_rand_range(strings_of_length->len));
+        memcpy(&((*original_p)[*pos_in_string]), lala , final_random_length);
+        (*original_p)[*pos_in_string + final_random_length]='\0';
         *pos_in_string+=final_random_length;
       }else{
 //        g_message("pos_in_string: %d | Max len: %ld | Original: |%s|", *pos_in_string, *max_len, *original_p);
@@ -249,64 +397,83 @@ gboolean apply_format_item(gchar **original_p, gulong* max_len, struct format_it
     case FORMAT_ITEM_REGEX:
       ri=(struct regex_item *)fi->data;
       new_max_len=*max_len-*pos_in_string;
-      gchar * tmp_replacement=g_new0(gchar, new_max_len), *replacement=tmp_replacement;
+      // the replacement is built on the stack unless it does not fit
+      gchar stack_replacement[REGEX_MAX_LEN];
+      gchar * tmp_replacement=new_max_len < REGEX_MAX_LEN ? stack_replacement : g_new0(gchar, new_max_len + 1), *replacement=tmp_replacement;
+      tmp_replacement[0]='\0';
       new_i=0;
       apply_format_item(&tmp_replacement, &new_max_len, ri->fi, &new_i);
       PCRE2_UCHAR outputbuffer[REGEX_MAX_LEN];
       PCRE2_SIZE outlen=REGEX_MAX_LEN;
-      int rc = pcre2_substitute(*(ri->re), (PCRE2_SPTR)*original_p, strlen(*original_p), 0, PCRE2_SUBSTITUTE_GLOBAL | PCRE2_SUBSTITUTE_EXTENDED, NULL, NULL, (PCRE2_SPTR)replacement, strlen((gchar *)replacement), outputbuffer, &outlen);
+      int rc = pcre2_substitute(*(ri->re), (PCRE2_SPTR)*original_p, strlen(*original_p), 0, PCRE2_SUBSTITUTE_GLOBAL | PCRE2_SUBSTITUTE_EXTENDED, get_thread_match_data(), NULL, (PCRE2_SPTR)replacement, strlen((gchar *)replacement), outputbuffer, &outlen);
       if (rc < 0){
-        g_critical("Error found on pcre2_substitute: %s | %s", new_r->str, replacement);
+        g_critical("Error found on pcre2_substitute: %s | %s", *original_p, replacement);
+      }else{
+        g_strlcpy(*original_p, (gchar*)outputbuffer, outlen+1);
+        *pos_in_string=outlen;
       }
-      g_strlcpy(*original_p, (gchar*)outputbuffer, outlen+1);
-      *pos_in_string=outlen;
+      if (replacement != stack_replacement)
+        g_free(replacement);
       break;
   }
   return cont;
 }
 
 
+// runs the program compiled by parse_random_format over the caller buffer
 gchar *random_format_function(gchar ** r, gulong* max_len, struct function_pointer *fp){
   guint pos_in_string=0;
-  GList *l=fp->parse;
-  GList *d=fp->delimiters;
-  struct format_item *fi=NULL;
-  gboolean cont=TRUE;
-  while (l !=NULL && pos_in_string < *max_len){
-    // Delimiter could be implemented/simulated with regex.
-    cont=TRUE;
-    while (l !=NULL && cont && pos_in_string < *max_len){
-      fi=l->data;
-      cont=apply_format_item(/*&p,*/ r, max_len, fi, &pos_in_string);
-      l=l->next; 
-    }
-    if (d != NULL){
-      d=d->next;
+  guint i=0;
+  GString *input=NULL, *output=NULL;
+  if (fp->cache && *r){
+    output=thread_buffer(&masquerade_output);
+    if (masquerade_cache_lookup(fp->cache, *r, output) && output->len <= *max_len){
+      memcpy(*r, output->str, output->len + 1);
+      *max_len=output->len;
+      return *r;
     }
-  } 
+    input=thread_buffer(&masquerade_input);
+    g_string_assign(input, *r);
+  }
+  if (fp->deterministic && *r)
+    m_rand_seed_keyed(*r, *max_len, 0);
+  for (i=0; i < fp->program_length && pos_in_string < *max_len; i++)
+    apply_format_item(r, max_len, fp->program[i], &pos_in_string);
   if( pos_in_string < *max_len){
     (*r)[pos_in_string]='\0';
     *max_len=pos_in_string;
   }
+  if (fp->deterministic)
+    m_rand_unkeyed();
+  if (input)
+    masquerade_cache_insert(fp->cache, input->str, *r, NULL);
   return *r;
 }
 
 gchar * regex_function(gchar ** r, gulong* max_len, struct function_pointer *fp){
   pcre2_code *tre=NULL;
   GList *l=fp->parse;
+  GString *output=NULL;
+  if (fp->cache && *r){
+    output=thread_buffer(&masquerade_output);
+    if (masquerade_cache_lookup(fp->cache, *r, output)){
+      *max_len=output->len;
+      return g_strndup(output->str, output->len);
+    }
+  }
   GString *new_r= g_string_new(*r);
-  pcre2_match_data *match_data = NULL;
+  pcre2_match_data *match_data = get_thread_match_data();
   PCRE2_UCHAR outputbuffer[1024];
   PCRE2_SPTR replacement=NULL;
   size_t rlength=0;
   PCRE2_SIZE outlen=1024;
   while (l){
     tre=l->data;
-    match_data=pcre2_match_data_create_from_pattern(tre, NULL);
     l=l->next;
     replacement=l->data;
     l=l->next;
     rlength = strlen((gchar *)replacement);
+    outlen=1024;
     int rc =pcre2_substitute(tre, (PCRE2_SPTR)new_r->str, strlen(new_r->str), 0, PCRE2_SUBSTITUTE_GLOBAL | PCRE2_SUBSTITUTE_EXTENDED, match_data, NULL, replacement, rlength, outputbuffer, &outlen);
     if (rc < 0){
       g_critical("Error found on pcre2_substitute: %s | %s", new_r->str, replacement);
@@ -315,7 +482,9 @@ gchar * regex_function(gchar ** r, gulong* max_len, struct function_pointer *fp)
   }
   *max_len=new_r->len;
 //  g_message("new_r->str: %s",new_r->str );
-  return new_r->str;
+  if (output)
+    masquerade_cache_insert(fp->cache, *r, new_r->str, NULL);
+  return g_string_free(new_r, FALSE);
 }
 
 gchar *apply_function(gchar ** r, gulong* max_len, struct function_pointer *fp){
@@ -353,7 +522,8 @@ void parse_basic(struct function_pointer * fp, gchar *val){
     }
     buffer[i]='\0';
     if (g_str_has_prefix(buffer,"WITH_MEM")){
-      fp->memory=g_hash_table_new ( g_str_hash, g_str_equal );
+      if (!fp->memory)
+        fp->memory=new_masquerade_cache(0);
     }else if (g_str_has_prefix(buffer,"REPLACE_NULL")){
       fp->replace_null=TRUE;
       val++;
@@ -367,6 +537,10 @@ void parse_basic(struct function_pointer * fp, gchar *val){
       fp->null_max_length=atoi(buffer);
     }else if (g_str_has_prefix(buffer,"UNIQUE")){
       fp->unique=TRUE;
+      if (!fp->unique_set){
+        fp->unique_set=g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+        fp->unique_mutex=g_mutex_new();
+      }
     }else if (g_str_has_prefix(buffer,"MAX_LENGTH")){
       val++;
       i=0;
@@ -542,6 +716,13 @@ void parse_random_format(struct function_pointer * fp, gchar *val){
           }
           if (sum != 0 )
             g_error("The file %s shouldn't have gaps: %d | %d | %d", buffer, sum , fid->min , fid->max);
+          fid->by_length=g_new0(GPtrArray *, fid->max + 1);
+          for (guint len=fid->min; len <= fid->max; len++){
+            GList *strings=g_hash_table_lookup(fid->data, GINT_TO_POINTER(len));
+            fid->by_length[len]=g_ptr_array_sized_new(g_list_length(strings));
+            for (; strings; strings=strings->next)
+              g_ptr_array_add(fid->by_length[len], strings->data);
+          }
           fi->data = fid;
           if (regex_fi){
             fp->parse=g_list_append(fp->parse,regex_fi);
@@ -602,6 +783,13 @@ void parse_random_format(struct function_pointer * fp, gchar *val){
 
     }
   }
+  g_string_free(regex_content, TRUE);
+
+  fp->program_length=g_list_length(fp->parse);
+  fp->program=g_new0(struct format_item *, fp->program_length + 1);
+  i=0;
+  for (GList *l=fp->parse; l; l=l->next)
+    fp->program[i++]=l->data;
 }
 
 // Function initializer
@@ -649,7 +837,12 @@ struct function_pointer * init_function_pointer(gchar *value){
   fp->delimiters=NULL;
   fp->is_pre=FALSE;
   fp->unique=FALSE;
-  fp->unique_list=NULL;
+  fp->unique_set=NULL;
+  fp->program=NULL;
+  fp->program_length=0;
+  fp->deterministic=FALSE;
+  fp->unique_mutex=NULL;
+  fp->cache=NULL;
   g_debug("init_function_pointer: %s", value);
   if (g_str_has_prefix(value,"random_format")){
     parse_random_format(fp, g_strdup(&(fp->value[14])));
@@ -669,6 +862,14 @@ struct function_pointer * init_function_pointer(gchar *value){
     if (g_strstr_len(fp->value,-1," "))
       parse_basic(fp, g_strdup(g_strstr_len(fp->value,-1," ")));
   }
+  if (masquerade_key && g_str_has_prefix(value,"random_")){
+    if (!masquerade_sip_key[0] && !masquerade_sip_key[1])
+      initialize_masquerade_key();
+    fp->deterministic=TRUE;
+  }
+  // only functions with the same output for the same value can be cached
+  if (masquerade_cache_size > 0 && !fp->memory && (fp->deterministic || fp->function == &regex_function))
+    fp->cache=new_masquerade_cache(masquerade_cache_size);
   return fp;
 }
 
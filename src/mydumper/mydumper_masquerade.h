@@ -35,6 +35,7 @@ struct format_item_file{
   GHashTable * data;
   guint min;
   guint max;
+  GPtrArray **by_length; // strings of the file indexed by their length
 
 };
 
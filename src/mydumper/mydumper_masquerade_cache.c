@@ -0,0 +1,115 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+
+#include <string.h>
+#include <glib.h>
+#include "mydumper_masquerade_cache.h"
+
+#define MASQUERADE_CACHE_SHARDS 16
+
+struct masquerade_cache_entry {
+  gchar *key;
+  gchar *value;
+  GList link;
+};
+
+struct masquerade_cache_shard {
+  GMutex *mutex;
+  GHashTable *entries;
+  GQueue lru;
+  guint capacity;
+};
+
+struct masquerade_cache {
+  struct masquerade_cache_shard shards[MASQUERADE_CACHE_SHARDS];
+};
+
+static
+void free_masquerade_cache_entry(struct masquerade_cache_entry *entry){
+  g_free(entry->key);
+  g_free(entry->value);
+  g_free(entry);
+}
+
+struct masquerade_cache *new_masquerade_cache(guint capacity){
+  struct masquerade_cache *cache=g_new0(struct masquerade_cache, 1);
+  guint i=0;
+  for (i=0; i < MASQUERADE_CACHE_SHARDS; i++){
+    cache->shards[i].mutex=g_mutex_new();
+    cache->shards[i].entries=g_hash_table_new(g_str_hash, g_str_equal);
+    g_queue_init(&(cache->shards[i].lru));
+    cache->shards[i].capacity=capacity ? (capacity + MASQUERADE_CACHE_SHARDS - 1) / MASQUERADE_CACHE_SHARDS : 0;
+  }
+  return cache;
+}
+
+static inline
+struct masquerade_cache_shard *get_shard(struct masquerade_cache *cache, const gchar *key){
+  return &(cache->shards[g_str_hash(key) % MASQUERADE_CACHE_SHARDS]);
+}
+
+// the entry is copied into value as it could be evicted once we unlock
+static
+void touch_entry(struct masquerade_cache_shard *shard, struct masquerade_cache_entry *entry, GString *value){
+  if (shard->capacity){
+    g_queue_unlink(&(shard->lru), &(entry->link));
+    g_queue_push_head_link(&(shard->lru), &(entry->link));
+  }
+  if (value)
+    g_string_assign(value, entry->value);
+}
+
+gboolean masquerade_cache_lookup(struct masquerade_cache *cache, const gchar *key, GString *value){
+  struct masquerade_cache_shard *shard=get_shard(cache, key);
+  g_mutex_lock(shard->mutex);
+  struct masquerade_cache_entry *entry=g_hash_table_lookup(shard->entries, key);
+  if (entry)
+    touch_entry(shard, entry, value);
+  g_mutex_unlock(shard->mutex);
+  return entry != NULL;
+}
+
+/* Returns FALSE when another thread inserted the key first, in that case its
+   value is copied into winner so every thread uses the same mapping */
+gboolean masquerade_cache_insert(struct masquerade_cache *cache, const gchar *key, const gchar *value, GString *winner){
+  struct masquerade_cache_shard *shard=get_shard(cache, key);
+  struct masquerade_cache_entry *entry=NULL, *old=NULL;
+  g_mutex_lock(shard->mutex);
+  entry=g_hash_table_lookup(shard->entries, key);
+  if (entry){
+    touch_entry(shard, entry, winner);
+    g_mutex_unlock(shard->mutex);
+    return FALSE;
+  }
+  entry=g_new0(struct masquerade_cache_entry, 1);
+  entry->key=g_strdup(key);
+  entry->value=g_strdup(value);
+  entry->link.data=entry;
+  g_hash_table_insert(shard->entries, entry->key, entry);
+  if (shard->capacity){
+    g_queue_push_head_link(&(shard->lru), &(entry->link));
+    if (shard->lru.length > shard->capacity){
+      old=g_queue_peek_tail_link(&(shard->lru))->data;
+      g_queue_unlink(&(shard->lru), &(old->link));
+      g_hash_table_remove(shard->entries, old->key);
+      free_masquerade_cache_entry(old);
+    }
+  }
+  g_mutex_unlock(shard->mutex);
+  return TRUE;
+}
@@ -0,0 +1,30 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#ifndef _src_mydumper_masquerade_cache_h
+#define _src_mydumper_masquerade_cache_h
+#include <glib.h>
+
+/* input->output map of a masquerade function, split in shards with their own
+   lock so the dumper threads seldom compete. A capacity of 0 never evicts,
+   otherwise every shard keeps its least recently used entries at the tail */
+struct masquerade_cache;
+
+struct masquerade_cache *new_masquerade_cache(guint capacity);
+gboolean masquerade_cache_lookup(struct masquerade_cache *cache, const gchar *key, GString *value);
+gboolean masquerade_cache_insert(struct masquerade_cache *cache, const gchar *key, const gchar *value, GString *winner);
+#endif
@@ -0,0 +1,476 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+/* Minimal Parquet writer: one data page per column chunk, no compression.
+   Integers are INT64 and floats DOUBLE, everything else is BYTE_ARRAY.
+   BYTE_ARRAY columns are dictionary encoded while the dictionary of the row
+   group stays small, PLAIN otherwise. Definition levels are RLE encoded.
+   Metadata is serialized with the Thrift compact protocol. */
+
+#include <string.h>
+#include <stdlib.h>
+#include "mydumper_parquet.h"
+
+// parquet.thrift
+#define PARQUET_INT64 2
+#define PARQUET_DOUBLE 5
+#define PARQUET_BYTE_ARRAY 6
+#define PARQUET_OPTIONAL 1
+#define PARQUET_UTF8 0
+#define PARQUET_UINT_64 14
+#define PARQUET_PLAIN 0
+#define PARQUET_RLE 3
+#define PARQUET_RLE_DICTIONARY 8
+#define PARQUET_DATA_PAGE 0
+#define PARQUET_DICTIONARY_PAGE 2
+#define PARQUET_UNCOMPRESSED 0
+
+// Thrift compact protocol types
+#define THRIFT_I32 5
+#define THRIFT_I64 6
+#define THRIFT_BINARY 8
+#define THRIFT_LIST 9
+#define THRIFT_STRUCT 12
+#define THRIFT_MAX_DEPTH 8
+
+struct thrift_writer {
+  GString *out;
+  gint16 last_field[THRIFT_MAX_DEPTH];
+  guint depth;
+};
+
+static
+void append_varint(GString *out, guint64 value){
+  while (value >= 0x80){
+    g_string_append_c(out, (gchar)((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+  g_string_append_c(out, (gchar)value);
+}
+
+static
+void append_le32(GString *out, guint32 value){
+  guint32 le=GUINT32_TO_LE(value);
+  g_string_append_len(out, (gchar *)&le, 4);
+}
+
+static
+void append_le64(GString *out, guint64 value){
+  guint64 le=GUINT64_TO_LE(value);
+  g_string_append_len(out, (gchar *)&le, 8);
+}
+
+static
+void thrift_struct_begin(struct thrift_writer *tw){
+  g_assert(tw->depth + 1 < THRIFT_MAX_DEPTH);
+  tw->depth++;
+  tw->last_field[tw->depth]=0;
+}
+
+static
+void thrift_struct_end(struct thrift_writer *tw){
+  g_string_append_c(tw->out, 0);
+  tw->depth--;
+}
+
+static
+void thrift_field(struct thrift_writer *tw, guint8 type, gint16 id){
+  gint16 delta=id - tw->last_field[tw->depth];
+  if (delta > 0 && delta <= 15)
+    g_string_append_c(tw->out, (gchar)((delta << 4) | type));
+  else{
+    g_string_append_c(tw->out, (gchar)type);
+    append_varint(tw->out, (guint16)((id << 1) ^ (id >> 15)));
+  }
+  tw->last_field[tw->depth]=id;
+}
+
+static
+void thrift_i32(struct thrift_writer *tw, gint16 id, gint32 value){
+  thrift_field(tw, THRIFT_I32, id);
+  append_varint(tw->out, (guint32)((value << 1) ^ (value >> 31)));
+}
+
+static
+void thrift_i64(struct thrift_writer *tw, gint16 id, gint64 value){
+  thrift_field(tw, THRIFT_I64, id);
+  append_varint(tw->out, (guint64)((value << 1) ^ (value >> 63)));
+}
+
+static
+void thrift_binary(struct thrift_writer *tw, gint16 id, const gchar *value){
+  thrift_field(tw, THRIFT_BINARY, id);
+  append_varint(tw->out, strlen(value));
+  g_string_append(tw->out, value);
+}
+
+static
+void thrift_list(struct thrift_writer *tw, gint16 id, guint8 type, guint size){
+  thrift_field(tw, THRIFT_LIST, id);
+  if (size < 15)
+    g_string_append_c(tw->out, (gchar)((size << 4) | type));
+  else{
+    g_string_append_c(tw->out, (gchar)(0xF0 | type));
+    append_varint(tw->out, size);
+  }
+}
+
+static
+void thrift_struct_field(struct thrift_writer *tw, gint16 id){
+  thrift_field(tw, THRIFT_STRUCT, id);
+  thrift_struct_begin(tw);
+}
+
+static
+guint32 get_level(const void *values, guint element_size, guint64 i){
+  return element_size == 1 ? ((const guint8 *)values)[i] : ((const guint32 *)values)[i];
+}
+
+static
+void append_bit_packed_groups(GString *out, GString *groups, guint num_groups){
+  if (num_groups == 0)
+    return;
+  append_varint(out, ((guint64)num_groups << 1) | 1);
+  g_string_append_len(out, groups->str, groups->len);
+  g_string_set_size(groups, 0);
+}
+
+/* RLE/bit-packing hybrid: runs of 8 or more equal values are RLE, the rest
+   are bit-packed in groups of 8, the last group is padded with zeros */
+static
+void append_rle_hybrid(GString *out, const void *values, guint element_size, guint64 count, guint bit_width){
+  GString *groups=g_string_new("");
+  guint num_groups=0, byte_width=(bit_width + 7) / 8, j;
+  guint64 i=0, run, acc;
+  guint bits;
+  while (i < count){
+    guint32 value=get_level(values, element_size, i);
+    run=1;
+    while (i + run < count && get_level(values, element_size, i + run) == value)
+      run++;
+    if (run >= 8){
+      append_bit_packed_groups(out, groups, num_groups);
+      num_groups=0;
+      append_varint(out, run << 1);
+      for (j = 0; j < byte_width; j++)
+        g_string_append_c(out, (gchar)((value >> (8 * j)) & 0xFF));
+      i+=run;
+      continue;
+    }
+    acc=0;
+    bits=0;
+    for (j = 0; j < 8; j++){
+      acc|= (guint64)(i + j < count ? get_level(values, element_size, i + j) : 0) << bits;
+      bits+=bit_width;
+      while (bits >= 8){
+        g_string_append_c(groups, (gchar)(acc & 0xFF));
+        acc>>=8;
+        bits-=8;
+      }
+    }
+    num_groups++;
+    i= i + 8 < count ? i + 8 : count;
+  }
+  append_bit_packed_groups(out, groups, num_groups);
+  g_string_free(groups, TRUE);
+}
+
+static
+guint get_bit_width(guint max_value){
+  guint width=1;
+  while (width < 32 && (max_value >> width) != 0)
+    width++;
+  return width;
+}
+
+static
+void reset_parquet_column(struct parquet_column *pc){
+  g_string_set_size(pc->values, 0);
+  g_byte_array_set_size(pc->definition_levels, 0);
+  pc->use_dictionary= pc->type == PARQUET_BYTE_ARRAY;
+  if (pc->dictionary)
+    g_hash_table_remove_all(pc->dictionary);
+  g_string_set_size(pc->dictionary_values, 0);
+  pc->dictionary_size=0;
+  g_array_set_size(pc->indices, 0);
+}
+
+struct parquet_writer *new_parquet_writer(MYSQL_FIELD *fields, guint num_fields){
+  struct parquet_writer *pw=g_new0(struct parquet_writer, 1);
+  guint i;
+  pw->num_columns=num_fields;
+  pw->columns=g_new0(struct parquet_column, num_fields);
+  pw->row_groups=g_string_new("");
+  for (i = 0; i < num_fields; i++){
+    struct parquet_column *pc=&(pw->columns[i]);
+    pc->name=g_strdup(fields[i].name);
+    pc->converted_type=-1;
+    switch (fields[i].type){
+      case MYSQL_TYPE_TINY:
+      case MYSQL_TYPE_SHORT:
+      case MYSQL_TYPE_INT24:
+      case MYSQL_TYPE_LONG:
+      case MYSQL_TYPE_LONGLONG:
+      case MYSQL_TYPE_YEAR:
+        pc->type=PARQUET_INT64;
+        if (fields[i].type == MYSQL_TYPE_LONGLONG && (fields[i].flags & UNSIGNED_FLAG))
+          pc->converted_type=PARQUET_UINT_64;
+        break;
+      case MYSQL_TYPE_FLOAT:
+      case MYSQL_TYPE_DOUBLE:
+        pc->type=PARQUET_DOUBLE;
+        break;
+      default:
+        pc->type=PARQUET_BYTE_ARRAY;
+        if (fields[i].charsetnr != 63 && fields[i].type != MYSQL_TYPE_BIT)
+          pc->converted_type=PARQUET_UTF8;
+        pc->dictionary=g_hash_table_new_full(g_bytes_hash, g_bytes_equal, (GDestroyNotify)g_bytes_unref, NULL);
+        break;
+    }
+    pc->values=g_string_new("");
+    pc->definition_levels=g_byte_array_new();
+    pc->dictionary_values=g_string_new("");
+    pc->indices=g_array_new(FALSE, FALSE, sizeof(guint32));
+    reset_parquet_column(pc);
+  }
+  return pw;
+}
+
+static
+void append_to_dictionary(struct parquet_column *pc, const gchar *value, gulong length){
+  gpointer index=NULL;
+  GBytes *key=g_bytes_new(value, length);
+  if (g_hash_table_lookup_extended(pc->dictionary, key, NULL, &index)){
+    g_bytes_unref(key);
+  }else{
+    // Too many distinct values, PLAIN is going to be smaller
+    if (pc->dictionary_size >= PARQUET_DICTIONARY_MAX_ENTRIES || pc->dictionary_values->len >= PARQUET_DICTIONARY_MAX_SIZE){
+      g_bytes_unref(key);
+      pc->use_dictionary=FALSE;
+      return;
+    }
+    index=GUINT_TO_POINTER(pc->dictionary_size);
+    g_hash_table_insert(pc->dictionary, key, index);
+    append_le32(pc->dictionary_values, length);
+    g_string_append_len(pc->dictionary_values, value, length);
+    pc->dictionary_size++;
+  }
+  guint32 i=GPOINTER_TO_UINT(index);
+  g_array_append_val(pc->indices, i);
+}
+
+void parquet_append_value(struct parquet_writer *pw, guint column, const gchar *value, gulong length){
+  struct parquet_column *pc=&(pw->columns[column]);
+  guint8 level= value != NULL;
+  gsize previous=pc->values->len;
+  g_byte_array_append(pc->definition_levels, &level, 1);
+  if (value != NULL){
+    switch (pc->type){
+      case PARQUET_INT64:
+        if (pc->converted_type == PARQUET_UINT_64)
+          append_le64(pc->values, g_ascii_strtoull(value, NULL, 10));
+        else
+          append_le64(pc->values, (guint64)g_ascii_strtoll(value, NULL, 10));
+        break;
+      case PARQUET_DOUBLE:{
+        union { gdouble d; guint64 u; } v;
+        v.d=g_ascii_strtod(value, NULL);
+        append_le64(pc->values, v.u);
+        break;
+      }
+      default:
+        append_le32(pc->values, length);
+        g_string_append_len(pc->values, value, length);
+        if (pc->use_dictionary)
+          append_to_dictionary(pc, value, length);
+        break;
+    }
+  }
+  pw->buffered_size+=pc->values->len - previous + 1;
+}
+
+void parquet_end_row(struct parquet_writer *pw){
+  pw->num_rows++;
+}
+
+static
+void append_page_header(GString *out, gint32 type, gsize size, guint num_values, gint32 encoding){
+  struct thrift_writer tw={ out, {0}, 0 };
+  thrift_struct_begin(&tw);
+  thrift_i32(&tw, 1, type);
+  thrift_i32(&tw, 2, size);
+  thrift_i32(&tw, 3, size);
+  if (type == PARQUET_DICTIONARY_PAGE){
+    thrift_struct_field(&tw, 7);
+    thrift_i32(&tw, 1, num_values);
+    thrift_i32(&tw, 2, encoding);
+    thrift_struct_end(&tw);
+  }else{
+    thrift_struct_field(&tw, 5);
+    thrift_i32(&tw, 1, num_values);
+    thrift_i32(&tw, 2, encoding);
+    thrift_i32(&tw, 3, PARQUET_RLE);
+    thrift_i32(&tw, 4, PARQUET_RLE);
+    thrift_struct_end(&tw);
+  }
+  thrift_struct_end(&tw);
+}
+
+/* Writes the pages of the column into out and the ColumnChunk struct into
+   the row group metadata. Returns the size of the column chunk */
+static
+guint64 write_column_chunk(struct parquet_writer *pw, struct parquet_column *pc, GString *out, struct thrift_writer *rg){
+  GString *page=g_string_new("");
+  gsize start=out->len;
+  guint64 chunk_offset=pw->offset, dictionary_offset=0, data_offset;
+  gboolean dictionary= pc->use_dictionary && pc->dictionary_size > 0;
+
+  if (dictionary){
+    dictionary_offset=pw->offset;
+    append_page_header(out, PARQUET_DICTIONARY_PAGE, pc->dictionary_values->len, pc->dictionary_size, PARQUET_PLAIN);
+    g_string_append_len(out, pc->dictionary_values->str, pc->dictionary_values->len);
+  }
+  data_offset=pw->offset + (out->len - start);
+
+  // definition levels have a 4 bytes length prefix on data pages v1
+  append_le32(page, 0);
+  append_rle_hybrid(page, pc->definition_levels->data, 1, pc->definition_levels->len, 1);
+  guint32 levels_length=GUINT32_TO_LE(page->len - 4);
+  memcpy(page->str, &levels_length, 4);
+  if (dictionary){
+    guint bit_width=get_bit_width(pc->dictionary_size - 1);
+    g_string_append_c(page, (gchar)bit_width);
+    append_rle_hybrid(page, pc->indices->data, sizeof(guint32), pc->indices->len, bit_width);
+  }else
+    g_string_append_len(page, pc->values->str, pc->values->len);
+  append_page_header(out, PARQUET_DATA_PAGE, page->len, pw->num_rows, dictionary ? PARQUET_RLE_DICTIONARY : PARQUET_PLAIN);
+  g_string_append_len(out, page->str, page->len);
+  g_string_free(page, TRUE);
+
+  guint64 size=out->len - start;
+  pw->offset+=size;
+
+  // ColumnChunk
+  thrift_struct_begin(rg);
+  thrift_i64(rg, 2, chunk_offset);
+  thrift_struct_field(rg, 3);
+  thrift_i32(rg, 1, pc->type);
+  thrift_list(rg, 2, THRIFT_I32, dictionary ? 3 : 2);
+  append_varint(rg->out, PARQUET_PLAIN << 1);
+  append_varint(rg->out, PARQUET_RLE << 1);
+  if (dictionary)
+    append_varint(rg->out, PARQUET_RLE_DICTIONARY << 1);
+  thrift_list(rg, 3, THRIFT_BINARY, 1);
+  append_varint(rg->out, strlen(pc->name));
+  g_string_append(rg->out, pc->name);
+  thrift_i32(rg, 4, PARQUET_UNCOMPRESSED);
+  thrift_i64(rg, 5, pw->num_rows);
+  thrift_i64(rg, 6, size);
+  thrift_i64(rg, 7, size);
+  thrift_i64(rg, 9, data_offset);
+  if (dictionary)
+    thrift_i64(rg, 11, dictionary_offset);
+  thrift_struct_end(rg);
+  thrift_struct_end(rg);
+  return size;
+}
+
+static
+void start_parquet_file(struct parquet_writer *pw, GString *out){
+  if (pw->started)
+    return;
+  g_string_append(out, PARQUET_MAGIC);
+  pw->offset=strlen(PARQUET_MAGIC);
+  pw->started=TRUE;
+}
+
+void parquet_flush_row_group(struct parquet_writer *pw, GString *out){
+  guint i;
+  guint64 total_size=0;
+  if (pw->num_rows == 0)
+    return;
+  start_parquet_file(pw, out);
+  struct thrift_writer rg={ pw->row_groups, {0}, 0 };
+  thrift_struct_begin(&rg);
+  thrift_list(&rg, 1, THRIFT_STRUCT, pw->num_columns);
+  for (i = 0; i < pw->num_columns; i++){
+    total_size+=write_column_chunk(pw, &(pw->columns[i]), out, &rg);
+    reset_parquet_column(&(pw->columns[i]));
+  }
+  thrift_i64(&rg, 2, total_size);
+  thrift_i64(&rg, 3, pw->num_rows);
+  thrift_struct_end(&rg);
+  pw->num_row_groups++;
+  pw->file_rows+=pw->num_rows;
+  pw->num_rows=0;
+  pw->buffered_size=0;
+}
+
+// Writes the footer, the writer can be used again for a new file
+void parquet_finish_file(struct parquet_writer *pw, GString *out){
+  guint i;
+  parquet_flush_row_group(pw, out);
+  start_parquet_file(pw, out);
+  gsize start=out->len;
+  struct thrift_writer tw={ out, {0}, 0 };
+  thrift_struct_begin(&tw);
+  thrift_i32(&tw, 1, 1);
+  thrift_list(&tw, 2, THRIFT_STRUCT, pw->num_columns + 1);
+  thrift_struct_begin(&tw);
+  thrift_binary(&tw, 4, "schema");
+  thrift_i32(&tw, 5, pw->num_columns);
+  thrift_struct_end(&tw);
+  for (i = 0; i < pw->num_columns; i++){
+    thrift_struct_begin(&tw);
+    thrift_i32(&tw, 1, pw->columns[i].type);
+    thrift_i32(&tw, 3, PARQUET_OPTIONAL);
+    thrift_binary(&tw, 4, pw->columns[i].name);
+    if (pw->columns[i].converted_type >= 0)
+      thrift_i32(&tw, 6, pw->columns[i].converted_type);
+    thrift_struct_end(&tw);
+  }
+  thrift_i64(&tw, 3, pw->file_rows);
+  thrift_list(&tw, 4, THRIFT_STRUCT, pw->num_row_groups);
+  g_string_append_len(out, pw->row_groups->str, pw->row_groups->len);
+  thrift_binary(&tw, 6, "mydumper");
+  thrift_struct_end(&tw);
+  append_le32(out, out->len - start);
+  g_string_append(out, PARQUET_MAGIC);
+
+  g_string_set_size(pw->row_groups, 0);
+  pw->num_row_groups=0;
+  pw->file_rows=0;
+  pw->offset=0;
+  pw->started=FALSE;
+}
+
+void free_parquet_writer(struct parquet_writer *pw){
+  guint i;
+  for (i = 0; i < pw->num_columns; i++){
+    struct parquet_column *pc=&(pw->columns[i]);
+    g_free(pc->name);
+    g_string_free(pc->values, TRUE);
+    g_byte_array_free(pc->definition_levels, TRUE);
+    if (pc->dictionary)
+      g_hash_table_destroy(pc->dictionary);
+    g_string_free(pc->dictionary_values, TRUE);
+    g_array_free(pc->indices, TRUE);
+  }
+  g_free(pw->columns);
+  g_string_free(pw->row_groups, TRUE);
+  g_free(pw);
+}
@@ -0,0 +1,64 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+#if !defined(mydumper_mydumper_parquet)
+#define mydumper_mydumper_parquet
+
+#include <mysql.h>
+#include <glib.h>
+
+#define PARQUET_MAGIC "PAR1"
+// used when --chunk-filesize is not set
+#define PARQUET_ROW_GROUP_SIZE 32*1024*1024
+#define PARQUET_DICTIONARY_MAX_ENTRIES 65536
+#define PARQUET_DICTIONARY_MAX_SIZE 1024*1024
+
+struct parquet_column {
+  gchar *name;
+  gint type;
+  gint converted_type;
+  // PLAIN encoded values that are not NULL
+  GString *values;
+  // one byte per row, 0 is NULL
+  GByteArray *definition_levels;
+  gboolean use_dictionary;
+  GHashTable *dictionary;
+  GString *dictionary_values;
+  guint dictionary_size;
+  GArray *indices;
+};
+
+struct parquet_writer {
+  guint num_columns;
+  struct parquet_column *columns;
+  // rows in the row group that is being built
+  guint64 num_rows;
+  guint64 buffered_size;
+  // rows, offset and RowGroup structs of the current file
+  gboolean started;
+  guint64 file_rows;
+  guint64 offset;
+  GString *row_groups;
+  guint num_row_groups;
+};
+
+struct parquet_writer *new_parquet_writer(MYSQL_FIELD *fields, guint num_fields);
+void parquet_append_value(struct parquet_writer *pw, guint column, const gchar *value, gulong length);
+void parquet_end_row(struct parquet_writer *pw);
+void parquet_flush_row_group(struct parquet_writer *pw, GString *out);
+void parquet_finish_file(struct parquet_writer *pw, GString *out);
+void free_parquet_writer(struct parquet_writer *pw);
+#endif
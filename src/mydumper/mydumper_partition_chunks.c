@@ -36,26 +36,122 @@
 #include "mydumper_jobs.h"
 #include "mydumper_global.h"
 #include "mydumper_write.h"
+#include "mydumper_catalog.h"
+#include "mydumper_integer_chunks.h"
+#include "mydumper_char_chunks.h"
 
 
 gboolean split_partitions = FALSE;
 gchar *partition_regex = FALSE;
+gboolean sub_chunk_partitions = FALSE;
 
 struct chunk_step_item *get_next_partition_chunk(struct db_table *dbt);
 
+/* Sub-chunks: a partition with more rows than a chunk is read by an integer
+   or char step on the primary key, nested on csi->next like the multicolumn
+   chunks. The nested step is split by get_next_partition_chunk() into new
+   partition chunks, each one with its own range of the same partition. */
+
+static
+guint64 get_partition_rows(MYSQL *conn, struct db_table *dbt, const gchar *partition_name){
+  gchar *query=NULL;
+  guint64 rows=0;
+  struct M_ROW *mr=m_store_result_row(conn, query=g_strdup_printf(
+                        "SELECT SUM(TABLE_ROWS) FROM information_schema.PARTITIONS WHERE TABLE_SCHEMA='%s' AND TABLE_NAME='%s' AND PARTITION_NAME='%s'",
+                        dbt->database->source_database_escaped, dbt->escaped_table, partition_name), m_warning, NULL, "Failed to get the rows of the partition", NULL);
+  g_free(query);
+  if (mr->row && mr->row[0])
+    rows=strtoull(mr->row[0], NULL, 10);
+  m_store_result_row_free(mr);
+  return rows;
+}
+
+static
+void process_partition_sub_step(struct table_job *tj, struct chunk_step_item *next, gchar *partition){
+  tj->partition = partition;
+  next->chunk_functions.process(tj, next);
+  tj->partition = NULL;
+}
+
+// csi->mutex is LOCKED
+static
+void detach_partition_sub_step(struct chunk_step_item *csi){
+  struct chunk_step_item *next=csi->next;
+  csi->next=NULL;
+  // the chunks split from a char step keep a reference to it
+  if (next->chunk_type == INTEGER){
+    next->chunk_functions.free(next);
+    g_free(next);
+  }
+}
+
+static
+gboolean process_partition_by_sub_chunks(struct table_job *tj, struct chunk_step_item *csi, gchar *partition_name, gchar *partition){
+  struct db_table *dbt=tj->dbt;
+  MYSQL *conn=tj->td->thrconn;
+  if (!dbt->split_integer_tables || !dbt->primary_key)
+    return FALSE;
+  guint64 rows=get_partition_rows(conn, dbt, partition_name);
+  if (rows <= dbt->min_chunk_step_size)
+    return FALSE;
+  struct chunk_step_item *next=initialize_chunk_step_item(conn, dbt, 0, rows, NULL, partition);
+  if (next == NULL)
+    return FALSE;
+  if (next->chunk_type != INTEGER && next->chunk_type != CHAR){
+    g_free(next);
+    return FALSE;
+  }
+  if (next->chunk_type == INTEGER){
+    // the parts of fixed length steps are not unique across partitions
+    next->multicolumn=FALSE;
+    next->chunk_step->integer_step.is_step_fixed_length=FALSE;
+  }
+  next->status=ASSIGNED;
+  trace("Partition %s of `%s`.`%s` is split in chunks", partition_name, dbt->database->source_database, dbt->table);
+  g_mutex_lock(csi->mutex);
+  csi->chunk_step->partition_step.current_partition=partition;
+  csi->next=next;
+  g_mutex_unlock(csi->mutex);
+  process_partition_sub_step(tj, next, partition);
+  g_mutex_lock(csi->mutex);
+  detach_partition_sub_step(csi);
+  csi->chunk_step->partition_step.current_partition=NULL;
+  g_mutex_unlock(csi->mutex);
+  return TRUE;
+}
+
 void process_partition_chunk(struct table_job *tj, struct chunk_step_item *csi){
   union chunk_step *cs = csi->chunk_step;
-  gchar *partition=NULL;
+  gchar *partition=NULL, *partition_name=NULL;
+  if (csi->next){
+    // split from a partition, only its range is read
+    process_partition_sub_step(tj, csi->next, cs->partition_step.current_partition);
+    g_mutex_lock(csi->mutex);
+    detach_partition_sub_step(csi);
+    g_free(cs->partition_step.current_partition);
+    cs->partition_step.current_partition=NULL;
+    csi->status=COMPLETED;
+    g_mutex_unlock(csi->mutex);
+    return;
+  }
   while (cs->partition_step.list != NULL){
     if (shutdown_triggered) {
       return;
     }
     g_mutex_lock(csi->mutex);
-    partition=g_strdup_printf(" PARTITION (%s) ",(char*)(cs->partition_step.list->data));
+    partition_name=cs->partition_step.list->data;
+    partition=g_strdup_printf(" PARTITION (%s) ",partition_name);
     cs->partition_step.list= cs->partition_step.list->next;
     g_mutex_unlock(csi->mutex);
-    tj->partition = partition;
-    write_table_job_into_file(tj);
+    if (!sub_chunk_partitions || !process_partition_by_sub_chunks(tj, csi, partition_name, partition)){
+      tj->partition = partition;
+      write_table_job_into_file(tj);
+    }
+    // the next partition starts its own files
+    if (tj->rows && tj->rows->file >= 0){
+      tj->sub_part++;
+      close_files(tj);
+    }
     g_free(partition);
   }
 }
@@ -109,6 +205,24 @@ struct chunk_step_item *get_next_partition_chunk(struct db_table *dbt){
  //     g_mutex_unlock(dbt->chunks_mutex);
       return new_csi;
     }
+
+    if (csi->next != NULL){
+      g_mutex_lock(csi->next->mutex);
+      struct chunk_step_item *new_next = csi->next->chunk_type == INTEGER ?
+                                         split_integer_step_item(csi->next) :
+                                         split_char_step_item(csi->next);
+      g_mutex_unlock(csi->next->mutex);
+      if (new_next){
+        struct chunk_step_item * new_csi = new_real_partition_step_item(NULL, csi->deep+1, csi->part+pow(2,csi->deep));
+        new_csi->chunk_step->partition_step.current_partition=g_strdup(csi->chunk_step->partition_step.current_partition);
+        new_csi->next=new_next;
+        csi->deep++;
+        new_csi->status=ASSIGNED;
+        dbt->chunks=g_list_append(dbt->chunks,new_csi);
+        g_mutex_unlock(csi->mutex);
+        return new_csi;
+      }
+    }
     g_mutex_unlock(csi->mutex);
     l=l->next;
   }
@@ -116,7 +230,22 @@ struct chunk_step_item *get_next_partition_chunk(struct db_table *dbt){
   return NULL;
 }
 
+static
+gboolean partition_is_elected(struct db_table *dbt, char *partition){
+  return (!dbt->partition_regex && eval_partition_regex(partition)) || (dbt->partition_regex && eval_pcre_regex(dbt->partition_regex, partition));
+}
+
 GList * get_partitions_for_table(MYSQL *conn, struct db_table *dbt){
+  GList *partition_list = NULL;
+  if (catalog_has_partitions()){
+    struct catalog_table *ct=get_catalog_table(dbt->database->source_database, dbt->table);
+    if (ct){
+      for (GList *l=ct->partitions; l; l=l->next)
+        if (partition_is_elected(dbt, l->data))
+          partition_list = g_list_append(partition_list, strdup(l->data));
+      return partition_list;
+    }
+  }
 
   gchar *query = g_strdup_printf("select DISTINCT PARTITION_NAME from information_schema.PARTITIONS where PARTITION_NAME is not null and TABLE_SCHEMA='%s' and TABLE_NAME='%s'", dbt->database->source_database, dbt->table);
   MYSQL_RES *res=m_store_result(conn,query, NULL,"Partitioning is not supported", NULL);
@@ -126,10 +255,9 @@ GList * get_partitions_for_table(MYSQL *conn, struct db_table *dbt){
     //partitioning is not supported
     return NULL;
 
-  GList *partition_list = NULL;
   MYSQL_ROW row;
   while ((row = mysql_fetch_row(res))) {
-    if ( (!dbt->partition_regex && eval_partition_regex(row[0])) || (dbt->partition_regex && eval_pcre_regex(dbt->partition_regex, row[0]) ) )
+    if (partition_is_elected(dbt, row[0]))
       partition_list = g_list_append(partition_list, strdup(row[0]));
   }
   mysql_free_result(res);
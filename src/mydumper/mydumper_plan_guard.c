@@ -0,0 +1,100 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#include <string.h>
+#include <strings.h>
+
+#include "mydumper.h"
+#include "mydumper_global.h"
+#include "mydumper_plan_guard.h"
+
+// chunks of a table between the EXPLAIN of their query
+#define PLAN_GUARD_INTERVAL 64
+
+gboolean chunk_plan_guard=TRUE;
+
+// access types that only read the rows of the chunk
+static
+gboolean is_bounded_access(const gchar *type){
+  return type && (!g_ascii_strcasecmp(type, "range") || !g_ascii_strcasecmp(type, "ref") ||
+                  !g_ascii_strcasecmp(type, "eq_ref") || !g_ascii_strcasecmp(type, "ref_or_null") ||
+                  !g_ascii_strcasecmp(type, "const"));
+}
+
+static
+gboolean explain_chunk_query(MYSQL *conn, const gchar *query, gchar **type, gchar **key){
+  gchar *explain=g_strdup_printf("EXPLAIN %s", query);
+  MYSQL_RES *res=m_store_result(conn, explain, m_warning, "Failed to EXPLAIN the chunk query: %s", explain);
+  g_free(explain);
+  if (!res)
+    return FALSE;
+  MYSQL_FIELD *fields=mysql_fetch_fields(res);
+  guint i, type_col=G_MAXUINT, key_col=G_MAXUINT;
+  for (i=0; i < mysql_num_fields(res); i++){
+    if (!strcasecmp(fields[i].name, "type"))
+      type_col=i;
+    else if (!strcasecmp(fields[i].name, "key"))
+      key_col=i;
+  }
+  MYSQL_ROW row=mysql_fetch_row(res);
+  gboolean found= row && type_col != G_MAXUINT && key_col != G_MAXUINT;
+  if (found){
+    *type=g_strdup(row[type_col]);
+    *key=g_strdup(row[key_col]);
+  }
+  mysql_free_result(res);
+  return found;
+}
+
+/* Called with the query of the chunk before it is executed. Returns TRUE when
+   the index hint was added, the query has to be built again. A plan that is
+   not bounded after the first check is reported as a regression */
+gboolean check_chunk_plan(struct table_job *tj, const gchar *query){
+  struct db_table *dbt=tj->dbt;
+  if (!chunk_plan_guard || !is_mysql_like() || dbt->chunk_index == NULL || tj->where->len == 0)
+    return FALSE;
+  gint checked=g_atomic_int_add(&dbt->plan_guard_queries, 1);
+  if (checked % PLAN_GUARD_INTERVAL != 0)
+    return FALSE;
+  gchar *type=NULL, *key=NULL;
+  if (!explain_chunk_query(tj->td->thrconn, query, &type, &key))
+    return FALSE;
+  gboolean hinted=FALSE;
+  if (!is_bounded_access(type) || g_strcmp0(key, dbt->chunk_index)){
+    if (g_atomic_pointer_get(&dbt->plan_guard_hint)){
+      g_warning("Thread %d: chunk query of %s.%s has access type %s on %s even with %s", tj->td->thread_id,
+                dbt->database->source_database, dbt->table, type ? type : "NULL", key ? key : "no index", dbt->plan_guard_hint);
+    }else{
+      char *index_name=identifier_quote_character_protect(dbt->chunk_index);
+      gchar *hint=g_strdup_printf("FORCE INDEX (%s%s%s)", identifier_quote_character_str, index_name, identifier_quote_character_str);
+      g_free(index_name);
+      if (g_atomic_pointer_compare_and_exchange((gpointer *)&dbt->plan_guard_hint, NULL, hint)){
+        if (checked == 0)
+          g_message("Thread %d: chunk query of %s.%s has access type %s on %s instead of a range on %s, adding %s", tj->td->thread_id,
+                    dbt->database->source_database, dbt->table, type ? type : "NULL", key ? key : "no index", dbt->chunk_index, hint);
+        else
+          g_warning("Thread %d: plan of the chunk query of %s.%s regressed to access type %s on %s, adding %s", tj->td->thread_id,
+                    dbt->database->source_database, dbt->table, type ? type : "NULL", key ? key : "no index", hint);
+        hinted=TRUE;
+      }else
+        g_free(hint);
+    }
+  }
+  g_free(type);
+  g_free(key);
+  return hinted;
+}
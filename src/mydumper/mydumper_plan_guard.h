@@ -0,0 +1,28 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+#if !defined(mydumper_mydumper_plan_guard)
+#define mydumper_mydumper_plan_guard
+
+#include <glib.h>
+#include "mydumper_create_jobs.h"
+
+/* The optimizer can pick a full scan or another index for the chunk query
+   when the statistics are skewed. The plan of the chunk query is checked
+   with EXPLAIN on the first chunk of the table and periodically after it,
+   and FORCE INDEX on the chunking index is added when it is not bounded */
+gboolean check_chunk_plan(struct table_job *tj, const gchar *query);
+#endif
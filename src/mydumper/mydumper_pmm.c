@@ -19,6 +19,7 @@
 
 #include "mydumper_global.h"
 #include "mydumper_stream.h"
+#include "mydumper_database.h"
 
 void append_pmm_entry(GString *content, const gchar *metric, const gchar *_key, guint64 value){
   g_string_append_printf(content,"mydumper_%s{name=\"%s\"} %"G_GUINT64_FORMAT"\n",metric, _key, value);
@@ -32,11 +33,13 @@ void append_pmm_entry_queue(GString *content, const gchar *_key, GAsyncQueue * q
 void append_pmm_entry_all_tables(GString *content){
   struct db_table *dbt=NULL;
   GHashTableIter iter;
+  lock_all_dbts();
   g_hash_table_iter_init ( &iter, all_dbts );
   gchar *lkey;
   while ( g_hash_table_iter_next ( &iter, (gpointer *) &lkey, (gpointer *) &dbt ) ) {
     append_pmm_entry(content,"table",dbt->table, dbt->estimated_remaining_steps);
   }
+  unlock_all_dbts();
 }
 
 void write_mydumper_pmm_entries(const gchar* filename, GString *content, struct configuration* conf){
@@ -58,3 +61,57 @@ void write_mydumper_pmm_entries(const gchar* filename, GString *content, struct
   g_file_set_contents( filename , content->str, content->len, NULL);
 }
 
+
+static
+void append_metrics_queue(GString *content, const gchar *_key, GAsyncQueue * queue){
+  if (queue != NULL)
+    g_string_append_printf(content,"mydumper_queue_length{name=\"%s\"} %d\n", _key, g_async_queue_length(queue));
+}
+
+static
+void append_metrics_table(GString *content, const gchar *metric, struct db_table *dbt, guint64 value){
+  g_string_append_printf(content, "%s{", metric);
+  append_metrics_label(content, "database", dbt->database->source_database);
+  g_string_append_c(content, ',');
+  append_metrics_label(content, "table", dbt->table);
+  g_string_append_printf(content, "} %"G_GUINT64_FORMAT"\n", value);
+}
+
+void write_mydumper_metrics_entries(GString *content, void *_conf){
+  struct configuration *conf=_conf;
+  append_metrics_header(content, "mydumper_threads", "gauge", "Dump threads");
+  g_string_append_printf(content, "mydumper_threads %u\n", num_threads);
+  append_metrics_header(content, "mydumper_errors", "counter", "Errors found during the dump");
+  g_string_append_printf(content, "mydumper_errors %u\n", errors);
+  append_queue_stats_metrics(content, "mydumper");
+  if (conf == NULL)
+    return;
+  append_metrics_header(content, "mydumper_queue_length", "gauge", "Jobs waiting on each queue");
+  append_metrics_queue(content, "schema_queue",              conf->schema_queue);
+  append_metrics_queue(content, "non_transactional_queue",   conf->non_transactional.queue);
+  append_metrics_queue(content, "non_transactional_defer",   conf->non_transactional.defer);
+  append_metrics_queue(content, "transactional_queue",       conf->transactional.queue);
+  append_metrics_queue(content, "transactional_defer",       conf->transactional.defer);
+  append_metrics_queue(content, "post_data_queue",           conf->post_data_queue);
+  append_metrics_queue(content, "ready",                     conf->ready);
+  g_string_append_printf(content,"mydumper_queue_length{name=\"stream\"} %u\n", get_stream_queue_length());
+
+  struct db_table *dbt=NULL;
+  GHashTableIter iter;
+  gchar *lkey;
+  // tables are added while the metrics are served
+  lock_all_dbts();
+  append_metrics_header(content, "mydumper_table_rows", "counter", "Rows dumped per table");
+  g_hash_table_iter_init(&iter, all_dbts);
+  while (g_hash_table_iter_next(&iter, (gpointer *) &lkey, (gpointer *) &dbt))
+    append_metrics_table(content, "mydumper_table_rows", dbt, dbt->rows);
+  append_metrics_header(content, "mydumper_table_bytes", "counter", "Statement bytes written per table, before compression");
+  g_hash_table_iter_init(&iter, all_dbts);
+  while (g_hash_table_iter_next(&iter, (gpointer *) &lkey, (gpointer *) &dbt))
+    append_metrics_table(content, "mydumper_table_bytes", dbt, dbt->bytes);
+  append_metrics_header(content, "mydumper_table_threads", "gauge", "Threads dumping each table");
+  g_hash_table_iter_init(&iter, all_dbts);
+  while (g_hash_table_iter_next(&iter, (gpointer *) &lkey, (gpointer *) &dbt))
+    append_metrics_table(content, "mydumper_table_threads", dbt, dbt->current_threads_running);
+  unlock_all_dbts();
+}
@@ -16,3 +16,4 @@
 */
 
 void write_mydumper_pmm_entries(GString *content, struct configuration* conf);
+void write_mydumper_metrics_entries(GString *content, void *conf);
@@ -0,0 +1,176 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "mydumper.h"
+#include "mydumper_global.h"
+#include "mydumper_replica_hosts.h"
+
+gchar *replica_hosts=NULL;
+guint replica_wait_timeout=300;
+
+static struct replica_host *hosts=NULL;
+static guint num_hosts=0;
+
+/* Control connections are opened before the global lock, with the worker
+ * connections */
+void initialize_replica_hosts(){
+  if (!replica_hosts)
+    return;
+  if (!is_mysql_like() || get_product() == SERVER_TYPE_MARIADB){
+    g_warning("--replica-hosts needs GTID replication of MySQL or Percona Server, the replicas are not used");
+    return;
+  }
+  gchar **list=g_strsplit(replica_hosts, ",", 0);
+  guint i, n=g_strv_length(list);
+  hosts=g_new0(struct replica_host, n);
+  for (i = 0; i < n; i++){
+    gchar *host=g_strstrip(list[i]);
+    if (*host == '\0')
+      continue;
+    gchar *colon=g_strrstr(host, ":");
+    struct replica_host *rh=&(hosts[num_hosts++]);
+    if (colon){
+      *colon='\0';
+      rh->port=strtoul(colon + 1, NULL, 10);
+    }
+    rh->host=g_strdup(host);
+    rh->conn=mysql_init(NULL);
+    m_connect_to_host(rh->conn, rh->host, rh->port);
+    rh->usable=TRUE;
+    g_message("Replica %s connected using MySQL connection ID %lu", rh->host, mysql_thread_id(rh->conn));
+  }
+  g_strfreev(list);
+}
+
+gboolean replica_hosts_in_use(){
+  guint i;
+  for (i = 0; i < num_hosts; i++)
+    if (hosts[i].usable)
+      return TRUE;
+  return FALSE;
+}
+
+/* Round robin over the main host and the replicas. NULL means the main host,
+ * which is also used by the threads that are not working threads */
+struct replica_host *get_thread_replica_host(guint thread_id){
+  if (num_hosts == 0 || thread_id == 0 || thread_id > num_threads)
+    return NULL;
+  guint i=(thread_id - 1) % (num_hosts + 1);
+  return i == 0 ? NULL : &(hosts[i - 1]);
+}
+
+static
+gboolean query_returns_one(MYSQL *conn, const gchar *query){
+  gboolean one=FALSE;
+  struct M_ROW *mr=m_store_result_row(conn, query, m_warning, m_warning, "Failed to execute %s", query);
+  if (mr->row && mr->row[0])
+    one=!g_strcmp0(mr->row[0], "1");
+  m_store_result_row_free(mr);
+  return one;
+}
+
+static
+void discard_replica(struct replica_host *rh, const gchar *reason){
+  g_warning("Replica %s is not used: %s", rh->host, reason);
+  rh->usable=FALSE;
+  if (rh->stopped){
+    m_query_warning(rh->conn, start_replica_sql_thread, "Not able to start replica on %s", rh->host);
+    rh->stopped=FALSE;
+  }
+}
+
+/* Runs under the global lock, once the main host can not move. All the
+ * replicas are stopped first, so none of them goes past the position while
+ * the others are waited */
+void pin_replica_hosts(MYSQL *conn, gboolean writes_blocked){
+  guint i;
+  gchar *query=NULL;
+  if (!replica_hosts_in_use())
+    return;
+  if (!writes_blocked)
+    m_critical("--replica-hosts needs a global lock or a stopped replica on the main host to pin the position");
+  struct M_ROW *mr=m_store_result_row(conn, "SELECT @@GLOBAL.gtid_executed", m_critical, m_critical, "Failed to get gtid_executed", NULL);
+  gchar *gtid=g_strdup(mr->row[0] ? remove_new_line(mr->row[0]) : "");
+  m_store_result_row_free(mr);
+  g_message("Pinning the replicas to %s", gtid);
+
+  for (i = 0; i < num_hosts; i++)
+    if (hosts[i].usable)
+      hosts[i].stopped=!m_query_warning(hosts[i].conn, stop_replica_sql_thread, "Not able to stop replica on %s", hosts[i].host);
+
+  for (i = 0; i < num_hosts; i++){
+    struct replica_host *rh=&(hosts[i]);
+    if (!rh->usable)
+      continue;
+    if (!rh->stopped){
+      discard_replica(rh, "replication could not be stopped");
+      continue;
+    }
+    query=g_strdup_printf("SELECT GTID_SUBSET(@@GLOBAL.gtid_executed, '%s')", gtid);
+    gboolean behind=query_returns_one(rh->conn, query);
+    g_free(query);
+    if (!behind){
+      discard_replica(rh, "it is ahead of the main host");
+      continue;
+    }
+    query=g_strdup_printf("%s UNTIL SQL_AFTER_GTIDS='%s'", start_replica_sql_thread, gtid);
+    m_query_warning(rh->conn, query, "Not able to start replica until the position on %s", rh->host);
+    g_free(query);
+    query=g_strdup_printf("SELECT WAIT_FOR_EXECUTED_GTID_SET('%s', %u) = 0", gtid, replica_wait_timeout);
+    gboolean reached=query_returns_one(rh->conn, query);
+    g_free(query);
+    // the UNTIL clause already stopped it, this is in case it did not
+    m_query_warning(rh->conn, stop_replica_sql_thread, "Not able to stop replica on %s", rh->host);
+    if (!reached){
+      discard_replica(rh, "it did not reach the position");
+      continue;
+    }
+    query=g_strdup_printf("SELECT GTID_SUBSET(@@GLOBAL.gtid_executed, '%s')", gtid);
+    if (!query_returns_one(rh->conn, query))
+      discard_replica(rh, "it went past the position");
+    else
+      g_message("Replica %s stopped at the position of the main host", rh->host);
+    g_free(query);
+  }
+  g_free(gtid);
+}
+
+// Once all the working threads opened their snapshot
+void release_replica_hosts(){
+  guint i;
+  for (i = 0; i < num_hosts; i++){
+    if (hosts[i].stopped){
+      g_message("Starting replica on %s", hosts[i].host);
+      m_query_warning(hosts[i].conn, start_replica_sql_thread, "Not able to start replica on %s", hosts[i].host);
+      hosts[i].stopped=FALSE;
+    }
+  }
+}
+
+void finalize_replica_hosts(){
+  guint i;
+  release_replica_hosts();
+  for (i = 0; i < num_hosts; i++){
+    mysql_close(hosts[i].conn);
+    g_free(hosts[i].host);
+  }
+  g_free(hosts);
+  hosts=NULL;
+  num_hosts=0;
+}
@@ -0,0 +1,43 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#if !defined(mydumper_mydumper_replica_hosts)
+#define mydumper_mydumper_replica_hosts
+
+#include <mysql.h>
+#include <glib.h>
+
+/* With --replica-hosts the working threads are spread over the main host and
+   the replicas. The replicas are stopped at the gtid_executed of the main
+   connection, taken under the global lock, so every snapshot sees the same
+   data wherever it was opened */
+struct replica_host {
+  gchar *host;
+  guint port;
+  // control connection, replication is stopped and restarted from it
+  MYSQL *conn;
+  gboolean usable;
+  gboolean stopped;
+};
+
+void initialize_replica_hosts();
+gboolean replica_hosts_in_use();
+struct replica_host *get_thread_replica_host(guint thread_id);
+void pin_replica_hosts(MYSQL *conn, gboolean writes_blocked);
+void release_replica_hosts();
+void finalize_replica_hosts();
+#endif
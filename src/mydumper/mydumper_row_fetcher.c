@@ -0,0 +1,241 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+/* The row fetcher reads the result set of a chunk on its own thread while
+   the worker encodes the rows that were already received, so the server
+   is not waiting for us to escape, compress and write each row. Batches
+   are recycled between the free and the ready queues, which limits the
+   memory to ROW_FETCHER_BATCHES batches per worker. Each worker has one
+   fetcher thread, that waits on the start queue for the next result set
+   and lives until free_row_fetcher().
+
+   The worker can also give the query of its next chunk with
+   row_fetcher_prefetch(). It is sent as soon as the rows of the current
+   result set were read, so the server executes it while the worker encodes
+   the last batches. The next chunk takes the result if it builds the same
+   query, otherwise it is discarded, as it is before any other query is sent
+   on the connection. The prefetched query holds its own --throttle-control
+   slot, taken only when one is free, until its result is freed. */
+
+#include <string.h>
+#include "mydumper_global.h"
+#include "mydumper_row_fetcher.h"
+#include "common.h"
+#include "throttle_control.h"
+
+// the fetcher of the worker thread, to discard its prefetched result
+static __thread struct row_fetcher *thread_row_fetcher=NULL;
+
+static
+void reset_row_batch(struct row_batch *batch){
+  g_string_set_size(batch->data, 0);
+  g_array_set_size(batch->offsets, 0);
+  g_array_set_size(batch->lengths, 0);
+  batch->num_rows=0;
+}
+
+static
+void fetch_result(struct row_fetcher *rf){
+  MYSQL_ROW row;
+  gulong *lengths;
+  gssize offset;
+  guint i;
+  struct row_batch *batch=g_async_queue_pop(rf->free);
+  reset_row_batch(batch);
+  while (!g_atomic_int_get(&(rf->abort)) && (row = mysql_fetch_row(rf->result))){
+    lengths = mysql_fetch_lengths(rf->result);
+    for (i = 0; i < rf->num_fields; i++){
+      offset= row[i] ? (gssize)batch->data->len : -1;
+      g_array_append_val(batch->offsets, offset);
+      g_array_append_val(batch->lengths, lengths[i]);
+      if (row[i]){
+        g_string_append_len(batch->data, row[i], lengths[i]);
+        g_string_append_c(batch->data, '\0');
+      }
+    }
+    batch->num_rows++;
+    if (batch->data->len >= statement_size || batch->num_rows >= ROW_BATCH_MAX_ROWS){
+      g_async_queue_push(rf->ready, batch);
+      batch=g_async_queue_pop(rf->free);
+      reset_row_batch(batch);
+    }
+  }
+  if (batch->num_rows > 0){
+    g_async_queue_push(rf->ready, batch);
+    batch=g_async_queue_pop(rf->free);
+    reset_row_batch(batch);
+  }
+  rf->result_errno=mysql_errno(rf->conn);
+  g_free(rf->result_error);
+  rf->result_error= rf->result_errno ? g_strdup(mysql_error(rf->conn)) : NULL;
+  if (rf->next_query){
+    // the next query is not worth waiting for a --throttle-control slot
+    if (!g_atomic_int_get(&(rf->abort)) && rf->result_errno == 0 && throttle_control_try_acquire()){
+      /* The client library detaches the result set from the connection at
+         the end of its rows, but not every version does it, and
+         mysql_free_result() would read the rows of the next chunk */
+      rf->result->handle=NULL;
+      if (!mysql_real_query(rf->conn, rf->next_query, strlen(rf->next_query)) && (rf->next_result=mysql_use_result(rf->conn)) != NULL){
+        rf->next_result_query=rf->next_query;
+        rf->next_query=NULL;
+      }else{
+        trace("The query of the next chunk could not be sent: %s", mysql_error(rf->conn));
+        throttle_control_release();
+      }
+    }
+    g_free(rf->next_query);
+    rf->next_query=NULL;
+  }
+  // An empty batch is the end of the result set
+  g_async_queue_push(rf->ready, batch);
+}
+
+static
+void discard_prefetched_result_of_conn(MYSQL *conn){
+  if (thread_row_fetcher && thread_row_fetcher->conn == conn)
+    row_fetcher_discard_prefetched(thread_row_fetcher);
+}
+
+// The fetcher itself on the start queue asks the thread to exit
+static
+void *row_fetcher_thread(struct row_fetcher *rf){
+  while (g_async_queue_pop(rf->start) != rf)
+    fetch_result(rf);
+  mysql_thread_end();
+  return NULL;
+}
+
+struct row_fetcher *new_row_fetcher(MYSQL *conn){
+  struct row_fetcher *rf=g_new0(struct row_fetcher, 1);
+  guint i;
+  rf->conn=conn;
+  thread_row_fetcher=rf;
+  before_query=discard_prefetched_result_of_conn;
+  rf->start=g_async_queue_new();
+  rf->ready=g_async_queue_new();
+  rf->free=g_async_queue_new();
+  for (i = 0; i < ROW_FETCHER_BATCHES; i++){
+    struct row_batch *batch=g_new0(struct row_batch, 1);
+    batch->data=g_string_sized_new(statement_size + statement_size/10);
+    batch->offsets=g_array_new(FALSE, FALSE, sizeof(gssize));
+    batch->lengths=g_array_new(FALSE, FALSE, sizeof(gulong));
+    g_async_queue_push(rf->free, batch);
+  }
+  rf->thread=g_thread_new("row_fetcher", (GThreadFunc)row_fetcher_thread, rf);
+  return rf;
+}
+
+void start_row_fetcher(struct row_fetcher *rf, MYSQL_RES *result, guint num_fields){
+  rf->result=result;
+  if (rf->num_fields != num_fields){
+    g_free(rf->row);
+    rf->row=g_new(gchar *, num_fields);
+    rf->num_fields=num_fields;
+  }
+  rf->current=NULL;
+  rf->position=0;
+  g_atomic_int_set(&(rf->abort), 0);
+  g_async_queue_push(rf->start, result);
+}
+
+// Called before the result set is started, the fetcher owns the query
+void row_fetcher_prefetch(struct row_fetcher *rf, gchar *query){
+  g_free(rf->next_query);
+  rf->next_query=query;
+}
+
+// The prefetched result when it is the one of query, otherwise it is discarded
+MYSQL_RES *row_fetcher_take_prefetched(struct row_fetcher *rf, const gchar *query){
+  MYSQL_RES *result=NULL;
+  if (rf->next_result && !g_strcmp0(rf->next_result_query, query)){
+    result=rf->next_result;
+    rf->next_result=NULL;
+    g_free(rf->next_result_query);
+    rf->next_result_query=NULL;
+  }
+  row_fetcher_discard_prefetched(rf);
+  return result;
+}
+
+// mysql_free_result() reads the rows that were not received
+void row_fetcher_discard_prefetched(struct row_fetcher *rf){
+  if (rf->next_result == NULL)
+    return;
+  trace("Discarding the result of the next chunk: %s", rf->next_result_query);
+  mysql_free_result(rf->next_result);
+  rf->next_result=NULL;
+  g_free(rf->next_result_query);
+  rf->next_result_query=NULL;
+  throttle_control_release();
+}
+
+MYSQL_ROW row_fetcher_next(struct row_fetcher *rf, gulong **lengths){
+  if (rf->current != NULL && rf->position >= rf->current->num_rows){
+    if (rf->current->num_rows == 0)
+      return NULL;
+    g_async_queue_push(rf->free, rf->current);
+    rf->current=NULL;
+  }
+  if (rf->current == NULL){
+    rf->current=g_async_queue_pop(rf->ready);
+    rf->position=0;
+    if (rf->current->num_rows == 0)
+      return NULL;
+  }
+  gssize *offsets=&g_array_index(rf->current->offsets, gssize, rf->position * rf->num_fields);
+  guint i;
+  for (i = 0; i < rf->num_fields; i++)
+    rf->row[i]= offsets[i] < 0 ? NULL : rf->current->data->str + offsets[i];
+  *lengths=&g_array_index(rf->current->lengths, gulong, rf->position * rf->num_fields);
+  rf->position++;
+  return rf->row;
+}
+
+// Waits for the end of the result set, the rows that were not consumed are discarded
+void stop_row_fetcher(struct row_fetcher *rf){
+  g_atomic_int_set(&(rf->abort), 1);
+  while (rf->current == NULL || rf->current->num_rows > 0){
+    if (rf->current)
+      g_async_queue_push(rf->free, rf->current);
+    rf->current=g_async_queue_pop(rf->ready);
+  }
+  g_async_queue_push(rf->free, rf->current);
+  rf->current=NULL;
+  rf->result=NULL;
+}
+
+void free_row_fetcher(struct row_fetcher *rf){
+  struct row_batch *batch;
+  g_async_queue_push(rf->start, rf);
+  g_thread_join(rf->thread);
+  row_fetcher_discard_prefetched(rf);
+  if (thread_row_fetcher == rf)
+    thread_row_fetcher=NULL;
+  while ((batch=g_async_queue_try_pop(rf->free))){
+    g_string_free(batch->data, TRUE);
+    g_array_free(batch->offsets, TRUE);
+    g_array_free(batch->lengths, TRUE);
+    g_free(batch);
+  }
+  g_async_queue_unref(rf->start);
+  g_async_queue_unref(rf->ready);
+  g_async_queue_unref(rf->free);
+  g_free(rf->row);
+  g_free(rf->next_query);
+  g_free(rf->result_error);
+  g_free(rf);
+}
@@ -0,0 +1,66 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+#if !defined(mydumper_mydumper_row_fetcher)
+#define mydumper_mydumper_row_fetcher
+
+#include <mysql.h>
+#include <glib.h>
+
+#define ROW_FETCHER_BATCHES 4
+#define ROW_BATCH_MAX_ROWS 10000
+
+// Rows copied out of the result set, values are NUL terminated
+struct row_batch {
+  GString *data;
+  // per column, -1 means NULL
+  GArray *offsets;
+  GArray *lengths;
+  guint num_rows;
+};
+
+struct row_fetcher {
+  MYSQL *conn;
+  MYSQL_RES *result;
+  guint num_fields;
+  // error of the result set, the connection might be running the next query
+  guint result_errno;
+  gchar *result_error;
+  // query of the next chunk, sent when the result set was read
+  gchar *next_query;
+  MYSQL_RES *next_result;
+  gchar *next_result_query;
+  // result sets to fetch
+  GAsyncQueue *start;
+  GAsyncQueue *ready;
+  GAsyncQueue *free;
+  GThread *thread;
+  gint abort;
+  // batch that is being consumed
+  struct row_batch *current;
+  guint position;
+  MYSQL_ROW row;
+};
+
+struct row_fetcher *new_row_fetcher(MYSQL *conn);
+void start_row_fetcher(struct row_fetcher *rf, MYSQL_RES *result, guint num_fields);
+void row_fetcher_prefetch(struct row_fetcher *rf, gchar *query);
+MYSQL_RES *row_fetcher_take_prefetched(struct row_fetcher *rf, const gchar *query);
+void row_fetcher_discard_prefetched(struct row_fetcher *rf);
+MYSQL_ROW row_fetcher_next(struct row_fetcher *rf, gulong **lengths);
+void stop_row_fetcher(struct row_fetcher *rf);
+void free_row_fetcher(struct row_fetcher *rf);
+#endif
@@ -0,0 +1,250 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+/* With --sample the tables are split in SAMPLE_RANGES strata over the range
+   of the first integer column of the key, and a sub-range of each stratum
+   is dumped, so only those index ranges are read. The sub-ranges only
+   depend on the table name, its MIN/MAX and --sample-seed, which lets any
+   other table compute them: with --sample-follow-fk the tables that
+   reference the PRIMARY KEY of a table without foreign keys keep the rows
+   whose parents were sampled, instead of being sampled themselves. Tables
+   without an integer key get the first rows. */
+
+#include <stdlib.h>
+#include <string.h>
+#include "mydumper.h"
+#include "mydumper_global.h"
+#include "mydumper_common.h"
+#include "mydumper_database.h"
+#include "mydumper_table.h"
+#include "mydumper_integer_chunks.h"
+#include "mydumper_sample.h"
+
+gdouble sample_percent=0;
+gboolean sample_follow_fk=FALSE;
+guint sample_seed=0;
+
+gboolean is_sampled_dump(){
+  return sample_percent > 0 && sample_percent < 100;
+}
+
+/* Fills from and to with the offsets from the minimum of the sub-ranges,
+ * returns how many there are */
+static
+guint get_sample_ranges(const gchar *database, const gchar *table, guint64 range, guint64 *from, guint64 *to){
+  guint64 total= range < G_MAXUINT64 ? range + 1 : range;
+  guint64 sampled= (guint64)((gdouble)total * sample_percent / 100);
+  if (sampled == 0)
+    sampled=1;
+  guint n= sampled < SAMPLE_RANGES ? sampled : SAMPLE_RANGES;
+  guint64 width=sampled / n, stratum=total / n, i;
+  GRand *rand=g_rand_new_with_seed(sample_seed ^ g_str_hash(database) ^ (g_str_hash(table) * 31));
+  for (i = 0; i < n; i++){
+    from[i]=i * stratum + (stratum > width ? (guint64)(g_rand_double(rand) * (stratum - width)) : 0);
+    to[i]=from[i] + width - 1;
+  }
+  g_rand_free(rand);
+  return n;
+}
+
+static
+void append_sample_ranges(GString *where, const gchar *field, gboolean is_unsigned, guint64 min, guint64 *from, guint64 *to, guint n){
+  guint i;
+  for (i = 0; i < n; i++){
+    if (is_unsigned)
+      g_string_append_printf(where, " OR %s%s%s BETWEEN %"G_GUINT64_FORMAT" AND %"G_GUINT64_FORMAT,
+                             identifier_quote_character_str, field, identifier_quote_character_str, min + from[i], min + to[i]);
+    else
+      g_string_append_printf(where, " OR %s%s%s BETWEEN %"G_GINT64_FORMAT" AND %"G_GINT64_FORMAT,
+                             identifier_quote_character_str, field, identifier_quote_character_str, (gint64)(min + from[i]), (gint64)(min + to[i]));
+  }
+}
+
+/* Same MIN/MAX than initialize_chunk_step_item(), min is returned as the
+ * unsigned representation of the value */
+static
+gboolean get_integer_min_max(MYSQL *conn, const gchar *database, const gchar *table, const gchar *field, gboolean *is_unsigned, guint64 *min, guint64 *range){
+  gchar *query=NULL;
+  gboolean found=FALSE;
+  struct M_ROW *mr = m_store_result_row(conn, query = g_strdup_printf(
+                        "SELECT %s MIN(%s%s%s),MAX(%s%s%s) FROM %s%s%s.%s%s%s %s %s",
+                        is_mysql_like()? "/*!40001 SQL_NO_CACHE */":"",
+                        identifier_quote_character_str, field, identifier_quote_character_str, identifier_quote_character_str, field, identifier_quote_character_str,
+                        identifier_quote_character_str, database, identifier_quote_character_str, identifier_quote_character_str, table, identifier_quote_character_str,
+                        where_option ? "WHERE" : "", where_option ? where_option : ""),
+                        m_warning, m_warning, "Failed to get the range of %s.%s", database, table);
+  g_free(query);
+  if (mr->res && mr->row && mr->row[0] && mr->row[1]){
+    MYSQL_FIELD *fields = mysql_fetch_fields(mr->res);
+    switch (fields[0].type){
+      case MYSQL_TYPE_TINY:
+      case MYSQL_TYPE_SHORT:
+      case MYSQL_TYPE_LONG:
+      case MYSQL_TYPE_LONGLONG:
+      case MYSQL_TYPE_INT24:
+        *is_unsigned= fields[0].flags & UNSIGNED_FLAG;
+        if (*is_unsigned){
+          *min=strtoull(mr->row[0], NULL, 10);
+          *range=strtoull(mr->row[1], NULL, 10) - *min;
+        }else{
+          *min=(guint64)strtoll(mr->row[0], NULL, 10);
+          *range=(guint64)strtoll(mr->row[1], NULL, 10) - *min;
+        }
+        found=TRUE;
+        break;
+      default:
+        break;
+    }
+  }
+  m_store_result_row_free(mr);
+  return found;
+}
+
+static
+void add_where_on_dbt(struct db_table *dbt, const gchar *condition){
+  // dbt->where belongs to conf_per_table, it is not freed
+  dbt->where= dbt->where ? g_strdup_printf("(%s) AND (%s)", dbt->where, condition) : g_strdup(condition);
+}
+
+static
+gboolean append_integer_sample(MYSQL *conn, GString *where, const gchar *database, const gchar *table, const gchar *field, const gchar *column){
+  gboolean is_unsigned=FALSE;
+  guint64 min=0, range=0, from[SAMPLE_RANGES], to[SAMPLE_RANGES];
+  if (!get_integer_min_max(conn, database, table, field, &is_unsigned, &min, &range))
+    return FALSE;
+  guint n=get_sample_ranges(database, table, range, from, to);
+  append_sample_ranges(where, column, is_unsigned, min, from, to, n);
+  return TRUE;
+}
+
+/* Single column foreign keys to the first column of the PRIMARY KEY of
+ * tables that have no foreign keys of their own, so the parents are sampled
+ * by range. Returns TRUE when the rows of dbt are filtered by them */
+gboolean sample_by_foreign_keys(MYSQL *conn, struct db_table *dbt){
+  gchar *query=NULL;
+  MYSQL_RES *res=m_store_result(conn, query=g_strdup_printf(
+      "SELECT k.COLUMN_NAME, k.REFERENCED_TABLE_SCHEMA, k.REFERENCED_TABLE_NAME, k.REFERENCED_COLUMN_NAME "
+      "FROM information_schema.KEY_COLUMN_USAGE k JOIN information_schema.KEY_COLUMN_USAGE p "
+        "ON p.TABLE_SCHEMA=k.REFERENCED_TABLE_SCHEMA AND p.TABLE_NAME=k.REFERENCED_TABLE_NAME AND p.COLUMN_NAME=k.REFERENCED_COLUMN_NAME "
+        "AND p.CONSTRAINT_NAME='PRIMARY' AND p.ORDINAL_POSITION=1 "
+      "WHERE k.TABLE_SCHEMA='%s' AND k.TABLE_NAME='%s' AND k.REFERENCED_TABLE_NAME IS NOT NULL "
+        "AND NOT (k.REFERENCED_TABLE_SCHEMA=k.TABLE_SCHEMA AND k.REFERENCED_TABLE_NAME=k.TABLE_NAME) "
+        "AND (SELECT COUNT(*) FROM information_schema.KEY_COLUMN_USAGE c WHERE c.CONSTRAINT_SCHEMA=k.CONSTRAINT_SCHEMA "
+          "AND c.TABLE_NAME=k.TABLE_NAME AND c.CONSTRAINT_NAME=k.CONSTRAINT_NAME)=1 "
+        "AND NOT EXISTS (SELECT 1 FROM information_schema.KEY_COLUMN_USAGE g WHERE g.TABLE_SCHEMA=k.REFERENCED_TABLE_SCHEMA "
+          "AND g.TABLE_NAME=k.REFERENCED_TABLE_NAME AND g.REFERENCED_TABLE_NAME IS NOT NULL "
+          "AND NOT (g.REFERENCED_TABLE_SCHEMA=g.TABLE_SCHEMA AND g.REFERENCED_TABLE_NAME=g.TABLE_NAME))",
+      dbt->database->source_database_escaped, dbt->escaped_table), m_warning, "Failed to get the foreign keys of %s.%s", dbt->database->source_database, dbt->table);
+  g_free(query);
+  if (!res)
+    return FALSE;
+  MYSQL_ROW row;
+  GString *condition=g_string_new("");
+  GString *ranges=g_string_new("");
+  guint parents=0;
+  while ((row = mysql_fetch_row(res))){
+    gchar *column=identifier_quote_character_protect(row[0]);
+    gchar *parent_table=identifier_quote_character_protect(row[2]);
+    gchar *parent_column=identifier_quote_character_protect(row[3]);
+    g_string_set_size(ranges, 0);
+    if (append_integer_sample(conn, ranges, row[1], parent_table, parent_column, column)){
+      // rows without parent are kept
+      g_string_append_printf(condition, "%s(%s%s%s IS NULL%s)", parents ? " AND " : "",
+                             identifier_quote_character_str, column, identifier_quote_character_str, ranges->str);
+      parents++;
+    }
+    g_free(column);
+    g_free(parent_table);
+    g_free(parent_column);
+  }
+  mysql_free_result(res);
+  if (parents > 0){
+    g_message("%s.%s is sampled following %u foreign keys", dbt->database->source_database, dbt->table, parents);
+    add_where_on_dbt(dbt, condition->str);
+  }
+  g_string_free(condition, TRUE);
+  g_string_free(ranges, TRUE);
+  return parents > 0;
+}
+
+/* The chunk keeps the first sub-range and a new chunk is returned for each
+ * of the others */
+GList *sample_integer_step_item(struct db_table *dbt, struct chunk_step_item *csi){
+  struct integer_step *ics=&(csi->chunk_step->integer_step);
+  GList *seeds=NULL;
+  guint64 min= ics->is_unsigned ? ics->type.unsign.min : (guint64)ics->type.sign.min;
+  guint64 range= ics->is_unsigned ?
+                 ics->type.unsign.max - ics->type.unsign.min :
+                 (guint64)ics->type.sign.max - (guint64)ics->type.sign.min;
+  guint64 from[SAMPLE_RANGES], to[SAMPLE_RANGES];
+  guint n=get_sample_ranges(dbt->database->source_database, dbt->table, range, from, to), i;
+  guint64 rows=(guint64)(ics->rows_in_explain * sample_percent / 100) / n;
+  // The seeds are the leaves of the split tree at this depth, so next splits
+  // keep the part numbers unique
+  guint deep=0;
+  while ((1U << deep) < n)
+    deep++;
+  union type type;
+  for (i = 1; i < n; i++){
+    if (ics->is_unsigned){
+      type.unsign.min=min + from[i];
+      type.unsign.max=min + to[i];
+    }else{
+      type.sign.min=(gint64)(min + from[i]);
+      type.sign.max=(gint64)(min + to[i]);
+    }
+    struct chunk_step_item *seed=new_integer_step_item(FALSE, csi->prefix, csi->field, ics->is_unsigned, type, deep, ics->is_step_fixed_length, ics->step, ics->min_chunk_step_size, ics->max_chunk_step_size, i, FALSE, FALSE, NULL, csi->position, FALSE, rows);
+    update_where_on_integer_step(seed);
+    seeds=g_list_append(seeds, seed);
+  }
+  if (ics->is_unsigned){
+    ics->type.unsign.min=min + from[0];
+    ics->type.unsign.cursor=ics->type.unsign.min;
+    ics->type.unsign.max=min + to[0];
+  }else{
+    ics->type.sign.min=(gint64)(min + from[0]);
+    ics->type.sign.cursor=ics->type.sign.min;
+    ics->type.sign.max=(gint64)(min + to[0]);
+  }
+  ics->check_min=FALSE;
+  ics->check_max=FALSE;
+  ics->estimated_remaining_steps=ics->step > 0 ? (to[0] - from[0]) / ics->step : 1;
+  ics->rows_in_explain=rows;
+  csi->include_null=FALSE;
+  csi->deep=deep;
+  update_where_on_integer_step(csi);
+  g_message("%s.%s is sampled on %u ranges of %s", dbt->database->source_database, dbt->table, n, csi->field);
+  return seeds;
+}
+
+/* Tables that are not split: the sub-ranges go on the WHERE when the first
+ * column of the key is an integer, otherwise the first rows are dumped */
+void sample_whole_table(MYSQL *conn, struct db_table *dbt, guint64 rows){
+  gchar *field=g_list_nth_data(dbt->primary_key, 0);
+  GString *ranges=g_string_new("");
+  if (field && append_integer_sample(conn, ranges, dbt->database->source_database, dbt->table, field, field)){
+    // the ranges are appended as " OR ...", FALSE keeps them as they are
+    gchar *condition=g_strdup_printf("FALSE%s", ranges->str);
+    add_where_on_dbt(dbt, condition);
+    g_free(condition);
+  }else if (dbt->limit == NULL){
+    guint64 limit=(guint64)((gdouble)rows * sample_percent / 100);
+    dbt->limit=g_strdup_printf("%"G_GUINT64_FORMAT, limit > 0 ? limit : 1);
+    g_message("%s.%s has no integer key, the first %s rows are sampled", dbt->database->source_database, dbt->table, dbt->limit);
+  }
+  g_string_free(ranges, TRUE);
+}
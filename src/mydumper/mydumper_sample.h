@@ -0,0 +1,31 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+#if !defined(mydumper_mydumper_sample)
+#define mydumper_mydumper_sample
+
+#include <mysql.h>
+#include <glib.h>
+#include "mydumper_chunks.h"
+
+// Sub-ranges of the integer key that are read from each table
+#define SAMPLE_RANGES 64
+
+gboolean is_sampled_dump();
+gboolean sample_by_foreign_keys(MYSQL *conn, struct db_table *dbt);
+GList *sample_integer_step_item(struct db_table *dbt, struct chunk_step_item *csi);
+void sample_whole_table(MYSQL *conn, struct db_table *dbt, guint64 rows);
+#endif
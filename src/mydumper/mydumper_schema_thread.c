@@ -0,0 +1,161 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#include <mysql.h>
+#include <glib.h>
+
+#include "mydumper_start_dump.h"
+#include "mydumper_jobs.h"
+#include "mydumper_global.h"
+#include "mydumper_working_thread.h"
+#include "mydumper_schema_thread.h"
+#include "mydumper_job_queue.h"
+
+// SHOW CREATE TABLE statements sent on each round trip
+#define SCHEMA_BATCH_SIZE 64
+
+guint num_schema_threads=0;
+
+static struct job_queue *schema_thread_queue=NULL;
+static GThread **schema_threads=NULL;
+static struct thread_data *schema_thread_data=NULL;
+static guint schema_threads_running=0;
+
+static
+gboolean process_schema_job(struct thread_data *td, struct job *job){
+  enum job_type type=job->type;
+  struct report_mark mark;
+  report_start(&mark);
+  switch (job->type) {
+    case JOB_VIEW:
+      do_JOB_VIEW(td, job);
+      break;
+    case JOB_TRIGGERS:
+      do_JOB_TRIGGERS(td, job);
+      break;
+    case JOB_SHUTDOWN:
+      g_free(job);
+      return FALSE;
+    default:
+      m_error("Schema thread received job type %d", job->type);
+  }
+  report_job(type, &mark);
+  return TRUE;
+}
+
+static
+void *schema_thread(struct thread_data *td){
+  set_thread_affinity(AFFINITY_SCHEMA);
+  struct job **batch=g_new(struct job *, SCHEMA_BATCH_SIZE);
+  struct job *job=NULL, *other=NULL;
+  guint n=0;
+  gboolean cont=TRUE;
+  struct report_mark mark;
+  connect_worker(td);
+  while (cont){
+    job=job_queue_pop(schema_thread_queue);
+    if (shutdown_triggered && job->type != JOB_SHUTDOWN)
+      continue;
+    if (job->type != JOB_SCHEMA){
+      cont=process_schema_job(td, job);
+      continue;
+    }
+    // the schemas waiting in the queue go in the same round trip
+    n=0;
+    batch[n++]=job;
+    other=NULL;
+    while (n < SCHEMA_BATCH_SIZE && (job=job_queue_try_pop(schema_thread_queue))){
+      if (job->type != JOB_SCHEMA){
+        other=job;
+        break;
+      }
+      batch[n++]=job;
+    }
+    report_start(&mark);
+    do_JOB_SCHEMA_BATCH(td, batch, n);
+    report_job(JOB_SCHEMA, &mark);
+    if (other)
+      cont=process_schema_job(td, other);
+  }
+  g_message("Thread %d: Schema thread shutting down", td->thread_id);
+  mysql_close(td->thrconn);
+  mysql_thread_end();
+  g_free(batch);
+  return NULL;
+}
+
+void start_schema_threads(struct configuration *conf, gboolean ddl_locked){
+  guint n;
+  schema_threads_running=0;
+  if (num_schema_threads == 0 || no_schemas)
+    return;
+  // the working threads keep the metadata lock of the tables they inspected
+  // until they finish, other connections only get the same guarantee from
+  // the DDL lock
+  if (!ddl_locked && !no_data){
+    g_warning("--schema-threads needs a DDL lock or --no-data, the schemas are dumped by the working threads");
+    return;
+  }
+  if (stream){
+    g_warning("--schema-threads is not compatible with --stream, the schemas are dumped by the working threads");
+    return;
+  }
+  // the working threads wait while the schema threads are behind
+  if (!schema_thread_queue)
+    schema_thread_queue=job_queue_new(max_queued_jobs, (guint64)max_queued_jobs_memory * 1024 * 1024);
+  schema_threads=g_new(GThread *, num_schema_threads);
+  schema_thread_data=g_new0(struct thread_data, num_schema_threads);
+  g_message("Creating %u schema threads", num_schema_threads);
+  for (n = 0; n < num_schema_threads; n++) {
+    schema_thread_data[n].conf=conf;
+    schema_thread_data[n].thread_id=num_threads + n + 1;
+    schema_threads[n]=m_thread_new("schema", (GThreadFunc)schema_thread, &schema_thread_data[n], "Schema thread could not be created");
+  }
+  schema_threads_running=num_schema_threads;
+}
+
+gboolean schema_threads_enabled(){
+  return schema_threads_running > 0;
+}
+
+void schema_threads_push(struct job *job){
+  job_queue_push(schema_thread_queue, job);
+}
+
+// the jobs were all pushed before, so the shutdowns are the last ones popped
+void shutdown_schema_threads(){
+  guint n;
+  for (n = 0; n < schema_threads_running; n++) {
+    struct job *j = g_new0(struct job, 1);
+    j->type = JOB_SHUTDOWN;
+    job_queue_push(schema_thread_queue, j);
+  }
+}
+
+void wait_schema_threads_to_finish(){
+  guint n;
+  if (!schema_threads_running)
+    return;
+  g_message("Waiting schema threads to complete");
+  for (n = 0; n < schema_threads_running; n++)
+    g_thread_join(schema_threads[n]);
+  g_free(schema_threads);
+  schema_threads=NULL;
+  g_free(schema_thread_data);
+  schema_thread_data=NULL;
+  schema_threads_running=0;
+}
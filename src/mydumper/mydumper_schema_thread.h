@@ -0,0 +1,33 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#ifndef _src_mydumper_schema_thread_h
+#define _src_mydumper_schema_thread_h
+#include <glib.h>
+
+/* With --schema-threads the table schemas, views and triggers are dumped by
+   their own connections instead of the working threads. The SHOW CREATE
+   TABLE of consecutive jobs are sent together in one multi-statement */
+struct job;
+struct configuration;
+
+void start_schema_threads(struct configuration *conf, gboolean ddl_locked);
+gboolean schema_threads_enabled();
+void schema_threads_push(struct job *job);
+void shutdown_schema_threads();
+void wait_schema_threads_to_finish();
+#endif
@@ -0,0 +1,251 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/wait.h>
+#include <glib/gstdio.h>
+#include "mydumper.h"
+#include "mydumper_global.h"
+#include "mydumper_shards.h"
+
+gchar *shard_hosts=NULL;
+guint shard_parallel=4;
+
+struct shard{
+  gchar *host;
+  guint port;
+  gchar *directory;
+  gint status;
+  gdouble seconds;
+};
+
+static GAsyncQueue *shard_queue=NULL;
+static gchar **child_argv_template=NULL;
+static guint child_argc=0;
+static gchar **child_envp=NULL;
+
+gboolean shard_hosts_in_use(){
+  return shard_hosts != NULL;
+}
+
+// the options of the scheduler are not passed to the dumps, nor the
+// password, which is passed in the environment
+static
+gboolean is_shard_option(const gchar *arg, gboolean *takes_value){
+  *takes_value=FALSE;
+  if (g_str_has_prefix(arg, "--shard-hosts=") || g_str_has_prefix(arg, "--shard-parallel=") ||
+      g_str_has_prefix(arg, "--password=") || (g_str_has_prefix(arg, "-p") && strlen(arg) > 2 && arg[1] != '-') ||
+      !g_strcmp0(arg, "--ask-password") || !g_strcmp0(arg, "-a"))
+    return TRUE;
+  if (!g_strcmp0(arg, "--shard-hosts") || !g_strcmp0(arg, "--shard-parallel") ||
+      !g_strcmp0(arg, "--password") || !g_strcmp0(arg, "-p")){
+    *takes_value=TRUE;
+    return TRUE;
+  }
+  return FALSE;
+}
+
+// the dumps are executed with this same binary, not with the first
+// mydumper in the PATH
+static
+gchar *get_executable(const gchar *argv0){
+  gchar *executable=g_file_read_link("/proc/self/exe", NULL);
+  if (executable)
+    return executable;
+  if (g_path_is_absolute(argv0))
+    return g_strdup(argv0);
+  if (strchr(argv0, G_DIR_SEPARATOR)){
+    gchar *current_dir=g_get_current_dir();
+    executable=g_build_filename(current_dir, argv0, NULL);
+    g_free(current_dir);
+    return executable;
+  }
+  executable=g_find_program_in_path(argv0);
+  if (!executable)
+    m_critical("Could not find the path of %s to execute the shards", argv0);
+  return executable;
+}
+
+static
+void build_child_argv_template(int argc, char *argv[]){
+  int i;
+  gboolean takes_value;
+  GPtrArray *args=g_ptr_array_new();
+  g_ptr_array_add(args, get_executable(argv[0]));
+  for (i = 1; i < argc; i++){
+    if (is_shard_option(argv[i], &takes_value)){
+      if (takes_value)
+        i++;
+      continue;
+    }
+    g_ptr_array_add(args, g_strdup(argv[i]));
+  }
+  child_argc=args->len;
+  g_ptr_array_add(args, NULL);
+  child_argv_template=(gchar **)g_ptr_array_free(args, FALSE);
+  // MYSQL_PWD is not visible in ps or /proc/<pid>/cmdline like --password
+  child_envp=g_get_environ();
+  if (password)
+    child_envp=g_environ_setenv(child_envp, "MYSQL_PWD", password, TRUE);
+}
+
+// the options that are added at the end override the ones of the template
+static
+gchar **build_child_argv(struct shard *s){
+  guint i;
+  gchar **child_argv=g_new0(gchar *, child_argc + 7);
+  for (i = 0; i < child_argc; i++)
+    child_argv[i]=child_argv_template[i];
+  child_argv[i++]="--host";
+  child_argv[i++]=s->host;
+  if (s->port){
+    child_argv[i++]="--port";
+    child_argv[i++]=g_strdup_printf("%u", s->port);
+  }
+  child_argv[i++]="--outputdir";
+  child_argv[i++]=s->directory;
+  return child_argv;
+}
+
+static
+void *shard_thread(void *data){
+  (void) data;
+  struct shard *s=NULL;
+  GError *error=NULL;
+  while ((s=g_async_queue_pop(shard_queue)) != GINT_TO_POINTER(-1)){
+    gchar **child_argv=build_child_argv(s);
+    g_message("Shard %s:%u: dumping into %s", s->host, s->port, s->directory);
+    gint64 start=g_get_monotonic_time();
+    if (!g_spawn_sync(NULL, child_argv, child_envp, G_SPAWN_CHILD_INHERITS_STDIN, NULL, NULL, NULL, NULL, &(s->status), &error)){
+      g_critical("Shard %s:%u: mydumper could not be executed: %s", s->host, s->port, error->message);
+      g_clear_error(&error);
+      s->status=-1;
+    }
+    s->seconds=(gdouble)(g_get_monotonic_time() - start) / G_USEC_PER_SEC;
+    if (s->status == 0)
+      g_message("Shard %s:%u: completed in %.1f seconds", s->host, s->port, s->seconds);
+    else{
+      g_critical("Shard %s:%u: failed after %.1f seconds with status %d", s->host, s->port, s->seconds,
+                 s->status > 0 && WIFEXITED(s->status) ? WEXITSTATUS(s->status) : s->status);
+      errors++;
+    }
+    if (s->port)
+      g_free(child_argv[child_argc + 3]);
+    g_free(child_argv);
+  }
+  return NULL;
+}
+
+static
+gchar *build_shard_directory(const gchar *host, guint port){
+  gchar *name= port ? g_strdup_printf("%s_%u", host, port) : g_strdup(host);
+  g_strdelimit(name, "/\\", '_');
+  gchar *directory=g_build_filename(output_directory, name, NULL);
+  g_free(name);
+  return directory;
+}
+
+static
+void write_shards_metadata(struct shard *shards, guint n){
+  guint i;
+  gchar *filename=g_build_filename(output_directory, SHARDS_METADATA, NULL);
+  FILE *file=g_fopen(filename, "w");
+  if (!file){
+    g_critical("Could not create %s: %s", filename, strerror(errno));
+    errors++;
+    g_free(filename);
+    return;
+  }
+  for (i = 0; i < n; i++){
+    gchar *basename=g_path_get_basename(shards[i].directory);
+    fprintf(file, "[%s]\nhost = %s\nport = %u\nstatus = %d\nseconds = %.1f\n\n", basename,
+        shards[i].host, shards[i].port, shards[i].status, shards[i].seconds);
+    g_free(basename);
+  }
+  fclose(file);
+  g_free(filename);
+}
+
+/* Returns the exit code of the run. The shards are taken in the order of the
+   list by the first free slot, so a slow shard does not hold the others */
+int run_shards(int argc, char *argv[]){
+  guint i, n=0;
+  if (stream || daemon_mode)
+    m_critical("--shard-hosts is not compatible with --stream or --daemon");
+  if (shard_parallel == 0)
+    shard_parallel=1;
+  gchar **list=g_strsplit(shard_hosts, ",", 0);
+  struct shard *shards=g_new0(struct shard, g_strv_length(list));
+  for (i = 0; list[i]; i++){
+    gchar *host=g_strstrip(list[i]);
+    if (*host == '\0')
+      continue;
+    gchar *colon=g_strrstr(host, ":");
+    struct shard *s=&(shards[n++]);
+    if (colon){
+      *colon='\0';
+      s->port=strtoul(colon + 1, NULL, 10);
+    }
+    s->host=g_strdup(host);
+    s->directory=build_shard_directory(s->host, s->port);
+  }
+  g_strfreev(list);
+  if (n == 0)
+    m_critical("--shard-hosts has no hosts");
+
+  ask_password();
+  build_child_argv_template(argc, argv);
+  hide_password(argc, argv);
+  create_dir(output_directory);
+  shard_queue=g_async_queue_new();
+  for (i = 0; i < n; i++)
+    g_async_queue_push(shard_queue, &(shards[i]));
+  guint num_slots= shard_parallel < n ? shard_parallel : n;
+  GThread **slots=g_new(GThread *, num_slots);
+  g_message("Dumping %u shards, %u at the same time with %u threads each", n, num_slots, num_threads);
+  for (i = 0; i < num_slots; i++){
+    g_async_queue_push(shard_queue, GINT_TO_POINTER(-1));
+    slots[i]=m_thread_new("shard", (GThreadFunc)shard_thread, NULL, "Shard thread could not be created");
+  }
+  for (i = 0; i < num_slots; i++)
+    g_thread_join(slots[i]);
+  g_free(slots);
+  g_async_queue_unref(shard_queue);
+
+  write_shards_metadata(shards, n);
+  guint failed=0;
+  for (i = 0; i < n; i++){
+    if (shards[i].status != 0)
+      failed++;
+    g_free(shards[i].host);
+    g_free(shards[i].directory);
+  }
+  g_free(shards);
+  g_strfreev(child_argv_template);
+  child_argv_template=NULL;
+  g_strfreev(child_envp);
+  child_envp=NULL;
+  if (failed){
+    g_critical("%u of %u shards failed", failed, n);
+    return EXIT_FAILURE;
+  }
+  g_message("All the %u shards were dumped", n);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,35 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#if !defined(mydumper_mydumper_shards)
+#define mydumper_mydumper_shards
+
+#include <glib.h>
+
+#define SHARDS_METADATA "metadata.shards"
+
+/* With --shard-hosts this process only schedules: every shard is dumped by a
+   mydumper with the same options into its own subdirectory of the output
+   directory, at most --shard-parallel at the same time. Each dump has its own
+   snapshot and metadata, the outcome of all of them is in SHARDS_METADATA.
+   The scheduling is by shard, not by table or chunk: the threads are not
+   shared between the shards and every shard reads its own catalog. A source
+   gets at most --threads connections, and the run at most --shard-parallel
+   times --threads */
+gboolean shard_hosts_in_use();
+int run_shards(int argc, char *argv[]);
+#endif
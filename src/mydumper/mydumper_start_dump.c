@@ -32,12 +32,24 @@
 #include "mydumper_working_thread.h"
 #include "mydumper_pmm.h"
 #include "mydumper_exec_command.h"
+#include "mydumper_upload.h"
 #include "mydumper_masquerade.h"
 #include "mydumper_chunks.h"
 #include "mydumper_write.h"
+#include "mydumper_incremental.h"
+#include "mydumper_content_store.h"
+#include "mydumper_file_manifest.h"
+#include "mydumper_bundle.h"
 #include "mydumper_global.h"
 #include "mydumper_create_jobs.h"
 #include "mydumper_file_handler.h"
+#include "mydumper_chunk_profile.h"
+#include "mydumper_catalog.h"
+#include "mydumper_schema_thread.h"
+#include "mydumper_replica_hosts.h"
+#include "mydumper_copy.h"
+#include "mydumper_transportable.h"
+#include "mydumper_binlog_delta.h"
 
 /* Program options */
 gchar *tidb_snapshot = NULL;
@@ -62,7 +74,7 @@ GList *schema_post = NULL;
 gboolean it_is_a_consistent_backup = FALSE;
 GHashTable *all_dbts=NULL;
 char * (*identifier_quote_character_protect)(char *r);
-struct configuration_per_table conf_per_table = {NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL};
+struct configuration_per_table conf_per_table = {NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL};
 gboolean replica_stopped = FALSE;
 gboolean merge_dumpdir= FALSE;
 gboolean clear_dumpdir= FALSE;
@@ -79,6 +91,10 @@ extern guint ftwrl_timeout_retries;
 static GMutex **pause_mutex_per_thread=NULL;
 static guint pause_at=0;
 static guint resume_at=0;
+// working threads allowed to take jobs by the disk space control
+static guint disk_allowed_threads=0;
+static GMutex *disk_allowed_mutex=NULL;
+static GCond *disk_allowed_cond=NULL;
 static gchar **db_items=NULL;
 static GRecMutex *ready_table_dump_mutex = NULL;
 static gboolean ftwrl_completed=FALSE;
@@ -90,7 +106,7 @@ void initialize_start_dump(){
 	initialize_conf_per_table(&conf_per_table);
 
   // until we have an unique option on lock types we need to ensure this
-  if (sync_thread_lock_mode==NO_LOCK || sync_thread_lock_mode==SAFE_NO_LOCK)
+  if (sync_thread_lock_mode==NO_LOCK || sync_thread_lock_mode==SAFE_NO_LOCK || sync_thread_lock_mode==BINLOG_DELTA)
     trx_tables=TRUE;
 
   // clarify binlog coordinates with --trx-tables
@@ -109,49 +125,88 @@ void set_disk_limits(guint p_at, guint r_at){
 }
 
 static
-gboolean is_disk_space_ok(guint val){
+gboolean get_available_disk_space(gdouble *available){
   struct statvfs buffer;
-  int ret = statvfs(output_directory, &buffer);
-  if (!ret) {
-    const double available = (double)(buffer.f_bfree * buffer.f_frsize) / 1024 / 1024;
-    return available > val;
-  }else{
+  if (statvfs(output_directory, &buffer)){
     g_warning("Disk space check failed");
+    return FALSE;
   }
+  *available = (gdouble)(buffer.f_bavail * buffer.f_frsize) / 1024 / 1024;
   return TRUE;
 }
 
-static
-void *monitor_disk_space_thread (void *queue){
-  (void)queue;
-  guint i=0;
-  GMutex **_pause_mutex_per_thread=g_new(GMutex * , num_threads) ;
-  for(i=0;i<num_threads;i++){
-    _pause_mutex_per_thread[i]=g_mutex_new();
+// Working threads with a higher thread_id wait until the disk space control lets them continue
+void wait_for_disk_space(guint thread_id){
+  if (!disk_allowed_mutex || thread_id > num_threads)
+    return;
+  g_mutex_lock(disk_allowed_mutex);
+  if (thread_id > disk_allowed_threads && !shutdown_triggered){
+    g_message("Thread %d: Waiting for disk space", thread_id);
+    while (thread_id > disk_allowed_threads && !shutdown_triggered)
+      g_cond_wait(disk_allowed_cond, disk_allowed_mutex);
   }
+  g_mutex_unlock(disk_allowed_mutex);
+}
 
-  gboolean previous_state = TRUE, current_state = TRUE;
+static
+void set_disk_allowed_threads(guint allowed){
+  g_mutex_lock(disk_allowed_mutex);
+  disk_allowed_threads=allowed;
+  g_cond_broadcast(disk_allowed_cond);
+  g_mutex_unlock(disk_allowed_mutex);
+}
 
-  while (disk_limits != NULL){
-    current_state = previous_state ? is_disk_space_ok(pause_at) : is_disk_space_ok(resume_at);
-    if (previous_state != current_state){
-      if (!current_state){
-        g_warning("Pausing backup disk space lower than %dMB. You need to free up to %dMB to resume",pause_at,resume_at);
-        for(i=0;i<num_threads;i++){
-          g_mutex_lock(_pause_mutex_per_thread[i]);
-          g_async_queue_push(queue,_pause_mutex_per_thread[i]);
-        }
-      }else{
-        g_warning("Resuming backup");
-        for(i=0;i<num_threads;i++){
-          g_mutex_unlock(_pause_mutex_per_thread[i]);
-        }
-      }
-      previous_state = current_state;
+/* Flow control over the free space. The space written minus the space freed
+   (uploads, --exec, removed files) is measured on every check and smoothed,
+   the free space projected DISK_PROJECTION_SECONDS ahead decides how many
+   working threads keep taking jobs: all of them over resume_at, none under
+   pause_at and proportionally in between. The amount of threads changes a
+   few at a time so the dump does not stop and start at each check. */
+#define DISK_CHECK_INTERVAL 1
+#define DISK_PROJECTION_SECONDS 30
 
+static
+void *monitor_disk_space_thread (void *data){
+  (void)data;
+  gdouble available=0, previous=0, consumed=0, rate=0, projected=0;
+  guint allowed=num_threads, target, max_change=num_threads/4 > 0 ? num_threads/4 : 1;
+  gboolean has_previous=FALSE;
+  set_disk_allowed_threads(allowed);
+  while (disk_limits != NULL && !shutdown_triggered){
+    if (get_available_disk_space(&available)){
+      if (has_previous){
+        consumed = (previous - available) / DISK_CHECK_INTERVAL;
+        // exponential moving average of the MB/s consumed, negative when freeing
+        rate = rate * 0.7 + consumed * 0.3;
+      }
+      previous=available;
+      has_previous=TRUE;
+      projected = available - (rate > 0 ? rate * DISK_PROJECTION_SECONDS : 0);
+      if (available <= pause_at || projected <= pause_at)
+        target = 0;
+      else if (projected >= resume_at)
+        target = num_threads;
+      else
+        target = (guint)(num_threads * (projected - pause_at) / (resume_at - pause_at));
+      // the whole dump only stops at once when there is no space left
+      if (target < allowed && available > pause_at && allowed - target > max_change)
+        target = allowed - max_change;
+      else if (target > allowed && target - allowed > max_change)
+        target = allowed + max_change;
+      if (target != allowed){
+        if (target == 0)
+          g_warning("Pausing backup, disk space %.0fMB lower than %dMB. You need to free up to %dMB to resume", available, pause_at, resume_at);
+        else if (allowed == 0)
+          g_warning("Resuming backup with %u threads, disk space %.0fMB", target, available);
+        else
+          g_message("Disk space %.0fMB consumed at %.1fMB/s, %u threads dumping", available, rate, target);
+        allowed=target;
+        set_disk_allowed_threads(allowed);
+      }
     }
-    sleep(10);
+    sleep(DISK_CHECK_INTERVAL);
   }
+  set_disk_allowed_threads(num_threads);
   return NULL;
 }
 
@@ -685,6 +740,33 @@ void determine_ddl_lock_function(MYSQL ** conn, void(**acquire_global_lock_funct
 
 // see write_database_on_disk() for db write to metadata
 
+/* Escaped as GKeyFile does, list items are also protected from the ';'
+ * separator so myloader can read them with g_key_file_get_string_list() */
+static
+void append_key_file_value(GString *data, const gchar *value, gboolean list_item){
+  const gchar *c;
+  for (c=value; *c; c++){
+    switch (*c){
+      case ' ':
+        // a leading space would be trimmed
+        g_string_append(data, c == value ? "\\s" : " ");
+        break;
+      case '\\': g_string_append(data, "\\\\"); break;
+      case '\n': g_string_append(data, "\\n"); break;
+      case '\r': g_string_append(data, "\\r"); break;
+      case '\t': g_string_append(data, "\\t"); break;
+      case ';':
+        if (list_item)
+          g_string_append_c(data, '\\');
+        g_string_append_c(data, ';');
+        break;
+      default: g_string_append_c(data, *c);
+    }
+  }
+  if (list_item)
+    g_string_append_c(data, ';');
+}
+
 void print_dbt_on_metadata_gstring(struct db_table *dbt, GString *data){
   char *name= newline_protect(dbt->database->source_database);
   char *table= newline_protect(dbt->table);
@@ -697,8 +779,52 @@ void print_dbt_on_metadata_gstring(struct db_table *dbt, GString *data){
   g_free(table);
   if (dbt->is_sequence)
     g_string_append_printf(data,"is_sequence = 1\n");
+  if (dbt->statement_size)
+    g_string_append_printf(data,"statement_size = %u\nstatement_max_rows = %"G_GUINT64_FORMAT"\n", dbt->statement_size, dbt->statement_max_rows);
   if (dbt->data_checksum)
     g_string_append_printf(data,"data_checksum = %s\n", dbt->data_checksum);
+  if (dbt->chunk_checksum_list){
+    // checksum;rows;partition;where;files...
+    guint n=0;
+    g_string_append(data, "chunk_checksum_expression = ");
+    append_key_file_value(data, dbt->chunk_checksum_expression, FALSE);
+    g_string_append_c(data, '\n');
+    for (GList *l=g_list_last(dbt->chunk_checksum_list); l; l=l->prev){
+      struct chunk_checksum *cc=l->data;
+      g_string_append_printf(data, "chunk_checksum_%u = %s;%"G_GUINT64_FORMAT";", n++, cc->checksum, cc->rows);
+      append_key_file_value(data, cc->partition ? cc->partition : "", TRUE);
+      append_key_file_value(data, cc->where, TRUE);
+      for (GList *f=cc->files; f; f=f->next)
+        append_key_file_value(data, f->data, TRUE);
+      g_string_append_c(data, '\n');
+    }
+  }
+  if (dbt->partition_files){
+    // partition;files...
+    guint n=0;
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init(&iter, dbt->partition_files);
+    while (g_hash_table_iter_next(&iter, &key, &value)){
+      g_string_append_printf(data, "partition_files_%u = ", n++);
+      append_key_file_value(data, key, TRUE);
+      for (GList *f=value; f; f=f->next)
+        append_key_file_value(data, f->data, TRUE);
+      g_string_append_c(data, '\n');
+    }
+  }
+  if (dbt->file_checksums){
+    // file;crc32 of the content;crc32 of the file
+    guint n=0;
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init(&iter, dbt->file_checksums);
+    while (g_hash_table_iter_next(&iter, &key, &value)){
+      g_string_append_printf(data, "file_checksum_%u = ", n++);
+      append_key_file_value(data, key, TRUE);
+      g_string_append_printf(data, "%s\n", (gchar *)value);
+    }
+  }
   if (dbt->schema_checksum)
     g_string_append_printf(data,"schema_checksum = %s\n", dbt->schema_checksum);
   if (dbt->indexes_checksum)
@@ -713,9 +839,9 @@ void print_dbt_on_metadata(FILE *mdfile, struct db_table *dbt){
   GString *data = g_string_sized_new(100);
   print_dbt_on_metadata_gstring(dbt, data);
   fprintf(mdfile, "%s", data->str);
-  if (check_row_count && !dbt->object_to_export.no_data && (dbt->rows != dbt->rows_total)) {
-    m_critical("Row count mismatch found for %s.%s: got %u of %u expected",
-               dbt->database->source_database, dbt->table, dbt->rows, dbt->rows_total);
+  if (check_row_count && !dbt->object_to_export.no_data && dbt->has_rows_counted && (dbt->rows != dbt->rows_counted)) {
+    m_critical("Row count mismatch found for %s.%s: got %"G_GUINT64_FORMAT" of %"G_GUINT64_FORMAT" expected",
+               dbt->database->source_database, dbt->table, dbt->rows, dbt->rows_counted);
   }
 }
 
@@ -888,6 +1014,7 @@ void start_dump(struct configuration *conf) {
   GThread *disk_check_thread = NULL;
   GThread *sthread = NULL;
   FILE *mdfile=NULL;
+  struct report_mark lock_mark={0, 0}, catalog_mark={0, 0};
 
   // Initializing process
   if (clear_dumpdir)
@@ -895,10 +1022,15 @@ void start_dump(struct configuration *conf) {
   else if (!(dirty_dumpdir || merge_dumpdir) && !is_empty_dir(dump_directory)) {
     g_error("Directory is not empty (use --clear, --dirty or --merge): %s\n", dump_directory);
   }
+  initialize_incremental();
+  initialize_content_store();
+  initialize_file_manifest();
+  initialize_bundle();
 
   check_num_threads();
   g_message("Using %u dumper threads", num_threads);
   initialize_start_dump();
+  initialize_chunk_profile();
   initialize_common();
   initialize_create_jobs(conf);
   initialize_connection(MYDUMPER);
@@ -921,13 +1053,18 @@ void start_dump(struct configuration *conf) {
   conf->use_any_index= 1;
 
   if (disk_limits!=NULL){
-    conf->pause_resume = g_async_queue_new();
-    disk_check_thread = m_thread_new("mon_disk",monitor_disk_space_thread, conf->pause_resume, "Monitor thread could not be created");
+    if (resume_at <= pause_at)
+      m_critical("--disk-limits needs a resume value higher than the pause value");
+    disk_allowed_mutex=g_mutex_new();
+    disk_allowed_cond=g_cond_new();
+    disk_allowed_threads=num_threads;
+    disk_check_thread = m_thread_new("mon_disk",monitor_disk_space_thread, NULL, "Monitor thread could not be created");
   }
 
 //  GThread *throttling_thread = 
   if (throttle_variable)
     m_thread_new("mon_thro",monitor_throttling_thread, NULL, "Monitor throttling thread could not be created");
+  initialize_throttle_control(num_threads);
 
   // signal_thread is disable if daemon mode
   if (!daemon_mode)
@@ -960,7 +1097,7 @@ void start_dump(struct configuration *conf) {
   }
 
   // If we are locking, we need to be sure there is no long running queries
-  if (sync_thread_lock_mode!=NO_LOCK && sync_thread_lock_mode!=SAFE_NO_LOCK && is_mysql_like()) {
+  if (sync_thread_lock_mode!=NO_LOCK && sync_thread_lock_mode!=SAFE_NO_LOCK && sync_thread_lock_mode!=BINLOG_DELTA && is_mysql_like()) {
   // We check SHOW PROCESSLIST, and if there're queries
   // larger than preset value, we terminate the process.
   // This avoids stalling whole server with flush.
@@ -1003,6 +1140,12 @@ void start_dump(struct configuration *conf) {
   if (exec_command != NULL)
     initialize_exec_command();
 
+  if (upload_url != NULL){
+    if (stream || (exec_command && !is_exec_command_builtin("upload")))
+      m_critical("--upload-url is not compatible with --stream or --exec, other than --exec=upload");
+    initialize_upload();
+  }
+
   // Write replica information
   if (get_product() != SERVER_TYPE_TIDB) {
     if (replica_data.enabled)
@@ -1018,8 +1161,13 @@ void start_dump(struct configuration *conf) {
     case SAFE_NO_LOCK:
       g_message("Executing in SAFE_NO_LOCK mode. This backup will fail if all threads are not in the same point in time, which ensures consistency");
       break;
+    case BINLOG_DELTA:
+      start_binlog_delta(conn);
+      break;
     case LOCK_ALL:
+      report_start(&lock_mark);
       send_lock_all_tables(conn);
+      report_end(REPORT_LOCK_WAIT, &lock_mark, 0);
       break;
     case AUTO:
       determine_ddl_lock_function(&second_conn, &acquire_global_lock_function,&release_global_lock_function, &acquire_ddl_lock_function, &release_ddl_lock_function, &release_binlog_function);
@@ -1038,14 +1186,45 @@ void start_dump(struct configuration *conf) {
     release_ddl_lock_function=NULL;
   }
 
+  initialize_replica_hosts();
+  open_worker_connections();
+  start_schema_threads(conf, acquire_ddl_lock_function != NULL);
+
   if (acquire_ddl_lock_function != NULL) {
     g_message("Acquiring DDL lock");
+    report_start(&lock_mark);
     acquire_ddl_lock_function(second_conn);
+    report_end(REPORT_LOCK_WAIT, &lock_mark, 0);
   }
 
+  // under the DDL lock the catalog matches the tables that are going to
+  // be dumped, and it is read before the global lock to not extend it
+  report_start(&catalog_mark);
+  initialize_catalog(conn, db_items);
+  report_end(REPORT_CATALOG, &catalog_mark, 0);
+
+  // FTWRL waits for the tables that are locked FOR EXPORT by another session
+  if (transportable_tablespaces && acquire_global_lock_function == &send_flush_table_with_read_lock){
+    g_warning("--transportable-tablespaces can not be used with FLUSH TABLES WITH READ LOCK, the tables are going to be dumped logically. Use --sync-thread-lock-mode LOCK_ALL, GTID or SAFE_NO_LOCK");
+    transportable_tablespaces=FALSE;
+  }
+  start_transportable(conn, db_items);
+  initialize_adaptive_statement_size(conn);
+
+  gint64 global_lock_start=0;
   if (acquire_global_lock_function != NULL) {
     g_message("Acquiring Global lock");
+    report_start(&lock_mark);
     acquire_global_lock_function(conn);
+    report_end(REPORT_LOCK_WAIT, &lock_mark, 0);
+    global_lock_start=g_get_monotonic_time();
+    report_start(&lock_mark);
+  }
+
+  // the replicas must be at the position of conn before any snapshot is opened
+  if (replica_hosts_in_use()){
+    pin_replica_hosts(conn, acquire_global_lock_function != NULL || replica_stopped || sync_thread_lock_mode == LOCK_ALL);
+    reconnect_unpinned_worker_connections();
   }
 
   // TODO: this should be deleted on future releases. 
@@ -1110,6 +1289,13 @@ void start_dump(struct configuration *conf) {
   conf->are_all_threads_in_same_pos = g_async_queue_new();
   conf->db_ready = g_async_queue_new();
   conf->source_and_replica_status_queue = g_async_queue_new();
+  register_queue_stats("schema", conf->schema_queue);
+  register_queue_stats("post_data", conf->post_data_queue);
+  register_queue_stats("transactional", conf->transactional.queue);
+  register_queue_stats("transactional_defer", conf->transactional.defer);
+  register_queue_stats("non_transactional", conf->non_transactional.queue);
+  register_queue_stats("non_transactional_defer", conf->non_transactional.defer);
+  metrics_set_conf(conf);
   ready_table_dump_mutex = g_rec_mutex_new();
   g_rec_mutex_lock(ready_table_dump_mutex);
 
@@ -1165,7 +1351,9 @@ void start_dump(struct configuration *conf) {
   gchar *source_gtid = NULL;
   get_binlog_position(conn, &source_log, &source_pos, &source_gtid);
   
-  if (g_strcmp0(source_log, initial_source_log) ||
+  if (sync_thread_lock_mode == BINLOG_DELTA){
+    // the writes of the dump window are in the binlog delta
+  }else if (g_strcmp0(source_log, initial_source_log) ||
       g_strcmp0(source_pos, initial_source_pos) ||
       g_strcmp0(source_gtid,initial_source_gtid)){
     if (sync_thread_lock_mode == NO_LOCK){
@@ -1188,8 +1376,12 @@ void start_dump(struct configuration *conf) {
       g_message("Releasing binlog lock");
       release_binlog_function(second_conn);
     }
-    if (release_global_lock_function)
+    if (release_global_lock_function){
       release_global_lock_function(conn);
+      if (global_lock_start)
+        report_end(REPORT_LOCK_HOLD, &lock_mark, 0);
+      g_message("Global lock held for %.3f seconds", (gdouble)(g_get_monotonic_time() - global_lock_start) / G_USEC_PER_SEC);
+    }
     if (is_mysql_like() && replica_stopped){
       g_message("Starting replica");
       m_query_warning(conn, start_replica_sql_thread, "Not able to start replica", NULL);
@@ -1199,6 +1391,7 @@ void start_dump(struct configuration *conf) {
       }
       replica_stopped=FALSE;
     }
+    release_replica_hosts();
   }
 
   // Every time a schema job is created a counter increases
@@ -1222,6 +1415,8 @@ void start_dump(struct configuration *conf) {
   for (n = 0; n < num_threads; n++) {
     g_async_queue_pop(conf->initial_completed_queue);
   }
+  // all the tables are already in the table lists
+  sort_table_lists();
   // at this point initial jobs has been completed
   // which means that all schema jobs has been created 
   // we are able to send the JOB_SHUTDOWN to schema_queue
@@ -1231,6 +1426,7 @@ void start_dump(struct configuration *conf) {
     j->type = JOB_SHUTDOWN;
     g_async_queue_push(conf->schema_queue, j);
   }
+  shutdown_schema_threads();
   // In case that we are NOT exporting transactional table, we need to 
   // build the lock table statement, at this stage, before
   // let workers to start dumping data
@@ -1252,8 +1448,12 @@ void start_dump(struct configuration *conf) {
       release_binlog_function(second_conn);
     }
     g_message("Non-InnoDB dump complete, releasing global locks");
-    if (release_global_lock_function)
+    if (release_global_lock_function){
       release_global_lock_function(conn);
+      if (global_lock_start)
+        report_end(REPORT_LOCK_HOLD, &lock_mark, 0);
+      g_message("Global lock held for %.3f seconds", (gdouble)(g_get_monotonic_time() - global_lock_start) / G_USEC_PER_SEC);
+    }
     g_message("Global locks released");
   }
 
@@ -1266,6 +1466,7 @@ void start_dump(struct configuration *conf) {
       discard_mysql_output(conn);
     }
   }
+  release_replica_hosts();
 
   // All the jobs related to post data has been created and enquequed
   // so, we can send the JOB_SHUTDOWN
@@ -1276,12 +1477,17 @@ void start_dump(struct configuration *conf) {
   }
   // At this point the main process, needs to wait the working threads to finish 
   wait_working_thread_to_finish();
+  wait_schema_threads_to_finish();
+  finish_transportable();
+  write_binlog_delta(conn, mdfile);
 
   // Backup is done
   // Starting to finalize it
   finalize_working_thread();
+  finalize_replica_hosts();
   finalize_chunk();
   finalize_write();
+  finalize_incremental();
 
   // Releasing DDL lock if possible
   if (release_ddl_lock_function != NULL) {
@@ -1304,6 +1510,7 @@ void start_dump(struct configuration *conf) {
 
   // There are scenarios where we need to wait files to flush to disk  
   wait_close_files();
+  finish_copy();
 
   GList *keys= g_hash_table_get_keys(all_dbts);
   keys= g_list_sort(keys, key_strcmp);
@@ -1312,9 +1519,17 @@ void start_dump(struct configuration *conf) {
     g_assert(dbt);
     print_dbt_on_metadata(mdfile, dbt);
   }
+  write_chunk_profile();
   write_database_on_disk(mdfile);
   g_list_free(table_schemas);
   table_schemas=NULL;
+  metrics_set_conf(NULL);
+  unregister_queue_stats(conf->schema_queue);
+  unregister_queue_stats(conf->post_data_queue);
+  unregister_queue_stats(conf->transactional.queue);
+  unregister_queue_stats(conf->transactional.defer);
+  unregister_queue_stats(conf->non_transactional.queue);
+  unregister_queue_stats(conf->non_transactional.defer);
   g_async_queue_unref(conf->transactional.defer);
   conf->transactional.defer= NULL;
   g_async_queue_unref(conf->transactional.queue);
@@ -1339,6 +1554,9 @@ void start_dump(struct configuration *conf) {
 
   fprintf(mdfile, "[config]\nmax-statement-size = %ld\n", max_statement_size);
   fprintf(mdfile, "num-sequences = %d\n", num_sequences);
+  if (throttle_control_threads() > 0)
+    fprintf(mdfile, "\n[auto_threads]\nthreads = %u\n", throttle_control_threads());
+  finalize_throttle_control();
 
   datetime = g_date_time_new_now_local();
   datetimestr=g_date_time_format(datetime,"\%Y-\%m-\%d \%H:\%M:\%S");
@@ -1348,6 +1566,10 @@ void start_dump(struct configuration *conf) {
   if (updated_since > 0)
     fclose(nufile);
 
+  finalize_content_store();
+  finalize_file_manifest();
+  finalize_bundle();
+
   if (g_rename(metadata_partial_filename, metadata_filename))
     m_critical("We were not able to rename metadata file");
 
@@ -1362,6 +1584,20 @@ void start_dump(struct configuration *conf) {
     if (no_delete == FALSE && output_directory_str == NULL)
       if (g_rmdir(output_directory) != 0)
         g_critical("Backup directory not removed: %s", output_directory);
+  }else if (exec_command != NULL){
+    // with --upload-url it is sent below, once all the files were uploaded
+    if (!upload_url)
+      exec_queue_push(NULL, g_strdup(metadata_filename));
+    wait_exec_command_to_finish();
+  }
+
+  if (upload_url) {
+    if (content_store)
+      upload_queue_push(NULL, content_store_manifest_filename());
+    if (file_manifest)
+      upload_queue_push(NULL, g_build_filename(dump_directory, FILE_MANIFEST, NULL));
+    upload_queue_push(NULL, g_strdup(metadata_filename));
+    wait_upload_to_finish();
   }
 
   for (GList *it= keys; it; it= g_list_next(it)) {
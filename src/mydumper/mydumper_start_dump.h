@@ -33,7 +33,8 @@ enum sync_thread_lock_mode {
   LOCK_ALL,
   GTID,
   NO_LOCK,
-  SAFE_NO_LOCK
+  SAFE_NO_LOCK,
+  BINLOG_DELTA
 };
 
 struct MList{
@@ -79,5 +80,6 @@ void *exec_thread(void *data);
 gboolean sig_triggered_int(void * user_data);
 gboolean sig_triggered_term(void * user_data);
 void set_disk_limits(guint p_at, guint r_at);
+void wait_for_disk_space(guint thread_id);
 //void print_dbt_on_metadata(FILE *mdfile, struct db_table *dbt);
 void print_dbt_on_metadata_gstring(struct db_table *dbt, GString *data);
@@ -0,0 +1,258 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+/* With --blob-slice-size the chunks of tables with BLOB, TEXT, JSON or
+   GEOMETRY columns are read with a server side prepared statement. The
+   other columns are bound to string buffers of their display length, so
+   mysql_stmt_fetch() formats them like the text protocol does. The BLOB
+   columns are bound without buffers, mysql_stmt_fetch() only tells us the
+   length of each value, and the values are copied out afterwards with
+   mysql_stmt_fetch_column(). Values bigger than blob_slice_size are not
+   copied, the writer reads them in slices at increasing offsets and encodes
+   each slice straight to the file. */
+
+#include <string.h>
+#include "mydumper_global.h"
+#include "mydumper_database.h"
+#include "mydumper_table.h"
+#include "mydumper_stmt_fetcher.h"
+
+/* Some earlier versions of MySQL do not yet define MYSQL_TYPE_JSON */
+#ifndef MYSQL_TYPE_JSON
+#define MYSQL_TYPE_JSON 245
+#endif
+
+// Room for any FLOAT or DOUBLE value formatted by the client library
+#define STMT_FETCHER_MIN_BUFFER 64
+
+guint blob_slice_size=0;
+
+static
+gboolean is_blob_field(enum enum_field_types type){
+  switch (type){
+    case MYSQL_TYPE_TINY_BLOB:
+    case MYSQL_TYPE_MEDIUM_BLOB:
+    case MYSQL_TYPE_LONG_BLOB:
+    case MYSQL_TYPE_BLOB:
+    case MYSQL_TYPE_GEOMETRY:
+    case MYSQL_TYPE_JSON:
+      return TRUE;
+    default:
+      return FALSE;
+  }
+}
+
+gboolean has_blob_fields(MYSQL_FIELD *fields, guint num_fields){
+  guint i;
+  for (i = 0; i < num_fields; i++)
+    if (is_blob_field(fields[i].type))
+      return TRUE;
+  return FALSE;
+}
+
+/* The client library formats FLOAT and DOUBLE values with the length of the
+ * buffer as the width, a column bound without a buffer would lose digits */
+static
+void bind_column_buffer(struct stmt_fetcher *sf, guint column, gulong length){
+  g_string_set_size(sf->columns[column], length);
+  sf->bind[column].buffer=sf->columns[column]->str;
+  sf->bind[column].buffer_length=length;
+}
+
+static
+void set_blob_stream(struct db_table *dbt, gboolean blob_stream){
+  g_mutex_lock(dbt->chunks_mutex);
+  dbt->blob_stream=blob_stream;
+  dbt->blob_stream_checked=TRUE;
+  g_mutex_unlock(dbt->chunks_mutex);
+}
+
+/* Returns NULL when the table has no column worth streaming or when the
+ * statement could not be used, the chunk is then read as usual */
+struct stmt_fetcher *new_stmt_fetcher(MYSQL *conn, struct db_table *dbt, const gchar *query){
+  g_mutex_lock(dbt->chunks_mutex);
+  gboolean skip=dbt->blob_stream_checked && !dbt->blob_stream;
+  g_mutex_unlock(dbt->chunks_mutex);
+  if (skip)
+    return NULL;
+
+  MYSQL_STMT *stmt=mysql_stmt_init(conn);
+  if (!stmt)
+    return NULL;
+  if (mysql_stmt_prepare(stmt, query, strlen(query))){
+    g_warning("Could not prepare the chunk query of %s.%s, BLOB values will not be sliced: %s", dbt->database->source_database, dbt->table, mysql_stmt_error(stmt));
+    mysql_stmt_close(stmt);
+    set_blob_stream(dbt, FALSE);
+    return NULL;
+  }
+  MYSQL_RES *metadata=mysql_stmt_result_metadata(stmt);
+  if (!metadata){
+    mysql_stmt_close(stmt);
+    set_blob_stream(dbt, FALSE);
+    return NULL;
+  }
+  guint num_fields=mysql_num_fields(metadata);
+  if (!dbt->blob_stream_checked)
+    set_blob_stream(dbt, has_blob_fields(mysql_fetch_fields(metadata), num_fields));
+  if (!dbt->blob_stream){
+    mysql_free_result(metadata);
+    mysql_stmt_close(stmt);
+    return NULL;
+  }
+  if (mysql_stmt_execute(stmt)){
+    g_warning("Could not execute the chunk query of %s.%s as a prepared statement: %s", dbt->database->source_database, dbt->table, mysql_stmt_error(stmt));
+    mysql_free_result(metadata);
+    mysql_stmt_close(stmt);
+    return NULL;
+  }
+
+  struct stmt_fetcher *sf=g_new0(struct stmt_fetcher, 1);
+  sf->stmt=stmt;
+  sf->metadata=metadata;
+  sf->num_fields=num_fields;
+  sf->bind=g_new0(MYSQL_BIND, num_fields);
+  sf->lengths=g_new0(gulong, num_fields);
+  sf->is_null=g_new0(stmt_fetcher_bool, num_fields);
+  sf->error=g_new0(stmt_fetcher_bool, num_fields);
+  sf->sliceable=g_new0(gboolean, num_fields);
+  sf->sliced=g_new0(gboolean, num_fields);
+  sf->columns=g_new0(GString *, num_fields);
+  sf->row=g_new0(gchar *, num_fields);
+  sf->slice=g_string_sized_new(blob_slice_size);
+  sf->bound=g_new0(gboolean, num_fields);
+  MYSQL_FIELD *fields=mysql_fetch_fields(metadata);
+  guint i;
+  for (i = 0; i < num_fields; i++){
+    sf->bind[i].buffer_type=MYSQL_TYPE_STRING;
+    sf->bind[i].length=&(sf->lengths[i]);
+    sf->bind[i].is_null=&(sf->is_null[i]);
+    sf->bind[i].error=&(sf->error[i]);
+    sf->columns[i]=g_string_new("");
+    if (is_blob_field(fields[i].type)){
+      // no buffer: mysql_stmt_fetch() only sets the length
+      sf->bind[i].buffer=NULL;
+      sf->bind[i].buffer_length=0;
+    }else{
+      sf->bound[i]=TRUE;
+      bind_column_buffer(sf, i, MAX(fields[i].length, STMT_FETCHER_MIN_BUFFER));
+    }
+  }
+  if (mysql_stmt_bind_result(stmt, sf->bind)){
+    g_warning("Could not bind the chunk result of %s.%s: %s", dbt->database->source_database, dbt->table, mysql_stmt_error(stmt));
+    free_stmt_fetcher(sf);
+    return NULL;
+  }
+  return sf;
+}
+
+void stmt_fetcher_set_sliceable(struct stmt_fetcher *sf, guint column, gboolean sliceable){
+  sf->sliceable[column]=sliceable;
+}
+
+static
+gboolean fetch_column_into(struct stmt_fetcher *sf, guint column, gchar *buffer, gulong length, gulong offset){
+  MYSQL_BIND bind;
+  gulong fetched=0;
+  stmt_fetcher_bool is_null=0, error=0;
+  memset(&bind, 0, sizeof(bind));
+  bind.buffer_type=MYSQL_TYPE_STRING;
+  bind.buffer=buffer;
+  bind.buffer_length=length;
+  bind.length=&fetched;
+  bind.is_null=&is_null;
+  bind.error=&error;
+  if (mysql_stmt_fetch_column(sf->stmt, &bind, column, offset)){
+    g_critical("Could not fetch column %u at offset %lu: %s", column, offset, mysql_stmt_error(sf->stmt));
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/* The row is valid until the next call. Values that were left for slicing
+ * are NULL on the row and flagged on sf->sliced, their length is the full
+ * length of the value */
+MYSQL_ROW stmt_fetcher_next(struct stmt_fetcher *sf, gulong **lengths){
+  int rc=mysql_stmt_fetch(sf->stmt);
+  if (rc == 1 || rc == MYSQL_NO_DATA)
+    return NULL;
+  guint i;
+  gboolean rebind=FALSE;
+  sf->oversized=FALSE;
+  for (i = 0; i < sf->num_fields; i++){
+    sf->sliced[i]=FALSE;
+    if (sf->is_null[i]){
+      sf->row[i]=NULL;
+      continue;
+    }
+    if (sf->bound[i]){
+      if (sf->lengths[i] > sf->bind[i].buffer_length){
+        // truncated by mysql_stmt_fetch(), grow the buffer and read it again
+        bind_column_buffer(sf, i, sf->lengths[i]);
+        rebind=TRUE;
+        if (!fetch_column_into(sf, i, sf->columns[i]->str, sf->lengths[i], 0))
+          return NULL;
+      }
+      sf->columns[i]->str[sf->lengths[i]]='\0';
+      sf->row[i]=sf->columns[i]->str;
+      continue;
+    }
+    if (sf->sliceable[i] && sf->lengths[i] > blob_slice_size){
+      sf->sliced[i]=TRUE;
+      sf->oversized=TRUE;
+      sf->row[i]=NULL;
+      continue;
+    }
+    g_string_set_size(sf->columns[i], sf->lengths[i]);
+    if (sf->lengths[i] > 0 && !fetch_column_into(sf, i, sf->columns[i]->str, sf->lengths[i], 0))
+      return NULL;
+    sf->row[i]=sf->columns[i]->str;
+  }
+  if (rebind && mysql_stmt_bind_result(sf->stmt, sf->bind)){
+    g_critical("Could not bind the grown column buffers: %s", mysql_stmt_error(sf->stmt));
+    return NULL;
+  }
+  *lengths=sf->lengths;
+  return sf->row;
+}
+
+// Reads up to blob_slice_size bytes of the value into sf->slice
+gboolean stmt_fetcher_read_slice(struct stmt_fetcher *sf, guint column, gulong offset){
+  gulong length=sf->lengths[column] - offset;
+  if (length > blob_slice_size)
+    length=blob_slice_size;
+  g_string_set_size(sf->slice, length);
+  return fetch_column_into(sf, column, sf->slice->str, length, offset);
+}
+
+void free_stmt_fetcher(struct stmt_fetcher *sf){
+  guint i;
+  for (i = 0; i < sf->num_fields; i++)
+    g_string_free(sf->columns[i], TRUE);
+  g_free(sf->columns);
+  g_string_free(sf->slice, TRUE);
+  mysql_free_result(sf->metadata);
+  mysql_stmt_close(sf->stmt);
+  g_free(sf->bind);
+  g_free(sf->lengths);
+  g_free(sf->is_null);
+  g_free(sf->error);
+  g_free(sf->sliceable);
+  g_free(sf->sliced);
+  g_free(sf->bound);
+  g_free(sf->row);
+  g_free(sf);
+}
@@ -0,0 +1,58 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+#if !defined(mydumper_mydumper_stmt_fetcher)
+#define mydumper_mydumper_stmt_fetcher
+
+#include <mysql.h>
+#include <glib.h>
+
+#if defined(HAVE_MY_BOOL)
+typedef my_bool stmt_fetcher_bool;
+#else
+typedef bool stmt_fetcher_bool;
+#endif
+
+struct db_table;
+
+struct stmt_fetcher {
+  MYSQL_STMT *stmt;
+  // result metadata, used as the MYSQL_RES of the chunk
+  MYSQL_RES *metadata;
+  guint num_fields;
+  MYSQL_BIND *bind;
+  gulong *lengths;
+  stmt_fetcher_bool *is_null;
+  stmt_fetcher_bool *error;
+  // per column: the value is read into its buffer by mysql_stmt_fetch()
+  gboolean *bound;
+  // per column: the value can be read in slices
+  gboolean *sliceable;
+  // per row: the value was not read, it is bigger than blob_slice_size
+  gboolean *sliced;
+  gboolean oversized;
+  GString **columns;
+  GString *slice;
+  MYSQL_ROW row;
+};
+
+gboolean has_blob_fields(MYSQL_FIELD *fields, guint num_fields);
+struct stmt_fetcher *new_stmt_fetcher(MYSQL *conn, struct db_table *dbt, const gchar *query);
+void stmt_fetcher_set_sliceable(struct stmt_fetcher *sf, guint column, gboolean sliceable);
+MYSQL_ROW stmt_fetcher_next(struct stmt_fetcher *sf, gulong **lengths);
+gboolean stmt_fetcher_read_slice(struct stmt_fetcher *sf, guint column, gulong offset);
+void free_stmt_fetcher(struct stmt_fetcher *sf);
+#endif
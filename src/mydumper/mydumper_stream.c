@@ -20,6 +20,9 @@
 #include <errno.h>
 // We need header fcntl.h for open function to build on Alpine. More info in: https://github.com/mydumper/mydumper/issues/1721
 #include <fcntl.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 
 #include "mydumper.h"
 #include "mydumper_global.h"
@@ -33,6 +36,11 @@ gboolean metadata_partial_writer_alive = TRUE;
 GAsyncQueue *metadata_partial_queue = NULL;
 GAsyncQueue * initial_metadata_lock_queue = NULL;
 GAsyncQueue * initial_metadata_queue = NULL;
+guint stream_lanes = 1;
+static GMutex *stream_write_mutex = NULL;
+static gint stream_lanes_alive = 0;
+static gint stream_file_id = 0;
+static guint64 stream_total_size = 0;
 
 void metadata_partial_queue_push (struct db_table *dbt){
   if (dbt)
@@ -53,8 +61,171 @@ void stream_queue_push(struct db_table *dbt,gchar *filename){
   metadata_partial_queue_push(dbt);
 }
 
+static
+void write_all(const char *buf, size_t count){
+  ssize_t len;
+  while (count > 0){
+    len=write(fileno(stdout), buf, count);
+    if (len <= 0)
+      m_error("Stream failed during transmition (%s)", strerror(errno));
+    buf+=len;
+    count-=len;
+  }
+}
+
+static
+void put_uint32(guchar *buf, guint32 value){
+  buf[0]=value >> 24;
+  buf[1]=value >> 16;
+  buf[2]=value >> 8;
+  buf[3]=value;
+}
+
+// A frame is written at once, so lanes can interleave frames on stdout
+static
+void write_stream_frame(guchar type, guint32 id, const gchar *prefix, guint32 prefix_len, const gchar *payload, guint32 payload_len){
+  guchar header[STREAM_FRAME_HEADER_SIZE];
+  header[0]=type;
+  put_uint32(&(header[1]), id);
+  put_uint32(&(header[5]), prefix_len + payload_len);
+  g_mutex_lock(stream_write_mutex);
+  write_all((gchar *)header, STREAM_FRAME_HEADER_SIZE);
+  if (prefix_len)
+    write_all(prefix, prefix_len);
+  if (payload_len)
+    write_all(payload, payload_len);
+  stream_total_size+=STREAM_FRAME_HEADER_SIZE + prefix_len + payload_len;
+  g_mutex_unlock(stream_write_mutex);
+}
+
+static
+void stream_file_in_frames(struct filename_queue_element *sf, char *buf){
+  guint32 id=g_atomic_int_add(&stream_file_id, 1);
+  char *used_filemame=g_path_get_basename(sf->filename);
+  guint64 size=0;
+  int f=-1;
+  if (!no_stream){
+    f=open(sf->filename,O_RDONLY);
+    if (f < 0)
+      m_error("File failed to open: %s (%s)", sf->filename, strerror(errno));
+    struct stat st;
+    fstat(f, &st);
+    size=st.st_size;
+  }
+  guchar size_buf[8];
+  put_uint32(size_buf, size >> 32);
+  put_uint32(&(size_buf[4]), size);
+  trace("Streaming %s as %u", sf->filename, id);
+  write_stream_frame(STREAM_FRAME_OPEN, id, (gchar *)size_buf, 8, used_filemame, strlen(used_filemame));
+  g_free(used_filemame);
+  if (f >= 0){
+    int buflen = read(f, buf, STREAM_BUFFER_SIZE);
+    while(buflen > 0){
+      write_stream_frame(STREAM_FRAME_DATA, id, NULL, 0, buf, buflen);
+      buflen = read(f, buf, STREAM_BUFFER_SIZE);
+    }
+    if (buflen < 0)
+      m_error("Stream failed reading file: %s (%s)", sf->filename, strerror(errno));
+    close(f);
+  }
+  write_stream_frame(STREAM_FRAME_CLOSE, id, NULL, 0, NULL, 0);
+}
+
+static
+void *process_stream_lane(void *data){
+  set_thread_affinity(AFFINITY_IO);
+  (void)data;
+  char *buf=g_new(gchar, STREAM_BUFFER_SIZE);
+  struct filename_queue_element *sf = NULL;
+  for(;;){
+    sf = m_async_queue_pop(stream_queue);
+    if (strlen(sf->filename) == 0){
+      // the last lane closes the stream, the others hand over the END job
+      if (g_atomic_int_dec_and_test(&stream_lanes_alive)){
+        write_stream_frame(STREAM_FRAME_END, 0, NULL, 0, NULL, 0);
+        if (sf->done)
+          g_async_queue_push(sf->done, GINT_TO_POINTER(1));
+      }else
+        g_async_queue_push(stream_queue, sf);
+      break;
+    }
+    stream_file_in_frames(sf, buf);
+    if (no_delete == FALSE){
+      trace("Deleting %s", sf->filename);
+      remove(sf->filename);
+    }
+    if (sf->done)
+      g_async_queue_push(sf->done, GINT_TO_POINTER(1));
+    g_free(sf->filename);
+    g_free(sf);
+  }
+  g_free(buf);
+  return NULL;
+}
+
+// Files are sent by stream_lanes threads at the same time, myloader
+// demultiplexes the frames by file id
+static
+void process_stream_lanes(){
+  GDateTime *total_start_time=g_date_time_new_now_local();
+  GThread **lanes=g_new(GThread *, stream_lanes);
+  guint n;
+  stream_write_mutex=g_mutex_new();
+  stream_lanes_alive=stream_lanes;
+  write_all(STREAM_LANES_MAGIC, strlen(STREAM_LANES_MAGIC));
+  for (n=0; n<stream_lanes; n++)
+    lanes[n]=m_thread_new("stream_lane", (GThreadFunc)process_stream_lane, NULL, "Stream lane thread could not be created");
+  for (n=0; n<stream_lanes; n++)
+    g_thread_join(lanes[n]);
+  g_free(lanes);
+  GDateTime *datetime = g_date_time_new_now_local();
+  GTimeSpan total_diff=g_date_time_difference(datetime,total_start_time)/G_TIME_SPAN_SECOND;
+  g_date_time_unref(total_start_time);
+  g_date_time_unref(datetime);
+  g_message("All data transferred was %" G_GINT64_FORMAT " at a rate of %" G_GINT64_FORMAT " MB/s using %u lanes",stream_total_size,total_diff!=0?stream_total_size/1024/1024/total_diff:stream_total_size/1024/1024, stream_lanes);
+}
+
+// Sends the file without copying it into userspace, returns the amount of
+// bytes sent. If nothing was sent, the caller falls back to read/write
+static
+guint64 sendfile_to_stdout(int f, off_t size){
+  guint64 total_len=0;
+#ifdef __linux__
+  static gboolean sendfile_available=TRUE;
+  ssize_t len;
+  while (sendfile_available && (off_t)total_len < size){
+    len=sendfile(fileno(stdout), f, NULL, size - total_len > STREAM_BUFFER_SIZE * 16 ? STREAM_BUFFER_SIZE * 16 : size - total_len);
+    if (len < 0){
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+      if (total_len == 0 && (errno == EINVAL || errno == ENOSYS)){
+        trace("sendfile is not available on stdout, using read/write");
+        sendfile_available=FALSE;
+        break;
+      }
+      m_error("Stream failed during transmition (%s)", strerror(errno));
+    }
+    if (len == 0)
+      break;
+    total_len+=len;
+  }
+#else
+  (void) f;
+  (void) size;
+#endif
+  return total_len;
+}
+
 void *process_stream(void *data){
+  set_thread_affinity(AFFINITY_IO);
   (void)data;
+  if (stream_lanes > 1){
+    process_stream_lanes();
+    metadata_partial_writer_alive = FALSE;
+    metadata_partial_queue_push(GINT_TO_POINTER(1));
+    g_thread_join(metadata_partial_writer_thread);
+    return NULL;
+  }
   int f=0;
   char *buf=g_new(gchar, STREAM_BUFFER_SIZE);
   int buflen;
@@ -67,7 +238,7 @@ void *process_stream(void *data){
   GDateTime *datetime;
   struct filename_queue_element *sf = NULL;
   for(;;){
-    sf = g_async_queue_pop(stream_queue);
+    sf = m_async_queue_pop(stream_queue);
 
     if (strlen(sf->filename) == 0){
       if (sf->done)
@@ -117,8 +288,10 @@ void *process_stream(void *data){
         total_size+=strlen(c) + 1;
         g_free(c);
 
-        guint total_len=0;
+        guint64 total_len=0;
         GDateTime *start_time=g_date_time_new_now_local();
+        total_len=sendfile_to_stdout(f, size);
+        // continues from the current offset, the file might have grown
         buflen = read(f, buf, STREAM_BUFFER_SIZE);
         while(buflen > 0){
           len=write(fileno(stdout), buf, buflen);
@@ -171,30 +344,59 @@ void send_initial_metadata(){
 
 static gchar *make_partial_filename(guint i)
 {
-  return g_strdup_printf("%s/metadata.partial.%d", dump_directory, i);
+  return g_strdup_printf("%s/metadata.partial.%d" METADATA_DELTA_SUFFIX, dump_directory, i);
+}
+
+/* The partial metadata files are deltas: one line per table whose rows
+ * changed since the previous file, with the names of the table in the files,
+ * its rows and its real name. The rest of the metadata of the tables is in
+ * the final metadata */
+static
+void append_metadata_delta(gpointer key, gpointer value, gpointer data){
+  (void) value;
+  struct db_table *dbt=key;
+  GString *output=data;
+  guint64 rows=dbt->rows;
+  if (dbt->metadata_delta_sent && rows == dbt->metadata_delta_rows)
+    return;
+  dbt->metadata_delta_sent=TRUE;
+  dbt->metadata_delta_rows=rows;
+  gchar *table=newline_protect(dbt->table);
+  g_string_append_printf(output, "%s\t%s\t%"G_GUINT64_FORMAT"\t%s\n", dbt->database->database_name_in_filename, dbt->table_filename, rows, table);
+  g_free(table);
+}
+
+static
+void write_metadata_delta(GHashTable *touched, guint i){
+  GString *output=g_string_sized_new(256);
+  GError *gerror=NULL;
+  g_hash_table_foreach(touched, append_metadata_delta, output);
+  g_hash_table_remove_all(touched);
+  gchar *filename=make_partial_filename(i);
+  if (!g_file_set_contents(filename, output->str, output->len, &gerror)){
+    g_critical("Could not write %s: %s", filename, gerror->message);
+    g_error_free(gerror);
+    errors++;
+  }
+  stream_queue_push(NULL, filename);
+  g_string_free(output, TRUE);
 }
 
 void *metadata_partial_writer(void *data){
   (void) data;
   struct db_table *dbt=NULL;
-  GList *dbt_list = NULL;
-  GString *output=g_string_sized_new(256);
+  // the tables with new files since the last partial metadata
+  GHashTable *touched=g_hash_table_new(g_direct_hash, g_direct_equal);
   guint i=0;
-  gchar *filename = NULL;
-  GError* gerror = NULL;
   for(i=0;i<num_threads;i++){
     g_async_queue_pop(initial_metadata_queue);
   }
   dbt=g_async_queue_try_pop(metadata_partial_queue);   
   while (dbt != NULL ){
-    dbt_list=g_list_prepend(dbt_list,dbt);
+    g_hash_table_add(touched, dbt);
     dbt=g_async_queue_try_pop(metadata_partial_queue);
   }
-  g_string_set_size(output,0);
-  g_list_foreach(dbt_list,(GFunc)(&print_dbt_on_metadata_gstring),output);
-  filename= make_partial_filename(0);
-  g_file_set_contents(filename, output->str,output->len,&gerror);
-  stream_queue_push(NULL, filename);
+  write_metadata_delta(touched, 0);
   for(i=0;i<num_threads;i++){
     g_async_queue_push(initial_metadata_lock_queue, GINT_TO_POINTER(1));
   }
@@ -203,26 +405,16 @@ void *metadata_partial_writer(void *data){
   GDateTime *prev_datetime = g_date_time_new_now_local();
   GDateTime *current_datetime = NULL;
   GTimeSpan diff=0;
-  g_string_set_size(output,0);
-  filename=NULL;
   dbt=g_async_queue_timeout_pop(metadata_partial_queue, METADATA_PARTIAL_INTERVAL * 1000000);
   while (metadata_partial_writer_alive){
-    if (dbt != NULL && g_list_find(dbt_list, dbt)==NULL){
-      dbt_list=g_list_prepend(dbt_list,dbt);
-    }
+    if (dbt != NULL && dbt != GINT_TO_POINTER(1))
+      g_hash_table_add(touched, dbt);
     current_datetime = g_date_time_new_now_local();
     diff=g_date_time_difference(current_datetime,prev_datetime)/G_TIME_SPAN_SECOND;
     if (diff > METADATA_PARTIAL_INTERVAL){
-      if (g_list_length(dbt_list) > 0){  
-        filename= make_partial_filename(i);
+      if (g_hash_table_size(touched) > 0){
+        write_metadata_delta(touched, i);
         i++;
-        initialize_config_on_string(output);
-        g_list_foreach(dbt_list,(GFunc)(&print_dbt_on_metadata_gstring),output);
-        g_file_set_contents(filename,output->str,output->len,&gerror);
-        stream_queue_push(NULL, filename);
-        filename = NULL;
-        g_string_set_size(output,0);
-        dbt_list=NULL;        
       }
       g_date_time_unref(prev_datetime);
       prev_datetime=current_datetime;
@@ -231,6 +423,7 @@ void *metadata_partial_writer(void *data){
     }
     dbt=g_async_queue_timeout_pop(metadata_partial_queue, METADATA_PARTIAL_INTERVAL * 1000000);
   }
+  g_hash_table_destroy(touched);
   return NULL;
 }
 
@@ -238,6 +431,7 @@ void initialize_stream(){
   initial_metadata_queue = g_async_queue_new();
   initial_metadata_lock_queue = g_async_queue_new();
   stream_queue = g_async_queue_new();
+  register_queue_stats("stream", stream_queue);
   metadata_partial_queue = g_async_queue_new();
   stream_thread = m_thread_new("stream", (GThreadFunc)process_stream, stream_queue, "Stream thread could not be created");
   metadata_partial_writer_thread = m_thread_new("metadata_writer", (GThreadFunc)metadata_partial_writer, NULL, "Metadata partial writer thread could not be created");
@@ -15,6 +15,7 @@
         Authors:    David Ducos, Percona (david dot ducos at percona dot com)
 */
 #define METADATA_PARTIAL_INTERVAL 2
+#define METADATA_DELTA_SUFFIX ".delta"
 void initialize_stream();
 void wait_stream_to_finish();
 void metadata_partial_push (struct db_table *dbt);
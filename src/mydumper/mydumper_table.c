@@ -25,6 +25,7 @@
 #include "mydumper_global.h"
 #include "mydumper_chunks.h"
 #include "mydumper_common.h"
+#include "mydumper_catalog.h"
 
 // Extern
 extern guint64 min_integer_chunk_step_size;
@@ -34,6 +35,9 @@ extern gboolean use_single_column;
 static GMutex *all_dbts_mutex=NULL;
 static GMutex *character_set_hash_mutex = NULL;
 static GHashTable *character_set_hash=NULL;
+// Order in which the tables are dumped, largest first by default as the
+// last table to start is the one that determines the end of the dump
+GCompareFunc table_order_function=&compare_dbt_by_size;
 
 void initialize_table(){
   all_dbts_mutex = g_mutex_new();
@@ -47,18 +51,91 @@ void finalize_table(){
   g_mutex_free(character_set_hash_mutex);
 }
 
+// For the readers of all_dbts while the tables are being added
+void lock_all_dbts(){
+  g_mutex_lock(all_dbts_mutex);
+}
+
+void unlock_all_dbts(){
+  g_mutex_unlock(all_dbts_mutex);
+}
+
+gint compare_dbt_by_rows(gconstpointer a, gconstpointer b){
+  guint64 a_rows=((struct db_table *)a)->estimated_rows, b_rows=((struct db_table *)b)->estimated_rows;
+  return a_rows < b_rows ? 1 : (a_rows > b_rows ? -1 : 0);
+}
+
+// Data_length is not available on every engine, then rows are used
+gint compare_dbt_by_size(gconstpointer a, gconstpointer b){
+  guint64 a_size=((struct db_table *)a)->data_length, b_size=((struct db_table *)b)->data_length;
+  if (a_size == b_size)
+    return compare_dbt_by_rows(a, b);
+  return a_size < b_size ? 1 : -1;
+}
+
+gboolean set_table_order(const gchar *value){
+  if (!g_ascii_strcasecmp(value, "size"))
+    table_order_function=&compare_dbt_by_size;
+  else if (!g_ascii_strcasecmp(value, "rows"))
+    table_order_function=&compare_dbt_by_rows;
+  else if (!g_ascii_strcasecmp(value, "none"))
+    table_order_function=NULL;
+  else
+    return FALSE;
+  return TRUE;
+}
+
+static
+void free_index_columns(GList *columns){
+  g_list_free_full(columns, g_free);
+}
+
+struct index_candidate{
+  guint64 cardinality;
+  gchar *key_name;
+  GList *columns;
+};
+
+static
+void free_index_candidate(struct index_candidate *ic){
+  free_index_columns(ic->columns);
+  g_free(ic->key_name);
+  g_free(ic);
+}
+
 void free_db_table(struct db_table * dbt){
   g_mutex_lock(dbt->chunks_mutex);
   g_mutex_free(dbt->rows_lock);
   g_free(dbt->escaped_table);
   if (dbt->insert_statement)
     g_string_free(dbt->insert_statement,TRUE);
+  if (dbt->binary_header)
+    g_string_free(dbt->binary_header,TRUE);
   if (dbt->select_fields)
     g_string_free(dbt->select_fields, TRUE);
+  g_free(dbt->encoder_plan);
+  g_list_free_full(dbt->chunk_index_candidates, (GDestroyNotify)free_index_candidate);
+  g_free(dbt->chunk_index);
+  g_free(dbt->plan_guard_hint);
   if (dbt->min!=NULL) g_free(dbt->min);
   if (dbt->max!=NULL) g_free(dbt->max);
   g_free(dbt->data_checksum);
   dbt->data_checksum=NULL;
+  g_free(dbt->chunk_checksum_expression);
+  for (GList *l=dbt->chunk_checksum_list; l; l=l->next){
+    struct chunk_checksum *cc=l->data;
+    g_free(cc->checksum);
+    g_free(cc->partition);
+    g_free(cc->where);
+    g_list_free_full(cc->files, g_free);
+    g_free(cc);
+  }
+  g_list_free(dbt->chunk_checksum_list);
+  if (dbt->partition_files)
+    g_hash_table_destroy(dbt->partition_files);
+  if (dbt->file_checksums)
+    g_hash_table_destroy(dbt->file_checksums);
+  free_table_definition(dbt->table_definition);
   g_free(dbt->chunks_completed);
 
   g_free(dbt->table);
@@ -87,10 +164,112 @@ gchar *get_character_set_from_collation(MYSQL *conn, gchar *collation){
 }
 
 static
-void get_primary_key(MYSQL *conn, struct db_table * dbt, struct configuration *conf){
+gint compare_index_candidate(gconstpointer a, gconstpointer b){
+  const struct index_candidate *ia=a, *ib=b;
+  return ia->cardinality < ib->cardinality ? 1 : ia->cardinality > ib->cardinality ? -1 : 0;
+}
+
+/* index_columns are struct catalog_index_column in the order of SHOW INDEX.
+   Without PK or UNIQUE index, the other indexes are left in candidates by
+   the cardinality of their leading column, the chunker moves to the next one
+   when the leading column of the current one can not be split. key_name is
+   the name of the index that is picked, unique is set when it is the PK or
+   a UNIQUE index without nullable columns */
+static
+GList *pick_primary_key(GList *index_columns, gboolean use_any_index, GList **candidates, gchar **key_name, gboolean *unique){
+  GList *primary_key=NULL, *l=NULL;
+  struct catalog_index_column *cic=NULL;
+  *candidates=NULL;
+  *key_name=NULL;
+  *unique=FALSE;
+  for (l=index_columns; l; l=l->next){
+    cic=l->data;
+    if (cic->column && !strcmp(cic->key_name, "PRIMARY") ) {
+      // Pick first column in PK, cardinality doesn't matter
+      primary_key=g_list_append(primary_key,g_strdup(cic->column));
+    }
+  }
+  if (primary_key){
+    *key_name=g_strdup("PRIMARY");
+    *unique=TRUE;
+    return primary_key;
+  }
+
+  // If no PK found, try using first UNIQUE index
+  const gchar *unique_key=NULL;
+  gboolean nullable=FALSE;
+  for (l=index_columns; l; l=l->next){
+    cic=l->data;
+    if (cic->column && !cic->non_unique) {
+      // only the columns of that index
+      if (unique_key && strcmp(unique_key, cic->key_name))
+        break;
+      unique_key=cic->key_name;
+      nullable|=cic->nullable;
+      primary_key=g_list_append(primary_key,g_strdup(cic->column));
+    }
+  }
+  if (primary_key){
+    *key_name=g_strdup(unique_key);
+    // rows with NULL on a column of a UNIQUE index are not unique
+    *unique=!nullable;
+    return primary_key;
+  }
+
+  // Still unlucky? Pick any high-cardinality index, with all its columns
+  if (use_any_index) {
+    GList *indexes=NULL;
+    struct index_candidate *current=NULL;
+    gboolean truncated=FALSE;
+    for (l=index_columns; l; l=l->next){
+      cic=l->data;
+      if (cic->seq == 1){
+        current=NULL;
+        truncated=FALSE;
+        // functional key parts have not column
+        if (!cic->column)
+          continue;
+        current=g_new0(struct index_candidate, 1);
+        current->cardinality=cic->cardinality;
+        current->key_name=g_strdup(cic->key_name);
+        indexes=g_list_prepend(indexes, current);
+      }
+      if (!current || truncated)
+        continue;
+      if (!cic->column){
+        truncated=TRUE;
+        continue;
+      }
+      current->columns=g_list_append(current->columns, g_strdup(cic->column));
+    }
+    // stable, so ties keep the order of SHOW INDEX
+    indexes=g_list_sort(g_list_reverse(indexes), compare_index_candidate);
+    for (l=indexes; l; l=l->next){
+      current=l->data;
+      if (primary_key)
+        *candidates=g_list_append(*candidates, current);
+      else{
+        primary_key=current->columns;
+        *key_name=current->key_name;
+        g_free(current);
+      }
+    }
+    g_list_free(indexes);
+  }
+  return primary_key;
+}
+
+static
+void get_primary_key(MYSQL *conn, struct db_table * dbt, struct configuration *conf, struct catalog_table *ct){
   MYSQL_RES *indexes = NULL;
   MYSQL_ROW row;
+  GList *index_columns=NULL;
   dbt->primary_key=NULL;
+  dbt->chunk_index_unique=FALSE;
+  if (ct){
+    dbt->primary_key=pick_primary_key(ct->index_columns, conf->use_any_index, &dbt->chunk_index_candidates, &dbt->chunk_index, &dbt->chunk_index_unique);
+    return;
+  }
   // first have to pick index, in future should be able to preset in
   //    * configuration too
   gchar *query = g_strdup_printf("SHOW INDEX FROM %s%s%s.%s%s%s",
@@ -99,51 +278,13 @@ void get_primary_key(MYSQL *conn, struct db_table * dbt, struct configuration *c
   g_free(query);
 
   if (indexes){
-    while ((row = mysql_fetch_row(indexes))) {
-      if (!strcmp(row[2], "PRIMARY") ) {
-        // Pick first column in PK, cardinality doesn't matter
-        dbt->primary_key=g_list_append(dbt->primary_key,g_strdup(row[4]));
-      }
-    }
-    if (dbt->primary_key)
-      goto cleanup;
-
-    // If no PK found, try using first UNIQUE index
-    mysql_data_seek(indexes, 0);
-    while ((row = mysql_fetch_row(indexes))) {
-      if (!strcmp(row[1], "0")) {
-        // Again, first column of any unique index
-        dbt->primary_key=g_list_append(dbt->primary_key,g_strdup(row[4]));
-      }
-    }
-
-    if (dbt->primary_key)
-      goto cleanup;
-
-    // Still unlucky? Pick any high-cardinality index
-    if (!dbt->primary_key && conf->use_any_index) {
-      guint64 max_cardinality = 0;
-      guint64 cardinality = 0;
-      gchar *field=NULL;
-      mysql_data_seek(indexes, 0);
-      while ((row = mysql_fetch_row(indexes))) {
-        if (!strcmp(row[3], "1")) {
-          if (row[6])
-            cardinality = strtoul(row[6], NULL, 10);
-          if (cardinality > max_cardinality) {
-            field = g_strdup(row[4]);
-            max_cardinality = cardinality;
-          }
-        }
-      }
-      if (field)
-        dbt->primary_key=g_list_append(dbt->primary_key,field);
-    }
-  }
-
-cleanup:
-  if (indexes)
+    while ((row = mysql_fetch_row(indexes)))
+      index_columns=g_list_prepend(index_columns, new_catalog_index_column(row[2], row[1], row[3], row[4], row[6], row[9]));
+    index_columns=g_list_reverse(index_columns);
+    dbt->primary_key=pick_primary_key(index_columns, conf->use_any_index, &dbt->chunk_index_candidates, &dbt->chunk_index, &dbt->chunk_index_unique);
+    g_list_free_full(index_columns, (GDestroyNotify)free_catalog_index_column);
     mysql_free_result(indexes);
+  }
 }
 
 static
@@ -167,11 +308,50 @@ void get_primary_key_separated_by_comma(struct db_table * dbt) {
     dbt->primary_key_separated_by_comma = g_string_free(field_list, FALSE);
 }
 
+/* Replaces the primary_key by the next index in chunk_index_candidates.
+   Called with chunks_mutex locked, before the chunks of the table exist */
+gboolean use_next_chunk_index(struct db_table *dbt){
+  if (!dbt->chunk_index_candidates)
+    return FALSE;
+  GList *next=dbt->chunk_index_candidates;
+  struct index_candidate *ic=next->data;
+  dbt->chunk_index_candidates=g_list_remove_link(dbt->chunk_index_candidates, next);
+  free_index_columns(dbt->primary_key);
+  g_free(dbt->chunk_index);
+  dbt->primary_key=ic->columns;
+  dbt->chunk_index=ic->key_name;
+  g_free(ic);
+  g_list_free_1(next);
+  g_free(dbt->primary_key_separated_by_comma);
+  dbt->primary_key_separated_by_comma=NULL;
+  if (order_by_primary_key)
+    get_primary_key_separated_by_comma(dbt);
+  // the candidates are not unique indexes, chunked by their leading column
+  dbt->chunk_index_unique=FALSE;
+  dbt->multicolumn=FALSE;
+  return TRUE;
+}
+
+static
+void append_selectable_field(GString *field_list, char *field){
+  if (field_list->len > 0)
+    g_string_append(field_list, ",");
+  char *field_name= identifier_quote_character_protect(field);
+  g_string_append_printf(field_list, "%s%s%s", identifier_quote_character_str, field_name, identifier_quote_character_str);
+  g_free(field_name);
+}
+
 static
-GString *get_selectable_fields(MYSQL *conn, char *database, char *table) {
+GString *get_selectable_fields(MYSQL *conn, char *database, char *table, struct catalog_table *ct) {
   MYSQL_ROW row;
 
   GString *field_list = g_string_new("");
+  guint i=0;
+  if (ct){
+    for (i=0; i < ct->selectable_fields->len; i++)
+      append_selectable_field(field_list, g_ptr_array_index(ct->selectable_fields, i));
+    return field_list;
+  }
 
   gchar *query =
       g_strdup_printf("select COLUMN_NAME from information_schema.COLUMNS "
@@ -181,20 +361,8 @@ GString *get_selectable_fields(MYSQL *conn, char *database, char *table) {
   MYSQL_RES *res=m_store_result_critical(conn, query, "Failed to get Selectable Fields", NULL);
   g_free(query);
 
-  gboolean first = TRUE;
-  while ((row = mysql_fetch_row(res))) {
-    if (first) {
-      first = FALSE;
-    } else {
-      g_string_append(field_list, ",");
-    }
-
-    char *field_name= identifier_quote_character_protect(row[0]);
-    gchar *tb = g_strdup_printf("%s%s%s", identifier_quote_character_str, field_name, identifier_quote_character_str);
-    g_free(field_name);
-    g_string_append(field_list, tb);
-    g_free(tb);
-  }
+  while ((row = mysql_fetch_row(res)))
+    append_selectable_field(field_list, row[0]);
 
   mysql_free_result(res);
 
@@ -202,10 +370,12 @@ GString *get_selectable_fields(MYSQL *conn, char *database, char *table) {
 }
 
 static
-gboolean detect_generated_fields(MYSQL *conn, gchar *database, gchar* table) {
+gboolean detect_generated_fields(MYSQL *conn, gchar *database, gchar* table, struct catalog_table *ct) {
   gboolean result = FALSE;
   if (ignore_generated_fields)
     return FALSE;
+  if (ct)
+    return ct->has_generated_fields;
 
   gchar *query = g_strdup_printf(
       "SELECT COLUMN_NAME FROM information_schema.COLUMNS "
@@ -221,7 +391,9 @@ gboolean detect_generated_fields(MYSQL *conn, gchar *database, gchar* table) {
 }
 
 static
-gboolean has_json_fields(MYSQL *conn, char *database, char *table) {
+gboolean has_json_fields(MYSQL *conn, char *database, char *table, struct catalog_table *ct) {
+  if (ct)
+    return ct->has_json_fields;
   gchar *query =
       g_strdup_printf("select COLUMN_NAME from information_schema.COLUMNS "
                       "where TABLE_SCHEMA='%s' and TABLE_NAME='%s' and "
@@ -250,13 +422,15 @@ gboolean new_db_table(struct db_table **d, MYSQL *conn, struct configuration *co
     b=FALSE;
     g_mutex_unlock(all_dbts_mutex);
   }else{
-    dbt = g_new(struct db_table, 1);
+    // the counters start at zero and the names are set before it is
+    // visible to the readers of all_dbts
+    dbt = g_new0(struct db_table, 1);
     dbt->key=lkey;
     dbt->status = UNDEFINED;
-    g_hash_table_insert(all_dbts, lkey, dbt);
-    g_mutex_unlock(all_dbts_mutex);
     dbt->database = database;
     dbt->table = identifier_quote_character_protect(table);
+    g_hash_table_insert(all_dbts, lkey, dbt);
+    g_mutex_unlock(all_dbts_mutex);
     dbt->table_filename = get_ref_table(dbt->table);
     dbt->is_sequence= is_sequence;
     if (table_collation==NULL)
@@ -266,7 +440,8 @@ gboolean new_db_table(struct db_table **d, MYSQL *conn, struct configuration *co
       if ( dbt->character_set == NULL)
         g_warning("Collation '%s' not found on INFORMATION_SCHEMA.COLLATIONS used by `%s`.`%s`",table_collation,database->source_database,table);
     }
-    dbt->has_json_fields = has_json_fields(conn, dbt->database->source_database, dbt->table);
+    struct catalog_table *ct=get_catalog_table(database->source_database, table);
+    dbt->has_json_fields = has_json_fields(conn, dbt->database->source_database, dbt->table, ct);
     dbt->rows_lock= g_mutex_new();
     dbt->rows_total=0;
     dbt->escaped_table = escape_string(conn,dbt->table);
@@ -277,6 +452,12 @@ gboolean new_db_table(struct db_table **d, MYSQL *conn, struct configuration *co
     dbt->partition_regex=g_hash_table_lookup(conf_per_table.all_partition_regex_per_table, lkey);
     dbt->max_threads_per_table=max_threads_per_table;
     dbt->current_threads_running=0;
+    dbt->profile_step=0;
+    dbt->profile_rows=0;
+    dbt->profile_bytes=0;
+    dbt->profile_time=0;
+    dbt->data_length=0;
+    dbt->estimated_rows=0;
 
     // Load chunk step size values
     gchar *rows_p_chunk=g_hash_table_lookup(conf_per_table.all_rows_per_table, lkey);
@@ -313,17 +494,29 @@ gboolean new_db_table(struct db_table **d, MYSQL *conn, struct configuration *co
     dbt->max=NULL;
     dbt->chunks=NULL;
     dbt->load_data_header=NULL;
+    dbt->binary_header=NULL;
     dbt->load_data_suffix=NULL;
     dbt->insert_statement=NULL;
+    dbt->anonymized_function=NULL;
+    dbt->encoder_plan=NULL;
+    dbt->blob_stream_checked=FALSE;
+    dbt->blob_stream=FALSE;
     dbt->chunks_mutex=g_mutex_new();
     dbt->chunks_queue=g_async_queue_new();
     dbt->chunks_completed=g_new(int,1);
     *(dbt->chunks_completed)=0;
-    get_primary_key(conn,dbt,conf);
+    dbt->chunk_index_candidates=NULL;
+    dbt->chunk_index=NULL;
+    dbt->plan_guard_hint=NULL;
+    dbt->plan_guard_queries=0;
+    get_primary_key(conn,dbt,conf,ct);
     dbt->primary_key_separated_by_comma = NULL;
     if (order_by_primary_key)
       get_primary_key_separated_by_comma(dbt);
-    dbt->multicolumn = !use_single_column && g_list_length(dbt->primary_key) > 1;
+    // a non unique or nullable key can have every row of a value of its
+    // leading column with NULL on the next one, the next column can not
+    // bound them
+    dbt->multicolumn = !use_single_column && dbt->chunk_index_unique && g_list_length(dbt->primary_key) > 1;
 
     gchar *columns_on_select=g_hash_table_lookup(conf_per_table.all_columns_on_select_per_table, lkey);
 
@@ -338,9 +531,9 @@ gboolean new_db_table(struct db_table **d, MYSQL *conn, struct configuration *co
       }
 
     }else if (!dbt->columns_on_insert){
-      dbt->complete_insert = complete_insert || detect_generated_fields(conn, dbt->database->source_database_escaped, dbt->escaped_table);
+      dbt->complete_insert = complete_insert || detect_generated_fields(conn, dbt->database->source_database_escaped, dbt->escaped_table, ct);
       if (dbt->complete_insert) {
-        dbt->select_fields = get_selectable_fields(conn, dbt->database->source_database_escaped, dbt->escaped_table);
+        dbt->select_fields = get_selectable_fields(conn, dbt->database->source_database_escaped, dbt->escaped_table, ct);
       }
     }
 
@@ -348,9 +541,26 @@ gboolean new_db_table(struct db_table **d, MYSQL *conn, struct configuration *co
     dbt->anonymized_function=NULL;
     dbt->indexes_checksum=NULL;
     dbt->data_checksum=NULL;
+    // the rows on the target are not the same when they are masqueraded or
+    // the columns are changed
+    dbt->chunk_checksums= data_checksums && !columns_on_select && !dbt->columns_on_insert &&
+        !g_hash_table_lookup(conf_per_table.all_anonymized_function, lkey) &&
+        !( get_major() == 5 && get_secondary() == 7 && dbt->has_json_fields );
+    dbt->chunk_checksum_expression=NULL;
+    dbt->chunk_checksum_list=NULL;
+    dbt->partition_files=NULL;
+    dbt->file_checksums=NULL;
+    dbt->table_definition=NULL;
     dbt->schema_checksum=NULL;
     dbt->triggers_checksum=NULL;
     dbt->rows=0;
+    dbt->rows_counted=0;
+    dbt->has_rows_counted=FALSE;
+    dbt->statement_size=0;
+    dbt->statement_max_rows=0;
+    dbt->metadata_delta_rows=0;
+    dbt->metadata_delta_sent=FALSE;
+    dbt->bytes=0;
  // dbt->chunk_functions.process=NULL;
     b=TRUE;
   }
@@ -25,6 +25,31 @@ enum db_table_states{
   READY
 };
 
+enum column_encoder_op{
+  ENCODE_SQL_NUMBER,
+  ENCODE_SQL_STRING,
+  ENCODE_SQL_HEX,
+  ENCODE_SQL_JSON,
+  ENCODE_LOAD_DATA_NUMBER,
+  ENCODE_LOAD_DATA_STRING,
+  ENCODE_LOAD_DATA_HEX
+};
+
+struct column_encoder{
+  enum column_encoder_op op;
+  struct function_pointer *function;
+  const gchar *terminated_by;
+};
+
+// --data-checksums of the rows returned by one chunk query
+struct chunk_checksum{
+  gchar *checksum;
+  guint64 rows;
+  gchar *partition;
+  gchar *where;
+  // data files, as myloader will see them, where the rows were written
+  GList *files;
+};
 
 struct db_table {
   gchar *key;
@@ -39,16 +64,35 @@ struct db_table {
   gboolean complete_insert;
   GString *insert_statement;
   GString *load_data_header;
+  GString *binary_header;
   GString *load_data_suffix;
   gboolean is_transactional;
   gboolean is_sequence;
   gboolean has_json_fields;
   char *character_set;
   guint64 rows_total;
+  // rows and bytes are added atomically by the writers
   guint64 rows;
+  // COUNT(*) of the table in the snapshot, with --check-row-count
+  guint64 rows_counted;
+  gboolean has_rows_counted;
+  // with --adaptive-statement-size, 0 until the first chunk is dumped
+  guint statement_size;
+  guint64 statement_max_rows;
+  // rows in the last partial metadata of --stream, only used by its writer
+  guint64 metadata_delta_rows;
+  gboolean metadata_delta_sent;
+  // statement bytes written, only accounted with --metrics-listen
+  guint64 bytes;
   guint64 estimated_remaining_steps;
+  // the chunk profile
   GMutex *rows_lock;
   struct function_pointer ** anonymized_function;
+  struct column_encoder *encoder_plan;
+  // with --blob-slice-size, decided on the first chunk from the result
+  // metadata: whether the chunks are read with a prepared statement
+  gboolean blob_stream_checked;
+  gboolean blob_stream;
   gchar *where;
   gchar *limit;
   gchar *columns_on_insert;
@@ -58,10 +102,33 @@ struct db_table {
   GMutex *chunks_mutex;
   GAsyncQueue *chunks_queue;
   GList *primary_key;
+  // the other indexes the table can be chunked by, when it has not PK
+  GList *chunk_index_candidates;
+  // name of the index of primary_key
+  gchar *chunk_index;
+  // every row has a distinct value of primary_key without NULLs, only then
+  // the chunks can be split by its next columns
+  gboolean chunk_index_unique;
+  // FORCE INDEX added to the chunk queries by the plan guard
+  gchar *plan_guard_hint;
+  gint plan_guard_queries;
   gchar *primary_key_separated_by_comma;
   gboolean multicolumn;
   gint * chunks_completed;
   gchar *data_checksum;
+  // with --data-checksums the data is verified per chunk instead of with
+  // the CHECKSUM TABLE job, which is kept for tables this cannot be used on
+  gboolean chunk_checksums;
+  gchar *chunk_checksum_expression;
+  GList *chunk_checksum_list;
+  // parsed SHOW CREATE TABLE, set when the schema is dumped
+  struct table_definition *table_definition;
+  // partition -> its data files, for myloader --exchange-partitions.
+  // Protected by chunks_mutex
+  GHashTable *partition_files;
+  // basename -> "crc32 of the content;crc32 of the file", --file-checksums.
+  // Protected by chunks_mutex
+  GHashTable *file_checksums;
   gchar *schema_checksum;
   gchar *indexes_checksum;
   gchar *triggers_checksum;
@@ -74,12 +141,26 @@ struct db_table {
   enum db_table_states status;
   guint max_threads_per_table;
   guint current_threads_running;
+  // accumulated by update_chunk_profile()
+  guint64 profile_step;
+  guint64 profile_rows;
+  guint64 profile_bytes;
+  GTimeSpan profile_time;
+  // from SHOW TABLE STATUS, used by table_order_function
+  guint64 data_length;
+  guint64 estimated_rows;
 };
 
 #endif
 void initialize_table();
 void finalize_table();
+void lock_all_dbts();
+void unlock_all_dbts();
 void free_db_table(struct db_table * dbt);
+gboolean use_next_chunk_index(struct db_table *dbt);
+gint compare_dbt_by_size(gconstpointer a, gconstpointer b);
+gint compare_dbt_by_rows(gconstpointer a, gconstpointer b);
+gboolean set_table_order(const gchar *value);
 gboolean new_db_table(struct db_table **d, MYSQL *conn, struct configuration *conf,
                       struct database *database, char *table, char *table_collation,
                       gboolean is_sequence);
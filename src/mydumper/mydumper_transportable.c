@@ -0,0 +1,286 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <glib/gstdio.h>
+#include "mydumper.h"
+#include "mydumper_global.h"
+#include "mydumper_common.h"
+#include "mydumper_write.h"
+#include "mydumper_transportable.h"
+
+#define TABLESPACE_READ_SIZE 4194304
+
+gboolean transportable_tablespaces=FALSE;
+
+static gchar *source_datadir=NULL;
+// holds the FOR EXPORT lock until the files are copied
+static MYSQL *export_conn=NULL;
+// keys of the tables that are locked FOR EXPORT
+static GHashTable *exported_tables=NULL;
+static GMutex *exported_tables_mutex=NULL;
+static GAsyncQueue *tablespace_queue=NULL;
+static GThread **tablespace_threads=NULL;
+static guint num_tablespace_threads=0;
+static gint exported_count=0;
+// locked tables that are not copied yet, the lock is released at 0
+static gint pending_tables=0;
+static GMutex *export_conn_mutex=NULL;
+static gboolean export_unlocked=FALSE;
+
+// names that are stored the same way in the datadir
+static
+gboolean is_datadir_name(const gchar *name){
+  const gchar *c;
+  for (c=name; *c; c++)
+    if (!g_ascii_isalnum(*c) && *c != '_')
+      return FALSE;
+  return c != name;
+}
+
+static
+gchar *build_datadir_path(const gchar *database, const gchar *table, const gchar *extension){
+  gchar *name=g_strdup_printf("%s.%s", table, extension);
+  gchar *path=g_build_filename(source_datadir, database, name, NULL);
+  g_free(name);
+  return path;
+}
+
+static
+gboolean is_exportable_table(gchar *database, gchar *table){
+  if (!g_strcmp0(database, "mysql") || !g_strcmp0(database, "sys"))
+    return FALSE;
+  if (!is_datadir_name(database) || !is_datadir_name(table))
+    return FALSE;
+  if (tables && !is_table_in_list(database, table, tables))
+    return FALSE;
+  if (is_mysql_special_tables(database, table))
+    return FALSE;
+  if (tables_skiplist_file && check_skiplist(database, table))
+    return FALSE;
+  if (!eval_regex(database, table))
+    return FALSE;
+  // the tables whose rows are filtered or not dumped are not copied, they
+  // are not locked
+  gchar *key=build_dbt_key(database, table);
+  struct object_to_export object_to_export;
+  parse_object_to_export(&object_to_export, g_hash_table_lookup(conf_per_table.all_object_to_export, key));
+  gboolean filtered= object_to_export.no_data ||
+                     g_hash_table_lookup(conf_per_table.all_where_per_table, key) ||
+                     g_hash_table_lookup(conf_per_table.all_limit_per_table, key) ||
+                     g_hash_table_lookup(conf_per_table.all_partition_regex_per_table, key);
+  g_free(key);
+  if (filtered)
+    return FALSE;
+  // partitioned tables and tables on general or system tablespaces have not
+  // their own file
+  gchar *path=build_datadir_path(database, table, "ibd");
+  gboolean exists=g_file_test(path, G_FILE_TEST_IS_REGULAR);
+  g_free(path);
+  return exists;
+}
+
+static
+gboolean copy_tablespace_file(struct db_table *dbt, const gchar *extension){
+  gchar *path=build_datadir_path(dbt->database->source_database, dbt->table, extension);
+  FILE *in=g_fopen(path, "r");
+  if (!in){
+    g_critical("Could not open %s of %s.%s: %s", path, dbt->database->source_database, dbt->table, strerror(errno));
+    errors++;
+    g_free(path);
+    return FALSE;
+  }
+  gchar *filename=build_filename(dbt->database->database_name_in_filename, dbt->table_filename, 0, 0, extension, NULL);
+  int file=m_open(&filename, "w");
+  GString *block=g_string_sized_new(TABLESPACE_READ_SIZE);
+  guint64 size=0;
+  gsize n;
+  gboolean ok=TRUE;
+  g_string_set_size(block, TABLESPACE_READ_SIZE);
+  while (ok && (n=fread(block->str, 1, TABLESPACE_READ_SIZE, in)) > 0){
+    g_string_set_size(block, n);
+    ok=write_data(file, block);
+    size+=n;
+    g_string_set_size(block, TABLESPACE_READ_SIZE);
+  }
+  if (ok && ferror(in)){
+    g_critical("Could not read %s of %s.%s: %s", path, dbt->database->source_database, dbt->table, strerror(errno));
+    errors++;
+    ok=FALSE;
+  }
+  fclose(in);
+  m_close(0, file, filename, size, dbt);
+  g_string_free(block, TRUE);
+  g_free(path);
+  return ok;
+}
+
+static
+void unlock_exported_tables(){
+  g_mutex_lock(export_conn_mutex);
+  if (!export_unlocked){
+    m_query_warning(export_conn, "UNLOCK TABLES", "Failed to unlock the tables locked FOR EXPORT", NULL);
+    export_unlocked=TRUE;
+    g_message("Tables locked FOR EXPORT are unlocked");
+  }
+  g_mutex_unlock(export_conn_mutex);
+}
+
+// The tables are writable again as soon as the last locked table is done
+static
+void release_exported_table(){
+  if (g_atomic_int_dec_and_test(&pending_tables))
+    unlock_exported_tables();
+}
+
+// The .cfg first, myloader needs it when the .ibd arrives
+static
+void *tablespace_thread(void *data){
+  (void) data;
+  struct db_table *dbt=NULL;
+  while ((dbt=g_async_queue_pop(tablespace_queue)) != GINT_TO_POINTER(-1)){
+    g_message("Copying tablespace of %s.%s", dbt->database->source_database, dbt->table);
+    if (copy_tablespace_file(dbt, "cfg"))
+      copy_tablespace_file(dbt, "ibd");
+    release_exported_table();
+  }
+  return NULL;
+}
+
+/* Called before the global lock. The list of tables is read from the server
+   with the filters of the dump, a table added after it is dumped logically */
+void start_transportable(MYSQL *conn, gchar **databases){
+  if (!transportable_tablespaces || no_data)
+    return;
+  if (!is_mysql_like() || get_product() == SERVER_TYPE_RDS){
+    g_warning("--transportable-tablespaces needs MySQL, Percona Server or MariaDB with access to the datadir, the tables are going to be dumped logically");
+    transportable_tablespaces=FALSE;
+    return;
+  }
+  struct M_ROW *mr=m_store_result_row(conn, "SELECT @@datadir", m_warning, m_warning, "Failed to get the datadir", NULL);
+  if (mr->row && mr->row[0])
+    source_datadir=g_strdup(mr->row[0]);
+  m_store_result_row_free(mr);
+  if (!source_datadir || !g_file_test(source_datadir, G_FILE_TEST_IS_DIR)){
+    g_warning("Datadir %s is not accessible, the tables are going to be dumped logically", source_datadir ? source_datadir : "");
+    transportable_tablespaces=FALSE;
+    return;
+  }
+
+  GString *query=g_string_new("SELECT TABLE_SCHEMA, TABLE_NAME FROM information_schema.TABLES WHERE ENGINE='InnoDB' AND TABLE_TYPE='BASE TABLE' AND TABLE_SCHEMA ");
+  guint i=0;
+  if (databases && g_strv_length(databases) > 0){
+    g_string_append(query, "IN (");
+    for (i=0; databases[i]; i++){
+      gchar *escaped=escape_string(conn, databases[i]);
+      g_string_append_printf(query, "%s'%s'", i > 0 ? "," : "", escaped);
+      g_free(escaped);
+    }
+    g_string_append_c(query, ')');
+  }else
+    g_string_append(query, "NOT IN ('information_schema','performance_schema')");
+  MYSQL_RES *res=m_store_result(conn, query->str, m_warning, "Failed to list the InnoDB tables", NULL);
+  g_string_free(query, TRUE);
+  if (!res){
+    transportable_tablespaces=FALSE;
+    return;
+  }
+  exported_tables=g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  exported_tables_mutex=g_mutex_new();
+  GString *flush=g_string_new("FLUSH TABLES ");
+  MYSQL_ROW row;
+  while ((row=mysql_fetch_row(res))){
+    if (!is_exportable_table(row[0], row[1]))
+      continue;
+    g_string_append_printf(flush, "%s%c%s%c.%c%s%c", g_hash_table_size(exported_tables) > 0 ? "," : "",
+        identifier_quote_character, row[0], identifier_quote_character, identifier_quote_character, row[1], identifier_quote_character);
+    g_hash_table_insert(exported_tables, build_dbt_key(row[0], row[1]), GINT_TO_POINTER(1));
+  }
+  mysql_free_result(res);
+  if (g_hash_table_size(exported_tables) == 0){
+    g_message("There are no InnoDB tables with their own tablespace to export");
+    g_string_free(flush, TRUE);
+    return;
+  }
+
+  g_string_append(flush, " FOR EXPORT");
+  export_conn=mysql_init(NULL);
+  m_connect(export_conn);
+  execute_gstring(export_conn, set_session);
+  if (m_query(export_conn, flush->str, m_warning, "Could not lock the tables FOR EXPORT, they are going to be dumped logically", NULL)){
+    g_hash_table_remove_all(exported_tables);
+    mysql_close(export_conn);
+    export_conn=NULL;
+    g_string_free(flush, TRUE);
+    return;
+  }
+  g_message("%u tables locked FOR EXPORT", g_hash_table_size(exported_tables));
+  g_string_free(flush, TRUE);
+  pending_tables=g_hash_table_size(exported_tables);
+  export_conn_mutex=g_mutex_new();
+  export_unlocked=FALSE;
+
+  tablespace_queue=g_async_queue_new();
+  num_tablespace_threads=num_threads;
+  tablespace_threads=g_new(GThread *, num_tablespace_threads);
+  for (i=0; i < num_tablespace_threads; i++)
+    tablespace_threads[i]=m_thread_new("tablespace", (GThreadFunc)tablespace_thread, NULL, "Tablespace thread could not be created");
+}
+
+/* TRUE when the files of the table are copied instead of its rows. Filters
+   on the rows need the logical dump */
+gboolean add_transportable_table(struct db_table *dbt){
+  if (tablespace_queue == NULL)
+    return FALSE;
+  g_mutex_lock(exported_tables_mutex);
+  gboolean exported=g_hash_table_remove(exported_tables, dbt->key);
+  g_mutex_unlock(exported_tables_mutex);
+  if (!exported)
+    return FALSE;
+  if (dbt->where || dbt->limit || dbt->partition_regex || dbt->anonymized_function){
+    release_exported_table();
+    return FALSE;
+  }
+  g_atomic_int_inc(&exported_count);
+  g_async_queue_push(tablespace_queue, dbt);
+  return TRUE;
+}
+
+/* After the working threads. The tables are unlocked here when some locked
+   tables were not dumped */
+void finish_transportable(){
+  guint i;
+  if (export_conn == NULL)
+    return;
+  for (i=0; i < num_tablespace_threads; i++)
+    g_async_queue_push(tablespace_queue, GINT_TO_POINTER(-1));
+  for (i=0; i < num_tablespace_threads; i++)
+    g_thread_join(tablespace_threads[i]);
+  g_free(tablespace_threads);
+  g_async_queue_unref(tablespace_queue);
+  tablespace_queue=NULL;
+  unlock_exported_tables();
+  g_mutex_free(export_conn_mutex);
+  export_conn_mutex=NULL;
+  mysql_close(export_conn);
+  export_conn=NULL;
+  g_message("Tablespaces of %d tables exported", exported_count);
+  g_hash_table_destroy(exported_tables);
+  exported_tables=NULL;
+}
@@ -0,0 +1,33 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#if !defined(mydumper_mydumper_transportable)
+#define mydumper_mydumper_transportable
+
+#include <mysql.h>
+#include <glib.h>
+#include "mydumper_table.h"
+
+/* With --transportable-tablespaces the InnoDB tables that have their own .ibd
+   in the datadir are locked with FLUSH TABLES ... FOR EXPORT before the global
+   lock. Writes are blocked on them from that point, so the .ibd and .cfg that
+   are copied through the file handler match the snapshot of the backup. The
+   tables that can not be exported are dumped as usual */
+void start_transportable(MYSQL *conn, gchar **databases);
+gboolean add_transportable_table(struct db_table *dbt);
+void finish_transportable();
+#endif
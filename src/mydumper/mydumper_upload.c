@@ -0,0 +1,503 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#include <mysql.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "mydumper.h"
+#include "mydumper_global.h"
+#include "mydumper_file_handler.h"
+#include "mydumper_upload.h"
+
+gchar *upload_url=NULL;
+guint num_upload_threads=4;
+guint upload_part_size=16;
+guint upload_max_in_flight=256;
+
+// S3 compatible endpoint, the path has the bucket and the prefix
+static gchar *upload_host=NULL;
+static guint16 upload_port=0;
+static gboolean upload_tls=FALSE;
+static gchar *upload_path=NULL;
+static const gchar *access_key=NULL;
+static const gchar *secret_key=NULL;
+static const gchar *session_token=NULL;
+static const gchar *region=NULL;
+
+static GAsyncQueue *upload_queue=NULL;
+static GAsyncQueue *upload_part_queue=NULL;
+static GThread **upload_threads=NULL;
+static GThread **upload_part_threads=NULL;
+
+// bytes of the parts that were read and are not uploaded yet
+static GMutex *in_flight_mutex=NULL;
+static GCond *in_flight_cond=NULL;
+static guint64 in_flight=0;
+
+struct upload_file{
+  gchar *key;
+  gchar *upload_id;
+  gchar **etags;
+  guint pending;
+  gboolean failed;
+  GMutex *mutex;
+  GCond *cond;
+};
+
+struct upload_part{
+  struct upload_file *uf;
+  guint number;
+  gchar *data;
+  gsize len;
+};
+
+static
+void in_flight_reserve(guint64 size){
+  g_mutex_lock(in_flight_mutex);
+  while (in_flight > 0 && in_flight + size > (guint64)upload_max_in_flight * 1024 * 1024)
+    g_cond_wait(in_flight_cond, in_flight_mutex);
+  in_flight+=size;
+  g_mutex_unlock(in_flight_mutex);
+}
+
+static
+void in_flight_release(guint64 size){
+  g_mutex_lock(in_flight_mutex);
+  in_flight-=size;
+  g_cond_broadcast(in_flight_cond);
+  g_mutex_unlock(in_flight_mutex);
+}
+
+static
+void hmac_sha256(const guchar *key, gsize key_len, const gchar *data, guchar *digest){
+  gsize len=32;
+  GHmac *hmac=g_hmac_new(G_CHECKSUM_SHA256, key, key_len);
+  g_hmac_update(hmac, (const guchar *)data, strlen(data));
+  g_hmac_get_digest(hmac, digest, &len);
+  g_hmac_unref(hmac);
+}
+
+// AWS Signature Version 4, only host, x-amz-content-sha256, x-amz-date and
+// x-amz-security-token are signed
+static
+void append_signed_headers(GString *request, const gchar *method, const gchar *uri, const gchar *query, const gchar *host, const gchar *payload_hash){
+  GDateTime *now=g_date_time_new_now_utc();
+  gchar *amz_date=g_date_time_format(now, "%Y%m%dT%H%M%SZ");
+  gchar *date=g_date_time_format(now, "%Y%m%d");
+  g_date_time_unref(now);
+  g_string_append_printf(request, "Host: %s\r\nx-amz-content-sha256: %s\r\nx-amz-date: %s\r\n", host, payload_hash, amz_date);
+  if (session_token)
+    g_string_append_printf(request, "x-amz-security-token: %s\r\n", session_token);
+  if (access_key && secret_key){
+    const gchar *signed_headers=session_token?"host;x-amz-content-sha256;x-amz-date;x-amz-security-token":"host;x-amz-content-sha256;x-amz-date";
+    GString *canonical=g_string_sized_new(512);
+    g_string_append_printf(canonical, "%s\n%s\n%s\nhost:%s\nx-amz-content-sha256:%s\nx-amz-date:%s\n", method, uri, query, host, payload_hash, amz_date);
+    if (session_token)
+      g_string_append_printf(canonical, "x-amz-security-token:%s\n", session_token);
+    g_string_append_printf(canonical, "\n%s\n%s", signed_headers, payload_hash);
+    gchar *canonical_hash=g_compute_checksum_for_string(G_CHECKSUM_SHA256, canonical->str, canonical->len);
+    gchar *scope=g_strdup_printf("%s/%s/s3/aws4_request", date, region);
+    gchar *string_to_sign=g_strdup_printf("AWS4-HMAC-SHA256\n%s\n%s\n%s", amz_date, scope, canonical_hash);
+    gchar *secret=g_strdup_printf("AWS4%s", secret_key);
+    guchar k_date[32], k_region[32], k_service[32], k_signing[32], signature[32];
+    hmac_sha256((guchar *)secret, strlen(secret), date, k_date);
+    hmac_sha256(k_date, 32, region, k_region);
+    hmac_sha256(k_region, 32, "s3", k_service);
+    hmac_sha256(k_service, 32, "aws4_request", k_signing);
+    hmac_sha256(k_signing, 32, string_to_sign, signature);
+    g_string_append_printf(request, "Authorization: AWS4-HMAC-SHA256 Credential=%s/%s, SignedHeaders=%s, Signature=", access_key, scope, signed_headers);
+    guint i;
+    for (i=0; i<32; i++)
+      g_string_append_printf(request, "%02x", signature[i]);
+    g_string_append(request, "\r\n");
+    g_free(secret);
+    g_free(string_to_sign);
+    g_free(scope);
+    g_free(canonical_hash);
+    g_string_free(canonical, TRUE);
+  }
+  g_free(date);
+  g_free(amz_date);
+}
+
+static
+gchar *get_response_header(GString *response, const gchar *name){
+  gchar **lines=g_strsplit(response->str, "\r\n", 0);
+  gchar *value=NULL;
+  guint i;
+  for (i=1; lines[i] != NULL && lines[i][0] != '\0'; i++){
+    if (!g_ascii_strncasecmp(lines[i], name, strlen(name)) && lines[i][strlen(name)] == ':'){
+      value=g_strstrip(g_strdup(&(lines[i][strlen(name)+1])));
+      break;
+    }
+  }
+  g_strfreev(lines);
+  return value;
+}
+
+static
+gchar *get_xml_value(GString *response, const gchar *tag){
+  gchar *open_tag=g_strdup_printf("<%s>", tag);
+  gchar *close_tag=g_strdup_printf("</%s>", tag);
+  gchar *value=NULL;
+  gchar *from=g_strstr_len(response->str, response->len, open_tag);
+  if (from){
+    from+=strlen(open_tag);
+    gchar *to=g_strstr_len(from, -1, close_tag);
+    if (to)
+      value=g_strndup(from, to - from);
+  }
+  g_free(open_tag);
+  g_free(close_tag);
+  return value;
+}
+
+// One request per connection, the response is read until the server closes it
+static
+guint http_request(const gchar *method, const gchar *key, const gchar *query, const gchar *body, gsize body_len, GString *response){
+  guint status=0;
+  GError *error=NULL;
+  gchar *uri=g_strdup_printf("%s/%s", upload_path, key);
+  gchar *host=(upload_port == 80 && !upload_tls) || (upload_port == 443 && upload_tls) ?
+      g_strdup(upload_host) : g_strdup_printf("%s:%u", upload_host, upload_port);
+  gchar *payload_hash=g_compute_checksum_for_data(G_CHECKSUM_SHA256, (const guchar *)(body?body:""), body_len);
+  GString *request=g_string_sized_new(1024);
+  g_string_append_printf(request, "%s %s%s%s HTTP/1.1\r\n", method, uri, strlen(query)?"?":"", query);
+  append_signed_headers(request, method, uri, query, host, payload_hash);
+  g_string_append_printf(request, "Content-Length: %" G_GSIZE_FORMAT "\r\nConnection: close\r\n\r\n", body_len);
+
+  g_string_set_size(response, 0);
+  GSocketClient *client=g_socket_client_new();
+  g_socket_client_set_tls(client, upload_tls);
+  GSocketConnection *connection=g_socket_client_connect_to_host(client, upload_host, upload_port, NULL, &error);
+  if (connection){
+    GOutputStream *out=g_io_stream_get_output_stream(G_IO_STREAM(connection));
+    GInputStream *in=g_io_stream_get_input_stream(G_IO_STREAM(connection));
+    gsize written=0;
+    if (g_output_stream_write_all(out, request->str, request->len, &written, NULL, &error) &&
+        (body_len == 0 || g_output_stream_write_all(out, body, body_len, &written, NULL, &error))){
+      gchar buffer[16384];
+      gssize len;
+      while ((len=g_input_stream_read(in, buffer, sizeof(buffer), NULL, &error)) > 0)
+        g_string_append_len(response, buffer, len);
+      if (response->len > 12 && g_str_has_prefix(response->str, "HTTP/1."))
+        status=g_ascii_strtoull(&(response->str[9]), NULL, 10);
+    }
+    g_object_unref(connection);
+  }
+  if (error){
+    g_warning("Upload of %s failed: %s", key, error->message);
+    g_error_free(error);
+  }
+  g_object_unref(client);
+  g_string_free(request, TRUE);
+  g_free(payload_hash);
+  g_free(host);
+  g_free(uri);
+  return status;
+}
+
+static
+guint http_request_with_retries(const gchar *method, const gchar *key, const gchar *query, const gchar *body, gsize body_len, GString *response){
+  guint status=0, retry;
+  for (retry=0; retry<UPLOAD_RETRIES; retry++){
+    status=http_request(method, key, query, body, body_len, response);
+    if (status >= 200 && status < 300)
+      break;
+    g_warning("Upload request %s %s returned %u, retrying", method, key, status);
+    g_usleep(G_USEC_PER_SEC * (retry + 1));
+  }
+  return status;
+}
+
+static
+void *process_upload_part(void *data){
+  set_thread_affinity(AFFINITY_IO);
+  (void) data;
+  GString *response=g_string_sized_new(1024);
+  struct upload_part *part=NULL;
+  for(;;){
+    part=m_async_queue_pop(upload_part_queue);
+    if (part->uf == NULL){
+      g_free(part);
+      break;
+    }
+    struct upload_file *uf=part->uf;
+    gchar *escaped_upload_id=g_uri_escape_string(uf->upload_id, NULL, FALSE);
+    gchar *query=g_strdup_printf("partNumber=%u&uploadId=%s", part->number, escaped_upload_id);
+    guint status=http_request_with_retries("PUT", uf->key, query, part->data, part->len, response);
+    gchar *etag=status>=200 && status<300 ? get_response_header(response, "ETag") : NULL;
+    g_free(query);
+    g_free(escaped_upload_id);
+    g_free(part->data);
+    in_flight_release(part->len);
+    g_mutex_lock(uf->mutex);
+    if (etag)
+      uf->etags[part->number - 1]=etag;
+    else
+      uf->failed=TRUE;
+    uf->pending--;
+    g_cond_signal(uf->cond);
+    g_mutex_unlock(uf->mutex);
+    g_free(part);
+  }
+  g_string_free(response, TRUE);
+  return NULL;
+}
+
+/* Every way out goes through cleanup, once the upload was initiated a
+   failure aborts it, so the parts that were uploaded are not kept */
+static
+gboolean upload_file_in_parts(const gchar *filename, struct upload_file *uf, guint64 size, GString *response){
+  guint64 part_size=(guint64)upload_part_size * 1024 * 1024;
+  guint parts=(size + part_size - 1) / part_size, i;
+  gboolean r=FALSE;
+  gchar *query=NULL;
+  if (http_request_with_retries("POST", uf->key, "uploads=", NULL, 0, response) / 100 != 2 ||
+      (uf->upload_id=get_xml_value(response, "UploadId")) == NULL){
+    g_critical("Multipart upload of %s could not be initiated", filename);
+    return FALSE;
+  }
+  gchar *escaped_upload_id=g_uri_escape_string(uf->upload_id, NULL, FALSE);
+  query=g_strdup_printf("uploadId=%s", escaped_upload_id);
+  g_free(escaped_upload_id);
+  uf->etags=g_new0(gchar *, parts + 1);
+  uf->mutex=g_mutex_new();
+  uf->cond=g_cond_new();
+  FILE *file=g_fopen(filename, "r");
+  if (!file){
+    g_critical("Couldn't open file %s to upload (%s)", filename, strerror(errno));
+    goto cleanup;
+  }
+  for (i=0; i<parts; i++){
+    struct upload_part *part=g_new0(struct upload_part, 1);
+    part->uf=uf;
+    part->number=i+1;
+    part->len=(i + 1 == parts) ? size - i * part_size : part_size;
+    in_flight_reserve(part->len);
+    part->data=g_malloc(part->len);
+    if (fread(part->data, 1, part->len, file) != part->len){
+      g_critical("Couldn't read file %s to upload (%s)", filename, strerror(errno));
+      in_flight_release(part->len);
+      g_free(part->data);
+      g_free(part);
+      g_mutex_lock(uf->mutex);
+      uf->failed=TRUE;
+      g_mutex_unlock(uf->mutex);
+      break;
+    }
+    g_mutex_lock(uf->mutex);
+    uf->pending++;
+    g_mutex_unlock(uf->mutex);
+    g_async_queue_push(upload_part_queue, part);
+  }
+  fclose(file);
+  g_mutex_lock(uf->mutex);
+  while (uf->pending > 0)
+    g_cond_wait(uf->cond, uf->mutex);
+  g_mutex_unlock(uf->mutex);
+
+  if (!uf->failed){
+    GString *complete=g_string_new("<CompleteMultipartUpload>");
+    for (i=0; i<parts; i++)
+      g_string_append_printf(complete, "<Part><PartNumber>%u</PartNumber><ETag>%s</ETag></Part>", i+1, uf->etags[i]);
+    g_string_append(complete, "</CompleteMultipartUpload>");
+    // S3 might return an error in the body with a 200
+    r=http_request_with_retries("POST", uf->key, query, complete->str, complete->len, response) / 100 == 2 &&
+      g_strstr_len(response->str, response->len, "<Error>") == NULL;
+    g_string_free(complete, TRUE);
+  }
+
+cleanup:
+  if (!r){
+    g_critical("Multipart upload of %s failed, aborting it", filename);
+    if (http_request_with_retries("DELETE", uf->key, query, NULL, 0, response) / 100 != 2)
+      g_warning("Multipart upload of %s could not be aborted, its parts are kept until they expire", filename);
+  }
+  g_free(query);
+  for (i=0; i<parts; i++)
+    g_free(uf->etags[i]);
+  g_free(uf->etags);
+  uf->etags=NULL;
+  g_free(uf->upload_id);
+  uf->upload_id=NULL;
+  return r;
+}
+
+static
+gboolean upload_file(const gchar *filename, GString *response){
+  GStatBuf st;
+  if (g_stat(filename, &st) != 0){
+    g_critical("Couldn't stat file %s to upload (%s)", filename, strerror(errno));
+    return FALSE;
+  }
+  gchar *basename=g_path_get_basename(filename);
+  struct upload_file uf={NULL, NULL, NULL, 0, FALSE, NULL, NULL};
+  uf.key=g_uri_escape_string(basename, NULL, FALSE);
+  g_free(basename);
+  gboolean r=FALSE;
+  if ((guint64)st.st_size <= (guint64)upload_part_size * 1024 * 1024){
+    gchar *content=NULL;
+    gsize len=0;
+    if (g_file_get_contents(filename, &content, &len, NULL)){
+      in_flight_reserve(len);
+      r=http_request_with_retries("PUT", uf.key, "", content, len, response) / 100 == 2;
+      in_flight_release(len);
+      g_free(content);
+    }
+  }else
+    r=upload_file_in_parts(filename, &uf, st.st_size, response);
+  if (uf.mutex){
+    g_mutex_free(uf.mutex);
+    g_cond_free(uf.cond);
+  }
+  g_free(uf.upload_id);
+  g_free(uf.key);
+  return r;
+}
+
+static
+void *process_upload(void *data){
+  set_thread_affinity(AFFINITY_IO);
+  (void) data;
+  GString *response=g_string_sized_new(1024);
+  struct filename_queue_element *sf=NULL;
+  for(;;){
+    sf=m_async_queue_pop(upload_queue);
+    if (strlen(sf->filename) == 0){
+      g_free(sf->filename);
+      g_free(sf);
+      break;
+    }
+    trace("Uploading %s", sf->filename);
+    if (upload_file(sf->filename, response)){
+      g_debug("File %s uploaded", sf->filename);
+      if (no_delete == FALSE)
+        remove(sf->filename);
+    }else{
+      g_critical("File %s was not uploaded", sf->filename);
+      errors++;
+    }
+    if (sf->done)
+      g_async_queue_push(sf->done, GINT_TO_POINTER(1));
+    g_free(sf->filename);
+    g_free(sf);
+  }
+  g_string_free(response, TRUE);
+  return NULL;
+}
+
+// --exec=upload, the file is uploaded by the exec thread
+gboolean upload_file_in_process(const gchar *filename){
+  static __thread GString *response=NULL;
+  if (!upload_queue)
+    m_critical("--exec=upload needs --upload-url");
+  if (!response)
+    response=g_string_sized_new(1024);
+  trace("Uploading %s", filename);
+  if (!upload_file(filename, response)){
+    g_critical("File %s was not uploaded", filename);
+    return FALSE;
+  }
+  g_debug("File %s uploaded", filename);
+  return TRUE;
+}
+
+void upload_queue_push(struct db_table *dbt, gchar *filename){
+  GAsyncQueue *done = no_sync?NULL:g_async_queue_new();
+  g_async_queue_push(upload_queue, new_filename_queue_element(dbt,filename,done));
+  if (done){
+    g_async_queue_pop(done);
+    g_async_queue_unref(done);
+  }
+}
+
+static
+void parse_upload_url(){
+  gchar *from=NULL;
+  if (g_str_has_prefix(upload_url, "https://")){
+    upload_tls=TRUE;
+    upload_port=443;
+    from=upload_url+strlen("https://");
+  }else if (g_str_has_prefix(upload_url, "http://")){
+    upload_port=80;
+    from=upload_url+strlen("http://");
+  }else
+    m_critical("--upload-url must start with http:// or https://");
+  gchar *path=g_strstr_len(from, -1, "/");
+  if (path == NULL || strlen(path) < 2)
+    m_critical("--upload-url must have the bucket, like http://host:port/bucket/prefix");
+  upload_host=g_strndup(from, path - from);
+  gchar *port=g_strstr_len(upload_host, -1, ":");
+  if (port){
+    *port='\0';
+    upload_port=g_ascii_strtoull(port+1, NULL, 10);
+  }
+  upload_path=g_strdup(path);
+  if (g_str_has_suffix(upload_path, "/"))
+    upload_path[strlen(upload_path)-1]='\0';
+}
+
+void initialize_upload(){
+  guint i;
+  parse_upload_url();
+  access_key=g_getenv("AWS_ACCESS_KEY_ID");
+  secret_key=g_getenv("AWS_SECRET_ACCESS_KEY");
+  session_token=g_getenv("AWS_SESSION_TOKEN");
+  region=g_getenv("AWS_REGION");
+  if (region == NULL)
+    region=g_getenv("AWS_DEFAULT_REGION");
+  if (region == NULL)
+    region="us-east-1";
+  if (!access_key || !secret_key)
+    g_warning("AWS_ACCESS_KEY_ID or AWS_SECRET_ACCESS_KEY not set, requests will not be signed");
+  if (num_upload_threads == 0)
+    num_upload_threads=1;
+  if (upload_part_size < 5){
+    g_warning("--upload-part-size must be at least 5 MB, using 5");
+    upload_part_size=5;
+  }
+  in_flight_mutex=g_mutex_new();
+  in_flight_cond=g_cond_new();
+  upload_queue=g_async_queue_new();
+  upload_part_queue=g_async_queue_new();
+  register_queue_stats("upload", upload_queue);
+  register_queue_stats("upload_part", upload_part_queue);
+  upload_threads=g_new(GThread *, num_upload_threads);
+  upload_part_threads=g_new(GThread *, num_upload_threads);
+  for (i=0; i<num_upload_threads; i++){
+    upload_threads[i]=m_thread_new("upload", (GThreadFunc)process_upload, NULL, "Upload thread could not be created");
+    upload_part_threads[i]=m_thread_new("upload_part", (GThreadFunc)process_upload_part, NULL, "Upload part thread could not be created");
+  }
+  g_message("Uploading files to %s://%s:%u%s", upload_tls?"https":"http", upload_host, upload_port, upload_path);
+}
+
+void wait_upload_to_finish(){
+  guint i;
+  for (i=0; i<num_upload_threads; i++)
+    g_async_queue_push(upload_queue, new_filename_queue_element(NULL, g_strdup(""), NULL));
+  for (i=0; i<num_upload_threads; i++)
+    g_thread_join(upload_threads[i]);
+  for (i=0; i<num_upload_threads; i++)
+    g_async_queue_push(upload_part_queue, g_new0(struct upload_part, 1));
+  for (i=0; i<num_upload_threads; i++)
+    g_thread_join(upload_part_threads[i]);
+}
@@ -35,6 +35,11 @@
 #include "mydumper_create_jobs.h"
 #include "mydumper_working_thread.h"
 #include "mydumper_table.h"
+#include "mydumper_row_fetcher.h"
+#include "mydumper_replica_hosts.h"
+#include "mydumper_transportable.h"
+#include "mydumper_sample.h"
+#include "mydumper_job_queue.h"
 /* Program options */
 gboolean order_by_primary_key = FALSE;
 gboolean use_savepoints = FALSE;
@@ -69,6 +74,12 @@ extern gchar *initial_source_gtid;
 
 // Static
 static GMutex *init_mutex = NULL;
+// opened by open_worker_connections(), each worker takes its own
+static MYSQL **worker_connections = NULL;
+// Percona Server clones the snapshot of thread 1 into the other sessions
+static gboolean snapshot_clone = FALSE;
+static gulong snapshot_source_id = 0;
+static GAsyncQueue *snapshot_source_ready = NULL;
 static gchar *binlog_snapshot_gtid_executed = NULL; 
 static char **ignore_engines = NULL;
 static int sync_wait = -1;
@@ -78,11 +89,16 @@ static GMutex *view_schemas_mutex = NULL;
 static const guint tablecol= 0;
 static GThread **threads=NULL;
 static struct thread_data *thread_data;
+// set while the thread processes the initial queue
+static __thread struct thread_data *job_builder_td=NULL;
+// memory of the jobs pushed with m_async_queue_push_conservative()
+static guint64 queued_jobs_bytes=0;
 
 static
 void dump_database_thread(MYSQL *, struct database *);
 static
 void *working_thread(struct thread_data *td);
+void initialize_thread(struct thread_data *td);
 
 void initialize_working_thread(){
   database_counter = 0;
@@ -122,6 +138,8 @@ void initialize_working_thread(){
     ignore_engines = g_strsplit(ignore_engines_str, ",", 0);
 
   initialize_file_handler();
+  initialize_gstring_pool();
+  initialize_table_job_pool();
 
   initialize_jobs();
   initialize_chunk();
@@ -133,8 +151,93 @@ void initialize_working_thread(){
   }
 }
 
+static
+void setup_worker_session(MYSQL *conn){
+  GString *setup=g_string_new(set_session ? set_session->str : NULL);
+  if (!skip_tz)       g_string_append(setup, "/*!40103 SET TIME_ZONE='+00:00' */;\n");
+  if (use_savepoints) g_string_append(setup, "SET SQL_LOG_BIN = 0;\n");
+  // session settings of the snapshot, so only START TRANSACTION runs under the lock
+  if (sync_wait != -1) g_string_append_printf(setup, "SET SESSION WSREP_SYNC_WAIT = %d;\n", sync_wait);
+  g_string_append(setup, "SET SESSION TRANSACTION ISOLATION LEVEL REPEATABLE READ;\n");
+  if (!execute_gstring_batch(conn, setup)){
+    execute_gstring(conn, set_session);
+    if (!skip_tz)       m_query_critical(conn, "/*!40103 SET TIME_ZONE='+00:00' */", "Failed to set time zone", NULL);
+    if (use_savepoints) m_query_critical(conn, "SET SQL_LOG_BIN = 0", "Failed to disable binlog for the thread", NULL);
+    if (sync_wait != -1){
+      gchar *query=g_strdup_printf("SET SESSION WSREP_SYNC_WAIT = %d",sync_wait);
+      m_query_critical(conn, query, "Failed to set wsrep_sync_wait for the thread",NULL);
+      g_free(query);
+    }
+    set_transaction_isolation_level_repeatable_read(conn);
+  }
+  g_string_free(setup, TRUE);
+}
+
+void connect_worker(struct thread_data *td){
+  // mysql_init is not thread safe, especially in Connector/C
+  g_mutex_lock(init_mutex);
+  td->thrconn = mysql_init(NULL);
+  g_mutex_unlock(init_mutex);
+
+  initialize_thread(td);
+  setup_worker_session(td->thrconn);
+}
+
+static
+void *open_worker_connection(struct thread_data *td){
+  connect_worker(td);
+  mysql_thread_end();
+  return NULL;
+}
+
+/* The workers connect at the same time and before the global lock is taken,
+ * otherwise the lock is held while every connection does its handshake */
+void open_worker_connections(){
+  guint n;
+  struct thread_data *tds=g_new0(struct thread_data, num_threads);
+  GThread **connectors=g_new(GThread *, num_threads);
+  g_message("Opening %u connections", num_threads);
+  for (n = 0; n < num_threads; n++) {
+    tds[n].thread_id = n + 1;
+    connectors[n]=m_thread_new("connect", (GThreadFunc)open_worker_connection, &tds[n], "Connection thread could not be created");
+  }
+  g_free(worker_connections);
+  worker_connections=g_new0(MYSQL *, num_threads);
+  for (n = 0; n < num_threads; n++) {
+    g_thread_join(connectors[n]);
+    worker_connections[n]=tds[n].thrconn;
+  }
+  g_free(connectors);
+  g_free(tds);
+}
+
+/* The connections to the replicas that could not be pinned are moved to the
+ * main host */
+void reconnect_unpinned_worker_connections(){
+  guint n;
+  for (n = 0; n < num_threads; n++) {
+    struct replica_host *rh=get_thread_replica_host(n + 1);
+    if (!rh || rh->usable || !worker_connections || !worker_connections[n])
+      continue;
+    struct thread_data *td=g_new0(struct thread_data, 1);
+    td->thread_id = n + 1;
+    mysql_close(worker_connections[n]);
+    connect_worker(td);
+    worker_connections[n]=td->thrconn;
+    g_free(td);
+  }
+}
+
 void start_working_thread(struct configuration *conf ){
   guint n;
+  gint64 snapshot_start=g_get_monotonic_time();
+  // a session can only be cloned on its own server
+  snapshot_clone = get_product() == SERVER_TYPE_PERCONA && num_threads > 1 && sync_thread_lock_mode != NO_LOCK && sync_thread_lock_mode != BINLOG_DELTA && !replica_hosts_in_use();
+  if (snapshot_clone){
+    if (!snapshot_source_ready)
+      snapshot_source_ready=g_async_queue_new();
+    g_message("Sessions will clone the consistent snapshot of thread 1");
+  }
   threads = g_new(GThread *, num_threads );
   thread_data =
       g_new(struct thread_data, num_threads);
@@ -145,6 +248,9 @@ void start_working_thread(struct configuration *conf ){
     thread_data[n].binlog_snapshot_gtid_executed = NULL;
     thread_data[n].pause_resume_mutex=NULL;
     thread_data[n].table_name=NULL;
+    thread_data[n].row_fetcher=NULL;
+    thread_data[n].memory_reserved=0;
+    thread_data[n].payload_bytes=0;
     thread_data[n].thread_data_buffers.statement = g_string_sized_new(2*statement_size);
     thread_data[n].thread_data_buffers.row = g_string_sized_new(statement_size);
     thread_data[n].thread_data_buffers.column = g_string_sized_new(statement_size);
@@ -176,6 +282,7 @@ void start_working_thread(struct configuration *conf ){
   for (n = 0; n < num_threads; n++) {
     g_async_queue_pop(conf->ready);
   }
+  g_message("Consistent snapshot started on %u sessions in %.3f seconds", num_threads, (gdouble)(g_get_monotonic_time() - snapshot_start) / G_USEC_PER_SEC);
 }
 
 void wait_working_thread_to_finish(){
@@ -243,6 +350,25 @@ void thd_JOB_DUMP_DATABASE(struct thread_data *td, struct job *job){
   }
 }
 
+// Data_length and Rows are estimations used to sort the tables
+static
+guint64 get_table_status_value(MYSQL_ROW row, guint col){
+  if (col == (guint)-1 || col == 0 || row[col] == NULL)
+    return 0;
+  return strtoull(row[col], NULL, 10);
+}
+
+void sort_table_lists(){
+  if (table_order_function == NULL)
+    return;
+  g_mutex_lock(transactional_table->mutex);
+  transactional_table->list=g_list_sort(transactional_table->list, table_order_function);
+  g_mutex_unlock(transactional_table->mutex);
+  g_mutex_lock(non_transactional_table->mutex);
+  non_transactional_table->list=g_list_sort(non_transactional_table->list, table_order_function);
+  g_mutex_unlock(non_transactional_table->mutex);
+}
+
 static
 void get_table_info_to_process_from_list(MYSQL *conn, struct configuration *conf, gchar ** table_list) {
 
@@ -261,8 +387,8 @@ void get_table_info_to_process_from_list(MYSQL *conn, struct configuration *conf
       return;
     }
 
-    guint ecol = -1, ccol = -1, collcol = -1, rowscol = 0;
-    determine_show_table_status_columns(result, &ecol, &ccol, &collcol, &rowscol);
+    guint ecol = -1, ccol = -1, collcol = -1, rowscol = 0, datacol = -1;
+    determine_show_table_status_columns(result, &ecol, &ccol, &collcol, &rowscol, &datacol);
     struct database * database=get_database(conn, dt[0], TRUE);
 /*    if (get_database(conn, dt[0], &database)){
       if (!database->already_dumped){
@@ -309,7 +435,8 @@ void get_table_info_to_process_from_list(MYSQL *conn, struct configuration *conf
       if (!eval_regex(database->source_database, row[0]))
         continue;
 
-      create_job_to_dump_table(is_view, is_sequence, database, g_strdup(row[tablecol]), g_strdup(row[collcol]), g_strdup(row[ecol]));
+      create_job_to_dump_table(is_view, is_sequence, database, g_strdup(row[tablecol]), g_strdup(row[collcol]), g_strdup(row[ecol]),
+                               get_table_status_value(row, datacol), get_table_status_value(row, rowscol));
     }
     mysql_free_result(result);
     g_strfreev(dt);
@@ -335,18 +462,23 @@ union chunk_step *new_partition_step(gchar *partition){
   return cs;
 }
 
-void m_async_queue_push_conservative(GAsyncQueue *queue, struct job *element){
-  // Each job weights 500 bytes aprox.
-  // if we reach to 200k of jobs, which is 100MB of RAM, we are going to wait 5 seconds
-  // which is not too much considering that it will impossible to proccess 200k of jobs
-  // in 5 seconds.
-  // I don't think that we need to this values as parameters, unless that a user needs to
-  // set hundreds of threads
-  while (g_async_queue_length(queue)>200000){
-    g_warning("Too many jobs in the queue. We are pausing the jobs creation for 5 seconds.");
-    sleep(5);
+/* The schema and post data queues are consumed by the working threads once
+   the jobs are created, so a producer can not wait for them. Past the limits
+   the working thread that creates the jobs processes the queued ones itself,
+   which keeps the memory flat and the creation at the speed of the dump */
+void m_async_queue_push_conservative(GAsyncQueue *queue, struct job *job){
+  job->queued_size=job_memory_size(job);
+  __sync_fetch_and_add(&queued_jobs_bytes, job->queued_size);
+  g_async_queue_push(queue, job);
+  if (job_builder_td == NULL)
+    return;
+  while ((max_queued_jobs > 0 && (guint)g_async_queue_length(queue) > max_queued_jobs) ||
+         (max_queued_jobs_memory > 0 && queued_jobs_bytes > (guint64)max_queued_jobs_memory * 1024 * 1024)){
+    struct job *queued=g_async_queue_try_pop(queue);
+    if (queued == NULL)
+      break;
+    process_job(job_builder_td, queued);
   }
-  g_async_queue_push(queue, element);
 }
 
 void thd_JOB_DUMP(struct thread_data *td, struct job *job){
@@ -376,17 +508,45 @@ void thd_JOB_DUMP(struct thread_data *td, struct job *job){
 }
 
 void initialize_thread(struct thread_data *td){
+  struct replica_host *rh=get_thread_replica_host(td->thread_id);
+  if (rh && rh->usable){
+    m_connect_to_host(td->thrconn, rh->host, rh->port);
+    g_message("Thread %d: connected to %s using MySQL connection ID %lu",
+              td->thread_id, rh->host, mysql_thread_id(td->thrconn));
+    return;
+  }
   m_connect(td->thrconn);
   g_message("Thread %d: connected using MySQL connection ID %lu",
             td->thread_id, mysql_thread_id(td->thrconn));
 }
 
-void initialize_consistent_snapshot(struct thread_data *td){
-  gchar *query=NULL;
-  if ( sync_wait != -1)
-    m_query_critical(td->thrconn, query=g_strdup_printf("SET SESSION WSREP_SYNC_WAIT = %d",sync_wait), "Failed to set wsrep_sync_wait for the thread",NULL);
+/* With snapshot_clone thread 1 opens the snapshot and the rest of the sessions
+ * copy its read view, so all of them see the same data even if the server
+ * keeps committing. If the clone fails we fall back to our own snapshot */
+static
+void start_consistent_snapshot(struct thread_data *td){
+  guint n;
+  if (!snapshot_clone){
+    m_query_critical(td->thrconn,"START TRANSACTION /*!40108 WITH CONSISTENT SNAPSHOT */", "Failed to start consistent snapshot", NULL);
+    return;
+  }
+  if (td->thread_id == 1){
+    m_query_critical(td->thrconn,"START TRANSACTION /*!40108 WITH CONSISTENT SNAPSHOT */", "Failed to start consistent snapshot", NULL);
+    snapshot_source_id=mysql_thread_id(td->thrconn);
+    for (n = 1; n < num_threads; n++)
+      g_async_queue_push(snapshot_source_ready, GINT_TO_POINTER(1));
+    return;
+  }
+  g_async_queue_pop(snapshot_source_ready);
+  gchar *query=g_strdup_printf("START TRANSACTION WITH CONSISTENT SNAPSHOT FROM SESSION %lu", snapshot_source_id);
+  if (mysql_query(td->thrconn, query)){
+    g_warning("Thread %d: Not able to clone the snapshot of session %lu: %s", td->thread_id, snapshot_source_id, mysql_error(td->thrconn));
+    m_query_critical(td->thrconn,"START TRANSACTION /*!40108 WITH CONSISTENT SNAPSHOT */", "Failed to start consistent snapshot", NULL);
+  }
   g_free(query);
-  set_transaction_isolation_level_repeatable_read(td->thrconn);
+}
+
+void initialize_consistent_snapshot(struct thread_data *td){
   guint start_transaction_retry=0;
   gboolean cont = FALSE;
 
@@ -395,7 +555,7 @@ void initialize_consistent_snapshot(struct thread_data *td){
 //    Uncommenting the sleep will cause inconsitent scenarios always, which is useful for debugging 
 //      sleep(td->thread_id);
       g_debug("Thread %d: Start transaction #%d", td->thread_id, start_transaction_retry);
-      m_query_critical(td->thrconn,"START TRANSACTION /*!40108 WITH CONSISTENT SNAPSHOT */", "Failed to start consistent snapshot", NULL);
+      start_consistent_snapshot(td);
       MYSQL_RES *res = m_store_result_critical (td->thrconn, "SHOW STATUS LIKE 'binlog_snapshot_gtid_executed'", "Failed to get binlog_snapshot_gtid_executed", NULL);
       if (res){
         MYSQL_ROW row = mysql_fetch_row(res);
@@ -417,8 +577,10 @@ void initialize_consistent_snapshot(struct thread_data *td){
     }else{
       m_critical("We were not able to sync all threads. We unsuccessfully tried %d times. Reducing the amount of threads might help.", MAX_START_TRANSACTION_RETRIES);
     }
-  }else if (sync_thread_lock_mode != NO_LOCK)
-    m_query_critical(td->thrconn,"START TRANSACTION /*!40108 WITH CONSISTENT SNAPSHOT */", "Failed to start consistent snapshot", NULL);
+  }else if (sync_thread_lock_mode != NO_LOCK && sync_thread_lock_mode != BINLOG_DELTA)
+    // with BINLOG_DELTA every chunk is read by a SELECT in autocommit, which
+    // is its own short transaction
+    start_consistent_snapshot(td);
 }
 
 static
@@ -470,17 +632,12 @@ void get_binlog_position(MYSQL *conn, char **masterlog, char **masterpos, char *
 }
 
 
-/* Write some stuff we know about snapshot, before it changes */
-static
-void write_source_info(MYSQL *conn, FILE *file) {
-
-  get_binlog_position(conn, &initial_source_log, &initial_source_pos, &initial_source_gtid);
-
-  if (initial_source_log) {
+void write_source_section(FILE *file, gchar *source_log, gchar *source_pos, gchar *source_gtid) {
+  if (source_log) {
     fprintf(file, "\n[source]\n# Channel_Name = '' # It can be use to setup replication FOR CHANNEL\n");
-    if (initial_source_gtid && strlen(initial_source_gtid)>0)
-      fprintf(file, "# executed_gtid_set = \"%s\"\n", initial_source_gtid);
-    fprintf(file, "# SOURCE_LOG_FILE = \"%s\"\n# SOURCE_LOG_POS = %s\n", initial_source_log, initial_source_pos);
+    if (source_gtid && strlen(source_gtid)>0)
+      fprintf(file, "# executed_gtid_set = \"%s\"\n", source_gtid);
+    fprintf(file, "# SOURCE_LOG_FILE = \"%s\"\n# SOURCE_LOG_POS = %s\n", source_log, source_pos);
 
     if (source_data.enabled){
       fprintf(file, "#SOURCE_HOST = \"%s\"\n#SOURCE_PORT = \n#SOURCE_USER = \"\"\n#SOURCE_PASSWORD = \"\"\n", hostname?hostname:"");
@@ -488,13 +645,13 @@ void write_source_info(MYSQL *conn, FILE *file) {
         fprintf(file, "SOURCE_SSL = 1\n");
       else
         fprintf(file, "#SOURCE_SSL = {0|1}\n");
-      if (initial_source_gtid && strlen(initial_source_gtid)>0)
-        fprintf(file, "executed_gtid_set = \"%s\"\n", initial_source_gtid);
+      if (source_gtid && strlen(source_gtid)>0)
+        fprintf(file, "executed_gtid_set = \"%s\"\n", source_gtid);
       if (source_data.auto_position){
-        fprintf(file, "#SOURCE_LOG_FILE = \"%s\"\n#SOURCE_LOG_POS = %s\n", initial_source_log, initial_source_pos);
+        fprintf(file, "#SOURCE_LOG_FILE = \"%s\"\n#SOURCE_LOG_POS = %s\n", source_log, source_pos);
         fprintf(file, "SOURCE_AUTO_POSITION = 1\n");
       }else{
-        fprintf(file, "SOURCE_LOG_FILE = \"%s\"\nSOURCE_LOG_POS = %s\n", initial_source_log, initial_source_pos);
+        fprintf(file, "SOURCE_LOG_FILE = \"%s\"\nSOURCE_LOG_POS = %s\n", source_log, source_pos);
         fprintf(file, "#SOURCE_AUTO_POSITION = {0|1}\n");
       }
       fprintf(file, "myloader_exec_reset_replica = %d\nmyloader_exec_change_source = %d\nmyloader_exec_start_replica = %d\n",
@@ -506,6 +663,20 @@ void write_source_info(MYSQL *conn, FILE *file) {
   fflush(file);
 }
 
+/* Write some stuff we know about snapshot, before it changes. With
+   BINLOG_DELTA the backup is consistent at the end of the binlog delta, the
+   section is written once it is read */
+static
+void write_source_info(MYSQL *conn, FILE *file) {
+  get_binlog_position(conn, &initial_source_log, &initial_source_pos, &initial_source_gtid);
+  if (sync_thread_lock_mode == BINLOG_DELTA){
+    if (initial_source_log)
+      g_message("Binlog delta starts at %s:%s", initial_source_log, initial_source_pos);
+    return;
+  }
+  write_source_section(file, initial_source_log, initial_source_pos, initial_source_gtid);
+}
+
 static
 void write_replica_info(MYSQL *conn, FILE *file) {
   MYSQL_RES *slave = NULL;
@@ -597,6 +768,17 @@ void write_replica_info(MYSQL *conn, FILE *file) {
 }
 
 static void thd_JOB_TABLE(struct thread_data *td, struct job *job);
+
+/* --check-row-count: the COUNT(*) of the whole table is compared with the
+   sum of the rows of its chunks, whatever the chunk type. The rows of the
+   tables dumped with a limit, by partition_regex or sampled are not all
+   the rows of the table */
+static
+void count_rows_of_table(struct db_table *dbt){
+  if (check_row_count && !dbt->limit && !dbt->partition_regex && !is_sampled_dump())
+    create_job_to_count_rows(dbt);
+}
+
 gboolean process_job_builder_job(struct thread_data *td, struct job *job){
     switch (job->type) {
     case JOB_DUMP_TABLE_LIST:
@@ -630,7 +812,39 @@ gboolean process_job_builder_job(struct thread_data *td, struct job *job){
   return TRUE;
 }
 
+// The chunks are reported by write_table_job_into_file() with their bytes
+void report_job(enum job_type type, struct report_mark *mark){
+  switch (type){
+    case JOB_DETERMINE_CHUNK_TYPE:
+      report_end(REPORT_CATALOG, mark, 0);
+      break;
+    case JOB_CHECKSUM:
+    case JOB_ROW_COUNT:
+      report_end(REPORT_CHECKSUMS, mark, 0);
+      break;
+    case JOB_CREATE_DATABASE:
+    case JOB_CREATE_TABLESPACE:
+    case JOB_SCHEMA:
+    case JOB_VIEW:
+    case JOB_SEQUENCE:
+    case JOB_TRIGGERS:
+    case JOB_SCHEMA_TRIGGERS:
+    case JOB_SCHEMA_POST:
+      report_end(REPORT_SCHEMA, mark, 0);
+      break;
+    default:
+      break;
+  }
+}
+
 gboolean process_job(struct thread_data *td, struct job *job){
+    enum job_type type=job->type;
+    struct report_mark mark;
+    report_start(&mark);
+    if (job->queued_size){
+      __sync_fetch_and_sub(&queued_jobs_bytes, job->queued_size);
+      job->queued_size=0;
+    }
     switch (job->type) {
     case JOB_DETERMINE_CHUNK_TYPE:
       set_chunk_strategy_for_dbt(td->thrconn, (struct db_table *)(job->job_data));
@@ -647,6 +861,9 @@ gboolean process_job(struct thread_data *td, struct job *job){
     case JOB_CHECKSUM:
       do_JOB_CHECKSUM(td,job);
       break;
+    case JOB_ROW_COUNT:
+      do_JOB_ROW_COUNT(td,job);
+      break;
     case JOB_CREATE_DATABASE:
       do_JOB_CREATE_DATABASE(td,job);
       break;
@@ -684,6 +901,7 @@ gboolean process_job(struct thread_data *td, struct job *job){
     default:
       m_error("Something very bad happened! %d", job->type);
     }
+  report_job(type, &mark);
   return TRUE;
 }
 
@@ -697,6 +915,7 @@ void check_pause_resume( struct thread_data *td ){
       td->pause_resume_mutex=NULL;
     }
   }
+  wait_for_disk_space(td->thread_id);
 }
 
 static
@@ -707,7 +926,7 @@ void process_queue(GAsyncQueue * queue, struct thread_data *td, gboolean do_buil
     if (chunk_step_queue) {
       g_async_queue_push(chunk_step_queue, GINT_TO_POINTER(1));
     }
-    job = (struct job *)g_async_queue_pop(queue);
+    job = (struct job *)m_async_queue_pop(queue);
     if (shutdown_triggered && (job->type != JOB_SHUTDOWN)) {
       g_message("Thread %d: Process has been cacelled",td->thread_id);
       return;
@@ -762,17 +981,12 @@ void update_estimated_remaining_chunks_on_dbt(struct db_table *dbt){
 
 static
 void *working_thread(struct thread_data *td) {
-  // mysql_init is not thread safe, especially in Connector/C
-  g_mutex_lock(init_mutex);
-  td->thrconn = mysql_init(NULL);
-  g_mutex_unlock(init_mutex);
-
-  initialize_thread(td);
-  execute_gstring(td->thrconn, set_session);
-
-  // Initialize connection 
-  if (!skip_tz)       m_query_critical(td->thrconn, "/*!40103 SET TIME_ZONE='+00:00' */", "Failed to set time zone", NULL);
-  if (use_savepoints) m_query_critical(td->thrconn, "SET SQL_LOG_BIN = 0", "Failed to disable binlog for the thread", NULL);
+  set_thread_affinity(AFFINITY_WORKERS);
+  if (worker_connections && worker_connections[td->thread_id - 1]){
+    td->thrconn = worker_connections[td->thread_id - 1];
+    worker_connections[td->thread_id - 1] = NULL;
+  }else
+    connect_worker(td);
 
   initialize_consistent_snapshot(td);
   check_connection_status(td);
@@ -781,7 +995,9 @@ void *working_thread(struct thread_data *td) {
   // Thread Ready to process jobs
   
   g_message("Thread %d: Creating Jobs", td->thread_id);
+  job_builder_td=td;
   process_queue(td->conf->initial_queue,td, TRUE, NULL);
+  job_builder_td=NULL;
   g_async_queue_push(td->conf->initial_completed_queue, GINT_TO_POINTER(1));
 
   g_message("Thread %d: Processing Schema jobs", td->thread_id);
@@ -839,8 +1055,18 @@ void *working_thread(struct thread_data *td) {
   if (td->binlog_snapshot_gtid_executed!=NULL)
     g_free(td->binlog_snapshot_gtid_executed);
 
-  if (td->thrconn)
+  if (td->row_fetcher){
+    free_row_fetcher(td->row_fetcher);
+    td->row_fetcher=NULL;
+  }
+  memory_track(MEMORY_ROW_BUFFERS, &(td->memory_reserved), 0);
+
+  if (td->thrconn){
+    gchar *label=g_strdup_printf("Thread %d", td->thread_id);
+    report_wire_compression(td->thrconn, label, td->payload_bytes, FALSE);
+    g_free(label);
     mysql_close(td->thrconn);
+  }
   mysql_thread_end();
   return NULL;
 }
@@ -848,7 +1074,7 @@ void *working_thread(struct thread_data *td) {
 static
 void new_table_to_dump(MYSQL *conn, struct configuration *conf, gboolean is_view,
                        gboolean is_sequence, struct database * database, char *table,
-                       char *collation, gchar *ecol)
+                       char *collation, gchar *ecol, guint64 data_length, guint64 rows)
 {
     /* Green light! */
 /*
@@ -863,6 +1089,8 @@ void new_table_to_dump(MYSQL *conn, struct configuration *conf, gboolean is_view
   struct db_table *dbt=NULL;
   gboolean b= new_db_table(&dbt, conn, conf, database, table, collation, is_sequence);
   if (b){
+  dbt->data_length=data_length;
+  dbt->estimated_rows=rows;
   // if a view or sequence we care only about schema
   if ((!is_view || views_as_tables ) && !is_sequence) {
   // with --trx-tables we dump all as transactional tables
@@ -878,21 +1106,26 @@ void new_table_to_dump(MYSQL *conn, struct configuration *conf, gboolean is_view
     }
     if (!no_data && !dbt->object_to_export.no_data) {
       if (ecol != NULL && g_ascii_strcasecmp("MRG_MYISAM",ecol)) {
-        if (data_checksums && !( get_major() == 5 && get_secondary() == 7 && dbt->has_json_fields ) ){
+        if (data_checksums && !dbt->chunk_checksums && !( get_major() == 5 && get_secondary() == 7 && dbt->has_json_fields ) ){
           create_job_to_dump_checksum(dbt);
         }
         if (trx_tables ||
           (ecol != NULL && (!g_ascii_strcasecmp("InnoDB", ecol) || !g_ascii_strcasecmp("TokuDB", ecol)))) {
           dbt->is_transactional=TRUE;
-          g_mutex_lock(transactional_table->mutex);
-          transactional_table->list=g_list_prepend(transactional_table->list,dbt);
-          g_mutex_unlock(transactional_table->mutex);
+          // its files are copied instead of its rows
+          if (!add_transportable_table(dbt)){
+            g_mutex_lock(transactional_table->mutex);
+            transactional_table->list=g_list_prepend(transactional_table->list,dbt);
+            g_mutex_unlock(transactional_table->mutex);
+            count_rows_of_table(dbt);
+          }
 
         } else {
           dbt->is_transactional=FALSE;
           g_mutex_lock(non_transactional_table->mutex);
           non_transactional_table->list = g_list_prepend(non_transactional_table->list, dbt);
           g_mutex_unlock(non_transactional_table->mutex);
+          count_rows_of_table(dbt);
         }
       }else{
         if (is_view){
@@ -900,6 +1133,7 @@ void new_table_to_dump(MYSQL *conn, struct configuration *conf, gboolean is_view
           g_mutex_lock(non_transactional_table->mutex);
           non_transactional_table->list = g_list_prepend(non_transactional_table->list, dbt);
           g_mutex_unlock(non_transactional_table->mutex);
+          count_rows_of_table(dbt);
         }
       }
     }
@@ -988,8 +1222,8 @@ void dump_database_thread(MYSQL *conn, struct database *database) {
   if (!result)
     return;
 
-  guint ecol= -1, ccol= -1, collcol= -1, rowscol= 0;
-  determine_show_table_status_columns(result, &ecol, &ccol, &collcol, &rowscol);
+  guint ecol= -1, ccol= -1, collcol= -1, rowscol= 0, datacol= -1;
+  determine_show_table_status_columns(result, &ecol, &ccol, &collcol, &rowscol, &datacol);
 
   guint i=0;
   MYSQL_ROW row;
@@ -1078,7 +1312,8 @@ void dump_database_thread(MYSQL *conn, struct database *database) {
 
     if (!dump)
       continue;
-    create_job_to_dump_table(is_view, is_sequence, database, g_strdup(row[tablecol]), g_strdup(row[collcol]), g_strdup(row[ecol]));
+    create_job_to_dump_table(is_view, is_sequence, database, g_strdup(row[tablecol]), g_strdup(row[collcol]), g_strdup(row[ecol]),
+                               get_table_status_value(row, datacol), get_table_status_value(row, rowscol));
   }
 
   mysql_free_result(result);
@@ -1096,7 +1331,7 @@ static
 void thd_JOB_TABLE(struct thread_data *td, struct job *job){
   struct dump_table_job *dtj=(struct dump_table_job *)job->job_data;
   new_table_to_dump(td->thrconn, td->conf, dtj->is_view, dtj->is_sequence, dtj->database, dtj->table,
-                      dtj->collation, dtj->engine);
+                      dtj->collation, dtj->engine, dtj->data_length, dtj->rows);
   free(dtj->collation);
   free(dtj->engine);
   free(dtj);
@@ -43,6 +43,12 @@ struct thread_data {
   gchar *binlog_snapshot_gtid_executed;
   GMutex *pause_resume_mutex;
   struct thread_data_buffers thread_data_buffers;
+  // only used with --prefetch-rows
+  struct row_fetcher *row_fetcher;
+  // bytes of thread_data_buffers reserved from --max-memory
+  gsize memory_reserved;
+  // bytes of the values fetched, to report the wire compression ratio
+  guint64 payload_bytes;
 };
 
 #endif
@@ -52,6 +58,9 @@ typedef gchar * (*fun_ptr2)(gchar **);
 
 void initialize_working_thread();
 void start_working_thread(struct configuration *conf );
+void open_worker_connections();
+void connect_worker(struct thread_data *td);
+void reconnect_unpinned_worker_connections();
 void wait_working_thread_to_finish();
 void finalize_working_thread();
 
@@ -61,4 +70,9 @@ void build_lock_tables_statement(struct configuration *conf);
 void check_pause_resume( struct thread_data *td );
 void update_estimated_remaining_chunks_on_dbt(struct db_table *dbt);
 void free_db_table(struct db_table * dbt);
+void sort_table_lists();
 void get_binlog_position(MYSQL *conn, char **masterlog, char **masterpos, char **mastergtid);
+void write_source_section(FILE *file, gchar *source_log, gchar *source_pos, gchar *source_gtid);
+void report_job(enum job_type type, struct report_mark *mark);
+gboolean process_job(struct thread_data *td, struct job *job);
+void m_async_queue_push_conservative(GAsyncQueue *queue, struct job *job);
@@ -33,12 +33,23 @@
 #include "mydumper_masquerade.h"
 #include "mydumper_global.h"
 #include "mydumper_arguments.h"
+#include "mydumper_row_fetcher.h"
+#include "mydumper_stmt_fetcher.h"
+#include "mydumper_parquet.h"
+#include "mydumper_clickhouse.h"
+#include "mydumper_file_manifest.h"
+#include "mydumper_copy.h"
+#include "mydumper_plan_guard.h"
 
 /* Some earlier versions of MySQL do not yet define MYSQL_TYPE_JSON */
 #ifndef MYSQL_TYPE_JSON
 #define MYSQL_TYPE_JSON 245
 #endif
 
+#define ADAPTIVE_STATEMENT_ROWS 5000
+#define ADAPTIVE_STATEMENT_MIN_ROWS 16
+#define ADAPTIVE_STATEMENT_DEFAULT_PACKET 67108864
+
 /* Program options */
 gchar *where_option=NULL;
 
@@ -47,8 +58,19 @@ gchar *where_option=NULL;
 
 const gchar *insert_statement=INSERT;
 guint statement_size = 1000000;
+gboolean adaptive_statement_size = FALSE;
+static guint64 max_allowed_packet=0;
+gboolean prefetch_rows = FALSE;
+gboolean data_index = FALSE;
 guint64 max_statement_size=0;
 GMutex *max_statement_size_mutex=NULL;
+static struct metrics_histogram *chunk_query_histogram=NULL;
+static struct metrics_histogram *chunk_fetch_histogram=NULL;
+static struct metrics_histogram *chunk_write_histogram=NULL;
+static struct metrics_histogram *chunk_total_histogram=NULL;
+// time spent by this thread inside write_statement() for the current chunk
+static __thread gint64 chunk_write_time=0;
+static __thread guint64 chunk_write_bytes=0;
 guint complete_insert = 0;
 guint chunk_filesize = 0;
 gboolean load_data = FALSE;
@@ -70,21 +92,72 @@ gchar *fields_terminated_by_ld=NULL;
 gboolean insert_ignore = FALSE;
 gboolean replace = FALSE;
 gboolean hex_blob = FALSE;
+gboolean into_outfile = FALSE;
+
 
+// myloader restores the LOAD DATA statement file, not the rows file. The
+// compression extension is added by m_open, it is not on f->filename
+static
+void add_checksum_file(struct table_job *tj){
+  struct table_job_file *f= tj->sql ? tj->sql : tj->rows;
+  if (tj->dbt->chunk_checksums && f->file >= 0 && f->filename){
+    gchar *basename=g_path_get_basename(f->filename);
+    tj->checksum_files=g_list_append(tj->checksum_files, g_strdup_printf("%s%s", basename, exec_per_thread_extension));
+    g_free(basename);
+  }
+}
+
+static
+void free_partition_files(gpointer data){
+  g_list_free_full(data, g_free);
+}
+
+// The files are rotated when the partition changes, so each file only has
+// rows of the partition of the " PARTITION (name) " clause of the job
+static
+void add_partition_file(struct table_job *tj){
+  struct table_job_file *f= tj->sql ? tj->sql : tj->rows;
+  if (tj->partition == NULL || f->file < 0 || f->filename == NULL)
+    return;
+  gchar *from=strchr(tj->partition, '('), *to=strrchr(tj->partition, ')');
+  if (from == NULL || to == NULL || to <= from)
+    return;
+  gchar *name=g_strndup(from + 1, to - from - 1);
+  gchar *basename=g_path_get_basename(f->filename);
+  g_mutex_lock(tj->dbt->chunks_mutex);
+  if (tj->dbt->partition_files == NULL)
+    tj->dbt->partition_files=g_hash_table_new_full(g_str_hash, g_str_equal, g_free, free_partition_files);
+  GList *files=g_hash_table_lookup(tj->dbt->partition_files, name);
+  gchar *file=g_strdup_printf("%s%s", basename, exec_per_thread_extension);
+  if (files){
+    // the head of a non empty list does not change
+    files=g_list_append(files, file);
+    g_free(name);
+  }else
+    g_hash_table_insert(tj->dbt->partition_files, name, g_list_append(NULL, file));
+  g_mutex_unlock(tj->dbt->chunks_mutex);
+  g_free(basename);
+}
 
 gboolean update_files_on_table_job(struct table_job *tj)
 {
   if (tj->rows->file < 0){
     tj->rows->filename = build_rows_filename(tj->dbt->database->database_name_in_filename, tj->dbt->table_filename, tj->part, tj->sub_part);
+    copy_next_file(tj->dbt->database, tj->dbt, COPY_DATA);
     tj->rows->file = m_open(&(tj->rows->filename),"w");
+    tj->rows->rows=0;
     trace("Thread %d: Filename assigned(%d): %s", tj->td->thread_id, tj->rows->file, tj->rows->filename);
 
     if (tj->sql){
       tj->sql->filename =build_sql_filename(tj->dbt->database->database_name_in_filename, tj->dbt->table_filename, tj->part, tj->sub_part);
       tj->sql->file = m_open(&(tj->sql->filename),"w");
       trace("Thread %d: Filename assigned: %s", tj->td->thread_id, tj->sql->filename);
+      add_checksum_file(tj);
+      add_partition_file(tj);
       return TRUE;
     }
+    add_checksum_file(tj);
+    add_partition_file(tj);
   }
   return FALSE;
 }
@@ -146,6 +219,13 @@ void initialize_write(){
 
   max_statement_size_mutex=g_mutex_new();
 
+  if (chunk_total_histogram == NULL){
+    chunk_query_histogram=new_metrics_histogram("mydumper_chunk_query_seconds", "Time until the SELECT of a chunk returns its result set");
+    chunk_fetch_histogram=new_metrics_histogram("mydumper_chunk_fetch_encode_seconds", "Time fetching and encoding the rows of a chunk");
+    chunk_write_histogram=new_metrics_histogram("mydumper_chunk_write_seconds", "Time writing the statements of a chunk, compression included");
+    chunk_total_histogram=new_metrics_histogram("mydumper_chunk_seconds", "Total time to dump a chunk");
+  }
+
   switch (output_format){
 		case CLICKHOUSE:
 		case SQL_INSERT:
@@ -262,6 +342,14 @@ void initialize_write(){
 	}
 
 
+  if (into_outfile){
+    if (output_format != LOAD_DATA && output_format != CSV)
+      m_critical("--into-outfile needs --format LOAD_DATA or CSV");
+    // the server writes the columns as they are, without header
+    if (hex_blob || include_header)
+      m_critical("--into-outfile is not compatible with --hex-blob or --include-header");
+  }
+
   if ( insert_ignore && replace ){
     m_error("You can't use --insert-ignore and --replace at the same time");
   }
@@ -370,6 +458,37 @@ void set_anonymized_function_list(struct db_table * dbt, MYSQL_FIELD *fields, gu
   }
 }
 
+/* The encoder plan has the operation to use for each column, selected once
+ * per table from the field metadata and the masquerade functions */
+void build_column_encoder_plan(struct db_table * dbt, MYSQL_FIELD *fields, guint num_fields){
+  struct column_encoder *plan = g_new0(struct column_encoder, num_fields);
+  gboolean is_load_data = output_format == LOAD_DATA || output_format == CSV;
+  guint i;
+  for (i = 0; i < num_fields; ++i) {
+    if (is_load_data){
+      if (is_hex_blob(fields[i]))
+        plan[i].op = ENCODE_LOAD_DATA_HEX;
+      else if (fields[i].type == MYSQL_TYPE_LONG || fields[i].type == MYSQL_TYPE_LONGLONG || fields[i].type == MYSQL_TYPE_INT24 || fields[i].type == MYSQL_TYPE_SHORT)
+        plan[i].op = ENCODE_LOAD_DATA_NUMBER;
+      else
+        plan[i].op = ENCODE_LOAD_DATA_STRING;
+    }else{
+      if (fields[i].flags & NUM_FLAG)
+        plan[i].op = ENCODE_SQL_NUMBER;
+      else if (is_hex_blob(fields[i]))
+        plan[i].op = ENCODE_SQL_HEX;
+      else if (fields[i].type == MYSQL_TYPE_JSON)
+        plan[i].op = ENCODE_SQL_JSON;
+      else
+        plan[i].op = ENCODE_SQL_STRING;
+    }
+    if (dbt->anonymized_function && dbt->anonymized_function[i]->function != &identity_function)
+      plan[i].function = dbt->anonymized_function[i];
+    plan[i].terminated_by = i + 1 < num_fields ? fields_terminated_by : lines_terminated_by;
+  }
+  dbt->encoder_plan=plan;
+}
+
 void build_insert_statement(struct db_table * dbt, MYSQL_FIELD *fields, guint num_fields){
   GString * i_s=g_string_new(insert_statement);
   g_string_append(i_s, " INTO ");
@@ -396,8 +515,9 @@ gboolean real_write_data(int file, float *filesize, GString *data) {
   size_t written = 0;
   ssize_t r = 0;
   gboolean second_write_zero = FALSE;
+  gint64 span=span_start();
   while (written < data->len) {
-    r=write(file, data->str + written, data->len - written);
+    r=m_write(file, data->str + written, data->len - written);
     if (r < 0) {
       g_critical("Couldn't write data to a file(%d): %s", file, strerror(errno));
       errors++;
@@ -415,7 +535,9 @@ gboolean real_write_data(int file, float *filesize, GString *data) {
     }
     written += r;
   }
+  update_file_checksum(file, data->str, data->len);
   *filesize+=written;
+  span_end("real_write_data", span, NULL, NULL, -1, NULL);
   return TRUE;
 }
 
@@ -425,22 +547,28 @@ gboolean write_data(int file, GString *data) {
   return real_write_data(file, &f, data);
 }
 
-void initialize_load_data_statement_suffix(struct db_table *dbt, MYSQL_FIELD * fields, guint num_fields){
+// CHARACTER SET, FIELDS and LINES, the same for LOAD DATA and INTO OUTFILE
+static
+void append_load_data_format(GString *statement, struct db_table *dbt){
   gchar *character_set=set_names_in_conn_by_default != NULL ? set_names_in_conn_by_default : dbt->character_set /* "BINARY"*/;
-  GString *load_data_suffix=g_string_sized_new(statement_size);
-  g_string_append_printf(load_data_suffix, "%s' INTO TABLE %s%s%s ", exec_per_thread_extension, identifier_quote_character_str, dbt->table, identifier_quote_character_str);
   if (character_set && strlen(character_set)!=0)
-    g_string_append_printf(load_data_suffix, "CHARACTER SET %s ",character_set);
+    g_string_append_printf(statement, "CHARACTER SET %s ",character_set);
   if (fields_terminated_by_ld)
-    g_string_append_printf(load_data_suffix, "FIELDS TERMINATED BY '%s' ",fields_terminated_by_ld);
+    g_string_append_printf(statement, "FIELDS TERMINATED BY '%s' ",fields_terminated_by_ld);
   if (fields_enclosed_by_ld)
-    g_string_append_printf(load_data_suffix, "ENCLOSED BY '%s' ",fields_enclosed_by_ld);
+    g_string_append_printf(statement, "ENCLOSED BY '%s' ",fields_enclosed_by_ld);
   if (fields_escaped_by)
-    g_string_append_printf(load_data_suffix, "ESCAPED BY '%s' ",fields_escaped_by);
-  g_string_append(load_data_suffix, "LINES ");
+    g_string_append_printf(statement, "ESCAPED BY '%s' ",fields_escaped_by);
+  g_string_append(statement, "LINES ");
   if (lines_starting_by_ld)
-    g_string_append_printf(load_data_suffix, "STARTING BY '%s' ",lines_starting_by_ld);
-  g_string_append_printf(load_data_suffix, "TERMINATED BY '%s' ", lines_terminated_by_ld);
+    g_string_append_printf(statement, "STARTING BY '%s' ",lines_starting_by_ld);
+  g_string_append_printf(statement, "TERMINATED BY '%s' ", lines_terminated_by_ld);
+}
+
+void initialize_load_data_statement_suffix(struct db_table *dbt, MYSQL_FIELD * fields, guint num_fields){
+  GString *load_data_suffix=g_string_sized_new(statement_size);
+  g_string_append_printf(load_data_suffix, "%s' INTO TABLE %s%s%s ", exec_per_thread_extension, identifier_quote_character_str, dbt->table, identifier_quote_character_str);
+  append_load_data_format(load_data_suffix, dbt);
   if (include_header)
     g_string_append(load_data_suffix, "IGNORE 1 LINES ");
   g_string_append_printf(load_data_suffix, "(");
@@ -507,16 +635,57 @@ void initialize_load_data_header(struct db_table *dbt, MYSQL_FIELD *fields, guin
   g_string_append(dbt->load_data_header,lines_terminated_by);
 }
 
+/* Reserves what the buffers can grow to while a row is encoded, before they
+   grow: a value takes at most twice its length once escaped, plus its quotes
+   and delimiters, and the escaped and column buffers hold one value at a
+   time. A row that does not fit in the statement is moved to the row buffer.
+   The reservation only grows, it is released when the job ends */
+static inline
+void reserve_row_buffers(struct thread_data *td, gulong *lengths, guint num_fields){
+  struct thread_data_buffers *buffers=&(td->thread_data_buffers);
+  gsize row_bytes=0, max_length=0;
+  guint i;
+  if (max_memory == 0)
+    return;
+  for (i = 0; i < num_fields; i++){
+    row_bytes+=lengths[i] * 2 + 10;
+    if (lengths[i] > max_length)
+      max_length=lengths[i];
+  }
+  gsize size=memory_string_size(buffers->statement, buffers->statement->len + row_bytes) + memory_string_size(buffers->row, row_bytes) +
+      memory_string_size(buffers->escaped, max_length * 2 + 1) + memory_string_size(buffers->column, max_length * 2 + 1);
+  if (size > td->memory_reserved)
+    memory_track(MEMORY_ROW_BUFFERS, &(td->memory_reserved), size);
+}
+
+// masquerade functions can return longer values than the estimate
+static inline
+void track_thread_data_buffers(struct thread_data *td){
+  struct thread_data_buffers *buffers=&(td->thread_data_buffers);
+  gsize size=buffers->statement->allocated_len + buffers->row->allocated_len + buffers->escaped->allocated_len + buffers->column->allocated_len;
+  if (size > td->memory_reserved)
+    memory_track(MEMORY_ROW_BUFFERS, &(td->memory_reserved), size);
+}
+
 static
 gboolean write_statement(int load_data_file, float *filessize, GString *statement, struct db_table * dbt){
+  gint64 start=metrics_listen ? g_get_monotonic_time() : 0;
   if (!real_write_data(load_data_file, filessize, statement)) {
     g_critical("Could not write out data for %s.%s", dbt->database->source_database, dbt->table);
     return FALSE;
   }
-  g_mutex_lock(max_statement_size_mutex);
-  if (statement->len > max_statement_size)
-    max_statement_size=statement->len;
-  g_mutex_unlock(max_statement_size_mutex);
+  chunk_write_bytes+=statement->len;
+  if (metrics_listen){
+    chunk_write_time+=g_get_monotonic_time() - start;
+    __sync_fetch_and_add(&(dbt->bytes), statement->len);
+  }
+  // the maximum rarely changes, the lock is only taken when it does
+  if (statement->len > max_statement_size){
+    g_mutex_lock(max_statement_size_mutex);
+    if (statement->len > max_statement_size)
+      max_statement_size=statement->len;
+    g_mutex_unlock(max_statement_size_mutex);
+  }
   g_string_set_size(statement, 0);
   return TRUE;
 }
@@ -542,7 +711,8 @@ void write_clickhouse_statement(struct table_job * tj){
   GString *statement = g_string_sized_new(statement_size);
   char * basename=g_path_get_basename(tj->rows->filename);
   initialize_sql_statement(statement);
-  g_string_append_printf(statement, "%s INTO %s%s%s FROM INFILE '%s' FORMAT MySQLDump;", insert_statement, identifier_quote_character_str, tj->dbt->table, identifier_quote_character_str, basename); // , tj->dbt->load_data_suffix->str);
+  g_string_append_printf(statement, "%s INTO %s%s%s FROM INFILE '%s' FORMAT %s;", insert_statement, identifier_quote_character_str, tj->dbt->table, identifier_quote_character_str, basename,
+      output_format == CLICKHOUSE_ROWBINARY ? CLICKHOUSE_ROWBINARY_FORMAT : "MySQLDump"); // , tj->dbt->load_data_suffix->str);
   if (!write_data(tj->sql->file, statement)) {
     g_critical("Could not write out data for %s.%s", tj->dbt->database->source_database, tj->dbt->table);
   }
@@ -556,103 +726,343 @@ gboolean write_header(struct table_job * tj){
   return TRUE;
 }
 
-void write_load_data_column_into_string( MYSQL *conn, gchar **column, MYSQL_FIELD field, gulong length, struct thread_data_buffers buffers){
-    if (!*column) {
-      g_string_append(buffers.column, "\\N");
-    } else if ( is_hex_blob(field) ) {
-      g_string_set_size(buffers.escaped, length * 2 + 1);
-      mysql_hex_string(buffers.escaped->str,*column,length);
-      g_string_append(buffers.column,buffers.escaped->str);
-    }else if (field.type != MYSQL_TYPE_LONG && field.type != MYSQL_TYPE_LONGLONG  && field.type != MYSQL_TYPE_INT24  && field.type != MYSQL_TYPE_SHORT ){
-      g_string_append(buffers.column,fields_enclosed_by);
-      // this will reserve the memory needed if the current size is not enough.
-      g_string_set_size(buffers.escaped, length * 2 + 1);
-      unsigned long new_length = mysql_real_escape_string(conn, buffers.escaped->str, *column, length);
-      new_length++;
-      //g_string_set_size(escaped, new_length);
-      m_replace_char_with_char('\\',*fields_escaped_by,buffers.escaped->str, new_length);
-      m_escape_char_with_char(*fields_terminated_by, *fields_escaped_by, buffers.escaped->str, new_length);
-      g_string_append(buffers.column,buffers.escaped->str);
-      g_string_append(buffers.column,fields_enclosed_by);
-    }else
-      g_string_append(buffers.column, *column);
-}
-
-void write_sql_column_into_string( MYSQL *conn, gchar **column, MYSQL_FIELD field, gulong length, struct thread_data_buffers buffers){
-    if (!*column) {
-      g_string_append(buffers.column, "NULL");
-    } else if (field.flags & NUM_FLAG) {
-      g_string_append(buffers.column, *column);
-    } else if ( length == 0){
-      g_string_append_c(buffers.column,*fields_enclosed_by);
-      g_string_append_c(buffers.column,*fields_enclosed_by);
-    } else if ( is_hex_blob(field) ) {
-      g_string_set_size(buffers.escaped, length * 2 + 1);
-      g_string_append(buffers.column,"0x");
-      mysql_hex_string(buffers.escaped->str,*column,length);
-      g_string_append(buffers.column,buffers.escaped->str);
-    } else {
-      /* We reuse buffers for string escaping, growing is expensive just at
- *        * the beginning */
-      g_string_set_size(buffers.escaped, length * 2 + 1);
-      mysql_real_escape_string(conn, buffers.escaped->str, *column, length);
-      if (field.type == MYSQL_TYPE_JSON)
-        g_string_append(buffers.column, "CONVERT(");
-      g_string_append_c(buffers.column, *fields_enclosed_by);
-      g_string_append(buffers.column, buffers.escaped->str);
-      g_string_append_c(buffers.column, *fields_enclosed_by);
-      if (field.type == MYSQL_TYPE_JSON)
-        g_string_append(buffers.column, " USING UTF8MB4)");
-    }
+static inline
+void append_hex_column(GString *to, const gchar *column, gulong length){
+  gsize start=to->len;
+  g_string_set_size(to, start + length * 2 + 1);
+  g_string_truncate(to, start + m_hex_string(to->str + start, column, length));
 }
 
+static inline
+void append_escaped_column(MYSQL *conn, GString *to, const gchar *column, gulong length){
+  /* Escape straight into the destination buffer, growing is expensive
+   * just at the beginning */
+  gsize start=to->len;
+  g_string_set_size(to, start + length * 2 + 1);
+  g_string_truncate(to, start + m_real_escape_string(conn, to->str + start, column, length, '\\'));
+}
 
+/* Appends column to `to` using the operation that was selected for it on the
+ * encoder plan */
+static inline
+void encode_column_into_string(MYSQL *conn, enum column_encoder_op op, const gchar *column, gulong length, GString *to){
+  if (!column){
+    if (op < ENCODE_LOAD_DATA_NUMBER)
+      g_string_append(to, "NULL");
+    else
+      g_string_append_len(to, "\\N", 2);
+    return;
+  }
+  switch (op){
+    case ENCODE_SQL_NUMBER:
+    case ENCODE_LOAD_DATA_NUMBER:
+      g_string_append_len(to, column, length);
+      break;
+    case ENCODE_SQL_HEX:
+      if (length == 0){
+        g_string_append_c(to, *fields_enclosed_by);
+        g_string_append_c(to, *fields_enclosed_by);
+        break;
+      }
+      g_string_append_len(to, "0x", 2);
+      append_hex_column(to, column, length);
+      break;
+    case ENCODE_SQL_STRING:
+    case ENCODE_SQL_JSON:
+      if (length == 0){
+        g_string_append_c(to, *fields_enclosed_by);
+        g_string_append_c(to, *fields_enclosed_by);
+        break;
+      }
+      if (op == ENCODE_SQL_JSON)
+        g_string_append(to, "CONVERT(");
+      g_string_append_c(to, *fields_enclosed_by);
+      append_escaped_column(conn, to, column, length);
+      g_string_append_c(to, *fields_enclosed_by);
+      if (op == ENCODE_SQL_JSON)
+        g_string_append(to, " USING UTF8MB4)");
+      break;
+    case ENCODE_LOAD_DATA_HEX:
+      append_hex_column(to, column, length);
+      break;
+    case ENCODE_LOAD_DATA_STRING:
+      g_string_append(to,fields_enclosed_by);
+      m_load_data_escape_string_append(conn, to, column, length, *fields_escaped_by, *fields_terminated_by, *fields_enclosed_by);
+      g_string_append(to,fields_enclosed_by);
+      break;
+  }
+}
 
-void write_column_into_string_with_terminated_by(MYSQL *conn, gchar * row, MYSQL_FIELD field, gulong length, struct thread_data_buffers buffers, void write_column_into_string(MYSQL *, gchar **, MYSQL_FIELD , gulong ,struct thread_data_buffers), struct function_pointer * f, gchar * terminated_by){
-  gchar *column=NULL;
+/* Columns with a masquerade function are encoded into buffers->column first
+ * as the function might need the encoded value */
+static
+void write_masqueraded_column_into_string(MYSQL *conn, gchar * row, gulong length, struct thread_data_buffers *buffers, struct column_encoder *ce, GString *to){
+  gchar *column=row;
   gulong rlength=length;
-  g_string_set_size(buffers.column,0);
-  if (row)
-    column=row;
-  if (f){
-   if (f->is_pre){
-     // apply and constant as they alter the data
-     write_column_into_string( conn, &(column), field, rlength, buffers);
-     column=f->function(&(buffers.column->str), &rlength, f);
-     g_string_printf(buffers.column,"%s",column);
-   }else{
-     column=f->function(&(column), &rlength, f);
-     write_column_into_string( conn, &(column), field, rlength, buffers);
-   }
+  struct function_pointer * f = ce->function;
+  g_string_set_size(buffers->column,0);
+  if (f->is_pre){
+    // apply and constant as they alter the data
+    encode_column_into_string(conn, ce->op, column, rlength, buffers->column);
+    column=f->function(&(buffers->column->str), &rlength, f);
+    g_string_printf(buffers->column,"%s",column);
   }else{
-    write_column_into_string( conn, &(column), field, rlength, buffers);
+    column=f->function(&(column), &rlength, f);
+    if (column && column != row)
+      rlength=strlen(column);
+    encode_column_into_string(conn, ce->op, column, rlength, buffers->column);
   }
-  g_string_append(buffers.row, buffers.column->str);
-  g_string_append(buffers.row, terminated_by);
+  g_string_append_len(to, buffers->column->str, buffers->column->len);
 
   if (column && column != row)
     g_free(column);
 }
 
-void write_row_into_string(MYSQL *conn, struct db_table * dbt, MYSQL_ROW row, MYSQL_FIELD *fields, gulong *lengths, guint num_fields, struct thread_data_buffers buffers, void write_column_into_string(MYSQL *, gchar **, MYSQL_FIELD , gulong , struct thread_data_buffers)){
+/* Formats that keep the values as they are received only need the masquerade
+ * function, the value returned must be freed if it is not the original */
+static
+gchar *get_masqueraded_value(struct column_encoder *ce, gchar *value, gulong *length){
+  gchar *column=value;
+  column=ce->function->function(&column, length, ce->function);
+  if (column && column != value)
+    *length=strlen(column);
+  return column;
+}
+
+static
+void write_clickhouse_row_into_string(struct db_table * dbt, MYSQL_FIELD *fields, MYSQL_ROW row, gulong *lengths, guint num_fields, GString *to){
+  guint i = 0;
+  struct column_encoder *ce = dbt->encoder_plan;
+  for (i = 0; i < num_fields; i++, ce++) {
+    if (row[i] != NULL && ce->function){
+      gulong length=lengths[i];
+      gchar *column=get_masqueraded_value(ce, row[i], &length);
+      clickhouse_append_value(to, &(fields[i]), column, length);
+      if (column && column != row[i])
+        g_free(column);
+    }else
+      clickhouse_append_value(to, &(fields[i]), row[i], lengths[i]);
+  }
+}
+
+static
+void write_binary_row_into_string(struct db_table * dbt, MYSQL_ROW row, gulong *lengths, guint num_fields, GString *to){
+  guint i = 0;
+  struct column_encoder *ce = dbt->encoder_plan;
+  for (i = 0; i < num_fields; i++, ce++) {
+    if (row[i] != NULL && ce->function){
+      gulong length=lengths[i];
+      gchar *column=get_masqueraded_value(ce, row[i], &length);
+      row_binary_append_value(to, column, length);
+      if (column && column != row[i])
+        g_free(column);
+    }else
+      row_binary_append_value(to, row[i], lengths[i]);
+  }
+}
+
+void write_row_into_string(MYSQL *conn, struct db_table * dbt, MYSQL_ROW row, gulong *lengths, guint num_fields, struct thread_data_buffers *buffers, GString *to){
+  guint i = 0;
+  struct column_encoder *ce = dbt->encoder_plan;
+  g_string_append(to, lines_starting_by);
+  for (i = 0; i < num_fields; i++, ce++) {
+    if (ce->function)
+      write_masqueraded_column_into_string(conn, row[i], lengths[i], buffers, ce, to);
+    else
+      encode_column_into_string(conn, ce->op, row[i], lengths[i], to);
+    g_string_append(to, ce->terminated_by);
+  }
+}
+
+/* Only these encodings can be applied one slice at a time. The escaping of
+ * the charsets where a multibyte character can hide a backslash depends on
+ * the previous bytes, so their strings are never sliced */
+static
+gboolean is_sliceable_column(MYSQL *conn, struct column_encoder *ce){
+  if (ce->function)
+    return FALSE;
+  switch (ce->op){
+    case ENCODE_SQL_HEX:
+    case ENCODE_LOAD_DATA_HEX:
+      return TRUE;
+    case ENCODE_SQL_STRING:
+    case ENCODE_SQL_JSON:
+    case ENCODE_LOAD_DATA_STRING:
+      return !is_escape_unsafe_charset(conn);
+    default:
+      return FALSE;
+  }
+}
+
+/* The value is read and encoded blob_slice_size bytes at a time, and the
+ * statement is written after each slice, so it only keeps the suffix */
+static
+gboolean write_sliced_column(MYSQL *conn, struct table_job *tj, struct stmt_fetcher *sf, guint column, enum column_encoder_op op, GString *to, gsize *written){
+  GString *slice=sf->slice;
+  gulong offset;
+  if (op == ENCODE_SQL_HEX)
+    g_string_append_len(to, "0x", 2);
+  else if (op == ENCODE_SQL_STRING || op == ENCODE_SQL_JSON){
+    if (op == ENCODE_SQL_JSON)
+      g_string_append(to, "CONVERT(");
+    g_string_append_c(to, *fields_enclosed_by);
+  }else if (op == ENCODE_LOAD_DATA_STRING)
+    g_string_append(to, fields_enclosed_by);
+  for (offset = 0; offset < sf->lengths[column]; offset += slice->len){
+    if (!stmt_fetcher_read_slice(sf, column, offset))
+      return FALSE;
+    switch (op){
+      case ENCODE_SQL_HEX:
+      case ENCODE_LOAD_DATA_HEX:
+        append_hex_column(to, slice->str, slice->len);
+        break;
+      case ENCODE_SQL_STRING:
+      case ENCODE_SQL_JSON:
+        append_escaped_column(conn, to, slice->str, slice->len);
+        break;
+      case ENCODE_LOAD_DATA_STRING:
+        m_load_data_escape_string_append(conn, to, slice->str, slice->len, *fields_escaped_by, *fields_terminated_by, *fields_enclosed_by);
+        break;
+      default:
+        break;
+    }
+    *written+=to->len;
+    if (!write_statement(tj->rows->file, &(tj->filesize), to, tj->dbt))
+      return FALSE;
+  }
+  if (op == ENCODE_SQL_STRING || op == ENCODE_SQL_JSON){
+    g_string_append_c(to, *fields_enclosed_by);
+    if (op == ENCODE_SQL_JSON)
+      g_string_append(to, " USING UTF8MB4)");
+  }else if (op == ENCODE_LOAD_DATA_STRING)
+    g_string_append(to, fields_enclosed_by);
+  return TRUE;
+}
+
+// Same as write_row_into_string() but the oversized values are sliced
+static
+gboolean write_oversized_row(MYSQL *conn, struct table_job *tj, struct stmt_fetcher *sf, MYSQL_ROW row, gulong *lengths, guint num_fields, struct thread_data_buffers *buffers, GString *to, gsize *written){
   guint i = 0;
-  g_string_append(buffers.row, lines_starting_by);
-  struct function_pointer ** f = dbt->anonymized_function;
+  struct column_encoder *ce = tj->dbt->encoder_plan;
+  g_string_append(to, lines_starting_by);
+  for (i = 0; i < num_fields; i++, ce++) {
+    if (sf->sliced[i]){
+      if (!write_sliced_column(conn, tj, sf, i, ce->op, to, written))
+        return FALSE;
+    }else if (ce->function)
+      write_masqueraded_column_into_string(conn, row[i], lengths[i], buffers, ce, to);
+    else
+      encode_column_into_string(conn, ce->op, row[i], lengths[i], to);
+    g_string_append(to, ce->terminated_by);
+  }
+  return TRUE;
+}
+
+/* --adaptive-statement-size: the packets of the server are the limit of the
+ * statements of the wide tables, the server of the dump is the only one
+ * known here */
+void initialize_adaptive_statement_size(MYSQL *conn){
+  if (!adaptive_statement_size)
+    return;
+  struct M_ROW *mr=m_store_result_row(conn, "SELECT @@max_allowed_packet", m_warning, m_warning, "Failed to get max_allowed_packet", NULL);
+  if (mr->row && mr->row[0])
+    max_allowed_packet=g_ascii_strtoull(mr->row[0], NULL, 10);
+  m_store_result_row_free(mr);
+  if (max_allowed_packet == 0)
+    max_allowed_packet=ADAPTIVE_STATEMENT_DEFAULT_PACKET;
+}
+
+static
+guint get_statement_size(struct db_table *dbt){
+  return dbt->statement_size ? dbt->statement_size : statement_size;
+}
 
-  for (i = 0; i < num_fields-1; i++) {
-    write_column_into_string_with_terminated_by(conn, row[i], fields[i], lengths[i], buffers, write_column_into_string,f==NULL?NULL:f[i], fields_terminated_by);
+/* Called after the first chunk of the table with rows: narrow rows are
+ * limited to ADAPTIVE_STATEMENT_ROWS per statement and wide rows get at
+ * least ADAPTIVE_STATEMENT_MIN_ROWS, without going over a quarter of
+ * max_allowed_packet */
+static
+void learn_statement_size(struct db_table *dbt, guint64 row_bytes, guint64 num_rows){
+  if (!adaptive_statement_size || dbt->statement_size || num_rows == 0)
+    return;
+  guint64 average=row_bytes / num_rows + 1;
+  guint64 size=MIN((guint64)statement_size, average * ADAPTIVE_STATEMENT_ROWS);
+  size=MAX(size, average * ADAPTIVE_STATEMENT_MIN_ROWS);
+  size=MIN(size, max_allowed_packet / 4);
+  size=MAX(size, average);
+  g_mutex_lock(dbt->chunks_mutex);
+  if (dbt->statement_size == 0){
+    dbt->statement_size=MIN(size, G_MAXUINT);
+    g_message("Statements of %s.%s are %u bytes, the average row is %"G_GUINT64_FORMAT" bytes", dbt->database->source_database, dbt->table, dbt->statement_size, average);
   }
-  write_column_into_string_with_terminated_by(conn, row[i], fields[i], lengths[i], buffers, write_column_into_string,f==NULL?NULL:f[i], lines_terminated_by);
+  g_mutex_unlock(dbt->chunks_mutex);
 }
 
+static
+void update_statement_max_rows(struct db_table *dbt, guint64 num_rows){
+  if (num_rows <= dbt->statement_max_rows)
+    return;
+  g_mutex_lock(dbt->chunks_mutex);
+  if (num_rows > dbt->statement_max_rows)
+    dbt->statement_max_rows=num_rows;
+  g_mutex_unlock(dbt->chunks_mutex);
+}
+
+// Called per statement, the progress is read without synchronization
 void update_dbt_rows(struct db_table * dbt, guint64 num_rows){
-  g_mutex_lock(dbt->rows_lock);
-  dbt->rows+=num_rows;
-  g_mutex_unlock(dbt->rows_lock);
+  __sync_fetch_and_add(&(dbt->rows), num_rows);
+}
+
+/* One line per statement with its offset, length and rows. The first line
+ * is the length of the SET statements at the top of the file, which myloader
+ * needs to execute before any other range of the file */
+static
+void append_data_index(struct table_job * tj, gsize length, guint64 num_rows){
+  if (tj->data_index == NULL)
+    return;
+  if (tj->data_index->len == 0){
+    g_string_append_printf(tj->data_index, "header %"G_GSIZE_FORMAT"\n", tj->data_index_header_length);
+    tj->data_index_offset=tj->data_index_header_length;
+    length-=tj->data_index_header_length;
+  }
+  g_string_append_printf(tj->data_index, "%"G_GUINT64_FORMAT" %"G_GSIZE_FORMAT" %"G_GUINT64_FORMAT"\n", tj->data_index_offset, length, num_rows);
+  tj->data_index_offset+=length;
+}
+
+// Written before the data file is closed, so it is streamed first
+void write_data_index(struct table_job * tj){
+  if (tj->data_index == NULL || tj->rows->file < 0)
+    return;
+  if (tj->data_index->len > 0){
+    gchar *filename=g_strdup_printf("%s.idx", tj->rows->filename);
+    int file=m_open(&filename, "w");
+    if (!write_data(file, tj->data_index))
+      g_critical("Fail to write on %s", filename);
+    m_close(tj->td->thread_id, file, filename, tj->data_index->len, tj->dbt);
+    g_free(filename);
+  }
+  g_string_set_size(tj->data_index, 0);
+  tj->data_index_offset=0;
+}
+
+// The footer can only be written once the file is complete
+void finish_parquet_file(struct table_job * tj){
+  if (tj->parquet == NULL || tj->rows->file < 0)
+    return;
+  GString *statement=tj->td->thread_data_buffers.statement;
+  g_string_set_size(statement, 0);
+  parquet_finish_file(tj->parquet, statement);
+  if (!write_statement(tj->rows->file, &(tj->filesize), statement, tj->dbt))
+    g_critical("Fail to write on %s", tj->rows->filename);
 }
 
 void close_file(struct table_job * tj, struct table_job_file *tjf){
+  if (tjf == tj->rows){
+    finish_parquet_file(tj);
+    write_data_index(tj);
+  }
   if (tjf->file >= 0){
+    file_manifest_set_rows(tjf->filename, tj->part, tj->sub_part, tj->rows ? tj->rows->rows : 0);
     m_close(tj->td->thread_id, tjf->file, tjf->filename, 1, tj->dbt);
     tjf->file=-1;
     g_free(tjf->filename);
@@ -665,9 +1075,12 @@ void close_files(struct table_job * tj){
     case LOAD_DATA:
     case CSV:
     case CLICKHOUSE:
+    case CLICKHOUSE_ROWBINARY:
       close_file(tj, tj->sql);
       break;
     case SQL_INSERT:
+    case PARQUET:
+    case BINARY:
       break;
   }
   close_file(tj, tj->rows);
@@ -690,14 +1103,140 @@ void reopen_files(struct table_job * tj){
         write_header(tj);
       }
       break;
+    case CLICKHOUSE_ROWBINARY:
+      if (update_files_on_table_job(tj))
+        write_clickhouse_statement(tj);
+      break;
     case SQL_INSERT:
+    case PARQUET:
+    case BINARY:
       update_files_on_table_job(tj);
       break;
   }
 }
 
 
-void write_result_into_file(MYSQL *conn, MYSQL_RES *result, struct table_job * tj){
+static
+void rotate_files_if_needed(struct table_job * tj){
+  struct db_table * dbt = tj->dbt;
+  if (dbt->chunk_filesize && (guint)ceil((float)tj->filesize / 1024 / 1024) >
+            dbt->chunk_filesize){
+    tj->sub_part++;
+    reopen_files(tj);
+    if (output_format == SQL_INSERT){
+      initialize_sql_statement(tj->td->thread_data_buffers.statement);
+      tj->data_index_header_length=tj->td->thread_data_buffers.statement->len;
+      g_string_append(tj->td->thread_data_buffers.statement, dbt->insert_statement->str);
+    }else if (output_format == BINARY || output_format == CLICKHOUSE_ROWBINARY){
+      // every file starts with the column header
+      g_string_set_size(tj->td->thread_data_buffers.statement, 0);
+      g_string_append_len(tj->td->thread_data_buffers.statement, dbt->binary_header->str, dbt->binary_header->len);
+    }
+    tj->st_in_file = 0;
+    tj->filesize = 0;
+  }
+}
+
+// Compared with the bytes on the wire when the connection is compressed
+static inline
+guint64 row_payload_bytes(gulong *lengths, guint num_fields){
+  guint64 bytes=0;
+  guint i;
+  for (i = 0; i < num_fields; i++)
+    bytes+=lengths[i];
+  return bytes;
+}
+
+/* Rows are buffered per column and written one row group at a time, so a
+   file can only be rotated between row groups */
+static
+void write_result_into_parquet_file(MYSQL_RES *result, struct table_job * tj){
+  struct db_table * dbt = tj->dbt;
+  guint num_fields = mysql_num_fields(result);
+  MYSQL_FIELD *fields = mysql_fetch_fields(result);
+  MYSQL_ROW row;
+  gulong *lengths = NULL;
+  guint64 num_rows=0;
+  guint i;
+  gboolean count_payload=wire_compression_enabled();
+  guint64 row_group_size= dbt->chunk_filesize ? (guint64)dbt->chunk_filesize*1024*1024 : PARQUET_ROW_GROUP_SIZE;
+  if (row_group_size > PARQUET_ROW_GROUP_SIZE)
+    row_group_size=PARQUET_ROW_GROUP_SIZE;
+  GString *statement=tj->td->thread_data_buffers.statement;
+  g_string_set_size(statement, 0);
+
+  if (tj->rows->file < 0)
+    update_files_on_table_job(tj);
+  if (tj->parquet == NULL)
+    tj->parquet=new_parquet_writer(fields, num_fields);
+  // only the masquerade functions of the plan are used
+  if (dbt->encoder_plan==NULL){
+    g_mutex_lock(dbt->chunks_mutex);
+    if (dbt->encoder_plan==NULL)
+      build_column_encoder_plan(dbt, fields, num_fields);
+    g_mutex_unlock(dbt->chunks_mutex);
+  }
+
+  message_dumping_data(tj);
+
+  struct row_fetcher *rf=NULL;
+  if (prefetch_rows){
+    if (tj->td->row_fetcher == NULL)
+      tj->td->row_fetcher=new_row_fetcher(tj->td->thrconn);
+    rf=tj->td->row_fetcher;
+    start_row_fetcher(rf, result, num_fields);
+  }
+  while ((row = rf ? row_fetcher_next(rf, &lengths) : mysql_fetch_row(result))) {
+    if (!rf)
+      lengths = mysql_fetch_lengths(result);
+    num_rows++;
+    if (count_payload)
+      tj->td->payload_bytes+=row_payload_bytes(lengths, num_fields);
+    struct column_encoder *ce = dbt->encoder_plan;
+    for (i = 0; i < num_fields; i++, ce++){
+      if (row[i] != NULL && ce->function){
+        gulong rlength=lengths[i];
+        gchar *column=get_masqueraded_value(ce, row[i], &rlength);
+        parquet_append_value(tj->parquet, i, column, rlength);
+        if (column && column != row[i])
+          g_free(column);
+      }else
+        parquet_append_value(tj->parquet, i, row[i], lengths[i]);
+    }
+    parquet_end_row(tj->parquet);
+
+    if (tj->parquet->buffered_size >= row_group_size){
+      parquet_flush_row_group(tj->parquet, statement);
+      if (!write_statement(tj->rows->file, &(tj->filesize), statement, dbt)) {
+        g_critical("Fail to write on %s", tj->rows->filename);
+        if (rf)
+          stop_row_fetcher(rf);
+        return;
+      }
+      update_dbt_rows(dbt, num_rows);
+      tj->num_rows_of_last_run+=num_rows;
+      num_rows=0;
+      tj->st_in_file++;
+      check_pause_resume(tj->td);
+      if (shutdown_triggered) {
+        if (rf)
+          stop_row_fetcher(rf);
+        return;
+      }
+      rotate_files_if_needed(tj);
+    }
+  }
+  if (rf)
+    stop_row_fetcher(rf);
+  // the last row group is flushed when the file is closed
+  update_dbt_rows(dbt, num_rows);
+  tj->num_rows_of_last_run+=num_rows;
+}
+
+/* With a statement fetcher, result is its metadata and the rows come from
+ * the prepared statement */
+static
+void write_rows_into_file(MYSQL *conn, MYSQL_RES *result, struct stmt_fetcher *sf, struct table_job * tj){
 	struct db_table * dbt = tj->dbt;
 	guint num_fields = mysql_num_fields(result);
   MYSQL_FIELD *fields = mysql_fetch_fields(result);
@@ -708,11 +1247,17 @@ void write_result_into_file(MYSQL *conn, MYSQL_RES *result, struct table_job * t
   gulong *lengths = NULL;
   guint64 num_rows=0;
   guint64 num_rows_st = 0;
-  void (*write_column_into_string)(MYSQL *, gchar **, MYSQL_FIELD , gulong , struct thread_data_buffers) = write_sql_column_into_string;
+  // read once, it can be learned by another thread during the chunk
+  guint table_statement_size=get_statement_size(dbt);
+  guint64 row_bytes=0, max_rows_st=0;
+  gboolean count_payload=wire_compression_enabled();
+  if (output_format == PARQUET){
+    write_result_into_parquet_file(result, tj);
+    return;
+  }
   switch (output_format){
     case LOAD_DATA:
     case CSV:
-  		write_column_into_string=write_load_data_column_into_string;
     	if (dbt->load_data_suffix==NULL){
         g_mutex_lock(dbt->chunks_mutex);
         if (dbt->load_data_suffix==NULL){
@@ -748,6 +1293,36 @@ void write_result_into_file(MYSQL *conn, MYSQL_RES *result, struct table_job * t
 				write_clickhouse_statement(tj);
 			}
       g_string_append(tj->td->thread_data_buffers.statement, dbt->insert_statement->str);
+      break;
+    case BINARY:
+      if (tj->rows->file < 0)
+        update_files_on_table_job(tj);
+      if (dbt->binary_header==NULL){
+        g_mutex_lock(dbt->chunks_mutex);
+        if (dbt->binary_header==NULL){
+          GString *header=g_string_new("");
+          row_binary_append_header(header, fields, num_fields);
+          dbt->binary_header=header;
+        }
+        g_mutex_unlock(dbt->chunks_mutex);
+      }
+      if (!tj->st_in_file)
+        g_string_append_len(tj->td->thread_data_buffers.statement, dbt->binary_header->str, dbt->binary_header->len);
+      break;
+    case CLICKHOUSE_ROWBINARY:
+      if (tj->rows->file < 0 && update_files_on_table_job(tj))
+        write_clickhouse_statement(tj);
+      if (dbt->binary_header==NULL){
+        g_mutex_lock(dbt->chunks_mutex);
+        if (dbt->binary_header==NULL){
+          GString *header=g_string_new("");
+          clickhouse_append_header(header, fields, num_fields);
+          dbt->binary_header=header;
+        }
+        g_mutex_unlock(dbt->chunks_mutex);
+      }
+      if (!tj->st_in_file)
+        g_string_append_len(tj->td->thread_data_buffers.statement, dbt->binary_header->str, dbt->binary_header->len);
       break;
 		case SQL_INSERT:
       if (tj->rows->file < 0){
@@ -759,46 +1334,143 @@ void write_result_into_file(MYSQL *conn, MYSQL_RES *result, struct table_job * t
           build_insert_statement(dbt, fields, num_fields);
         g_mutex_unlock(dbt->chunks_mutex);
       }
-	  	if (!tj->st_in_file)
+	  	if (!tj->st_in_file){
   	  	initialize_sql_statement(tj->td->thread_data_buffers.statement);
+        tj->data_index_header_length=tj->td->thread_data_buffers.statement->len;
+      }
   		g_string_append(tj->td->thread_data_buffers.statement, dbt->insert_statement->str);
 	  	break;
 	}
 
+  if (dbt->encoder_plan==NULL){
+    g_mutex_lock(dbt->chunks_mutex);
+    if (dbt->encoder_plan==NULL)
+      build_column_encoder_plan(dbt, fields, num_fields);
+    g_mutex_unlock(dbt->chunks_mutex);
+  }
+  if (sf){
+    guint i;
+    for (i = 0; i < num_fields; i++)
+      stmt_fetcher_set_sliceable(sf, i, is_sliceable_column(conn, &(dbt->encoder_plan[i])));
+  }
+
   message_dumping_data(tj);
 
   GDateTime *from = g_date_time_new_now_local();
   GDateTime *to = NULL;
   GTimeSpan diff=0;
-	while ((row = mysql_fetch_row(result))) {
+  GString *statement=tj->td->thread_data_buffers.statement;
+  GString *pending_row=tj->td->thread_data_buffers.row;
+  gsize row_start=0;
+  struct row_fetcher *rf=NULL;
+  if (prefetch_rows && !sf){
+    if (tj->td->row_fetcher == NULL)
+      tj->td->row_fetcher=new_row_fetcher(tj->td->thrconn);
+    rf=tj->td->row_fetcher;
+    start_row_fetcher(rf, result, num_fields);
+  }
+	while ((row = sf ? stmt_fetcher_next(sf, &lengths) : rf ? row_fetcher_next(rf, &lengths) : mysql_fetch_row(result))) {
 // Uncomment next line if you need to simulate a slow read which is useful when calculate the chunk size
 //    g_usleep(1);
-    lengths = mysql_fetch_lengths(result);
+    if (!rf && !sf)
+      lengths = mysql_fetch_lengths(result);
     num_rows++;
-    // prepare row into statement_row
-		write_row_into_string(conn, dbt, row, fields, lengths, num_fields, tj->td->thread_data_buffers, write_column_into_string);
+    if (count_payload)
+      tj->td->payload_bytes+=row_payload_bytes(lengths, num_fields);
+    // if file size exceeded limit, we need to rotate. It only changes after a
+    // write, so this is needed just on the first row
+    if (num_rows == 1)
+      rotate_files_if_needed(tj);
+
+    // a row with sliced values goes alone in its statement, which is
+    // written while it is encoded
+    if (sf && sf->oversized){
+      if (num_rows_st > 0){
+        g_string_append(statement, statement_terminated_by);
+        append_data_index(tj, statement->len, num_rows_st);
+        tj->rows->rows+=num_rows_st;
+        if (!write_statement(tj->rows->file, &(tj->filesize), statement, dbt)) {
+          g_critical("Fail to write on %s", tj->rows->filename);
+          return;
+        }
+        tj->st_in_file++;
+        num_rows_st=0;
+        if (output_format == SQL_INSERT || output_format == CLICKHOUSE)
+          g_string_append(statement, dbt->insert_statement->str);
+      }
+      gsize written=0;
+      if (!write_oversized_row(conn, tj, sf, row, lengths, num_fields, &(tj->td->thread_data_buffers), statement, &written)){
+        g_critical("Fail to write on %s", tj->rows->filename);
+        return;
+      }
+      g_string_append(statement, statement_terminated_by);
+      written+=statement->len;
+      append_data_index(tj, written, 1);
+      tj->rows->rows++;
+      if (!write_statement(tj->rows->file, &(tj->filesize), statement, dbt)) {
+        g_critical("Fail to write on %s", tj->rows->filename);
+        return;
+      }
+      g_mutex_lock(max_statement_size_mutex);
+      if (written > max_statement_size)
+        max_statement_size=written;
+      g_mutex_unlock(max_statement_size_mutex);
+      update_dbt_rows(dbt, num_rows);
+      tj->num_rows_of_last_run+=num_rows;
+      num_rows=0;
+      tj->st_in_file++;
+      if (output_format == SQL_INSERT || output_format == CLICKHOUSE)
+        g_string_append(statement, dbt->insert_statement->str);
+      check_pause_resume(tj->td);
+      if (shutdown_triggered)
+        return;
+      rotate_files_if_needed(tj);
+      continue;
+    }
 
-    // if row exceeded statement_size then FLUSH buffer to disk
-		if (tj->td->thread_data_buffers.statement->len + tj->td->thread_data_buffers.row->len + 1 > statement_size){
+    // rows are encoded straight into the statement, if it gets exceeded we
+    // move the row back to the row buffer and FLUSH the statement to disk
+    row_start=statement->len;
+    if (num_rows_st && (output_format == SQL_INSERT || output_format == CLICKHOUSE))
+      g_string_append(statement, row_delimiter);
+    gsize row_data_start=statement->len;
+    reserve_row_buffers(tj->td, lengths, num_fields);
+    if (output_format == BINARY)
+      write_binary_row_into_string(dbt, row, lengths, num_fields, statement);
+    else if (output_format == CLICKHOUSE_ROWBINARY)
+      write_clickhouse_row_into_string(dbt, fields, row, lengths, num_fields, statement);
+    else
+		  write_row_into_string(conn, dbt, row, lengths, num_fields, &(tj->td->thread_data_buffers), statement);
+    track_thread_data_buffers(tj->td);
+    row_bytes+=statement->len - row_data_start;
+
+		if (statement->len + 1 > table_statement_size){
       if (num_rows_st == 0) {
-        g_string_append(tj->td->thread_data_buffers.statement, tj->td->thread_data_buffers.row->str);
-        g_string_set_size(tj->td->thread_data_buffers.row, 0);
         g_warning("Row bigger than statement_size for %s.%s", dbt->database->source_database,
                 dbt->table);
+      }else{
+        g_string_truncate(pending_row, 0);
+        g_string_append_len(pending_row, statement->str + row_data_start, statement->len - row_data_start);
+        g_string_truncate(statement, row_start);
       }
-      g_string_append(tj->td->thread_data_buffers.statement, statement_terminated_by);
-      if (!write_statement(tj->rows->file, &(tj->filesize), tj->td->thread_data_buffers.statement, dbt)) {
+      if (output_format != BINARY && output_format != CLICKHOUSE_ROWBINARY)
+        g_string_append(statement, statement_terminated_by);
+      append_data_index(tj, statement->len, num_rows_st ? num_rows_st : 1);
+      tj->rows->rows+= num_rows_st ? num_rows_st : 1;
+      max_rows_st=MAX(max_rows_st, num_rows_st ? num_rows_st : 1);
+      if (!write_statement(tj->rows->file, &(tj->filesize), statement, dbt)) {
         g_critical("Fail to write on %s", tj->rows->filename);
+        if (rf)
+          stop_row_fetcher(rf);
         return;
       }
 			update_dbt_rows(dbt, num_rows);
       tj->num_rows_of_last_run+=num_rows;
 			num_rows=0;
-			num_rows_st=0;
 			tj->st_in_file++;
     // initilize buffer if needed (INSERT INTO)
       if (output_format == SQL_INSERT || output_format == CLICKHOUSE){
-				g_string_append(tj->td->thread_data_buffers.statement, dbt->insert_statement->str);
+				g_string_append(statement, dbt->insert_statement->str);
 			}
       to = g_date_time_new_now_local();
       diff=g_date_time_difference(to,from)/G_TIME_SPAN_SECOND;
@@ -813,35 +1485,30 @@ void write_result_into_file(MYSQL *conn, MYSQL_RES *result, struct table_job * t
 
 			check_pause_resume(tj->td);
       if (shutdown_triggered) {
+        if (rf)
+          stop_row_fetcher(rf);
         return;
       }
+      rotate_files_if_needed(tj);
+      if (num_rows_st == 0)
+        continue;
+      // write the pending row to the new statement
+      g_string_append_len(statement, pending_row->str, pending_row->len);
+      g_string_truncate(pending_row, 0);
+      num_rows_st=0;
 		}
-		// if file size exceeded limit, we need to rotate
-		if (dbt->chunk_filesize && (guint)ceil((float)tj->filesize / 1024 / 1024) >
-              dbt->chunk_filesize){
-			tj->sub_part++;
-      reopen_files(tj);
-			if (output_format == SQL_INSERT){
-        initialize_sql_statement(tj->td->thread_data_buffers.statement);
-        g_string_append(tj->td->thread_data_buffers.statement, dbt->insert_statement->str);
-      }
-      tj->st_in_file = 0;
-      tj->filesize = 0;			
-		}
-		//
-		// write row to buffer
-    if (num_rows_st && (output_format == SQL_INSERT || output_format == CLICKHOUSE))
-      g_string_append(tj->td->thread_data_buffers.statement, row_delimiter);
-    g_string_append(tj->td->thread_data_buffers.statement, tj->td->thread_data_buffers.row->str);
-		if (tj->td->thread_data_buffers.row->len>0)
-      num_rows_st++;
-    g_string_set_size(tj->td->thread_data_buffers.row, 0);
+    num_rows_st++;
   }
+  if (rf)
+    stop_row_fetcher(rf);
   update_dbt_rows(dbt, num_rows);
   tj->num_rows_of_last_run+=num_rows;
   if (num_rows_st > 0 && tj->td->thread_data_buffers.statement->len > 0){
     if (output_format == SQL_INSERT || output_format == CLICKHOUSE)
 			g_string_append(tj->td->thread_data_buffers.statement, statement_terminated_by);
+    append_data_index(tj, tj->td->thread_data_buffers.statement->len, num_rows_st);
+    tj->rows->rows+=num_rows_st;
+    max_rows_st=MAX(max_rows_st, num_rows_st);
     if (!write_statement(tj->rows->file, &(tj->filesize), tj->td->thread_data_buffers.statement, dbt)) {
       g_critical("Fail to write on %s", tj->rows->filename);
       return;
@@ -849,6 +1516,10 @@ void write_result_into_file(MYSQL *conn, MYSQL_RES *result, struct table_job * t
 		tj->st_in_file++;
   }
   g_date_time_unref(from);
+  if (adaptive_statement_size){
+    update_statement_max_rows(dbt, max_rows_st);
+    learn_statement_size(dbt, row_bytes, tj->num_rows_of_last_run);
+  }
 
 //  g_string_free(statement, TRUE);
 //  g_string_free(escaped, TRUE);
@@ -856,30 +1527,281 @@ void write_result_into_file(MYSQL *conn, MYSQL_RES *result, struct table_job * t
   return;
 }
 
-/* Do actual data chunk reading/writing magic */
-void write_table_job_into_file(struct table_job * tj){
-  MYSQL *conn = tj->td->thrconn;
-  char *query = NULL;
+void write_result_into_file(MYSQL *conn, MYSQL_RES *result, struct table_job * tj){
+  write_rows_into_file(conn, result, NULL, tj);
+}
 
-//  if (throttle_time)
-  g_usleep(throttle_time);
+/* The checksum is calculated over the primary key followed by the selected
+ * columns, so values swapped between rows change the checksum. CONCAT_WS()
+ * skips the NULLs, so which ones are NULL is appended at the end */
+void build_chunk_checksum_expression(struct db_table *dbt, MYSQL_FIELD *fields, guint num_fields){
+  GString *expression=g_string_new("CONCAT_WS('#'");
+  GString *nulls=g_string_new("");
+  guint i;
+  GList *l;
+  for (l=dbt->primary_key; l; l=l->next){
+    char *field_name=identifier_quote_character_protect(l->data);
+    g_string_append_printf(expression, ",%s%s%s", identifier_quote_character_str, field_name, identifier_quote_character_str);
+    g_free(field_name);
+  }
+  if (dbt->primary_key)
+    g_string_append(expression, ",'|'");
+  for (i = 0; i < num_fields; i++){
+    char *field_name=identifier_quote_character_protect(fields[i].name);
+    g_string_append_printf(expression, ",%s%s%s", identifier_quote_character_str, field_name, identifier_quote_character_str);
+    g_string_append_printf(nulls, "%sISNULL(%s%s%s)", i ? "," : "", identifier_quote_character_str, field_name, identifier_quote_character_str);
+    g_free(field_name);
+  }
+  g_string_append_printf(expression, ",CONCAT(%s))", nulls->str);
+  g_string_free(nulls, TRUE);
+  dbt->chunk_checksum_expression=g_string_free(expression, FALSE);
+}
 
-  tj->num_rows_of_last_run=0;
+static
+void append_checksum_condition(GString *where, const gchar *condition){
+  if (condition == NULL || *condition == '\0')
+    return;
+  g_string_append_printf(where, "%s(%s)", where->len ? " AND " : "", condition);
+}
 
-  /* Ghm, not sure if this should be statement_size - but default isn't too big
-   * for now */
-  /* Poor man's database code */
-  MYSQL_RES *result = m_use_result(conn, query = g_strdup_printf(
-      "SELECT %s %s FROM %s%s%s.%s%s%s %s %s %s %s %s %s %s %s %s %s %s",
+/* Runs on the same connection, and so in the same snapshot, right after the
+ * chunk was dumped */
+static
+void write_chunk_checksum(struct table_job *tj){
+  struct db_table *dbt=tj->dbt;
+  GString *where=g_string_new("");
+  append_checksum_condition(where, tj->where->str);
+  append_checksum_condition(where, where_option);
+  append_checksum_condition(where, dbt->where);
+  guint64 rows=0;
+  gchar *checksum=checksum_chunk(tj->td->thrconn, dbt->database->source_database, dbt->table, dbt->chunk_checksum_expression, tj->partition, where->str, &rows);
+  if (checksum == NULL){
+    g_warning("Thread %d: Could not get the checksum of a chunk on %s.%s", tj->td->thread_id, dbt->database->source_database, dbt->table);
+    g_string_free(where, TRUE);
+    return;
+  }
+  struct chunk_checksum *cc=g_new0(struct chunk_checksum, 1);
+  cc->checksum=checksum;
+  cc->rows=rows;
+  cc->partition=g_strdup(tj->partition);
+  cc->where=g_string_free(where, FALSE);
+  cc->files=tj->checksum_files;
+  tj->checksum_files=NULL;
+  g_mutex_lock(dbt->chunks_mutex);
+  dbt->chunk_checksum_list=g_list_prepend(dbt->chunk_checksum_list, cc);
+  g_mutex_unlock(dbt->chunks_mutex);
+}
+
+/* Ghm, not sure if this should be statement_size - but default isn't too big
+ * for now */
+/* Poor man's database code */
+static
+gchar *build_table_job_query(struct table_job *tj){
+  return g_strdup_printf(
+      "SELECT %s %s FROM %s%s%s.%s%s%s %s %s %s %s %s %s %s %s %s %s %s %s",
       is_mysql_like() ? "/*!40001 SQL_NO_CACHE */" : "",
       tj->dbt->select_fields?tj->dbt->select_fields->str:"*",
       identifier_quote_character_str,tj->dbt->database->source_database, identifier_quote_character_str, identifier_quote_character_str, tj->dbt->table, identifier_quote_character_str, tj->partition?tj->partition:"",
+      g_atomic_pointer_get(&tj->dbt->plan_guard_hint) ? (gchar *)g_atomic_pointer_get(&tj->dbt->plan_guard_hint) : "",
        (tj->where->len || where_option   || tj->dbt->where) ? "WHERE"  : "" , tj->where->len ? tj->where->str : "",
        (tj->where->len && where_option )                    ? "AND"    : "" ,   where_option ?   where_option : "",
       ((tj->where->len || where_option ) && tj->dbt->where) ? "AND"    : "" , tj->dbt->where ? tj->dbt->where : "",
       order_by_primary_key && tj->dbt->primary_key_separated_by_comma ? " ORDER BY " : "", order_by_primary_key && tj->dbt->primary_key_separated_by_comma ? tj->dbt->primary_key_separated_by_comma : "",
-      tj->dbt->limit ?  "LIMIT" : "", tj->dbt->limit ? tj->dbt->limit : ""
-  ), m_warning, "Failed to execute query", NULL);
+      tj->dbt->limit ?  "LIMIT" : "", tj->dbt->limit ? tj->dbt->limit : "");
+}
+
+// The masquerading functions are applied to the rows by mydumper
+static
+gboolean into_outfile_table(struct db_table *dbt){
+  gchar *k = g_strdup_printf("`%s`.`%s`", dbt->database->source_database, dbt->table);
+  gboolean masqueraded= g_hash_table_lookup(conf_per_table.all_anonymized_function, k) != NULL;
+  g_free(k);
+  return !masqueraded;
+}
+
+static
+gchar *build_outfile_path(struct table_job *tj, const gchar *filename){
+  // the server writes the file, the path has to be absolute
+  gchar *path=NULL;
+  if (g_path_is_absolute(filename))
+    path=g_strdup_printf("%s.outfile", filename);
+  else{
+    gchar *cwd=g_get_current_dir();
+    gchar *absolute=g_build_filename(cwd, filename, NULL);
+    path=g_strdup_printf("%s.outfile", absolute);
+    g_free(absolute);
+    g_free(cwd);
+  }
+  gchar *escaped=g_new(gchar, strlen(path) * 2 + 1);
+  mysql_real_escape_string(tj->td->thrconn, escaped, path, strlen(path));
+  g_free(path);
+  return escaped;
+}
+
+// The file is compressed, hashed or streamed by the file handler
+static
+gboolean copy_outfile_into_file(struct table_job *tj, const gchar *path){
+  FILE *in=g_fopen(path, "r");
+  if (!in){
+    g_critical("Thread %d: Could not open %s written by the server: %s", tj->td->thread_id, path, strerror(errno));
+    return FALSE;
+  }
+  GString *block=tj->td->thread_data_buffers.statement;
+  gsize n;
+  gboolean ok=TRUE;
+  g_string_set_size(block, statement_size);
+  tj->rows->file=m_open(&(tj->rows->filename), "w");
+  while (ok && (n=fread(block->str, 1, statement_size, in)) > 0){
+    g_string_set_size(block, n);
+    ok=real_write_data(tj->rows->file, &(tj->filesize), block);
+    g_string_set_size(block, statement_size);
+  }
+  ok&= !ferror(in);
+  g_string_set_size(block, 0);
+  fclose(in);
+  return ok;
+}
+
+/* --into-outfile: the server writes the rows of the chunk with SELECT ... INTO
+ * OUTFILE, with the FIELDS and LINES options of the LOAD DATA statement. Each
+ * run of the job writes its own file, which is renamed into the backup or
+ * copied through the file handler when it has to be compressed */
+static
+gboolean write_table_job_into_outfile(struct table_job *tj){
+  struct db_table *dbt=tj->dbt;
+  MYSQL *conn=tj->td->thrconn;
+  gboolean ok=FALSE;
+  gchar *query=NULL;
+  if (dbt->load_data_suffix == NULL){
+    query=g_strdup_printf("SELECT %s FROM %s%s%s.%s%s%s LIMIT 0", dbt->select_fields ? dbt->select_fields->str : "*",
+        identifier_quote_character_str, dbt->database->source_database, identifier_quote_character_str,
+        identifier_quote_character_str, dbt->table, identifier_quote_character_str);
+    MYSQL_RES *result=m_store_result(conn, query, m_warning, "Failed to get the columns of %s.%s", dbt->database->source_database, dbt->table);
+    g_free(query);
+    if (!result)
+      return FALSE;
+    g_mutex_lock(dbt->chunks_mutex);
+    if (dbt->load_data_suffix == NULL)
+      initialize_load_data_statement_suffix(dbt, mysql_fetch_fields(result), mysql_num_fields(result));
+    g_mutex_unlock(dbt->chunks_mutex);
+    mysql_free_result(result);
+  }
+  tj->rows->filename=build_rows_filename(dbt->database->database_name_in_filename, dbt->table_filename, tj->part, tj->sub_part);
+  gchar *path=build_outfile_path(tj, tj->rows->filename);
+  // a file of a previous run would make the SELECT fail
+  remove(path);
+  gchar *select=build_table_job_query(tj);
+  if (check_chunk_plan(tj, select)){
+    g_free(select);
+    select=build_table_job_query(tj);
+  }
+  GString *statement=g_string_new(select);
+  g_free(select);
+  g_string_append_printf(statement, " INTO OUTFILE '%s' ", path);
+  append_load_data_format(statement, dbt);
+  if (m_query(conn, statement->str, m_warning, "Thread %d: Could not dump %s.%s into %s", tj->td->thread_id, dbt->database->source_database, dbt->table, path)){
+    errors++;
+    remove(path);
+    goto cleanup;
+  }
+  tj->num_rows_of_last_run=mysql_affected_rows(conn);
+  if (tj->num_rows_of_last_run == 0){
+    remove(path);
+    ok=TRUE;
+    goto cleanup;
+  }
+  tj->rows->rows=tj->num_rows_of_last_run;
+  update_dbt_rows(dbt, tj->num_rows_of_last_run);
+  if (m_open_writes_plain_files()){
+    if (g_rename(path, tj->rows->filename)){
+      g_critical("Thread %d: Could not rename %s: %s", tj->td->thread_id, path, strerror(errno));
+      errors++;
+      remove(path);
+      goto cleanup;
+    }
+  }else{
+    ok=copy_outfile_into_file(tj, path);
+    remove(path);
+    if (!ok){
+      errors++;
+      goto cleanup;
+    }
+  }
+  // the LOAD DATA statement file, as --load-data writes it
+  tj->sql->filename=build_sql_filename(dbt->database->database_name_in_filename, dbt->table_filename, tj->part, tj->sub_part);
+  tj->sql->file=m_open(&(tj->sql->filename), "w");
+  add_checksum_file(tj);
+  add_partition_file(tj);
+  write_load_data_statement(tj);
+  close_file(tj, tj->sql);
+  if (tj->rows->file >= 0)
+    close_file(tj, tj->rows);
+  else{
+    file_manifest_set_rows(tj->rows->filename, tj->part, tj->sub_part, tj->rows->rows);
+    m_close_server_file(tj->td->thread_id, tj->rows->filename, tj->dbt);
+  }
+  ok=TRUE;
+cleanup:
+  if (tj->rows->file >= 0)
+    close_file(tj, tj->rows);
+  g_free(tj->rows->filename);
+  tj->rows->filename=NULL;
+  tj->rows->file=-1;
+  tj->rows->rows=0;
+  tj->filesize=0;
+  tj->sub_part++;
+  g_string_free(statement, TRUE);
+  g_free(path);
+  return ok;
+}
+
+/* Do actual data chunk reading/writing magic */
+void write_table_job_into_file(struct table_job * tj){
+  MYSQL *conn = tj->td->thrconn;
+  char *query = NULL;
+  struct stmt_fetcher *sf = NULL;
+  MYSQL_RES *result = NULL;
+  struct row_fetcher *rf = prefetch_rows ? tj->td->row_fetcher : NULL;
+
+  tj->num_rows_of_last_run=0;
+  gint64 start=g_get_monotonic_time(), query_time=0;
+  struct report_mark mark;
+  report_start(&mark);
+  chunk_write_time=0;
+  chunk_write_bytes=0;
+  gboolean dumped=FALSE;
+  if (tj->dbt->chunk_checksums){
+    g_list_free_full(tj->checksum_files, g_free);
+    tj->checksum_files=NULL;
+    add_checksum_file(tj);
+  }
+
+  if (into_outfile && into_outfile_table(tj->dbt)){
+    throttle_control_acquire();
+    dumped=write_table_job_into_outfile(tj);
+    goto cleanup;
+  }
+
+  query = build_table_job_query(tj);
+  // the query might have been sent while the previous chunk was encoded,
+  // it took its --throttle-control slot then
+  if (rf)
+    result = row_fetcher_take_prefetched(rf, query);
+  if (!result)
+    throttle_control_acquire();
+  if (!result && check_chunk_plan(tj, query)){
+    g_free(query);
+    query = build_table_job_query(tj);
+  }
+
+  if (!result && blob_slice_size > 0 && (output_format == SQL_INSERT || output_format == CLICKHOUSE || output_format == LOAD_DATA || output_format == CSV))
+    sf=new_stmt_fetcher(conn, tj->dbt, query);
+  if (sf)
+    result = sf->metadata;
+  else if (!result)
+    result = m_use_result(conn, query, m_warning, "Failed to execute query", NULL);
+  else
+    trace("Thread %d: Using the prefetched result of %s", tj->td->thread_id, query);
 
   if (!result){
     if (!it_is_a_consistent_backup){
@@ -899,12 +1821,53 @@ void write_table_job_into_file(struct table_job * tj){
       goto cleanup;
   }
 
+  query_time=g_get_monotonic_time() - start;
+  span_end("query", start, tj->dbt->database->source_database, tj->dbt->table, tj->part, tj->partition);
+
+  if (tj->dbt->chunk_checksums && tj->dbt->chunk_checksum_expression == NULL){
+    g_mutex_lock(tj->dbt->chunks_mutex);
+    if (tj->dbt->chunk_checksum_expression == NULL)
+      build_chunk_checksum_expression(tj->dbt, mysql_fetch_fields(result), mysql_num_fields(result));
+    g_mutex_unlock(tj->dbt->chunks_mutex);
+  }
+
+  // the fetcher sends the query of the next chunk when this one was read
+  if (prefetch_rows && !sf && tj->next_where && !chunk_plan_guard){
+    GString *where=tj->where;
+    tj->where=tj->next_where;
+    gchar *next_query=build_table_job_query(tj);
+    tj->where=where;
+    if (tj->td->row_fetcher == NULL)
+      tj->td->row_fetcher=new_row_fetcher(conn);
+    rf=tj->td->row_fetcher;
+    row_fetcher_prefetch(rf, next_query);
+  }
+  if (tj->next_where){
+    g_string_free(tj->next_where, TRUE);
+    tj->next_where=NULL;
+  }
+
   /* Poor man's data dump code */
-  write_result_into_file(conn, result, tj);
+  gint64 span=span_start();
+  write_rows_into_file(conn, result, sf, tj);
+  if (prefetch_rows && !sf)
+    rf=tj->td->row_fetcher;
+  span_end("write_result_into_file", span, tj->dbt->database->source_database, tj->dbt->table, tj->part, tj->partition);
+
+  if (metrics_listen){
+    gint64 total_time=g_get_monotonic_time() - start;
+    metrics_observe(chunk_query_histogram, query_time);
+    metrics_observe(chunk_write_histogram, chunk_write_time);
+    metrics_observe(chunk_fetch_histogram, total_time - query_time - chunk_write_time);
+    metrics_observe(chunk_total_histogram, total_time);
+  }
 
-  if (mysql_errno(conn)) {
+  // the connection of the fetcher might be running the query of the next chunk
+  if (sf ? mysql_stmt_errno(sf->stmt) : rf ? rf->result_errno : mysql_errno(conn)) {
     g_critical("Thread %d: Could not read data from %s.%s to write on %s at byte %.0f: %s", tj->td->thread_id, tj->dbt->database->source_database, tj->dbt->table, tj->rows->filename, tj->filesize,
-               mysql_error(conn));
+               sf ? mysql_stmt_error(sf->stmt) : rf ? rf->result_error : mysql_error(conn));
+    if (rf)
+      row_fetcher_discard_prefetched(rf);
     errors++;
     if (mysql_ping(tj->td->thrconn)) {
       if (!it_is_a_consistent_backup){
@@ -913,13 +1876,25 @@ void write_table_job_into_file(struct table_job * tj){
         execute_gstring(tj->td->thrconn, set_session);
       }
     } 
- }
+ }else
+    dumped=TRUE;
 
 cleanup:
   g_free(query);
 
-  if (result) {
+  if (sf)
+    free_stmt_fetcher(sf);
+  else if (result) {
     mysql_free_result(result);
   }
+  throttle_control_add_work(tj->num_rows_of_last_run);
+  throttle_control_release();
+  if (dumped && tj->dbt->chunk_checksums && tj->num_rows_of_last_run > 0 && !shutdown_triggered){
+    throttle_control_acquire();
+    write_chunk_checksum(tj);
+    throttle_control_release();
+  }
+  report_chunk(REPORT_DATA, &mark, tj->dbt->database->source_database, tj->dbt->table, tj->part, chunk_write_bytes);
+  span_end("write_table_job_into_file", start, tj->dbt->database->source_database, tj->dbt->table, tj->part, tj->partition);
 }
 
@@ -27,8 +27,15 @@
 
 void load_write_entries(GOptionGroup *main_group, GOptionContext *context);
 void initialize_write();
+void initialize_adaptive_statement_size(MYSQL *conn);
 void initialize_config_on_string(GString *output);
 void finalize_write();
 void write_table_job_into_file(struct table_job *tj);
+struct thread_data_buffers;
+void build_column_encoder_plan(struct db_table * dbt, MYSQL_FIELD *fields, guint num_fields);
+void write_row_into_string(MYSQL *conn, struct db_table * dbt, MYSQL_ROW row, gulong *lengths, guint num_fields, struct thread_data_buffers *buffers, GString *to);
 gboolean write_data(int file, GString *data);
 void close_files(struct table_job * tj);
+void finish_parquet_file(struct table_job * tj);
+void write_data_index(struct table_job * tj);
+void build_chunk_checksum_expression(struct db_table *dbt, MYSQL_FIELD *fields, guint num_fields);
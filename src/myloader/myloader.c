@@ -30,6 +30,7 @@
 #include <errno.h>
 
 #include "myloader_stream.h"
+#include "myloader_plan.h"
 #include "myloader_process.h"
 #include "myloader_common.h"
 #include "myloader_directory.h"
@@ -43,11 +44,24 @@
 #include "myloader_worker_schema.h"
 #include "myloader_worker_loader.h"
 #include "myloader_worker_post.h"
+#include "myloader_dependency.h"
 #include "myloader_control_job.h"
 #include "myloader_database.h"
 #include "myloader_worker_loader_main.h"
+#include "myloader_fan_out.h"
+#include "myloader_shard.h"
+#include "myloader_journal.h"
+#include "myloader_exchange_partition.h"
+#include "myloader_prefetch.h"
+#include "myloader_transportable.h"
+#include "myloader_load_data.h"
+#include "myloader_ingest.h"
+#include "myloader_follow.h"
+#include "myloader_binlog_delta.h"
 
 guint commit_count = 1000;
+guint pipeline_depth = 8;
+guint split_file_size = 0;
 gchar *input_directory = NULL;
 gchar *directory = NULL;
 gchar *pwd=NULL;
@@ -91,7 +105,7 @@ extern guint64 max_transaction_size;
 
 const char DIRECTORY[] = "import";
 
-struct configuration_per_table conf_per_table = {NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL};
+struct configuration_per_table conf_per_table = {NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL};
 GHashTable * set_session_hash=NULL;
 
 GHashTable * myloader_initialize_hash_of_session_variables(){
@@ -152,6 +166,8 @@ void initialize_directories(){
     }else{
       if (!g_file_test(input_directory,G_FILE_TEST_IS_DIR))
         m_critical("the specified directory doesn't exists\n");
+      if (follow_mode)
+        directory=initialize_follow(directory);
       char *p = g_strdup_printf("%s/metadata", directory);
       if (!g_file_test(p, G_FILE_TEST_EXISTS)) {
         m_critical("the specified directory %s is not a mydumper backup as metadata file was not found in it",directory);
@@ -190,6 +206,8 @@ void print_help(){
     print_string("socket",socket_path);
     print_string("protocol", protocol_str);
     print_bool("compress-protocol",compress_protocol);
+    print_string("compression-algorithms",compression_algorithms);
+    print_int("zstd-compression-level",zstd_compression_level);
 #ifdef WITH_SSL
     print_bool("ssl",ssl);
     print_string("ssl-mode",ssl_mode);
@@ -205,6 +223,7 @@ void print_help(){
 
     print_bool("skip-triggers",skip_triggers);
     print_bool("skip-constraints",skip_constraints);
+    print_bool("validate-foreign-keys",validate_foreign_keys);
     print_bool("skip-indexes",skip_indexes);
     print_bool("skip-post",skip_post);
     print_bool("no-data",no_data);
@@ -237,7 +256,10 @@ void print_help(){
     print_bool("stream",stream);
 
     print_int("max-threads-per-table",max_threads_per_table);
+    print_bool("adaptive-table-threads",adaptive_table_threads);
     print_int("max-threads-for-index-creation",max_threads_for_index_creation);
+    print_int("index-ddl-threads",index_ddl_threads);
+    print_int("index-ddl-buffer-size",index_ddl_buffer_size);
     print_int("max-threads-for-post-actions",max_threads_for_post_creation);
     print_int("max-threads-for-schema-creation",max_threads_for_schema_creation);
     print_string("exec-per-thread",exec_per_thread);
@@ -245,6 +267,22 @@ void print_help(){
 
     print_int("rows",rows);
     print_int("queries-per-transaction",commit_count);
+    print_bool("adaptive-commit",adaptive_commit);
+    print_int("pipeline-depth",pipeline_depth);
+    print_int("split-file-size",split_file_size);
+    print_int("prefetch-files",prefetch_files);
+    print_int("prefetch-memory",prefetch_memory);
+    print_string("ingest-order",ingest_order_str);
+    print_string("io-mode",io_mode_str);
+    print_bool("load-data-as-insert",load_data_as_insert);
+    print_string("ingest-backend",ingest_backend_str);
+    print_string("fan-out-hosts",fan_out_hosts);
+    print_int("fan-out-buffer",fan_out_buffer);
+    print_string("shard-column",shard_column);
+    print_string("shard-function",shard_function_str);
+    print_bool("exchange-partitions",exchange_partitions);
+    print_int("stream-memory-limit",stream_memory_limit);
+    print_int("stream-lanes",stream_lanes);
     print_bool("append-if-not-exist",append_if_not_exist);
     print_string("set-names",set_names_in_conn_by_default);
 
@@ -257,7 +295,27 @@ void print_help(){
     print_string("database",target_db);
     print_string("quote-character",identifier_quote_character_str);
     print_bool("resume",resume);
+    print_bool("resume-journal",resume_journal);
+    print_bool("dump-in-progress",dump_in_progress);
+    print_bool("follow",follow_mode);
+    print_int("follow-interval",follow_interval);
+    print_bool("follow-drop-tables",follow_drop_tables);
+    print_bool("plan",plan);
+    print_int("plan-data-rate",plan_data_rate);
+    print_int("plan-max-data-rate",plan_max_data_rate);
+    print_int("plan-index-rate",plan_index_rate);
+    print_int("plan-schema-rate",plan_schema_rate);
     print_int("threads",num_threads);
+    print_int("max-memory",max_memory);
+    print_int("queue-stats-interval",queue_stats_interval);
+    print_string("cpu-affinity",cpu_affinity);
+    print_int("allocator-decay",allocator_decay);
+    print_string("metrics-listen",metrics_listen);
+    print_string("throttle-control",throttle_control);
+    print_bool("auto-threads",auto_threads);
+    print_string("trace-file",trace_file);
+    print_bool("report",run_report);
+    print_string("report-file",run_report_file);
     print_bool("version",program_version);
     print_bool("verbose",verbose);
     print_bool("debug",debug);
@@ -359,12 +417,19 @@ int main(int argc, char *argv[]) {
 
   check_num_threads();
 
+  if (pipeline_depth == 0)
+    pipeline_depth=1;
+
   if (num_threads > max_threads_per_table)
     g_message("Using %u loader threads (%u per table)", num_threads, max_threads_per_table);
   else
     g_message("Using %u loader threads", num_threads);
 
   initialize_set_names();
+  initialize_memory_budget();
+  initialize_cpu_affinity();
+  initialize_allocator();
+  initialize_gstring_pool();
 
   if (debug) {
     set_debug();
@@ -389,12 +454,23 @@ int main(int argc, char *argv[]) {
 
   g_message("MyDumper restore version: %s", VERSION);
 
+  if (plan){
+    if (stream)
+      m_critical("--plan needs a backup directory, it can not be used with --stream");
+    initialize_directories();
+    exit(run_plan());
+  }
+
   // Starts modifying file in disk, creating objects and restore
 
   hide_password(argc, argv);
   ask_password();
 
   initialize_pmm();
+  initialize_metrics(&write_myloader_metrics_entries);
+  initialize_spans("myloader");
+  initialize_run_report("myloader");
+  start_queue_stats();
 
   initialize_restore_job();
   initialize_directories();
@@ -410,6 +486,7 @@ int main(int argc, char *argv[]) {
   g_message("Using %s as FIFO directory, please remove it if restoration fails", fifo_directory);
 
   start_pmm_thread((void *)&conf);
+  metrics_set_conf(&conf);
 
   g_chdir(directory);
   /* Process list of tables to omit if specified */
@@ -452,13 +529,16 @@ int main(int argc, char *argv[]) {
   conf.post_table_queue = g_async_queue_new();
   conf.post_queue = g_async_queue_new();
   conf.index_queue = g_async_queue_new();
+  register_queue_stats("post_table", conf.post_table_queue);
+  register_queue_stats("post", conf.post_queue);
+  register_queue_stats("index", conf.index_queue);
   conf.view_queue = g_async_queue_new();
   conf.ready = g_async_queue_new();
+  initialize_dependencies();
+  initialize_constraint_dependencies(&conf);
   conf.pause_resume = g_async_queue_new();
   conf.table_list_mutex = g_mutex_new();
 //  conf.stream_queue = g_async_queue_new();
-  conf.table_hash = g_hash_table_new ( g_str_hash, g_str_equal );
-  conf.table_hash_mutex=g_mutex_new();
 
   if (g_file_test("resume",G_FILE_TEST_EXISTS)){
     if (!resume){
@@ -469,8 +549,20 @@ int main(int argc, char *argv[]) {
       m_critical("Resume file not found");
     }
   }
-
+  if (resume && dump_in_progress)
+    m_critical("--resume can not be used with --dump-in-progress");
+  if (follow_mode && (stream || dump_in_progress || resume || resume_journal))
+    m_critical("--follow can not be used with --stream, --dump-in-progress, --resume or --resume-journal");
+
+  initialize_fan_out();
+  initialize_shard();
+  initialize_journal();
+  initialize_exchange_partitions();
+  initialize_transportable(conn);
+  initialize_load_data(conn);
+  initialize_ingest(conn);
   initialize_connection_pool();
+  initialize_prefetch();
   struct thread_data *t=g_new(struct thread_data,1);
   initialize_thread_data(t, &conf, WAITING, 0, NULL);
 
@@ -489,6 +581,9 @@ int main(int argc, char *argv[]) {
     if (resume){
       m_critical("We don't expect to find resume files in a stream scenario");
     }
+    if (dump_in_progress){
+      m_critical("--dump-in-progress can not be used with --stream");
+    }
     initialize_stream(&conf);
   }else{
     initialize_directory();
@@ -525,7 +620,11 @@ int main(int argc, char *argv[]) {
   start_database(t);
   g_message("start_worker_schema");
   start_worker_schema();
+  // before the loader threads, as they acquire it
+  initialize_throttle_control(num_threads);
   initialize_loader_threads(&conf);
+  // the constraints are applied while other tables are still loading
+  initialize_post_loding_threads(&conf);
 
   if (throttle_variable)
     m_thread_new("mon_thro",monitor_throttling_thread, NULL, "Monitor throttling thread could not be created");
@@ -545,10 +644,10 @@ int main(int argc, char *argv[]) {
 
   wait_schema_worker_to_finish(&conf);
   wait_worker_loader_main();
+  restore_binlog_delta(t);
   enqueue_indexes_if_possible(&conf);
   create_index_shutdown_job(&conf);
   wait_index_worker_to_finish();
-  initialize_post_loding_threads(&conf);
   create_post_shutdown_job(&conf);
   wait_post_worker_to_finish();
 //  wait_control_job();
@@ -561,6 +660,8 @@ int main(int argc, char *argv[]) {
     m_query_critical(conn, "ALTER INSTANCE ENABLE INNODB REDO_LOG", "ENABLE INNODB REDO LOG failed");
 
   gboolean checksum_ok=TRUE;
+  struct report_mark checksum_mark;
+  report_start(&checksum_mark);
   tl=conf.table_list;
   while (tl != NULL){
     checksum_ok&=checksum_dbt(tl->data, conn);
@@ -587,7 +688,14 @@ int main(int argc, char *argv[]) {
                                   "Triggers checksum", checksum_trigger_structure_from_database);
     }
   }
+  report_end(REPORT_CHECKSUMS, &checksum_mark, 0);
+  if (follow_mode)
+    follow_snapshots(&conf);
   wait_restore_threads_to_close();
+  finalize_prefetch();
+  fan_out_report();
+  pipeline_report();
+  finalize_journal();
 
   if (!checksum_ok){
     if (checksum_mode==CHECKSUM_WARN)
@@ -636,11 +744,12 @@ int main(int argc, char *argv[]) {
   free_loader_threads();
 
   stop_pmm_thread();
+  stop_queue_stats();
+  stop_metrics();
+  finish_spans();
+  finish_run_report();
 
-//  g_hash_table_foreach(conf.table_hash,&show_dbt, NULL);
-  free_table_hash(conf.table_hash);
-  g_hash_table_remove_all(conf.table_hash);
-  g_hash_table_unref(conf.table_hash);
+  free_table_registry();
   g_list_free_full(conf.checksum_list,g_free);
 
   free_set_names();
@@ -664,8 +773,10 @@ int main(int argc, char *argv[]) {
   if (key_file)  g_key_file_free(key_file);
   g_remove(fifo_directory);
   g_message("Restore completed");
+  print_memory_usage();
 
   if (logoutfile) {
+    stop_async_log();
     fclose(logoutfile);
   }
 
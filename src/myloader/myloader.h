@@ -26,6 +26,15 @@
 #include "../server_detect.h"
 #include "../pmm_thread.h"
 #include "../checksum.h"
+#include "../row_binary.h"
+#include "../memory_budget.h"
+#include "../cpu_affinity.h"
+#include "../allocator.h"
+#include "../throttle_control.h"
+#include "../metrics.h"
+#include "../span_trace.h"
+#include "../queue_stats.h"
+#include "../run_report.h"
 #include "myloader_table.h"
 #ifndef _src_myloader_h
 #define _src_myloader_h
@@ -55,6 +64,8 @@ enum thread_states { WAITING, STARTED, COMPLETED };
 struct io_restore_result{
   GAsyncQueue *restore;
   GAsyncQueue *result;
+  // the connections handed back to the pool before the end of the file
+  GAsyncQueue *released;
 };
 
 struct connection_data{
@@ -66,7 +77,30 @@ struct connection_data{
   GAsyncQueue * ready;
   gboolean transaction;
   GMutex *in_use;
-  
+  // prepared while restoring a BINARY_DATA file
+  MYSQL_STMT *binary_stmt;
+  guint binary_stmt_rows;
+  // --adaptive-commit
+  guint commit_target;
+  gint commit_direction;
+  gint64 transaction_start;
+  guint64 transaction_rows;
+  gint64 commit_time_avg;
+  gdouble last_rate;
+  // --fan-out-hosts, a connection per target
+  struct fan_out_connection *fan_out;
+  // --shard-column, the LOAD DATA being executed
+  struct shard_load_data *shard_load_data;
+  struct shard_filter *shard_filter;
+  // --resume-journal, the file being restored and its next checkpoint
+  const gchar *journal_filename;
+  guint64 journal_range;
+  guint64 journal_offset;
+  guint64 statement_rows;
+  // statements sent, to report the wire compression ratio
+  guint64 payload_bytes;
+  // --ingest-backend, enabled on the session until the connection is released
+  struct ingest_backend *ingest_backend;
 };
 
 struct replication_statements {
@@ -83,7 +117,11 @@ struct thread_data {
   guint thread_id;
   enum thread_states status;
   guint granted_connections;
+  // granted connections that went back to the pool while the file is restored
+  guint released_connections;
   struct db_table*dbt;
+  // --exchange-partitions, the INSERTs of the data file go to this table
+  const gchar *staging_table;
 };
 
 struct configuration {
@@ -100,8 +138,6 @@ struct configuration {
   GList *table_list;
   GList *loading_table_list;
   GMutex * table_list_mutex;
-  GHashTable *table_hash;
-  GMutex *table_hash_mutex;
 //  GList *schema_create_list;
   GList *checksum_list;
   GMutex *mutex;
@@ -144,11 +180,16 @@ enum file_type {
   SCHEMA_SEQUENCE,
   SCHEMA_CREATE, 
   SCHEMA_TABLE,
+  DATA_INDEX,
+  TABLESPACE_CFG,
   DATA,
   LOAD_DATA,
+  BINARY_DATA,
+  TABLESPACE_DATA,
   SCHEMA_VIEW, 
   SCHEMA_TRIGGER, 
   SCHEMA_POST, 
+  BINLOG_DELTA,
   IGNORED,
   FILENAME_ENDED
 };
@@ -168,16 +209,26 @@ const char *ft2str(enum file_type ft){
     return "SCHEMA_CREATE";
   case SCHEMA_TABLE:
     return "SCHEMA_TABLE";
+  case DATA_INDEX:
+    return "DATA_INDEX";
+  case TABLESPACE_CFG:
+    return "TABLESPACE_CFG";
   case DATA:
     return "DATA";
   case LOAD_DATA:
     return "LOAD_DATA";
+  case BINARY_DATA:
+    return "BINARY_DATA";
+  case TABLESPACE_DATA:
+    return "TABLESPACE_DATA";
   case SCHEMA_VIEW:
     return "SCHEMA_VIEW";
   case SCHEMA_TRIGGER:
     return "SCHEMA_TRIGGER";
   case SCHEMA_POST:
     return "SCHEMA_POST";
+  case BINLOG_DELTA:
+    return "BINLOG_DELTA";
   case IGNORED:
     return "IGNORED";
   case FILENAME_ENDED:
@@ -129,6 +129,12 @@ gboolean arguments_callback(const gchar *option_name,const gchar *value, gpointe
   } else if (!g_strcmp0(option_name, "--enable-binlog") || !g_strcmp0(option_name, "-e")){
     m_warning("Option --enable-binlog / -e is discouraged. Use [myloader_session_variables] in the --defaults-file or --defaults-extra-file instead");
     return FALSE;
+  } else if (!g_strcmp0(option_name, "--table-order")){
+    if (value==NULL || !set_table_order(value)){
+      m_error("--table-order accepts: size, rows or none");
+      return FALSE;
+    }
+    return TRUE;
   }
   
   return common_arguments_callback(option_name, value, data, error);
@@ -149,6 +155,26 @@ static GOptionEntry entries[] = {
       "If enabled, during INSERT IGNORE the warnings will be printed", NULL},
     {"resume",0, 0, G_OPTION_ARG_NONE, &resume,
       "Expect to find resume file in backup dir and will only process those files",NULL},
+    {"resume-journal", 0, 0, G_OPTION_ARG_NONE, &resume_journal,
+      "Keeps a journal of the committed statements in the backup dir, a rerun continues every data file from its last commit. Uses one connection per data file",NULL},
+    {"dump-in-progress", 0, 0, G_OPTION_ARG_NONE, &dump_in_progress,
+      "Starts the restore while mydumper is still writing the backup dir, following the files of its --file-manifest until the dump finishes",NULL},
+    {"follow", 0, 0, G_OPTION_ARG_NONE, &follow_mode,
+      "The backup dir is the output directory of mydumper --daemon. Restores its last_dump and keeps applying the tables and chunks that changed in each new snapshot",NULL},
+    {"follow-interval", 0, 0, G_OPTION_ARG_INT, &follow_interval,
+      "Seconds between the checks of last_dump with --follow. Default: 60",NULL},
+    {"follow-drop-tables", 0, 0, G_OPTION_ARG_NONE, &follow_drop_tables,
+      "Drops the tables that are not in the new snapshot with --follow. By default they are kept as they are",NULL},
+    {"plan", 0, 0, G_OPTION_ARG_NONE, &plan,
+      "Does not connect, prints the predicted duration of each phase, the critical path and the recommended threads of the restore of the backup dir",NULL},
+    {"plan-data-rate", 0, 0, G_OPTION_ARG_INT, &plan_data_rate,
+      "MB/s that a loader thread loads in the --plan model. Default: 20",NULL},
+    {"plan-max-data-rate", 0, 0, G_OPTION_ARG_INT, &plan_max_data_rate,
+      "MB/s that the server loads with all the loader threads in the --plan model. Default: 0, unlimited",NULL},
+    {"plan-index-rate", 0, 0, G_OPTION_ARG_INT, &plan_index_rate,
+      "Rows/s that an index thread sorts for each secondary index in the --plan model. Default: 1000000",NULL},
+    {"plan-schema-rate", 0, 0, G_OPTION_ARG_INT, &plan_schema_rate,
+      "Objects/s that a schema or post thread creates in the --plan model. Default: 20",NULL},
     {"kill-at-once", 'k', 0, G_OPTION_ARG_NONE, &kill_at_once, 
       "When Ctrl+c is pressed it immediately terminates the process", NULL},
     {"mysqldump", 0, 0, G_OPTION_ARG_NONE, &mysqldump, 
@@ -168,8 +194,14 @@ static GOptionEntry load_from_metadata_entries[] = {
 static GOptionEntry threads_entries[] = {
     {"max-threads-per-table", 0, 0, G_OPTION_ARG_INT, &max_threads_per_table,
       "Maximum number of threads per table to use, defaults to --threads", NULL},
+    {"adaptive-table-threads", 0, 0, G_OPTION_ARG_NONE, &adaptive_table_threads,
+      "Changes the threads of each table up to --max-threads-per-table, following the bytes/sec that the table loads", NULL},
     {"max-threads-for-index-creation", 0, 0, G_OPTION_ARG_INT, &max_threads_for_index_creation,
-      "Maximum number of threads for index creation, default 4", NULL},
+      "Maximum number of threads for index creation, default 4. Less are used while the loader threads are busy", NULL},
+    {"index-ddl-threads", 0, 0, G_OPTION_ARG_INT, &index_ddl_threads,
+      "Total innodb_ddl_threads split between the index builds that run at the same time. Default: 0, not set", NULL},
+    {"index-ddl-buffer-size", 0, 0, G_OPTION_ARG_INT, &index_ddl_buffer_size,
+      "Total innodb_ddl_buffer_size in MB split between the index builds that run at the same time. Default: 0, not set", NULL},
     {"max-threads-for-post-actions", 0, 0, G_OPTION_ARG_INT,&max_threads_for_post_creation,
       "Maximum number of threads for post action like: constraints, procedure, views and triggers, default 1", NULL},
     {"max-threads-for-schema-creation", 0, 0, G_OPTION_ARG_INT, &max_threads_for_schema_creation,
@@ -215,15 +247,36 @@ static GOptionEntry execution_entries[] = {
     {"stream", 0, G_OPTION_FLAG_OPTIONAL_ARG, G_OPTION_ARG_CALLBACK , &stream_arguments_callback,
       "It will receive the stream from STDIN and create the file in the disk before start processing. "
       "Since v0.12.7-1, accepts NO_DELETE, NO_STREAM_AND_NO_DELETE and TRADITIONAL which is the default value and used if no parameter is given and also NO_STREAM since v0.16.3-1", NULL},
+    {"stream-memory-limit", 0, 0, G_OPTION_ARG_INT, &stream_memory_limit,
+      "Data files received with --stream are kept in memory up to this amount of MB and handed to the loader "
+      "threads without being written into the directory. Files that do not fit are spilled to disk. Default: 0 (disabled)", NULL},
+    {"stream-lanes", 0, 0, G_OPTION_ARG_INT, &stream_lanes,
+      "Amount of threads that write the files received when mydumper uses --stream-lanes. Default: 4", NULL},
     {"metadata-refresh-interval", 0, 0, G_OPTION_ARG_INT, &refresh_table_list_interval, 
-      "Every this amount of tables the internal metadata will be refreshed. "
-      "If the amount of tables you have in your metadata file is high, then you should increase this value. Default: 100", NULL},
+      "Deprecated, the tables are added to the internal metadata as they are found", NULL},
+    {"table-order", 0, 0, G_OPTION_ARG_CALLBACK, &arguments_callback,
+      "Order to load the tables: size (bytes left to load, largest first), rows (largest first) or none. Default: size", NULL},
     {"skip-table-sorting", 0, 0, G_OPTION_ARG_NONE, &skip_table_sorting, 
       "Starting with largest table is better, but this can be ignored due performance impact when you have high amount of tables", NULL},
     {"set-gtid-purged", 0, 0, G_OPTION_ARG_NONE, &set_gtid_purge,
       "After import, it will execute the SET GLOBAL gtid_purged with the value found on source section of the metadata file", NULL},
     {"num-sequences", 0, 0, G_OPTION_ARG_INT, &num_sequences,
       "Amount of sequences in the backup. It is read from [config] in the metadata file. Default: 0 ", NULL},
+    {"fan-out-hosts", 0, 0, G_OPTION_ARG_STRING, &fan_out_hosts,
+      "Comma separated list of host[:port] that are restored at the same time than --host, the dump is read once. "
+      "Every loader connection has a connection on each of them, with the same credentials, that executes the same statements", NULL},
+    {"fan-out-buffer", 0, 0, G_OPTION_ARG_INT, &fan_out_buffer,
+      "Statements that the connection of a --fan-out-hosts server can be behind before the loader connection waits for it, default 64", NULL},
+    {"shard-column", 0, 0, G_OPTION_ARG_STRING, &shard_column,
+      "Distributes the rows of the INSERT and LOAD DATA over --host, the shard 0, and the --fan-out-hosts by this column instead of copying them. "
+      "It can be set per table with shard_column in the [`db`.`table`] section of the defaults file. "
+      "Tables without the column are restored in every shard", NULL},
+    {"shard-function", 0, 0, G_OPTION_ARG_STRING, &shard_function_str,
+      "How the shard of a row is chosen: hash, which is CRC32(column) % shards, or range:<bound>[,<bound>...] with a bound less than the amount of shards, "
+      "the values lower than the first bound go to the shard 0. Default: hash", NULL},
+    {"exchange-partitions", 0, 0, G_OPTION_ARG_NONE, &exchange_partitions,
+      "Restores each partition dumped with --split-partitions into a staging table, which gets its own indexes and is swapped in with "
+      "ALTER TABLE ... EXCHANGE PARTITION once the table has its indexes. The partitions of the table are expected to be empty", NULL},
     {NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL}};
 
 static GOptionEntry filter_entries[] ={
@@ -235,6 +288,8 @@ static GOptionEntry filter_entries[] ={
      "Do not import events, stored procedures and functions. By default, it imports events, stored procedures or functions", NULL},
     {"skip-constraints", 0, 0, G_OPTION_ARG_NONE, &skip_constraints, 
       "Do not import constraints. By default, it imports constraints", NULL },
+    {"validate-foreign-keys", 0, 0, G_OPTION_ARG_NONE, &validate_foreign_keys,
+      "Checks each foreign key added with FOREIGN_KEY_CHECKS=0 with a query for the rows without parent row, on the connections of the pool while the constraints of other tables are added", NULL },
     {"skip-indexes", 0, 0, G_OPTION_ARG_NONE, &skip_indexes,
       "Do not import secondary indexes on InnoDB tables. By default, it import the indexes", NULL},
     {"no-data", 0, 0, G_OPTION_ARG_NONE, &no_data, 
@@ -246,8 +301,27 @@ static GOptionEntry statement_entries[] ={
      "Split the INSERT statement into this many rows.", NULL},
     {"queries-per-transaction", 'q', 0, G_OPTION_ARG_INT, &commit_count,
      "Number of queries per transaction, default 1000", NULL},
+    {"adaptive-commit", 0, 0, G_OPTION_ARG_NONE, &adaptive_commit,
+     "Adjusts the queries per transaction of each connection, starting from --queries-per-transaction, "
+     "to the size that gives more rows per second, and reduces it when the commits get slower", NULL},
+    {"pipeline-depth", 0, 0, G_OPTION_ARG_INT, &pipeline_depth,
+     "Number of statements per file that can be queued to the restore connections while the file is being read, default 8. With --max-memory it is reduced until the statements fit in half of the budget", NULL},
+    {"split-file-size", 0, 0, G_OPTION_ARG_INT, &split_file_size,
+     "Uncompressed data files bigger than this size in MB and without .idx file are split in ranges that are restored by different threads. 0 disables it, default 0", NULL},
+    {"prefetch-files", 0, 0, G_OPTION_ARG_INT, &prefetch_files,
+     "Number of data files per thread that are read and decompressed into memory before a loader thread opens them. 0 disables it, default 0", NULL},
+    {"prefetch-memory", 0, 0, G_OPTION_ARG_INT, &prefetch_memory,
+     "Memory in MB used by the files read by --prefetch-files, the files that do not fit are read by the loader threads. Default 1024", NULL},
+    {"ingest-order", 0, 0, G_OPTION_ARG_STRING, &ingest_order_str,
+     "Order of the data files of a table: INTERLEAVED, the threads load parts far from each other, or CLUSTERED, each thread loads consecutive parts and appends at the end of its own range of the primary key. Default: INTERLEAVED", NULL},
+    {"io-mode", 0, 0, G_OPTION_ARG_STRING, &io_mode_str,
+     "How the files are read: buffered or fadvise, which reads them ahead and releases their pages from the page cache once restored. Default: buffered", NULL},
     {"max-statement-size", 0, 0, G_OPTION_ARG_INT, &max_statement_size,
-     "Informs what is the max statement size. Currently not being used.", NULL},
+     "Size in bytes of the INSERT statements of --load-data-as-insert, capped by max_allowed_packet. Default: the one of the dump, otherwise 1000000", NULL},
+    {"load-data-as-insert", 0, 0, G_OPTION_ARG_NONE, &load_data_as_insert,
+     "Restores the files of the LOAD DATA statements as multi-row INSERTs, for servers that do not accept LOAD DATA LOCAL INFILE. Enabled when local_infile is OFF on the server", NULL},
+    {"ingest-backend", 0, 0, G_OPTION_ARG_STRING, &ingest_backend_str,
+     "How the rows are loaded: GENERIC, INSERT and LOAD DATA, or AUTO, which uses the bulk load of the engine when the server has it: rocksdb_bulk_load for the ROCKSDB tables that are created by myloader and the bulk DML of TiDB. Default: GENERIC", NULL},
     {"max-transaction-size", 0, 0, G_OPTION_ARG_INT, &max_transaction_size,
      "Set the max size of the transaction in megabytes, default 1000", NULL},
     {"append-if-not-exist", 0, 0, G_OPTION_ARG_NONE,&append_if_not_exist,
@@ -0,0 +1,49 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#include <glib.h>
+
+#include "myloader.h"
+#include "myloader_global.h"
+#include "myloader_common.h"
+#include "myloader_database.h"
+#include "myloader_restore.h"
+#include "myloader_binlog_delta.h"
+
+static gchar *binlog_delta_filename=NULL;
+
+void process_binlog_delta_filename(gchar *filename){
+  g_free(binlog_delta_filename);
+  binlog_delta_filename=g_strdup(filename);
+}
+
+/* The events have the database and table names of the source, the tables
+   that are not restored would make the delta fail */
+void restore_binlog_delta(struct thread_data *td){
+  if (binlog_delta_filename == NULL || no_data)
+    return;
+  if (has_been_defined_a_target_database() || source_db || tables){
+    g_critical("Binlog delta %s can not be restored with --database, --source-db or --tables-list, the data is not consistent", binlog_delta_filename);
+    errors++;
+    return;
+  }
+  message("Restoring binlog delta %s", binlog_delta_filename);
+  if (restore_data_from_mydumper_file(td, binlog_delta_filename, TRUE, NULL)){
+    g_critical("Binlog delta %s could not be restored, the data is not consistent", binlog_delta_filename);
+    errors++;
+  }
+}
@@ -0,0 +1,31 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#ifndef _src_myloader_binlog_delta_h
+#define _src_myloader_binlog_delta_h
+
+#include <glib.h>
+#include "myloader.h"
+
+#define BINLOG_DELTA_FILENAME "binlog-delta.sql"
+
+/* The BINLOG statements that mydumper --sync-thread-lock-mode BINLOG_DELTA
+   read from the binlog of the dump window. They are restored in order by a
+   single connection once all the data is loaded, before the indexes */
+void process_binlog_delta_filename(gchar *filename);
+void restore_binlog_delta(struct thread_data *td);
+#endif
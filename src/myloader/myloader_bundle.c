@@ -0,0 +1,191 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#define _GNU_SOURCE
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "myloader.h"
+#include "myloader_global.h"
+#include "myloader_bundle.h"
+
+struct bundle {
+  gchar *name;
+  // opened by the first section that is read, shared by all of them
+  int fd;
+};
+
+struct bundle_section {
+  struct bundle *bundle;
+  guint64 offset;
+  guint64 length;
+};
+
+struct bundle_reader {
+  struct bundle_section *bs;
+  guint64 position;
+};
+
+// basename of the file -> its bundle_section, it is not modified once loaded
+static GHashTable *bundle_sections=NULL;
+static GHashTable *bundles=NULL;
+static GMutex *bundle_mutex=NULL;
+
+static
+void free_bundle(struct bundle *b){
+  if (b->fd >= 0)
+    close(b->fd);
+  g_free(b->name);
+  g_free(b);
+}
+
+/* BUNDLE_INDEX has one "filename<TAB>bundle<TAB>offset<TAB>length" line per
+   file, in the order that they were appended. Returns the files, so they are
+   processed as if they were in the directory */
+GList *load_bundle_index(){
+  gchar *path=g_build_filename(directory, BUNDLE_INDEX, NULL), *content=NULL;
+  gboolean found=g_file_get_contents(path, &content, NULL, NULL);
+  g_free(path);
+  if (!found)
+    return NULL;
+  bundle_mutex=g_mutex_new();
+  bundles=g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)free_bundle);
+  bundle_sections=g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  GList *filenames=NULL;
+  gchar **lines=g_strsplit(content, "\n", -1);
+  g_free(content);
+  guint i;
+  for (i=0; lines[i]; i++){
+    gchar **fields=g_strsplit(lines[i], "\t", 4);
+    if (g_strv_length(fields) == 4){
+      struct bundle *b=g_hash_table_lookup(bundles, fields[1]);
+      if (b == NULL){
+        b=g_new0(struct bundle, 1);
+        b->name=g_strdup(fields[1]);
+        b->fd=-1;
+        g_hash_table_insert(bundles, b->name, b);
+      }
+      struct bundle_section *bs=g_new0(struct bundle_section, 1);
+      bs->bundle=b;
+      bs->offset=g_ascii_strtoull(fields[2], NULL, 10);
+      bs->length=g_ascii_strtoull(fields[3], NULL, 10);
+      g_hash_table_insert(bundle_sections, g_strdup(fields[0]), bs);
+      filenames=g_list_prepend(filenames, g_strdup(fields[0]));
+    }
+    g_strfreev(fields);
+  }
+  g_strfreev(lines);
+  g_message("Using %s, %u files in %u bundles", BUNDLE_INDEX, g_hash_table_size(bundle_sections), g_hash_table_size(bundles));
+  return g_list_reverse(filenames);
+}
+
+static
+struct bundle_section *bundle_lookup(const gchar *filename){
+  if (bundle_sections == NULL)
+    return NULL;
+  gchar *basename=g_path_get_basename(filename);
+  struct bundle_section *bs=g_hash_table_lookup(bundle_sections, basename);
+  g_free(basename);
+  return bs;
+}
+
+gboolean bundle_size(const gchar *filename, guint64 *size){
+  struct bundle_section *bs=bundle_lookup(filename);
+  if (bs == NULL)
+    return FALSE;
+  *size=bs->length;
+  return TRUE;
+}
+
+static
+ssize_t bundle_reader_read(void *cookie, char *buf, size_t size){
+  struct bundle_reader *br=cookie;
+  guint64 left=br->bs->length - br->position;
+  ssize_t r;
+  do {
+    r=pread(br->bs->bundle->fd, buf, left < size ? left : size, br->bs->offset + br->position);
+  } while (r < 0 && errno == EINTR);
+  if (r > 0)
+    br->position+=r;
+  return r;
+}
+
+static
+int bundle_reader_seek(void *cookie, off64_t *offset, int whence){
+  struct bundle_reader *br=cookie;
+  off64_t target;
+  switch (whence){
+    case SEEK_SET:
+      target=*offset;
+      break;
+    case SEEK_CUR:
+      target=br->position + *offset;
+      break;
+    case SEEK_END:
+      target=br->bs->length + *offset;
+      break;
+    default:
+      return -1;
+  }
+  if (target < 0 || (guint64)target > br->bs->length)
+    return -1;
+  br->position=target;
+  *offset=target;
+  return 0;
+}
+
+static
+int bundle_reader_close(void *cookie){
+  g_free(cookie);
+  return 0;
+}
+
+/* Returns the section of the file in its bundle, NULL if it was not bundled.
+   The sections are read with pread() on the descriptor of the bundle, which
+   is read ahead as the files of a bundle are restored close to its order */
+FILE *bundle_fopen(const gchar *filename){
+  struct bundle_section *bs=bundle_lookup(filename);
+  if (bs == NULL)
+    return NULL;
+  g_mutex_lock(bundle_mutex);
+  if (bs->bundle->fd < 0){
+    gchar *path=g_build_filename(directory, bs->bundle->name, NULL);
+    bs->bundle->fd=open(path, O_RDONLY);
+    if (bs->bundle->fd < 0)
+    {
+      g_critical("Could not open bundle %s: %s", path, strerror(errno));
+      errors++;
+    }else
+      posix_fadvise(bs->bundle->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    g_free(path);
+  }
+  g_mutex_unlock(bundle_mutex);
+  if (bs->bundle->fd < 0)
+    return NULL;
+  struct bundle_reader *br=g_new0(struct bundle_reader, 1);
+  br->bs=bs;
+  cookie_io_functions_t io_functions = { &bundle_reader_read, NULL, &bundle_reader_seek, &bundle_reader_close };
+  FILE *file=fopencookie(br, "r", io_functions);
+  if (!file)
+    bundle_reader_close(br);
+  return file;
+}
@@ -0,0 +1,32 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#ifndef _src_myloader_bundle_h
+#define _src_myloader_bundle_h
+
+#include <glib.h>
+#include <stdio.h>
+
+#define BUNDLE_INDEX "metadata.bundles"
+#define BUNDLE_EXTENSION ".bundle"
+
+/* The files of the small tables that mydumper --bundle-tables-under packed
+   into bundles are read from their section of the bundle, by their name */
+GList *load_bundle_index();
+FILE *bundle_fopen(const gchar *filename);
+gboolean bundle_size(const gchar *filename, guint64 *size);
+#endif
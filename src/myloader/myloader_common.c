@@ -15,6 +15,7 @@
         Authors:    David Ducos, Percona (david dot ducos at percona dot com)
 */
 
+#define _GNU_SOURCE
 #include <mysql.h>
 #include <glib.h>
 #include <glib/gstdio.h>
@@ -23,7 +24,9 @@
 #include <string.h>
 #include <sys/wait.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <errno.h>
+#include <zlib.h>
 
 #include "myloader.h"
 #include "myloader_stream.h"
@@ -35,17 +38,54 @@
 #include "myloader_global.h"
 #include "myloader_database.h"
 #include "myloader_table.h"
+#include "myloader_bundle.h"
+#ifdef WITH_ZSTD
+#include <zstd.h>
+#endif
 GHashTable *tbl_hash=NULL;
 int (*m_close)(void *file) = NULL;
 guint refresh_table_list_interval=100;
-guint refresh_table_list_counter=1;
 gboolean skip_table_sorting = FALSE;
 gchar ** zstd_decompress_cmd = NULL; 
 gchar ** gzip_decompress_cmd = NULL;
 guint max_number_tables_to_sort_in_table_list = 100000;
+gchar *io_mode_str=NULL;
+static gboolean io_mode_fadvise=FALSE;
+
+struct chunk_checksum{
+  struct db_table *dbt;
+  gchar *checksum;
+  guint64 rows;
+  gchar *partition;
+  gchar *where;
+  // data files of the chunk that are not restored yet
+  guint pending_files;
+  gboolean verified;
+  gboolean ok;
+};
+
+struct chunk_checksum_file{
+  gboolean restored;
+  GList *chunks;
+};
+
+static GMutex *chunk_checksum_mutex=NULL;
+static GHashTable *chunk_checksum_files=NULL;
+// basename -> crc32 of its content, from file_checksum_N of the metadata
+static GHashTable *file_checksums=NULL;
+// mydumper --content-store: filename -> blob, relative to the directory
+static GHashTable *content_store_manifest=NULL;
 
 void initialize_common(){
-  refresh_table_list_counter=refresh_table_list_interval;
+  if (io_mode_str){
+    if (!g_ascii_strcasecmp(io_mode_str, "fadvise"))
+      io_mode_fadvise=TRUE;
+    else if (g_ascii_strcasecmp(io_mode_str, "buffered"))
+      m_critical("--io-mode must be buffered or fadvise");
+  }
+  chunk_checksum_mutex=g_mutex_new();
+  chunk_checksum_files=g_hash_table_new(g_str_hash, g_str_equal);
+  file_checksums=g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
   tbl_hash=g_hash_table_new ( g_str_hash, g_str_equal );
 
   if ((exec_per_thread_extension==NULL) && (exec_per_thread != NULL))
@@ -65,17 +105,18 @@ void initialize_common(){
   gchar *cmd=NULL;
   tmpcmd=g_find_program_in_path(ZSTD);
   if (!tmpcmd){
+#ifndef WITH_ZSTD
     m_warning("%s was not found in PATH, use --exec-per-thread for non default locations",ZSTD);
+#endif
   }else{
     zstd_decompress_cmd = g_strsplit(cmd=g_strdup_printf("%s -c -d", tmpcmd)," ",0);
     g_free(tmpcmd);
     g_free(cmd);
   }
 
+  // gzip files are decompressed in-process, the command is just a fallback
   tmpcmd=g_find_program_in_path(GZIP);
-  if (!tmpcmd){
-    m_warning("%s was not found in PATH, use --exec-per-thread for non default locations",GZIP);
-  }else{
+  if (tmpcmd){
     gzip_decompress_cmd = g_strsplit( cmd=g_strdup_printf("%s -c -d", tmpcmd)," ",0);
     g_free(tmpcmd);
     g_free(cmd);
@@ -334,22 +375,38 @@ gboolean m_filename_has_suffix(gchar const *str, gchar const *suffix){
   return g_str_has_suffix(str,suffix);
 }
 
+// every file of a table asks for the same decision, it is kept per table
+static GHashTable *eval_table_results=NULL;
+static GString *eval_table_key=NULL;
+
+static
+gboolean eval_table_uncached( char *db_name, char * table_name){
+  if ( tables && !is_table_in_list( db_name, table_name, tables))
+    return FALSE;
+  if ( tables_skiplist_file && check_skiplist(db_name, table_name ))
+    return FALSE;
+  return eval_regex(db_name, table_name);
+}
+
 gboolean eval_table( char *db_name, char * table_name, GMutex * mutex){
   if (table_name == NULL)
     g_error("Table name is null on eval_table()");
   g_mutex_lock(mutex);
-  if ( tables ){
-    if (!is_table_in_list( db_name, table_name, tables)){
-      g_mutex_unlock(mutex);
-      return FALSE;
-    }
+  if (!eval_table_results){
+    eval_table_results=g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    eval_table_key=g_string_sized_new(128);
   }
-  if ( tables_skiplist_file && check_skiplist(db_name, table_name )){
-    g_mutex_unlock(mutex);
-    return FALSE;
+  g_string_printf(eval_table_key, "%s.%s", db_name, table_name);
+  gpointer result=NULL;
+  gboolean r=FALSE;
+  if (g_hash_table_lookup_extended(eval_table_results, eval_table_key->str, NULL, &result)){
+    r=GPOINTER_TO_INT(result);
+  }else{
+    r=eval_table_uncached(db_name, table_name);
+    g_hash_table_insert(eval_table_results, g_strdup(eval_table_key->str), GINT_TO_POINTER(r));
   }
   g_mutex_unlock(mutex);
-  return eval_regex(db_name, table_name);
+  return r;
 }
 /*
 enum file_type get_file_type (const char * filename){
@@ -420,51 +477,43 @@ void get_database_table_from_file(const gchar *filename,const char *sufix,gchar
   g_strfreev(split);
 }
 
+/* conf->table_list grows as the tables are found, only the list of the
+   tables that are still loading is rebuilt, and it is sorted once instead
+   of inserting each table in order */
 void refresh_table_list_without_table_hash_lock(struct configuration *conf, gboolean force){
   trace("refresh_table_list requested");
-  if (force || g_atomic_int_dec_and_test(&refresh_table_list_counter)){
-    trace("refresh_table_list granted");
-    GList * table_list=NULL;
-    GList * loading_table_list=NULL;
-    GHashTableIter iter;
-    gchar * lkey;
-    g_mutex_lock(conf->table_list_mutex);
-    g_hash_table_iter_init ( &iter, conf->table_hash );
-    struct db_table *dbt=NULL;
-    gboolean _skip_table_sorting= skip_table_sorting || g_hash_table_size(conf->table_hash) > max_number_tables_to_sort_in_table_list;
-    while ( g_hash_table_iter_next ( &iter, (gpointer *) &lkey, (gpointer *) &dbt ) ) {
-//      if (skip_table_sorting || g_list_length(table_list) > max_number_tables_to_sort_in_table_list)
-      trace("table_list inserting: %s", lkey);
-      if (_skip_table_sorting){
-        table_list=g_list_prepend(table_list,dbt);
-        table_lock(dbt);
-        if (dbt->schema_state < DATA_DONE)
-          loading_table_list=g_list_prepend(loading_table_list,dbt);
-        table_unlock(dbt);
-      }else{
-//        table_list=g_list_insert_sorted(table_list,dbt,&compare_dbt_short);
-        table_list=g_list_prepend(table_list,dbt);
-        table_lock(dbt);
-        if (dbt->schema_state < DATA_DONE)
-          loading_table_list=g_list_insert_sorted(loading_table_list,dbt,&compare_dbt_short);
-        table_unlock(dbt);
-      }
+  if (!force)
+    return;
+  GList * loading_table_list=NULL, *iter;
+  struct db_table *dbt=NULL;
+  g_mutex_lock(conf->table_list_mutex);
+  gboolean _skip_table_sorting= skip_table_sorting || table_order_function == NULL || table_registry_size() > max_number_tables_to_sort_in_table_list;
+  for (iter=conf->table_list; iter; iter=iter->next){
+    dbt=iter->data;
+    table_lock(dbt);
+    if (dbt->schema_state < DATA_DONE){
+      dbt->sort_size=dbt->remaining_size;
+      loading_table_list=g_list_prepend(loading_table_list,dbt);
     }
-    g_list_free(conf->table_list);
-    conf->table_list=table_list;
-    g_list_free(conf->loading_table_list);
-    conf->loading_table_list=loading_table_list;
-    g_atomic_int_set(&refresh_table_list_counter,refresh_table_list_interval);
-    g_mutex_unlock(conf->table_list_mutex);
-  }else{
-    trace("refresh_table_list denied");
+    table_unlock(dbt);
   }
+  if (!_skip_table_sorting)
+    loading_table_list=g_list_sort(loading_table_list, table_order_function);
+  g_list_free(conf->loading_table_list);
+  conf->loading_table_list=loading_table_list;
+  g_mutex_unlock(conf->table_list_mutex);
+}
+
+// the new table is checked by the loaders until the next refresh sorts it
+void append_table_list(struct configuration *conf, struct db_table *dbt){
+  g_mutex_lock(conf->table_list_mutex);
+  conf->table_list=g_list_prepend(conf->table_list, dbt);
+  conf->loading_table_list=g_list_prepend(conf->loading_table_list, dbt);
+  g_mutex_unlock(conf->table_list_mutex);
 }
 
 void refresh_table_list(struct configuration *conf){
-  g_mutex_lock(conf->table_hash_mutex);
   refresh_table_list_without_table_hash_lock(conf, TRUE);
-  g_mutex_unlock(conf->table_hash_mutex);
 }
 
 static inline gboolean
@@ -509,6 +558,181 @@ gboolean checksum_database_template(gchar *_db, gchar *dbt_checksum,  MYSQL *con
                     "%s confirmed for %s", message, _db, NULL);
 }
 
+static
+struct chunk_checksum_file *get_chunk_checksum_file(const gchar *basename){
+  struct chunk_checksum_file *ccf=g_hash_table_lookup(chunk_checksum_files, basename);
+  if (ccf == NULL){
+    ccf=g_new0(struct chunk_checksum_file, 1);
+    g_hash_table_insert(chunk_checksum_files, g_strdup(basename), ccf);
+  }
+  return ccf;
+}
+
+/* Each chunk_checksum_N of the metadata is checksum;rows;partition;where
+   followed by the data files that have its rows */
+void load_chunk_checksums(GKeyFile *kf, gchar *group, struct db_table *dbt){
+  if (checksum_mode == CHECKSUM_SKIP || dbt->chunk_checksum_expression != NULL)
+    return;
+  gchar *expression=g_key_file_get_string(kf, group, "chunk_checksum_expression", NULL);
+  if (expression == NULL)
+    return;
+  gsize num_keys=0, len=0, i, j;
+  gchar **keys=g_key_file_get_keys(kf, group, &num_keys, NULL);
+  g_mutex_lock(chunk_checksum_mutex);
+  dbt->chunk_checksum_expression=expression;
+  for (i=0; i < num_keys; i++){
+    if (!g_str_has_prefix(keys[i], "chunk_checksum_") || !g_strcmp0(keys[i], "chunk_checksum_expression"))
+      continue;
+    gchar **values=g_key_file_get_string_list(kf, group, keys[i], &len, NULL);
+    if (values == NULL || len < 4){
+      g_warning("Ignoring %s of %s on metadata, it is not valid", keys[i], group);
+      g_strfreev(values);
+      continue;
+    }
+    struct chunk_checksum *cc=g_new0(struct chunk_checksum, 1);
+    cc->dbt=dbt;
+    cc->checksum=g_strdup(values[0]);
+    cc->rows=g_ascii_strtoull(values[1], NULL, 10);
+    cc->partition= strlen(values[2]) > 0 ? g_strdup(values[2]) : NULL;
+    cc->where=g_strdup(values[3]);
+    // with --stream the data files can be restored before the metadata arrives
+    for (j=4; j < len; j++){
+      struct chunk_checksum_file *ccf=get_chunk_checksum_file(values[j]);
+      if (!ccf->restored){
+        cc->pending_files++;
+        ccf->chunks=g_list_prepend(ccf->chunks, cc);
+      }
+    }
+    dbt->chunk_checksums=g_list_prepend(dbt->chunk_checksums, cc);
+    g_strfreev(values);
+  }
+  g_mutex_unlock(chunk_checksum_mutex);
+  g_strfreev(keys);
+}
+
+/* Each file_checksum_N of the metadata, from mydumper --file-checksums, is
+   file;crc32 of the content;crc32 of the file */
+void load_file_checksums(GKeyFile *kf, gchar *group){
+  if (checksum_mode == CHECKSUM_SKIP)
+    return;
+  gsize num_keys=0, len=0, i;
+  gchar **keys=g_key_file_get_keys(kf, group, &num_keys, NULL);
+  g_mutex_lock(chunk_checksum_mutex);
+  for (i=0; i < num_keys; i++){
+    if (!g_str_has_prefix(keys[i], "file_checksum_"))
+      continue;
+    gchar **values=g_key_file_get_string_list(kf, group, keys[i], &len, NULL);
+    if (values == NULL || len < 2 || strlen(values[1]) == 0){
+      g_warning("Ignoring %s of %s on metadata, it is not valid", keys[i], group);
+      g_strfreev(values);
+      continue;
+    }
+    g_hash_table_replace(file_checksums, g_strdup(values[0]), GUINT_TO_POINTER((guint)g_ascii_strtoull(values[1], NULL, 16)));
+    g_strfreev(values);
+  }
+  g_mutex_unlock(chunk_checksum_mutex);
+  g_strfreev(keys);
+}
+
+gboolean get_file_checksum(const gchar *filename, guint32 *checksum){
+  gpointer value=NULL;
+  gchar *basename=g_path_get_basename(filename);
+  g_mutex_lock(chunk_checksum_mutex);
+  gboolean found=g_hash_table_lookup_extended(file_checksums, basename, NULL, &value);
+  g_mutex_unlock(chunk_checksum_mutex);
+  g_free(basename);
+  *checksum=GPOINTER_TO_UINT(value);
+  return found;
+}
+
+// checksum is the crc32 of what was read from the file
+gboolean verify_file_checksum(const gchar *filename, guint32 expected, guint32 checksum){
+  if (checksum == expected){
+    trace("File checksum confirmed for %s", filename);
+    return TRUE;
+  }
+  if (checksum_mode == CHECKSUM_WARN)
+    g_warning("File checksum mismatch found for %s: got %08x, expecting %08x", filename, checksum, expected);
+  else
+    g_critical("File checksum mismatch found for %s: got %08x, expecting %08x", filename, checksum, expected);
+  return FALSE;
+}
+
+/* Returns the chunks that had their last data file restored with filename */
+GList *chunk_checksums_ready(const gchar *filename){
+  if (checksum_mode == CHECKSUM_SKIP)
+    return NULL;
+  GList *ready=NULL;
+  gchar *basename=g_path_get_basename(filename);
+  g_mutex_lock(chunk_checksum_mutex);
+  struct chunk_checksum_file *ccf=get_chunk_checksum_file(basename);
+  ccf->restored=TRUE;
+  for (GList *l=ccf->chunks; l; l=l->next){
+    struct chunk_checksum *cc=l->data;
+    if (--cc->pending_files == 0)
+      ready=g_list_prepend(ready, cc);
+  }
+  g_list_free(ccf->chunks);
+  ccf->chunks=NULL;
+  g_mutex_unlock(chunk_checksum_mutex);
+  g_free(basename);
+  return ready;
+}
+
+static
+gboolean verify_chunk_checksum(struct chunk_checksum *cc, MYSQL *conn){
+  struct db_table *dbt=cc->dbt;
+  guint64 rows=0;
+  gchar *checksum=checksum_chunk(conn, dbt->database->target_database, dbt->source_table_name, dbt->chunk_checksum_expression, cc->partition, cc->where, &rows);
+  gboolean ok= checksum != NULL && rows == cc->rows && !g_ascii_strcasecmp(checksum, cc->checksum);
+  if (!ok){
+    if (checksum_mode == CHECKSUM_WARN)
+      g_warning("Data checksum mismatch found for %s.%s on chunk %s: got %s with %"G_GUINT64_FORMAT" rows, expecting %s with %"G_GUINT64_FORMAT" rows",
+                dbt->database->target_database, dbt->source_table_name, cc->where, checksum, rows, cc->checksum, cc->rows);
+    else
+      g_critical("Data checksum mismatch found for %s.%s on chunk %s: got %s with %"G_GUINT64_FORMAT" rows, expecting %s with %"G_GUINT64_FORMAT" rows",
+                dbt->database->target_database, dbt->source_table_name, cc->where, checksum, rows, cc->checksum, cc->rows);
+  }else
+    trace("Data checksum confirmed for %s.%s on chunk %s", dbt->database->target_database, dbt->source_table_name, cc->where);
+  g_free(checksum);
+  g_mutex_lock(chunk_checksum_mutex);
+  cc->verified=TRUE;
+  cc->ok=ok;
+  g_mutex_unlock(chunk_checksum_mutex);
+  return ok;
+}
+
+void verify_chunk_checksums(GList *ready, MYSQL *conn){
+  for (GList *l=ready; l; l=l->next)
+    verify_chunk_checksum(l->data, conn);
+  g_list_free(ready);
+}
+
+/* Chunks are verified as soon as their last file is restored, the ones that
+   were not, like those of empty files, are verified here */
+static
+gboolean checksum_dbt_chunks(struct db_table *dbt, MYSQL *conn){
+  gboolean checksum_ok=TRUE;
+  guint verified=0;
+  GList *pending=NULL;
+  g_mutex_lock(chunk_checksum_mutex);
+  for (GList *l=dbt->chunk_checksums; l; l=l->next){
+    struct chunk_checksum *cc=l->data;
+    if (cc->verified){
+      checksum_ok&=cc->ok;
+      verified++;
+    }else
+      pending=g_list_prepend(pending, cc);
+  }
+  g_mutex_unlock(chunk_checksum_mutex);
+  for (GList *l=pending; l; l=l->next)
+    checksum_ok&=verify_chunk_checksum(l->data, conn);
+  g_list_free(pending);
+  if (checksum_ok)
+    g_message("Data checksum confirmed for %s.%s on %u chunks, %u of them during the restore", dbt->database->target_database, dbt->source_table_name, g_list_length(dbt->chunk_checksums), verified);
+  return checksum_ok;
+}
+
 gboolean checksum_dbt(struct db_table *dbt,  MYSQL *conn)
 {
   gboolean checksum_ok=TRUE;
@@ -533,6 +757,8 @@ gboolean checksum_dbt(struct db_table *dbt,  MYSQL *conn)
     if (dbt->data_checksum!=NULL && !no_data)
       checksum_ok&=checksum_dbt_template(dbt, dbt->data_checksum, conn,
                             "Data checksum", checksum_table);
+    if (dbt->chunk_checksums!=NULL && !no_data)
+      checksum_ok&=checksum_dbt_chunks(dbt, conn);
   }
   return checksum_ok;
 }
@@ -542,6 +768,262 @@ gboolean has_exec_per_thread_extension(const gchar *filename){
 }
 
 
+// In-process decompression. gzip and zstd (when built WITH_ZSTD) files are
+// read through a FILE stream created with fopencookie(), so read_data() and
+// the rest of the readers don't need to know that the file is compressed.
+
+#define DECOMPRESS_IN_BUFFER_SIZE 131072
+
+struct decompressor{
+  gzFile gz;
+  // decompressed bytes that were returned
+  guint64 position;
+#ifdef WITH_ZSTD
+  ZSTD_DCtx *dctx;
+  FILE *in;
+  ZSTD_inBuffer input;
+  void *in_buffer;
+  // written by mydumper --seekable-zstd
+  GArray *frames;
+#endif
+};
+
+gboolean is_in_process_decompression_available(const gchar *filename){
+  if (has_exec_per_thread_extension(filename))
+    return FALSE;
+#ifdef WITH_ZSTD
+  if (g_str_has_suffix(filename, ZSTD_EXTENSION))
+    return TRUE;
+#endif
+  return g_str_has_suffix(filename, GZIP_EXTENSION);
+}
+
+#ifdef WITH_ZSTD
+static
+guint32 get_le32(const guchar *buf){
+  return (guint32)buf[0] | ((guint32)buf[1] << 8) | ((guint32)buf[2] << 16) | ((guint32)buf[3] << 24);
+}
+
+/* Reads the seek table at the end of a zstd file. Returns the compressed and
+   decompressed offset where each frame starts, and the total sizes as the last
+   element, or NULL if the file is not seekable */
+static
+GArray *read_seek_table(FILE *in){
+  guchar footer[SEEKABLE_FOOTER_SIZE], header[8];
+  GArray *frames=NULL;
+  guchar *entries=NULL;
+  if (fseeko(in, -SEEKABLE_FOOTER_SIZE, SEEK_END) || fread(footer, 1, SEEKABLE_FOOTER_SIZE, in) != SEEKABLE_FOOTER_SIZE
+      || get_le32(footer + 5) != SEEKABLE_MAGIC)
+    goto cleanup;
+  guint32 i, num_frames=get_le32(footer);
+  gsize entry_size= footer[4] & 0x80 ? 12 : 8;
+  gsize table_size=num_frames * entry_size;
+  off_t table_start=ftello(in) - SEEKABLE_FOOTER_SIZE - (off_t)table_size - 8;
+  if (num_frames == 0 || table_start < 0 || fseeko(in, table_start, SEEK_SET)
+      || fread(header, 1, 8, in) != 8 || get_le32(header) != SEEKABLE_SKIPPABLE_MAGIC
+      || get_le32(header + 4) != table_size + SEEKABLE_FOOTER_SIZE)
+    goto cleanup;
+  entries=g_malloc(table_size);
+  if (fread(entries, 1, table_size, in) != table_size)
+    goto cleanup;
+  guint64 offset[2]={0, 0};
+  frames=g_array_sized_new(FALSE, FALSE, sizeof(guint64) * 2, num_frames + 1);
+  for (i = 0; i < num_frames; i++){
+    g_array_append_val(frames, offset);
+    offset[0]+=get_le32(entries + i * entry_size);
+    offset[1]+=get_le32(entries + i * entry_size + 4);
+  }
+  g_array_append_val(frames, offset);
+cleanup:
+  g_free(entries);
+  if (fseeko(in, 0, SEEK_SET) && frames){
+    g_array_free(frames, TRUE);
+    frames=NULL;
+  }
+  return frames;
+}
+
+// Decompressed offsets of the frames of a seekable zstd file, and its size
+GArray *get_seekable_frame_offsets(const gchar *filename){
+  FILE *in=g_fopen(filename, "r");
+  if (!in)
+    return NULL;
+  GArray *frames=read_seek_table(in);
+  fclose(in);
+  if (!frames)
+    return NULL;
+  GArray *offsets=g_array_sized_new(FALSE, FALSE, sizeof(guint64), frames->len);
+  guint64 offset;
+  guint i;
+  for (i = 0; i < frames->len; i++){
+    offset=g_array_index(frames, guint64, 2 * i + 1);
+    g_array_append_val(offsets, offset);
+  }
+  g_array_free(frames, TRUE);
+  return offsets;
+}
+#else
+GArray *get_seekable_frame_offsets(const gchar *filename){
+  (void) filename;
+  return NULL;
+}
+#endif
+
+static
+ssize_t decompressor_read(void *cookie, char *buf, size_t size){
+  struct decompressor *d=cookie;
+  if (d->gz){
+    int r=gzread(d->gz, buf, size);
+    if (r > 0)
+      d->position+=r;
+    return r;
+  }
+#ifdef WITH_ZSTD
+  ZSTD_outBuffer output = { buf, size, 0 };
+  while (output.pos == 0){
+    if (d->input.pos == d->input.size){
+      d->input.size=fread(d->in_buffer, 1, DECOMPRESS_IN_BUFFER_SIZE, d->in);
+      d->input.pos=0;
+      if (d->input.size == 0)
+        return ferror(d->in) ? -1 : 0;
+    }
+    size_t r=ZSTD_decompressStream(d->dctx, &output, &(d->input));
+    if (ZSTD_isError(r)){
+      g_critical("Error decompressing zstd stream: %s", ZSTD_getErrorName(r));
+      return -1;
+    }
+  }
+  d->position+=output.pos;
+  return output.pos;
+#else
+  return -1;
+#endif
+}
+
+/* A seekable zstd file starts decompressing on the frame of the offset, the
+   bytes of the frame that are before it are discarded */
+static
+int decompressor_seek(void *cookie, off64_t *offset, int whence){
+  struct decompressor *d=cookie;
+  guint64 target;
+  if (whence == SEEK_SET)
+    target=*offset;
+  else if (whence == SEEK_CUR)
+    target=d->position + *offset;
+  else
+    return -1;
+  if (target == d->position){
+    *offset=d->position;
+    return 0;
+  }
+#ifdef WITH_ZSTD
+  if (d->frames == NULL)
+    return -1;
+  guint low=0, high=d->frames->len - 1, mid;
+  if (target > g_array_index(d->frames, guint64, 2 * high + 1))
+    return -1;
+  // last frame that starts before the target
+  while (high - low > 1){
+    mid=(low + high) / 2;
+    if (g_array_index(d->frames, guint64, 2 * mid + 1) <= target)
+      low=mid;
+    else
+      high=mid;
+  }
+  if (fseeko(d->in, g_array_index(d->frames, guint64, 2 * low), SEEK_SET))
+    return -1;
+  ZSTD_DCtx_reset(d->dctx, ZSTD_reset_session_only);
+  d->input.size=0;
+  d->input.pos=0;
+  d->position=g_array_index(d->frames, guint64, 2 * low + 1);
+  if (d->position < target){
+    gchar *scratch=g_malloc(DECOMPRESS_IN_BUFFER_SIZE);
+    ssize_t r=0;
+    while (d->position < target){
+      r=decompressor_read(d, scratch, target - d->position < DECOMPRESS_IN_BUFFER_SIZE ? target - d->position : DECOMPRESS_IN_BUFFER_SIZE);
+      if (r <= 0)
+        break;
+    }
+    g_free(scratch);
+    if (r <= 0)
+      return -1;
+  }
+  *offset=d->position;
+  return 0;
+#else
+  return -1;
+#endif
+}
+
+static
+int decompressor_close(void *cookie){
+  struct decompressor *d=cookie;
+  int r=0;
+  if (d->gz)
+    r=gzclose(d->gz) == Z_OK ? 0 : EOF;
+#ifdef WITH_ZSTD
+  else{
+    release_read_pages(d->in);
+    r=fclose(d->in);
+    ZSTD_freeDCtx(d->dctx);
+    g_free(d->in_buffer);
+    if (d->frames)
+      g_array_free(d->frames, TRUE);
+  }
+#endif
+  g_free(d);
+  return r;
+}
+
+/* With --io-mode fadvise the files are read ahead and their pages are
+   released once they are closed, as they are read only once */
+void advise_sequential_read(FILE *file){
+  if (io_mode_fadvise && file && fileno(file) >= 0)
+    posix_fadvise(fileno(file), 0, 0, POSIX_FADV_SEQUENTIAL);
+}
+
+void release_read_pages(FILE *file){
+  if (io_mode_fadvise && file && fileno(file) >= 0)
+    posix_fadvise(fileno(file), 0, 0, POSIX_FADV_DONTNEED);
+}
+
+FILE * open_decompressed_file(const gchar *filename){
+  struct decompressor *d=g_new0(struct decompressor, 1);
+  if (g_str_has_suffix(filename, GZIP_EXTENSION)){
+    d->gz=gzopen(filename, "rb");
+    if (!d->gz){
+      g_free(d);
+      return NULL;
+    }
+    gzbuffer(d->gz, DECOMPRESS_IN_BUFFER_SIZE);
+#ifdef WITH_ZSTD
+  }else{
+    d->in=stream_memory_fopen(filename);
+    if (!d->in)
+      d->in=bundle_fopen(filename);
+    if (!d->in){
+      d->in=g_fopen(filename, "r");
+      advise_sequential_read(d->in);
+    }
+    if (!d->in){
+      g_free(d);
+      return NULL;
+    }
+    d->dctx=ZSTD_createDCtx();
+    d->in_buffer=g_malloc(DECOMPRESS_IN_BUFFER_SIZE);
+    d->input.src=d->in_buffer;
+    d->input.size=0;
+    d->input.pos=0;
+    d->frames=read_seek_table(d->in);
+#endif
+  }
+  cookie_io_functions_t io_functions = { &decompressor_read, NULL, &decompressor_seek, &decompressor_close };
+  FILE *file=fopencookie(d, "r", io_functions);
+  if (!file)
+    decompressor_close(d);
+  return file;
+}
+
 int execute_file_per_thread( const gchar *sql_fn, gchar *sql_fn3, gchar **exec){
   int childpid=fork();
   if(!childpid){
@@ -571,7 +1053,7 @@ gboolean get_command_and_basename(gchar *filename, gchar ***command, gchar **bas
     goto avoid_command_check;
   }
 
-  if (!*command)
+  if (!*command && !is_in_process_decompression_available(filename))
     m_critical("We don't have a command for extension on file %s",filename);
 
 avoid_command_check:
@@ -592,7 +1074,9 @@ void initialize_thread_data(struct thread_data*td, struct configuration *conf, e
   td->thread_id=thread_id;
 //  td->connection_data.current_database=NULL;
   td->granted_connections=0;
+  td->released_connections=0;
   td->dbt=dbt;
+  td->staging_table=NULL;
 //  td->use_database=NULL;
 }
 
@@ -611,3 +1095,175 @@ char *show_warnings_if_possible(MYSQL *conn){
   }
   return g_string_free(_error, FALSE);
 }
+
+/* The snapshot has a manifest when it was taken with --content-store, the
+   files are not in the directory and they are read from their blobs */
+GList *load_content_store_manifest(){
+  gchar *path=g_build_filename(directory, CONTENT_STORE_MANIFEST, NULL), *content=NULL, *tab;
+  gboolean found=g_file_get_contents(path, &content, NULL, NULL);
+  g_free(path);
+  if (!found)
+    return NULL;
+  content_store_manifest=g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  gchar **lines=g_strsplit(content, "\n", -1);
+  g_free(content);
+  guint i;
+  for (i=0; lines[i]; i++){
+    tab=strchr(lines[i], '\t');
+    if (tab)
+      g_hash_table_insert(content_store_manifest, g_strndup(lines[i], tab - lines[i]), g_strdup(tab + 1));
+  }
+  g_strfreev(lines);
+  g_message("Using the manifest of the content store, %u files", g_hash_table_size(content_store_manifest));
+  return g_hash_table_get_keys(content_store_manifest);
+}
+
+// Returns the blob of path, NULL if it is not in the manifest
+gchar *resolve_content_store_path(const gchar *path){
+  if (content_store_manifest == NULL || g_file_test(path, G_FILE_TEST_EXISTS))
+    return NULL;
+  gchar *basename=g_path_get_basename(path);
+  const gchar *blob=g_hash_table_lookup(content_store_manifest, basename);
+  g_free(basename);
+  return blob ? g_build_filename(directory, blob, NULL) : NULL;
+}
+
+gchar *content_store_path(gchar *path){
+  gchar *blob=resolve_content_store_path(path);
+  if (blob == NULL)
+    return path;
+  g_free(path);
+  return blob;
+}
+
+/* metadata.files written by mydumper --file-manifest, with one
+   "type<TAB>database<TAB>table<TAB>part<TAB>sub_part<TAB>size<TAB>rows<TAB>filename"
+   line per file */
+struct file_manifest_entry {
+  enum file_type file_type;
+  gboolean has_type;
+  guint64 size;
+  guint64 rows;
+};
+
+static GHashTable *file_manifest=NULL;
+// only with --dump-in-progress, the manifest grows while the files are processed
+static GMutex *file_manifest_mutex=NULL;
+
+static const struct {
+  const gchar *name;
+  enum file_type file_type;
+} file_manifest_types[]={
+  {"schema-create", SCHEMA_CREATE}, {"schema", SCHEMA_TABLE}, {"schema-view", SCHEMA_VIEW},
+  {"schema-sequence", SCHEMA_SEQUENCE}, {"schema-triggers", SCHEMA_TRIGGER}, {"schema-post", SCHEMA_POST},
+  {"data", DATA}, {"data-index", DATA_INDEX}, {"load-data", LOAD_DATA}, {"binary-data", BINARY_DATA},
+  {"tablespace", TABLESPACE_DATA}, {"tablespace-cfg", TABLESPACE_CFG}, {"binlog-delta", BINLOG_DELTA}};
+
+// Returns the filename of the line, NULL if it is not an entry
+static
+gchar *add_file_manifest_line(const gchar *line){
+  gchar **fields=g_strsplit(line, "\t", 8), *filename=NULL;
+  guint t;
+  if (g_strv_length(fields) == 8){
+    struct file_manifest_entry *fme=g_new0(struct file_manifest_entry, 1);
+    for (t=0; t < array_elements(file_manifest_types); t++)
+      if (!strcmp(fields[0], file_manifest_types[t].name)){
+        fme->file_type=file_manifest_types[t].file_type;
+        fme->has_type=TRUE;
+        break;
+      }
+    fme->size=g_ascii_strtoull(fields[5], NULL, 10);
+    fme->rows=g_ascii_strtoull(fields[6], NULL, 10);
+    filename=g_strdup(fields[7]);
+    if (file_manifest_mutex)
+      g_mutex_lock(file_manifest_mutex);
+    g_hash_table_insert(file_manifest, g_strdup(fields[7]), fme);
+    if (file_manifest_mutex)
+      g_mutex_unlock(file_manifest_mutex);
+  }
+  g_strfreev(fields);
+  return filename;
+}
+
+GList *load_file_manifest(){
+  gchar *path=g_build_filename(directory, FILE_MANIFEST, NULL), *content=NULL, *filename;
+  gboolean found=g_file_get_contents(path, &content, NULL, NULL);
+  g_free(path);
+  if (!found)
+    return NULL;
+  file_manifest=g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  GList *filenames=NULL;
+  gchar **lines=g_strsplit(content, "\n", -1);
+  g_free(content);
+  guint i;
+  for (i=0; lines[i]; i++)
+    if ((filename=add_file_manifest_line(lines[i])))
+      filenames=g_list_prepend(filenames, filename);
+  g_strfreev(lines);
+  g_message("Using %s, %u files", FILE_MANIFEST, g_hash_table_size(file_manifest));
+  return g_list_reverse(filenames);
+}
+
+/* mydumper adds a line once the file is complete on disk. Returns the files
+   of the complete lines after *offset, which is moved past them */
+GList *follow_file_manifest(goffset *offset){
+  gchar *path=g_build_filename(directory, FILE_MANIFEST, NULL), *filename;
+  FILE *file=g_fopen(path, "r");
+  g_free(path);
+  if (!file)
+    return NULL;
+  if (file_manifest == NULL){
+    file_manifest=g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    file_manifest_mutex=g_mutex_new();
+  }
+  GList *filenames=NULL;
+  gchar *line=NULL;
+  size_t line_size=0;
+  ssize_t n;
+  if (fseeko(file, (off_t)*offset, SEEK_SET) == 0)
+    while ((n=getline(&line, &line_size, file)) > 0 && line[n - 1] == '\n'){
+      line[n - 1]='\0';
+      *offset+=n;
+      if ((filename=add_file_manifest_line(line)))
+        filenames=g_list_prepend(filenames, filename);
+    }
+  free(line);
+  fclose(file);
+  return g_list_reverse(filenames);
+}
+
+gboolean file_manifest_loaded(){
+  return file_manifest != NULL;
+}
+
+static
+struct file_manifest_entry *file_manifest_lookup(const gchar *filename){
+  if (file_manifest == NULL)
+    return NULL;
+  if (file_manifest_mutex)
+    g_mutex_lock(file_manifest_mutex);
+  struct file_manifest_entry *fme=g_hash_table_lookup(file_manifest, filename);
+  if (file_manifest_mutex)
+    g_mutex_unlock(file_manifest_mutex);
+  return fme;
+}
+
+gboolean file_manifest_has(const gchar *filename){
+  return file_manifest_lookup(filename) != NULL;
+}
+
+gboolean file_manifest_file_type(const gchar *filename, enum file_type *file_type){
+  struct file_manifest_entry *fme=file_manifest_lookup(filename);
+  if (fme == NULL || !fme->has_type)
+    return FALSE;
+  *file_type=fme->file_type;
+  return TRUE;
+}
+
+gboolean file_manifest_size(const gchar *filename, guint64 *size){
+  struct file_manifest_entry *fme=file_manifest_lookup(filename);
+  if (fme == NULL)
+    return FALSE;
+  *size=fme->size;
+  return TRUE;
+}
@@ -27,13 +27,25 @@ void finish_alter_table(GString * alter_table_statement);
 void initialize_common();
 void refresh_table_list(struct configuration *conf);
 void refresh_table_list_without_table_hash_lock(struct configuration *conf, gboolean force);
+void append_table_list(struct configuration *conf, struct db_table *dbt);
 void checksum_databases(struct thread_data *td);
 void checksum_table_filename(const gchar *filename, MYSQL *conn);
 //int execute_file_per_thread( const gchar *sql_fn, gchar *sql_fn3);
 int execute_file_per_thread( const gchar *sql_fn, gchar *sql_fn3, gchar **exec);
+gboolean is_in_process_decompression_available(const gchar *filename);
+FILE * open_decompressed_file(const gchar *filename);
+void advise_sequential_read(FILE *file);
+void release_read_pages(FILE *file);
+GArray *get_seekable_frame_offsets(const gchar *filename);
 gboolean has_compession_extension(const gchar *filename);
 gboolean has_exec_per_thread_extension(const gchar *filename);
 gboolean checksum_dbt(struct db_table *dbt,  MYSQL *conn) ;
+void load_chunk_checksums(GKeyFile *kf, gchar *group, struct db_table *dbt);
+GList *chunk_checksums_ready(const gchar *filename);
+void load_file_checksums(GKeyFile *kf, gchar *group);
+gboolean get_file_checksum(const gchar *filename, guint32 *checksum);
+gboolean verify_file_checksum(const gchar *filename, guint32 expected, guint32 checksum);
+void verify_chunk_checksums(GList *ready, MYSQL *conn);
 gboolean checksum_database_template(gchar *_db, gchar *dbt_checksum,  MYSQL *conn,
                                 const gchar *message, gchar* fun());
 gchar *get_value(GKeyFile * kf,gchar *group, const gchar *key);
@@ -44,4 +56,15 @@ void initialize_thread_data(struct thread_data*td, struct configuration *conf, e
 gboolean is_in_ignore_set_list(gchar *haystack);
 void remove_ignore_set_session_from_hash();
 void execute_replication_commands(MYSQL *conn, gchar *statement);
+#define CONTENT_STORE_MANIFEST "manifest"
+GList *load_content_store_manifest();
+gchar *resolve_content_store_path(const gchar *path);
+gchar *content_store_path(gchar *path);
+#define FILE_MANIFEST "metadata.files"
+GList *load_file_manifest();
+GList *follow_file_manifest(goffset *offset);
+gboolean file_manifest_loaded();
+gboolean file_manifest_has(const gchar *filename);
+gboolean file_manifest_file_type(const gchar *filename, enum file_type *file_type);
+gboolean file_manifest_size(const gchar *filename, guint64 *size);
 #endif
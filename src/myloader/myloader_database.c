@@ -16,12 +16,14 @@
 */
 
 #include <glib.h>
+#include <string.h>
 
 #include "myloader_common.h"
 #include "myloader_global.h"
 #include "myloader_database.h"
 #include "myloader_restore_job.h"
 #include "myloader_restore.h"
+#include "myloader_fan_out.h"
 
 GHashTable *database_hash=NULL;
 static GMutex *database_hash_mutex = NULL;
@@ -46,7 +48,6 @@ struct database * new_database(gchar *database, gchar *filename){
   _database->database_name_in_filename = filename;
   _database->mutex=g_mutex_new();
   _database->sequence_queue= g_async_queue_new();
-  _database->table_queue=g_async_queue_new();
   _database->schema_state=target_db?CREATED:NOT_FOUND;
   _database->schema_checksum=NULL;
   _database->post_checksum=NULL;
@@ -77,11 +78,12 @@ struct database * get_database(gchar *filename, gchar *name){
 gboolean execute_use(struct connection_data *cd){
   if (cd->current_database){
     gchar *query = g_strdup_printf("USE `%s`", cd->current_database->target_database);
-    if (m_query_warning(cd->thrconn, query, "Thread %d: Error switching to database `%s`", cd->thread_id, cd->current_database->target_database)) {
-      g_free(query);
-      return TRUE;
-    }
+    fan_out_query(cd, query, strlen(query));
+    gboolean failed=m_query_warning(cd->thrconn, query, "Thread %d: Error switching to database `%s`", cd->thread_id, cd->current_database->target_database);
+    fan_out_sync(cd);
     g_free(query);
+    if (failed)
+      return TRUE;
   }else{
     g_warning("Thread %ld with connection %ld: Not able to switch database",cd->thread_id, cd->connection_id);
   }
@@ -103,8 +105,8 @@ void create_database(struct thread_data *td, gchar *database) {
 
   const gchar *filename =
       g_strdup_printf("%s-schema-create.sql%s", database, exec_per_thread_extension?exec_per_thread_extension:"");
-  const gchar *filepath = g_strdup_printf("%s/%s",
-                                            directory, filename);
+  const gchar *filepath = content_store_path(g_strdup_printf("%s/%s",
+                                            directory, filename));
 
   if (drop_database)
     execute_drop_database(td, database);
@@ -0,0 +1,129 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#include "myloader_common.h"
+#include "myloader_dependency.h"
+
+struct dependency_job {
+  void (*release)(gpointer);
+  gpointer data;
+  guint waiting;
+};
+
+static GMutex *dependency_mutex=NULL;
+// node -> GList of dependency_job waiting on it
+static GHashTable *dependency_waiters=NULL;
+static GHashTable *dependency_done_nodes=NULL;
+static GList *pending_dependency_jobs=NULL;
+
+void initialize_dependencies(){
+  dependency_mutex=g_mutex_new();
+  dependency_waiters=g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  dependency_done_nodes=g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+}
+
+gchar *database_dependency_node(const gchar *database){
+  return g_strdup_printf("database %s", database);
+}
+
+gchar *table_dependency_node(const gchar *database, const gchar *table){
+  return g_strdup_printf("table %s.%s", database, table);
+}
+
+static
+void wait_for_node(struct dependency_job *dj, gchar *node){
+  if (g_hash_table_contains(dependency_done_nodes, node)){
+    g_free(node);
+    return;
+  }
+  GList *waiters=g_hash_table_lookup(dependency_waiters, node);
+  if (g_list_find(waiters, dj)){
+    g_free(node);
+    return;
+  }
+  dj->waiting++;
+  g_hash_table_replace(dependency_waiters, node, g_list_prepend(waiters, dj));
+}
+
+void dependency_wait(GList *nodes, void (*release)(gpointer), gpointer data){
+  struct dependency_job *dj=g_new0(struct dependency_job, 1);
+  dj->release=release;
+  dj->data=data;
+  GList *l;
+  g_mutex_lock(dependency_mutex);
+  for (l=nodes; l; l=l->next)
+    wait_for_node(dj, l->data);
+  g_list_free(nodes);
+  if (dj->waiting > 0){
+    pending_dependency_jobs=g_list_prepend(pending_dependency_jobs, dj);
+    dj=NULL;
+  }
+  g_mutex_unlock(dependency_mutex);
+  if (dj){
+    dj->release(dj->data);
+    g_free(dj);
+  }
+}
+
+static
+void release_dependency_jobs(GList *ready){
+  GList *l;
+  for (l=ready; l; l=l->next){
+    struct dependency_job *dj=l->data;
+    dj->release(dj->data);
+    g_free(dj);
+  }
+  g_list_free(ready);
+}
+
+void dependency_done(gchar *node){
+  if (dependency_mutex == NULL){
+    g_free(node);
+    return;
+  }
+  GList *ready=NULL;
+  g_mutex_lock(dependency_mutex);
+  if (g_hash_table_contains(dependency_done_nodes, node)){
+    g_mutex_unlock(dependency_mutex);
+    g_free(node);
+    return;
+  }
+  trace("Dependency done: %s", node);
+  GList *waiters=g_hash_table_lookup(dependency_waiters, node), *l;
+  g_hash_table_remove(dependency_waiters, node);
+  for (l=waiters; l; l=l->next){
+    struct dependency_job *dj=l->data;
+    if (--dj->waiting == 0){
+      pending_dependency_jobs=g_list_remove(pending_dependency_jobs, dj);
+      ready=g_list_prepend(ready, dj);
+    }
+  }
+  g_list_free(waiters);
+  g_hash_table_add(dependency_done_nodes, node);
+  g_mutex_unlock(dependency_mutex);
+  // in the order they were waiting
+  release_dependency_jobs(ready);
+}
+
+void release_pending_dependencies(){
+  g_mutex_lock(dependency_mutex);
+  GList *ready=g_list_reverse(pending_dependency_jobs);
+  pending_dependency_jobs=NULL;
+  g_hash_table_remove_all(dependency_waiters);
+  g_mutex_unlock(dependency_mutex);
+  release_dependency_jobs(ready);
+}
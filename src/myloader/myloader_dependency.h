@@ -0,0 +1,38 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#ifndef _src_myloader_dependency_h
+#define _src_myloader_dependency_h
+
+#include <glib.h>
+
+/* Dependency graph of the restore. The nodes are the database created and
+   the table loaded; a job waits on a list of nodes and is released once all
+   of them are done:
+     database created -> CREATE TABLE of its tables
+     table loaded     -> constraints of the table and of the tables that
+                         reference it */
+void initialize_dependencies();
+gchar *database_dependency_node(const gchar *database);
+gchar *table_dependency_node(const gchar *database, const gchar *table);
+/* Takes the node names. release(data) is called once, without the lock, when
+   the last node is done, or right away if all of them already are */
+void dependency_wait(GList *nodes, void (*release)(gpointer), gpointer data);
+void dependency_done(gchar *node);
+/* Nodes that are not in the backup are never done */
+void release_pending_dependencies();
+#endif
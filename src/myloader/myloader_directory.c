@@ -26,8 +26,13 @@
 #include "myloader_process.h"
 #include "myloader_common.h"
 #include "myloader_global.h"
+#include "myloader_bundle.h"
 
+#define DUMP_IN_PROGRESS_POLL 1
+
+gboolean dump_in_progress=FALSE;
 GAsyncQueue *metadata_sync_queue=NULL;
+static gint metadata_lock_released=0;
 
 void initialize_directory(){
   metadata_sync_queue=g_async_queue_new();
@@ -38,14 +43,61 @@ void wait_directory_to_process_metadata(){
   g_async_queue_unref(metadata_sync_queue);
 }
 
+// With --dump-in-progress the metadata is processed twice
 void release_directory_metadata_lock(){
+  if (!g_atomic_int_compare_and_exchange(&metadata_lock_released, 0, 1))
+    return;
   g_async_queue_push(metadata_sync_queue,GINT_TO_POINTER(1));
   g_message("metadata pushed");
 }
 
+/* mydumper writes metadata.partial with [config] before the first file and
+   renames it to metadata at the end. The files are pushed as mydumper adds
+   them to metadata.files, so a table is created and loaded as soon as its
+   schema and data files are complete, and the final metadata adds the
+   checksums and row counts */
+static
+void process_dump_in_progress(struct configuration *conf){
+  goffset offset=0;
+  gboolean finished=FALSE, waiting_message=TRUE;
+  GList *files=NULL, *l;
+  while (!g_file_test("metadata", G_FILE_TEST_IS_REGULAR) && !g_file_test("metadata.partial", G_FILE_TEST_IS_REGULAR)){
+    if (waiting_message)
+      g_message("Waiting for mydumper to start the dump in %s", directory);
+    waiting_message=FALSE;
+    g_usleep(DUMP_IN_PROGRESS_POLL * G_USEC_PER_SEC);
+  }
+  finished=g_file_test("metadata", G_FILE_TEST_IS_REGULAR);
+  gboolean partial=!finished;
+  process_metadata_global_filename(g_strdup(partial ? "metadata.partial" : "metadata"), conf->context);
+  if (!g_file_test(FILE_MANIFEST, G_FILE_TEST_IS_REGULAR))
+    m_critical("%s was not found, --dump-in-progress needs a dump taken with --file-manifest", FILE_MANIFEST);
+  for (;;){
+    // the manifest is closed before the rename, the last read gets all files
+    if (!finished)
+      finished=g_file_test("metadata", G_FILE_TEST_IS_REGULAR);
+    files=follow_file_manifest(&offset);
+    for (l=files; l; l=l->next)
+      process_filename_push(l->data);
+    g_list_free_full(files, g_free);
+    if (finished)
+      break;
+    if (!g_file_test("metadata.partial", G_FILE_TEST_IS_REGULAR) && !g_file_test("metadata", G_FILE_TEST_IS_REGULAR))
+      m_critical("metadata.partial was removed before the dump finished");
+    g_usleep(DUMP_IN_PROGRESS_POLL * G_USEC_PER_SEC);
+  }
+  if (partial)
+    process_metadata_global_filename(g_strdup("metadata"), conf->context);
+  process_filename_queue_end();
+}
+
 void *process_directory(struct configuration *conf){
   GError *error = NULL;
   const gchar *filename = NULL;
+  if (dump_in_progress){
+    process_dump_in_progress(conf);
+    return NULL;
+  }
   /*
     set_db_schema_created() depends on sequences variable. It will not be
     updated until metadata is read. If DB schema is processed before metadata
@@ -56,6 +108,7 @@ void *process_directory(struct configuration *conf){
 //    release_directory_metadata_lock(); This has been moved to process_metadata_global_filename and triggered when [config] has been processed
   }else
     g_error("metadata file was not found");
+  GList *manifest=load_content_store_manifest(), *files=NULL, *bundled=load_bundle_index();
   if (resume){
     g_message("Using resume file");
     FILE *file = g_fopen("resume", "r");
@@ -77,13 +130,26 @@ void *process_directory(struct configuration *conf){
       g_string_set_size(data, 0);
     } 
     fclose(file);
+  }else if ((files=load_file_manifest())){
+    // the directory is not listed, the content store manifest only
+    // translates the names into blobs
+    for (GList *l=files; l; l=l->next)
+      process_filename_push(l->data);
+    g_list_free_full(files, g_free);
   }else{
+    for (GList *l=manifest; l; l=l->next)
+      process_filename_push(l->data);
+    for (GList *l=bundled; l; l=l->next)
+      process_filename_push(l->data);
     GDir *dir = g_dir_open(directory, 0, &error);
     while ((filename = g_dir_read_name(dir))){
-      if (strcmp(filename, "metadata"))
+      if (strcmp(filename, "metadata") && strcmp(filename, CONTENT_STORE_MANIFEST) && strcmp(filename, FILE_MANIFEST) &&
+          strcmp(filename, BUNDLE_INDEX) && !g_str_has_suffix(filename, BUNDLE_EXTENSION))
         process_filename_push(filename);
     }
   }
+  g_list_free(manifest);
+  g_list_free_full(bundled, g_free);
   process_filename_queue_end();
   return NULL;
 }
@@ -0,0 +1,223 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#include <mysql.h>
+#include <glib.h>
+#include <string.h>
+
+#include "myloader.h"
+#include "myloader_global.h"
+#include "myloader_common.h"
+#include "myloader_restore.h"
+#include "myloader_exchange_partition.h"
+
+gboolean exchange_partitions=FALSE;
+
+static GMutex *exchange_mutex=NULL;
+// basename of the data file -> its partition
+static GHashTable *partition_files=NULL;
+
+void initialize_exchange_partitions(){
+  if (!exchange_partitions)
+    return;
+  // the rows that are already in a partition would be dropped with the
+  // staging table
+  if (stream)
+    m_critical("--exchange-partitions can not be used with --stream, data files can be restored before the metadata");
+  if (resume || resume_journal)
+    m_critical("--exchange-partitions can not be used with --resume or --resume-journal");
+  if (no_schemas)
+    m_critical("--exchange-partitions needs the tables created by myloader");
+  exchange_mutex=g_mutex_new();
+  partition_files=g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+}
+
+// partition_files_N = partition;files...
+void load_partition_files(GKeyFile *kf, gchar *group, struct db_table *dbt){
+  if (partition_files == NULL || dbt->exchange_partitions != NULL)
+    return;
+  gsize num_keys=0, len=0, i, j;
+  gchar **keys=g_key_file_get_keys(kf, group, &num_keys, NULL);
+  g_mutex_lock(exchange_mutex);
+  for (i=0; i < num_keys; i++){
+    if (!g_str_has_prefix(keys[i], "partition_files_"))
+      continue;
+    gchar **values=g_key_file_get_string_list(kf, group, keys[i], &len, NULL);
+    if (values == NULL || len < 2){
+      g_warning("Ignoring %s of %s on metadata, it is not valid", keys[i], group);
+      g_strfreev(values);
+      continue;
+    }
+    struct exchange_partition *ep=g_new0(struct exchange_partition, 1);
+    ep->dbt=dbt;
+    ep->name=g_strdup(values[0]);
+    ep->mutex=g_mutex_new();
+    for (j=1; j < len; j++){
+      g_hash_table_insert(partition_files, g_strdup(values[j]), ep);
+      ep->pending_files++;
+    }
+    dbt->exchange_partitions=g_list_prepend(dbt->exchange_partitions, ep);
+    g_strfreev(values);
+  }
+  g_mutex_unlock(exchange_mutex);
+  g_strfreev(keys);
+}
+
+struct exchange_partition *get_exchange_partition(const gchar *filename){
+  if (partition_files == NULL)
+    return NULL;
+  gchar *basename=g_path_get_basename(filename);
+  g_mutex_lock(exchange_mutex);
+  struct exchange_partition *ep=g_hash_table_lookup(partition_files, basename);
+  g_mutex_unlock(exchange_mutex);
+  g_free(basename);
+  return ep;
+}
+
+static
+void append_table(GString *statement, const gchar *database, const gchar *table){
+  const char q=identifier_quote_character;
+  g_string_append_printf(statement, "%c%s%c.%c%s%c", q, database, q, q, table, q);
+}
+
+static
+gchar *build_staging_table_name(struct exchange_partition *ep){
+  gchar *name=g_strdup_printf("%s_xp_%s", ep->dbt->source_table_name, ep->name);
+  if (strlen(name) > 64){
+    g_free(name);
+    name=g_strdup_printf("myloader_xp_%08x", g_str_hash(ep->dbt->source_table_name) ^ g_str_hash(ep->name));
+  }
+  return name;
+}
+
+/* The first data file of the partition creates the staging table from the
+   one that was created by myloader, with the indexes that were not deferred.
+   If it fails, the partition is restored into the table */
+gboolean prepare_exchange_partition(struct thread_data *td, struct exchange_partition *ep){
+  g_mutex_lock(ep->mutex);
+  if (!ep->created && !ep->failed){
+    struct db_table *dbt=ep->dbt;
+    ep->staging_table=build_staging_table_name(ep);
+    GString *statement=g_string_new("DROP TABLE IF EXISTS ");
+    append_table(statement, dbt->database->target_database, ep->staging_table);
+    g_string_append(statement, ";\nCREATE TABLE ");
+    append_table(statement, dbt->database->target_database, ep->staging_table);
+    g_string_append(statement, " LIKE ");
+    append_table(statement, dbt->database->target_database, dbt->source_table_name);
+    g_string_append(statement, ";\nALTER TABLE ");
+    append_table(statement, dbt->database->target_database, ep->staging_table);
+    g_string_append(statement, " REMOVE PARTITIONING;\n");
+    if (restore_data_in_gstring(td, statement, TRUE, dbt->database)){
+      g_warning("Staging table of partition %s of %s.%s could not be created, the partition is restored into the table",
+                ep->name, dbt->database->target_database, dbt->source_table_name);
+      ep->failed=TRUE;
+    }else{
+      trace("Partition %s of %s.%s is restored into %s", ep->name, dbt->database->target_database, dbt->source_table_name, ep->staging_table);
+      ep->created=TRUE;
+    }
+    g_string_free(statement, TRUE);
+  }
+  g_mutex_unlock(ep->mutex);
+  return ep->created;
+}
+
+/* The deferred indexes are built on the staging table, in parallel with the
+   rest of the data, so EXCHANGE PARTITION finds the same structure */
+void exchange_partition_file_done(struct thread_data *td, struct exchange_partition *ep){
+  struct db_table *dbt=ep->dbt;
+  if (!g_atomic_int_dec_and_test(&(ep->pending_files)) || !ep->created || dbt->indexes == NULL)
+    return;
+  gchar *from=g_strdup_printf("ALTER TABLE `%s` ", dbt->source_table_name);
+  gchar *to=g_strdup_printf("ALTER TABLE `%s` ", ep->staging_table);
+  gchar **parts=g_strsplit(dbt->indexes->str, from, -1);
+  GString *statement=g_string_new(NULL);
+  g_string_append(statement, parts[0]);
+  guint i;
+  for (i=1; parts[i]; i++){
+    g_string_append(statement, to);
+    g_string_append(statement, parts[i]);
+  }
+  message("Thread %d: restoring indexes of partition %s of %s.%s on %s", td->thread_id, ep->name, dbt->database->target_database, dbt->source_table_name, ep->staging_table);
+  if (restore_data_in_gstring(td, statement, FALSE, dbt->database))
+    g_warning("Indexes of partition %s of %s.%s could not be created on %s", ep->name, dbt->database->target_database, dbt->source_table_name, ep->staging_table);
+  g_strfreev(parts);
+  g_free(from);
+  g_free(to);
+  g_string_free(statement, TRUE);
+}
+
+// The INSERT, REPLACE or LOAD DATA statement is sent to the staging table
+void rename_statement_table(GString *statement, const gchar *table){
+  if (!g_str_has_prefix(statement->str, "INSERT") && !g_str_has_prefix(statement->str, "REPLACE") && !g_str_has_prefix(statement->str, "LOAD DATA"))
+    return;
+  gchar *from=g_strstr_len(statement->str, statement->len, " INTO ");
+  if (from == NULL)
+    return;
+  from+=strlen(" INTO ");
+  if (g_str_has_prefix(from, "TABLE "))
+    from+=strlen("TABLE ");
+  gchar q=*from, *to=from + 1;
+  if (q != '`' && q != '"')
+    return;
+  while (*to && !(*to == q && to[1] != q))
+    to+= *to == q ? 2 : 1;
+  if (*to != q)
+    return;
+  gsize pos=from - statement->str;
+  gchar *quoted=g_strdup_printf("%c%s%c", q, table, q);
+  g_string_erase(statement, pos, to + 1 - from);
+  g_string_insert(statement, pos, quoted);
+  g_free(quoted);
+}
+
+/* Runs on the index job, once the table has its indexes. The partitions of
+   the table are empty, the staging table is dropped after the swap */
+void exchange_table_partitions(struct thread_data *td, struct db_table *dbt){
+  const char q=identifier_quote_character;
+  gboolean without_validation= (get_product() == SERVER_TYPE_MYSQL || get_product() == SERVER_TYPE_PERCONA) &&
+      (get_major() > 5 || (get_major() == 5 && get_secondary() >= 7));
+  GString *statement=g_string_new(NULL);
+  for (GList *l=dbt->exchange_partitions; l; l=l->next){
+    struct exchange_partition *ep=l->data;
+    if (!ep->created)
+      continue;
+    if (g_atomic_int_get(&(ep->pending_files)) > 0){
+      g_critical("Partition %s of %s.%s is not exchanged, not all its files were restored. Its rows are on %s",
+                 ep->name, dbt->database->target_database, dbt->source_table_name, ep->staging_table);
+      errors++;
+      continue;
+    }
+    g_string_assign(statement, "ALTER TABLE ");
+    append_table(statement, dbt->database->target_database, dbt->source_table_name);
+    g_string_append_printf(statement, " EXCHANGE PARTITION %c%s%c WITH TABLE ", q, ep->name, q);
+    append_table(statement, dbt->database->target_database, ep->staging_table);
+    if (without_validation)
+      g_string_append(statement, " WITHOUT VALIDATION");
+    message("Thread %d: exchanging partition %s of %s.%s", td->thread_id, ep->name, dbt->database->target_database, dbt->source_table_name);
+    if (restore_data_in_gstring(td, statement, TRUE, dbt->database)){
+      g_critical("Partition %s of %s.%s could not be exchanged. Its rows are on %s",
+                 ep->name, dbt->database->target_database, dbt->source_table_name, ep->staging_table);
+      errors++;
+      continue;
+    }
+    g_string_assign(statement, "DROP TABLE ");
+    append_table(statement, dbt->database->target_database, ep->staging_table);
+    if (restore_data_in_gstring(td, statement, TRUE, dbt->database))
+      g_warning("Staging table %s of %s.%s could not be dropped", ep->staging_table, dbt->database->target_database, dbt->source_table_name);
+  }
+  g_string_free(statement, TRUE);
+}
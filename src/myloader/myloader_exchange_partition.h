@@ -0,0 +1,47 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#ifndef _src_myloader_exchange_partition_h
+#define _src_myloader_exchange_partition_h
+
+#include <glib.h>
+#include "myloader.h"
+
+/* With --exchange-partitions the data files of a partition, listed by
+   mydumper --split-partitions on partition_files_N of the metadata, are
+   restored into a staging table that is not partitioned. The last file of
+   the partition builds the secondary indexes of the staging table, and the
+   index job of the table swaps it in with EXCHANGE PARTITION */
+struct exchange_partition {
+  struct db_table *dbt;
+  gchar *name;
+  gchar *staging_table;
+  GMutex *mutex;
+  // data files of the partition that are not restored yet
+  gint pending_files;
+  gboolean created;
+  gboolean failed;
+};
+
+void initialize_exchange_partitions();
+void load_partition_files(GKeyFile *kf, gchar *group, struct db_table *dbt);
+struct exchange_partition *get_exchange_partition(const gchar *filename);
+gboolean prepare_exchange_partition(struct thread_data *td, struct exchange_partition *ep);
+void exchange_partition_file_done(struct thread_data *td, struct exchange_partition *ep);
+void rename_statement_table(GString *statement, const gchar *table);
+void exchange_table_partitions(struct thread_data *td, struct db_table *dbt);
+#endif
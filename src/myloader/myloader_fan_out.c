@@ -0,0 +1,259 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#include <mysql.h>
+#include <glib.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "myloader.h"
+#include "myloader_global.h"
+#include "myloader_restore.h"
+#include "myloader_fan_out.h"
+
+gchar *fan_out_hosts=NULL;
+guint fan_out_buffer=64;
+
+static struct fan_out_target *targets=NULL;
+static guint num_targets=0;
+
+struct fan_out_statement {
+  GString *query;
+  // a list of statements, as the SET header of a file
+  gboolean split;
+};
+static struct fan_out_statement end_fan_out={NULL, FALSE};
+static struct fan_out_statement end_of_file_fan_out={NULL, FALSE};
+
+void initialize_fan_out(){
+  if (!fan_out_hosts)
+    return;
+  if (fan_out_buffer == 0)
+    fan_out_buffer=1;
+  gchar **list=g_strsplit(fan_out_hosts, ",", 0);
+  guint i, n=g_strv_length(list);
+  targets=g_new0(struct fan_out_target, n);
+  for (i = 0; i < n; i++){
+    gchar *host=g_strstrip(list[i]);
+    if (*host == '\0')
+      continue;
+    gchar *colon=g_strrstr(host, ":");
+    struct fan_out_target *t=&(targets[num_targets++]);
+    if (colon){
+      *colon='\0';
+      t->port=strtoul(colon + 1, NULL, 10);
+    }
+    t->host=g_strdup(host);
+  }
+  g_strfreev(list);
+  if (num_targets > 0)
+    g_message("Restoring into %u more servers with a buffer of %u statements per connection", num_targets, fan_out_buffer);
+}
+
+gboolean fan_out_in_use(){
+  return num_targets > 0;
+}
+
+guint fan_out_target_count(){
+  return num_targets;
+}
+
+static
+void connect_fan_out_connection(struct fan_out_connection *foc){
+  foc->conn=mysql_init(NULL);
+  m_connect_to_host(foc->conn, foc->target->host, foc->target->port);
+  set_local_infile_handler(foc->conn, &(foc->shard_filter));
+  execute_gstring(foc->conn, set_session);
+}
+
+/* After a reconnection inside a transaction, the statements of the file
+   that were already sent are lost with it. The statement is not retried,
+   the file fails on this target */
+static
+gboolean execute_fan_out_query(struct fan_out_connection *foc, GString *query){
+  if (!mysql_real_query(foc->conn, query->str, query->len))
+    return FALSE;
+  if (g_list_find(ignore_errors_list, GINT_TO_POINTER(mysql_errno(foc->conn))))
+    return FALSE;
+  if (mysql_ping(foc->conn)){
+    g_warning("Fan-out target %s: connection lost, reconnecting", foc->target->host);
+    mysql_close(foc->conn);
+    connect_fan_out_connection(foc);
+    if (foc->use_statement)
+      m_query_warning(foc->conn, foc->use_statement, "Fan-out target %s: Error switching database", foc->target->host);
+    if (foc->in_transaction){
+      foc->failed_file=TRUE;
+      return TRUE;
+    }
+  }
+  return mysql_real_query(foc->conn, query->str, query->len) != 0;
+}
+
+static
+void *fan_out_thread(struct fan_out_connection *foc){
+  struct fan_out_statement *fos=NULL;
+  while ((fos=g_async_queue_pop(foc->queue)) != &end_fan_out){
+    if (fos == &end_of_file_fan_out){
+      foc->failed_file=FALSE;
+      foc->in_transaction=FALSE;
+    }else if (foc->failed_file){
+      // the rest of the failed file is skipped
+      __sync_fetch_and_add(&(foc->target->failed), 1);
+      __sync_fetch_and_add(&(foc->target->statements), 1);
+    }else if (fos->split){
+      execute_gstring(foc->conn, fos->query);
+    }else{
+      if (g_str_has_prefix(fos->query->str, "USE ")){
+        g_free(foc->use_statement);
+        foc->use_statement=g_strdup(fos->query->str);
+      }
+      if (execute_fan_out_query(foc, fos->query)){
+        if (foc->failed_file)
+          g_critical("Fan-out target %s: the connection was lost in a transaction, the file is not restored on it", foc->target->host);
+        else
+          g_critical("Fan-out target %s - ERROR %d: %s", foc->target->host, mysql_errno(foc->conn), mysql_error(foc->conn));
+        __sync_fetch_and_add(&(foc->target->failed), 1);
+        g_atomic_int_inc(&errors);
+      }else if (g_str_has_prefix(fos->query->str, "START TRANSACTION"))
+        foc->in_transaction=TRUE;
+      else if (!g_strcmp0(fos->query->str, "COMMIT"))
+        foc->in_transaction=FALSE;
+      __sync_fetch_and_add(&(foc->target->statements), 1);
+    }
+    if (fos != &end_of_file_fan_out){
+      g_string_free(fos->query, TRUE);
+      g_free(fos);
+    }
+    g_mutex_lock(foc->mutex);
+    foc->pending--;
+    g_cond_signal(foc->cond);
+    g_mutex_unlock(foc->mutex);
+  }
+  return NULL;
+}
+
+void fan_out_new_connection(struct connection_data *cd){
+  guint i;
+  cd->fan_out=NULL;
+  if (num_targets == 0)
+    return;
+  cd->fan_out=g_new0(struct fan_out_connection, num_targets);
+  for (i = 0; i < num_targets; i++){
+    struct fan_out_connection *foc=&(cd->fan_out[i]);
+    foc->target=&(targets[i]);
+    foc->shard_filter.shard=i + 1;
+    foc->shard_filter.load_data=&(cd->shard_load_data);
+    connect_fan_out_connection(foc);
+    foc->queue=g_async_queue_new();
+    foc->mutex=g_mutex_new();
+    foc->cond=g_cond_new();
+    foc->thread=m_thread_new("myloader_fan", (GThreadFunc)fan_out_thread, foc, "Fan-out thread could not be created");
+  }
+}
+
+static
+void wait_fan_out_buffer(struct fan_out_connection *foc){
+  g_mutex_lock(foc->mutex);
+  if (foc->pending >= fan_out_buffer){
+    gint64 start=g_get_monotonic_time();
+    while (foc->pending >= fan_out_buffer)
+      g_cond_wait(foc->cond, foc->mutex);
+    __sync_fetch_and_add(&(foc->target->wait_time), g_get_monotonic_time() - start);
+  }
+  foc->pending++;
+  g_mutex_unlock(foc->mutex);
+}
+
+static
+void push_fan_out_statement(struct fan_out_connection *foc, const gchar *query, gsize len, gboolean split){
+  wait_fan_out_buffer(foc);
+  struct fan_out_statement *fos=g_new(struct fan_out_statement, 1);
+  fos->query=g_string_new_len(query, len);
+  fos->split=split;
+  g_async_queue_push(foc->queue, fos);
+}
+
+void fan_out_query(struct connection_data *cd, const gchar *query, gsize len){
+  guint i;
+  if (cd->fan_out == NULL)
+    return;
+  for (i = 0; i < num_targets; i++)
+    push_fan_out_statement(&(cd->fan_out[i]), query, len, FALSE);
+}
+
+// Only to one of the servers, the rows of its shard
+void fan_out_query_to(struct connection_data *cd, guint target, const gchar *query, gsize len){
+  if (cd->fan_out == NULL || target >= num_targets)
+    return;
+  push_fan_out_statement(&(cd->fan_out[target]), query, len, FALSE);
+}
+
+void fan_out_gstring(struct connection_data *cd, GString *ss){
+  guint i;
+  if (cd->fan_out == NULL)
+    return;
+  for (i = 0; i < num_targets; i++)
+    push_fan_out_statement(&(cd->fan_out[i]), ss->str, ss->len, TRUE);
+}
+
+// The connection is released, a file that failed on a target ends here
+void fan_out_end_of_file(struct connection_data *cd){
+  guint i;
+  if (cd->fan_out == NULL)
+    return;
+  for (i = 0; i < num_targets; i++){
+    wait_fan_out_buffer(&(cd->fan_out[i]));
+    g_async_queue_push(cd->fan_out[i].queue, &end_of_file_fan_out);
+  }
+}
+
+// Waits until the twins executed everything that was sent to them
+void fan_out_sync(struct connection_data *cd){
+  guint i;
+  if (cd->fan_out == NULL)
+    return;
+  for (i = 0; i < num_targets; i++){
+    struct fan_out_connection *foc=&(cd->fan_out[i]);
+    g_mutex_lock(foc->mutex);
+    while (foc->pending > 0)
+      g_cond_wait(foc->cond, foc->mutex);
+    g_mutex_unlock(foc->mutex);
+  }
+}
+
+void fan_out_close(struct connection_data *cd){
+  guint i;
+  if (cd->fan_out == NULL)
+    return;
+  for (i = 0; i < num_targets; i++){
+    struct fan_out_connection *foc=&(cd->fan_out[i]);
+    g_async_queue_push(foc->queue, &end_fan_out);
+    g_thread_join(foc->thread);
+    mysql_close(foc->conn);
+    g_async_queue_unref(foc->queue);
+    g_free(foc->use_statement);
+  }
+  g_free(cd->fan_out);
+  cd->fan_out=NULL;
+}
+
+void fan_out_report(){
+  guint i;
+  for (i = 0; i < num_targets; i++)
+    g_message("Fan-out target %s: %"G_GUINT64_FORMAT" statements, %"G_GUINT64_FORMAT" failed, loader waited %.1f seconds for it",
+              targets[i].host, targets[i].statements, targets[i].failed, (gdouble)targets[i].wait_time / G_USEC_PER_SEC);
+}
@@ -0,0 +1,69 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#ifndef _src_myloader_fan_out_h
+#define _src_myloader_fan_out_h
+
+#include <mysql.h>
+#include <glib.h>
+#include "myloader.h"
+#include "myloader_shard.h"
+
+/* With --fan-out-hosts every connection of the pool has a twin on each of
+   the other targets. The statements sent to the connection are copied to the
+   twins, which execute them in the same order from their own thread. A twin
+   can be up to --fan-out-buffer statements behind, then the connection waits
+   until it catches up, so a slow target only holds back the others once its
+   buffer is full */
+struct fan_out_target {
+  gchar *host;
+  guint port;
+  guint64 statements;
+  guint64 failed;
+  // time the loader connections waited for this target
+  gint64 wait_time;
+};
+
+struct fan_out_connection {
+  struct fan_out_target *target;
+  MYSQL *conn;
+  GAsyncQueue *queue;
+  GMutex *mutex;
+  GCond *cond;
+  guint pending;
+  // replayed after a reconnection
+  gchar *use_statement;
+  gboolean in_transaction;
+  // the connection was lost in a transaction, the rest of the file is skipped
+  gboolean failed_file;
+  GThread *thread;
+  // --shard-column, the shard of a LOAD DATA that this server receives
+  struct shard_filter shard_filter;
+};
+
+void initialize_fan_out();
+gboolean fan_out_in_use();
+guint fan_out_target_count();
+void fan_out_new_connection(struct connection_data *cd);
+void fan_out_query(struct connection_data *cd, const gchar *query, gsize len);
+void fan_out_query_to(struct connection_data *cd, guint target, const gchar *query, gsize len);
+void fan_out_gstring(struct connection_data *cd, GString *ss);
+void fan_out_sync(struct connection_data *cd);
+void fan_out_end_of_file(struct connection_data *cd);
+void fan_out_close(struct connection_data *cd);
+void fan_out_report();
+#endif
@@ -0,0 +1,742 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+#include "myloader.h"
+#include "myloader_global.h"
+#include "myloader_common.h"
+#include "myloader_process.h"
+#include "myloader_restore.h"
+#include "myloader_table.h"
+#include "myloader_fan_out.h"
+#include "myloader_follow.h"
+
+gboolean follow_mode=FALSE;
+guint follow_interval=60;
+gboolean follow_drop_tables=FALSE;
+
+// output directory of mydumper --daemon
+static gchar *follow_root=NULL;
+// metadata of the snapshot that is in the database
+static GKeyFile *follow_metadata=NULL;
+static GAsyncQueue *follow_queue=NULL;
+// tables whose update failed, they are loaded again whole by the next snapshot
+static GHashTable *follow_reload=NULL;
+// jobs that failed on the current snapshot
+static GMutex *follow_failed_mutex=NULL;
+static GList *follow_failed=NULL;
+static guint reloaded_chunks=0;
+static guint reloaded_tables=0;
+static guint dropped_tables=0;
+
+struct follow_chunk{
+  gchar *partition;
+  // NULL when the whole table is loaded again
+  gchar *where;
+  GList *files;
+};
+
+/* All the chunks of a table are applied by the same thread, one after the
+   other, so their DELETE and INSERT ... SELECT never wait for each other */
+struct follow_job{
+  struct db_table *dbt;
+  gchar *group;
+  GList *chunks;
+  // the table is not in the new snapshot
+  gboolean drop;
+  // the table is new in the snapshot, it is created from this file
+  gchar *schema;
+};
+
+static
+gchar *get_snapshot_directory(){
+  gchar *link=g_build_filename(follow_root, "last_dump", NULL);
+  gchar *target=g_file_read_link(link, NULL);
+  g_free(link);
+  if (target == NULL)
+    return NULL;
+  gchar *snapshot= g_path_is_absolute(target) ? g_strdup(target) : g_build_filename(follow_root, target, NULL);
+  g_free(target);
+  return snapshot;
+}
+
+static
+GKeyFile *load_snapshot_metadata(const gchar *snapshot){
+  gchar *path=g_build_filename(snapshot, "metadata", NULL);
+  GKeyFile *kf=load_config_file(path);
+  g_free(path);
+  return kf;
+}
+
+gchar *initialize_follow(gchar *output_directory){
+  follow_root=output_directory;
+  gchar *snapshot=get_snapshot_directory();
+  if (snapshot == NULL)
+    m_critical("--follow needs the output directory of mydumper --daemon, %s/last_dump was not found", output_directory);
+  follow_metadata=load_snapshot_metadata(snapshot);
+  if (follow_metadata == NULL)
+    m_critical("Metadata of snapshot %s could not be read", snapshot);
+  follow_reload=g_hash_table_new(g_direct_hash, g_direct_equal);
+  follow_failed_mutex=g_mutex_new();
+  g_message("Following the snapshots of %s, starting from %s", output_directory, snapshot);
+  return snapshot;
+}
+
+/* The table of a [`db`.`table`] group of the metadata, NULL for the rest.
+   The group has the names used in the filenames, which are only the real
+   names when they do not need to be escaped, and a table renamed to
+   mydumper_N can get another number when mydumper is restarted. The table
+   is found by its real_table_name when the names do not match */
+static
+struct db_table *get_group_table(GKeyFile *kf, gchar *group){
+  if (!g_str_has_prefix(group, identifier_quote_character_str))
+    return NULL;
+  const char *delimiter= identifier_quote_character == BACKTICK ? "`.`" : "\".\"";
+  gchar **database_table=g_strsplit(group+1, delimiter, 2);
+  struct db_table *dbt=NULL;
+  if (database_table[1] != NULL){
+    database_table[1][strlen(database_table[1])-1]='\0';
+    dbt=get_table(database_table[0], database_table[1]);
+    gchar *value=g_key_file_get_value(kf, group, "real_table_name", NULL);
+    if (value){
+      gchar *real_table_name=newline_unprotect(value);
+      if (dbt == NULL || g_strcmp0(dbt->source_table_name, real_table_name))
+        dbt=get_table_by_source_name(database_table[0], real_table_name);
+      g_free(real_table_name);
+      g_free(value);
+    }
+    if (dbt == NULL && (!source_db || !g_strcmp0(database_table[0], source_db)))
+      g_warning("Table of group %s is not known, it is not updated", group);
+    else if (dbt != NULL && source_db && g_strcmp0(dbt->database->source_database, source_db))
+      dbt=NULL;
+  }
+  g_strfreev(database_table);
+  return dbt;
+}
+
+// Both snapshots have the key with the same value
+static
+gboolean same_value(GKeyFile *previous, GKeyFile *kf, const gchar *group, const gchar *key){
+  gchar *a=g_key_file_get_value(previous, group, key, NULL);
+  gchar *b=g_key_file_get_value(kf, group, key, NULL);
+  gboolean same= a && b && !g_strcmp0(a, b);
+  g_free(a);
+  g_free(b);
+  return same;
+}
+
+// Both snapshots have the key with a different value
+static
+gboolean different_value(GKeyFile *previous, GKeyFile *kf, const gchar *group, const gchar *key){
+  return g_key_file_has_key(previous, group, key, NULL) && g_key_file_has_key(kf, group, key, NULL) &&
+         !same_value(previous, kf, group, key);
+}
+
+// "partition;where" -> values of its chunk_checksum_N
+static
+GHashTable *get_group_chunks(GKeyFile *kf, const gchar *group){
+  gsize num_keys=0, len=0, i;
+  gchar **keys=g_key_file_get_keys(kf, group, &num_keys, NULL);
+  GHashTable *chunks=g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_strfreev);
+  for (i=0; i < num_keys; i++){
+    if (!g_str_has_prefix(keys[i], "chunk_checksum_") || !g_strcmp0(keys[i], "chunk_checksum_expression"))
+      continue;
+    gchar **values=g_key_file_get_string_list(kf, group, keys[i], &len, NULL);
+    if (values == NULL || len < 4){
+      g_strfreev(values);
+      continue;
+    }
+    g_hash_table_insert(chunks, g_strdup_printf("%s;%s", values[2], values[3]), values);
+  }
+  g_strfreev(keys);
+  return chunks;
+}
+
+// filename -> crc32 of its content, NULL without --file-checksums
+static
+GHashTable *get_group_files(GKeyFile *kf, const gchar *group){
+  gsize num_keys=0, len=0, i;
+  gchar **keys=g_key_file_get_keys(kf, group, &num_keys, NULL);
+  GHashTable *files=NULL;
+  for (i=0; i < num_keys; i++){
+    if (!g_str_has_prefix(keys[i], "file_checksum_"))
+      continue;
+    gchar **values=g_key_file_get_string_list(kf, group, keys[i], &len, NULL);
+    if (values != NULL && len >= 2){
+      if (files == NULL)
+        files=g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+      g_hash_table_insert(files, g_strdup(values[0]), g_strdup(values[1]));
+    }
+    g_strfreev(values);
+  }
+  g_strfreev(keys);
+  return files;
+}
+
+// Same keys, and the same values when values is TRUE
+static
+gboolean same_entries(GHashTable *a, GHashTable *b, gboolean values){
+  if (g_hash_table_size(a) != g_hash_table_size(b))
+    return FALSE;
+  GHashTableIter iter;
+  gpointer key, value;
+  g_hash_table_iter_init(&iter, a);
+  while (g_hash_table_iter_next(&iter, &key, &value)){
+    gpointer other=NULL;
+    if (!g_hash_table_lookup_extended(b, key, NULL, &other))
+      return FALSE;
+    if (values && g_strcmp0(value, other))
+      return FALSE;
+  }
+  return TRUE;
+}
+
+static
+struct follow_chunk *new_follow_chunk(const gchar *partition, const gchar *where, GList *files){
+  struct follow_chunk *fc=g_new0(struct follow_chunk, 1);
+  fc->partition= partition && strlen(partition) > 0 ? g_strdup(partition) : NULL;
+  fc->where=g_strdup(where);
+  fc->files=g_list_sort(files, (GCompareFunc)g_strcmp0);
+  return fc;
+}
+
+static
+void free_follow_chunk(struct follow_chunk *fc){
+  g_list_free_full(fc->files, g_free);
+  g_free(fc->partition);
+  g_free(fc->where);
+  g_free(fc);
+}
+
+static
+void free_follow_job(struct follow_job *fj){
+  g_list_free_full(fj->chunks, (GDestroyNotify)free_follow_chunk);
+  g_free(fj->group);
+  g_free(fj->schema);
+  g_free(fj);
+}
+
+static
+void push_follow_job(struct db_table *dbt, const gchar *group, GList *chunks, gboolean drop){
+  struct follow_job *fj=g_new0(struct follow_job, 1);
+  fj->dbt=dbt;
+  fj->group=g_strdup(group);
+  fj->chunks=chunks;
+  fj->drop=drop;
+  g_async_queue_push(follow_queue, fj);
+}
+
+static
+void push_table_drop(struct db_table *dbt, const gchar *group){
+  push_follow_job(dbt, group, NULL, TRUE);
+  dropped_tables++;
+}
+
+static
+struct follow_chunk *new_table_chunk(GList *table_files){
+  GList *files=NULL, *l;
+  for (l=table_files; l; l=l->next)
+    files=g_list_prepend(files, g_strdup(l->data));
+  return new_follow_chunk(NULL, NULL, files);
+}
+
+static
+void push_table_reload(struct db_table *dbt, const gchar *group, GList *table_files){
+  push_follow_job(dbt, group, g_list_prepend(NULL, new_table_chunk(table_files)), FALSE);
+  reloaded_tables++;
+}
+
+static
+void push_table_create(struct db_table *dbt, const gchar *group, const gchar *schema, GList *table_files){
+  struct follow_job *fj=g_new0(struct follow_job, 1);
+  fj->dbt=dbt;
+  fj->group=g_strdup(group);
+  fj->chunks=g_list_prepend(NULL, new_table_chunk(table_files));
+  fj->schema=g_strdup(schema);
+  g_async_queue_push(follow_queue, fj);
+  reloaded_tables++;
+}
+
+/* The changed chunks are deleted by their WHERE and loaded again when both
+   snapshots have the same chunks and they do not share files with the chunks
+   that did not change */
+static
+gboolean push_chunk_reloads(struct db_table *dbt, const gchar *group, GHashTable *previous_chunks, GHashTable *chunks, gboolean *changed){
+  GHashTable *unchanged_files=g_hash_table_new(g_str_hash, g_str_equal);
+  GList *changed_chunks=NULL, *l;
+  GHashTableIter iter;
+  gpointer key, value;
+  guint j;
+  g_hash_table_iter_init(&iter, chunks);
+  while (g_hash_table_iter_next(&iter, &key, &value)){
+    gchar **values=value, **previous_values=g_hash_table_lookup(previous_chunks, key);
+    if (g_strcmp0(values[0], previous_values[0]) || g_strcmp0(values[1], previous_values[1]))
+      changed_chunks=g_list_prepend(changed_chunks, values);
+    else
+      for (j=4; values[j]; j++)
+        g_hash_table_insert(unchanged_files, values[j], values[j]);
+  }
+  gboolean shared=FALSE;
+  for (l=changed_chunks; l && !shared; l=l->next)
+    for (j=4; ((gchar **)l->data)[j] && !shared; j++)
+      shared=g_hash_table_lookup(unchanged_files, ((gchar **)l->data)[j]) != NULL;
+  if (!shared && changed_chunks){
+    GList *follow_chunks=NULL;
+    for (l=changed_chunks; l; l=l->next){
+      gchar **values=l->data;
+      GList *files=NULL;
+      for (j=4; values[j]; j++)
+        files=g_list_prepend(files, g_strdup(values[j]));
+      follow_chunks=g_list_prepend(follow_chunks, new_follow_chunk(values[2], values[3], files));
+      reloaded_chunks++;
+    }
+    push_follow_job(dbt, group, follow_chunks, FALSE);
+  }
+  *changed= changed_chunks != NULL;
+  g_list_free(changed_chunks);
+  g_hash_table_destroy(unchanged_files);
+  return !shared;
+}
+
+/* Pushes the jobs that bring the table to the new snapshot, by chunk when it
+   is possible. Otherwise the table is loaded again when its files or its
+   checksum changed, or when its update failed on the previous snapshot.
+   A table that is new in the snapshot is created from its schema file and
+   loaded whole. Returns FALSE when the table did not change */
+static
+gboolean diff_table(struct db_table *dbt, GKeyFile *kf, gchar *group, GList *table_files, const gchar *schema){
+  if (!g_key_file_has_group(follow_metadata, group)){
+    if (schema == NULL){
+      g_warning("%s.%s is new in the snapshot and has no schema file, it needs a full restore", dbt->database->target_database, dbt->source_table_name);
+      return FALSE;
+    }
+    g_message("%s.%s is new in the snapshot, it is created and loaded", dbt->database->target_database, dbt->source_table_name);
+    push_table_create(dbt, group, schema, table_files);
+    return TRUE;
+  }
+  if (different_value(follow_metadata, kf, group, "schema_checksum")){
+    g_warning("Structure of %s.%s changed in the snapshot, it needs a full restore", dbt->database->target_database, dbt->source_table_name);
+    return FALSE;
+  }
+  if (g_hash_table_remove(follow_reload, dbt)){
+    g_message("%s.%s failed to update on the previous snapshot, it is loaded again", dbt->database->target_database, dbt->source_table_name);
+    push_table_reload(dbt, group, table_files);
+    return TRUE;
+  }
+  gboolean changed=FALSE;
+  if (same_value(follow_metadata, kf, group, "chunk_checksum_expression")){
+    GHashTable *previous_chunks=get_group_chunks(follow_metadata, group);
+    GHashTable *chunks=get_group_chunks(kf, group);
+    gboolean by_chunk= g_hash_table_size(chunks) > 0 && same_entries(chunks, previous_chunks, FALSE) &&
+                       push_chunk_reloads(dbt, group, previous_chunks, chunks, &changed);
+    g_hash_table_destroy(previous_chunks);
+    g_hash_table_destroy(chunks);
+    if (by_chunk)
+      return changed;
+  }
+  GHashTable *previous_files=get_group_files(follow_metadata, group);
+  GHashTable *files=get_group_files(kf, group);
+  if (previous_files && files)
+    changed=!same_entries(files, previous_files, TRUE);
+  else if (g_key_file_has_key(kf, group, "data_checksum", NULL))
+    changed=!same_value(follow_metadata, kf, group, "data_checksum");
+  else{
+    g_warning("%s.%s has no checksums in the snapshot, it is loaded again", dbt->database->target_database, dbt->source_table_name);
+    changed=TRUE;
+  }
+  if (previous_files)
+    g_hash_table_destroy(previous_files);
+  if (files)
+    g_hash_table_destroy(files);
+  if (changed)
+    push_table_reload(dbt, group, table_files);
+  return changed;
+}
+
+// Data files of each table of the snapshot, and its schema file in schemas.
+// The LOAD DATA files are released
+static
+GHashTable *get_snapshot_files(const gchar *snapshot, GHashTable *schemas){
+  GHashTable *files=g_hash_table_new(g_direct_hash, g_direct_equal);
+  GDir *dir=g_dir_open(snapshot, 0, NULL);
+  const gchar *filename=NULL;
+  while (dir && (filename=g_dir_read_name(dir))){
+    if (g_str_has_prefix(filename, "metadata"))
+      continue;
+    const gchar *schema=g_strstr_len(filename, -1, "-schema.sql");
+    if (schema){
+      gchar *name=g_strndup(filename, schema - filename);
+      gchar **split=g_strsplit(name, ".", 2);
+      struct db_table *dbt= g_strv_length(split) == 2 ? get_table(split[0], split[1]) : NULL;
+      if (dbt)
+        g_hash_table_insert(schemas, dbt, g_strdup(filename));
+      g_strfreev(split);
+      g_free(name);
+      continue;
+    }
+    if (g_strstr_len(filename, -1, "-schema"))
+      continue;
+    if (m_filename_has_suffix(filename, ".dat")){
+      release_load_data_as_it_is_close((gchar *)filename);
+      continue;
+    }
+    if (!m_filename_has_suffix(filename, ".sql") && !m_filename_has_suffix(filename, "." ROW_BINARY_EXTENSION))
+      continue;
+    gchar **split=g_strsplit(filename, ".", 3);
+    struct db_table *dbt= g_strv_length(split) == 3 ? get_table(split[0], split[1]) : NULL;
+    g_strfreev(split);
+    if (dbt)
+      g_hash_table_insert(files, dbt, g_list_prepend(g_hash_table_lookup(files, dbt), g_strdup(filename)));
+  }
+  if (dir)
+    g_dir_close(dir);
+  return files;
+}
+
+static
+void append_follow_table(GString *statement, struct db_table *dbt, const gchar *table){
+  const char q=identifier_quote_character;
+  char * (*protect)(char *r)= q == BACKTICK ? &backtick_protect : &double_quoute_protect;
+  gchar *database=protect(dbt->database->target_database);
+  gchar *name=protect((gchar *)table);
+  g_string_append_printf(statement, "%c%s%c.%c%s%c", q, database, q, q, name, q);
+  g_free(database);
+  g_free(name);
+}
+
+static
+gchar *build_follow_staging_name(struct db_table *dbt, guint thread_id){
+  gchar *name=g_strdup_printf("%s_follow_%u", dbt->source_table_name, thread_id);
+  if (strlen(name) > 64){
+    g_free(name);
+    name=g_strdup_printf("myloader_follow_%08x_%u", g_str_hash(dbt->source_table_name), thread_id);
+  }
+  return name;
+}
+
+// The columns that can be inserted, the generated ones are skipped
+static
+GString *get_insert_columns(struct connection_data *cd, struct db_table *dbt){
+  const char q=identifier_quote_character;
+  char * (*protect)(char *r)= q == BACKTICK ? &backtick_protect : &double_quoute_protect;
+  gchar *database=g_new(gchar, strlen(dbt->database->target_database) * 2 + 1);
+  gchar *table=g_new(gchar, strlen(dbt->source_table_name) * 2 + 1);
+  mysql_real_escape_string(cd->thrconn, database, dbt->database->target_database, strlen(dbt->database->target_database));
+  mysql_real_escape_string(cd->thrconn, table, dbt->source_table_name, strlen(dbt->source_table_name));
+  gchar *query=g_strdup_printf("SELECT COLUMN_NAME FROM information_schema.COLUMNS WHERE TABLE_SCHEMA='%s' AND TABLE_NAME='%s' AND EXTRA NOT LIKE '%%GENERATED%%' ORDER BY ORDINAL_POSITION",
+      database, table);
+  g_free(database);
+  g_free(table);
+  MYSQL_RES *result=m_store_result(cd->thrconn, query, m_warning, "Columns of %s.%s could not be read", dbt->database->target_database, dbt->source_table_name);
+  g_free(query);
+  if (!result)
+    return NULL;
+  GString *columns=g_string_new(NULL);
+  MYSQL_ROW row;
+  while ((row=mysql_fetch_row(result))){
+    gchar *column=protect(row[0]);
+    g_string_append_printf(columns, "%s%c%s%c", columns->len ? "," : "", q, column, q);
+    g_free(column);
+  }
+  mysql_free_result(result);
+  if (columns->len == 0){
+    g_string_free(columns, TRUE);
+    return NULL;
+  }
+  return columns;
+}
+
+static
+gboolean follow_query(struct connection_data *cd, GString *statement){
+  fan_out_query(cd, statement->str, statement->len);
+  if (mysql_real_query(cd->thrconn, statement->str, statement->len)){
+    g_critical("Connection %ld - ERROR %d: %s\n%s", cd->connection_id, mysql_errno(cd->thrconn), mysql_error(cd->thrconn), statement->str);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/* The rows of the staging table replace the rows of the table, or of the
+   chunk, in one transaction, so the table is never seen half loaded */
+static
+gboolean swap_follow_rows(struct db_table *dbt, struct follow_chunk *fc, const gchar *staging){
+  const char q=identifier_quote_character;
+  char * (*protect)(char *r)= q == BACKTICK ? &backtick_protect : &double_quoute_protect;
+  struct connection_data *cd=m_async_queue_pop(connection_pool);
+  GString *columns=get_insert_columns(cd, dbt);
+  gboolean ok=FALSE;
+  if (columns){
+    GString *statement=g_string_new("START TRANSACTION");
+    ok=follow_query(cd, statement);
+    g_string_assign(statement, "DELETE FROM ");
+    append_follow_table(statement, dbt, dbt->source_table_name);
+    if (fc->partition){
+      gchar *partition=protect(fc->partition);
+      g_string_append_printf(statement, " PARTITION (%c%s%c)", q, partition, q);
+      g_free(partition);
+    }
+    if (fc->where && strlen(fc->where) > 0)
+      g_string_append_printf(statement, " WHERE %s", fc->where);
+    ok= ok && follow_query(cd, statement);
+    g_string_assign(statement, "INSERT INTO ");
+    append_follow_table(statement, dbt, dbt->source_table_name);
+    g_string_append_printf(statement, " (%s) SELECT %s FROM ", columns->str, columns->str);
+    append_follow_table(statement, dbt, staging);
+    ok= ok && follow_query(cd, statement);
+    g_string_assign(statement, ok ? "COMMIT" : "ROLLBACK");
+    ok= follow_query(cd, statement) && ok;
+    fan_out_sync(cd);
+    g_string_free(statement, TRUE);
+    g_string_free(columns, TRUE);
+  }
+  g_async_queue_push(connection_pool, cd);
+  return ok;
+}
+
+static
+int apply_follow_chunk(struct thread_data *td, struct db_table *dbt, struct follow_chunk *fc){
+  GString *statement=g_string_new(NULL);
+  int r=0;
+  // the files are loaded into a copy of the table, the table is untouched
+  // until they are all loaded
+  gchar *staging=build_follow_staging_name(dbt, td->thread_id);
+  g_string_assign(statement, "DROP TABLE IF EXISTS ");
+  append_follow_table(statement, dbt, staging);
+  g_string_append(statement, ";\nCREATE TABLE ");
+  append_follow_table(statement, dbt, staging);
+  g_string_append(statement, " LIKE ");
+  append_follow_table(statement, dbt, dbt->source_table_name);
+  if (restore_data_in_gstring(td, statement, TRUE, dbt->database)){
+    g_critical("Thread %d: staging table of %s.%s could not be created, it is not updated", td->thread_id, dbt->database->target_database, dbt->source_table_name);
+    errors++;
+    g_string_free(statement, TRUE);
+    g_free(staging);
+    return 1;
+  }
+  td->staging_table=staging;
+  GList *l;
+  for (l=fc->files; l; l=l->next){
+    if (m_filename_has_suffix(l->data, "." ROW_BINARY_EXTENSION))
+      r|=restore_data_from_binary_file(td, l->data, dbt->database);
+    else
+      r|=restore_data_from_mydumper_file(td, l->data, FALSE, dbt->database);
+  }
+  td->staging_table=NULL;
+  if (r || !swap_follow_rows(dbt, fc, staging)){
+    g_critical("Thread %d: %s.%s could not be updated, it is loaded again by the next snapshot", td->thread_id, dbt->database->target_database, dbt->source_table_name);
+    errors++;
+    r=1;
+  }
+  g_string_assign(statement, "DROP TABLE IF EXISTS ");
+  append_follow_table(statement, dbt, staging);
+  if (restore_data_in_gstring(td, statement, TRUE, dbt->database))
+    g_warning("Thread %d: staging table %s of %s.%s could not be dropped", td->thread_id, staging, dbt->database->target_database, dbt->source_table_name);
+  g_string_free(statement, TRUE);
+  g_free(staging);
+  return r;
+}
+
+// The chunks after a failed one are not applied, the table is loaded again
+static
+int apply_follow_job(struct thread_data *td, struct follow_job *fj){
+  struct db_table *dbt=fj->dbt;
+  int r=0;
+  td->dbt=dbt;
+  if (fj->drop){
+    GString *statement=g_string_new(dbt->is_view ? "DROP VIEW IF EXISTS " : "DROP TABLE IF EXISTS ");
+    append_follow_table(statement, dbt, dbt->source_table_name);
+    message("Thread %d: dropping %s.%s, it is not in the snapshot", td->thread_id, dbt->database->target_database, dbt->source_table_name);
+    r=restore_data_in_gstring(td, statement, TRUE, dbt->database);
+    if (r){
+      g_critical("Thread %d: %s.%s could not be dropped", td->thread_id, dbt->database->target_database, dbt->source_table_name);
+      errors++;
+    }
+    g_string_free(statement, TRUE);
+    return r;
+  }
+  if (fj->schema){
+    GString *statement=g_string_new("DROP TABLE IF EXISTS ");
+    append_follow_table(statement, dbt, dbt->source_table_name);
+    message("Thread %d: creating %s.%s, it is new in the snapshot", td->thread_id, dbt->database->target_database, dbt->source_table_name);
+    r=restore_data_in_gstring(td, statement, TRUE, dbt->database) ||
+      restore_data_from_mydumper_file(td, fj->schema, TRUE, dbt->database);
+    g_string_free(statement, TRUE);
+    if (r){
+      g_critical("Thread %d: %s.%s could not be created", td->thread_id, dbt->database->target_database, dbt->source_table_name);
+      errors++;
+      return r;
+    }
+  }
+  GList *l;
+  for (l=fj->chunks; l && !r; l=l->next)
+    r=apply_follow_chunk(td, dbt, l->data);
+  return r;
+}
+
+static
+void *follow_thread(struct thread_data *td){
+  struct follow_job *fj=NULL;
+  while ((fj=g_async_queue_pop(follow_queue)) != GINT_TO_POINTER(-1)){
+    trace("Thread %d: updating %s.%s", td->thread_id, fj->dbt->database->target_database, fj->dbt->source_table_name);
+    if (apply_follow_job(td, fj)){
+      g_mutex_lock(follow_failed_mutex);
+      follow_failed=g_list_prepend(follow_failed, fj);
+      g_mutex_unlock(follow_failed_mutex);
+    }else
+      free_follow_job(fj);
+  }
+  return NULL;
+}
+
+// Copies the group of the previous snapshot into the new one
+static
+void keep_previous_group(GKeyFile *kf, const gchar *group){
+  gsize num_keys=0, i;
+  gchar **keys=g_key_file_get_keys(follow_metadata, group, &num_keys, NULL);
+  for (i=0; i < num_keys; i++){
+    gchar *value=g_key_file_get_value(follow_metadata, group, keys[i], NULL);
+    g_key_file_set_value(kf, group, keys[i], value);
+    g_free(value);
+  }
+  g_strfreev(keys);
+}
+
+/* The database is left as the failed jobs found it, partially updated when a
+   chunk failed, so the snapshot can not be used as the reference of these
+   tables. They are loaded again whole by the next snapshot, the tables
+   that could not be dropped keep their group to be dropped again, and the
+   tables that could not be created are created again */
+static
+void keep_failed_tables(GKeyFile *kf){
+  GList *l;
+  for (l=follow_failed; l; l=l->next){
+    struct follow_job *fj=l->data;
+    if (fj->drop)
+      keep_previous_group(kf, fj->group);
+    else if (fj->schema)
+      g_key_file_remove_group(kf, fj->group, NULL);
+    else
+      g_hash_table_add(follow_reload, fj->dbt);
+    free_follow_job(fj);
+  }
+  g_list_free(follow_failed);
+  follow_failed=NULL;
+}
+
+static
+void free_table_files(gpointer key, gpointer value, gpointer user_data){
+  (void) key;
+  (void) user_data;
+  g_list_free_full(value, g_free);
+}
+
+// The jobs are applied by num_threads threads, as the data of the restore
+static
+void apply_snapshot(struct configuration *conf, gchar *snapshot){
+  GKeyFile *kf=load_snapshot_metadata(snapshot);
+  if (kf == NULL){
+    g_warning("Metadata of snapshot %s could not be read, it is skipped", snapshot);
+    g_free(snapshot);
+    return;
+  }
+  g_message("Applying snapshot %s", snapshot);
+  g_free(directory);
+  directory=snapshot;
+  if (g_chdir(directory))
+    m_critical("Could not change to snapshot %s", directory);
+  GHashTable *schemas=g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+  GHashTable *files=get_snapshot_files(directory, schemas);
+  follow_queue=g_async_queue_new();
+  reloaded_chunks=0;
+  reloaded_tables=0;
+  guint unchanged=0, n;
+  gsize length=0, i;
+  gchar **groups=g_key_file_get_groups(kf, &length);
+  for (i=0; i < length; i++){
+    struct db_table *dbt=get_group_table(kf, groups[i]);
+    if (dbt == NULL || dbt->is_view || dbt->object_to_export.no_data)
+      continue;
+    load_file_checksums(kf, groups[i]);
+    if (!diff_table(dbt, kf, groups[i], g_hash_table_lookup(files, dbt), g_hash_table_lookup(schemas, dbt)))
+      unchanged++;
+  }
+  g_strfreev(groups);
+  /* the tables that were dropped on the source since the previous snapshot
+     are only dropped with --follow-drop-tables. Otherwise they keep their
+     group, so they are updated again if they come back */
+  dropped_tables=0;
+  groups=g_key_file_get_groups(follow_metadata, &length);
+  for (i=0; i < length; i++){
+    if (g_key_file_has_group(kf, groups[i]))
+      continue;
+    struct db_table *dbt=get_group_table(follow_metadata, groups[i]);
+    if (dbt == NULL || dbt->object_to_export.no_data)
+      continue;
+    if (follow_drop_tables)
+      push_table_drop(dbt, groups[i]);
+    else{
+      g_warning("%s.%s is not in the snapshot, it is kept as it is", dbt->database->target_database, dbt->source_table_name);
+      keep_previous_group(kf, groups[i]);
+    }
+  }
+  g_strfreev(groups);
+
+  struct thread_data *td=g_new(struct thread_data, num_threads);
+  GThread **threads=g_new(GThread *, num_threads);
+  for (n=0; n < num_threads; n++){
+    initialize_thread_data(&(td[n]), conf, STARTED, n + 1, NULL);
+    threads[n]=m_thread_new("myl_follow", (GThreadFunc)follow_thread, &(td[n]), "Follow thread could not be created");
+  }
+  for (n=0; n < num_threads; n++)
+    g_async_queue_push(follow_queue, GINT_TO_POINTER(-1));
+  for (n=0; n < num_threads; n++)
+    g_thread_join(threads[n]);
+  g_free(threads);
+  g_free(td);
+  g_async_queue_unref(follow_queue);
+  follow_queue=NULL;
+  g_hash_table_foreach(files, free_table_files, NULL);
+  g_hash_table_destroy(files);
+  g_hash_table_destroy(schemas);
+
+  keep_failed_tables(kf);
+  g_key_file_free(follow_metadata);
+  follow_metadata=kf;
+  g_message("Snapshot %s applied: %u chunks and %u tables loaded again, %u tables dropped, %u tables unchanged",
+            directory, reloaded_chunks, reloaded_tables, dropped_tables, unchanged);
+}
+
+/* Called once the restore is done. last_dump is switched by mydumper when a
+   snapshot is complete, it is checked every --follow-interval seconds */
+void follow_snapshots(struct configuration *conf){
+  guint n;
+  while (!shutdown_triggered){
+    for (n=0; n < follow_interval && !shutdown_triggered; n++)
+      g_usleep(G_USEC_PER_SEC);
+    if (shutdown_triggered)
+      break;
+    gchar *snapshot=get_snapshot_directory();
+    if (snapshot == NULL || !g_strcmp0(snapshot, directory)){
+      g_free(snapshot);
+      continue;
+    }
+    apply_snapshot(conf, snapshot);
+  }
+}
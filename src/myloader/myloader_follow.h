@@ -0,0 +1,32 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#ifndef _src_myloader_follow_h
+#define _src_myloader_follow_h
+
+#include <glib.h>
+#include "myloader.h"
+
+/* With --follow, -d is the output directory of mydumper --daemon: the
+   snapshot of last_dump is restored as usual and, with the connections and
+   the tables of the restore, each new snapshot is applied on top of it. The
+   chunks or tables whose checksums changed are loaded into a staging table
+   and swapped in with a DELETE and an INSERT ... SELECT in one transaction.
+   The tables that are not in the new snapshot are dropped */
+gchar *initialize_follow(gchar *output_directory);
+void follow_snapshots(struct configuration *conf);
+#endif
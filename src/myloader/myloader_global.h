@@ -51,14 +51,23 @@ extern gboolean no_delete;
 extern gboolean overwrite_tables;
 extern gboolean overwrite_unsafe;
 extern gboolean resume;
+extern gboolean resume_journal;
+extern gboolean dump_in_progress;
+extern gboolean plan;
+extern guint plan_data_rate;
+extern guint plan_max_data_rate;
+extern guint plan_index_rate;
+extern guint plan_schema_rate;
 extern gboolean serial_tbl_creation;
 extern gboolean shutdown_triggered;
 extern gboolean skip_definer;
 extern gboolean skip_post;
 extern gboolean skip_triggers;
 extern gboolean skip_constraints;
+extern gboolean validate_foreign_keys;
 extern gboolean skip_indexes;
 extern gboolean stream;
+extern GAsyncQueue *connection_pool;
 extern gchar *compress_extension;
 extern gchar *target_db;
 extern gchar *directory;
@@ -70,9 +79,32 @@ extern GHashTable *database_hash;
 extern GHashTable *tbl_hash;
 extern GString *set_session;
 extern guint commit_count;
+extern gboolean adaptive_commit;
+extern guint pipeline_depth;
+extern guint split_file_size;
+extern guint prefetch_files;
+extern gboolean adaptive_table_threads;
+extern guint prefetch_memory;
+extern gchar *io_mode_str;
+extern gboolean load_data_as_insert;
+extern gchar *ingest_order_str;
+extern gchar *ingest_backend_str;
+extern gboolean follow_mode;
+extern guint follow_interval;
+extern gboolean follow_drop_tables;
+extern gchar *fan_out_hosts;
+extern guint fan_out_buffer;
+extern gchar *shard_column;
+extern gchar *shard_function_str;
+extern gboolean exchange_partitions;
+extern guint stream_memory_limit;
+extern guint stream_lanes;
 extern guint errors;
 extern guint max_errors;
 extern guint max_threads_for_index_creation;
+extern guint index_ddl_threads;
+extern guint index_ddl_buffer_size;
+extern gint loader_threads_busy;
 extern guint max_threads_for_post_creation;
 extern guint max_threads_for_schema_creation;
 extern guint max_threads_per_table;
@@ -0,0 +1,135 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#include <mysql.h>
+#include <glib.h>
+#include <string.h>
+
+#include "myloader.h"
+#include "myloader_global.h"
+#include "myloader_database.h"
+#include "myloader_table.h"
+#include "myloader_ingest.h"
+
+gchar *ingest_backend_str=NULL;
+
+struct ingest_backend {
+  const gchar *name;
+  enum server_type product;
+  // ENGINE of the tables, NULL for every table of the server
+  const gchar *engine;
+  // the backend is only used when the server has this variable
+  const gchar *variable;
+  const gchar *start;
+  const gchar *finish;
+  // it is only used by the statements out of a transaction
+  gboolean autocommit;
+  // the rows can not be loaded into a table that already has rows
+  gboolean empty_table;
+  gboolean available;
+};
+
+/* MyRocks builds the SST files of the rows of the connection and ingests
+   them when rocksdb_bulk_load is disabled, the rows are sorted by the engine.
+   TiDB bulk DML commits the rows of a statement in pipelined batches */
+static struct ingest_backend ingest_backends[] = {
+  {"MyRocks bulk load", SERVER_TYPE_UNKNOWN, "ROCKSDB", "rocksdb_bulk_load",
+   "SET SESSION rocksdb_bulk_load_allow_unsorted=1, rocksdb_bulk_load=1", "SET SESSION rocksdb_bulk_load=0", FALSE, TRUE, FALSE},
+  {"TiDB bulk DML", SERVER_TYPE_TIDB, NULL, "tidb_dml_type",
+   "SET SESSION tidb_dml_type='bulk'", "SET SESSION tidb_dml_type='standard'", TRUE, FALSE, FALSE},
+  {NULL, SERVER_TYPE_UNKNOWN, NULL, NULL, NULL, NULL, FALSE, FALSE, FALSE}};
+
+// SERVER_TYPE_UNKNOWN is any MySQL like server
+static
+gboolean is_backend_product(struct ingest_backend *ib){
+  return ib->product == SERVER_TYPE_UNKNOWN ? is_mysql_like() : get_product() == (int)ib->product;
+}
+
+void initialize_ingest(MYSQL *conn){
+  struct ingest_backend *ib;
+  if (!ingest_backend_str || !g_ascii_strcasecmp(ingest_backend_str, "GENERIC"))
+    return;
+  if (g_ascii_strcasecmp(ingest_backend_str, "AUTO"))
+    m_critical("--ingest-backend must be GENERIC or AUTO");
+  for (ib=ingest_backends; ib->name; ib++){
+    if (!is_backend_product(ib))
+      continue;
+    gchar *query=g_strdup_printf("SHOW VARIABLES LIKE '%s'", ib->variable);
+    struct M_ROW *mr=m_store_result_row(conn, query, m_warning, m_message, "Failed to check %s", ib->variable);
+    g_free(query);
+    ib->available= mr->row != NULL;
+    m_store_result_row_free(mr);
+    if (ib->available)
+      g_message("Ingest backend %s is going to be used%s%s", ib->name, ib->engine ? " by the tables of engine " : "", ib->engine ? ib->engine : "");
+  }
+}
+
+static
+struct ingest_backend *get_ingest_backend(struct db_table *dbt){
+  struct ingest_backend *ib;
+  if (dbt == NULL)
+    return NULL;
+  for (ib=ingest_backends; ib->name; ib++){
+    if (!g_atomic_int_get(&(ib->available)))
+      continue;
+    if (ib->engine && (!dbt->table_definition || !dbt->table_definition->engine || g_ascii_strcasecmp(ib->engine, dbt->table_definition->engine)))
+      continue;
+    // the tables that were not created by myloader might have rows
+    if (ib->empty_table && (no_schemas || append_if_not_exist))
+      continue;
+    return ib;
+  }
+  return NULL;
+}
+
+gboolean ingest_needs_autocommit(struct db_table *dbt){
+  struct ingest_backend *ib=get_ingest_backend(dbt);
+  return ib && ib->autocommit;
+}
+
+// Called by the restore thread before a statement with rows of dbt
+void ingest_prepare(struct connection_data *cd, struct db_table *dbt){
+  struct ingest_backend *ib=get_ingest_backend(dbt);
+  if (ib == cd->ingest_backend)
+    return;
+  if (cd->ingest_backend)
+    ingest_finish(cd);
+  if (ib == NULL)
+    return;
+  if (mysql_query(cd->thrconn, ib->start)){
+    // the rest of the tables are loaded by the generic path
+    if (g_atomic_int_compare_and_exchange(&(ib->available), TRUE, FALSE))
+      g_warning("Connection %ld: %s could not be enabled, using INSERT and LOAD DATA: %s", cd->connection_id, ib->name, mysql_error(cd->thrconn));
+    return;
+  }
+  trace("Connection %ld: %s enabled for %s.%s", cd->connection_id, ib->name, dbt->database->target_database, dbt->source_table_name);
+  cd->ingest_backend=ib;
+}
+
+// The rows loaded since ingest_prepare() are ingested, after the COMMIT
+int ingest_finish(struct connection_data *cd){
+  struct ingest_backend *ib=cd->ingest_backend;
+  if (ib == NULL)
+    return 0;
+  cd->ingest_backend=NULL;
+  if (mysql_query(cd->thrconn, ib->finish)){
+    g_critical("Connection %ld: %s could not be finished: %s", cd->connection_id, ib->name, mysql_error(cd->thrconn));
+    errors++;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,36 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#ifndef _src_myloader_ingest_h
+#define _src_myloader_ingest_h
+
+#include <mysql.h>
+#include <glib.h>
+#include "myloader.h"
+
+/* With --ingest-backend AUTO the rows of a table are loaded through the bulk
+   path of its engine when the server has it: the session of a connection is
+   switched when it starts restoring rows of the table and switched back, which
+   finishes the bulk load, when the connection is released. Tables and
+   servers without one are loaded by the generic INSERT and LOAD DATA path */
+struct ingest_backend;
+
+void initialize_ingest(MYSQL *conn);
+gboolean ingest_needs_autocommit(struct db_table *dbt);
+void ingest_prepare(struct connection_data *cd, struct db_table *dbt);
+int ingest_finish(struct connection_data *cd);
+#endif
@@ -0,0 +1,174 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "myloader.h"
+#include "myloader_global.h"
+#include "myloader_restore.h"
+#include "myloader_journal.h"
+#include "myloader_fan_out.h"
+
+gboolean resume_journal=FALSE;
+
+static FILE *journal_file=NULL;
+static gchar *journal_path=NULL;
+static GMutex *journal_mutex=NULL;
+// filename and range to the last checkpoint found in the journal
+static GHashTable *checkpoints=NULL;
+// files with a failed statement, their position is not moved anymore
+static GHashTable *failed_files=NULL;
+
+static
+gchar *checkpoint_key(const gchar *filename, guint64 range){
+  return g_strdup_printf("%s\t%"G_GUINT64_FORMAT, filename, range);
+}
+
+// A line that was being written when the process died is not complete
+static
+void load_journal(){
+  gchar *content=NULL;
+  gsize len=0;
+  guint n=0;
+  if (!g_file_get_contents(journal_path, &content, &len, NULL))
+    return;
+  gchar *line=content, *nl;
+  while ((nl=memchr(line, '\n', content + len - line))){
+    *nl='\0';
+    gchar **fields=g_strsplit(line, "\t", 0);
+    if (g_strv_length(fields) == 4){
+      struct journal_checkpoint *jc=g_new(struct journal_checkpoint, 1);
+      jc->offset=g_ascii_strtoull(fields[2], NULL, 10);
+      jc->rows=g_ascii_strtoull(fields[3], NULL, 10);
+      g_hash_table_insert(checkpoints, checkpoint_key(fields[0], g_ascii_strtoull(fields[1], NULL, 10)), jc);
+      n++;
+    }
+    g_strfreev(fields);
+    line=nl + 1;
+  }
+  g_free(content);
+  if (n > 0)
+    g_message("Resuming %u data files from the journal", g_hash_table_size(checkpoints));
+}
+
+void initialize_journal(){
+  if (!resume_journal)
+    return;
+  if (stream)
+    m_critical("--resume-journal can not be used with --stream, the files are removed once restored");
+  // the checkpoints point to rows that the purge removes from the tables
+  if (overwrite_tables || purge_mode == DROP || purge_mode == TRUNCATE || purge_mode == DELETE)
+    m_critical("--resume-journal can not be used with --overwrite-tables or --purge-mode DROP, TRUNCATE or DELETE, the restored rows of the journal would be purged");
+  journal_mutex=g_mutex_new();
+  checkpoints=g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  failed_files=g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  journal_path=g_build_filename(directory, JOURNAL_FILENAME, NULL);
+  load_journal();
+  journal_file=g_fopen(journal_path, "a");
+  if (!journal_file)
+    m_critical("Journal file %s could not be opened (%d)", journal_path, errno);
+}
+
+struct journal_checkpoint *get_journal_checkpoint(const gchar *filename, guint64 range){
+  if (checkpoints == NULL)
+    return NULL;
+  gchar *key=checkpoint_key(filename, range);
+  struct journal_checkpoint *jc=g_hash_table_lookup(checkpoints, key);
+  g_free(key);
+  return jc;
+}
+
+void journal_statement_start(struct connection_data *cd, struct statement *ir){
+  if (!resume_journal || ir->filename == NULL || ir->is_schema){
+    cd->journal_filename=NULL;
+    return;
+  }
+  g_mutex_lock(journal_mutex);
+  gboolean failed=g_hash_table_contains(failed_files, ir->filename);
+  g_mutex_unlock(journal_mutex);
+  if (failed){
+    cd->journal_filename=NULL;
+    return;
+  }
+  cd->journal_filename=ir->filename;
+  cd->journal_range=ir->journal_range;
+  cd->journal_offset=ir->offset;
+  cd->statement_rows=ir->skipped_rows;
+}
+
+void journal_statement_end(struct connection_data *cd, struct statement *ir){
+  if (cd->journal_filename == NULL)
+    return;
+  // the file is not journaled anymore, a rerun starts from the last commit
+  if (ir->result > 0){
+    g_mutex_lock(journal_mutex);
+    g_hash_table_add(failed_files, g_strdup(cd->journal_filename));
+    g_mutex_unlock(journal_mutex);
+    cd->journal_filename=NULL;
+    return;
+  }
+  cd->journal_offset=ir->end_offset;
+  // the INSERTs of a LOAD DATA that is not completed yet keep its offset
+  if (ir->end_offset != ir->offset)
+    cd->statement_rows=0;
+  // without transaction every statement is committed when it is executed
+  if (!cd->transaction)
+    journal_commit(cd);
+}
+
+/* Called once the COMMIT succeeded, it is flushed to disk before going on.
+   The --fan-out-hosts targets have to apply the commit first, otherwise a
+   rerun would skip rows that they never got */
+void journal_commit(struct connection_data *cd){
+  if (cd->journal_filename == NULL)
+    return;
+  fan_out_sync(cd);
+  g_mutex_lock(journal_mutex);
+  fprintf(journal_file, "%s\t%"G_GUINT64_FORMAT"\t%"G_GUINT64_FORMAT"\t%"G_GUINT64_FORMAT"\n",
+          cd->journal_filename, cd->journal_range, cd->journal_offset, cd->statement_rows);
+  if (fflush(journal_file) || fsync(fileno(journal_file)))
+    g_warning("Journal file %s could not be written (%d)", journal_path, errno);
+  g_mutex_unlock(journal_mutex);
+}
+
+// The connection is not restoring the file anymore, its last COMMIT was
+// already written
+void journal_release(struct connection_data *cd){
+  cd->journal_filename=NULL;
+}
+
+// The journal is only needed by a rerun when something failed
+void finalize_journal(){
+  if (journal_file == NULL)
+    return;
+  fclose(journal_file);
+  journal_file=NULL;
+  if (errors == 0)
+    g_remove(journal_path);
+  else
+    g_message("Journal %s kept, rerun with --resume-journal to continue", journal_path);
+  g_hash_table_destroy(checkpoints);
+  checkpoints=NULL;
+  g_hash_table_destroy(failed_files);
+  failed_files=NULL;
+}
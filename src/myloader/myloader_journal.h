@@ -0,0 +1,44 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#ifndef _src_myloader_journal_h
+#define _src_myloader_journal_h
+
+#include <glib.h>
+#include "myloader.h"
+
+/* --resume-journal appends to JOURNAL_FILENAME a line per commit of a data
+   file: the file, the offset of its range, the offset of the first statement
+   that is not completely committed and the rows of that statement that are.
+   A rerun continues every file from its last line */
+#define JOURNAL_FILENAME "myloader.journal"
+
+struct journal_checkpoint {
+  guint64 offset;
+  guint64 rows;
+};
+
+struct statement;
+
+void initialize_journal();
+struct journal_checkpoint *get_journal_checkpoint(const gchar *filename, guint64 range);
+void journal_statement_start(struct connection_data *cd, struct statement *ir);
+void journal_statement_end(struct connection_data *cd, struct statement *ir);
+void journal_commit(struct connection_data *cd);
+void journal_release(struct connection_data *cd);
+void finalize_journal();
+#endif
@@ -0,0 +1,379 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#include <mysql.h>
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "myloader.h"
+#include "myloader_global.h"
+#include "myloader_shard.h"
+#include "myloader_load_data.h"
+
+#define LOAD_DATA_READ_SIZE 64*1024
+#define DEFAULT_LOAD_DATA_INSERT_SIZE 1000000
+
+gboolean load_data_as_insert=FALSE;
+extern guint64 max_statement_size;
+
+static guint64 max_allowed_packet=0;
+
+// How a field of the file is sent in the INSERT
+struct load_data_field {
+  // a user variable that is not used by the SET clause
+  gboolean skip;
+  // the SET expression before and after the user variable, NULL for a column
+  gchar *before;
+  gchar *after;
+};
+
+struct load_data_insert {
+  struct shard_load_data *sld;
+  FILE *file;
+  // INSERT INTO `table` (`a`,`b`) VALUES
+  GString *prefix;
+  // empty when the statement has no column list
+  GPtrArray *fields;
+  // _charset of the CHARACTER SET of the statement, or NULL
+  gchar *introducer;
+  GString *in;
+  gsize position;
+  GString *value;
+  guint64 skip_rows;
+  gboolean header_pending;
+  gboolean eof;
+  gboolean error;
+  // crc32 of what was read from the file
+  guint32 checksum;
+};
+
+void initialize_load_data(MYSQL *conn){
+  struct M_ROW *mr=m_store_result_row(conn, "SELECT @@local_infile, @@max_allowed_packet", m_warning, m_warning, "Failed to get local_infile", NULL);
+  if (mr->row){
+    if (!load_data_as_insert && mr->row[0] && !strcmp(mr->row[0], "0")){
+      g_message("local_infile is disabled on the server, the LOAD DATA files are going to be restored as INSERT statements");
+      load_data_as_insert=TRUE;
+    }
+    if (mr->row[1])
+      max_allowed_packet=strtoull(mr->row[1], NULL, 10);
+  }
+  m_store_result_row_free(mr);
+}
+
+// max-statement-size is also read from the metadata of the dump
+static
+gsize load_data_insert_size(){
+  guint64 size= max_statement_size > 0 ? max_statement_size : DEFAULT_LOAD_DATA_INSERT_SIZE;
+  if (max_allowed_packet > 0 && size > max_allowed_packet / 2)
+    size=max_allowed_packet / 2;
+  return size;
+}
+
+static
+void free_load_data_field(struct load_data_field *f){
+  g_free(f->before);
+  g_free(f->after);
+  g_free(f);
+}
+
+// `db`.`table`, `column` or a plain name
+static
+const gchar *skip_identifier(const gchar *p){
+  do {
+    if (*p == '.')
+      p++;
+    if (*p == identifier_quote_character){
+      for (p++; *p; p++)
+        if (*p == identifier_quote_character){
+          if (p[1] != identifier_quote_character)
+            break;
+          p++;
+        }
+      if (*p)
+        p++;
+    }else
+      while (*p && *p != ' ' && *p != '.' && *p != ',' && *p != '(' && *p != ')' && *p != '=')
+        p++;
+  } while (*p == '.');
+  return p;
+}
+
+// Splits a=b,c=d up to the end of the statement, outside of parenthesis and quotes
+static
+void parse_set_clause(const gchar *p, GPtrArray *columns, GPtrArray *expressions){
+  while (*p == ' ')
+    p++;
+  if (g_ascii_strncasecmp(p, "SET ", 4))
+    return;
+  p+=4;
+  while (*p && *p != ';'){
+    while (*p == ' ' || *p == ',')
+      p++;
+    const gchar *column=p, *equal=NULL;
+    gint depth=0;
+    gchar quote='\0';
+    for (; *p && (quote || depth > 0 || (*p != ',' && *p != ';')); p++){
+      if (quote){
+        if (*p == quote)
+          quote='\0';
+      }else if (*p == '\'' || *p == identifier_quote_character)
+        quote=*p;
+      else if (*p == '(')
+        depth++;
+      else if (*p == ')')
+        depth--;
+      else if (*p == '=' && depth == 0 && !equal)
+        equal=p;
+    }
+    if (equal){
+      g_ptr_array_add(columns, g_strstrip(g_strndup(column, equal - column)));
+      g_ptr_array_add(expressions, g_strstrip(g_strndup(equal + 1, p - equal - 1)));
+    }
+  }
+}
+
+// @name in the expression, not followed by more characters of a name
+static
+const gchar *find_user_variable(const gchar *expression, const gchar *name, gsize len){
+  const gchar *p=expression;
+  while ((p=strstr(p, name))){
+    if (!g_ascii_isalnum(p[len]) && p[len] != '_' && p[len] != '$')
+      return p;
+    p++;
+  }
+  return NULL;
+}
+
+/* The column list of the statement is the order of the fields of the file.
+   A user variable takes the column of the SET expression that uses it */
+static
+void parse_load_data_columns(struct load_data_insert *ldi, const gchar *p, GString *columns){
+  GPtrArray *set_columns=g_ptr_array_new_with_free_func(g_free);
+  GPtrArray *set_expressions=g_ptr_array_new_with_free_func(g_free);
+  const gchar *list_end=strchr(p, ')');
+  if (list_end)
+    parse_set_clause(list_end + 1, set_columns, set_expressions);
+  p++;
+  while (*p && *p != ')'){
+    while (*p == ' ' || *p == ',')
+      p++;
+    if (*p == ')' || *p == '\0')
+      break;
+    struct load_data_field *f=g_new0(struct load_data_field, 1);
+    const gchar *name=p;
+    if (*p == '@'){
+      while (*p && *p != ',' && *p != ')' && *p != ' ')
+        p++;
+      gchar *variable=g_strndup(name, p - name);
+      guint i;
+      const gchar *v=NULL;
+      for (i=0; i < set_expressions->len && !v; i++)
+        v=find_user_variable(g_ptr_array_index(set_expressions, i), variable, p - name);
+      if (v){
+        const gchar *expression=g_ptr_array_index(set_expressions, i - 1);
+        f->before=g_strndup(expression, v - expression);
+        f->after=g_strdup(v + (p - name));
+        g_string_append_printf(columns, "%s%s", columns->len ? "," : "", (gchar *)g_ptr_array_index(set_columns, i - 1));
+      }else
+        f->skip=TRUE;
+      g_free(variable);
+    }else{
+      p=skip_identifier(p);
+      g_string_append_printf(columns, "%s%.*s", columns->len ? "," : "", (gint)(p - name), name);
+    }
+    g_ptr_array_add(ldi->fields, f);
+    while (*p == ' ')
+      p++;
+  }
+  g_ptr_array_free(set_columns, TRUE);
+  g_ptr_array_free(set_expressions, TRUE);
+}
+
+struct load_data_insert *new_load_data_insert(GString *statement, FILE *file){
+  struct load_data_insert *ldi=g_new0(struct load_data_insert, 1);
+  ldi->sld=parse_load_data_statement(statement);
+  ldi->file=file;
+  ldi->fields=g_ptr_array_new_with_free_func((GDestroyNotify)free_load_data_field);
+  ldi->in=g_string_sized_new(LOAD_DATA_READ_SIZE);
+  ldi->value=g_string_sized_new(256);
+  ldi->header_pending=ldi->sld->header;
+
+  const gchar *s=statement->str, *into=strstr(s, " INTO TABLE ");
+  const gchar *infile=strchr(s, '\''), *infile_end= infile ? strchr(infile + 1, '\'') : NULL;
+  gchar *modifier= into && infile_end && infile_end < into ? g_strndup(infile_end + 1, into - infile_end - 1) : NULL;
+  ldi->prefix=g_string_new(modifier && strstr(modifier, "REPLACE") ? "REPLACE INTO " :
+                           modifier && strstr(modifier, "IGNORE") ? "INSERT IGNORE INTO " : "INSERT INTO ");
+  g_free(modifier);
+  if (into){
+    const gchar *table=into + strlen(" INTO TABLE "), *table_end=skip_identifier(table);
+    g_string_append_len(ldi->prefix, table, table_end - table);
+    const gchar *charset=strstr(table_end, " CHARACTER SET ");
+    if (charset && (!ldi->sld->columns || charset < ldi->sld->columns)){
+      charset+=strlen(" CHARACTER SET ");
+      ldi->introducer=g_strdup_printf("_%.*s", (gint)strcspn(charset, " "), charset);
+    }
+  }
+  if (ldi->sld->columns){
+    GString *columns=g_string_new(NULL);
+    parse_load_data_columns(ldi, ldi->sld->columns, columns);
+    g_string_append_printf(ldi->prefix, " (%s)", columns->str);
+    g_string_free(columns, TRUE);
+  }
+  g_string_append(ldi->prefix, " VALUES ");
+  return ldi;
+}
+
+// The rows that a previous run committed, --resume-journal
+void skip_load_data_rows(struct load_data_insert *ldi, guint64 num_rows){
+  ldi->skip_rows=num_rows;
+}
+
+static
+void append_sql_literal(GString *out, const gchar *introducer, GString *value){
+  gsize i;
+  if (introducer)
+    g_string_append(out, introducer);
+  g_string_append_c(out, '\'');
+  for (i=0; i < value->len; i++){
+    switch (value->str[i]){
+      case '\0':   g_string_append(out, "\\0"); break;
+      case '\'':   g_string_append(out, "\\'"); break;
+      case '\\':   g_string_append(out, "\\\\"); break;
+      case '\n':   g_string_append(out, "\\n"); break;
+      case '\r':   g_string_append(out, "\\r"); break;
+      case '\032': g_string_append(out, "\\Z"); break;
+      default:     g_string_append_c(out, value->str[i]);
+    }
+  }
+  g_string_append_c(out, '\'');
+}
+
+/* A field missing in the line gets the default of the column, as LOAD DATA
+   does. The fields after the ones of the column list are ignored */
+static
+void append_load_data_row(struct load_data_insert *ldi, GString *insert, const gchar *p, const gchar *end){
+  gsize fl=ldi->sld->fields_terminated_by->len;
+  gboolean more=TRUE, is_null=FALSE, first=TRUE;
+  guint i;
+  g_string_append_c(insert, '(');
+  p=skip_line_start(ldi->sld, p, end);
+  for (i=0; i < ldi->fields->len || (ldi->fields->len == 0 && more); i++){
+    struct load_data_field *f= i < ldi->fields->len ? g_ptr_array_index(ldi->fields, i) : NULL;
+    gboolean missing=!more;
+    if (more){
+      p=read_load_data_field(ldi->sld, ldi->value, &is_null, p, end);
+      if (p < end)
+        p+=fl;
+      else
+        more=FALSE;
+    }
+    if (f && f->skip)
+      continue;
+    if (!first)
+      g_string_append_c(insert, ',');
+    first=FALSE;
+    if (f && f->before)
+      g_string_append(insert, f->before);
+    if (missing)
+      g_string_append(insert, f && f->before ? "NULL" : "DEFAULT");
+    else if (is_null)
+      g_string_append(insert, "NULL");
+    else
+      append_sql_literal(insert, ldi->introducer, ldi->value);
+    if (f && f->after)
+      g_string_append(insert, f->after);
+  }
+  g_string_append_c(insert, ')');
+}
+
+static
+gboolean read_load_data_file(struct load_data_insert *ldi){
+  g_string_erase(ldi->in, 0, ldi->position);
+  ldi->position=0;
+  gsize len=ldi->in->len;
+  g_string_set_size(ldi->in, len + LOAD_DATA_READ_SIZE);
+  gsize r=fread(ldi->in->str + len, 1, LOAD_DATA_READ_SIZE, ldi->file);
+  g_string_set_size(ldi->in, len + r);
+  ldi->checksum=crc32(ldi->checksum, (const Bytef *)ldi->in->str + len, (uInt)r);
+  if (r == 0){
+    if (ferror(ldi->file)){
+      ldi->error=TRUE;
+      return FALSE;
+    }
+    ldi->eof=TRUE;
+  }
+  return TRUE;
+}
+
+// Fills insert with the next rows of the file, returns how many
+guint64 next_load_data_insert(struct load_data_insert *ldi, GString *insert){
+  gsize size=load_data_insert_size(), tl=ldi->sld->lines_terminated_by->len;
+  guint64 num_rows=0;
+  g_string_assign(insert, ldi->prefix->str);
+  while (insert->len < size){
+    const gchar *p=ldi->in->str + ldi->position, *end=ldi->in->str + ldi->in->len;
+    const gchar *line_end= p < end ? find_line_end(ldi->sld, p, end) : NULL;
+    if (line_end == NULL){
+      if (!ldi->eof){
+        if (!read_load_data_file(ldi))
+          return 0;
+        continue;
+      }
+      if (p == end)
+        break;
+      // the last line without terminator
+      line_end=end;
+    }
+    if (ldi->header_pending)
+      ldi->header_pending=FALSE;
+    else if (ldi->skip_rows > 0)
+      ldi->skip_rows--;
+    else{
+      if (num_rows > 0)
+        g_string_append_c(insert, ',');
+      append_load_data_row(ldi, insert, p, line_end);
+      num_rows++;
+    }
+    ldi->position= (line_end + tl <= end ? line_end + tl : end) - ldi->in->str;
+  }
+  if (num_rows > 0)
+    g_string_append(insert, ";\n");
+  return num_rows;
+}
+
+gboolean load_data_insert_failed(struct load_data_insert *ldi){
+  return ldi->error;
+}
+
+// FALSE while the file was not read until its end
+gboolean load_data_insert_checksum(struct load_data_insert *ldi, guint32 *checksum){
+  *checksum=ldi->checksum;
+  return ldi->eof && !ldi->error;
+}
+
+void free_load_data_insert(struct load_data_insert *ldi){
+  free_shard_load_data(ldi->sld);
+  g_string_free(ldi->prefix, TRUE);
+  g_ptr_array_free(ldi->fields, TRUE);
+  g_free(ldi->introducer);
+  g_string_free(ldi->in, TRUE);
+  g_string_free(ldi->value, TRUE);
+  g_free(ldi);
+}
@@ -0,0 +1,39 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#ifndef _src_myloader_load_data_h
+#define _src_myloader_load_data_h
+
+#include <stdio.h>
+#include <mysql.h>
+#include <glib.h>
+#include "myloader.h"
+
+/* With --load-data-as-insert, or when local_infile is disabled on the server,
+   the rows of the file of a LOAD DATA statement are read with the FIELDS and
+   LINES of the statement and sent as multi-row INSERTs of up to
+   --max-statement-size bytes */
+struct load_data_insert;
+
+void initialize_load_data(MYSQL *conn);
+struct load_data_insert *new_load_data_insert(GString *statement, FILE *file);
+void skip_load_data_rows(struct load_data_insert *ldi, guint64 num_rows);
+guint64 next_load_data_insert(struct load_data_insert *ldi, GString *insert);
+gboolean load_data_insert_failed(struct load_data_insert *ldi);
+gboolean load_data_insert_checksum(struct load_data_insert *ldi, guint32 *checksum);
+void free_load_data_insert(struct load_data_insert *ldi);
+#endif
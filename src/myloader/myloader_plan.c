@@ -0,0 +1,478 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "myloader.h"
+#include "myloader_global.h"
+#include "myloader_common.h"
+#include "myloader_plan.h"
+
+#define PLAN_MARGIN 1.05
+
+gboolean plan=FALSE;
+guint plan_data_rate=20;
+guint plan_max_data_rate=0;
+guint plan_index_rate=1000000;
+guint plan_schema_rate=20;
+
+struct plan_table{
+  gchar *name;
+  guint64 rows;
+  GArray *files;
+  guint64 bytes;
+  guint indexes;
+  // simulation
+  guint64 remaining;
+  guint next_file;
+  guint running;
+  gdouble schema_end;
+  gdouble data_start;
+  gdouble data_end;
+  gdouble index_start;
+  gdouble index_end;
+};
+
+struct plan_job{
+  gdouble end;
+  struct plan_table *pt;
+};
+
+struct plan_result{
+  gdouble schema_end;
+  gdouble data_start;
+  gdouble data_end;
+  gdouble index_start;
+  gdouble index_end;
+  gdouble post_end;
+  struct plan_table *critical;
+};
+
+static GPtrArray *plan_tables=NULL;
+static guint plan_post_objects=0;
+
+static
+struct plan_table *new_plan_table(const gchar *name){
+  struct plan_table *pt=g_new0(struct plan_table, 1);
+  pt->name=g_strdup(name);
+  pt->files=g_array_new(FALSE, FALSE, sizeof(guint64));
+  return pt;
+}
+
+/* The groups of the tables are `db`.`table` with the names of the files */
+static
+void read_plan_metadata(GHashTable *tables_by_name){
+  gchar *path=g_build_filename(directory, "metadata", NULL);
+  GKeyFile *kf=load_config_file(path);
+  g_free(path);
+  if (kf == NULL)
+    m_critical("The metadata of %s could not be read", directory);
+  gsize length=0, i;
+  gchar **groups=g_key_file_get_groups(kf, &length);
+  for (i=0; i < length; i++){
+    gchar q=groups[i][0];
+    gsize len=strlen(groups[i]);
+    if ((q != '`' && q != '"') || len < 5 || groups[i][len-1] != q)
+      continue;
+    gchar delimiter[4]={q, '.', q, '\0'};
+    gchar *inner=g_strndup(groups[i] + 1, len - 2);
+    gchar **database_table=g_strsplit(inner, delimiter, 2);
+    if (g_strv_length(database_table) == 2){
+      gchar *name=g_strdup_printf("%s.%s", database_table[0], database_table[1]);
+      struct plan_table *pt=new_plan_table(name);
+      pt->rows=g_key_file_get_uint64(kf, groups[i], "rows", NULL);
+      g_hash_table_insert(tables_by_name, name, pt);
+      g_ptr_array_add(plan_tables, pt);
+    }
+    g_strfreev(database_table);
+    g_free(inner);
+  }
+  g_strfreev(groups);
+  g_key_file_free(kf);
+}
+
+// the secondary indexes are created after the data
+static
+guint count_deferred_indexes(const gchar *filename){
+  gchar *path=g_build_filename(directory, filename, NULL);
+  FILE *file=NULL;
+  if (is_in_process_decompression_available(path))
+    file=open_decompressed_file(path);
+  else if (g_str_has_suffix(path, ".sql"))
+    file=g_fopen(path, "r");
+  g_free(path);
+  if (file == NULL)
+    return 0;
+  guint indexes=0;
+  gchar *line=NULL;
+  size_t size=0;
+  while (getline(&line, &size, file) > 0){
+    gchar *l=g_strchug(line);
+    if (g_str_has_prefix(l, "KEY ") || g_str_has_prefix(l, "UNIQUE KEY ") ||
+        g_str_has_prefix(l, "FULLTEXT KEY ") || g_str_has_prefix(l, "SPATIAL KEY "))
+      indexes++;
+  }
+  free(line);
+  fclose(file);
+  return indexes;
+}
+
+static
+void add_plan_file(GHashTable *tables_by_name, const gchar *filename, guint64 size){
+  const gchar *c;
+  if (m_filename_has_suffix(filename, "-schema-post.sql") || m_filename_has_suffix(filename, "-schema-triggers.sql") ||
+      m_filename_has_suffix(filename, "-schema-view.sql")){
+    plan_post_objects++;
+    return;
+  }
+  // the name of the table ends at a '.' or at the '-' of -schema.sql
+  for (c=filename; *c; c++){
+    if (*c != '.' && *c != '-')
+      continue;
+    gchar *name=g_strndup(filename, c - filename);
+    struct plan_table *pt=g_hash_table_lookup(tables_by_name, name);
+    g_free(name);
+    if (pt == NULL)
+      continue;
+    if (*c == '-' && m_filename_has_suffix(c, "-schema.sql"))
+      pt->indexes=count_deferred_indexes(filename);
+    else if (*c == '.' && (m_filename_has_suffix(c, ".sql") || m_filename_has_suffix(c, ".dat") ||
+                           m_filename_has_suffix(c, "." ROW_BINARY_EXTENSION))){
+      g_array_append_val(pt->files, size);
+      pt->bytes+=size;
+    }
+    return;
+  }
+}
+
+static
+void read_plan_directory(GHashTable *tables_by_name){
+  GError *error=NULL;
+  GDir *dir=g_dir_open(directory, 0, &error);
+  if (!dir)
+    m_critical("The directory %s could not be read: %s", directory, error->message);
+  const gchar *filename=NULL;
+  while ((filename=g_dir_read_name(dir))){
+    gchar *path=g_build_filename(directory, filename, NULL);
+    GStatBuf st;
+    if (g_stat(path, &st) == 0 && S_ISREG(st.st_mode))
+      add_plan_file(tables_by_name, filename, st.st_size);
+    g_free(path);
+  }
+  g_dir_close(dir);
+}
+
+static
+gint compare_plan_jobs(gconstpointer a, gconstpointer b){
+  gdouble ea=((const struct plan_job *)a)->end, eb=((const struct plan_job *)b)->end;
+  return ea < eb ? -1 : ea > eb;
+}
+
+// the table with more bytes left goes first, as in give_me_next_data_job_conf()
+static
+gint compare_plan_tables(gconstpointer a, gconstpointer b){
+  guint64 ra=((const struct plan_table *)a)->remaining, rb=((const struct plan_table *)b)->remaining;
+  return ra > rb ? -1 : ra < rb;
+}
+
+static
+gint compare_plan_tables_by_end(gconstpointer a, gconstpointer b){
+  gdouble ea=(*(struct plan_table * const *)a)->data_end, eb=(*(struct plan_table * const *)b)->data_end;
+  return ea < eb ? -1 : ea > eb;
+}
+
+/* Min heaps on compare, for the running jobs and for the tables that can
+   take a thread */
+static
+void plan_heap_push(GPtrArray *heap, gpointer data, GCompareFunc compare){
+  guint i=heap->len, parent;
+  g_ptr_array_add(heap, data);
+  while (i > 0){
+    parent=(i-1)/2;
+    if (compare(g_ptr_array_index(heap, parent), data) <= 0)
+      break;
+    heap->pdata[i]=heap->pdata[parent];
+    i=parent;
+  }
+  heap->pdata[i]=data;
+}
+
+static
+gpointer plan_heap_pop(GPtrArray *heap, GCompareFunc compare){
+  if (heap->len == 0)
+    return NULL;
+  gpointer top=g_ptr_array_index(heap, 0);
+  gpointer last=g_ptr_array_index(heap, heap->len - 1);
+  g_ptr_array_set_size(heap, heap->len - 1);
+  guint i=0, child, len=heap->len;
+  if (len > 0){
+    while ((child=2*i+1) < len){
+      if (child + 1 < len && compare(g_ptr_array_index(heap, child + 1), g_ptr_array_index(heap, child)) < 0)
+        child++;
+      if (compare(last, g_ptr_array_index(heap, child)) <= 0)
+        break;
+      heap->pdata[i]=heap->pdata[child];
+      i=child;
+    }
+    heap->pdata[i]=last;
+  }
+  return top;
+}
+
+static
+void finish_plan_data(struct plan_table *pt, gdouble now, struct plan_result *r){
+  pt->data_end=now;
+  if (now > r->data_end)
+    r->data_end=now;
+}
+
+/* The schema of the tables is created in the order of plan_tables, so they
+   become runnable in that order, and the events are the end of a job or of
+   a schema */
+static
+void simulate_plan_data(guint threads, guint per_table, guint schema_threads, struct plan_result *r){
+  guint i, next_schema=0;
+  memset(r, 0, sizeof(*r));
+  r->data_start=-1;
+  r->index_start=-1;
+  schema_threads=MAX(schema_threads, 1);
+  gdouble rate=(gdouble)plan_data_rate * 1024 * 1024;
+  if (plan_max_data_rate > 0 && (gdouble)plan_max_data_rate * 1024 * 1024 / threads < rate)
+    rate=(gdouble)plan_max_data_rate * 1024 * 1024 / threads;
+
+  // schema: one table per free schema thread
+  gdouble *workers=g_new0(gdouble, schema_threads);
+  for (i=0; i < plan_tables->len; i++){
+    struct plan_table *pt=g_ptr_array_index(plan_tables, i);
+    guint w=i % schema_threads;
+    workers[w]+=1.0 / plan_schema_rate;
+    pt->schema_end=workers[w];
+    pt->remaining=pt->bytes;
+    pt->next_file=0;
+    pt->running=0;
+    pt->data_start=-1;
+    pt->data_end=pt->schema_end;
+    pt->index_start=pt->index_end=0;
+    if (pt->schema_end > r->schema_end)
+      r->schema_end=pt->schema_end;
+  }
+  g_free(workers);
+
+  // data
+  GPtrArray *running=g_ptr_array_new();
+  GPtrArray *runnable=g_ptr_array_new();
+  guint free_threads=threads;
+  gdouble now=0;
+  struct plan_table *pt;
+  struct plan_job *job;
+  for (;;){
+    for (; next_schema < plan_tables->len; next_schema++){
+      pt=g_ptr_array_index(plan_tables, next_schema);
+      if (pt->schema_end > now)
+        break;
+      if (pt->files->len > 0)
+        plan_heap_push(runnable, pt, compare_plan_tables);
+    }
+    while (free_threads > 0 && (pt=plan_heap_pop(runnable, compare_plan_tables)) != NULL){
+      guint64 size=g_array_index(pt->files, guint64, pt->next_file++);
+      job=g_new(struct plan_job, 1);
+      job->end=now + size / rate;
+      job->pt=pt;
+      plan_heap_push(running, job, compare_plan_jobs);
+      if (pt->data_start < 0)
+        pt->data_start=now;
+      if (r->data_start < 0)
+        r->data_start=now;
+      pt->remaining-=size;
+      pt->running++;
+      free_threads--;
+      if (pt->next_file < pt->files->len && pt->running < per_table)
+        plan_heap_push(runnable, pt, compare_plan_tables);
+    }
+    gdouble next=-1;
+    if (running->len > 0)
+      next=((struct plan_job *)g_ptr_array_index(running, 0))->end;
+    // a table whose schema is not created yet
+    if (next_schema < plan_tables->len){
+      pt=g_ptr_array_index(plan_tables, next_schema);
+      if (next < 0 || pt->schema_end < next)
+        next=pt->schema_end;
+    }
+    if (next < 0)
+      break;
+    now=next;
+    while (running->len > 0 && ((struct plan_job *)g_ptr_array_index(running, 0))->end <= now){
+      job=plan_heap_pop(running, compare_plan_jobs);
+      pt=job->pt;
+      g_free(job);
+      // it left the runnable tables when it reached per_table
+      if (pt->next_file < pt->files->len && pt->running == per_table)
+        plan_heap_push(runnable, pt, compare_plan_tables);
+      pt->running--;
+      free_threads++;
+      if (pt->running == 0 && pt->next_file >= pt->files->len)
+        finish_plan_data(pt, now, r);
+    }
+  }
+  g_ptr_array_free(running, TRUE);
+  g_ptr_array_free(runnable, TRUE);
+  if (r->data_start < 0)
+    r->data_start=0;
+  if (r->data_end < r->schema_end)
+    r->data_end=r->schema_end;
+}
+
+// indexes, in the order the tables finish, on the first free index thread
+static
+void simulate_plan_indexes(GPtrArray *by_end, guint index_threads, guint post_threads, struct plan_result *r){
+  guint i, j;
+  index_threads=MAX(index_threads, 1);
+  post_threads=MAX(post_threads, 1);
+  r->index_start=-1;
+  r->index_end=0;
+  r->critical=NULL;
+  gdouble *workers=g_new0(gdouble, index_threads);
+  for (i=0; i < by_end->len; i++){
+    struct plan_table *pt=g_ptr_array_index(by_end, i);
+    pt->index_end=pt->data_end;
+    if (pt->indexes == 0)
+      continue;
+    guint w=0;
+    for (j=1; j < index_threads; j++)
+      if (workers[j] < workers[w])
+        w=j;
+    pt->index_start=MAX(workers[w], pt->data_end);
+    pt->index_end=pt->index_start + (gdouble)pt->rows * pt->indexes / plan_index_rate;
+    workers[w]=pt->index_end;
+    if (r->index_start < 0 || pt->index_start < r->index_start)
+      r->index_start=pt->index_start;
+    if (pt->index_end > r->index_end)
+      r->index_end=pt->index_end;
+  }
+  g_free(workers);
+  if (r->index_start < 0)
+    r->index_start=r->data_end;
+  if (r->index_end < r->data_end)
+    r->index_end=r->data_end;
+
+  r->post_end=r->index_end + (gdouble)((plan_post_objects + post_threads - 1) / post_threads) / plan_schema_rate;
+  for (i=0; i < plan_tables->len; i++){
+    struct plan_table *pt=g_ptr_array_index(plan_tables, i);
+    if (r->critical == NULL || pt->index_end > r->critical->index_end)
+      r->critical=pt;
+  }
+}
+
+static
+GPtrArray *plan_tables_by_end(){
+  GPtrArray *by_end=g_ptr_array_sized_new(plan_tables->len);
+  guint i;
+  for (i=0; i < plan_tables->len; i++)
+    g_ptr_array_add(by_end, g_ptr_array_index(plan_tables, i));
+  g_ptr_array_sort(by_end, compare_plan_tables_by_end);
+  return by_end;
+}
+
+static
+void simulate_plan(guint threads, guint per_table, guint index_threads, guint schema_threads, guint post_threads, struct plan_result *r){
+  simulate_plan_data(threads, per_table, schema_threads, r);
+  GPtrArray *by_end=plan_tables_by_end();
+  simulate_plan_indexes(by_end, index_threads, post_threads, r);
+  g_ptr_array_free(by_end, TRUE);
+}
+
+static
+gdouble simulate_threads(guint t, gboolean index, GPtrArray *by_end, const struct plan_result *data){
+  struct plan_result r;
+  if (index){
+    r=*data;
+    simulate_plan_indexes(by_end, t, max_threads_for_post_creation, &r);
+  }else
+    simulate_plan(t, MIN(max_threads_per_table, t), max_threads_for_index_creation, max_threads_for_schema_creation, max_threads_for_post_creation, &r);
+  return r.post_end;
+}
+
+/* The least threads that are within PLAN_MARGIN of the best time. The time
+   does not grow with the threads, so the best one is the one of the most
+   threads, and the least threads are found with a binary search. The data
+   phase does not depend on the index threads, so it is simulated once */
+static
+guint recommend_threads(guint current, gboolean index){
+  guint lo=1, hi=MAX(current * 2, 2), mid;
+  struct plan_result data;
+  GPtrArray *by_end=NULL;
+  if (index){
+    simulate_plan_data(num_threads, max_threads_per_table, max_threads_for_schema_creation, &data);
+    by_end=plan_tables_by_end();
+  }
+  gdouble target=simulate_threads(hi, index, by_end, &data) * PLAN_MARGIN;
+  while (lo < hi){
+    mid=lo + (hi - lo) / 2;
+    if (simulate_threads(mid, index, by_end, &data) <= target)
+      hi=mid;
+    else
+      lo=mid + 1;
+  }
+  if (by_end)
+    g_ptr_array_free(by_end, TRUE);
+  return lo;
+}
+
+int run_plan(){
+  struct plan_result r;
+  guint i;
+  if (plan_data_rate == 0 || plan_index_rate == 0 || plan_schema_rate == 0)
+    m_critical("--plan-data-rate, --plan-index-rate and --plan-schema-rate must be greater than 0");
+  GHashTable *tables_by_name=g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  plan_tables=g_ptr_array_new();
+  read_plan_metadata(tables_by_name);
+  read_plan_directory(tables_by_name);
+  g_hash_table_destroy(tables_by_name);
+
+  guint64 bytes=0, rows_total=0, files=0;
+  for (i=0; i < plan_tables->len; i++){
+    struct plan_table *pt=g_ptr_array_index(plan_tables, i);
+    bytes+=pt->bytes;
+    rows_total+=pt->rows;
+    files+=pt->files->len;
+  }
+  simulate_plan(num_threads, max_threads_per_table, max_threads_for_index_creation, max_threads_for_schema_creation, max_threads_for_post_creation, &r);
+
+  printf("Restore plan of %s\n", directory);
+  printf("Tables: %u, data files: %"G_GUINT64_FORMAT", bytes: %"G_GUINT64_FORMAT", rows: %"G_GUINT64_FORMAT", post objects: %u\n",
+      plan_tables->len, files, bytes, rows_total, plan_post_objects);
+  printf("Model: %u MB/s per loader thread, %u MB/s server total (0 is unlimited), %u rows/s per index, %u objects/s per schema thread\n",
+      plan_data_rate, plan_max_data_rate, plan_index_rate, plan_schema_rate);
+  printf("\nPhase          Start (s)      End (s)\n");
+  printf("schema      %12.1f %12.1f\n", 0.0, r.schema_end);
+  printf("data        %12.1f %12.1f\n", r.data_start, r.data_end);
+  printf("index       %12.1f %12.1f\n", r.index_start, r.index_end);
+  printf("post        %12.1f %12.1f\n", r.index_end, r.post_end);
+  printf("\nPredicted restore time: %.1f seconds\n", r.post_end);
+  if (r.critical){
+    struct plan_table *pt=r.critical;
+    printf("Critical path: %s, schema created at %.1f, data loaded from %.1f to %.1f in %u files, indexes built from %.1f to %.1f\n",
+        pt->name, pt->schema_end, MAX(pt->data_start, 0), pt->data_end, pt->files->len,
+        pt->indexes ? pt->index_start : pt->data_end, pt->index_end);
+  }
+  printf("\nRecommended --threads: %u (current %u)\n", recommend_threads(num_threads, FALSE), num_threads);
+  printf("Recommended --max-threads-for-index-creation: %u (current %u)\n", recommend_threads(max_threads_for_index_creation, TRUE), max_threads_for_index_creation);
+  return EXIT_SUCCESS;
+}
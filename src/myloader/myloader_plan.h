@@ -0,0 +1,30 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#ifndef _src_myloader_plan_h
+#define _src_myloader_plan_h
+
+#include <glib.h>
+
+/* --plan reads the metadata and the files of the backup directory, without
+   connecting, and simulates the restore: the schema threads create the
+   tables, the loader threads take the files of the table with more bytes
+   left up to --max-threads-per-table, the indexes are built once the data of
+   the table is loaded and the post actions at the end. The rates of the model
+   are set with the --plan-* options */
+int run_plan();
+#endif
@@ -25,6 +25,7 @@
 #include <mysql.h>
 #include "myloader.h"
 #include "myloader_global.h"
+#include "myloader_database.h"
 
 void append_pmm_entry(GString *content, const gchar *_key, GAsyncQueue * queue){
   if (queue != NULL)
@@ -33,15 +34,7 @@ void append_pmm_entry(GString *content, const gchar *_key, GAsyncQueue * queue){
 
 void append_pmm_entry_tables(GString *content,struct configuration *conf){
   (void) content;
-  GHashTableIter iter;
-  gchar * lkey;
-  if (conf->table_hash){
-    g_hash_table_iter_init ( &iter, conf->table_hash );
-    struct db_table *dbt=NULL;
-    while ( g_hash_table_iter_next ( &iter, (gpointer *) &lkey, (gpointer *) &dbt ) ) {
-//      g_string_append_printf(content,"myloader_table{name=\"%s\"} %d\n",lkey,stream?(guint)g_list_length(dbt->restore_job_list):(guint)g_async_queue_length(dbt->queue));
-    }
-  }
+  (void) conf;
 }
 
 void write_myloader_pmm_entries(const gchar* filename, GString *content, struct configuration* conf){
@@ -60,3 +53,68 @@ void write_myloader_pmm_entries(const gchar* filename, GString *content, struct
   g_file_set_contents( filename , content->str, content->len, NULL);
 }
 
+
+static
+void append_metrics_queue(GString *content, const gchar *_key, GAsyncQueue * queue){
+  if (queue != NULL)
+    g_string_append_printf(content,"myloader_queue_length{name=\"%s\"} %d\n", _key, g_async_queue_length(queue));
+}
+
+static
+void append_metrics_table(GString *content, const gchar *metric, struct db_table *dbt, guint64 value){
+  g_string_append_printf(content, "%s{", metric);
+  append_metrics_label(content, "database", dbt->database->target_database);
+  g_string_append_c(content, ',');
+  append_metrics_label(content, "table", dbt->source_table_name);
+  g_string_append_printf(content, "} %"G_GUINT64_FORMAT"\n", value);
+}
+
+void write_myloader_metrics_entries(GString *content, void *_conf){
+  struct configuration *conf=_conf;
+  append_metrics_header(content, "myloader_threads", "gauge", "Restore threads");
+  g_string_append_printf(content, "myloader_threads %u\n", num_threads);
+  append_metrics_header(content, "myloader_errors", "counter", "Errors found during the restore");
+  g_string_append_printf(content, "myloader_errors %u\n", errors);
+  if (connection_pool != NULL){
+    append_metrics_header(content, "myloader_connections_idle", "gauge", "Connections of the pool that are not running a job");
+    g_string_append_printf(content, "myloader_connections_idle %d\n", g_async_queue_length(connection_pool));
+  }
+  append_queue_stats_metrics(content, "myloader");
+  if (conf == NULL)
+    return;
+  append_metrics_header(content, "myloader_queue_length", "gauge", "Jobs waiting on each queue");
+  append_metrics_queue(content, "database_queue",    conf->database_queue);
+  append_metrics_queue(content, "table_queue",       conf->table_queue);
+  append_metrics_queue(content, "retry_queue",       conf->retry_queue);
+  append_metrics_queue(content, "data_queue",        conf->data_queue);
+  append_metrics_queue(content, "post_table_queue",  conf->post_table_queue);
+  append_metrics_queue(content, "post_queue",        conf->post_queue);
+  append_metrics_queue(content, "index_queue",       conf->index_queue);
+
+  if (conf->table_list_mutex == NULL)
+    return;
+  GList *l;
+  struct db_table *dbt=NULL;
+  g_mutex_lock(conf->table_list_mutex);
+  append_metrics_header(content, "myloader_table_rows", "counter", "Rows inserted per table");
+  for (l=conf->table_list; l; l=l->next){
+    dbt=l->data;
+    append_metrics_table(content, "myloader_table_rows", dbt, dbt->rows_inserted);
+  }
+  append_metrics_header(content, "myloader_table_remaining_bytes", "gauge", "Size of the data files not loaded yet per table");
+  for (l=conf->table_list; l; l=l->next){
+    dbt=l->data;
+    append_metrics_table(content, "myloader_table_remaining_bytes", dbt, dbt->remaining_size);
+  }
+  append_metrics_header(content, "myloader_table_threads", "gauge", "Threads loading each table");
+  for (l=conf->table_list; l; l=l->next){
+    dbt=l->data;
+    append_metrics_table(content, "myloader_table_threads", dbt, dbt->current_threads);
+  }
+  append_metrics_header(content, "myloader_table_max_threads", "gauge", "Threads allowed on each table");
+  for (l=conf->table_list; l; l=l->next){
+    dbt=l->data;
+    append_metrics_table(content, "myloader_table_max_threads", dbt, dbt->max_threads);
+  }
+  g_mutex_unlock(conf->table_list_mutex);
+}
@@ -16,3 +16,4 @@
 */
 
 void write_myloader_pmm_entries(const gchar* filename, GString *content, struct configuration* conf);
+void write_myloader_metrics_entries(GString *content, void *conf);
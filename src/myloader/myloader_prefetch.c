@@ -0,0 +1,299 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#define _GNU_SOURCE
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "myloader.h"
+#include "myloader_global.h"
+#include "myloader_process.h"
+#include "myloader_restore_job.h"
+#include "myloader_prefetch.h"
+
+#define PREFETCH_READ_SIZE 1048576
+
+guint prefetch_files=0;
+guint prefetch_memory=1024;
+
+struct prefetched_file{
+  gchar *buffer;
+  gsize size;
+  // bytes taken from --prefetch-memory
+  guint64 reserved;
+  // a prefetch thread is reading it, a loader that opens it waits for it
+  gboolean started;
+  gboolean ready;
+};
+
+struct prefetched_reader{
+  struct prefetched_file *pf;
+  gsize position;
+};
+
+static GAsyncQueue *prefetch_queue=NULL;
+static GThread **prefetch_threads=NULL;
+static GMutex *prefetch_mutex=NULL;
+static GCond *prefetch_cond=NULL;
+// path of the file -> its prefetched_file, until it is opened
+static GHashTable *prefetched_files=NULL;
+static guint64 prefetch_memory_used=0;
+static gchar end_prefetch[]="";
+// myl_open() is also used by the prefetch threads to read the files
+static __thread gboolean prefetching=FALSE;
+
+static
+void free_prefetched_file(struct prefetched_file *pf){
+  g_mutex_lock(prefetch_mutex);
+  prefetch_memory_used-=pf->reserved;
+  g_mutex_unlock(prefetch_mutex);
+  g_free(pf->buffer);
+  g_free(pf);
+}
+
+static
+gboolean reserve_prefetch_memory(struct prefetched_file *pf, guint64 size){
+  gboolean fits;
+  g_mutex_lock(prefetch_mutex);
+  fits= prefetch_memory_used + size <= (guint64)prefetch_memory * 1024 * 1024;
+  if (fits){
+    prefetch_memory_used+=size;
+    pf->reserved+=size;
+  }
+  g_mutex_unlock(prefetch_mutex);
+  return fits;
+}
+
+/* The size of the file is checked before reading it, and it is not
+   prefetched when it does not fit in what is left of --prefetch-memory. For
+   compressed files it is a lower bound, and the reservation keeps growing
+   while they are decompressed. Files that are not on the storage, as the
+   bundled ones, are only bound while they are read */
+static
+gboolean read_prefetched_file(gchar *path, struct prefetched_file *pf){
+  GStatBuf st;
+  if (g_stat(path, &st) == 0 && S_ISREG(st.st_mode)){
+    if (!reserve_prefetch_memory(pf, (guint64)st.st_size + 1))
+      return FALSE;
+    pf->buffer=g_malloc(pf->reserved);
+  }
+  FILE *file=myl_open(path, "r");
+  if (!file)
+    return FALSE;
+  gsize n;
+  gboolean fits=TRUE;
+  do {
+    if (pf->size == pf->reserved){
+      fits=reserve_prefetch_memory(pf, PREFETCH_READ_SIZE);
+      if (!fits)
+        break;
+      pf->buffer=g_realloc(pf->buffer, pf->reserved);
+    }
+    n=fread(pf->buffer + pf->size, 1, pf->reserved - pf->size, file);
+    pf->size+=n;
+  } while (n > 0);
+  gboolean ok= fits && !ferror(file);
+  myl_close(path, file, FALSE);
+  return ok;
+}
+
+static
+void *prefetch_thread(void *data){
+  (void) data;
+  prefetching=TRUE;
+  gchar *path=NULL;
+  struct prefetched_file *pf=NULL;
+  for (;;){
+    path=g_async_queue_pop(prefetch_queue);
+    if (path == end_prefetch)
+      break;
+    g_mutex_lock(prefetch_mutex);
+    pf=g_hash_table_lookup(prefetched_files, path);
+    // a loader opened it before it was started, and read it from the storage
+    if (pf)
+      pf->started=TRUE;
+    g_mutex_unlock(prefetch_mutex);
+    if (pf == NULL){
+      g_free(path);
+      continue;
+    }
+    // once it is ready, pf belongs to the loader thread that opens it
+    gboolean ready=read_prefetched_file(path, pf);
+    if (ready){
+      trace("File %s prefetched, %"G_GSIZE_FORMAT" bytes", path, pf->size);
+      g_mutex_lock(prefetch_mutex);
+      pf->ready=TRUE;
+    }else{
+      // the loader thread reads the file from the storage
+      trace("File %s could not be prefetched", path);
+      g_mutex_lock(prefetch_mutex);
+      g_hash_table_remove(prefetched_files, path);
+      prefetch_memory_used-=pf->reserved;
+      pf->reserved=0;
+    }
+    g_cond_broadcast(prefetch_cond);
+    g_mutex_unlock(prefetch_mutex);
+    if (!ready)
+      free_prefetched_file(pf);
+    g_free(path);
+  }
+  return NULL;
+}
+
+void initialize_prefetch(){
+  guint n;
+  if (prefetch_files == 0)
+    return;
+  prefetch_mutex=g_mutex_new();
+  prefetch_cond=g_cond_new();
+  prefetched_files=g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  prefetch_queue=g_async_queue_new();
+  register_queue_stats("prefetch", prefetch_queue);
+  prefetch_threads=g_new(GThread *, num_threads);
+  for (n = 0; n < num_threads; n++)
+    prefetch_threads[n]=m_thread_new("myl_prefetch", (GThreadFunc)prefetch_thread, NULL, "Prefetch thread could not be created");
+}
+
+/* Called with the table locked, when a job of the table is handed to a
+   loader thread, to read the files of the prefetch_files jobs that are going
+   to be taken next. Ranges are read from an offset and tablespaces are
+   copied into the datadir, so they are not prefetched */
+void prefetch_next_data_jobs(GPtrArray *restore_job_heap){
+  guint i, n;
+  if (prefetch_queue == NULL)
+    return;
+  guint *next=g_new(guint, prefetch_files);
+  n=restore_job_heap_next(restore_job_heap, prefetch_files, next);
+  for (i = 0; i < n; i++){
+    struct restore_job *rj=g_ptr_array_index(restore_job_heap, next[i]);
+    struct data_restore_job *drj=rj->data.drj;
+    if (drj->prefetch_requested || drj->length > 0 || drj->is_tablespace)
+      continue;
+    gchar *path=g_build_filename(directory, rj->filename, NULL);
+    g_mutex_lock(prefetch_mutex);
+    // at most prefetch_files per loader thread are waiting to be opened
+    if (g_hash_table_size(prefetched_files) >= prefetch_files * num_threads){
+      g_mutex_unlock(prefetch_mutex);
+      g_free(path);
+      break;
+    }
+    drj->prefetch_requested=TRUE;
+    if (g_hash_table_lookup(prefetched_files, path)){
+      g_mutex_unlock(prefetch_mutex);
+      g_free(path);
+      continue;
+    }
+    g_hash_table_insert(prefetched_files, g_strdup(path), g_new0(struct prefetched_file, 1));
+    g_mutex_unlock(prefetch_mutex);
+    g_async_queue_push(prefetch_queue, path);
+  }
+  g_free(next);
+}
+
+static
+ssize_t prefetched_reader_read(void *cookie, char *buf, size_t size){
+  struct prefetched_reader *pr=cookie;
+  gsize n= pr->pf->size - pr->position < size ? pr->pf->size - pr->position : size;
+  memcpy(buf, pr->pf->buffer + pr->position, n);
+  pr->position+=n;
+  return n;
+}
+
+static
+int prefetched_reader_seek(void *cookie, off64_t *offset, int whence){
+  struct prefetched_reader *pr=cookie;
+  off64_t target;
+  switch (whence){
+    case SEEK_SET:
+      target=*offset;
+      break;
+    case SEEK_CUR:
+      target=pr->position + *offset;
+      break;
+    case SEEK_END:
+      target=pr->pf->size + *offset;
+      break;
+    default:
+      return -1;
+  }
+  if (target < 0 || (guint64)target > pr->pf->size)
+    return -1;
+  pr->position=target;
+  *offset=target;
+  return 0;
+}
+
+static
+int prefetched_reader_close(void *cookie){
+  struct prefetched_reader *pr=cookie;
+  free_prefetched_file(pr->pf);
+  g_free(pr);
+  return 0;
+}
+
+/* Returns the file from memory if it was prefetched, waiting for it if it is
+   being read, or NULL if the loader thread has to open it. A file that no
+   prefetch thread started yet is taken out of the queue instead of waiting */
+FILE *prefetch_fopen(const gchar *filename){
+  if (prefetched_files == NULL || prefetching)
+    return NULL;
+  g_mutex_lock(prefetch_mutex);
+  struct prefetched_file *pf=g_hash_table_lookup(prefetched_files, filename);
+  while (pf && pf->started && !pf->ready){
+    g_cond_wait(prefetch_cond, prefetch_mutex);
+    pf=g_hash_table_lookup(prefetched_files, filename);
+  }
+  if (pf)
+    g_hash_table_remove(prefetched_files, filename);
+  g_mutex_unlock(prefetch_mutex);
+  if (pf == NULL)
+    return NULL;
+  if (!pf->started){
+    trace("File %s opened before it was prefetched", filename);
+    free_prefetched_file(pf);
+    return NULL;
+  }
+  struct prefetched_reader *pr=g_new0(struct prefetched_reader, 1);
+  pr->pf=pf;
+  cookie_io_functions_t io_functions = { &prefetched_reader_read, NULL, &prefetched_reader_seek, &prefetched_reader_close };
+  FILE *file=fopencookie(pr, "r", io_functions);
+  if (!file)
+    prefetched_reader_close(pr);
+  return file;
+}
+
+void finalize_prefetch(){
+  guint n;
+  if (prefetch_queue == NULL)
+    return;
+  for (n = 0; n < num_threads; n++)
+    g_async_queue_push(prefetch_queue, end_prefetch);
+  for (n = 0; n < num_threads; n++)
+    g_thread_join(prefetch_threads[n]);
+  g_free(prefetch_threads);
+  // the files of the jobs that were not executed
+  GHashTableIter iter;
+  gpointer key, value;
+  g_hash_table_iter_init(&iter, prefetched_files);
+  while (g_hash_table_iter_next(&iter, &key, &value))
+    free_prefetched_file(value);
+  g_hash_table_destroy(prefetched_files);
+  prefetched_files=NULL;
+}
@@ -0,0 +1,32 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#ifndef _src_myloader_prefetch_h
+#define _src_myloader_prefetch_h
+
+#include <glib.h>
+#include <stdio.h>
+#include "myloader.h"
+
+/* With --prefetch-files the next data jobs of a table are read, and
+   decompressed, by the prefetch threads when a job of the table is handed to
+   a loader thread. The loader finds the file in memory when it opens it */
+void initialize_prefetch();
+void prefetch_next_data_jobs(GPtrArray *restore_job_heap);
+FILE *prefetch_fopen(const gchar *filename);
+void finalize_prefetch();
+#endif
@@ -36,6 +36,12 @@
 #include "myloader_database.h"
 #include "myloader_directory.h"
 #include "myloader_worker_schema.h"
+#include "myloader_worker_post.h"
+#include "myloader_worker_loader_main.h"
+#include "myloader_shard.h"
+#include "myloader_exchange_partition.h"
+#include "myloader_prefetch.h"
+#include "myloader_bundle.h"
 
 
 struct replication_statements *replication_statements=NULL;
@@ -64,7 +70,18 @@ FILE * myl_open(char *filename, const char *type){
   (void) child_proc;
   gchar **command=NULL;
   struct stat a;
-  if (get_command_and_basename(filename, &command,&basename)){
+  if ((file=prefetch_fopen(filename)) != NULL)
+    return file;
+  gchar *blob=resolve_content_store_path(filename);
+  if (blob)
+    filename=blob;
+  if (is_in_process_decompression_available(filename)){
+    file=open_decompressed_file(filename);
+  }else if ((file=stream_memory_fopen(filename)) != NULL){
+    // kept in memory by the stream thread
+  }else if ((file=bundle_fopen(filename)) != NULL){
+    // packed by mydumper --bundle-tables-under
+  }else if (get_command_and_basename(filename, &command,&basename)){
 
 
     fifoname=basename;
@@ -116,8 +133,10 @@ FILE * myl_open(char *filename, const char *type){
       file=NULL;
     }else{
       file=g_fopen(filename, type);
+      advise_sequential_read(file);
     }
   }
+  g_free(blob);
   return file;
 }
 
@@ -125,6 +144,8 @@ void myl_close(const char *filename, FILE *file, gboolean rm){
   g_mutex_lock(fifo_table_mutex);
   struct fifo *f=g_hash_table_lookup(fifo_hash,file);
   g_mutex_unlock(fifo_table_mutex);
+  if (f == NULL)
+    release_read_pages(file);
   fclose(file);
 
   if (f != NULL){
@@ -136,7 +157,7 @@ void myl_close(const char *filename, FILE *file, gboolean rm){
 
     remove(f->stdout_filename);
   }
-  if (rm){
+  if (rm && !stream_memory_remove(filename)){
     m_remove(NULL,filename);
   }
 }
@@ -173,41 +194,21 @@ gboolean parse_create_table_from_file(struct db_table *dbt, gchar *filename){
             g_error("Identifier quote character (%s) not found on %s. Review file and configure --identifier-quote-character properly", identifier_quote_character_str, filename);
             return FALSE;
           }
-//          {
-            GError *err= NULL;
-            GMatchInfo *match_info;
-            char *expr= g_strdup_printf("CREATE\\s+TABLE\\s+[^%c]*%c(.+?)%c\\s*\\(", identifier_quote_character, identifier_quote_character, identifier_quote_character);
-            /*
-              G_REGEX_DOTALL: A dot metacharacter (".") in the pattern matches
-              all characters, including newlines. Without it, newlines are excluded. This
-              option can be changed within a pattern by a ("?s") option setting.
-
-              G_REGEX_ANCHORED: The pattern is forced to be "anchored", that is,
-              it is constrained to match only at the first matching point in the string that
-              is being searched. This effect can also be achieved by appropriate constructs in
-              the pattern itself such as the "^" metacharacter.
-
-              G_REGEX_RAW: Usually strings must be valid UTF-8 strings, using
-              this flag they are considered as a raw sequence of bytes.
-            */
-            const GRegexCompileFlags flags= G_REGEX_CASELESS|G_REGEX_MULTILINE|G_REGEX_DOTALL|G_REGEX_ANCHORED|G_REGEX_RAW;
-            GRegex *regex= g_regex_new(expr, flags, 0, &err);
-            if (!regex)
-              goto regex_error;
-            if (!g_regex_match(regex, data->str, 0, &match_info) ||
-                !g_match_info_matches(match_info)) {
-              g_regex_unref(regex);
-regex_error:
-              g_free(expr);
-              g_error("Cannot parse real table name from CREATE TABLE statement:\n%s", data->str);
-              return FALSE;
+          if (append_if_not_exist){
+            if ((g_strstr_len(data->str,13,"CREATE TABLE ")) && !(g_strstr_len(data->str,15,"CREATE TABLE IF"))){
+              GString *tmp_data=g_string_sized_new(data->len);
+              g_string_append(tmp_data, "CREATE TABLE IF NOT EXISTS ");
+              g_string_append(tmp_data, &(data->str[13]));
+              g_string_free(data,TRUE);
+              data=tmp_data;
             }
-            dbt->create_table_name= g_match_info_fetch(match_info, 1);
-            g_regex_unref(regex);
-            if (!strlen(dbt->create_table_name))
-              goto regex_error;
-            g_free(expr);
-//          }
+          }
+          free_table_definition(dbt->table_definition);
+          dbt->table_definition=parse_table_definition(data->str);
+          if (dbt->table_definition->name == NULL)
+            g_error("Cannot parse real table name from CREATE TABLE statement:\n%s", data->str);
+          dbt->create_table_name=g_strdup(dbt->table_definition->name);
+          parse_shard_column_position(dbt, dbt->table_definition);
           if ( g_str_has_prefix(dbt->table_filename,"mydumper_") && !dbt->source_table_name){
             dbt->source_table_name=dbt->create_table_name;
 //            g_hash_table_insert(tbl_hash, dbt->table_filename, dbt->source_table_name);
@@ -217,15 +218,6 @@ regex_error:
 //            else
 //              g_hash_table_insert(tbl_hash, dbt->table_filename, dbt->create_table_name);
           }
-          if (append_if_not_exist){
-            if ((g_strstr_len(data->str,13,"CREATE TABLE ")) && !(g_strstr_len(data->str,15,"CREATE TABLE IF"))){
-              GString *tmp_data=g_string_sized_new(data->len);
-              g_string_append(tmp_data, "CREATE TABLE IF NOT EXISTS ");
-              g_string_append(tmp_data, &(data->str[13]));
-              g_string_free(data,TRUE);
-              data=tmp_data;
-            }
-          }
         }
         if (optimize_keys || skip_constraints || skip_indexes ){
           GString *alter_table_statement=g_string_sized_new(512);
@@ -236,8 +228,11 @@ regex_error:
             g_string_append(create_table_statement,data->str);
           }else{
             // Processing CREATE TABLE statement
-            int flag = // process_create_table_statement(data->str, create_table_statement, alter_table_statement, alter_table_constraint_statement, dbt, (dbt->rows == 0 || dbt->rows >= 1000000 || skip_constraints || skip_indexes));
-                      global_process_create_table_statement(data->str, create_table_statement, alter_table_statement, alter_table_constraint_statement, dbt->source_table_name?dbt->source_table_name:dbt->create_table_name, (dbt->rows == 0 || dbt->rows >= 10 || skip_constraints || skip_indexes));
+            // the CREATE TABLE was parsed above, any other statement is parsed here
+            struct table_definition *def= g_strstr_len(data->str,13,"CREATE TABLE ") ? dbt->table_definition : parse_table_definition(data->str);
+            int flag = process_table_definition(def, create_table_statement, alter_table_statement, alter_table_constraint_statement, dbt->source_table_name?dbt->source_table_name:dbt->create_table_name, (dbt->rows == 0 || dbt->rows >= 10 || skip_constraints || skip_indexes));
+            if (def != dbt->table_definition)
+              free_table_definition(def);
             if (flag & IS_TRX_TABLE){
               if (flag & IS_ALTER_TABLE_PRESENT){
 //                finish_alter_table(alter_table_statement);
@@ -255,7 +250,7 @@ regex_error:
               }
               if (!skip_constraints && (flag & INCLUDE_CONSTRAINT)){
                 struct restore_job *rj = new_schema_restore_job(strdup(filename),JOB_RESTORE_STRING,dbt, dbt->database, alter_table_constraint_statement, CONSTRAINTS);
-                g_async_queue_push(_conf->post_table_queue, new_control_job(JOB_RESTORE,rj,dbt->database));
+                register_constraint_job(dbt, rj);
                 dbt->constraints=alter_table_constraint_statement;
               }else{
                  g_string_free(alter_table_constraint_statement,TRUE);
@@ -406,7 +401,7 @@ gboolean process_schema_sequence_filename(gchar *filename) {
   }
   append_new_db_table(&dbt, _database, NULL, table_name);//, 0, NULL);
   dbt->is_sequence= TRUE;
-  dbt->schema_state= NOT_CREATED;
+  set_table_schema_state(dbt, NOT_CREATED);
 /*  struct restore_job *rj = new_schema_restore_job(filename, JOB_RESTORE_SCHEMA_FILENAME, dbt, _database, NULL, SEQUENCE );
   struct schema_job *sj= new_schema_job(JOB_RESTORE,rj,_database);
   g_mutex_lock(_database->mutex);
@@ -468,7 +463,7 @@ gboolean process_table_filename(char * filename){
 
   append_new_db_table(&dbt, _database, NULL, table_name);//,0,NULL);
   if (dbt->schema_state<NOT_CREATED){
-    dbt->schema_state=NOT_CREATED;
+    set_table_schema_state(dbt, NOT_CREATED);
   }else{
     // parsing was already done
     trace("Processing table filename: %s was already done", filename);
@@ -502,8 +497,113 @@ gboolean process_table_filename(char * filename){
 
 gboolean first_metadata_processed=FALSE;
 
+/* Single pass over the keys of the table group, a lookup per known key
+   means a GError for every key that is not present */
+static
+void load_table_metadata(GKeyFile *kf, gchar *group, struct db_table *dbt){
+  gsize num_keys=0, i;
+  gchar **keys=g_key_file_get_keys(kf, group, &num_keys, NULL);
+  gchar *value=NULL;
+  gboolean has_chunk_checksums=FALSE, has_partition_files=FALSE, has_file_checksums=FALSE;
+  for (i=0; i < num_keys; i++){
+    if (g_str_has_prefix(keys[i], "chunk_checksum_")){
+      has_chunk_checksums=TRUE;
+      continue;
+    }
+    if (g_str_has_prefix(keys[i], "partition_files_")){
+      has_partition_files=TRUE;
+      continue;
+    }
+    if (g_str_has_prefix(keys[i], "file_checksum_")){
+      has_file_checksums=TRUE;
+      continue;
+    }
+    value=g_key_file_get_value(kf, group, keys[i], NULL);
+    if (value == NULL)
+      continue;
+    if (!strcmp(keys[i], "data_checksum") && !dbt->object_to_export.no_data){
+      dbt->data_checksum=value;
+    }else if (!strcmp(keys[i], "schema_checksum") && !dbt->object_to_export.no_schema){
+      dbt->schema_checksum=value;
+    }else if (!strcmp(keys[i], "indexes_checksum") && !dbt->object_to_export.no_schema){
+      dbt->indexes_checksum=value;
+    }else if (!strcmp(keys[i], "triggers_checksum") && !dbt->object_to_export.no_trigger){
+      dbt->triggers_checksum=value;
+    }else{
+      if (!strcmp(keys[i], "is_view") && !strcmp(value, "1")){
+        dbt->is_view=TRUE;
+      }else if (!strcmp(keys[i], "is_sequence") && !strcmp(value, "1")){
+        dbt->is_sequence=TRUE;
+        ++sequences;
+      }else if (!strcmp(keys[i], "rows")){
+        dbt->rows=g_ascii_strtoull(value, NULL, 10);
+      }else if (!strcmp(keys[i], "statement_max_rows")){
+        dbt->statement_max_rows=g_ascii_strtoull(value, NULL, 10);
+      }
+      g_free(value);
+    }
+  }
+  g_strfreev(keys);
+  if (has_chunk_checksums && !dbt->object_to_export.no_data && !no_data)
+    load_chunk_checksums(kf, group, dbt);
+  if (has_partition_files && !dbt->object_to_export.no_data && !no_data)
+    load_partition_files(kf, group, dbt);
+  if (has_file_checksums)
+    load_file_checksums(kf, group);
+}
+
+/* Partial metadata of mydumper --stream, see append_metadata_delta(): the
+   records are applied one by one, the tables are added as in the groups of
+   the metadata */
+static
+void process_metadata_delta_filename(gchar *file){
+  gchar *path=g_build_filename(directory, file, NULL);
+  FILE *delta=g_fopen(path, "r");
+  g_free(path);
+  if (!delta){
+    g_critical("Could not open %s: %s", file, strerror(errno));
+    errors++;
+    g_free(file);
+    return;
+  }
+  message("Reading metadata: %s", file);
+  gchar *line=NULL;
+  size_t size=0;
+  ssize_t len;
+  guint records=0;
+  while ((len=getline(&line, &size, delta)) > 0){
+    if (line[len-1] == '\n')
+      line[len-1]='\0';
+    gchar **fields=g_strsplit(line, "\t", 4);
+    if (g_strv_length(fields) != 4){
+      g_warning("Wrong record in %s: %s", file, line);
+      g_strfreev(fields);
+      continue;
+    }
+    if (!source_db || g_strcmp0(fields[0], source_db) == 0){
+      struct database *_database=get_database(fields[0], fields[0]);
+      struct db_table *dbt=NULL;
+      append_new_db_table(&dbt, _database, newline_unprotect(fields[3]), fields[1]);
+      dbt->rows=g_ascii_strtoull(fields[2], NULL, 10);
+      records++;
+    }
+    g_strfreev(fields);
+  }
+  free(line);
+  fclose(delta);
+  trace("metadata: %u tables updated by %s", records, file);
+  if (stream)
+    metadata_has_been_processed();
+  m_remove(directory, file);
+  g_free(file);
+}
+
 void process_metadata_global_filename(gchar *file, GOptionContext * local_context)
 {
+  if (g_str_has_suffix(file, METADATA_DELTA_SUFFIX)){
+    process_metadata_delta_filename(file);
+    return;
+  }
   gchar *path = g_build_filename(directory, file, NULL);
   GKeyFile * kf = load_config_file(path);
   if (kf==NULL)
@@ -591,6 +691,8 @@ void process_metadata_global_filename(gchar *file, GOptionContext * local_contex
       trace("Ignoring [config] from metadata as it was already processed");
     }else if (g_strstr_len(group, 26,"myloader_session_variables")){
       trace("Ignoring [myloader_session_variables] from metadata as it was already processed");
+    }else if (!g_strcmp0(group, "auto_threads")){
+      throttle_control_start_from(g_key_file_get_integer(kf, group, "threads", NULL));
     } else if (g_str_has_prefix(group, wrong_quote))
       g_error("metadata is broken: group %s has wrong quoting: %s; must be: %c", group, wrong_quote, identifier_quote_character);
     else if (g_str_has_prefix(group, identifier_quote_character_str)) {
@@ -601,34 +703,15 @@ void process_metadata_global_filename(gchar *file, GOptionContext * local_contex
           struct database *_database=get_database(database_table[0],database_table[0]);
 //          gchar *table_filename=g_strdup(database_table[1]);
          
-          value= get_value(kf, groups[j], "real_table_name");
+          value= g_key_file_get_value(kf, groups[j], "real_table_name", NULL);
           if (value){
             trace("real_table_name= %s", value);
             real_table_name= newline_unprotect(value);
             g_free(value);
           }
           append_new_db_table(&dbt, _database, real_table_name, database_table[1]);//, real_table_name);//,0,NULL);
-//          if (real_table_name) g_free(real_table_name);
-  //        if (table_filename) g_free(table_filename);
           real_table_name=NULL;
-          dbt->data_checksum=    dbt->object_to_export.no_data   ?NULL:get_value(kf,groups[j],"data_checksum");
-          dbt->schema_checksum=  dbt->object_to_export.no_schema ?NULL:get_value(kf,groups[j],"schema_checksum");
-          dbt->indexes_checksum= dbt->object_to_export.no_schema ?NULL:get_value(kf,groups[j],"indexes_checksum");
-          dbt->triggers_checksum=dbt->object_to_export.no_trigger?NULL:get_value(kf,groups[j],"triggers_checksum");
-          value=get_value(kf,groups[j],"is_view");
-          if (value != NULL && g_strcmp0(value,"1")==0){
-            dbt->is_view=TRUE;
-          }
-          if (value) g_free(value);
-          value=get_value(kf, groups[j], "is_sequence");
-          if (value != NULL && g_strcmp0(value, "1") == 0){
-            dbt->is_sequence= TRUE;
-            ++sequences;
-          }
-          if (value) g_free(value);
-          if (get_value(kf,groups[j],"rows")){
-            dbt->rows=g_ascii_strtoull(get_value(kf,groups[j],"rows"),NULL, 10);
-          }
+          load_table_metadata(kf, groups[j], dbt);
         }
       } else {
         database_table[0][strlen(database_table[0])-1]='\0';
@@ -701,20 +784,228 @@ gboolean process_schema_post_filename(gchar *filename, enum restore_job_statemen
   return TRUE; // SCHEMA_VIEW
 }
 
+/* Reads the .idx that mydumper --data-index writes next to the data file and
+   groups its statements in up to max_ranges ranges of similar size. Returns
+   NULL if there is no index or if the file can not be split */
+static
+GArray *get_data_file_ranges(const gchar *filename, guint max_ranges, guint64 *header_length){
+  gchar *path=content_store_path(g_strdup_printf("%s/%s.idx", directory, filename));
+  gchar *content=NULL;
+  GArray *statements=NULL, *ranges=NULL;
+  guint64 total=0, offset, length, target, value[2];
+  guint i;
+  if (!g_file_get_contents(path, &content, NULL, NULL)){
+    g_free(path);
+    return NULL;
+  }
+  g_free(path);
+  gchar **lines=g_strsplit(content, "\n", -1);
+  g_free(content);
+  if (lines[0] == NULL || !g_str_has_prefix(lines[0], "header ")){
+    g_strfreev(lines);
+    return NULL;
+  }
+  *header_length=g_ascii_strtoull(lines[0] + 7, NULL, 10);
+  statements=g_array_new(FALSE, FALSE, sizeof(guint64) * 2);
+  for (i = 1; lines[i] != NULL; i++){
+    gchar **fields=g_strsplit(lines[i], " ", 3);
+    if (g_strv_length(fields) == 3){
+      value[0]=g_ascii_strtoull(fields[0], NULL, 10);
+      value[1]=g_ascii_strtoull(fields[1], NULL, 10);
+      g_array_append_val(statements, value);
+      total+=value[1];
+    }
+    g_strfreev(fields);
+  }
+  g_strfreev(lines);
+  if (max_ranges > statements->len)
+    max_ranges=statements->len;
+  if (max_ranges > 1){
+    ranges=g_array_new(FALSE, FALSE, sizeof(guint64) * 2);
+    target=total / max_ranges;
+    offset=g_array_index(statements, guint64, 0);
+    length=0;
+    for (i = 0; i < statements->len; i++){
+      length+=g_array_index(statements, guint64, 2 * i + 1);
+      if (length >= target && ranges->len + 1 < max_ranges){
+        value[0]=offset;
+        value[1]=length;
+        g_array_append_val(ranges, value);
+        offset+=length;
+        length=0;
+      }
+    }
+    if (length > 0){
+      value[0]=offset;
+      value[1]=length;
+      g_array_append_val(ranges, value);
+    }
+  }
+  g_array_free(statements, TRUE);
+  return ranges;
+}
+
+#define SPLIT_SCAN_SIZE 1024*1024
+
+// the statements that mydumper writes with --insert-ignore and --replace too
+static const gchar *split_insert_prefixes[]={"INSERT INTO ", "INSERT IGNORE INTO ", "REPLACE INTO ", NULL};
+
+// Returns the offset where the first statement after from starts, 0 if none
+static
+guint64 find_next_insert(FILE *file, guint64 from, gchar *buffer, const gchar *boundary){
+  gsize keep=0, n, boundary_len=strlen(boundary);
+  // offset of buffer[0] in the file
+  guint64 position=from;
+  if (fseek(file, from, SEEK_SET))
+    return 0;
+  while ((n=fread(buffer + keep, 1, SPLIT_SCAN_SIZE - keep, file)) > 0){
+    n+=keep;
+    gchar *found=g_strstr_len(buffer, n, boundary);
+    if (found)
+      return position + (found - buffer) + 2;
+    // the boundary might be split between blocks
+    keep= n < boundary_len ? n : boundary_len - 1;
+    memmove(buffer, buffer + n - keep, keep);
+    position+=n - keep;
+  }
+  return 0;
+}
+
+/* Returns the boundary between the statements of the file, a ";\n" followed
+   by the prefix of its first statement, and sets start to where it is. NULL
+   if the file has no statements */
 static
-gint cmp_restore_job(gconstpointer rj1, gconstpointer rj2){
-  if (((struct restore_job *)rj1)->data.drj->part != ((struct restore_job *)rj2)->data.drj->part ){
-    guint a=((struct restore_job *)rj1)->data.drj->part, b=((struct restore_job *)rj2)->data.drj->part;
-    while ( a%2 == b%2 ){
-      a=a>>1;
-      b=b>>1;
+gchar *find_split_boundary(FILE *file, gchar *buffer, guint64 *start){
+  gsize n=fread(buffer, 1, SPLIT_SCAN_SIZE, file);
+  guint i, first=0;
+  guint64 offset;
+  *start=0;
+  for (i = 0; split_insert_prefixes[i]; i++)
+    if (n >= strlen(split_insert_prefixes[i]) && g_str_has_prefix(buffer, split_insert_prefixes[i]))
+      return g_strconcat(";\n", split_insert_prefixes[i], NULL);
+  for (i = 0; split_insert_prefixes[i]; i++){
+    gchar *boundary=g_strconcat(";\n", split_insert_prefixes[i], NULL);
+    offset=find_next_insert(file, 0, buffer, boundary);
+    g_free(boundary);
+    if (offset > 0 && (*start == 0 || offset < *start)){
+      *start=offset;
+      first=i;
     }
-    return a%2 > b%2;
   }
-  return ((struct restore_job *)rj1)->data.drj->sub_part > ((struct restore_job *)rj2)->data.drj->sub_part;
+  return *start > 0 ? g_strconcat(";\n", split_insert_prefixes[first], NULL) : NULL;
 }
 
-gboolean process_data_filename(char * filename){
+/* Splits a data file without .idx in byte ranges. The header is everything
+   before the first statement and every range starts after a ";\n" that is
+   followed by the same INSERT, INSERT IGNORE or REPLACE. Values can not have a raw newline, as they are
+   escaped by mydumper and mysqldump, so this always is a statement boundary.
+   With --mysqldump the stream writes the data of each table in its own file,
+   which is split here as well */
+static
+GArray *split_data_file(const gchar *filename, guint max_ranges, guint64 *header_length){
+  gchar *path=content_store_path(g_build_filename(directory, filename, NULL));
+  GStatBuf st;
+  GArray *ranges=NULL;
+  guint64 value[2], start, next, size;
+  guint i;
+  if (g_stat(path, &st) != 0 || (guint64)st.st_size < (guint64)split_file_size * 1024 * 1024){
+    g_free(path);
+    return NULL;
+  }
+  size=st.st_size;
+  FILE *file=g_fopen(path, "r");
+  g_free(path);
+  if (!file)
+    return NULL;
+  gchar *buffer=g_malloc(SPLIT_SCAN_SIZE);
+  gchar *boundary=find_split_boundary(file, buffer, &start);
+  if (boundary == NULL)
+    goto cleanup;
+  *header_length=start;
+  ranges=g_array_new(FALSE, FALSE, sizeof(guint64) * 2);
+  for (i = 1; i < max_ranges; i++){
+    next=find_next_insert(file, *header_length + (size - *header_length) * i / max_ranges, buffer, boundary);
+    if (next == 0)
+      break;
+    if (next <= start)
+      continue;
+    value[0]=start;
+    value[1]=next - start;
+    g_array_append_val(ranges, value);
+    start=next;
+  }
+  value[0]=start;
+  value[1]=size - start;
+  g_array_append_val(ranges, value);
+  if (ranges->len < 2){
+    g_array_free(ranges, TRUE);
+    ranges=NULL;
+  }
+cleanup:
+  g_free(boundary);
+  g_free(buffer);
+  fclose(file);
+  return ranges;
+}
+
+/* A data file of mydumper --seekable-zstd is split on the frames, which end
+   on a statement, so the threads only decompress their own frames */
+static
+GArray *split_seekable_data_file(const gchar *filename, guint max_ranges, guint64 *header_length){
+  gchar *path=content_store_path(g_build_filename(directory, filename, NULL));
+  GArray *frames=get_seekable_frame_offsets(path), *ranges=NULL;
+  FILE *file=NULL;
+  gchar *buffer=NULL, *boundary=NULL;
+  guint64 value[2], start, offset, total, target;
+  guint i;
+  if (frames == NULL || frames->len < 3 || (file=open_decompressed_file(path)) == NULL)
+    goto cleanup;
+  buffer=g_malloc(SPLIT_SCAN_SIZE);
+  boundary=find_split_boundary(file, buffer, &start);
+  if (boundary == NULL)
+    goto cleanup;
+  *header_length=start;
+  total=g_array_index(frames, guint64, frames->len - 1);
+  target=(total - start) / max_ranges;
+  ranges=g_array_new(FALSE, FALSE, sizeof(guint64) * 2);
+  for (i = 1; i + 1 < frames->len && ranges->len + 1 < max_ranges; i++){
+    offset=g_array_index(frames, guint64, i);
+    if (offset <= start || offset - start < target)
+      continue;
+    value[0]=start;
+    value[1]=offset - start;
+    g_array_append_val(ranges, value);
+    start=offset;
+  }
+  value[0]=start;
+  value[1]=total - start;
+  g_array_append_val(ranges, value);
+  if (ranges->len < 2){
+    g_array_free(ranges, TRUE);
+    ranges=NULL;
+  }
+cleanup:
+  g_free(boundary);
+  g_free(buffer);
+  if (file)
+    fclose(file);
+  if (frames)
+    g_array_free(frames, TRUE);
+  g_free(path);
+  return ranges;
+}
+
+static
+void append_data_restore_job(struct db_table *dbt, struct restore_job *rj){
+  table_lock(dbt);
+  g_atomic_int_add(&(dbt->remaining_jobs), 1);
+  dbt->count++; 
+  dbt->remaining_size+=rj->data.drj->size;
+  restore_job_heap_push(dbt->restore_job_heap, rj);
+  table_unlock(dbt);
+}
+
+gboolean process_data_filename(char * filename, enum file_type file_type){
   gchar *db_name, *table_name;
   // TODO: check if it is a data file
   // TODO: we need to count sections of the data file to determine if it is ok.
@@ -733,8 +1024,13 @@ gboolean process_data_filename(char * filename){
   struct db_table *dbt=NULL;
   if (append_new_db_table(&dbt, _database, NULL, table_name)){
     if (!has_been_defined_a_target_database()){
-      gchar *schema_filename=common_build_schema_table_filename(directory, _database->target_database, table_name, "schema");
-      if (g_file_test(schema_filename,G_FILE_TEST_EXISTS)){
+      gchar *schema_filename=content_store_path(common_build_schema_table_filename(directory, _database->target_database, table_name, "schema"));
+      gchar *schema_basename=g_path_get_basename(schema_filename);
+      guint64 schema_size=0;
+      gboolean schema_exists= file_manifest_loaded() ? file_manifest_has(schema_basename) :
+                              g_file_test(schema_filename,G_FILE_TEST_EXISTS) || bundle_size(schema_basename, &schema_size);
+      g_free(schema_basename);
+      if (schema_exists){
         schema_filename=common_build_schema_table_filename(NULL, _database->database_name_in_filename, table_name, "schema");
         trace("Filename %s detected and send to process", schema_filename);
         process_table_filename(schema_filename);
@@ -742,13 +1038,48 @@ gboolean process_data_filename(char * filename){
     }
   }
 	if (!dbt->object_to_export.no_data){
-    struct restore_job *rj = new_data_restore_job( g_strdup(filename), JOB_RESTORE_FILENAME, dbt, part, sub_part);
-    table_lock(dbt);
-    g_atomic_int_add(&(dbt->remaining_jobs), 1);
-    dbt->count++; 
-    dbt->restore_job_list=g_list_insert_sorted(dbt->restore_job_list,rj,&cmp_restore_job);
-//  dbt->restore_job_list=g_list_append(dbt->restore_job_list,rj);
-    table_unlock(dbt);
+    guint64 header_length=0;
+    // only plain and seekable zstd files can be read from an offset
+    GArray *ranges=NULL;
+    if (file_type == DATA && g_str_has_suffix(filename, ".sql") && dbt->max_threads_limit > 1){
+      ranges=get_data_file_ranges(filename, dbt->max_threads_limit, &header_length);
+      if (ranges == NULL && split_file_size > 0)
+        ranges=split_data_file(filename, dbt->max_threads_limit, &header_length);
+    }else if (file_type == DATA && g_str_has_suffix(filename, ".sql" ZSTD_EXTENSION) && dbt->max_threads_limit > 1)
+      ranges=split_seekable_data_file(filename, dbt->max_threads_limit, &header_length);
+    if (ranges){
+      guint i;
+      gint *pending_ranges=g_new(gint, 1);
+      *pending_ranges=ranges->len;
+      trace("File %s is going to be restored in %u ranges", filename, ranges->len);
+      for (i = 0; i < ranges->len; i++){
+        struct restore_job *rj = new_data_restore_job( g_strdup(filename), JOB_RESTORE_FILENAME, dbt, part, sub_part);
+        rj->data.drj->header_length=header_length;
+        rj->data.drj->offset=g_array_index(ranges, guint64, 2 * i);
+        rj->data.drj->length=g_array_index(ranges, guint64, 2 * i + 1);
+        rj->data.drj->size=rj->data.drj->length;
+        rj->data.drj->pending_ranges=pending_ranges;
+        append_data_restore_job(dbt, rj);
+      }
+      total_data_sql_files+=ranges->len - 1;
+      g_array_free(ranges, TRUE);
+    }else{
+      struct restore_job *rj = new_data_restore_job( g_strdup(filename), JOB_RESTORE_FILENAME, dbt, part, sub_part);
+      rj->data.drj->is_binary= file_type == BINARY_DATA;
+      rj->data.drj->is_tablespace= file_type == TABLESPACE_DATA;
+      // the manifest saves a stat per file
+      if (!file_manifest_size(filename, &(rj->data.drj->size))){
+        GStatBuf st;
+        gchar *path=content_store_path(g_build_filename(directory, filename, NULL));
+        if (g_stat(path, &st) == 0)
+          rj->data.drj->size=st.st_size;
+        else if (!stream_memory_size(filename, &(rj->data.drj->size)))
+          bundle_size(filename, &(rj->data.drj->size));
+        g_free(path);
+      }
+      append_data_restore_job(dbt, rj);
+    }
+    data_table_ready(dbt);
 	}else{
     g_warning("Ignoring file %s on `%s`.`%s`",filename, dbt->database->source_database, dbt->table_filename);
 	}
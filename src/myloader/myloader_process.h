@@ -15,6 +15,7 @@
         Authors:    David Ducos, Percona (david dot ducos at percona dot com)
 */
 #define CONFIG "config"
+#define METADATA_DELTA_SUFFIX ".delta"
 #include <stdio.h>
 #include "myloader_restore_job.h"
 struct fifo{
@@ -31,7 +32,7 @@ void process_database_filename(char * filename);
 
 gboolean process_table_filename(char * filename);
 gboolean process_schema_post_filename(gchar *filename, enum restore_job_statement_type object);
-gboolean process_data_filename(char * filename);
+gboolean process_data_filename(char * filename, enum file_type file_type);
 gboolean process_schema_view_filename(gchar *filename);
 gboolean process_schema_sequence_filename(gchar *filename);
 
@@ -29,6 +29,8 @@
 #include "myloader_global.h"
 #include "myloader_database.h"
 #include "myloader_worker_schema.h"
+#include "myloader_stream.h"
+#include "myloader_binlog_delta.h"
 
 extern guint schema_counter;
 guint schema_processed_counter = 0;
@@ -103,14 +105,22 @@ void *process_file_type_worker(void *data){
         process_schema_sequence_filename(fti->filename); // pushed to table_queue if database is created, _database->sequence_queue otherwise 
         break;
       case SCHEMA_TABLE:
-        process_table_filename(fti->filename); // pushed to table_queue if database is created, _database->table_queue otherwise
+        process_table_filename(fti->filename); // pushed to schema_job_queue if database is created, waits on the database node otherwise
         g_atomic_int_inc(&schema_processed_counter);
         break;
+      case DATA_INDEX:
+        // read by process_data_filename() when the data file arrives
+        break;
+      case TABLESPACE_CFG:
+        // imported with the .ibd of the table
+        break;
       case DATA:
+      case BINARY_DATA:
+      case TABLESPACE_DATA:
         if (!no_data){
-          if (process_data_filename(fti->filename)) // added to dbt->restore_job_list 
+          if (process_data_filename(fti->filename, fti->file_type)) // added to dbt->restore_job_list 
             wake_data_threads();
-        }else
+        }else if (!stream_memory_remove(fti->filename))
           m_remove(directory,fti->filename);
         total_data_sql_files++;
         break;
@@ -130,6 +140,9 @@ void *process_file_type_worker(void *data){
         if (!skip_post)
           process_schema_post_filename(fti->filename, POST); // pushed to post_queue
         break;
+      case BINLOG_DELTA:
+        process_binlog_delta_filename(fti->filename); // restored after the data
+        break;
       case IGNORED:
         g_warning("Filename %s has been ignored", fti->filename);
         break;
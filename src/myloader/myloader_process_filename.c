@@ -29,6 +29,7 @@
 #include "myloader_database.h"
 #include "myloader_process_file_type.h"
 #include "myloader_worker_loader_main.h"
+#include "myloader_binlog_delta.h"
 guint schema_counter = 0;
 guint sequence_counter = 0;
 
@@ -61,10 +62,11 @@ void initialize_process_filename (struct configuration *c){
   if (stream)
     g_mutex_unlock(start_process_filename_thread);
   process_filename_queue_ended=FALSE;
+  // tables might be notified as ready as soon as the files are processed
+  initialize_worker_loader_main(c);
   process_filename_thread =
       m_thread_new("myloader_process_filename",(GThreadFunc)process_filename_worker, NULL, "Intermediate worker could not be created");
   initialize_process_file_type(c);
-  initialize_worker_loader_main(c);
 }
 
 void process_filename_push(const gchar *filename){
@@ -95,11 +97,32 @@ void process_filename_queue_incomplete(struct process_filename_filename * iflnm)
   g_async_queue_push(process_filename_queue, iflnm);
 }
 
+static
+gboolean is_filtered_by_source_db(const char *filename){
+  return source_db && !(g_str_has_prefix(filename, source_db) && strlen(filename) > strlen(source_db) && (filename[strlen(source_db)] == '.' || filename[strlen(source_db)] == '-') ) && !g_str_has_prefix(filename, "mydumper_");
+}
+
 static
 enum file_type get_file_type (const char * filename){
   if ( !g_strcmp0(filename,"END"))
     return FILENAME_ENDED; 
 
+  // it has the rows of all the databases of the dump
+  if (g_str_has_prefix(filename, BINLOG_DELTA_FILENAME))
+    return BINLOG_DELTA;
+
+  // mydumper already classified the files of its manifest
+  enum file_type ft;
+  if (file_manifest_file_type(filename, &ft)){
+    if (is_filtered_by_source_db(filename))
+      return IGNORED;
+    if (ft == SCHEMA_TABLE || ft == SCHEMA_CREATE)
+      g_atomic_int_inc(&schema_counter);
+    else if (ft == SCHEMA_SEQUENCE)
+      g_atomic_int_inc(&sequence_counter);
+    return ft;
+  }
+
   if ((!strcmp(filename,          "metadata") ||
        !strcmp(filename,          "metadata.header") ||
        g_str_has_prefix(filename, "metadata.partial"))
@@ -108,7 +131,7 @@ enum file_type get_file_type (const char * filename){
          has_exec_per_thread_extension(filename)))
     return METADATA_GLOBAL;
 
-  if (source_db && !(g_str_has_prefix(filename, source_db) && strlen(filename) > strlen(source_db) && (filename[strlen(source_db)] == '.' || filename[strlen(source_db)] == '-') ) && !g_str_has_prefix(filename, "mydumper_"))
+  if (is_filtered_by_source_db(filename))
     return IGNORED;
 
   if (m_filename_has_suffix(filename, "-schema.sql")){
@@ -148,12 +171,24 @@ enum file_type get_file_type (const char * filename){
     return SCHEMA_CREATE;
   }
 
+  if (g_str_has_suffix(filename, ".sql.idx") )
+    return DATA_INDEX;
+
   if (m_filename_has_suffix(filename, ".sql") )
     return DATA;
 
   if (m_filename_has_suffix(filename, ".dat"))
     return LOAD_DATA;
 
+  if (m_filename_has_suffix(filename, "." ROW_BINARY_EXTENSION))
+    return BINARY_DATA;
+
+  if (m_filename_has_suffix(filename, ".ibd"))
+    return TABLESPACE_DATA;
+
+  if (m_filename_has_suffix(filename, ".cfg"))
+    return TABLESPACE_CFG;
+
   return IGNORED;
 }
 
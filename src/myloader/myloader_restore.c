@@ -22,6 +22,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <zlib.h>
 
 #include "myloader.h"
 #include "myloader_common.h"
@@ -30,20 +31,43 @@
 #include "myloader_process.h"
 #include "myloader_restore.h"
 #include "myloader_database.h"
+#include "myloader_restore_job.h"
+#include "myloader_stream.h"
+#include "myloader_fan_out.h"
+#include "myloader_shard.h"
+#include "myloader_journal.h"
+#include "myloader_exchange_partition.h"
+#include "myloader_load_data.h"
+#include "myloader_ingest.h"
+
+/* Some earlier versions of MySQL do not yet define MYSQL_TYPE_JSON */
+#ifndef MYSQL_TYPE_JSON
+#define MYSQL_TYPE_JSON 245
+#endif
 
 struct statement * new_statement();
 guint64 max_transaction_size=DEFAULT_MAX_TRANSACTION_SIZE;
+gboolean adaptive_commit=FALSE;
 gboolean skip_definer = FALSE;
 GAsyncQueue *connection_pool = NULL;
 GAsyncQueue *restore_queues=NULL;
 GAsyncQueue *free_results_queue=NULL;
+static struct metrics_histogram *statement_histogram=NULL;
+static struct metrics_histogram *connection_wait_histogram=NULL;
+static struct metrics_histogram *pipeline_wait_histogram=NULL;
+// INSERTs sent through the pipeline, and the ones whose slot was already free
+static guint64 pipeline_statements=0;
+static guint64 pipeline_overlapped=0;
+static gint64 pipeline_wait_time=0;
+extern guint64 max_statement_size;
 int (*restore_data_from_file) (struct thread_data *, const char *, gboolean , struct database *) = NULL;
 
 GMutex *load_data_list_mutex=NULL;
 GHashTable * load_data_list = NULL;
 
 void *restore_thread(MYSQL *thrconn);
-struct statement release_connection_statement = {0, 0, NULL, NULL, CLOSE, FALSE, NULL, 0, NULL, NULL};
+struct statement release_connection_statement = {0, 0, NULL, NULL, CLOSE, FALSE, NULL, 0, NULL, NULL, NULL, 0, 0, 0, 0, 0, 0};
+static struct statement lease_release_statement = {0, 0, NULL, NULL, CLOSE, FALSE, NULL, 0, NULL, NULL, NULL, 0, 0, 0, 0, 0, 0};
 struct io_restore_result end_restore_thread = { NULL, NULL};
 
 GThread **restore_threads=NULL;
@@ -55,6 +79,92 @@ void initialize_restore(){
   load_data_list = g_hash_table_new ( g_str_hash, g_str_equal );
 }
 
+struct local_infile{
+  gchar *filename;
+  FILE *file;
+  // --shard-column, only the lines of the shard of the connection are sent
+  struct shard_reader *reader;
+  guint64 *sent_bytes;
+  // --file-checksums, the crc32 of the file is verified once it was read
+  // until its end. A shard reader does not send every line, it is not
+  // verified
+  gboolean verify_checksum;
+  guint32 expected_checksum;
+  guint32 checksum;
+  gboolean eof;
+  int error;
+  gchar message[MYSQL_ERRMSG_SIZE];
+};
+
+// LOAD DATA LOCAL INFILE reads the file through myl_open(), compressed files
+// are decompressed in process and no FIFO is needed
+static
+int local_infile_init(void **ptr, const char *filename, void *userdata){
+  struct shard_filter *sf=userdata;
+  struct local_infile *li=g_new0(struct local_infile, 1);
+  *ptr=li;
+  li->filename=g_strdup(filename);
+  li->file=myl_open(li->filename, "r");
+  if (!li->file){
+    li->error=CR_UNKNOWN_ERROR;
+    g_snprintf(li->message, sizeof(li->message), "cannot open file %s (%d)", filename, errno);
+    return 1;
+  }
+  if (sf && *(sf->load_data) && (*(sf->load_data))->column >= 0)
+    li->reader=new_shard_reader(li->file, *(sf->load_data), sf->shard);
+  li->sent_bytes= sf ? &(sf->infile_bytes) : NULL;
+  li->verify_checksum= li->reader == NULL && get_file_checksum(filename, &(li->expected_checksum));
+  return 0;
+}
+
+static
+int local_infile_read(void *ptr, char *buf, unsigned int buf_len){
+  struct local_infile *li=ptr;
+  int len= li->reader ? shard_reader_read(li->reader, buf, buf_len) : (int)fread(buf, 1, buf_len, li->file);
+  if (len < 0 || (len==0 && ferror(li->file))){
+    li->error=CR_UNKNOWN_ERROR;
+    g_snprintf(li->message, sizeof(li->message), "error reading file %s (%d)", li->filename, errno);
+    return -1;
+  }
+  if (li->sent_bytes)
+    *(li->sent_bytes)+=len;
+  if (li->verify_checksum)
+    li->checksum=crc32(li->checksum, (const Bytef *)buf, (uInt)len);
+  if (len == 0)
+    li->eof=TRUE;
+  return len;
+}
+
+static
+void local_infile_end(void *ptr){
+  struct local_infile *li=ptr;
+  if (li == NULL)
+    return;
+  if (li->reader)
+    free_shard_reader(li->reader);
+  if (li->verify_checksum && li->eof && !verify_file_checksum(li->filename, li->expected_checksum, li->checksum) && checksum_mode != CHECKSUM_WARN)
+    errors++;
+  if (li->file)
+    myl_close(li->filename, li->file, FALSE);
+  g_free(li->filename);
+  g_free(li);
+}
+
+static
+int local_infile_error(void *ptr, char *error_msg, unsigned int error_msg_len){
+  struct local_infile *li=ptr;
+  if (li == NULL){
+    g_strlcpy(error_msg, "out of memory", error_msg_len);
+    return CR_UNKNOWN_ERROR;
+  }
+  g_strlcpy(error_msg, li->message, error_msg_len);
+  return li->error;
+}
+
+void set_local_infile_handler(MYSQL *thrconn, struct shard_filter *sf){
+  mysql_set_local_infile_handler(thrconn, &local_infile_init, &local_infile_read, &local_infile_end, &local_infile_error, sf);
+}
+
 struct connection_data *new_connection_data(MYSQL *thrconn){
   struct connection_data *cd=g_new(struct connection_data,1);
   if (thrconn)
@@ -63,13 +173,31 @@ struct connection_data *new_connection_data(MYSQL *thrconn){
     cd->thrconn = mysql_init(NULL);
     m_connect(cd->thrconn);
   }
+  cd->shard_load_data=NULL;
+  cd->journal_filename=NULL;
+  cd->shard_filter=g_new(struct shard_filter, 1);
+  cd->shard_filter->shard=0;
+  cd->shard_filter->load_data=&(cd->shard_load_data);
+  cd->shard_filter->infile_bytes=0;
+  cd->payload_bytes=0;
+  cd->ingest_backend=NULL;
+  set_local_infile_handler(cd->thrconn, cd->shard_filter);
   cd->current_database=NULL;
   cd->connection_id=mysql_thread_id(cd->thrconn);
   cd->ready=g_async_queue_new();
   cd->queue=NULL;
   cd->in_use=g_mutex_new();
+  cd->binary_stmt=NULL;
+  cd->binary_stmt_rows=0;
+  cd->commit_target=commit_count;
+  cd->commit_direction=1;
+  cd->transaction_start=0;
+  cd->transaction_rows=0;
+  cd->commit_time_avg=0;
+  cd->last_rate=0;
   g_message("Executing set session");
   execute_gstring(cd->thrconn, set_session);
+  fan_out_new_connection(cd);
   g_async_queue_push(connection_pool,cd);
   return cd;
 }
@@ -77,13 +205,32 @@ struct io_restore_result *new_io_restore_result(){
   struct io_restore_result *iors=g_new(struct io_restore_result,1);
   iors->result=g_async_queue_new();
   iors->restore=g_async_queue_new();
+  iors->released=g_async_queue_new();
   return iors;
 }
 
 
 int restore_data_from_mysqldump_file(struct thread_data *td, const char *filename, gboolean is_schema, struct database *use_database);
 
+/* The pool has pipeline_depth + 1 statements per thread, and each keeps the
+   buffer of the biggest statement that it held. With --max-memory, the depth
+   is reduced until the pool of statements of the dump size fits in half of
+   the budget, the rest is for the read buffers */
+static
+void bound_pipeline_depth(){
+  if (max_memory == 0)
+    return;
+  guint64 statement= max_statement_size > 0 ? max_statement_size : DEFAULT_PIPELINE_STATEMENT_SIZE;
+  guint64 statements=(guint64)max_memory * 1024 * 1024 / 2 / statement / num_threads;
+  guint depth= statements > 1 ? statements - 1 : 1;
+  if (pipeline_depth > depth){
+    g_warning("--pipeline-depth reduced from %u to %u, the statement pool must fit in --max-memory", pipeline_depth, depth);
+    pipeline_depth=depth;
+  }
+}
+
 void initialize_connection_pool(){
+  bound_pipeline_depth();
   if (mysqldump)
     restore_data_from_file=&restore_data_from_mysqldump_file;
   else
@@ -91,15 +238,21 @@ void initialize_connection_pool(){
 
   guint n=0;
   connection_pool=g_async_queue_new();
+  statement_histogram=new_metrics_histogram("myloader_statement_seconds", "Time executing a statement on the server, retries included");
+  connection_wait_histogram=new_metrics_histogram("myloader_connection_wait_seconds", "Time waiting for a connection of the pool");
+  pipeline_wait_histogram=new_metrics_histogram("myloader_pipeline_wait_seconds", "Time the file reader waited for a slot of the statement pipeline");
   restore_queues=g_async_queue_new();
   free_results_queue=g_async_queue_new();
+  register_queue_stats("connection_pool", connection_pool);
+  register_queue_stats("restore_queues", restore_queues);
+  register_queue_stats("free_results", free_results_queue);
   struct io_restore_result *iors=NULL;
   restore_threads=g_new(GThread *, num_threads);
   for (n = 0; n < num_threads; n++) {
     iors=new_io_restore_result();
     g_async_queue_push(restore_queues, iors);
   }
-  for (n = 0; n < 8*num_threads; n++) {
+  for (n = 0; n < (pipeline_depth + 1)*num_threads; n++) {
     g_async_queue_push(free_results_queue, new_statement());
   }
 }
@@ -116,6 +269,11 @@ void wait_restore_threads_to_close(){
   struct connection_data *cd=NULL;
   for(n = 0; n < num_threads; n++){
     cd=g_async_queue_pop(connection_pool);
+    if (wire_compression_enabled()){
+      gchar *label=g_strdup_printf("Connection %ld", cd->connection_id);
+      report_wire_compression(cd->thrconn, label, cd->payload_bytes + cd->shard_filter->infile_bytes, TRUE);
+      g_free(label);
+    }
     g_async_queue_push(cd->ready, &end_restore_thread);
   }
   for (n = 0; n < num_threads; n++)
@@ -126,13 +284,21 @@ void reconnect_connection_data(struct connection_data *cd){
   mysql_close(cd->thrconn);
   cd->thrconn=mysql_init(NULL);
   m_connect(cd->thrconn);
+  set_local_infile_handler(cd->thrconn, cd->shard_filter);
   cd->connection_id=mysql_thread_id(cd->thrconn);
+  // the status of the server starts again with the session
+  cd->payload_bytes=0;
+  cd->shard_filter->infile_bytes=0;
+  cd->ingest_backend=NULL;
   execute_use(cd);
   execute_gstring(cd->thrconn, set_session);
 }
 
-int restore_data_in_gstring_by_statement(struct connection_data *cd, GString *data, gboolean is_schema, guint *query_counter)
+static
+int send_statement(struct connection_data *cd, GString *data, gboolean is_schema, guint *query_counter)
 {
+  gint64 start=metrics_listen ? g_get_monotonic_time() : 0;
+  cd->payload_bytes+=data->len;
   guint en=mysql_real_query(cd->thrconn, data->str, data->len);
   if (en) {
     if (is_schema)
@@ -152,6 +318,7 @@ int restore_data_in_gstring_by_statement(struct connection_data *cd, GString *da
       }
 
       g_atomic_int_inc(&(detailed_errors.retries));
+      cd->payload_bytes+=data->len;
       if (mysql_real_query(cd->thrconn, data->str, data->len)) {
         if (is_schema)
           g_critical("Thread %ld using connection %ld - ERROR %d: %s\n%s", cd->thread_id, cd->connection_id, mysql_errno(cd->thrconn), mysql_error(cd->thrconn), data->str);
@@ -163,11 +330,39 @@ int restore_data_in_gstring_by_statement(struct connection_data *cd, GString *da
       }
     }
   }
+  if (metrics_listen)
+    metrics_observe(statement_histogram, g_get_monotonic_time() - start);
   *query_counter=*query_counter+1;
   g_string_set_size(data, 0);
   return 0;
 }
 
+// --throttle-control gates each data statement, whichever connection sends it
+static
+int execute_statement(struct connection_data *cd, GString *data, gboolean is_schema, guint *query_counter)
+{
+  if (is_schema)
+    return send_statement(cd, data, is_schema, query_counter);
+  gsize len=data->len;
+  throttle_control_acquire();
+  int r=send_statement(cd, data, is_schema, query_counter);
+  throttle_control_add_work(len);
+  throttle_control_release();
+  return r;
+}
+
+int restore_data_in_gstring_by_statement(struct connection_data *cd, GString *data, gboolean is_schema, guint *query_counter)
+{
+  // the file of a LOAD DATA is removed once it is loaded here, and the
+  // schema must exist on the twins before the data of other connections
+  gboolean sync=cd->fan_out && (is_schema || g_strrstr_len(data->str,10,"LOAD DATA "));
+  fan_out_query(cd, data->str, data->len);
+  int r=execute_statement(cd, data, is_schema, query_counter);
+  if (sync)
+    fan_out_sync(cd);
+  return r;
+}
+
 void setup_connection(struct connection_data *cd, struct thread_data *td, struct io_restore_result *io_restore_result , gboolean start_transaction, struct database *use_database, GString *header){
   trace("Thread %d: Connection %ld granted", td->thread_id, cd->connection_id);
   if (mysql_ping(cd->thrconn)) {
@@ -183,26 +378,79 @@ void setup_connection(struct connection_data *cd, struct thread_data *td, struct
     td->granted_connections++;
   }
 
-  if (cd->transaction)
+  if (cd->transaction){
+    fan_out_query(cd, "START TRANSACTION", strlen("START TRANSACTION"));
     m_query_warning(cd->thrconn, "START TRANSACTION", "START TRANSACTION failed");
+  }
 
   cd->queue = io_restore_result;
-  if (header)
+  if (header){
+    fan_out_gstring(cd, header);
     execute_gstring(cd->thrconn,header);
+  }
   g_async_queue_push(cd->ready, cd->queue);
 }
 
+// same condition than execute_use_if_needs_to() to skip the USE
+static
+gboolean is_connection_on_database(struct connection_data *cd, struct database *database){
+  return cd->current_database != NULL &&
+         (target_db != NULL || !g_strcmp0(database->target_database, cd->current_database->target_database));
+}
+
+/* The connections are handed out in the order that they were released, so
+   with many databases most jobs would get a connection on another database
+   and pay a USE. An idle connection that is already on the database of the
+   job is taken instead, the rest keep their order */
+static
+struct connection_data *pop_connection_for_database(struct database *database, gboolean wait){
+  struct connection_data *cd= wait ? m_async_queue_pop(connection_pool) : g_async_queue_try_pop(connection_pool);
+  if (cd == NULL || database == NULL || is_connection_on_database(cd, database))
+    return cd;
+  struct connection_data *other=NULL, *found=NULL;
+  g_async_queue_lock(connection_pool);
+  gint i, idle=g_async_queue_length_unlocked(connection_pool);
+  for (i=0; i < idle && (other=g_async_queue_try_pop_unlocked(connection_pool)); i++){
+    if (found == NULL && is_connection_on_database(other, database))
+      found=other;
+    else
+      g_async_queue_push_unlocked(connection_pool, other);
+  }
+  if (found){
+    g_async_queue_push_unlocked(connection_pool, cd);
+    cd=found;
+  }
+  g_async_queue_unlock(connection_pool);
+  return cd;
+}
+
 struct connection_data *wait_for_available_restore_thread(struct thread_data *td, gboolean start_transaction, struct database *use_database){
-  struct connection_data *cd=g_async_queue_pop(connection_pool);
-  setup_connection(cd,td,g_async_queue_pop(restore_queues), start_transaction, use_database, NULL);
+  gint64 start=metrics_listen ? g_get_monotonic_time() : 0;
+  struct connection_data *cd=pop_connection_for_database(use_database, TRUE);
+  if (metrics_listen)
+    metrics_observe(connection_wait_histogram, g_get_monotonic_time() - start);
+  setup_connection(cd,td,m_async_queue_pop(restore_queues), start_transaction, use_database, NULL);
   return cd;
 }
 
+/* Runs the checksums of the chunks that had the last of their files just
+   restored, on a connection of the pool so it is done alongside the load */
+static
+void verify_restored_chunks(const gchar *filename){
+  GList *ready=chunk_checksums_ready(filename);
+  if (ready == NULL)
+    return;
+  struct connection_data *cd=m_async_queue_pop(connection_pool);
+  verify_chunk_checksums(ready, cd->thrconn);
+  g_async_queue_push(connection_pool, cd);
+}
+
 extern gboolean control_job_ended;
 gboolean request_another_connection(struct thread_data *td, struct io_restore_result *io_restore_result, gboolean start_transaction, struct database *use_database, GString *header){
-  if ( control_job_ended && td->granted_connections < td->dbt->max_threads && g_list_length(td->dbt->restore_job_list)==0 ){
+  // the checkpoints of a file need its statements in order
+  if ( !resume_journal && control_job_ended && td->granted_connections < td->dbt->max_threads && td->dbt->restore_job_heap->len==0 ){
     g_assert(header);
-    struct connection_data *cd=g_async_queue_try_pop(connection_pool);
+    struct connection_data *cd=pop_connection_for_database(use_database, FALSE);
     if(cd){
       setup_connection(cd,td,io_restore_result,start_transaction, use_database, header);
       return TRUE;
@@ -213,57 +461,192 @@ gboolean request_another_connection(struct thread_data *td, struct io_restore_re
 
 
 int m_commit(struct connection_data *cd){
-  return m_query_warning(cd->thrconn, "COMMIT", "COMMIT failed")?2:0;
+  gint64 span=span_start();
+  fan_out_query(cd, "COMMIT", strlen("COMMIT"));
+  int r=m_query_warning(cd->thrconn, "COMMIT", "COMMIT failed")?2:0;
+  if (r == 0)
+    journal_commit(cd);
+  span_end("m_commit", span, NULL, NULL, -1, NULL);
+  return r;
+}
+
+/* --adaptive-commit: the amount of queries per transaction of each
+   connection moves toward the best rows per second, in steps of a quarter of
+   the current size. When the commit takes much longer than it used to, the
+   size is halved */
+#define ADAPTIVE_COMMIT_MAX_FACTOR 8
+#define ADAPTIVE_COMMIT_SPIKE 4
+
+guint commit_limit(struct connection_data *cd){
+  return adaptive_commit ? cd->commit_target : commit_count;
+}
+
+static
+void adapt_commit_target(struct connection_data *cd, gint64 commit_time, gint64 now){
+  guint max_target=commit_count * ADAPTIVE_COMMIT_MAX_FACTOR, step;
+  if (cd->transaction_start == 0 || now <= cd->transaction_start || cd->transaction_rows == 0)
+    return;
+  gdouble rate=(gdouble)cd->transaction_rows * G_USEC_PER_SEC / (now - cd->transaction_start);
+  if (cd->commit_time_avg > 0 && commit_time > ADAPTIVE_COMMIT_SPIKE * cd->commit_time_avg){
+    cd->commit_target= cd->commit_target > 1 ? cd->commit_target / 2 : 1;
+    cd->commit_direction=-1;
+    trace("Connection %ld: commit took %"G_GINT64_FORMAT" usec, transaction size reduced to %u", cd->connection_id, commit_time, cd->commit_target);
+  }else{
+    // the last step made it slower, going back
+    if (cd->last_rate > 0 && rate < cd->last_rate * 0.95)
+      cd->commit_direction=-cd->commit_direction;
+    step= cd->commit_target / 4 > 0 ? cd->commit_target / 4 : 1;
+    if (cd->commit_direction > 0)
+      cd->commit_target= cd->commit_target + step < max_target ? cd->commit_target + step : max_target;
+    else
+      cd->commit_target= cd->commit_target > step ? cd->commit_target - step : 1;
+  }
+  cd->last_rate=rate;
+  cd->commit_time_avg= cd->commit_time_avg > 0 ? (cd->commit_time_avg * 4 + commit_time) / 5 : commit_time;
 }
 
 int m_commit_and_start_transaction(struct connection_data *cd, guint* query_counter){
+  gint64 start=adaptive_commit ? g_get_monotonic_time() : 0;
   int e=m_commit(cd);
   if (e) return e;
+  if (adaptive_commit){
+    gint64 now=g_get_monotonic_time();
+    adapt_commit_target(cd, now - start, now);
+    cd->transaction_start=now;
+    cd->transaction_rows=0;
+  }
   *query_counter=0;
+  fan_out_query(cd, "START TRANSACTION", strlen("START TRANSACTION"));
   m_query_warning(cd->thrconn, "START TRANSACTION", "START TRANSACTION failed");
   return 0;
 }
 
+/* Moves *current_line over up to max_rows rows of an INSERT, every row ends
+ * with a \n. *last_line is left on the last row taken and *next_line on the
+ * \n after *current_line, or NULL when there are no more rows */
+guint next_insert_rows(gchar **current_line, gchar **next_line, gchar **last_line, gchar *end, guint max_rows){
+  guint num_rows=0;
+  do {
+    *last_line=*current_line;
+    num_rows++;
+    *current_line=*next_line+1;
+    *next_line= *current_line < end ? memchr(*current_line, '\n', end - *current_line) : NULL;
+  } while ((max_rows == 0 || num_rows < max_rows) && *next_line != NULL);
+  return num_rows;
+}
+
+/* --shard-column: the rows are regrouped per shard, up to --rows in each
+   statement. The shard 0 is this connection and the rest are its fan-out
+   connections, the transactions are committed at the same time on all */
+static
+int flush_shard_batch(struct connection_data *cd, GString *batch, guint shard, guint num_rows, guint *query_counter, struct db_table *dbt){
+  int r=0;
+  if (shard == 0){
+    r=execute_statement(cd, batch, FALSE, query_counter);
+    if (mysql_warning_count(cd->thrconn)){
+      g_warning("Connection %ld: Warnings found during INSERT on %s.%s: %s", cd->connection_id, dbt->database->target_database, dbt->source_table_name, show_warnings_if_possible(cd->thrconn));
+      detailed_errors.data_warnings+=mysql_warning_count(cd->thrconn);
+    }
+  }else{
+    fan_out_query_to(cd, shard - 1, batch->str, batch->len);
+    *query_counter=*query_counter+1;
+  }
+  __sync_fetch_and_add(&(dbt->rows_inserted), num_rows);
+  cd->transaction_rows+=num_rows;
+  cd->statement_rows+=num_rows;
+  if (cd->transaction && *query_counter >= commit_limit(cd))
+    r+=m_commit_and_start_transaction(cd, query_counter);
+  return r;
+}
+
+static
+int restore_sharded_insert(struct connection_data *cd, GString *data, gsize prefix_len, gint column, guint *query_counter, guint offset_line, struct db_table *dbt){
+  gint64 span=span_start();
+  guint num_shards=shard_count(), shard;
+  gchar *end=data->str + data->len;
+  // the first row follows VALUES, every other one starts a line
+  gchar *row=data->str + prefix_len, *row_end, *last;
+  GString **batch=g_new(GString *, num_shards);
+  guint *batch_rows=g_new0(guint, num_shards);
+  int r=0;
+  for (shard = 0; shard < num_shards; shard++)
+    batch[shard]=gstring_pool_get(data->len / num_shards + 64);
+  while (row != NULL && row < end){
+    row_end=memchr(row, '\n', end - row);
+    if (row_end == NULL)
+      row_end=end;
+    // without the , or ; after the row
+    for (last=row_end; last > row && *(last - 1) != ')'; last--);
+    if (last > row){
+      shard=row_shard(row, last, column);
+      if (batch_rows[shard] == 0)
+        g_string_append_len(g_string_truncate(batch[shard], 0), data->str, prefix_len);
+      else
+        g_string_append_c(batch[shard], ',');
+      g_string_append_c(batch[shard], '\n');
+      g_string_append_len(batch[shard], row, last - row);
+      batch_rows[shard]++;
+      if (rows > 0 && batch_rows[shard] >= rows){
+        r+=flush_shard_batch(cd, batch[shard], shard, batch_rows[shard], query_counter, dbt);
+        batch_rows[shard]=0;
+      }
+    }
+    row= row_end < end ? row_end + 1 : NULL;
+  }
+  for (shard = 0; shard < num_shards; shard++){
+    if (batch_rows[shard] > 0)
+      r+=flush_shard_batch(cd, batch[shard], shard, batch_rows[shard], query_counter, dbt);
+    gstring_pool_put(batch[shard]);
+  }
+  g_free(batch);
+  g_free(batch_rows);
+  span_end("restore_sharded_insert", span, dbt->database->target_database, dbt->source_table_name, offset_line, NULL);
+  return r;
+}
+
 int restore_insert(struct connection_data *cd, struct thread_data*td, 
                   GString *data, guint *query_counter, guint offset_line, struct db_table *dbt)
 {
-  char *next_line=g_strstr_len(data->str,-1,"VALUES") + 6;
-  char *insert_statement_prefix=g_strndup(data->str,next_line - data->str);
+  // The statement is split by offsets over data, every line is a row and
+  // each sub statement is built with the prefix and a single append of the
+  // rows that belongs to it
+  gint64 span=span_start();
+  guint first_offset_line=offset_line;
+  gchar *end=data->str + data->len;
+  gchar *current_line=g_strstr_len(data->str,-1,"VALUES") + 6;
+  gsize insert_statement_prefix_len=current_line - data->str;
+  gint column= shard_in_use() ? insert_shard_column(dbt, data->str, insert_statement_prefix_len) : -1;
+  if (column >= 0)
+    return restore_sharded_insert(cd, data, insert_statement_prefix_len, column, query_counter, offset_line, dbt);
   int r=0;
   guint tr=0,current_offset_line=offset_line-1;
-  gchar *current_line=next_line;
-  next_line=g_strstr_len(current_line, -1, "\n");
-  GString * new_insert=g_string_sized_new(strlen(insert_statement_prefix));
+  gchar *next_line=memchr(current_line, '\n', end - current_line);
+  GString * new_insert=gstring_pool_get(data->len + 64);
   guint current_rows=0;
   guint64 transaction_size=0;
+  // the INSERTs that mydumper already sized are not split
+  guint max_rows= dbt->statement_max_rows > 0 && dbt->statement_max_rows <= rows ? 0 : rows;
   do {
     current_rows=0;
-    g_string_set_size(new_insert, 0);
+    // approximate, rows_inserted is updated by the other threads of the table
     g_string_printf(new_insert,"/* Completed: %"G_GUINT64_FORMAT"%% */ ", dbt->rows>0?dbt->rows_inserted*100/dbt->rows:0);
-    new_insert=g_string_append(new_insert,insert_statement_prefix);
-    guint line_len=0;
-    do {
-      char *line=g_strndup(current_line, next_line - current_line);
-      line_len=strlen(line);
-      g_string_append(new_insert, line);
-      g_free(line);
-      current_rows++;
-      current_line=next_line+1;
-      next_line=g_strstr_len(current_line, -1, "\n");
-      current_offset_line++;
-    } while ((rows == 0 || current_rows < rows) && next_line != NULL);
-    if (current_rows > 1 || (current_rows==1 && line_len>0) ){
+    g_string_append_len(new_insert, data->str, insert_statement_prefix_len);
+    gchar *first_line=current_line, *last_line=current_line;
+    current_rows=next_insert_rows(&current_line, &next_line, &last_line, end, max_rows);
+    current_offset_line+=current_rows;
+    // current_line-1 is the \n that ends the last row of this sub statement
+    g_string_append_len(new_insert, first_line, current_line - 1 - first_line);
+    if (current_rows > 1 || (current_rows==1 && current_line - 1 > last_line) ){
       if (cd->transaction && ((max_transaction_size * 1024 * 1024 < new_insert->len + transaction_size) )){ //|| (max_transaction_size * 1024 * 1024 < transaction_size + max_statement_size ))){
         tr+=m_commit_and_start_transaction(cd,query_counter);
         transaction_size=0;
       }
       transaction_size+=new_insert->len;
       tr=restore_data_in_gstring_by_statement(cd, new_insert, FALSE, query_counter);
-      g_usleep(throttle_time);
-      table_lock(dbt);
-      dbt->rows_inserted+=current_rows;
-      table_unlock(dbt);
-      if (cd->transaction && *query_counter == commit_count) {
+      __sync_fetch_and_add(&(dbt->rows_inserted), current_rows);
+      cd->transaction_rows+=current_rows;
+      cd->statement_rows+=current_rows;
+      if (cd->transaction && *query_counter >= commit_limit(cd)) {
         tr+=m_commit_and_start_transaction(cd,query_counter);
         transaction_size=0;
       }
@@ -282,14 +665,125 @@ int restore_insert(struct connection_data *cd, struct thread_data*td,
     current_line++; // remove trailing ,
   } while (next_line != NULL);
   cd=NULL;
-  g_string_free(new_insert,TRUE);
-  g_free(insert_statement_prefix);
+  gstring_pool_put(new_insert);
+  span_end("restore_insert", span, dbt->database->target_database, dbt->source_table_name, first_offset_line, NULL);
   return r;
 }
 
 
 
+static
+void close_binary_stmt(struct connection_data *cd){
+  if (cd->binary_stmt){
+    mysql_stmt_close(cd->binary_stmt);
+    cd->binary_stmt=NULL;
+    cd->binary_stmt_rows=0;
+  }
+}
+
+/* Rows of a BINARY_DATA file are sent with a prepared multi row INSERT, the
+   values are bound as they are in the file so the server doesn't need to
+   parse them. The statement is reused while the number of rows is the same,
+   which is every statement of the file but the last one */
+static
+int restore_binary_insert(struct connection_data *cd, struct statement *ir, guint *query_counter){
+  struct row_binary_header *header=ir->binary_header;
+  struct db_table *dbt=ir->dbt;
+  guint num_columns=header->num_columns, i, j;
+  const char q=identifier_quote_character;
+  if (cd->binary_stmt == NULL || cd->binary_stmt_rows != ir->num_rows){
+    close_binary_stmt(cd);
+    // the quote character is doubled inside the identifiers
+    char * (*identifier_quote_character_protect)(char *r)= q == BACKTICK ? &backtick_protect : &double_quoute_protect;
+    gchar *database=identifier_quote_character_protect(dbt->database->target_database);
+    // --follow and --exchange-partitions load the rows into a staging table
+    gchar *table=identifier_quote_character_protect(ir->td && ir->td->staging_table ? (gchar *)ir->td->staging_table : dbt->source_table_name);
+    GString *query=g_string_new("INSERT INTO ");
+    g_string_append_printf(query, "%c%s%c.%c%s%c (", q, database, q, q, table, q);
+    g_free(database);
+    g_free(table);
+    for (j = 0; j < num_columns; j++){
+      gchar *column=identifier_quote_character_protect(header->columns[j].name);
+      g_string_append_printf(query, "%s%c%s%c", j ? "," : "", q, column, q);
+      g_free(column);
+    }
+    g_string_append(query, ") VALUES ");
+    // JSON values come with the binary charset, which the server rejects
+    for (i = 0; i < ir->num_rows; i++){
+      g_string_append(query, i ? ",(" : "(");
+      for (j = 0; j < num_columns; j++){
+        if (j)
+          g_string_append_c(query, ',');
+        g_string_append(query, header->columns[j].type == MYSQL_TYPE_JSON ? "CONVERT(? USING utf8mb4)" : "?");
+      }
+      g_string_append_c(query, ')');
+    }
+    cd->binary_stmt=mysql_stmt_init(cd->thrconn);
+    if (mysql_stmt_prepare(cd->binary_stmt, query->str, query->len)){
+      ir->error=g_strdup(mysql_stmt_error(cd->binary_stmt));
+      ir->error_number=mysql_stmt_errno(cd->binary_stmt);
+      close_binary_stmt(cd);
+      g_string_free(query, TRUE);
+      return 1;
+    }
+    cd->binary_stmt_rows=ir->num_rows;
+    g_string_free(query, TRUE);
+  }
+
+  guint num_values=ir->num_rows * num_columns;
+  MYSQL_BIND *bind=g_new0(MYSQL_BIND, num_values);
+  const gchar **values=g_new(const gchar *, num_values);
+  gulong *lengths=g_new(gulong, num_values);
+  gsize pos=0, consumed=0;
+  for (i = 0; i < ir->num_rows; i++){
+    if (row_binary_read_row(ir->buffer->str + pos, ir->buffer->len - pos, num_columns, values + i * num_columns, lengths + i * num_columns, &consumed) != 1)
+      g_assert_not_reached();
+    pos+=consumed;
+  }
+  for (i = 0; i < num_values; i++){
+    struct row_binary_column *column=&(header->columns[i % num_columns]);
+    if (values[i] == NULL){
+      bind[i].buffer_type=MYSQL_TYPE_NULL;
+      continue;
+    }
+    bind[i].buffer_type= column->charsetnr == 63 ? MYSQL_TYPE_BLOB : MYSQL_TYPE_STRING;
+    bind[i].buffer=(void *)values[i];
+    bind[i].buffer_length=lengths[i];
+    bind[i].length=&(lengths[i]);
+  }
+  int r=0;
+  gint64 start=metrics_listen || spans_enabled ? g_get_monotonic_time() : 0;
+  throttle_control_acquire();
+  gboolean failed=mysql_stmt_bind_param(cd->binary_stmt, bind) || mysql_stmt_execute(cd->binary_stmt);
+  throttle_control_add_work(ir->buffer->len);
+  throttle_control_release();
+  if (failed){
+    ir->error=g_strdup(mysql_stmt_error(cd->binary_stmt));
+    ir->error_number=mysql_stmt_errno(cd->binary_stmt);
+    errors++;
+    r=1;
+  }else{
+    if (metrics_listen)
+      metrics_observe(statement_histogram, g_get_monotonic_time() - start);
+    span_end("restore_binary_insert", start, dbt->database->target_database, dbt->source_table_name, ir->preline, NULL);
+    *query_counter=*query_counter+1;
+    __sync_fetch_and_add(&(dbt->rows_inserted), ir->num_rows);
+    cd->transaction_rows+=ir->num_rows;
+    if (mysql_warning_count(cd->thrconn)){
+      g_warning("Connection %ld: Warnings found during INSERT on rows %d to %d of %s: %s", cd->connection_id, ir->preline, ir->preline + ir->num_rows - 1, ir->filename, show_warnings_if_possible(cd->thrconn));
+      detailed_errors.data_warnings+=mysql_warning_count(cd->thrconn);
+    }
+    if (cd->transaction && *query_counter >= commit_limit(cd))
+      r=m_commit_and_start_transaction(cd, query_counter);
+  }
+  g_free(bind);
+  g_free(values);
+  g_free(lengths);
+  return r;
+}
+
 void *restore_thread(MYSQL *thrconn){
+  set_thread_affinity(AFFINITY_WORKERS);
   struct connection_data *cd=new_connection_data(thrconn);
   struct statement *ir=NULL;
   guint query_counter=0;
@@ -304,13 +798,23 @@ void *restore_thread(MYSQL *thrconn){
         trace("Releasing connection: %ld", cd->connection_id);
         if (cd->transaction && query_counter > 0)
           m_commit(cd);
-        g_async_queue_push(cd->queue->result,ir);
+        fan_out_end_of_file(cd);
+        ingest_finish(cd);
+        journal_release(cd);
+        // the time until the connection is taken again is not restore time
+        cd->transaction_start=0;
+        cd->transaction_rows=0;
+        close_binary_stmt(cd);
+        g_async_queue_push(ir == &lease_release_statement ? cd->queue->released : cd->queue->result, ir);
         cd->queue=NULL;
         ir=NULL;
         break;
       }
       if (ir->kind_of_statement==INSERT){
+        ingest_prepare(cd, ir->dbt);
+        journal_statement_start(cd, ir);
         ir->result=restore_insert(cd, ir->td, ir->buffer, &query_counter,ir->preline, ir->dbt);
+        journal_statement_end(cd, ir);
         if (ir->result>0){
           ir->error=g_strdup(mysql_error(cd->thrconn));
           ir->error_number=mysql_errno(cd->thrconn);
@@ -331,8 +835,21 @@ void *restore_thread(MYSQL *thrconn){
           }
         }
         g_async_queue_push(cd->queue->result,ir);
+      }else if (ir->kind_of_statement==BINARY_INSERT){
+        ingest_prepare(cd, ir->dbt);
+        ir->result=restore_binary_insert(cd, ir, &query_counter);
+        if (ir->result>0)
+          g_critical("Error occurs on rows %d to %d of file %s: %s", ir->preline, ir->preline + ir->num_rows - 1, ir->filename, ir->error);
+        g_async_queue_push(cd->queue->result,ir);
       }else{
+        if (!ir->is_schema && g_str_has_prefix(ir->buffer->str, "LOAD DATA "))
+          ingest_prepare(cd, ir->dbt);
+        cd->shard_load_data=new_shard_load_data(ir->dbt, ir->buffer);
+        journal_statement_start(cd, ir);
         ir->result=restore_data_in_gstring_by_statement(cd, ir->buffer, ir->is_schema, &query_counter);
+        journal_statement_end(cd, ir);
+        free_shard_load_data(cd->shard_load_data);
+        cd->shard_load_data=NULL;
         if (ir->result>0){
           ir->error=g_strdup(mysql_error(cd->thrconn));
           ir->error_number=mysql_errno(cd->thrconn);
@@ -344,6 +861,7 @@ void *restore_thread(MYSQL *thrconn){
     g_async_queue_push(connection_pool,cd);
   }
 //  g_mutex_unlock(cd->in_use);
+  fan_out_close(cd);
   return NULL;
 }
 
@@ -379,6 +897,7 @@ void release_load_data_as_it_is_close( gchar * filename ){
 }
 
 void free_statement(struct statement *statement){
+  memory_track(MEMORY_STATEMENTS, &(statement->memory_reserved), 0);
   g_string_free(statement->buffer, TRUE);
   g_free(statement->error);
   g_free(statement);
@@ -400,17 +919,25 @@ struct statement * new_statement(){
   return stmt;
 }
 
-void assign_statement(struct statement *ir, struct thread_data*td, struct db_table * dbt, gchar *stmt, guint preline, gboolean is_schema, enum kind_of_statement kind_of_statement){
+void assign_statement_len(struct statement *ir, struct thread_data*td, struct db_table * dbt, const gchar *stmt, gsize len, guint preline, gboolean is_schema, enum kind_of_statement kind_of_statement){
   initialize_statement(ir);
   g_assert(stmt); 
-  g_string_assign(ir->buffer,stmt);
+  g_string_truncate(ir->buffer, 0);
+  memory_track(MEMORY_STATEMENTS, &(ir->memory_reserved), memory_string_size(ir->buffer, len));
+  g_string_append_len(ir->buffer, stmt, len);
   ir->preline=preline;
+  ir->filename=NULL;
   ir->is_schema=is_schema;
   ir->kind_of_statement=kind_of_statement;
   ir->dbt=dbt;
   ir->td=td;
 }
 
+void assign_statement(struct statement *ir, struct thread_data*td, struct db_table * dbt, gchar *stmt, guint preline, gboolean is_schema, enum kind_of_statement kind_of_statement){
+  g_assert(stmt); 
+  assign_statement_len(ir, td, dbt, stmt, strlen(stmt), preline, is_schema, kind_of_statement);
+}
+
 
 guint process_result_vstatement_pop(GAsyncQueue * get_insert_result_queue, struct statement **ir, void log_fun(const char *, ...) , const char *fmt, va_list args, void * g_async_queue_pop_fun(GAsyncQueue *) ){
   *ir=g_async_queue_pop_fun(get_insert_result_queue);
@@ -436,6 +963,31 @@ guint process_result_statement(GAsyncQueue * get_insert_result_queue, struct sta
   return r;
 }
 
+/* The result of an INSERT sent through the pipeline. When a slot is already
+   free, the reader goes on with the file while the connections execute the
+   statements that it queued before */
+static
+guint process_pipeline_result(struct io_restore_result *queue, struct statement **ir, const gchar *filename){
+  gint64 start=g_get_monotonic_time();
+  gboolean overlapped=g_async_queue_length(queue->result) > 0;
+  guint r=process_result_statement(queue->result, ir, m_critical, "(2)Error occurs processing file %s", filename);
+  gint64 wait=g_get_monotonic_time() - start;
+  __sync_fetch_and_add(&pipeline_statements, 1);
+  if (overlapped)
+    __sync_fetch_and_add(&pipeline_overlapped, 1);
+  __sync_fetch_and_add(&pipeline_wait_time, wait);
+  if (metrics_listen)
+    metrics_observe(pipeline_wait_histogram, wait);
+  return r;
+}
+
+void pipeline_report(){
+  if (pipeline_statements == 0)
+    return;
+  g_message("Pipeline depth %u: %"G_GUINT64_FORMAT" of %"G_GUINT64_FORMAT" INSERTs were queued while the previous ones were executing, the readers waited %.1f seconds for a slot",
+            pipeline_depth, pipeline_overlapped, pipeline_statements, (gdouble)pipeline_wait_time / G_USEC_PER_SEC);
+}
+
 int restore_data_from_mysqldump_file(struct thread_data *td, const char *filename, gboolean is_schema, struct database *use_database){
 
   FILE *infile=NULL;
@@ -457,7 +1009,7 @@ int restore_data_from_mysqldump_file(struct thread_data *td, const char *filenam
   g_assert(g_async_queue_length(cd->queue->restore)<=0);
   g_assert(g_async_queue_length(cd->queue->result)<=0);
   guint i=0;
-  struct statement *ir=g_async_queue_pop(free_results_queue);
+  struct statement *ir=m_async_queue_pop(free_results_queue);
   gboolean results_added=FALSE;
   gchar *delimiter=g_strdup(DEFAULT_DELIMITER);
   while (eof == FALSE) {
@@ -492,7 +1044,7 @@ int restore_data_from_mysqldump_file(struct thread_data *td, const char *filenam
   struct io_restore_result *queue= cd->queue;
   g_async_queue_push(free_results_queue,ir);
   if (results_added){
-    for(i=0;i<7;i++){
+    for(i=1;i<pipeline_depth;i++){
       process_result_statement(queue->result, &ir, m_critical, "(2)Error occurs processing file %s", filename);
       g_assert(ir->kind_of_statement!=CLOSE);
       g_async_queue_push(free_results_queue,ir);
@@ -513,11 +1065,156 @@ int restore_data_from_mysqldump_file(struct thread_data *td, const char *filenam
 }
 
 
-int restore_data_from_mydumper_file(struct thread_data *td, const char *filename, gboolean is_schema, struct database *use_database){
+/* Only the session settings of the header of a file are executed by each
+   range, statements like LOCK TABLES would serialize them. The
+   ALTER TABLE ... DISABLE KEYS of mysqldump neither: a range that starts
+   after the last one ran the ENABLE KEYS would leave the keys disabled */
+static
+gboolean is_session_statement(const gchar *stmt){
+  while (*stmt == '\n' || g_str_has_prefix(stmt, "--")){
+    const gchar *nl=strchr(stmt, '\n');
+    if (nl == NULL)
+      return FALSE;
+    stmt=nl + 1;
+  }
+  if (g_str_has_prefix(stmt, "/*!")){
+    stmt+=3;
+    while (g_ascii_isdigit(*stmt) || *stmt == ' ')
+      stmt++;
+    return g_ascii_strncasecmp(stmt, "ALTER TABLE ", 12) != 0;
+  }
+  return g_ascii_strncasecmp(stmt, "SET ", 4) == 0;
+}
+
+/* --resume-journal: the rows that a previous run committed are removed from
+   the statement that it restored partially. FALSE when there are none left */
+static
+gboolean skip_insert_rows(gchar *stmt, gsize len, guint64 num_rows, GString *out){
+  gchar *end=stmt + len, *last_line=NULL;
+  gchar *current_line=g_strstr_len(stmt, len, "VALUES");
+  if (current_line == NULL)
+    return FALSE;
+  current_line+=6;
+  gsize prefix_len=current_line - stmt;
+  gchar *next_line=memchr(current_line, '\n', end - current_line);
+  if (next_line == NULL)
+    return FALSE;
+  next_insert_rows(&current_line, &next_line, &last_line, end, num_rows);
+  if (current_line >= end)
+    return FALSE;
+  g_string_truncate(out, 0);
+  g_string_append_len(out, stmt, prefix_len);
+  g_string_append_len(out, current_line, end - current_line);
+  return TRUE;
+}
+
+static
+void set_statement_position(struct statement *ir, guint64 offset, guint64 end_offset, guint64 range, guint64 skipped_rows){
+  ir->offset=offset;
+  ir->end_offset=end_offset;
+  ir->journal_range=range;
+  ir->skipped_rows=skipped_rows;
+}
+
+/* The connections granted to a file are leased per statement: when more
+   than one of them is waiting for a statement of the file and another file
+   is waiting for a connection, one is handed back to the pool. It is taken
+   by a connection that is between statements, which commits its transaction
+   before it leaves, so a transaction is never split between connections */
+static
+void release_idle_connection(struct thread_data *td, struct io_restore_result *queue){
+  // negative lengths are the threads waiting on the queue
+  if (td->granted_connections < 2 || g_async_queue_length(queue->restore) > -2 || g_async_queue_length(connection_pool) >= 0)
+    return;
+  trace("Thread %d: handing back an idle connection of %s", td->thread_id, td->dbt->source_table_name);
+  td->granted_connections--;
+  td->released_connections++;
+  g_async_queue_push(queue->restore, &lease_release_statement);
+}
+
+// The released connections have committed before the file is done
+static
+void wait_released_connections(struct thread_data *td, struct io_restore_result *queue){
+  for(;td->released_connections>0;td->released_connections--)
+    g_async_queue_pop(queue->released);
+}
+
+// The INSERT is executed by the connections granted to the file, in order
+static
+void queue_insert_statement(struct thread_data *td, struct connection_data *cd, struct database *use_database, GString *header,
+                            gboolean *results_added, struct statement **ir, const gchar *stmt, gsize stmt_len, guint preline, const char *filename){
+  guint i;
+  release_idle_connection(td, cd->queue);
+  request_another_connection(td, cd->queue, cd->transaction, use_database, header);
+  if (!*results_added){
+    *results_added=TRUE;
+    struct statement * other_ir=NULL;
+    for(i=1;i<pipeline_depth;i++){
+      other_ir=m_async_queue_pop(free_results_queue);
+      g_async_queue_push(cd->queue->result,initialize_statement(other_ir));
+    }
+  }
+  assign_statement_len(*ir, td, td->dbt, stmt, stmt_len, preline, FALSE, INSERT);
+  (*ir)->filename=filename;
+}
+
+/* --load-data-as-insert: the rows of the file are sent as INSERTs through the
+   pipeline of the file. The journal keeps the offset of the statement and
+   the rows loaded until its last INSERT, so a rerun skips them */
+static
+int restore_load_data_as_insert(struct thread_data *td, struct connection_data *cd, struct database *use_database, GString *header,
+                                gboolean *results_added, struct statement **ir, GString *statement, gchar *load_data_filename, guint preline,
+                                const char *filename, guint64 stmt_offset, guint64 stmt_end, guint64 range, guint64 journal_rows){
+  int r=0;
+  initialize_statement(*ir);
+  FILE *file=myl_open(load_data_filename, "r");
+  if (!file){
+    g_critical("cannot open file %s (%d)", load_data_filename, errno);
+    errors++;
+    return 1;
+  }
+  struct load_data_insert *ldi=new_load_data_insert(statement, file);
+  skip_load_data_rows(ldi, journal_rows);
+  GString *insert=g_string_new(NULL), *next=g_string_new(NULL), *swap=NULL;
+  guint64 loaded=journal_rows;
+  guint64 num_rows=next_load_data_insert(ldi, insert), next_num_rows=0;
+  while (num_rows > 0){
+    next_num_rows=next_load_data_insert(ldi, next);
+    queue_insert_statement(td, cd, use_database, header, results_added, ir, insert->str, insert->len, preline, filename);
+    set_statement_position(*ir, stmt_offset, next_num_rows > 0 ? stmt_offset : stmt_end, range, loaded);
+    g_async_queue_push(cd->queue->restore, *ir);
+    *ir=NULL;
+    process_pipeline_result(cd->queue, ir, filename);
+    r|= (*ir)->result;
+    loaded+=num_rows;
+    num_rows=next_num_rows;
+    swap=insert;
+    insert=next;
+    next=swap;
+  }
+  guint32 expected_checksum=0, checksum=0;
+  if (load_data_insert_failed(ldi)){
+    g_critical("error reading file %s (%d)", load_data_filename, errno);
+    errors++;
+    r=1;
+  }else if (load_data_insert_checksum(ldi, &checksum) && get_file_checksum(load_data_filename, &expected_checksum) &&
+            !verify_file_checksum(load_data_filename, expected_checksum, checksum) && checksum_mode != CHECKSUM_WARN){
+    errors++;
+    r=1;
+  }
+  trace("File %s restored as INSERT, %"G_GUINT64_FORMAT" rows", load_data_filename, loaded - journal_rows);
+  free_load_data_insert(ldi);
+  myl_close(load_data_filename, file, FALSE);
+  g_string_free(insert, TRUE);
+  g_string_free(next, TRUE);
+  return r;
+}
+
+static
+int restore_data_from_mydumper_file_internal(struct thread_data *td, const char *filename, gboolean is_schema, struct database *use_database, struct data_restore_job *drj){
 
   FILE *infile=NULL;
   gboolean eof = FALSE;
-  GString *data = g_string_sized_new(256);
   guint line=0,preline=0;
   gchar *path = g_build_filename(directory, filename, NULL);
   infile=myl_open(path,"r");
@@ -529,39 +1226,87 @@ int restore_data_from_mydumper_file(struct thread_data *td, const char *filename
     errors++;
     return 1;
   }
+  GString *data = gstring_pool_get(256);
   guint r=0;
   gchar *load_data_filename=NULL;
-  gchar *load_data_fifo_filename=NULL;
-  gchar *new_load_data_fifo_filename=NULL;
-  struct connection_data *cd=wait_for_available_restore_thread(td, !is_schema && (commit_count > 1), use_database );
+  struct connection_data *cd=wait_for_available_restore_thread(td, !is_schema && (commit_count > 1) && !ingest_needs_autocommit(td->dbt), use_database );
   g_assert(g_async_queue_length(cd->queue->restore)<=0);
   g_assert(g_async_queue_length(cd->queue->result)<=0);
   guint i=0;
-  struct statement *ir=g_async_queue_pop(free_results_queue);
+  struct statement *ir=m_async_queue_pop(free_results_queue);
   gboolean results_added=FALSE;
   GString *header=g_string_sized_new(256);
+  struct statement_reader *sr=new_statement_reader(infile);
+  gchar *stmt=NULL;
+  gsize stmt_len=0;
+  gsize read_reserved=0;
+  // a range starts with the SET statements of the top of the file
+  gboolean range_pending= drj != NULL;
+  guint64 range= drj ? drj->offset : 0, stmt_offset=0, stmt_end=0, skipped_rows=0;
+  // --resume-journal, what a previous run committed is not restored again
+  struct journal_checkpoint *jc= is_schema ? NULL : get_journal_checkpoint(filename, range);
+  gboolean journal_seek_pending= jc != NULL && drj == NULL;
+  // every byte of the file is in one of the statements, unless it is read
+  // from an offset
+  guint32 expected_checksum=0, checksum=0;
+  gboolean verify_checksum= drj == NULL && jc == NULL && get_file_checksum(filename, &expected_checksum);
+  if (drj)
+    set_statement_reader_range(sr, 0, drj->header_length);
   while (eof == FALSE) {
-    if (read_data(infile, data, &eof, &line)) {
-      if (g_strrstr(&data->str[data->len >= 5 ? data->len - 5 : 0], ";\n")) {
-        if ( skip_definer && g_str_has_prefix(data->str,"CREATE")){
-          remove_definer(data);
+    if (read_statement(sr, &stmt, &stmt_len, &eof, &line)) {
+      if (verify_checksum)
+        checksum=crc32(checksum, (const Bytef *)stmt, (uInt)stmt_len);
+      // data holds at most a copy of the statement
+      memory_track(MEMORY_READ_BUFFERS, &read_reserved, memory_string_size(data, stmt_len));
+      if (stmt_len >= 2 && stmt[stmt_len-2] == ';' && stmt[stmt_len-1] == '\n') {
+        if (range_pending && !is_session_statement(stmt))
+          goto STMT_IGNORED;
+        stmt_end=statement_reader_offset(sr);
+        stmt_offset=stmt_end - stmt_len;
+        skipped_rows=0;
+        if (jc && stmt_offset < jc->offset && !is_session_statement(stmt)){
+          // the SET statements on top are executed, the file continues from
+          // the checkpoint. Compressed files that can not seek are read
+          if (journal_seek_pending){
+            journal_seek_pending=FALSE;
+            if (set_statement_reader_range(sr, jc->offset, G_MAXUINT64))
+              trace("File %s continues at offset %"G_GUINT64_FORMAT, filename, jc->offset);
+          }
+          goto STMT_IGNORED;
         }
-        if ( g_strrstr_len(data->str,6,"INSERT")){
-          request_another_connection(td, cd->queue, cd->transaction, use_database, header);
-          if (!results_added){
-            results_added=TRUE;
-            struct statement * other_ir=NULL;
-            for(i=0;i<7;i++){
-              other_ir=g_async_queue_pop(free_results_queue);
-              g_async_queue_push(cd->queue->result,initialize_statement(other_ir));
-            }
-          } 
-          assign_statement(ir, td, td->dbt, data->str, preline, FALSE, INSERT);
+        if (jc && jc->rows > 0 && stmt_offset == jc->offset && g_strrstr_len(stmt,6,"INSERT")){
+          if (!skip_insert_rows(stmt, stmt_len, jc->rows, data))
+            goto STMT_IGNORED;
+          skipped_rows=jc->rows;
+          stmt=data->str;
+          stmt_len=data->len;
+        }
+        // INSERTs are sent from the reader buffer, the rest of the statements
+        // are copied into data as they might be modified
+        if ( !g_strrstr_len(stmt,6,"INSERT")){
+          g_string_truncate(data, 0);
+          g_string_append_len(data, stmt, stmt_len);
+          if ( skip_definer && g_str_has_prefix(data->str,"CREATE")){
+            remove_definer(data);
+          }
+        }
+        if (td->staging_table){
+          if (g_strrstr_len(stmt,6,"INSERT")){
+            g_string_truncate(data, 0);
+            g_string_append_len(data, stmt, stmt_len);
+            rename_statement_table(data, td->staging_table);
+            stmt=data->str;
+            stmt_len=data->len;
+          }else
+            rename_statement_table(data, td->staging_table);
+        }
+        if ( g_strrstr_len(stmt,6,"INSERT")){
+          queue_insert_statement(td, cd, use_database, header, &results_added, &ir, stmt, stmt_len, preline, filename);
+          set_statement_position(ir, stmt_offset, stmt_end, range, skipped_rows);
           g_async_queue_push(cd->queue->restore, ir);
           ir=NULL;
-          process_result_statement(cd->queue->result, &ir, m_critical, "(2)Error occurs processing file %s", filename);
+          process_pipeline_result(cd->queue, &ir, filename);
         }else if (g_strrstr_len(data->str,10,"LOAD DATA ")){
-          GString *new_data = NULL;
           gchar *from = g_strstr_len(data->str, -1, "'");
           from++;
           gchar *to = g_strstr_len(from, -1, "'");
@@ -570,45 +1315,18 @@ int restore_data_from_mydumper_file(struct thread_data *td, const char *filename
           if (load_data_mutex_locate(load_data_filename, &mutex))
             g_mutex_lock(mutex);
 	      // TODO we need to free filename and mutex from the hash.
-          gchar **command=NULL;
-          gboolean is_fifo = get_command_and_basename(load_data_filename, &command, &load_data_fifo_filename);
-          if (is_fifo){ 
-            if (fifo_directory != NULL){
-              new_data = g_string_new_len(data->str, from - data->str);
-              g_string_append(new_data, fifo_directory);
-              g_string_append_c(new_data, '/');
-              g_string_append(new_data, from);
-              from = g_strstr_len(new_data->str, -1, "'") + 1;
-              g_string_free(data, TRUE);
-              data=new_data;
-              to = g_strstr_len(from, -1, "'");
-            }
-            guint a=0;
-            for(;a<strlen(load_data_filename)-strlen(load_data_fifo_filename);a++){
-              *to=' '; to--;
-            }
-            *to='\'';
-
-            if (fifo_directory != NULL){
-              new_load_data_fifo_filename=g_strdup_printf("%s/%s", fifo_directory, load_data_fifo_filename);
-              g_free(load_data_fifo_filename);
-              load_data_fifo_filename=new_load_data_fifo_filename;
-            }
-            if (mkfifo(load_data_fifo_filename,0666)){
-              g_critical("cannot create named pipe %s (%d)", load_data_fifo_filename, errno);
-            }
-            execute_file_per_thread(load_data_filename, load_data_fifo_filename, command );
-            release_load_data_as_it_is_close(load_data_fifo_filename);
-//              g_free(fifo_name);
+          if (load_data_as_insert){
+            r|= restore_load_data_as_insert(td, cd, use_database, header, &results_added, &ir, data, load_data_filename, preline, filename,
+                                            stmt_offset, stmt_end, range, jc && jc->offset == stmt_offset ? jc->rows : 0);
+          }else{
+            // The statement is sent as it is, the local infile handler of the
+            // connection opens and decompresses the file
+            assign_statement(ir, td, td->dbt, data->str, preline, FALSE, OTHER);
+            g_async_queue_push(cd->queue->restore,ir);
+            ir=NULL;
+            process_result_statement(cd->queue->result, &ir, m_critical, "(2)Error occurs processing file %s", filename);
           }
-
-          assign_statement(ir, td, td->dbt, data->str, preline, FALSE, OTHER);
-          g_async_queue_push(cd->queue->restore,ir);
-          ir=NULL;
-          process_result_statement(cd->queue->result, &ir, m_critical, "(2)Error occurs processing file %s", filename);
-          if (is_fifo) 
-            m_remove0(NULL, load_data_fifo_filename);
-          else
+          if (!stream_memory_remove(load_data_filename))
             m_remove(NULL, load_data_filename);
         }else{
           if (g_strrstr_len(data->str,3,"/*!")){
@@ -631,19 +1349,37 @@ int restore_data_from_mydumper_file(struct thread_data *td, const char *filename
             header=NULL;
           }
           assign_statement(ir, td, td->dbt, data->str, preline, is_schema, OTHER);
+          ir->filename=filename;
+          set_statement_position(ir, stmt_offset, stmt_end, range, 0);
           g_async_queue_push(cd->queue->restore,ir);
           ir=NULL;
           process_result_statement(cd->queue->result, &ir, m_critical, "(2)Error occurs processing file %s", filename);
         }
 
+        // ir is the result of a statement that was queued earlier, so the
+        // line of the error is the one stored on it
         r|= ir->result;
         if (ir->result>0)
-          g_critical("(1)Error occurs processing file %s",filename);
+          g_critical("(1)Error occurs processing file %s starting at line %d",filename, ir->preline);
 
 STMT_IGNORED:
         g_string_set_size(data, 0);
         preline=line+1;
       }
+      if (eof && range_pending){
+        range_pending=FALSE;
+        guint64 from=drj->offset, length=drj->length;
+        if (jc && jc->offset > from){
+          length-= jc->offset - from < length ? jc->offset - from : length;
+          from=jc->offset;
+        }
+        if (!set_statement_reader_range(sr, from, length)){
+          g_critical("cannot seek on file %s (%d)", filename, errno);
+          errors++;
+          r=1;
+        }else
+          eof=FALSE;
+      }
     } else {
       g_critical("error reading file %s (%d)", filename, errno);
       errors++;
@@ -653,12 +1389,13 @@ STMT_IGNORED:
   struct io_restore_result *queue= cd->queue;
   g_async_queue_push(free_results_queue,ir);
   if (results_added){
-    for(i=0;i<7;i++){
+    for(i=1;i<pipeline_depth;i++){
       process_result_statement(queue->result, &ir, m_critical, "(2)Error occurs processing file %s", filename);
       g_assert(ir->kind_of_statement!=CLOSE);
       g_async_queue_push(free_results_queue,ir);
     }
   }
+  wait_released_connections(td, queue);
   for(;td->granted_connections>0;td->granted_connections--){
     g_async_queue_push(queue->restore,&release_connection_statement);
     process_result_statement(queue->result, &ir, m_critical, "(2)Error occurs processing file %s", filename);
@@ -666,10 +1403,172 @@ STMT_IGNORED:
   }
   g_async_queue_push(restore_queues, queue);
 
-  g_string_free(data, TRUE);
+  memory_track(MEMORY_READ_BUFFERS, &read_reserved, 0);
+  gstring_pool_put(data);
   g_free(load_data_filename);
+  free_statement_reader(sr);
+  if (verify_checksum && !verify_file_checksum(filename, expected_checksum, checksum) && checksum_mode != CHECKSUM_WARN){
+    errors++;
+    r=1;
+  }
+
+  // the file can be removed once all its ranges are restored
+  gboolean last= drj == NULL || g_atomic_int_dec_and_test(drj->pending_ranges);
+  myl_close(filename, infile, last);
+  if (last && !is_schema)
+    verify_restored_chunks(filename);
+  if (drj && last){
+    g_free(drj->pending_ranges);
+    gchar *index_filename=g_strdup_printf("%s.idx", filename);
+    m_remove(directory, index_filename);
+    g_free(index_filename);
+  }
+  g_free(path);
+  return r;
+}
+
+int restore_data_from_mydumper_file(struct thread_data *td, const char *filename, gboolean is_schema, struct database *use_database){
+  return restore_data_from_mydumper_file_internal(td, filename, is_schema, use_database, NULL);
+}
+
+int restore_data_range_from_mydumper_file(struct thread_data *td, const char *filename, struct database *use_database, struct data_restore_job *drj){
+  return restore_data_from_mydumper_file_internal(td, filename, FALSE, use_database, drj);
+}
+
+/* The file is read in blocks and every complete row is appended to the
+   statement, which is sent when it has --rows rows or the size limit of a
+   statement is reached */
+int restore_data_from_binary_file(struct thread_data *td, const char *filename, struct database *use_database){
+  // the rows are bound to a prepared statement that is not sent as text
+  if (fan_out_in_use())
+    m_critical("BINARY_DATA file %s can not be restored with --fan-out-hosts", filename);
+  gchar *path = g_build_filename(directory, filename, NULL);
+  FILE *infile=myl_open(path,"r");
+  if (!infile) {
+    g_critical("cannot open file %s (%d)", filename, errno);
+    errors++;
+    g_free(path);
+    return 1;
+  }
+  struct connection_data *cd=wait_for_available_restore_thread(td, commit_count > 1 && !ingest_needs_autocommit(td->dbt), use_database);
+  struct io_restore_result *queue= cd->queue;
+  cd=NULL;
+  struct statement *ir=m_async_queue_pop(free_results_queue);
+  struct statement *pending=NULL;
+  struct row_binary_header *header=NULL;
+  GString *data=gstring_pool_get(BINARY_READ_SIZE);
+  gchar *block=g_new(gchar, BINARY_READ_SIZE);
+  gsize pos=0, consumed=0, n;
+  guint max_rows=0, row_number=1, i;
+  gboolean eof=FALSE, results_added=FALSE;
+  gint st;
+  const gchar **values=NULL;
+  gulong *lengths=NULL;
+  int r=0;
+
+  initialize_statement(ir);
+  g_string_set_size(ir->buffer, 0);
+  ir->num_rows=0;
+  while (!eof || pos < data->len){
+    if (!eof){
+      n=fread(block, 1, BINARY_READ_SIZE, infile);
+      if (n == 0)
+        eof=TRUE;
+      else
+        g_string_append_len(data, block, n);
+    }
+    if (header == NULL){
+      st=row_binary_read_header(data->str, data->len, &header, &consumed);
+      if (st < 0){
+        g_critical("File %s is not in %s format", filename, ROW_BINARY_MAGIC);
+        errors++;
+        r=1;
+        break;
+      }
+      if (st == 0){
+        if (eof)
+          break;
+        continue;
+      }
+      pos=consumed;
+      // the server accepts up to 65535 placeholders per statement
+      max_rows= 65535 / header->num_columns;
+      if (rows > 0 && rows < max_rows)
+        max_rows=rows;
+      values=g_new(const gchar *, header->num_columns);
+      lengths=g_new(gulong, header->num_columns);
+    }
+    while ((st=row_binary_read_row(data->str + pos, data->len - pos, header->num_columns, values, lengths, &consumed)) == 1){
+      if (ir->num_rows == 0)
+        ir->preline=row_number;
+      g_string_append_len(ir->buffer, data->str + pos, consumed);
+      pos+=consumed;
+      ir->num_rows++;
+      row_number++;
+      if (ir->num_rows >= max_rows || ir->buffer->len >= BINARY_STATEMENT_SIZE){
+        ir->kind_of_statement=BINARY_INSERT;
+        ir->binary_header=header;
+        ir->dbt=td->dbt;
+        ir->td=td;
+        ir->filename=filename;
+        if (!results_added){
+          results_added=TRUE;
+          for(i=1;i<pipeline_depth;i++){
+            pending=m_async_queue_pop(free_results_queue);
+            g_async_queue_push(queue->result,initialize_statement(pending));
+          }
+        }
+        g_async_queue_push(queue->restore, ir);
+        ir=NULL;
+        r|=process_pipeline_result(queue, &ir, filename);
+        initialize_statement(ir);
+        g_string_set_size(ir->buffer, 0);
+        ir->num_rows=0;
+      }
+    }
+    // keep the incomplete row for the next block
+    g_string_erase(data, 0, pos);
+    pos=0;
+    if (eof && data->len > 0){
+      g_critical("File %s ends with an incomplete row", filename);
+      errors++;
+      r=1;
+      break;
+    }
+  }
+  if (r == 0 && ir->num_rows > 0){
+    ir->kind_of_statement=BINARY_INSERT;
+    ir->binary_header=header;
+    ir->dbt=td->dbt;
+    ir->td=td;
+    ir->filename=filename;
+    g_async_queue_push(queue->restore, ir);
+    ir=NULL;
+    r|=process_result_statement(queue->result, &ir, m_critical, "(2)Error occurs processing file %s", filename);
+  }
+  g_async_queue_push(free_results_queue,ir);
+  if (results_added){
+    for(i=1;i<pipeline_depth;i++){
+      r|=process_result_statement(queue->result, &ir, m_critical, "(2)Error occurs processing file %s", filename);
+      g_assert(ir->kind_of_statement!=CLOSE);
+      g_async_queue_push(free_results_queue,ir);
+    }
+  }
+  for(;td->granted_connections>0;td->granted_connections--){
+    g_async_queue_push(queue->restore,&release_connection_statement);
+    process_result_statement(queue->result, &ir, m_critical, "(2)Error occurs processing file %s", filename);
+    g_assert(ir->kind_of_statement==CLOSE);
+  }
+  g_async_queue_push(restore_queues, queue);
 
+  if (header)
+    free_row_binary_header(header);
+  g_free(values);
+  g_free(lengths);
+  g_free(block);
+  gstring_pool_put(data);
   myl_close(filename, infile, TRUE);
+  verify_restored_chunks(filename);
   g_free(path);
   return r;
 }
@@ -681,7 +1580,7 @@ int restore_data_in_gstring_extended(struct thread_data *td, GString *data, gboo
   struct connection_data *cd=wait_for_available_restore_thread(td, !is_schema && (commit_count > 1), use_database );
   struct io_restore_result *queue= cd->queue;
   cd=NULL;
-  struct statement *ir=g_async_queue_pop(free_results_queue);
+  struct statement *ir=m_async_queue_pop(free_results_queue);
   int i=0;
   int r=0;
   if (data != NULL && data->len > 4){
@@ -16,8 +16,13 @@
 */
 #define DEFAULT_DELIMITER ";\n"
 #define DEFAULT_MAX_TRANSACTION_SIZE 1000
+#define BINARY_READ_SIZE 1024*1024
+// kept below the default max_allowed_packet
+#define BINARY_STATEMENT_SIZE 16*1024*1024
+// --pipeline-depth with --max-memory, the statement size of mydumper by default
+#define DEFAULT_PIPELINE_STATEMENT_SIZE 1000000
 
-enum kind_of_statement { NOT_DEFINED, INSERT, OTHER, CLOSE};
+enum kind_of_statement { NOT_DEFINED, INSERT, BINARY_INSERT, OTHER, CLOSE};
 
 struct statement{
   guint result;
@@ -30,15 +35,33 @@ struct statement{
   guint error_number;
   struct db_table *dbt;
   struct thread_data*td;
+  // BINARY_INSERT: buffer has num_rows rows encoded as in the file
+  struct row_binary_header *binary_header;
+  guint num_rows;
+  // bytes of buffer reserved from --max-memory
+  gsize memory_reserved;
+  // --resume-journal, where the statement is in the file
+  guint64 offset;
+  guint64 end_offset;
+  guint64 journal_range;
+  // rows of the statement in the file that were restored by a previous run
+  guint64 skipped_rows;
 };
 
 void initialize_restore();
+struct shard_filter;
+void set_local_infile_handler(MYSQL *thrconn, struct shard_filter *sf);
+guint next_insert_rows(gchar **current_line, gchar **next_line, gchar **last_line, gchar *end, guint max_rows);
 void initialize_connection_pool();
 void start_connection_pool();
 
 int restore_data_in_gstring(struct thread_data *td, GString *data, gboolean is_schema, struct database *use_database);
 int restore_data_in_gstring_extended(struct thread_data *td, GString *data, gboolean is_schema, struct database *use_database, void log_fun(const char *, ...) , const char *fmt, ...);
 int restore_data_from_mydumper_file(struct thread_data *td, const char *filename, gboolean is_schema, struct database *use_database);
+struct data_restore_job;
+int restore_data_range_from_mydumper_file(struct thread_data *td, const char *filename, struct database *use_database, struct data_restore_job *drj);
+int restore_data_from_binary_file(struct thread_data *td, const char *filename, struct database *use_database);
 void release_load_data_as_it_is_close( gchar * filename );
 void close_restore_thread();
 void wait_restore_threads_to_close();
+void pipeline_report();
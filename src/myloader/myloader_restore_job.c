@@ -32,6 +32,10 @@
 #include "myloader_worker_loader.h"
 #include "myloader_worker_index.h"
 #include "myloader_database.h"
+#include "myloader_worker_loader_main.h"
+#include "myloader_exchange_partition.h"
+#include "myloader_transportable.h"
+#include "myloader_worker_post.h"
 
 unsigned long long int total_data_sql_files = 0;
 gboolean shutdown_triggered=FALSE;
@@ -41,22 +45,258 @@ static GMutex *single_threaded_create_table = NULL;
 GMutex *shutdown_triggered_mutex=NULL;
 unsigned long long int progress = 0;
 enum purge_mode purge_mode = FAIL;
+gchar *ingest_order_str=NULL;
+static gboolean clustered_order=FALSE;
+
+void initialize_ingest_order(){
+  clustered_order=FALSE;
+  if (ingest_order_str){
+    if (!g_ascii_strcasecmp(ingest_order_str, "CLUSTERED"))
+      clustered_order=TRUE;
+    else if (g_ascii_strcasecmp(ingest_order_str, "INTERLEAVED"))
+      m_critical("--ingest-order must be INTERLEAVED or CLUSTERED");
+  }
+}
 
 void initialize_restore_job(){
+  initialize_ingest_order();
   file_list_to_do = g_async_queue_new();
   single_threaded_create_table = g_mutex_new();
   progress_mutex = g_mutex_new();
   shutdown_triggered_mutex = g_mutex_new();
 }
 
+static
+guint32 reverse_bits(guint32 v){
+  v=((v >> 1) & 0x55555555) | ((v & 0x55555555) << 1);
+  v=((v >> 2) & 0x33333333) | ((v & 0x33333333) << 2);
+  v=((v >> 4) & 0x0F0F0F0F) | ((v & 0x0F0F0F0F) << 4);
+  v=((v >> 8) & 0x00FF00FF) | ((v & 0x00FF00FF) << 8);
+  return (v >> 16) | (v << 16);
+}
+
 struct data_restore_job * new_data_restore_job_internal( guint index, guint part, guint sub_part){
   struct data_restore_job *drj = g_new(struct data_restore_job, 1);
   drj->index    = index;
   drj->part     = part;
   drj->sub_part = sub_part;
+  drj->size     = 0;
+  drj->is_binary= FALSE;
+  drj->is_tablespace= FALSE;
+  drj->header_length=0;
+  drj->offset=0;
+  drj->length=0;
+  drj->pending_ranges=NULL;
+  drj->prefetch_requested=FALSE;
+  drj->run=RESTORE_JOB_NO_RUN;
+  // the parts are interleaved: the lowest bit that differs decides
+  drj->order=((guint64)(clustered_order ? part : reverse_bits(part)) << 32) | sub_part;
   return drj;
 }
 
+/* --ingest-order CLUSTERED: the jobs of the table are kept sorted and every
+   thread of the table owns a run of consecutive parts, so it inserts at the
+   right edge of its own range of the clustered index. A run continues with
+   the next job while no other run has started in between, otherwise it
+   starts again in the largest range of jobs that no run is going to reach:
+   at its beginning when no run ends right before it, or at its middle */
+static
+void clustered_heap_insert(GPtrArray *heap, struct restore_job *rj){
+  guint64 order=rj->data.drj->order;
+  guint low=0, high=heap->len;
+  // the files are usually found in order
+  if (high > 0 && ((struct restore_job *)g_ptr_array_index(heap, high - 1))->data.drj->order <= order)
+    low=high;
+  while (low < high){
+    guint middle=(low + high) / 2;
+    if (((struct restore_job *)g_ptr_array_index(heap, middle))->data.drj->order <= order)
+      low=middle + 1;
+    else
+      high=middle;
+  }
+  g_ptr_array_insert(heap, low, rj);
+}
+
+// the runs whose last order is after a and before b
+static
+gboolean run_between(struct db_table *dbt, guint64 a, guint64 b){
+  guint r;
+  for (r=0; r < dbt->runs; r++)
+    if (dbt->run_started[r] && dbt->run_last[r] > a && dbt->run_last[r] < b)
+      return TRUE;
+  return FALSE;
+}
+
+// index of the first job after order
+static
+guint clustered_heap_after(GPtrArray *heap, guint64 order){
+  guint low=0, high=heap->len;
+  while (low < high){
+    guint middle=(low + high) / 2;
+    if (((struct restore_job *)g_ptr_array_index(heap, middle))->data.drj->order <= order)
+      low=middle + 1;
+    else
+      high=middle;
+  }
+  return low;
+}
+
+static
+struct restore_job *clustered_heap_take(struct db_table *dbt){
+  GPtrArray *heap=dbt->restore_job_heap;
+  guint r, free_run=dbt->runs, i, start=0, take=0;
+  if (dbt->run_last == NULL){
+    dbt->runs=num_threads;
+    dbt->run_last=g_new0(guint64, dbt->runs);
+    dbt->run_started=g_new0(gboolean, dbt->runs);
+    dbt->run_busy=g_new0(gboolean, dbt->runs);
+    free_run=dbt->runs;
+  }
+  for (r=0; r < dbt->runs; r++){
+    if (dbt->run_busy[r])
+      continue;
+    if (free_run == dbt->runs)
+      free_run=r;
+    if (!dbt->run_started[r])
+      continue;
+    i=clustered_heap_after(heap, dbt->run_last[r]);
+    if (i < heap->len && !run_between(dbt, dbt->run_last[r], ((struct restore_job *)g_ptr_array_index(heap, i))->data.drj->order)){
+      free_run=r;
+      take=i;
+      goto found;
+    }
+  }
+  if (free_run == dbt->runs){
+    // more threads than runs, the first job
+    struct restore_job *rj=restore_job_heap_pop(heap);
+    if (rj)
+      rj->data.drj->run=RESTORE_JOB_NO_RUN;
+    return rj;
+  }
+  // the segments are the jobs between two runs
+  guint best_length=0;
+  for (i=0; i <= heap->len; i++){
+    if (i < heap->len && (i == start ||
+        !run_between(dbt, ((struct restore_job *)g_ptr_array_index(heap, i-1))->data.drj->order, ((struct restore_job *)g_ptr_array_index(heap, i))->data.drj->order)))
+      continue;
+    if (i > start){
+      guint64 first=((struct restore_job *)g_ptr_array_index(heap, start))->data.drj->order;
+      gboolean preceded=FALSE;
+      for (r=0; r < dbt->runs; r++)
+        if (dbt->run_started[r] && dbt->run_last[r] < first && !run_between(dbt, dbt->run_last[r], first))
+          preceded=TRUE;
+      guint length= preceded ? (i - start) / 2 : i - start;
+      if (best_length == 0 || length > best_length){
+        best_length=MAX(length, 1);
+        take= preceded ? start + (i - start) / 2 : start;
+      }
+    }
+    start=i;
+  }
+found:
+  {
+    struct restore_job *rj=g_ptr_array_remove_index(heap, take);
+    dbt->run_last[free_run]=rj->data.drj->order;
+    dbt->run_started[free_run]=TRUE;
+    dbt->run_busy[free_run]=TRUE;
+    rj->data.drj->run=free_run;
+    return rj;
+  }
+}
+
+// Called with the table locked
+struct restore_job *restore_job_take(struct db_table *dbt){
+  if (!clustered_order)
+    return restore_job_heap_pop(dbt->restore_job_heap);
+  return clustered_heap_take(dbt);
+}
+
+// The jobs taken when every run was busy have no run to release
+void restore_job_done(struct db_table *dbt, guint run){
+  if (clustered_order && dbt->run_busy && run != RESTORE_JOB_NO_RUN)
+    dbt->run_busy[run]=FALSE;
+}
+
+/* Pending data jobs of a table, a min heap on drj->order. The chunks that
+   are restored at the same time are far from each other in the table */
+void restore_job_heap_push(GPtrArray *heap, struct restore_job *rj){
+  if (clustered_order){
+    clustered_heap_insert(heap, rj);
+    return;
+  }
+  guint i=heap->len, parent;
+  guint64 order=rj->data.drj->order;
+  g_ptr_array_add(heap, rj);
+  while (i > 0){
+    parent=(i-1)/2;
+    if (((struct restore_job *)g_ptr_array_index(heap, parent))->data.drj->order <= order)
+      break;
+    heap->pdata[i]=heap->pdata[parent];
+    i=parent;
+  }
+  heap->pdata[i]=rj;
+}
+
+struct restore_job *restore_job_heap_pop(GPtrArray *heap){
+  if (heap->len == 0)
+    return NULL;
+  if (clustered_order)
+    return g_ptr_array_remove_index(heap, 0);
+  struct restore_job *top=g_ptr_array_index(heap, 0);
+  struct restore_job *last=g_ptr_array_index(heap, heap->len - 1);
+  g_ptr_array_set_size(heap, heap->len - 1);
+  guint i=0, child, len=heap->len;
+  if (len > 0){
+    while ((child=2*i+1) < len){
+      if (child + 1 < len &&
+          ((struct restore_job *)g_ptr_array_index(heap, child + 1))->data.drj->order < ((struct restore_job *)g_ptr_array_index(heap, child))->data.drj->order)
+        child++;
+      if (last->data.drj->order <= ((struct restore_job *)g_ptr_array_index(heap, child))->data.drj->order)
+        break;
+      heap->pdata[i]=heap->pdata[child];
+      i=child;
+    }
+    heap->pdata[i]=last;
+  }
+  return top;
+}
+
+/* Fills next with the positions of the first k jobs that restore_job_take()
+   is going to return, and returns how many there are. Only the root of the
+   min heap is ordered, so they are found walking it from the root, keeping
+   the children of the jobs that were taken as the frontier. The clustered
+   order is sorted, its first positions are the next jobs */
+guint restore_job_heap_next(GPtrArray *heap, guint k, guint *next){
+  guint n=0, i;
+  if (clustered_order){
+    for (n=0; n < k && n < heap->len; n++)
+      next[n]=n;
+    return n;
+  }
+  if (heap->len == 0 || k == 0)
+    return 0;
+  // every job taken adds at most two children and removes itself
+  guint *frontier=g_new(guint, k + 1);
+  guint frontier_len=1;
+  frontier[0]=0;
+  while (n < k && frontier_len > 0){
+    guint best=0;
+    for (i=1; i < frontier_len; i++)
+      if (((struct restore_job *)g_ptr_array_index(heap, frontier[i]))->data.drj->order <
+          ((struct restore_job *)g_ptr_array_index(heap, frontier[best]))->data.drj->order)
+        best=i;
+    guint position=frontier[best];
+    frontier[best]=frontier[--frontier_len];
+    next[n++]=position;
+    if (2*position+1 < heap->len)
+      frontier[frontier_len++]=2*position+1;
+    if (2*position+2 < heap->len)
+      frontier[frontier_len++]=2*position+2;
+  }
+  g_free(frontier);
+  return n;
+}
+
 struct schema_restore_job * new_schema_restore_job_internal( struct database * database, GString * statement, enum restore_job_statement_type object){
   struct schema_restore_job *srj = g_new(struct schema_restore_job, 1);
   srj->database  = database;
@@ -200,32 +440,14 @@ void increse_object_error(enum restore_job_statement_type object){
   }
 }
 
-void schema_state_increment(gchar* _key, struct db_table* dbt, guint *total, enum schema_status schema_state){
-  (void) _key;
-  if (dbt->schema_state >= schema_state){
-    *total = *total + 1;
-  }
-}
-
-void is_all_done(gchar* _key, struct db_table* dbt, guint *total){
-  schema_state_increment(_key, dbt, total, ALL_DONE);
-}
-
-void is_created(gchar* _key, struct db_table* dbt, guint *total){
-  schema_state_increment(_key, dbt, total, CREATED);
-}
-
-
 void get_total_done(struct configuration * conf, guint *total){
-  g_mutex_lock(conf->table_hash_mutex);
-  g_hash_table_foreach(conf->table_hash,(void (*)(void *, void *, void *)) &is_all_done, total);
-  g_mutex_unlock(conf->table_hash_mutex);
+  (void) conf;
+  *total=get_tables_all_done();
 }
 
 void get_total_created(struct configuration * conf, guint *total){
-  g_mutex_lock(conf->table_hash_mutex);
-  g_hash_table_foreach(conf->table_hash,(void (*)(void *, void *, void *)) &is_created, total);
-  g_mutex_unlock(conf->table_hash_mutex);
+  (void) conf;
+  *total=get_tables_created();
 }
 
 void execute_drop_database(struct thread_data *td, gchar *database) {
@@ -269,18 +491,19 @@ int process_restore_job(struct thread_data *td, struct restore_job *rj){
            ){
         get_total_done(td->conf, &total);
           message("Thread %d: restoring %s %s.%s from %s. Tables %d of %d completed", td->thread_id,
-                    rjstmtype2str(rj->data.srj->object), dbt->database->target_database, dbt->source_table_name, rj->filename, total , g_hash_table_size(td->conf->table_hash));
+                    rjstmtype2str(rj->data.srj->object), dbt->database->target_database, dbt->source_table_name, rj->filename, total , table_registry_size());
           if (restore_data_in_gstring(td, rj->data.srj->statement, FALSE, rj->data.srj->database)){
             increse_object_error(rj->data.srj->object);
             message("Failed %s: %s",rjstmtype2str(rj->data.srj->object),rj->data.srj->statement->str);
-          }
+          }else if (rj->data.srj->object==CONSTRAINTS)
+            queue_foreign_key_checks(dbt, rj->data.srj->statement->str);
         }
       }
       free_schema_restore_job(rj->data.srj);
       break;
     case JOB_TO_CREATE_TABLE:
 
-      dbt->schema_state=CREATING;
+      set_table_schema_state(dbt, CREATING);
       if ((!source_db || g_strcmp0(dbt->database->source_database,source_db)==0) && !no_schemas && !dbt->object_to_export.no_schema ){
         if (serial_tbl_creation) g_mutex_lock(single_threaded_create_table);
         message("Thread %d: restoring table %s.%s from %s", td->thread_id,
@@ -291,7 +514,7 @@ int process_restore_job(struct thread_data *td, struct restore_job *rj){
           if (overwrite_error) {
             if (dbt->retry_count) {
               dbt->retry_count--;
-              dbt->schema_state= NOT_CREATED;
+              set_table_schema_state(dbt, NOT_CREATED);
               m_warning("Drop table %s.%s failed: retry %u of %u", dbt->database->target_database, dbt->source_table_name, retry_count - dbt->retry_count, retry_count);
               return 1;
             } else {
@@ -322,12 +545,13 @@ int process_restore_job(struct thread_data *td, struct restore_job *rj){
             }
           }else{
             get_total_created(td->conf, &total);
-            message("Thread %d: Table %s.%s created. Tables that pass created stage: %d of %d", td->thread_id, dbt->database->target_database, dbt->source_table_name, total , g_hash_table_size(td->conf->table_hash));
+            message("Thread %d: Table %s.%s created. Tables that pass created stage: %d of %d", td->thread_id, dbt->database->target_database, dbt->source_table_name, total , table_registry_size());
           }
         }
         if (serial_tbl_creation) g_mutex_unlock(single_threaded_create_table);
       }
-      dbt->schema_state=CREATED;
+      set_table_schema_state(dbt, CREATED);
+      data_table_ready(dbt);
       free_schema_restore_job(rj->data.srj);
       break;
     case JOB_RESTORE_FILENAME:
@@ -336,12 +560,24 @@ int process_restore_job(struct thread_data *td, struct restore_job *rj){
           progress++;
           get_total_done(td->conf, &total);
           message("Thread %d: restoring %s.%s part %d of %d from %s | Progress %llu of %llu. Tables %d of %d completed", td->thread_id,
-                    dbt->database->target_database, dbt->source_table_name, rj->data.drj->index, dbt->count, rj->filename, progress,total_data_sql_files, total , g_hash_table_size(td->conf->table_hash));
+                    dbt->database->target_database, dbt->source_table_name, rj->data.drj->index, dbt->count, rj->filename, progress,total_data_sql_files, total , table_registry_size());
           g_mutex_unlock(progress_mutex);
-          if (restore_data_from_file(td, rj->filename, FALSE, dbt->database) > 0){
+          // the prepared INSERT of the binary files is not redirected
+          struct exchange_partition *ep=rj->data.drj->is_binary || rj->data.drj->is_tablespace ? NULL : get_exchange_partition(rj->filename);
+          td->staging_table= ep && prepare_exchange_partition(td, ep) ? ep->staging_table : NULL;
+          if ((rj->data.drj->is_tablespace ?
+                 restore_tablespace_file(td, dbt, rj->filename) :
+                 rj->data.drj->is_binary ?
+                 restore_data_from_binary_file(td, rj->filename, dbt->database) :
+                 rj->data.drj->length > 0 ?
+                 restore_data_range_from_mydumper_file(td, rj->filename, dbt->database, rj->data.drj) :
+                 restore_data_from_file(td, rj->filename, FALSE, dbt->database)) > 0){
             g_atomic_int_inc(&(detailed_errors.data_errors));
             g_critical("Thread : issue restoring %s", rj->filename);
           }
+          td->staging_table=NULL;
+          if (ep)
+            exchange_partition_file_done(td, ep);
       }
       g_atomic_int_dec_and_test(&(dbt->remaining_jobs));
       g_free(rj->data.drj);
@@ -367,9 +603,9 @@ int process_restore_job(struct thread_data *td, struct restore_job *rj){
            ){
           get_total_done(td->conf, &total); 
           message("Thread %d: restoring %s on `%s` from %s. Tables %d of %d completed", td->thread_id, rjstmtype2str(rj->data.srj->object),
-                    rj->data.srj->database->target_database, rj->filename, total , g_hash_table_size(td->conf->table_hash));
+                    rj->data.srj->database->target_database, rj->filename, total , table_registry_size());
           if (dbt)
-            dbt->schema_state= CREATING;
+            set_table_schema_state(dbt, CREATING);
 
           if ( rj->data.srj->object == CREATE_DATABASE){
             rj->data.srj->database->schema_state = CREATING;
@@ -380,9 +616,11 @@ int process_restore_job(struct thread_data *td, struct restore_job *rj){
           if ( restore_data_from_file(td, rj->filename, TRUE, rj->data.srj->object == CREATE_DATABASE ? NULL :rj->data.srj->database ) > 0 ) {
             increse_object_error(rj->data.srj->object);
             if (dbt)
-              dbt->schema_state= NOT_CREATED;
-          } else if (dbt)
-            dbt->schema_state= CREATED;
+              set_table_schema_state(dbt, NOT_CREATED);
+          } else if (dbt){
+            set_table_schema_state(dbt, CREATED);
+            data_table_ready(dbt);
+          }
 
           if ( rj->data.srj->object == CREATE_DATABASE)
             rj->data.srj->database->schema_state = CREATED;
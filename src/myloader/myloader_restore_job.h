@@ -66,10 +66,29 @@ const char * rjstmtype2str(enum restore_job_statement_type rjstmtype)
   return 0;
 }
 
+#define RESTORE_JOB_NO_RUN G_MAXUINT
+
 struct data_restore_job{
   guint index;
   guint part;
   guint sub_part;
+  guint64 size;
+  gboolean is_binary;
+  // .ibd of mydumper --transportable-tablespaces
+  gboolean is_tablespace;
+  // range of the file from its .idx, length is 0 when it is the whole file
+  guint64 header_length;
+  guint64 offset;
+  guint64 length;
+  // ranges of the same file that are not restored yet
+  gint *pending_ranges;
+  // position in the restore job heap of the table
+  guint64 order;
+  // --ingest-order CLUSTERED, run of the table that took it or
+  // RESTORE_JOB_NO_RUN
+  guint run;
+  // --prefetch-files, it was queued to the prefetch threads
+  gboolean prefetch_requested;
 };
 
 struct schema_restore_job{
@@ -91,10 +110,16 @@ struct restore_job {
   struct db_table *dbt;
 };
 
+void initialize_ingest_order();
 void initialize_restore_job();
 //struct restore_job * new_restore_job( char * filename, /*char * database,*/ struct db_table * dbt, GString * statement, guint part, guint sub_part, enum restore_job_type type, const char *object);
 struct restore_job * new_data_restore_job( char * filename, enum restore_job_type type, struct db_table * dbt, guint part, guint sub_part);
 struct restore_job * new_schema_restore_job( char * filename, enum restore_job_type type, struct db_table * dbt, struct database * database, GString * statement, enum restore_job_statement_type object);
+void restore_job_heap_push(GPtrArray *heap, struct restore_job *rj);
+struct restore_job *restore_job_heap_pop(GPtrArray *heap);
+guint restore_job_heap_next(GPtrArray *heap, guint k, guint *next);
+struct restore_job *restore_job_take(struct db_table *dbt);
+void restore_job_done(struct db_table *dbt, guint run);
 int process_restore_job(struct thread_data *td, struct restore_job *rj);
 void restore_job_finish();
 void stop_signal_thread();
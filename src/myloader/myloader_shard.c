@@ -0,0 +1,459 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "myloader.h"
+#include "myloader_global.h"
+#include "myloader_fan_out.h"
+#include "myloader_shard.h"
+
+#define SHARD_READ_SIZE 64*1024
+
+gchar *shard_column=NULL;
+gchar *shard_function_str=NULL;
+
+static guint num_shards=0;
+// --shard-function range, num_shards - 1 upper bounds
+static gdouble *range_bounds=NULL;
+static __thread GString *shard_value=NULL;
+
+struct shard_reader {
+  FILE *file;
+  struct shard_load_data *sld;
+  guint shard;
+  // read from the file and not split in lines yet
+  GString *in;
+  // lines of the shard not handed to the server yet
+  GString *out;
+  gsize out_pos;
+  GString *value;
+  gboolean eof;
+  gboolean header_pending;
+};
+
+void initialize_shard(){
+  if (!shard_column && g_hash_table_size(conf_per_table.all_shard_column_per_table) == 0)
+    return;
+  if (!fan_out_in_use())
+    m_critical("--shard-column needs the rest of the shards in --fan-out-hosts");
+  // the offsets of the journal are of the regrouped statements, not of the file
+  if (resume_journal)
+    m_critical("--shard-column can not be used with --resume-journal");
+  num_shards=fan_out_target_count() + 1;
+  if (shard_function_str && g_str_has_prefix(shard_function_str, "range:")){
+    gchar **bounds=g_strsplit(shard_function_str + strlen("range:"), ",", 0);
+    guint i;
+    if (g_strv_length(bounds) != num_shards - 1)
+      m_critical("--shard-function range needs %u bounds, one less than the amount of shards", num_shards - 1);
+    range_bounds=g_new(gdouble, num_shards - 1);
+    for (i = 0; i < num_shards - 1; i++){
+      gchar *e=NULL;
+      range_bounds[i]=g_ascii_strtod(bounds[i], &e);
+      if (e == bounds[i])
+        m_critical("Invalid bound %s in --shard-function", bounds[i]);
+      if (i > 0 && range_bounds[i] <= range_bounds[i - 1])
+        m_critical("The bounds of --shard-function must be increasing");
+    }
+    g_strfreev(bounds);
+  }else if (shard_function_str && g_ascii_strcasecmp(shard_function_str, "hash"))
+    m_critical("--shard-function must be hash or range:<bound>[,<bound>...]");
+  g_message("Distributing the rows over %u shards by %s", num_shards, range_bounds ? "range" : "hash");
+}
+
+gboolean shard_in_use(){
+  return num_shards > 0;
+}
+
+guint shard_count(){
+  return num_shards;
+}
+
+void set_table_shard_column(struct db_table *dbt, const gchar *key){
+  gchar *column=g_hash_table_lookup(conf_per_table.all_shard_column_per_table, key);
+  dbt->shard_column= column ? column : shard_column;
+  dbt->shard_column_position=-1;
+}
+
+static
+gboolean is_shard_column(struct db_table *dbt, const gchar *name, gsize len){
+  return strlen(dbt->shard_column) == len && !g_ascii_strncasecmp(dbt->shard_column, name, len);
+}
+
+// Position of the column in the CREATE TABLE, used by the INSERTs without column list
+void parse_shard_column_position(struct db_table *dbt, struct table_definition *def){
+  if (!dbt->shard_column)
+    return;
+  guint position;
+  for (position=0; position < def->columns->len; position++){
+    const gchar *column=g_ptr_array_index(def->columns, position);
+    if (is_shard_column(dbt, column, strlen(column))){
+      dbt->shard_column_position=position;
+      return;
+    }
+  }
+  g_message("Table %s.%s has no column %s, all its rows are restored in every shard", dbt->database->target_database, dbt->source_table_name, dbt->shard_column);
+}
+
+// Index of the column in a list like `a`,`b`,@c that ends with )
+static
+gint column_in_list(struct db_table *dbt, const gchar *p, const gchar *end){
+  gint index=0;
+  while (p < end && *p != ')'){
+    while (p < end && (*p == ' ' || *p == '@' || *p == identifier_quote_character))
+      p++;
+    const gchar *name=p;
+    while (p < end && *p != ',' && *p != ')' && *p != identifier_quote_character)
+      p++;
+    if (is_shard_column(dbt, name, p - name))
+      return index;
+    while (p < end && *p != ',' && *p != ')')
+      p++;
+    if (p < end && *p == ',')
+      p++;
+    index++;
+  }
+  return -1;
+}
+
+gint insert_shard_column(struct db_table *dbt, const gchar *insert, gsize prefix_len){
+  if (!dbt->shard_column)
+    return -1;
+  const gchar *p=insert, *end=insert + prefix_len;
+  gboolean quoted=FALSE;
+  for (; p < end; p++){
+    if (*p == identifier_quote_character)
+      quoted=!quoted;
+    else if (!quoted && *p == '(')
+      return column_in_list(dbt, p + 1, end);
+  }
+  return dbt->shard_column_position;
+}
+
+static
+guint shard_of_value(const gchar *value, gsize len){
+  guint i;
+  if (range_bounds == NULL)
+    return crc32(0L, (const Bytef *)value, len) % num_shards;
+  gchar *number=g_strndup(value, len);
+  gdouble v=g_ascii_strtod(number, NULL);
+  g_free(number);
+  for (i = 0; i < num_shards - 1; i++)
+    if (v < range_bounds[i])
+      return i;
+  return num_shards - 1;
+}
+
+static
+gchar unescape_char(gchar c){
+  switch (c){
+    case '0': return '\0';
+    case 'b': return '\b';
+    case 'n': return '\n';
+    case 'r': return '\r';
+    case 't': return '\t';
+    case 'Z': return '\032';
+    default: return c;
+  }
+}
+
+static
+gint hex_digit(gchar c){
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return 0;
+}
+
+/* A value of an INSERT row as it is written by mydumper: a quoted string,
+   with or without charset introducer, a 0x hex string, NULL or a number.
+   Strings are hashed unescaped, so the shard is CRC32(column) % shards */
+static
+guint insert_value_shard(const gchar *p, const gchar *end){
+  if (shard_value == NULL)
+    shard_value=g_string_sized_new(256);
+  g_string_truncate(shard_value, 0);
+  while (p < end && *p == ' ')
+    p++;
+  while (end > p && end[-1] == ' ')
+    end--;
+  const gchar *quote=memchr(p, '\'', end - p);
+  if (quote){
+    for (p = quote + 1; p < end; p++){
+      if (*p == '\\' && p + 1 < end)
+        g_string_append_c(shard_value, unescape_char(*(++p)));
+      else if (*p == '\'' && p + 1 < end && p[1] == '\'')
+        g_string_append_c(shard_value, *(p++));
+      else if (*p == '\'')
+        break;
+      else
+        g_string_append_c(shard_value, *p);
+    }
+  }else if (end - p == 4 && !g_ascii_strncasecmp(p, "NULL", 4)){
+    return 0;
+  }else if (end - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')){
+    for (p += 2; p + 1 < end; p += 2)
+      g_string_append_c(shard_value, hex_digit(p[0]) * 16 + hex_digit(p[1]));
+  }else
+    g_string_append_len(shard_value, p, end - p);
+  return shard_of_value(shard_value->str, shard_value->len);
+}
+
+// Shard of a row like (1,'a',NULL), rows without the column go to shard 0
+gint row_shard(const gchar *row, const gchar *end, gint column){
+  const gchar *p=memchr(row, '(', end - row);
+  gint field=0;
+  if (p == NULL)
+    return 0;
+  for (p++; p < end; p++, field++){
+    const gchar *start=p;
+    gboolean in_quote=FALSE;
+    guint depth=0;
+    for (; p < end; p++){
+      if (in_quote){
+        if (*p == '\\')
+          p++;
+        else if (*p == '\'')
+          in_quote=FALSE;
+      }else if (*p == '\'')
+        in_quote=TRUE;
+      else if (*p == '(')
+        depth++;
+      else if (*p == ')' && depth > 0)
+        depth--;
+      else if ((*p == ',' || *p == ')') && depth == 0)
+        break;
+    }
+    if (field == column)
+      return insert_value_shard(start, p);
+    if (p >= end || *p == ')')
+      break;
+  }
+  return 0;
+}
+
+// Reads a quoted SQL literal, p is after the opening quote
+static
+const gchar *parse_sql_literal(const gchar *p, GString *out){
+  g_string_truncate(out, 0);
+  for (; *p != '\0' && *p != '\''; p++){
+    if (*p == '\\' && p[1] != '\0')
+      g_string_append_c(out, unescape_char(*(++p)));
+    else
+      g_string_append_c(out, *p);
+  }
+  return *p == '\'' ? p + 1 : p;
+}
+
+static
+const gchar *parse_load_data_clause(const gchar *from, const gchar *clause, GString *out, const gchar *after){
+  const gchar *p=strstr(from, clause);
+  if (p == NULL)
+    return after;
+  p=parse_sql_literal(p + strlen(clause), out);
+  return p > after ? p : after;
+}
+
+// FIELDS and LINES of the statement, with the defaults of the server
+struct shard_load_data *parse_load_data_statement(GString *statement){
+  struct shard_load_data *sld=g_new0(struct shard_load_data, 1);
+  const gchar *s=statement->str, *after=s;
+  GString *literal=g_string_new(NULL);
+  sld->fields_terminated_by=g_string_new("\t");
+  sld->lines_starting_by=g_string_new("");
+  sld->lines_terminated_by=g_string_new("\n");
+  sld->escaped_by='\\';
+  sld->column=-1;
+  after=parse_load_data_clause(s, " FIELDS TERMINATED BY '", sld->fields_terminated_by, after);
+  if (strstr(s, " ENCLOSED BY '")){
+    after=parse_load_data_clause(s, " ENCLOSED BY '", literal, after);
+    sld->enclosed_by= literal->len ? literal->str[0] : '\0';
+  }
+  if (strstr(s, " ESCAPED BY '")){
+    after=parse_load_data_clause(s, " ESCAPED BY '", literal, after);
+    sld->escaped_by= literal->len ? literal->str[0] : '\0';
+  }
+  const gchar *lines=strstr(after, " LINES ");
+  if (lines){
+    after=parse_load_data_clause(lines, " STARTING BY '", sld->lines_starting_by, after);
+    after=parse_load_data_clause(lines, " TERMINATED BY '", sld->lines_terminated_by, after);
+  }
+  sld->header= strstr(after, " IGNORE 1 LINES") != NULL;
+  sld->columns=strchr(after, '(');
+  g_string_free(literal, TRUE);
+  return sld;
+}
+
+struct shard_load_data *new_shard_load_data(struct db_table *dbt, GString *statement){
+  if (!shard_in_use() || dbt == NULL || !dbt->shard_column || !g_strrstr_len(statement->str, 10, "LOAD DATA "))
+    return NULL;
+  struct shard_load_data *sld=parse_load_data_statement(statement);
+  sld->column= sld->columns ? column_in_list(dbt, sld->columns + 1, statement->str + statement->len) : -1;
+  return sld;
+}
+
+void free_shard_load_data(struct shard_load_data *sld){
+  if (sld == NULL)
+    return;
+  g_string_free(sld->fields_terminated_by, TRUE);
+  g_string_free(sld->lines_starting_by, TRUE);
+  g_string_free(sld->lines_terminated_by, TRUE);
+  g_free(sld);
+}
+
+// Start of the lines terminator that ends the line at p, or NULL
+const gchar *find_line_end(struct shard_load_data *sld, const gchar *p, const gchar *end){
+  gsize tl=sld->lines_terminated_by->len;
+  gboolean enclosed=FALSE;
+  for (; p < end; p++){
+    if (sld->escaped_by && *p == sld->escaped_by){
+      if (++p >= end)
+        return NULL;
+    }else if (sld->enclosed_by && *p == sld->enclosed_by)
+      enclosed=!enclosed;
+    else if (!enclosed && (gsize)(end - p) >= tl && !memcmp(p, sld->lines_terminated_by->str, tl))
+      return p;
+  }
+  return NULL;
+}
+
+/* Unescapes the field of the line that starts at p into value. Returns the
+   start of the fields terminator after it, or end */
+const gchar *read_load_data_field(struct shard_load_data *sld, GString *value, gboolean *is_null, const gchar *p, const gchar *end){
+  gsize fl=sld->fields_terminated_by->len;
+  gboolean enclosed=FALSE, was_enclosed=FALSE, escaped_null=FALSE;
+  g_string_truncate(value, 0);
+  if (sld->enclosed_by && p < end && *p == sld->enclosed_by){
+    enclosed=was_enclosed=TRUE;
+    p++;
+  }
+  while (p < end){
+    if (sld->escaped_by && *p == sld->escaped_by && p + 1 < end){
+      p++;
+      if (!enclosed && value->len == 0 && *p == 'N')
+        escaped_null=TRUE;
+      g_string_append_c(value, unescape_char(*(p++)));
+    }else if (enclosed && *p == sld->enclosed_by){
+      if (p + 1 < end && p[1] == sld->enclosed_by){
+        g_string_append_c(value, *p);
+        p+=2;
+      }else{
+        enclosed=FALSE;
+        p++;
+      }
+    }else if (!enclosed && fl && (gsize)(end - p) >= fl && !memcmp(p, sld->fields_terminated_by->str, fl))
+      break;
+    else
+      g_string_append_c(value, *(p++));
+  }
+  // \N, or the word NULL when the fields are enclosed
+  *is_null= (escaped_null && value->len == 1) ||
+            (sld->enclosed_by && !was_enclosed && value->len == 4 && !memcmp(value->str, "NULL", 4));
+  return p;
+}
+
+// Skips the STARTING BY of the line that starts at p
+const gchar *skip_line_start(struct shard_load_data *sld, const gchar *p, const gchar *end){
+  gsize sl=sld->lines_starting_by->len;
+  if (sl && (gsize)(end - p) >= sl && !memcmp(p, sld->lines_starting_by->str, sl))
+    p+=sl;
+  return p;
+}
+
+static
+guint line_shard(struct shard_load_data *sld, GString *value, const gchar *p, const gchar *end){
+  gsize fl=sld->fields_terminated_by->len;
+  gint field=0;
+  gboolean is_null;
+  p=skip_line_start(sld, p, end);
+  while (TRUE){
+    p=read_load_data_field(sld, value, &is_null, p, end);
+    if (field == sld->column)
+      return is_null ? 0 : shard_of_value(value->str, value->len);
+    if (p >= end)
+      return 0;
+    p+=fl;
+    field++;
+  }
+}
+
+struct shard_reader *new_shard_reader(FILE *file, struct shard_load_data *sld, guint shard){
+  struct shard_reader *sr=g_new0(struct shard_reader, 1);
+  sr->file=file;
+  sr->sld=sld;
+  sr->shard=shard;
+  sr->in=g_string_sized_new(SHARD_READ_SIZE);
+  sr->out=g_string_sized_new(SHARD_READ_SIZE);
+  sr->value=g_string_sized_new(256);
+  sr->header_pending=sld->header;
+  return sr;
+}
+
+// Moves the complete lines of sr->in that belong to the shard to sr->out
+static
+void split_shard_lines(struct shard_reader *sr){
+  const gchar *p=sr->in->str, *end=sr->in->str + sr->in->len, *line_end;
+  gsize tl=sr->sld->lines_terminated_by->len;
+  while (p < end){
+    line_end=find_line_end(sr->sld, p, end);
+    if (line_end == NULL){
+      if (!sr->eof)
+        break;
+      // the last line without terminator
+      line_end=end;
+    }
+    const gchar *next= line_end + tl <= end ? line_end + tl : end;
+    if (sr->header_pending || line_shard(sr->sld, sr->value, p, line_end) == sr->shard)
+      g_string_append_len(sr->out, p, next - p);
+    sr->header_pending=FALSE;
+    p=next;
+  }
+  g_string_erase(sr->in, 0, p - sr->in->str);
+}
+
+int shard_reader_read(struct shard_reader *sr, char *buf, unsigned int buf_len){
+  while (sr->out_pos >= sr->out->len){
+    if (sr->eof && sr->in->len == 0)
+      break;
+    g_string_truncate(sr->out, 0);
+    sr->out_pos=0;
+    gsize len=sr->in->len;
+    g_string_set_size(sr->in, len + SHARD_READ_SIZE);
+    gsize r=fread(sr->in->str + len, 1, SHARD_READ_SIZE, sr->file);
+    g_string_set_size(sr->in, len + r);
+    if (r == 0){
+      if (ferror(sr->file))
+        return -1;
+      sr->eof=TRUE;
+    }
+    split_shard_lines(sr);
+  }
+  gsize n=MIN(buf_len, sr->out->len - sr->out_pos);
+  memcpy(buf, sr->out->str + sr->out_pos, n);
+  sr->out_pos+=n;
+  return n;
+}
+
+void free_shard_reader(struct shard_reader *sr){
+  g_string_free(sr->in, TRUE);
+  g_string_free(sr->out, TRUE);
+  g_string_free(sr->value, TRUE);
+  g_free(sr);
+}
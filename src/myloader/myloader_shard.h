@@ -0,0 +1,70 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#ifndef _src_myloader_shard_h
+#define _src_myloader_shard_h
+
+#include <stdio.h>
+#include <glib.h>
+#include "myloader.h"
+
+/* With --shard-column the rows are distributed over --host, which is the
+   shard 0, and the --fan-out-hosts, in the order they are listed. The other
+   statements are still sent to every server. A table without the column has
+   all its rows in every shard */
+
+// How to read the rows of a LOAD DATA file, taken from the statement
+struct shard_load_data {
+  // in the column list of the statement, -1 when the table is not sharded
+  gint column;
+  GString *fields_terminated_by;
+  GString *lines_starting_by;
+  GString *lines_terminated_by;
+  gchar enclosed_by;
+  gchar escaped_by;
+  gboolean header;
+  // the ( of the column list in the statement, or NULL
+  const gchar *columns;
+};
+
+// Local infile userdata of each connection of a loader connection
+struct shard_filter {
+  guint shard;
+  struct shard_load_data **load_data;
+  // bytes of the LOAD DATA LOCAL files that were sent
+  guint64 infile_bytes;
+};
+
+struct shard_reader;
+
+void initialize_shard();
+gboolean shard_in_use();
+guint shard_count();
+void set_table_shard_column(struct db_table *dbt, const gchar *key);
+void parse_shard_column_position(struct db_table *dbt, struct table_definition *def);
+gint insert_shard_column(struct db_table *dbt, const gchar *insert, gsize prefix_len);
+gint row_shard(const gchar *row, const gchar *end, gint column);
+struct shard_load_data *parse_load_data_statement(GString *statement);
+struct shard_load_data *new_shard_load_data(struct db_table *dbt, GString *statement);
+const gchar *find_line_end(struct shard_load_data *sld, const gchar *p, const gchar *end);
+const gchar *skip_line_start(struct shard_load_data *sld, const gchar *p, const gchar *end);
+const gchar *read_load_data_field(struct shard_load_data *sld, GString *value, gboolean *is_null, const gchar *p, const gchar *end);
+void free_shard_load_data(struct shard_load_data *sld);
+struct shard_reader *new_shard_reader(FILE *file, struct shard_load_data *sld, guint shard);
+int shard_reader_read(struct shard_reader *sr, char *buf, unsigned int buf_len);
+void free_shard_reader(struct shard_reader *sr);
+#endif
@@ -17,6 +17,7 @@
 
 #include <mysql.h>
 #include <glib/gstdio.h>
+#include <stdio.h>
 
 #include "myloader.h"
 #include "myloader_common.h"
@@ -31,7 +32,27 @@ static GMutex *metadata_header_mutex=NULL;
 static gboolean metadata_header_done=FALSE;
 static GCond *metadata_header_cond= NULL;
 
+guint stream_memory_limit=0;
+guint stream_lanes=4;
+
+// Data files received by the stream that are kept in memory instead of being
+// written into the directory, the key is the basename of the file
+struct stream_memory_file{
+  gchar *buffer;
+  size_t size;
+  guint64 reserved;
+};
+static GHashTable *stream_memory_files=NULL;
+static GMutex *stream_memory_mutex=NULL;
+static guint64 stream_memory_used=0;
+
 void initialize_stream (struct configuration *c){
+  stream_memory_mutex=g_mutex_new();
+  stream_memory_files=g_hash_table_new(g_str_hash, g_str_equal);
+  if (stream_memory_limit > 0 && (no_stream || no_delete)){
+    g_warning("--stream-memory-limit is ignored when the stream files need to be kept in the directory");
+    stream_memory_limit=0;
+  }
   stream_thread = m_thread_new("myloader_stream",(GThreadFunc)process_stream, c, "Stream thread could not be created");
   metadata_header_mutex=g_mutex_new();
   metadata_header_cond= g_cond_new();
@@ -58,6 +79,92 @@ void metadata_has_been_processed(){
 
 
 
+// Only data files are read once and removed after they are loaded, the
+// schema and metadata files are always written into the directory. gzip
+// files are opened by name with gzopen(), so they are not kept either
+static
+gboolean is_stream_memory_candidate(const gchar *filename){
+  if (g_str_has_prefix(filename, "metadata") || g_strstr_len(filename, -1, "-schema") ||
+      g_str_has_suffix(filename, GZIP_EXTENSION) ||
+      (has_exec_per_thread_extension(filename) && !is_in_process_decompression_available(filename)))
+    return FALSE;
+  return m_filename_has_suffix(filename, ".sql") ||
+         m_filename_has_suffix(filename, ".dat") ||
+         m_filename_has_suffix(filename, "." ROW_BINARY_EXTENSION);
+}
+
+// Reserves size bytes, if the limit is reached the file is spilled to disk
+static
+FILE *stream_memory_create(const gchar *filename, guint64 size){
+  FILE *file=NULL;
+  if (stream_memory_limit == 0 || !is_stream_memory_candidate(filename))
+    return NULL;
+  g_mutex_lock(stream_memory_mutex);
+  if (stream_memory_used + size <= (guint64)stream_memory_limit * 1024 * 1024){
+    struct stream_memory_file *smf=g_new0(struct stream_memory_file, 1);
+    file=open_memstream(&(smf->buffer), &(smf->size));
+    if (file){
+      smf->reserved=size;
+      stream_memory_used+=size;
+      g_hash_table_insert(stream_memory_files, g_path_get_basename(filename), smf);
+    }else
+      g_free(smf);
+  }
+  g_mutex_unlock(stream_memory_mutex);
+  return file;
+}
+
+static
+struct stream_memory_file *stream_memory_lookup(const gchar *filename){
+  if (stream_memory_files == NULL)
+    return NULL;
+  gchar *basename=g_path_get_basename(filename);
+  g_mutex_lock(stream_memory_mutex);
+  struct stream_memory_file *smf=g_hash_table_lookup(stream_memory_files, basename);
+  g_mutex_unlock(stream_memory_mutex);
+  g_free(basename);
+  return smf;
+}
+
+FILE *stream_memory_fopen(const gchar *filename){
+  struct stream_memory_file *smf=stream_memory_lookup(filename);
+  if (smf == NULL)
+    return NULL;
+  if (smf->size == 0)
+    return g_fopen("/dev/null", "r");
+  return fmemopen(smf->buffer, smf->size, "r");
+}
+
+gboolean stream_memory_size(const gchar *filename, guint64 *size){
+  struct stream_memory_file *smf=stream_memory_lookup(filename);
+  if (smf == NULL)
+    return FALSE;
+  *size=smf->size;
+  return TRUE;
+}
+
+gboolean stream_memory_remove(const gchar *filename){
+  if (stream_memory_files == NULL)
+    return FALSE;
+  gchar *basename=g_path_get_basename(filename);
+  gchar *orig_key=NULL;
+  struct stream_memory_file *smf=NULL;
+  g_mutex_lock(stream_memory_mutex);
+  if (g_hash_table_lookup_extended(stream_memory_files, basename, (gpointer*) &orig_key, (gpointer*) &smf)){
+    g_hash_table_remove(stream_memory_files, basename);
+    stream_memory_used-=smf->reserved;
+  }
+  g_mutex_unlock(stream_memory_mutex);
+  g_free(basename);
+  if (smf == NULL)
+    return FALSE;
+  trace("Releasing in memory file %s", orig_key);
+  g_free(orig_key);
+  free(smf->buffer);
+  g_free(smf);
+  return TRUE;
+}
+
 size_t read_stream_line(char *buffer, int c_to_read){
     size_t bytes = fread(buffer, sizeof(char), c_to_read, stdin);
     return bytes;
@@ -80,12 +187,180 @@ void flush(char *buffer, int from, int to, FILE *file, guint *total_size){
 gboolean has_mydumper_suffix(gchar *line){
   return
     m_filename_has_suffix(line,".dat") ||
+    m_filename_has_suffix(line,"." ROW_BINARY_EXTENSION) ||
     m_filename_has_suffix(line,".sql") ||
+    g_str_has_suffix(line,".sql.idx") ||
     g_strstr_len(line,-1,"metadata.partial") ||
     g_str_has_prefix(line,"metadata");
 }
 
+struct stream_frame{
+  guchar type;
+  guint32 id;
+  guint32 len;
+  gchar *payload;
+  guint32 payload_size;
+};
+
+struct stream_lane_file{
+  gchar *filename;
+  FILE *file;
+  guint64 size;
+  guint64 written;
+  gboolean push;
+};
+
+struct stream_lane{
+  GAsyncQueue *queue;
+  GHashTable *files;
+};
+
+// frames are taken from here, this bounds the memory used by the lanes
+static GAsyncQueue *free_stream_frames=NULL;
+
+static
+guint32 get_uint32(const guchar *buf){
+  return ((guint32)buf[0] << 24) | ((guint32)buf[1] << 16) | ((guint32)buf[2] << 8) | (guint32)buf[3];
+}
+
+static
+void open_stream_lane_file(struct stream_lane *lane, struct stream_frame *frame){
+  if (frame->len < 8)
+    m_critical("Stream frame OPEN of file %u is too short", frame->id);
+  struct stream_lane_file *slf=g_new0(struct stream_lane_file, 1);
+  slf->size=((guint64)get_uint32((guchar *)frame->payload) << 32) | get_uint32((guchar *)&(frame->payload[4]));
+  slf->filename=g_strndup(&(frame->payload[8]), frame->len - 8);
+  gchar *real_filename = g_build_filename(directory,slf->filename,NULL);
+  if (g_file_test(real_filename, G_FILE_TEST_EXISTS)){
+    if (no_stream)
+      slf->push=TRUE;
+    else
+      g_warning("Stream Thread: File %s exists in datadir, we are not replacing", real_filename);
+  }else{
+    if (no_stream)
+      m_critical("File %s not found in backup dir when using NO_STREAM.", slf->filename);
+    slf->file = stream_memory_create(slf->filename, slf->size);
+    if (!slf->file)
+      slf->file = g_fopen(real_filename, "w");
+    if (!slf->file)
+      m_critical("cannot create file %s (%d)", real_filename, errno);
+    slf->push=TRUE;
+  }
+  if (!has_mydumper_suffix(slf->filename)){
+    g_debug("Not a mydumper file: %s", slf->filename);
+  }
+  g_free(real_filename);
+  g_hash_table_insert(lane->files, GUINT_TO_POINTER(frame->id), slf);
+}
+
+static
+void close_stream_lane_file(struct stream_lane *lane, struct stream_frame *frame){
+  struct stream_lane_file *slf=g_hash_table_lookup(lane->files, GUINT_TO_POINTER(frame->id));
+  if (slf == NULL)
+    m_critical("Stream frame CLOSE for unknown file %u", frame->id);
+  g_hash_table_remove(lane->files, GUINT_TO_POINTER(frame->id));
+  if (slf->file){
+    fclose(slf->file);
+    if (slf->written != slf->size)
+      m_critical("Different file size in %s. Should be: %"G_GUINT64_FORMAT" | Written: %"G_GUINT64_FORMAT, slf->filename, slf->size, slf->written);
+  }
+  if (slf->push)
+    process_filename_push(slf->filename);
+  g_free(slf->filename);
+  g_free(slf);
+}
+
+static
+void *process_stream_lane(struct stream_lane *lane){
+  set_thread_affinity(AFFINITY_IO);
+  set_thread_name("STL");
+  struct stream_frame *frame=NULL;
+  struct stream_lane_file *slf=NULL;
+  for(;;){
+    frame=g_async_queue_pop(lane->queue);
+    if (frame->type == STREAM_FRAME_END){
+      g_async_queue_push(free_stream_frames, frame);
+      break;
+    }
+    switch (frame->type){
+      case STREAM_FRAME_OPEN:
+        open_stream_lane_file(lane, frame);
+        break;
+      case STREAM_FRAME_DATA:
+        slf=g_hash_table_lookup(lane->files, GUINT_TO_POINTER(frame->id));
+        if (slf == NULL)
+          m_critical("Stream frame DATA for unknown file %u", frame->id);
+        if (slf->file){
+          if ((guint32)write_file(slf->file, frame->payload, frame->len) != frame->len)
+            g_critical("Error on writing");
+          slf->written+=frame->len;
+        }
+        break;
+      case STREAM_FRAME_CLOSE:
+        close_stream_lane_file(lane, frame);
+        break;
+    }
+    g_async_queue_push(free_stream_frames, frame);
+  }
+  return NULL;
+}
+
+// mydumper --stream-lanes interleaves the frames of several files, the frames
+// of a file are always written by the same lane to keep them in order
+static
+void process_stream_lanes(){
+  guint n;
+  guchar header[STREAM_FRAME_HEADER_SIZE];
+  struct stream_lane *lanes=g_new0(struct stream_lane, stream_lanes);
+  GThread **lane_threads=g_new(GThread *, stream_lanes);
+  struct stream_frame *frame=NULL;
+  free_stream_frames=g_async_queue_new();
+  for (n=0; n<stream_lanes*4; n++)
+    g_async_queue_push(free_stream_frames, g_new0(struct stream_frame, 1));
+  for (n=0; n<stream_lanes; n++){
+    lanes[n].queue=g_async_queue_new();
+    lanes[n].files=g_hash_table_new(g_direct_hash, g_direct_equal);
+    lane_threads[n]=m_thread_new("myloader_stream_lane",(GThreadFunc)process_stream_lane, &(lanes[n]), "Stream lane thread could not be created");
+  }
+  for(;;){
+    if (fread(header, 1, STREAM_FRAME_HEADER_SIZE, stdin) != STREAM_FRAME_HEADER_SIZE)
+      m_critical("Stream ended without END frame");
+    if (header[0] == STREAM_FRAME_END)
+      break;
+    frame=g_async_queue_pop(free_stream_frames);
+    frame->type=header[0];
+    frame->id=get_uint32(&(header[1]));
+    frame->len=get_uint32(&(header[5]));
+    if (frame->len > frame->payload_size){
+      g_free(frame->payload);
+      frame->payload=g_malloc(frame->len);
+      frame->payload_size=frame->len;
+    }
+    if (frame->len && fread(frame->payload, 1, frame->len, stdin) != frame->len)
+      m_critical("Stream ended in the middle of a frame of file %u", frame->id);
+    g_async_queue_push(lanes[frame->id % stream_lanes].queue, frame);
+  }
+  for (n=0; n<stream_lanes; n++){
+    frame=g_async_queue_pop(free_stream_frames);
+    frame->type=STREAM_FRAME_END;
+    g_async_queue_push(lanes[n].queue, frame);
+  }
+  for (n=0; n<stream_lanes; n++){
+    g_thread_join(lane_threads[n]);
+    g_async_queue_unref(lanes[n].queue);
+    g_hash_table_destroy(lanes[n].files);
+  }
+  g_free(lane_threads);
+  g_free(lanes);
+  while ((frame=g_async_queue_try_pop(free_stream_frames)) != NULL){
+    g_free(frame->payload);
+    g_free(frame);
+  }
+  g_async_queue_unref(free_stream_frames);
+}
+
 void *process_stream(struct configuration *stream_conf){
+  set_thread_affinity(AFFINITY_IO);
   (void) stream_conf;
   set_thread_name("STT");
   char * filename=NULL,*real_filename=NULL,* previous_filename=NULL;
@@ -107,6 +382,21 @@ void *process_stream(struct configuration *stream_conf){
   }
   gchar *new_filename,*new_real_filename,*kind=NULL;
   int num=0;
+  if (!mysqldump){
+    // mydumper --stream-lanes starts the stream with the magic, any other
+    // data read is processed as usual
+    diff=fread(buffer, sizeof(char), strlen(STREAM_LANES_MAGIC), stdin);
+    if (diff == strlen(STREAM_LANES_MAGIC) && !strncmp(buffer, STREAM_LANES_MAGIC, diff)){
+      g_message("Stream Thread: receiving stream lanes");
+      if (stream_lanes == 0)
+        stream_lanes=1;
+      process_stream_lanes();
+      g_free(buffer);
+      g_string_free(set_buffer, TRUE);
+      process_filename_queue_end();
+      return NULL;
+    }
+  }
   while (TRUE){
     // Reads from stdin and fills the buffer from last position
 read_more:
@@ -350,7 +640,9 @@ read_more:
               if (no_stream){
                 m_critical("File %s not found in backup dir when using NO_STREAM.", filename);
               }
-              file = g_fopen(real_filename, "w");
+              file = stream_memory_create(filename, file_size_from_stream);
+              if (!file)
+                file = g_fopen(real_filename, "w");
               m_close=(void *) &fclose;
             }
             if (!has_mydumper_suffix(filename)){
@@ -19,3 +19,6 @@ void initialize_stream (struct configuration *conf);
 void wait_stream_to_finish();
 void wait_stream_to_process_metadata_header();
 void metadata_has_been_processed();
+FILE *stream_memory_fopen(const gchar *filename);
+gboolean stream_memory_size(const gchar *filename, guint64 *size);
+gboolean stream_memory_remove(const gchar *filename);
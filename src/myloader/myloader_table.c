@@ -36,15 +36,69 @@
 #include "myloader_database.h"
 #include "myloader_directory.h"
 #include "myloader_worker_schema.h"
+#include "myloader_shard.h"
+#include "myloader_table_threads.h"
 
 
 //GString *change_master_statement=NULL;
 struct configuration *__conf;
 extern gboolean schema_sequence_fix;
 
+/* The tables are spread on shards by the hash of their key, so the threads
+   that look up or add different tables do not wait on the same mutex */
+#define TABLE_REGISTRY_SHARDS 64
+struct table_registry_shard {
+  GMutex *mutex;
+  GHashTable *hash;
+};
+static struct table_registry_shard table_registry[TABLE_REGISTRY_SHARDS];
+static gint table_registry_count=0;
+// amount of tables that passed CREATED and ALL_DONE
+static gint tables_created=0;
+static gint tables_all_done=0;
 
 void initialize_table(struct configuration *c){
   __conf=c;
+  guint i;
+  for (i=0; i < TABLE_REGISTRY_SHARDS; i++){
+    table_registry[i].mutex=g_mutex_new();
+    table_registry[i].hash=g_hash_table_new(g_str_hash, g_str_equal);
+  }
+}
+
+static
+struct table_registry_shard *get_table_registry_shard(const gchar *lkey){
+  return &table_registry[g_str_hash(lkey) % TABLE_REGISTRY_SHARDS];
+}
+
+guint table_registry_size(){
+  return g_atomic_int_get(&table_registry_count);
+}
+
+guint get_tables_created(){
+  return g_atomic_int_get(&tables_created);
+}
+
+guint get_tables_all_done(){
+  return g_atomic_int_get(&tables_all_done);
+}
+
+static
+void update_state_counter(gint *counter, enum schema_status threshold, enum schema_status old_state, enum schema_status new_state){
+  if (old_state < threshold && new_state >= threshold)
+    g_atomic_int_inc(counter);
+  else if (old_state >= threshold && new_state < threshold)
+    g_atomic_int_add(counter, -1);
+}
+
+// The counters follow the transitions, the callers do not need to scan the tables
+void set_table_schema_state(struct db_table *dbt, enum schema_status state){
+  enum schema_status old_state;
+  do {
+    old_state=g_atomic_int_get((gint *)&(dbt->schema_state));
+  } while (!g_atomic_int_compare_and_exchange((gint *)&(dbt->schema_state), old_state, state));
+  update_state_counter(&tables_created, CREATED, old_state, state);
+  update_state_counter(&tables_all_done, ALL_DONE, old_state, state);
 }
 
 gint compare_dbt(gconstpointer a, gconstpointer b, gpointer table_hash){
@@ -58,25 +112,73 @@ gint compare_dbt(gconstpointer a, gconstpointer b, gpointer table_hash){
 }
 
 gint compare_dbt_short(gconstpointer a, gconstpointer b){
-  return ((struct db_table *)a)->rows < ((struct db_table *)b)->rows;
+  guint64 a_rows=((struct db_table *)a)->rows, b_rows=((struct db_table *)b)->rows;
+  return a_rows < b_rows ? 1 : (a_rows > b_rows ? -1 : 0);
+}
+
+// Bytes left to load, as index builds follow the data the table that takes
+// longer has to start first. Ties are ordered by rows. The loaders keep
+// reducing remaining_size, the sort uses the copy taken before it
+gint compare_dbt_by_size(gconstpointer a, gconstpointer b){
+  guint64 a_size=((struct db_table *)a)->sort_size, b_size=((struct db_table *)b)->sort_size;
+  if (a_size == b_size)
+    return compare_dbt_short(a, b);
+  return a_size < b_size ? 1 : -1;
+}
+
+GCompareFunc table_order_function=&compare_dbt_by_size;
+
+gboolean set_table_order(const gchar *value){
+  if (!g_ascii_strcasecmp(value, "size"))
+    table_order_function=&compare_dbt_by_size;
+  else if (!g_ascii_strcasecmp(value, "rows"))
+    table_order_function=&compare_dbt_short;
+  else if (!g_ascii_strcasecmp(value, "none"))
+    table_order_function=NULL;
+  else
+    return FALSE;
+  return TRUE;
 }
 
 struct db_table * get_table(gchar *database_name_in_filename , gchar * table_filename){
   struct db_table *dbt=NULL;
   gchar *lkey=build_dbt_key(database_name_in_filename, table_filename);
-  dbt=g_hash_table_lookup(__conf->table_hash,lkey);
+  struct table_registry_shard *shard=get_table_registry_shard(lkey);
+  g_mutex_lock(shard->mutex);
+  dbt=g_hash_table_lookup(shard->hash,lkey);
+  g_mutex_unlock(shard->mutex);
+  g_free(lkey);
   return dbt;
 }
 
+/* The table with the real names, when the names in the filenames are not
+   known. The database is either its name in the filenames or its real name */
+struct db_table *get_table_by_source_name(const gchar *database, const gchar *source_table_name){
+  GHashTableIter iter;
+  struct db_table *dbt=NULL, *found=NULL;
+  guint i;
+  for (i=0; i < TABLE_REGISTRY_SHARDS && !found; i++){
+    g_mutex_lock(table_registry[i].mutex);
+    g_hash_table_iter_init(&iter, table_registry[i].hash);
+    while (!found && g_hash_table_iter_next(&iter, NULL, (gpointer *)&dbt))
+      if (!g_strcmp0(dbt->source_table_name, source_table_name) &&
+          (!g_strcmp0(dbt->database->database_name_in_filename, database) || !g_strcmp0(dbt->database->source_database, database)))
+        found=dbt;
+    g_mutex_unlock(table_registry[i].mutex);
+  }
+  return found;
+}
+
 gboolean append_new_db_table( struct db_table **p_dbt, struct database *_database, gchar *source_table_name, gchar *table_filename){
   struct db_table *dbt=NULL;
   gchar *lkey=build_dbt_key(_database->database_name_in_filename, table_filename);
   trace("Searching for dbt with key: %s", lkey);
 //  dbt=g_hash_table_lookup(__conf->table_hash,lkey);
   gboolean r = dbt == NULL;
+  struct table_registry_shard *shard=get_table_registry_shard(lkey);
   if (r){
-    g_mutex_lock(__conf->table_hash_mutex);
-    dbt=g_hash_table_lookup(__conf->table_hash,lkey);
+    g_mutex_lock(shard->mutex);
+    dbt=g_hash_table_lookup(shard->hash,lkey);
     r = dbt == NULL;
     if (r){
       trace("New dbt: %s %s %s", _database->target_database, table_filename,source_table_name);
@@ -88,15 +190,23 @@ gboolean append_new_db_table( struct db_table **p_dbt, struct database *_databas
 //      dbt->rows=number_rows;
       dbt->rows=0;
       dbt->rows_inserted=0;
-      dbt->restore_job_list = NULL;
+      dbt->statement_max_rows=0;
+      dbt->restore_job_heap = g_ptr_array_new();
+      dbt->runs=0;
+      dbt->run_last=NULL;
+      dbt->run_started=NULL;
+      dbt->run_busy=NULL;
       parse_object_to_export(&(dbt->object_to_export),g_hash_table_lookup(conf_per_table.all_object_to_export, lkey));
+      set_table_shard_column(dbt, lkey);
 			dbt->current_threads=0;
       dbt->max_threads=max_threads_per_table>num_threads?num_threads:max_threads_per_table;
+      initialize_table_threads(dbt);
       dbt->max_connections_per_job=0;
       dbt->retry_count= retry_count;
       dbt->mutex=g_mutex_new();
 //      dbt->indexes=alter_table_statement;
       dbt->indexes=NULL;
+      dbt->index_cost=0;
       dbt->start_data_time=NULL;
       dbt->finish_data_time=NULL;
       dbt->start_index_time=NULL;
@@ -104,24 +214,33 @@ gboolean append_new_db_table( struct db_table **p_dbt, struct database *_databas
       dbt->schema_state=NOT_FOUND;
       dbt->index_enqueued=FALSE;
       dbt->remaining_jobs = 0;
+      dbt->remaining_size = 0;
+      dbt->ready_pending = FALSE;
+      dbt->ready_scheduled = FALSE;
+      dbt->ready_key = 0;
       dbt->constraints=NULL;
       dbt->count=0;
-      g_hash_table_insert(__conf->table_hash, lkey, dbt);
-      trace("g_hash_table_insert(conf->table_hash, %s", lkey);
-      refresh_table_list_without_table_hash_lock(__conf, FALSE);
+      g_hash_table_insert(shard->hash, lkey, dbt);
+      g_atomic_int_inc(&table_registry_count);
+      trace("g_hash_table_insert(table_registry, %s", lkey);
       dbt->schema_checksum=NULL;
       dbt->triggers_checksum=NULL;
       dbt->indexes_checksum=NULL;
       dbt->data_checksum=NULL;
+      dbt->chunk_checksum_expression=NULL;
+      dbt->chunk_checksums=NULL;
+      dbt->exchange_partitions=NULL;
+      dbt->table_definition=NULL;
       dbt->is_view=FALSE;
       dbt->is_sequence=FALSE;
+      append_table_list(__conf, dbt);
     }else{
 //      g_free(source_table_name);
       g_free(lkey);
 //      if (number_rows>0) dbt->rows=number_rows;
 //      if (alter_table_statement != NULL) dbt->indexes=alter_table_statement;
     }
-    g_mutex_unlock(__conf->table_hash_mutex);
+    g_mutex_unlock(shard->mutex);
   }else{
     //g_free(source_table_name);
       g_free(lkey);
@@ -150,6 +269,9 @@ void table_unlock(struct db_table *dbt){
 
 void free_dbt(struct db_table * dbt){
   g_free(dbt->table_filename);
+  g_free(dbt->run_last);
+  g_free(dbt->run_started);
+  g_free(dbt->run_busy);
 //  if (dbt->constraints!=NULL) g_string_free(dbt->constraints,TRUE);
   dbt->constraints = NULL; // It should be free after constraint is executed
 //  g_async_queue_unref(dbt->queue);
@@ -157,19 +279,21 @@ void free_dbt(struct db_table * dbt){
   
 }
 
-void free_table_hash(GHashTable *table_hash){
-  g_mutex_lock(__conf->table_hash_mutex);
+void free_table_registry(){
   GHashTableIter iter;
   gchar * lkey;
-  if (table_hash){
-    g_hash_table_iter_init ( &iter, table_hash );
-    struct db_table *dbt=NULL;
+  struct db_table *dbt=NULL;
+  guint i;
+  for (i=0; i < TABLE_REGISTRY_SHARDS; i++){
+    g_mutex_lock(table_registry[i].mutex);
+    g_hash_table_iter_init ( &iter, table_registry[i].hash );
     while ( g_hash_table_iter_next ( &iter, (gpointer *) &lkey, (gpointer *) &dbt ) ) {
       free_dbt(dbt);
       g_free((gchar*)lkey);
       g_free(dbt);
     }
-  } 
-  g_mutex_unlock(__conf->table_hash_mutex);
+    g_hash_table_remove_all(table_registry[i].hash);
+    g_mutex_unlock(table_registry[i].mutex);
+  }
 }
 
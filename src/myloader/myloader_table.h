@@ -29,14 +29,34 @@ struct db_table {
   gchar *create_table_name;
   struct object_to_export object_to_export;
   guint64 rows;
+  // added atomically by the loader threads
   guint64 rows_inserted;
-  GList * restore_job_list;
+  // rows of the largest INSERT of the dump, 0 when it is not known
+  guint64 statement_max_rows;
+  // pending data jobs, see restore_job_heap_push()
+  GPtrArray *restore_job_heap;
+  // --ingest-order CLUSTERED, last order taken by each run
+  guint runs;
+  guint64 *run_last;
+  gboolean *run_started;
+  gboolean *run_busy;
   guint current_threads;
   guint max_threads;
+  // --max-threads-per-table, max_threads changes below it with
+  // --adaptive-table-threads, see myloader_table_threads.c
+  guint max_threads_limit;
+  gint64 threads_window_start;
+  guint64 threads_window_bytes;
+  guint threads_window_jobs;
+  gdouble threads_last_rate;
+  gint threads_step;
+  gboolean threads_changed;
+  guint threads_hold;
   guint max_connections_per_job;
   guint retry_count;
   GMutex *mutex;
   GString *indexes;
+  guint64 index_cost;
   GString *constraints;
   guint count;
   enum schema_status schema_state;
@@ -47,18 +67,45 @@ struct db_table {
   GDateTime * finish_time;
   gint remaining_jobs;
   gchar *data_checksum;
+  // --data-checksums per chunk, protected by chunk_checksum_mutex
+  gchar *chunk_checksum_expression;
+  GList *chunk_checksums;
   gchar *schema_checksum;
   gchar *indexes_checksum;
   gchar *triggers_checksum;
   gboolean is_view;
   gboolean is_sequence;
+  // sum of the size of the files in restore_job_list
+  guint64 remaining_size;
+  // remaining_size when the table list was sorted, protected by table_list_mutex
+  guint64 sort_size;
+  // protected by the ready table mutex in myloader_worker_loader_main.c
+  gboolean ready_pending;
+  // only used by the control job thread
+  gboolean ready_scheduled;
+  guint64 ready_key;
+  // --shard-column, the position is -1 when it is not in the CREATE TABLE
+  gchar *shard_column;
+  gint shard_column_position;
+  // parsed CREATE TABLE of the schema file
+  struct table_definition *table_definition;
+  // --exchange-partitions, the partitions restored into staging tables
+  GList *exchange_partitions;
 };
 
 struct db_table * get_table(gchar *database_name_in_filename , gchar * table_filename);
-void free_table_hash(GHashTable *table_hash);
+struct db_table *get_table_by_source_name(const gchar *database, const gchar *source_table_name);
+void free_table_registry();
+guint table_registry_size();
+guint get_tables_created();
+guint get_tables_all_done();
+void set_table_schema_state(struct db_table *dbt, enum schema_status state);
 gboolean append_new_db_table( struct db_table **p_dbt, struct database *_database, gchar *source_table_name, gchar *table_filename);
 gint compare_dbt(gconstpointer a, gconstpointer b, gpointer table_hash);
 gint compare_dbt_short(gconstpointer a, gconstpointer b);
+gint compare_dbt_by_size(gconstpointer a, gconstpointer b);
+gboolean set_table_order(const gchar *value);
+extern GCompareFunc table_order_function;
 void initialize_table(struct configuration *c);
 void table_lock(struct db_table *dbt);
 void table_unlock(struct db_table *dbt);
@@ -0,0 +1,95 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#include <glib.h>
+
+#include "myloader.h"
+#include "myloader_global.h"
+#include "myloader_table_threads.h"
+
+// seconds of a measure window
+#define TABLE_THREADS_WINDOW 3
+// changes on the rate below this percentage are noise
+#define TABLE_THREADS_THRESHOLD 5
+// windows without changes after a change is undone
+#define TABLE_THREADS_HOLD 3
+
+gboolean adaptive_table_threads=FALSE;
+
+void initialize_table_threads(struct db_table *dbt){
+  dbt->max_threads_limit=dbt->max_threads;
+  dbt->threads_window_start=0;
+  dbt->threads_window_bytes=0;
+  dbt->threads_window_jobs=0;
+  dbt->threads_last_rate=0;
+  dbt->threads_step=1;
+  dbt->threads_changed=FALSE;
+  dbt->threads_hold=0;
+  // both directions are explored from the middle
+  if (adaptive_table_threads)
+    dbt->max_threads= dbt->max_threads_limit > 1 ? dbt->max_threads_limit / 2 : 1;
+}
+
+static
+void change_table_threads(struct db_table *dbt){
+  if ((dbt->threads_step > 0 && dbt->max_threads >= dbt->max_threads_limit) ||
+      (dbt->threads_step < 0 && dbt->max_threads <= 1)){
+    dbt->threads_step=-dbt->threads_step;
+    dbt->threads_hold=TABLE_THREADS_HOLD;
+    return;
+  }
+  dbt->max_threads+=dbt->threads_step;
+  dbt->threads_changed=TRUE;
+}
+
+void table_threads_job_done(struct db_table *dbt, guint64 bytes){
+  if (!adaptive_table_threads || dbt->max_threads_limit <= 1)
+    return;
+  gint64 now=g_get_monotonic_time();
+  if (dbt->threads_window_start == 0){
+    dbt->threads_window_start=now;
+    return;
+  }
+  dbt->threads_window_bytes+=bytes;
+  dbt->threads_window_jobs++;
+  gint64 elapsed=now - dbt->threads_window_start;
+  // every thread has to finish a job in the window
+  if (elapsed < TABLE_THREADS_WINDOW * G_USEC_PER_SEC || dbt->threads_window_jobs < dbt->max_threads)
+    return;
+  gdouble rate=(gdouble)dbt->threads_window_bytes * G_USEC_PER_SEC / elapsed;
+  guint previous=dbt->max_threads;
+  gboolean changed=dbt->threads_changed;
+  dbt->threads_changed=FALSE;
+  if (dbt->threads_hold > 0)
+    dbt->threads_hold--;
+  else if (changed && (rate < dbt->threads_last_rate * (100 - TABLE_THREADS_THRESHOLD) / 100 ||
+          (dbt->threads_step > 0 && rate <= dbt->threads_last_rate * (100 + TABLE_THREADS_THRESHOLD) / 100))){
+    // the last change made it slower or a new thread did not help, it is
+    // undone and the table stays there for a while
+    dbt->threads_step=-dbt->threads_step;
+    change_table_threads(dbt);
+    dbt->threads_changed=FALSE;
+    dbt->threads_hold=TABLE_THREADS_HOLD;
+  }else
+    change_table_threads(dbt);
+  if (dbt->max_threads != previous)
+    trace("%s.%s: %.0f bytes/sec with %u threads, using %u threads", dbt->database->target_database, dbt->source_table_name, rate, previous, dbt->max_threads);
+  dbt->threads_last_rate=rate;
+  dbt->threads_window_start=now;
+  dbt->threads_window_bytes=0;
+  dbt->threads_window_jobs=0;
+}
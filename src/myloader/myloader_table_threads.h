@@ -0,0 +1,32 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#ifndef _src_myloader_table_threads_h
+#define _src_myloader_table_threads_h
+
+#include <glib.h>
+#include "myloader_table.h"
+
+/* --adaptive-table-threads changes dbt->max_threads of every table between 1
+   and --max-threads-per-table. The bytes/sec of the table are measured over
+   windows of a few seconds, one more or one less thread is tried after each
+   window and the change continues while the table loads faster. Tables with
+   contention on their indexes or AUTO_INCREMENT stay on a few threads */
+void initialize_table_threads(struct db_table *dbt);
+// Called with the table locked when a loader thread finishes a job on it
+void table_threads_job_done(struct db_table *dbt, guint64 bytes);
+#endif
@@ -0,0 +1,149 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#include <mysql.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "myloader.h"
+#include "myloader_global.h"
+#include "myloader_common.h"
+#include "myloader_process.h"
+#include "myloader_restore.h"
+#include "myloader_table.h"
+#include "myloader_fan_out.h"
+#include "myloader_transportable.h"
+
+#define TABLESPACE_COPY_SIZE 4194304
+
+static gchar *target_datadir=NULL;
+
+void initialize_transportable(MYSQL *conn){
+  struct M_ROW *mr=m_store_result_row(conn, "SELECT @@datadir", m_warning, m_warning, "Failed to get the datadir", NULL);
+  if (mr->row && mr->row[0] && g_file_test(mr->row[0], G_FILE_TEST_IS_DIR))
+    target_datadir=g_strdup(mr->row[0]);
+  m_store_result_row_free(mr);
+}
+
+// names that are stored the same way in the datadir
+static
+gboolean is_datadir_name(const gchar *name){
+  const gchar *c;
+  for (c=name; *c; c++)
+    if (!g_ascii_isalnum(*c) && *c != '_')
+      return FALSE;
+  return c != name;
+}
+
+static
+gboolean copy_into_datadir(gchar *path, const gchar *target){
+  FILE *in=myl_open(path, "r");
+  if (!in)
+    return FALSE;
+  FILE *out=g_fopen(target, "w");
+  if (!out){
+    g_critical("Could not create %s: %s", target, strerror(errno));
+    errors++;
+    myl_close(path, in, FALSE);
+    return FALSE;
+  }
+  gchar *buffer=g_malloc(TABLESPACE_COPY_SIZE);
+  gsize n;
+  gboolean ok=TRUE;
+  while (ok && (n=fread(buffer, 1, TABLESPACE_COPY_SIZE, in)) > 0)
+    ok= fwrite(buffer, 1, n, out) == n;
+  ok&= !ferror(in);
+  ok&= fclose(out) == 0;
+  g_free(buffer);
+  myl_close(path, in, TRUE);
+  if (!ok){
+    g_critical("Could not copy %s into %s: %s", path, target, strerror(errno));
+    errors++;
+  }
+  return ok;
+}
+
+static
+int alter_tablespace(struct thread_data *td, struct db_table *dbt, const gchar *action){
+  const char q=identifier_quote_character;
+  GString *statement=g_string_new(NULL);
+  g_string_printf(statement, "ALTER TABLE %c%s%c.%c%s%c %s TABLESPACE",
+      q, dbt->database->target_database, q, q, dbt->source_table_name, q, action);
+  int r=restore_data_in_gstring(td, statement, TRUE, dbt->database);
+  if (r){
+    g_critical("Thread %d: %s TABLESPACE failed on %s.%s", td->thread_id, action, dbt->database->target_database, dbt->source_table_name);
+    errors++;
+  }
+  g_string_free(statement, TRUE);
+  return r;
+}
+
+/* The tablespace has the indexes of the source table, so the deferred
+   indexes are added while the table is empty. The .cfg is optional for
+   IMPORT TABLESPACE, it is removed from the datadir once it is imported */
+int restore_tablespace_file(struct thread_data *td, struct db_table *dbt, const gchar *filename){
+  if (fan_out_in_use())
+    m_critical("Tablespace file %s can not be restored with --fan-out-hosts", filename);
+  if (target_datadir == NULL || !is_datadir_name(dbt->database->target_database) || !is_datadir_name(dbt->source_table_name)){
+    g_critical("Tablespace file %s can not be restored, the datadir of the server is not accessible or %s.%s is not a plain name",
+               filename, dbt->database->target_database, dbt->source_table_name);
+    errors++;
+    return 1;
+  }
+  table_lock(dbt);
+  GString *indexes=dbt->indexes;
+  dbt->indexes=NULL;
+  table_unlock(dbt);
+  if (indexes){
+    message("Thread %d: restoring indexes of %s.%s before its tablespace", td->thread_id, dbt->database->target_database, dbt->source_table_name);
+    int r=restore_data_in_gstring(td, indexes, FALSE, dbt->database);
+    g_string_free(indexes, TRUE);
+    if (r){
+      g_critical("Thread %d: indexes of %s.%s could not be created, its tablespace is not imported", td->thread_id, dbt->database->target_database, dbt->source_table_name);
+      errors++;
+      return 1;
+    }
+  }
+  if (alter_tablespace(td, dbt, "DISCARD"))
+    return 1;
+
+  gchar *ibd_name=g_strdup_printf("%s.ibd", dbt->source_table_name);
+  gchar *cfg_name=g_strdup_printf("%s.cfg", dbt->source_table_name);
+  gchar *ibd_target=g_build_filename(target_datadir, dbt->database->target_database, ibd_name, NULL);
+  gchar *cfg_target=g_build_filename(target_datadir, dbt->database->target_database, cfg_name, NULL);
+  gchar *ibd_path=g_build_filename(directory, filename, NULL);
+  gchar *cfg_path=g_strdup(ibd_path);
+  memcpy(g_strrstr(cfg_path, ".ibd"), ".cfg", 4);
+  int r=1;
+  if (!copy_into_datadir(cfg_path, cfg_target))
+    g_warning("Thread %d: %s.%s is imported without its .cfg", td->thread_id, dbt->database->target_database, dbt->source_table_name);
+  if (copy_into_datadir(ibd_path, ibd_target)){
+    message("Thread %d: importing tablespace of %s.%s", td->thread_id, dbt->database->target_database, dbt->source_table_name);
+    r=alter_tablespace(td, dbt, "IMPORT");
+  }
+  g_remove(cfg_target);
+  g_free(ibd_name);
+  g_free(cfg_name);
+  g_free(ibd_target);
+  g_free(cfg_target);
+  g_free(ibd_path);
+  g_free(cfg_path);
+  return r;
+}
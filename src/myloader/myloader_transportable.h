@@ -0,0 +1,31 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#ifndef _src_myloader_transportable_h
+#define _src_myloader_transportable_h
+
+#include <mysql.h>
+#include <glib.h>
+#include "myloader.h"
+
+/* The .ibd and .cfg written by mydumper --transportable-tablespaces are
+   imported into the table created by myloader: DISCARD TABLESPACE, the files
+   are placed in the datadir of the server and IMPORT TABLESPACE. myloader has
+   to run on the database host with write access to the datadir */
+void initialize_transportable(MYSQL *conn);
+int restore_tablespace_file(struct thread_data *td, struct db_table *dbt, const gchar *filename);
+#endif
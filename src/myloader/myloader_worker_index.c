@@ -16,6 +16,7 @@
 */
 
 #include <glib/gstdio.h>
+#include <string.h>
 
 #include "myloader_common.h"
 #include "myloader_restore_job.h"
@@ -23,6 +24,9 @@
 #include "myloader_worker_loader_main.h"
 #include "myloader_global.h"
 #include "myloader_database.h"
+#include "myloader_worker_index.h"
+#include "myloader_worker_post.h"
+#include "myloader_exchange_partition.h"
 
 GAsyncQueue * optimize_keys_all_tables_queue=NULL;
 GThread **index_threads = NULL;
@@ -30,10 +34,28 @@ struct thread_data *index_td = NULL;
 static GMutex *init_connection_mutex=NULL;
 void *worker_index_thread(struct thread_data *td);
 
+/* Index scheduler: the jobs on index_queue are only tokens, the build that
+   is started is the most expensive one of pending_index_jobs. How many
+   builds run at the same time depends on the loader threads that are busy */
+guint index_ddl_threads=0;
+guint index_ddl_buffer_size=0;
+static GMutex *index_mutex=NULL;
+static GCond *index_cond=NULL;
+static GList *pending_index_jobs=NULL;
+static guint running_index_builds=0;
+static gboolean ddl_variables_available=FALSE;
+
 void initialize_worker_index(struct configuration *conf){
   guint n=0;
-//  index_mutex = g_mutex_new();
+  index_mutex = g_mutex_new();
+  index_cond = g_cond_new();
   init_connection_mutex = g_mutex_new();
+  // innodb_ddl_threads and innodb_ddl_buffer_size were added in 8.0.27
+  ddl_variables_available= (index_ddl_threads > 0 || index_ddl_buffer_size > 0) &&
+      (get_product() == SERVER_TYPE_MYSQL || get_product() == SERVER_TYPE_PERCONA) &&
+      (get_major() > 8 || (get_major() == 8 && (get_secondary() > 0 || get_revision() >= 27)));
+  if ((index_ddl_threads > 0 || index_ddl_buffer_size > 0) && !ddl_variables_available)
+    g_warning("--index-ddl-threads and --index-ddl-buffer-size need MySQL 8.0.27 or newer, they will be ignored");
   index_threads = g_new(GThread *, max_threads_for_index_creation);
   index_td = g_new(struct thread_data, max_threads_for_index_creation);
   optimize_keys_all_tables_queue=g_async_queue_new();
@@ -44,8 +66,63 @@ void initialize_worker_index(struct configuration *conf){
   }
 }
 
+static
+guint allowed_index_builds(){
+  guint busy=g_atomic_int_get(&loader_threads_busy);
+  if (busy == 0 || num_threads == 0)
+    return max_threads_for_index_creation;
+  guint idle= busy < num_threads ? num_threads - busy : 0;
+  guint allowed=max_threads_for_index_creation * idle / num_threads;
+  return allowed > 0 ? allowed : 1;
+}
+
+void wake_index_threads(){
+  g_mutex_lock(index_mutex);
+  g_cond_broadcast(index_cond);
+  g_mutex_unlock(index_mutex);
+}
+
+// waits for a free slot and takes the most expensive pending build
+static
+struct control_job *take_next_index_job(guint *running){
+  g_mutex_lock(index_mutex);
+  while (running_index_builds >= allowed_index_builds())
+    g_cond_wait(index_cond, index_mutex);
+  g_assert(pending_index_jobs != NULL);
+  struct control_job *job=pending_index_jobs->data;
+  pending_index_jobs=g_list_delete_link(pending_index_jobs, pending_index_jobs);
+  *running=++running_index_builds;
+  g_mutex_unlock(index_mutex);
+  return job;
+}
+
+static
+void index_build_finished(){
+  g_mutex_lock(index_mutex);
+  running_index_builds--;
+  g_cond_broadcast(index_cond);
+  g_mutex_unlock(index_mutex);
+}
+
+// The budget of DDL threads and sort buffer is split between the builds
+// that are running
+static
+void prepend_ddl_variables(GString *statement, guint running){
+  if (!ddl_variables_available)
+    return;
+  GString *set=g_string_new("");
+  if (index_ddl_threads > 0)
+    g_string_append_printf(set, "SET SESSION innodb_ddl_threads=%u;\n", index_ddl_threads / running > 0 ? index_ddl_threads / running : 1);
+  if (index_ddl_buffer_size > 0){
+    guint64 buffer=(guint64)index_ddl_buffer_size * 1024 * 1024 / running;
+    g_string_append_printf(set, "SET SESSION innodb_ddl_buffer_size=%"G_GUINT64_FORMAT";\n", buffer > 65536 ? buffer : 65536);
+  }
+  g_string_prepend(statement, set->str);
+  g_string_free(set, TRUE);
+}
+
 gboolean process_index(struct thread_data * td){
-  struct control_job *job=g_async_queue_pop(td->conf->index_queue);
+  struct control_job *job=m_async_queue_pop(td->conf->index_queue);
   if (job->type==JOB_SHUTDOWN)
   {
     trace("index_queue -> %s", jtype2str(job->type));
@@ -53,19 +130,29 @@ gboolean process_index(struct thread_data * td){
   }
 
   g_assert(job->type == JOB_RESTORE);
+  guint running=0;
+  struct report_mark mark;
+  job=take_next_index_job(&running);
   struct db_table *dbt=job->data.restore_job->dbt;
+  prepend_ddl_variables(job->data.restore_job->data.srj->statement, running);
   trace("index_queue -> %s: %s.%s", rjtype2str(job->data.restore_job->type), dbt->database->target_database, dbt->table_filename);
   dbt->start_index_time=g_date_time_new_now_local();
   g_message("restoring index: %s.%s", dbt->database->source_database, dbt->table_filename);
+  report_start(&mark);
   process_job(td, job, NULL);
+  report_chunk(REPORT_INDEXES, &mark, dbt->database->target_database, dbt->source_table_name, -1, 0);
+  exchange_table_partitions(td, dbt);
+  index_build_finished();
   dbt->finish_time=g_date_time_new_now_local();
   table_lock(dbt);
-  dbt->schema_state=ALL_DONE;
+  set_table_schema_state(dbt, ALL_DONE);
   table_unlock(dbt);
+  constraint_dependency_done(dbt);
   return TRUE;
 }
 
 void *worker_index_thread(struct thread_data *td) {
+  set_thread_affinity(AFFINITY_INDEX);
   struct configuration *conf = td->conf;
   g_mutex_lock(init_connection_mutex);
   g_mutex_unlock(init_connection_mutex);
@@ -112,22 +199,62 @@ void start_optimize_keys_all_tables(){
   }
 }
 
+/* Rows times the key parts that are added, a FULLTEXT or SPATIAL index costs
+   more than a BTREE one with the same columns */
+static
+guint64 estimate_index_cost(struct db_table *dbt){
+  guint64 parts=0, key_parts, rows= dbt->rows > dbt->rows_inserted ? dbt->rows : dbt->rows_inserted;
+  gchar **lines=g_strsplit(dbt->indexes->str, "\n ADD", -1);
+  guint i, quotes;
+  gint depth;
+  gchar *c;
+  // the first one is the ALTER TABLE
+  for (i=1; lines[i]; i++){
+    c=strchr(lines[i], '(');
+    for (quotes=0, depth=0; c && *c; c++){
+      if (*c == '(') depth++;
+      else if (*c == ')' && --depth == 0) break;
+      else if (*c == '`') quotes++;
+    }
+    key_parts= quotes / 2 > 0 ? quotes / 2 : 1;
+    if (g_str_has_prefix(g_strchug(lines[i]), "FULLTEXT") || g_str_has_prefix(lines[i], "SPATIAL"))
+      key_parts*=4;
+    parts+=key_parts;
+  }
+  g_strfreev(lines);
+  return (rows > 0 ? rows : 1) * (parts > 0 ? parts : 1);
+}
+
+static
+gint compare_index_cost(gconstpointer a, gconstpointer b){
+  guint64 ca=((struct control_job *)a)->data.restore_job->dbt->index_cost;
+  guint64 cb=((struct control_job *)b)->data.restore_job->dbt->index_cost;
+  return ca < cb ? 1 : ca > cb ? -1 : 0;
+}
+
 static
 gboolean create_index_job(struct configuration *conf, struct db_table * dbt, guint tdid){
   message("Thread %d: Enqueuing index for table: %s.%s", tdid, dbt->database->target_database, dbt->table_filename);
-  struct restore_job *rj = new_schema_restore_job(g_strdup("index"),JOB_RESTORE_STRING, dbt, dbt->database,dbt->indexes, INDEXES);
+  // without indexes the job only exchanges the partitions
+  struct restore_job *rj = new_schema_restore_job(g_strdup("index"),JOB_RESTORE_STRING, dbt, dbt->database, dbt->indexes ? dbt->indexes : g_string_new(""), INDEXES);
   trace("index_queue <- %s: %s.%s", rjtype2str(rj->type), dbt->database->target_database, dbt->table_filename);
-  g_async_queue_push(conf->index_queue, new_control_job(JOB_RESTORE,rj,dbt->database));
-  dbt->schema_state=INDEX_ENQUEUED;
+  dbt->index_cost=dbt->indexes ? estimate_index_cost(dbt) : 0;
+  struct control_job *job=new_control_job(JOB_RESTORE,rj,dbt->database);
+  g_mutex_lock(index_mutex);
+  pending_index_jobs=g_list_insert_sorted(pending_index_jobs, job, compare_index_cost);
+  g_mutex_unlock(index_mutex);
+  g_async_queue_push(conf->index_queue, job);
+  set_table_schema_state(dbt, INDEX_ENQUEUED);
   return TRUE;
 }
 
 void enqueue_index_for_dbt_if_possible(struct configuration *conf, struct db_table * dbt){
   trace("Checking if index on %s %s is possible to enqueu", dbt->database->target_database, dbt->table_filename);
   if (dbt->schema_state==DATA_DONE){
-    if (dbt->indexes == NULL){
+    if (dbt->indexes == NULL && dbt->exchange_partitions == NULL){
       trace("Table %s %s is all done", dbt->database->target_database, dbt->table_filename);
-      dbt->schema_state=ALL_DONE;
+      set_table_schema_state(dbt, ALL_DONE);
+      constraint_dependency_done(dbt);
 //      return FALSE;
     }else{
 //      return 
@@ -22,3 +22,4 @@ void create_index_shutdown_job(struct configuration *conf);
 void start_optimize_keys_all_tables();
 void enqueue_indexes_if_possible(struct configuration *conf);
 void enqueue_index_for_dbt_if_possible(struct configuration *conf, struct db_table * dbt);
+void wake_index_threads();
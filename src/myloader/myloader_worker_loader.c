@@ -25,15 +25,19 @@
 #include "myloader_worker_index.h"
 #include "myloader_database.h"
 #include "myloader_worker_loader_main.h"
+#include "myloader_table_threads.h"
 
 GThread **threads = NULL;
 struct thread_data *loader_td = NULL;
 void *loader_thread(struct thread_data *td);
 GAsyncQueue *data_job_queue = NULL;
+// loader threads restoring a data job, the index scheduler reads it
+gint loader_threads_busy = 0;
 
 void initialize_loader_threads(struct configuration *conf){
   guint n=0;
   data_job_queue = g_async_queue_new();
+  register_queue_stats("data", data_job_queue);
   threads = g_new(GThread *, num_threads);
   loader_td = g_new(struct thread_data, num_threads);
   max_threads_per_table=max_threads_per_table>num_threads?num_threads:max_threads_per_table;
@@ -65,18 +69,33 @@ void data_ended(){
 
 gboolean process_loader(struct thread_data * td) {
   struct db_table * dbt = NULL;
-  struct data_job *dj= (struct data_job *)g_async_queue_pop(data_job_queue);
+  guint64 restored_bytes=0;
+  guint run=0, part=0;
+  struct report_mark mark;
+  struct data_job *dj= (struct data_job *)m_async_queue_pop(data_job_queue);
   trace("data_job_queue -> %s", data_job_type2str(dj->type)); // dj->restore_job->dbt->database->target_database, dj->restore_job->dbt->source_table_name, dj->restore_job->dbt->current_threads);
 
   switch (dj->type){
     case DATA_JOB:
       dbt=dj->restore_job->dbt;
       td->dbt=dj->restore_job->dbt;
+      // the data restore job is freed once it is processed
+      restored_bytes=dj->restore_job->data.drj->size;
+      run=dj->restore_job->data.drj->run;
+      part=dj->restore_job->data.drj->part;
+      g_atomic_int_inc(&loader_threads_busy);
+      report_start(&mark);
       process_restore_job(td, dj->restore_job);
+      report_chunk(REPORT_DATA, &mark, dbt->database->target_database, dbt->source_table_name, part, restored_bytes);
+      g_atomic_int_add(&loader_threads_busy, -1);
+      wake_index_threads();
       table_lock(dbt);
       dbt->current_threads--;
+      restore_job_done(dbt, run);
+      table_threads_job_done(dbt, restored_bytes);
       trace("%s.%s: done job, threads %u", dbt->database->target_database, dbt->source_table_name, dbt->current_threads);
       table_unlock(dbt);
+      data_table_ready(dbt);
       break;
     case DATA_PROCESS_ENDED:
       data_job_push(DATA_PROCESS_ENDED, NULL);
@@ -92,6 +111,7 @@ gboolean process_loader(struct thread_data * td) {
 }
 
 void *loader_thread(struct thread_data *td) {
+  set_thread_affinity(AFFINITY_WORKERS);
   struct configuration *conf = td->conf;
   gboolean cont=TRUE;
   g_async_queue_push(conf->ready, GINT_TO_POINTER(1));
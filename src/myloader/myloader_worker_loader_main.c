@@ -26,8 +26,10 @@
 #include "myloader_global.h"
 #include "myloader_worker_loader.h"
 #include "myloader_worker_index.h"
+#include "myloader_worker_post.h"
 #include "myloader_worker_schema.h"
 #include "myloader_database.h"
+#include "myloader_prefetch.h"
 
 gboolean control_job_ended=FALSE;
 gboolean all_jobs_are_enqueued=FALSE;
@@ -45,6 +47,8 @@ void initialize_worker_loader_main (struct configuration *conf){
 //  data_job_queue = g_async_queue_new();
 //  data_queue = g_async_queue_new();
   threads_waiting_mutex=g_mutex_new();
+  ready_tables_mutex=g_mutex_new();
+  ready_table_heap=g_ptr_array_new();
   _worker_loader_main = m_thread_new("myloader_ctr",(GThreadFunc)worker_loader_main_thread, conf, "Control job thread could not be created");
 }
 
@@ -60,109 +64,226 @@ void data_control_queue_push(enum data_control_type current_ft){
   g_async_queue_push(data_control_queue, GINT_TO_POINTER(current_ft));
 }
 
-gboolean give_me_next_data_job_conf(struct configuration *conf, struct restore_job ** rj){
-  gboolean giveup = TRUE;
-  g_mutex_lock(conf->table_list_mutex);
-  GList * iter=conf->loading_table_list;
-  struct restore_job *job = NULL;
-//  g_mutex_lock(conf->table_list_mutex);
-//  trace("Elements in table_list: %d",g_list_length(conf->table_list));
-//  g_mutex_unlock(conf->table_list_mutex);
-//  We are going to check every table and see if there is any missing job
-  struct db_table * dbt;
-  while (iter != NULL){
-    dbt = iter->data;
-    trace("DB: %s Table: %s Schema State: %d remaining_jobs: %d", dbt->database->target_database,dbt->source_table_name, dbt->schema_state, dbt->remaining_jobs);
-    if (dbt->database->schema_state == NOT_FOUND){
-      iter=iter->next;
-      /*
-        TODO: make all "voting for finish" messages another debug level
+/* Tables that might have a data job to be sent are notified with
+   data_table_ready() and kept in ready_tables until the control job thread
+   moves them to ready_table_heap, which is ordered by remaining size. This
+   way we don't need to check every table each time that a data job is
+   requested. */
+static GMutex *ready_tables_mutex=NULL;
+static GList *ready_tables=NULL;
+static GPtrArray *ready_table_heap=NULL;
+/* Once all the jobs are enqueued, every table votes to finish. The votes
+   only change when a table is notified, so they are checked again only
+   after a notification */
+static gboolean finish_vote_pending=TRUE;
 
-        G_MESSAGES_DEBUG.  A space-separated list of log domains for which informational
-        and debug messages should be printed. By default, these messages are not
-        printed. You can also use the special value all. This environment variable only
-        affects the default log handler, g_log_default_handler().
-      */
-      trace("%s.%s: %s, voting for finish", dbt->database->target_database, dbt->source_table_name, status2str(dbt->schema_state));
-      continue;
-    }
-    table_lock(dbt);
-    if (dbt->schema_state >= DATA_DONE ||
-        (dbt->schema_state == CREATED && (dbt->is_view || dbt->is_sequence))){
-      trace("%s.%s done: %s, voting for finish", dbt->database->target_database, dbt->source_table_name, status2str(dbt->schema_state));
-      iter=iter->next;
-      table_unlock(dbt);
-      continue;
-    }
-    // I could do some job in here, do we have some for me?
-    if (!resume && dbt->schema_state<CREATED ){
-      giveup=FALSE;
-      trace("%s.%s not yet created: %s, waiting", dbt->database->target_database, dbt->source_table_name, status2str(dbt->schema_state));
-      iter=iter->next;
-      table_unlock(dbt);
-      continue;
+void data_table_ready(struct db_table *dbt){
+  g_mutex_lock(ready_tables_mutex);
+  if (!dbt->ready_pending){
+    dbt->ready_pending=TRUE;
+    ready_tables=g_list_prepend(ready_tables, dbt);
+  }
+  finish_vote_pending=TRUE;
+  g_mutex_unlock(ready_tables_mutex);
+}
+
+static
+gboolean take_finish_vote(){
+  g_mutex_lock(ready_tables_mutex);
+  gboolean r=finish_vote_pending;
+  finish_vote_pending=FALSE;
+  g_mutex_unlock(ready_tables_mutex);
+  return r;
+}
+
+static
+void ready_table_heap_push(struct db_table *dbt){
+  guint i=ready_table_heap->len, parent;
+  g_ptr_array_add(ready_table_heap, dbt);
+  dbt->ready_scheduled=TRUE;
+  while (i > 0){
+    parent=(i-1)/2;
+    if (((struct db_table *)g_ptr_array_index(ready_table_heap, parent))->ready_key >= dbt->ready_key)
+      break;
+    ready_table_heap->pdata[i]=ready_table_heap->pdata[parent];
+    i=parent;
+  }
+  ready_table_heap->pdata[i]=dbt;
+}
+
+static
+struct db_table *ready_table_heap_pop(){
+  if (ready_table_heap->len == 0)
+    return NULL;
+  struct db_table *top=g_ptr_array_index(ready_table_heap, 0);
+  struct db_table *last=g_ptr_array_index(ready_table_heap, ready_table_heap->len - 1);
+  g_ptr_array_set_size(ready_table_heap, ready_table_heap->len - 1);
+  guint i=0, child, len=ready_table_heap->len;
+  if (len > 0){
+    while ((child=2*i+1) < len){
+      if (child + 1 < len &&
+          ((struct db_table *)g_ptr_array_index(ready_table_heap, child + 1))->ready_key > ((struct db_table *)g_ptr_array_index(ready_table_heap, child))->ready_key)
+        child++;
+      if (last->ready_key >= ((struct db_table *)g_ptr_array_index(ready_table_heap, child))->ready_key)
+        break;
+      ready_table_heap->pdata[i]=ready_table_heap->pdata[child];
+      i=child;
     }
+    ready_table_heap->pdata[i]=last;
+  }
+  top->ready_scheduled=FALSE;
+  return top;
+}
 
-      // TODO: can we do without double check (not under and under dbt->mutex)?
-    if (dbt->schema_state >= DATA_DONE ||
-        (dbt->schema_state == CREATED && (dbt->is_view || dbt->is_sequence))){
-      trace("%s.%s done just now: %s, voting for finish", dbt->database->target_database, dbt->source_table_name, status2str(dbt->schema_state));
-      iter=iter->next;
-      table_unlock(dbt);
+static
+void move_ready_tables_to_heap(){
+  g_mutex_lock(ready_tables_mutex);
+  GList *iter=ready_tables, *list=ready_tables;
+  ready_tables=NULL;
+  for (; iter != NULL; iter=iter->next)
+    ((struct db_table *)iter->data)->ready_pending=FALSE;
+  g_mutex_unlock(ready_tables_mutex);
+  struct db_table *dbt;
+  for (iter=list; iter != NULL; iter=iter->next){
+    dbt=iter->data;
+    if (dbt->ready_scheduled)
       continue;
-    }
+    table_lock(dbt);
+    dbt->ready_key=dbt->remaining_size;
+    table_unlock(dbt);
+    ready_table_heap_push(dbt);
+  }
+  g_list_free(list);
+}
 
-    if (dbt->schema_state == CREATED && g_list_length(dbt->restore_job_list) > 0){
-      if (dbt->object_to_export.no_data){
-        GList * current = dbt->restore_job_list;
-        while (current){
-          g_free(((struct restore_job *)current->data)->data.drj);
-          current=current->next;
-        }
-        dbt->schema_state = ALL_DONE;
-        trace("Setting on %s.%s ALL_DONE", dbt->database->target_database, dbt->source_table_name);
+static
+struct restore_job * give_me_next_data_job_from_table(struct db_table *dbt, struct configuration *conf, gboolean *giveup){
+  struct restore_job *job = NULL;
+  trace("DB: %s Table: %s Schema State: %d remaining_jobs: %d", dbt->database->target_database,dbt->source_table_name, dbt->schema_state, dbt->remaining_jobs);
+  if (dbt->database->schema_state == NOT_FOUND){
+    /*
+      TODO: make all "voting for finish" messages another debug level
 
-      }else{
-        if (dbt->current_threads >= dbt->max_threads ){
-          giveup=FALSE;
-          trace("%s.%s Reached max thread %s", dbt->database->target_database, dbt->source_table_name, status2str(dbt->schema_state));
-          iter=iter->next;
-          table_unlock(dbt);
-          continue;
-        }
-        // We found a job that we can process!
-        job = dbt->restore_job_list->data;
-        GList * current = dbt->restore_job_list;
-//      dbt->restore_job_list = dbt->restore_job_list->next;
-        dbt->restore_job_list = g_list_remove_link(dbt->restore_job_list, current);
-        g_list_free_1(current);
-        dbt->current_threads++;
+      G_MESSAGES_DEBUG.  A space-separated list of log domains for which informational
+      and debug messages should be printed. By default, these messages are not
+      printed. You can also use the special value all. This environment variable only
+      affects the default log handler, g_log_default_handler().
+    */
+    trace("%s.%s: %s, voting for finish", dbt->database->target_database, dbt->source_table_name, status2str(dbt->schema_state));
+    return NULL;
+  }
+  table_lock(dbt);
+  if (dbt->schema_state >= DATA_DONE ||
+      (dbt->schema_state == CREATED && (dbt->is_view || dbt->is_sequence))){
+    trace("%s.%s done: %s, voting for finish", dbt->database->target_database, dbt->source_table_name, status2str(dbt->schema_state));
+    table_unlock(dbt);
+    return NULL;
+  }
+  // I could do some job in here, do we have some for me?
+  if (!resume && dbt->schema_state<CREATED ){
+    *giveup=FALSE;
+    trace("%s.%s not yet created: %s, waiting", dbt->database->target_database, dbt->source_table_name, status2str(dbt->schema_state));
+    table_unlock(dbt);
+    return NULL;
+  }
+
+  if (dbt->schema_state == CREATED && dbt->restore_job_heap->len > 0){
+    if (dbt->object_to_export.no_data){
+      guint i;
+      for (i=0; i < dbt->restore_job_heap->len; i++)
+        g_free(((struct restore_job *)g_ptr_array_index(dbt->restore_job_heap, i))->data.drj);
+      g_ptr_array_set_size(dbt->restore_job_heap, 0);
+      dbt->remaining_size=0;
+      set_table_schema_state(dbt, ALL_DONE);
+      constraint_dependency_done(dbt);
+      trace("Setting on %s.%s ALL_DONE", dbt->database->target_database, dbt->source_table_name);
+
+    }else{
+      if (dbt->current_threads >= dbt->max_threads ){
+        *giveup=FALSE;
+        trace("%s.%s Reached max thread %s", dbt->database->target_database, dbt->source_table_name, status2str(dbt->schema_state));
         table_unlock(dbt);
-        giveup=FALSE;
-        trace("%s.%s sending %s: %s, threads: %u, prohibiting finish", dbt->database->target_database, dbt->source_table_name,
-            rjtype2str(job->type), job->filename, dbt->current_threads);
-        break;
+        return NULL;
       }
-    }else{
-// AND CURRENT THREADS IS 0... if not we are seting DATA_DONE to unfinished tables
-      trace("No remaining jobs on %s.%s and %d %d %d", dbt->database->target_database, dbt->source_table_name, all_jobs_are_enqueued, dbt->current_threads, dbt->remaining_jobs); 
-      if (all_jobs_are_enqueued && dbt->current_threads == 0 && (g_atomic_int_get(&(dbt->remaining_jobs))==0 )){
-        dbt->schema_state = DATA_DONE;
-        enqueue_index_for_dbt_if_possible(conf,dbt);
-        trace("%s.%s queuing indexes, voting for finish", dbt->database->target_database, dbt->source_table_name);
-      }else
-        giveup=FALSE;
+      // We found a job that we can process!
+      job = restore_job_take(dbt);
+      prefetch_next_data_jobs(dbt->restore_job_heap);
+      dbt->current_threads++;
+      dbt->remaining_size-=job->data.drj->size;
+      table_unlock(dbt);
+      *giveup=FALSE;
+      trace("%s.%s sending %s: %s, threads: %u, prohibiting finish", dbt->database->target_database, dbt->source_table_name,
+          rjtype2str(job->type), job->filename, dbt->current_threads);
+      return job;
     }
-    
-    table_unlock(dbt);
+  }else{
+// AND CURRENT THREADS IS 0... if not we are seting DATA_DONE to unfinished tables
+    trace("No remaining jobs on %s.%s and %d %d %d", dbt->database->target_database, dbt->source_table_name, all_jobs_are_enqueued, dbt->current_threads, dbt->remaining_jobs); 
+    if (all_jobs_are_enqueued && dbt->current_threads == 0 && (g_atomic_int_get(&(dbt->remaining_jobs))==0 )){
+      set_table_schema_state(dbt, DATA_DONE);
+      enqueue_index_for_dbt_if_possible(conf,dbt);
+      trace("%s.%s queuing indexes, voting for finish", dbt->database->target_database, dbt->source_table_name);
+    }else
+      *giveup=FALSE;
+  }
+  table_unlock(dbt);
+  return NULL;
+}
+
+static
+gboolean give_me_next_data_job_checking_all_tables(struct configuration *conf, struct restore_job ** rj){
+  gboolean giveup = TRUE;
+  struct restore_job *job = NULL;
+  g_mutex_lock(conf->table_list_mutex);
+  GList * iter=conf->loading_table_list;
+//  We are going to check every table and see if there is any missing job
+  while (iter != NULL && job == NULL){
+    job=give_me_next_data_job_from_table(iter->data, conf, &giveup);
     iter=iter->next;
   }
   trace("No more tables to check %d", giveup);
   g_mutex_unlock(conf->table_list_mutex);
+  // the table of the job might have more, it has to be checked again
+  if (job != NULL){
+    g_mutex_lock(ready_tables_mutex);
+    finish_vote_pending=TRUE;
+    g_mutex_unlock(ready_tables_mutex);
+  }
   *rj = job;
   return giveup;
 }
 
+gboolean give_me_next_data_job_conf(struct configuration *conf, struct restore_job ** rj){
+  struct restore_job *job = NULL;
+  struct db_table *dbt = NULL;
+  gboolean giveup = TRUE, more_jobs;
+  move_ready_tables_to_heap();
+  while (job == NULL && (dbt=ready_table_heap_pop()) != NULL){
+    job=give_me_next_data_job_from_table(dbt, conf, &giveup);
+    if (job != NULL){
+      table_lock(dbt);
+      more_jobs= dbt->restore_job_heap->len > 0 && dbt->current_threads < dbt->max_threads;
+      table_unlock(dbt);
+      // The table is notified again when a thread finishes a job on it
+      if (more_jobs){
+        dbt->ready_key=dbt->remaining_size;
+        ready_table_heap_push(dbt);
+      }
+    }
+  }
+  if (job != NULL){
+    *rj = job;
+    return FALSE;
+  }
+  // When all the jobs are enqueued we need to vote every table to finish,
+  // which means that we need to check them all. Without a notification
+  // since the last check, the votes are the same and nobody gave up yet
+  if (all_jobs_are_enqueued && take_finish_vote())
+    return give_me_next_data_job_checking_all_tables(conf, rj);
+  *rj = NULL;
+  return FALSE;
+}
+
 static
 void wake_threads_waiting(){
   g_mutex_lock(threads_waiting_mutex);
@@ -16,10 +16,14 @@
 */
 
 #include <glib/gstdio.h>
+#include <string.h>
 
 #include "myloader_common.h"
 #include "myloader_global.h"
 #include "myloader_restore_job.h"
+#include "myloader_control_job.h"
+#include "myloader_worker_post.h"
+#include "myloader_dependency.h"
 
 GThread **post_threads = NULL;
 struct thread_data *post_td = NULL;
@@ -31,6 +35,232 @@ guint sync_threads_remaining;
 guint sync_threads_remaining1;
 guint sync_threads_remaining2;
 
+/* The constraints of a table are sent to post_table_queue as soon as the
+   table and the tables that it references are loaded, instead of waiting
+   for the whole restore to finish (see myloader_dependency.h) */
+static struct configuration *constraint_conf=NULL;
+
+/* --validate-foreign-keys: the foreign keys are added with
+   FOREIGN_KEY_CHECKS=0, so the server does not scan the child table. Each
+   one is verified afterwards with a query for the rows without parent, which
+   run on the connections of the pool while the post threads go on with the
+   constraints of the other tables */
+gboolean validate_foreign_keys=FALSE;
+
+struct foreign_key_check {
+  gchar *table;
+  gchar *name;
+  GString *query;
+};
+static GAsyncQueue *foreign_key_check_queue=NULL;
+static GThread **foreign_key_check_threads=NULL;
+static gint foreign_keys_checked=0;
+static gint foreign_keys_with_orphans=0;
+
+void initialize_constraint_dependencies(struct configuration *conf){
+  constraint_conf=conf;
+}
+
+static
+gchar *read_identifier(gchar **c){
+  gchar *start=NULL, *end=NULL;
+  if (**c != identifier_quote_character)
+    return NULL;
+  start=*c + 1;
+  end=start;
+  // doubled quotes are part of the name
+  while ((end=strchr(end, identifier_quote_character)) && end[1] == identifier_quote_character)
+    end+=2;
+  if (end == NULL)
+    return NULL;
+  *c=end + 1;
+  return g_strndup(start, end - start);
+}
+
+// REFERENCES `table` or REFERENCES `db`.`table`
+static
+GList *get_referenced_tables(struct db_table *dbt, const gchar *statement){
+  GList *references=NULL;
+  gchar *c=(gchar *)statement, *first, *second;
+  while ((c=strstr(c, "REFERENCES "))){
+    c+=strlen("REFERENCES ");
+    first=read_identifier(&c);
+    if (first == NULL)
+      continue;
+    second=NULL;
+    if (*c == '.'){
+      c++;
+      second=read_identifier(&c);
+    }
+    references=g_list_prepend(references, second ?
+        table_dependency_node(first, second) :
+        table_dependency_node(dbt->database->source_database, first));
+    g_free(first);
+    g_free(second);
+  }
+  return references;
+}
+
+// (`a`, `b`), the names are kept quoted as they are in the statement
+static
+GList *read_identifier_list(gchar **c){
+  GList *list=NULL;
+  gchar *name=NULL;
+  if (**c != '(')
+    return NULL;
+  (*c)++;
+  while ((name=read_identifier(c))){
+    list=g_list_append(list, name);
+    while (**c == ',' || **c == ' ')
+      (*c)++;
+  }
+  if (**c != ')'){
+    g_list_free_full(list, g_free);
+    return NULL;
+  }
+  (*c)++;
+  return list;
+}
+
+static
+GString *build_orphan_query(struct db_table *dbt, gchar *parent_database, gchar *parent_table, GList *columns, GList *parent_columns){
+  const char q=identifier_quote_character;
+  GString *query=g_string_new(NULL);
+  GList *c, *p;
+  g_string_printf(query, "SELECT 1 FROM %c%s%c.%c%s%c c WHERE ",
+      q, dbt->database->target_database, q, q, dbt->source_table_name, q);
+  // rows with a NULL in the key are not checked by the server either
+  for (c=columns; c; c=c->next)
+    g_string_append_printf(query, "c.%c%s%c IS NOT NULL AND ", q, (gchar *)c->data, q);
+  g_string_append_printf(query, "NOT EXISTS (SELECT 1 FROM %c%s%c.%c%s%c p WHERE ", q, parent_database, q, q, parent_table, q);
+  for (c=columns, p=parent_columns; c && p; c=c->next, p=p->next)
+    g_string_append_printf(query, "%sp.%c%s%c=c.%c%s%c", c == columns ? "" : " AND ", q, (gchar *)p->data, q, q, (gchar *)c->data, q);
+  g_string_append(query, ") LIMIT 1");
+  return query;
+}
+
+/* Called once the constraints of the table are added. Each CONSTRAINT `name`
+   FOREIGN KEY (...) REFERENCES [`db`.]`table` (...) gets its check */
+void queue_foreign_key_checks(struct db_table *dbt, const gchar *statement){
+  if (foreign_key_check_queue == NULL)
+    return;
+  gchar *c=(gchar *)statement, *constraint, *first, *second;
+  while ((c=strstr(c, "FOREIGN KEY "))){
+    gchar *name=NULL;
+    constraint=g_strrstr_len(statement, c - statement, "CONSTRAINT ");
+    if (constraint){
+      constraint+=strlen("CONSTRAINT ");
+      name=read_identifier(&constraint);
+    }
+    c+=strlen("FOREIGN KEY ");
+    GList *columns=read_identifier_list(&c), *parent_columns=NULL;
+    first=NULL;
+    second=NULL;
+    if (columns && g_str_has_prefix(c, " REFERENCES ")){
+      c+=strlen(" REFERENCES ");
+      first=read_identifier(&c);
+      if (first && *c == '.'){
+        c++;
+        second=read_identifier(&c);
+      }
+      if (*c == ' ')
+        c++;
+      parent_columns=read_identifier_list(&c);
+    }
+    if (first && parent_columns && g_list_length(columns) == g_list_length(parent_columns)){
+      struct foreign_key_check *fkc=g_new0(struct foreign_key_check, 1);
+      fkc->table=g_strdup_printf("%s.%s", dbt->database->target_database, dbt->source_table_name);
+      fkc->name= name ? name : g_strdup("");
+      name=NULL;
+      // the tables of the database of the dump are in the target database
+      gchar *parent_database= second == NULL || !g_strcmp0(first, dbt->database->source_database) ? dbt->database->target_database : first;
+      fkc->query=build_orphan_query(dbt, parent_database, second ? second : first, columns, parent_columns);
+      g_async_queue_push(foreign_key_check_queue, fkc);
+    }else
+      g_warning("Foreign key %s of %s.%s could not be parsed, it is not validated", name ? name : "", dbt->database->target_database, dbt->source_table_name);
+    g_free(name);
+    g_free(first);
+    g_free(second);
+    g_list_free_full(columns, g_free);
+    g_list_free_full(parent_columns, g_free);
+  }
+}
+
+static
+void *foreign_key_check_thread(void *data){
+  (void) data;
+  struct foreign_key_check *fkc=NULL;
+  while ((fkc=g_async_queue_pop(foreign_key_check_queue)) != GINT_TO_POINTER(-1)){
+    struct connection_data *cd=m_async_queue_pop(connection_pool);
+    trace("Validating foreign key %s of %s", fkc->name, fkc->table);
+    struct M_ROW *mr=m_store_result_row(cd->thrconn, fkc->query->str, m_warning, m_warning, "Failed to validate foreign key %s of %s", fkc->name, fkc->table);
+    if (mr->res == NULL){
+      g_atomic_int_inc(&(detailed_errors.constraints_errors));
+    }else if (mr->row){
+      g_critical("Foreign key %s of %s has rows without their parent row", fkc->name, fkc->table);
+      errors++;
+      g_atomic_int_inc(&foreign_keys_with_orphans);
+    }
+    g_atomic_int_inc(&foreign_keys_checked);
+    m_store_result_row_free(mr);
+    g_async_queue_push(connection_pool, cd);
+    g_free(fkc->table);
+    g_free(fkc->name);
+    g_string_free(fkc->query, TRUE);
+    g_free(fkc);
+  }
+  return NULL;
+}
+
+static
+void initialize_foreign_key_checks(){
+  guint n;
+  if (!validate_foreign_keys)
+    return;
+  gchar *foreign_key_checks=g_hash_table_lookup(set_session_hash, "FOREIGN_KEY_CHECKS");
+  if (foreign_key_checks && g_strcmp0(foreign_key_checks, "0")){
+    g_warning("--validate-foreign-keys is ignored, the server validates the foreign keys with FOREIGN_KEY_CHECKS=%s", foreign_key_checks);
+    return;
+  }
+  foreign_key_check_queue=g_async_queue_new();
+  foreign_key_check_threads=g_new(GThread *, num_threads);
+  for (n=0; n < num_threads; n++)
+    foreign_key_check_threads[n]=m_thread_new("myl_fk_check", (GThreadFunc)foreign_key_check_thread, NULL, "Foreign key check thread could not be created");
+}
+
+// After the post threads, no more checks are queued
+static
+void finish_foreign_key_checks(){
+  guint n;
+  if (foreign_key_check_queue == NULL)
+    return;
+  for (n=0; n < num_threads; n++)
+    g_async_queue_push(foreign_key_check_queue, GINT_TO_POINTER(-1));
+  for (n=0; n < num_threads; n++)
+    g_thread_join(foreign_key_check_threads[n]);
+  g_free(foreign_key_check_threads);
+  g_async_queue_unref(foreign_key_check_queue);
+  foreign_key_check_queue=NULL;
+  g_message("%d foreign keys validated, %d with rows without their parent row", foreign_keys_checked, foreign_keys_with_orphans);
+}
+
+static
+void release_constraint_job(gpointer data){
+  struct control_job *job=data;
+  trace("post_table_queue <- constraints of %s.%s", job->data.restore_job->dbt->database->target_database, job->data.restore_job->dbt->source_table_name);
+  g_async_queue_push(constraint_conf->post_table_queue, job);
+}
+
+void register_constraint_job(struct db_table *dbt, struct restore_job *rj){
+  GList *nodes=get_referenced_tables(dbt, rj->data.srj->statement->str);
+  nodes=g_list_prepend(nodes, table_dependency_node(dbt->database->source_database, dbt->source_table_name));
+  dependency_wait(nodes, release_constraint_job, new_control_job(JOB_RESTORE, rj, dbt->database));
+}
+
+void constraint_dependency_done(struct db_table *dbt){
+  dependency_done(table_dependency_node(dbt->database->source_database, dbt->source_table_name));
+}
+
 void initialize_post_loding_threads(struct configuration *conf){
   guint n=0;
 //  post_mutex = g_mutex_new();
@@ -42,6 +272,7 @@ void initialize_post_loding_threads(struct configuration *conf){
   sync_mutex = g_mutex_new();
   sync_mutex1 = g_mutex_new();
   sync_mutex2 = g_mutex_new();
+  initialize_foreign_key_checks();
   g_mutex_lock(sync_mutex);
   g_mutex_lock(sync_mutex1);
   g_mutex_lock(sync_mutex2);
@@ -64,30 +295,41 @@ void sync_threads(guint *counter, GMutex *mutex){
 }
 
 void *worker_post_thread(struct thread_data *td) {
+  set_thread_affinity(AFFINITY_POST);
   struct configuration *conf = td->conf;
 
   g_async_queue_push(conf->ready, GINT_TO_POINTER(1));
   gboolean cont=TRUE;
   struct control_job *job = NULL;
+  struct report_mark mark;
 
   set_thread_name("T%02u", td->thread_id);
   g_message("Thread %u: Starting post import task over table", td->thread_id);
   cont=TRUE;
   while (cont){
-    job = (struct control_job *)g_async_queue_pop(conf->post_table_queue);
+    job = (struct control_job *)m_async_queue_pop(conf->post_table_queue);
+    report_start(&mark);
     cont=process_job(td, job, NULL);
+    if (cont)
+      report_end(REPORT_CONSTRAINTS, &mark, 0);
   }
 
   cont=TRUE;
   while (cont){
-    job = (struct control_job *)g_async_queue_pop(conf->post_queue);
+    job = (struct control_job *)m_async_queue_pop(conf->post_queue);
+    report_start(&mark);
     cont=process_job(td, job, NULL);
+    if (cont)
+      report_end(REPORT_POST, &mark, 0);
   }
   sync_threads(&sync_threads_remaining2,sync_mutex2);
   cont=TRUE;
   while (cont){
     job = (struct control_job *)g_async_queue_pop(conf->view_queue);
+    report_start(&mark);
     cont=process_job(td, job, NULL);
+    if (cont)
+      report_end(REPORT_POST, &mark, 0);
   }
 
   trace("Thread %u: ending", td->thread_id);
@@ -96,6 +338,8 @@ void *worker_post_thread(struct thread_data *td) {
 
 void create_post_shutdown_job(struct configuration *conf){
   guint n=0;
+  // references to tables that are not in the backup are never done
+  release_pending_dependencies();
   for (n = 0; n < max_threads_for_post_creation; n++) {
     g_async_queue_push(conf->post_queue, new_control_job(JOB_SHUTDOWN,NULL,NULL));
     g_async_queue_push(conf->post_table_queue, new_control_job(JOB_SHUTDOWN,NULL,NULL));
@@ -108,6 +352,7 @@ void wait_post_worker_to_finish(){
   for (n = 0; n < max_threads_for_post_creation; n++) {
     g_thread_join(post_threads[n]);
   }
+  finish_foreign_key_checks();
 }
 
 void free_post_worker_threads(){
@@ -15,7 +15,12 @@
         Authors:    David Ducos, Percona (david dot ducos at percona dot com)
 */
 #include "myloader.h"
+#include "myloader_restore_job.h"
 
 void initialize_post_loding_threads(struct configuration *conf);
 void create_post_shutdown_job(struct configuration *conf);
 void wait_post_worker_to_finish();
+void initialize_constraint_dependencies(struct configuration *conf);
+void register_constraint_job(struct db_table *dbt, struct restore_job *rj);
+void constraint_dependency_done(struct db_table *dbt);
+void queue_foreign_key_checks(struct db_table *dbt, const gchar *statement);
@@ -24,6 +24,7 @@
 #include "myloader_global.h"
 #include "myloader_database.h"
 #include "myloader_worker_schema.h"
+#include "myloader_dependency.h"
 
 /* refresh_db_queue2 is for schemas creation */
 static
@@ -55,6 +56,11 @@ void schema_job_queue_push(struct schema_job *sj){
   g_async_queue_push(schema_job_queue, sj);
 }
 
+static
+void release_schema_job(gpointer sj){
+  schema_job_queue_push(sj);
+}
+
 gboolean schema_push( enum schema_job_type schema_worker_job, gchar * filename, enum restore_job_type rj_type, struct db_table * dbt, struct database * _database, GString * statement, enum restore_job_statement_type object, struct database *use_database ){
   struct restore_job *rj = new_schema_restore_job(filename, rj_type, dbt, _database, statement, object);
   struct schema_job *sj = new_schema_job(schema_worker_job, rj, use_database);
@@ -69,9 +75,9 @@ gboolean schema_push( enum schema_job_type schema_worker_job, gchar * filename,
       return FALSE;
     }else
     if (schema_worker_job == SCHEMA_TABLE_JOB ) {
-      trace("%s.table_queue <- %s", _database->target_database, schema_job_type2str(sj->type));
-      trace("_database: %p; table_queue: %p", _database, _database->table_queue);
-      g_async_queue_push(_database->table_queue, sj);
+      // released by set_db_schema_created()
+      trace("CREATE TABLE waits on database %s: %s", _database->target_database, schema_job_type2str(sj->type));
+      dependency_wait(g_list_prepend(NULL, database_dependency_node(_database->source_database)), release_schema_job, sj);
       g_mutex_unlock(_database->mutex);
       return FALSE;
     }else{
@@ -123,11 +129,8 @@ void set_db_schema_created(struct database * _database)
     schema_job_queue_push(sj);
     sj = g_async_queue_try_pop(_database->sequence_queue);  
   }
-  sj = g_async_queue_try_pop(_database->table_queue);
-  while (sj){
-    schema_job_queue_push(sj);
-    sj = g_async_queue_try_pop(_database->table_queue);
-  }
+  // the tables are created after the sequences that they could use
+  dependency_done(database_dependency_node(_database->source_database));
 }
 
 static
@@ -138,8 +141,10 @@ void set_table_schema_state_to_created (struct configuration *conf){
   while (iter != NULL){
     dbt=iter->data;
     table_lock(dbt);
-    if (dbt->schema_state == NOT_FOUND )
-      dbt->schema_state = CREATED;
+    if (dbt->schema_state == NOT_FOUND ){
+      set_table_schema_state(dbt, CREATED);
+      data_table_ready(dbt);
+    }
     table_unlock(dbt);
     iter=iter->next;
   }
@@ -151,8 +156,9 @@ gboolean second_round=FALSE;
 gboolean process_schema(struct thread_data * td){
   struct database * _database = NULL;
   struct control_job *job = NULL;
+  struct report_mark mark;
 
-  struct schema_job * schema_job = g_async_queue_pop(schema_job_queue);
+  struct schema_job * schema_job = m_async_queue_pop(schema_job_queue);
   trace("schema_job_queue -> %s", schema_job_type2str(schema_job->type));
 
   switch (schema_job->type){
@@ -160,7 +166,9 @@ gboolean process_schema(struct thread_data * td){
       _database=schema_job->restore_job->data.srj->database;
       trace("database_queue -> %s", _database->source_database);
       g_mutex_lock(_database->mutex);
+      report_start(&mark);
       process_restore_job(td, schema_job->restore_job);
+      report_end(REPORT_SCHEMA, &mark, 0);
       //      ret=process_job(td, job, NULL);
       set_db_schema_created(_database);
       trace("Set DB created: %s", _database->source_database);
@@ -168,10 +176,12 @@ gboolean process_schema(struct thread_data * td){
       break;
     case SCHEMA_SEQUENCE_JOB:
     case SCHEMA_TABLE_JOB:
+      report_start(&mark);
       if (process_restore_job(td, schema_job->restore_job)){
         trace("retry_queue <- ");
         g_async_queue_push(retry_queue, job);
       }
+      report_end(REPORT_SCHEMA, &mark, 0);
       wake_data_threads();
       break;
     case SCHEMA_PROCESS_ENDED:
@@ -208,6 +218,7 @@ gboolean process_schema(struct thread_data * td){
 }
 
 void *worker_schema_thread(struct thread_data *td) {
+  set_thread_affinity(AFFINITY_SCHEMA);
   struct configuration *conf = td->conf;
 
   g_async_queue_push(conf->ready, GINT_TO_POINTER(1));
@@ -229,6 +240,7 @@ void initialize_worker_schema(struct configuration *conf){
   guint n=0;
   refresh_db_queue2 = g_async_queue_new();
   schema_job_queue = g_async_queue_new();
+  register_queue_stats("schema", schema_job_queue);
   retry_queue = g_async_queue_new();
   schema_threads = g_new(GThread *, max_threads_for_schema_creation);
   schema_td = g_new(struct thread_data, max_threads_for_schema_creation);
@@ -0,0 +1,264 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Authors:        David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#include <unistd.h>
+#include "common.h"
+#include "metrics.h"
+#include "queue_stats.h"
+#include "allocator.h"
+
+guint queue_stats_interval=0;
+
+struct queue_stats {
+  const gchar *name;
+  GAsyncQueue *queue;
+  guint64 pops;
+  // pops that found the queue empty and the time they were blocked
+  guint64 stalls;
+  guint64 consumer_wait_usec;
+  // producers that wait on a bounded queue, like the exec queue
+  guint64 producer_wait_usec;
+  gint max_length;
+  // owned by the reporting thread
+  guint64 last_pops;
+  guint64 last_consumer_wait_usec;
+};
+
+static struct queue_stats queue_stats[QUEUE_STATS_MAX];
+static gint queue_stats_count=0;
+static GThread *queue_stats_thread=NULL;
+static gint queue_stats_shutdown=FALSE;
+// protects the queue of the entries against the samplers of the depth
+static GMutex queue_stats_mutex;
+
+/* Entries are written before the count is published and never removed, so
+   the lookups do not need a lock. A name registered again, like on every run
+   of --daemon, moves the entry to the new queue and keeps the counters. The
+   entry holds a reference on its queue until it is unregistered or moved, so
+   a sample never reads a freed queue */
+void register_queue_stats(const gchar *name, GAsyncQueue *queue){
+  if (queue == NULL)
+    return;
+  gint i, n=g_atomic_int_get(&queue_stats_count);
+  GAsyncQueue *previous=NULL;
+  g_mutex_lock(&queue_stats_mutex);
+  for (i=0; i < n; i++){
+    if (!g_strcmp0(queue_stats[i].name, name)){
+      previous=queue_stats[i].queue;
+      g_atomic_pointer_set(&queue_stats[i].queue, g_async_queue_ref(queue));
+      g_mutex_unlock(&queue_stats_mutex);
+      if (previous)
+        g_async_queue_unref(previous);
+      return;
+    }
+  }
+  if (n == QUEUE_STATS_MAX){
+    g_mutex_unlock(&queue_stats_mutex);
+    g_warning("Queue %s is not instrumented, there are already %d", name, QUEUE_STATS_MAX);
+    return;
+  }
+  queue_stats[n].name=name;
+  queue_stats[n].queue=g_async_queue_ref(queue);
+  g_atomic_int_inc(&queue_stats_count);
+  g_mutex_unlock(&queue_stats_mutex);
+}
+
+// The counters are kept, the name can be registered again with a new queue
+void unregister_queue_stats(GAsyncQueue *queue){
+  if (queue == NULL)
+    return;
+  gint i, n=g_atomic_int_get(&queue_stats_count);
+  g_mutex_lock(&queue_stats_mutex);
+  for (i=0; i < n; i++){
+    if (g_atomic_pointer_get(&queue_stats[i].queue) == queue){
+      g_atomic_pointer_set(&queue_stats[i].queue, NULL);
+      g_mutex_unlock(&queue_stats_mutex);
+      g_async_queue_unref(queue);
+      return;
+    }
+  }
+  g_mutex_unlock(&queue_stats_mutex);
+}
+
+static
+struct queue_stats *get_queue_stats(GAsyncQueue *queue){
+  gint i, n=g_atomic_int_get(&queue_stats_count);
+  for (i=0; i < n; i++)
+    if (g_atomic_pointer_get(&queue_stats[i].queue) == queue)
+      return &(queue_stats[i]);
+  return NULL;
+}
+
+static
+void queue_stats_popped(struct queue_stats *qs, gint64 start){
+  __sync_fetch_and_add(&qs->pops, 1);
+  if (start){
+    __sync_fetch_and_add(&qs->stalls, 1);
+    __sync_fetch_and_add(&qs->consumer_wait_usec, g_get_monotonic_time() - start);
+  }
+}
+
+// Only the pops that block are timed, the queue is usually not empty
+gpointer m_async_queue_pop(GAsyncQueue *queue){
+  struct queue_stats *qs=get_queue_stats(queue);
+  if (qs == NULL)
+    return g_async_queue_pop(queue);
+  gpointer data=g_async_queue_try_pop(queue);
+  gint64 start=0;
+  if (data == NULL){
+    start=g_get_monotonic_time();
+    data=g_async_queue_pop(queue);
+  }
+  queue_stats_popped(qs, start);
+  return data;
+}
+
+gpointer m_async_queue_timeout_pop(GAsyncQueue *queue, guint64 timeout){
+  struct queue_stats *qs=get_queue_stats(queue);
+  if (qs == NULL)
+    return g_async_queue_timeout_pop(queue, timeout);
+  gpointer data=g_async_queue_try_pop(queue);
+  gint64 start=0;
+  if (data == NULL){
+    start=g_get_monotonic_time();
+    data=g_async_queue_timeout_pop(queue, timeout);
+    if (data == NULL){
+      __sync_fetch_and_add(&qs->consumer_wait_usec, g_get_monotonic_time() - start);
+      return NULL;
+    }
+  }
+  queue_stats_popped(qs, start);
+  return data;
+}
+
+void queue_stats_producer_wait(GAsyncQueue *queue, gint64 usec){
+  struct queue_stats *qs=get_queue_stats(queue);
+  if (qs != NULL)
+    __sync_fetch_and_add(&qs->producer_wait_usec, usec);
+}
+
+// An unregistered queue is empty
+static
+gint sample_queue_length(struct queue_stats *qs){
+  gint length=0;
+  g_mutex_lock(&queue_stats_mutex);
+  if (qs->queue)
+    length=g_async_queue_length(qs->queue);
+  g_mutex_unlock(&queue_stats_mutex);
+  if (length > g_atomic_int_get(&qs->max_length))
+    g_atomic_int_set(&qs->max_length, length);
+  return length;
+}
+
+void append_queue_stats_metrics(GString *content, const gchar *prefix){
+  gint i, n=g_atomic_int_get(&queue_stats_count);
+  if (n == 0)
+    return;
+  gchar *name=g_strdup_printf("%s_queue_depth", prefix);
+  append_metrics_header(content, name, "gauge", "Jobs waiting on each pipeline queue");
+  for (i=0; i < n; i++)
+    g_string_append_printf(content, "%s{name=\"%s\"} %d\n", name, queue_stats[i].name, sample_queue_length(&queue_stats[i]));
+  g_free(name);
+  name=g_strdup_printf("%s_queue_max_depth", prefix);
+  append_metrics_header(content, name, "gauge", "Highest depth sampled on each pipeline queue");
+  for (i=0; i < n; i++)
+    g_string_append_printf(content, "%s{name=\"%s\"} %d\n", name, queue_stats[i].name, g_atomic_int_get(&queue_stats[i].max_length));
+  g_free(name);
+  name=g_strdup_printf("%s_queue_pops_total", prefix);
+  append_metrics_header(content, name, "counter", "Jobs taken from each pipeline queue");
+  for (i=0; i < n; i++)
+    g_string_append_printf(content, "%s{name=\"%s\"} %"G_GUINT64_FORMAT"\n", name, queue_stats[i].name, queue_stats[i].pops);
+  g_free(name);
+  name=g_strdup_printf("%s_queue_stalls_total", prefix);
+  append_metrics_header(content, name, "counter", "Pops that found the pipeline queue empty");
+  for (i=0; i < n; i++)
+    g_string_append_printf(content, "%s{name=\"%s\"} %"G_GUINT64_FORMAT"\n", name, queue_stats[i].name, queue_stats[i].stalls);
+  g_free(name);
+  name=g_strdup_printf("%s_queue_consumer_wait_seconds_total", prefix);
+  append_metrics_header(content, name, "counter", "Time the consumers were blocked on an empty pipeline queue");
+  for (i=0; i < n; i++)
+    g_string_append_printf(content, "%s{name=\"%s\"} %f\n", name, queue_stats[i].name, (gdouble)queue_stats[i].consumer_wait_usec / G_USEC_PER_SEC);
+  g_free(name);
+  name=g_strdup_printf("%s_queue_producer_wait_seconds_total", prefix);
+  append_metrics_header(content, name, "counter", "Time the producers were blocked on a full pipeline queue");
+  for (i=0; i < n; i++)
+    g_string_append_printf(content, "%s{name=\"%s\"} %f\n", name, queue_stats[i].name, (gdouble)queue_stats[i].producer_wait_usec / G_USEC_PER_SEC);
+  g_free(name);
+}
+
+/* One line per interval. The consumer wait is the share of the interval the
+   consumers of the queue spent blocked, added over all of them, so a stage
+   with 8 idle threads shows 800% */
+static
+void message_queue_stats(gint64 elapsed_usec){
+  gint i, n=g_atomic_int_get(&queue_stats_count);
+  GString *line=g_string_sized_new(512);
+  for (i=0; i < n; i++){
+    struct queue_stats *qs=&(queue_stats[i]);
+    guint64 pops=qs->pops, wait=qs->consumer_wait_usec;
+    g_string_append_printf(line, "%s%s: %d queued, %.0f/s, %.0f%% waiting", line->len ? " | " : "", qs->name,
+        sample_queue_length(qs), (gdouble)(pops - qs->last_pops) * G_USEC_PER_SEC / elapsed_usec,
+        (gdouble)(wait - qs->last_consumer_wait_usec) * 100 / elapsed_usec);
+    qs->last_pops=pops;
+    qs->last_consumer_wait_usec=wait;
+  }
+  if (line->len)
+    g_message("Queues: %s", line->str);
+  g_string_free(line, TRUE);
+}
+
+// Sleeps by seconds, so the end of the run is not delayed by the interval
+static
+void *queue_stats_thread_worker(void *data){
+  (void) data;
+  gint64 last=g_get_monotonic_time(), now=0;
+  guint seconds=0;
+  while (!g_atomic_int_get(&queue_stats_shutdown)){
+    sleep(1);
+    if (++seconds < queue_stats_interval)
+      continue;
+    seconds=0;
+    now=g_get_monotonic_time();
+    message_queue_stats(now - last);
+    message_allocator_stats();
+    last=now;
+  }
+  return NULL;
+}
+
+void start_queue_stats(){
+  if (queue_stats_interval == 0)
+    return;
+  queue_stats_thread=m_thread_new("queue_stats", queue_stats_thread_worker, NULL, "Queue stats thread could not be created");
+}
+
+// The summary of the whole run, the busiest stage is the one never waiting
+void stop_queue_stats(){
+  gint i, n=g_atomic_int_get(&queue_stats_count);
+  if (queue_stats_thread){
+    g_atomic_int_set(&queue_stats_shutdown, TRUE);
+    g_thread_join(queue_stats_thread);
+    queue_stats_thread=NULL;
+  }
+  if (queue_stats_interval == 0)
+    return;
+  for (i=0; i < n; i++)
+    g_message("Queue %s: %"G_GUINT64_FORMAT" jobs, %"G_GUINT64_FORMAT" stalls, max depth %d, consumers waited %.3fs, producers waited %.3fs",
+        queue_stats[i].name, queue_stats[i].pops, queue_stats[i].stalls, queue_stats[i].max_length,
+        (gdouble)queue_stats[i].consumer_wait_usec / G_USEC_PER_SEC, (gdouble)queue_stats[i].producer_wait_usec / G_USEC_PER_SEC);
+  message_allocator_stats();
+}
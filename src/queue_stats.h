@@ -0,0 +1,40 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Authors:        David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#ifndef _src_queue_stats_h
+#define _src_queue_stats_h
+
+#include <glib.h>
+
+/* Telemetry of the GAsyncQueues between the stages of the pipeline. The
+   queues are registered once by name and the consumers pop them through
+   m_async_queue_pop(), which counts the jobs and the time blocked waiting for
+   one. The depth is sampled by --queue-stats-interval and by the metrics */
+#define QUEUE_STATS_MAX 32
+
+extern guint queue_stats_interval;
+
+void register_queue_stats(const gchar *name, GAsyncQueue *queue);
+void unregister_queue_stats(GAsyncQueue *queue);
+gpointer m_async_queue_pop(GAsyncQueue *queue);
+gpointer m_async_queue_timeout_pop(GAsyncQueue *queue, guint64 timeout);
+void queue_stats_producer_wait(GAsyncQueue *queue, gint64 usec);
+void append_queue_stats_metrics(GString *content, const gchar *prefix);
+void start_queue_stats();
+void stop_queue_stats();
+
+#endif
@@ -28,6 +28,11 @@ GList *re_list = NULL;
 static pcre2_code *filename_re = NULL;
 static pcre2_code *partition_re = NULL;
 GList *regex_list=NULL;
+// match data is reused per thread, sized for the pattern with more groups
+static guint32 regex_max_pairs=1;
+static __thread pcre2_match_data *thread_match_data=NULL;
+static __thread guint32 thread_match_data_pairs=0;
+static __thread GString *regex_subject=NULL;
 
 gboolean regex_arguments_callback(const gchar *option_name,const gchar *value, gpointer data, GError **error){
   *error=NULL;
@@ -53,13 +58,25 @@ GOptionGroup * load_regex_entries(GOptionContext *context){
   return filter_group;
 }
 
-gboolean check_filename_regex(char *word) {
-  /* This is not going to be used in threads */
-  if (filename_re){
-    pcre2_match_data *match_data = pcre2_match_data_create_from_pattern(filename_re, NULL);
-    int rc =pcre2_match(filename_re, (PCRE2_SPTR)word, strlen(word), 0, 0, match_data, NULL);
-    return (rc > 0) ? TRUE : FALSE;
+pcre2_match_data *get_thread_match_data(){
+  guint32 pairs=g_atomic_int_get(&regex_max_pairs);
+  if (thread_match_data_pairs < pairs){
+    if (thread_match_data)
+      pcre2_match_data_free(thread_match_data);
+    thread_match_data=pcre2_match_data_create(pairs, NULL);
+    thread_match_data_pairs=pairs;
   }
+  return thread_match_data;
+}
+
+static
+gboolean regex_match(pcre2_code *re, const gchar *subject, gsize length){
+  return pcre2_match(re, (PCRE2_SPTR)subject, length, 0, 0, get_thread_match_data(), NULL) >= 0;
+}
+
+gboolean check_filename_regex(char *word) {
+  if (filename_re)
+    return regex_match(filename_re, word, strlen(word));
   return TRUE;
 }
 
@@ -74,6 +91,13 @@ void init_regex(pcre2_code **r, const char *str){
       pcre2_get_error_message(error,buffer,1024);
       m_critical("Regular expression fail: %s (%d) %s", str, error, (gchar *)buffer);
     }
+    // without JIT support pcre2_match keeps using the interpreter
+    pcre2_jit_compile(*r, PCRE2_JIT_COMPLETE);
+    guint32 captures=0, pairs=0;
+    pcre2_pattern_info(*r, PCRE2_INFO_CAPTURECOUNT, &captures);
+    do {
+      pairs=g_atomic_int_get(&regex_max_pairs);
+    } while (captures + 1 > pairs && !g_atomic_int_compare_and_exchange((gint *)&regex_max_pairs, pairs, captures + 1));
   }
 }
 
@@ -94,20 +118,16 @@ void initialize_regex(gchar * partition_regex){
 
 /* Check database.table string against regular expression */
 gboolean check_regex(pcre2_code *tre, char *_database_name, char * _table_name) {
-  /* This is not going to be used in threads */
   if (tre){
     g_assert(_database_name);
-    char * p = NULL;
-    if (_table_name)
-      p = g_strdup_printf("%s.%s", _database_name, _table_name);
-    else
-      p = g_strdup_printf("%s", _database_name);
-    pcre2_match_data *match_data = pcre2_match_data_create_from_pattern(tre, NULL);
-    int rc = pcre2_match(tre, (PCRE2_SPTR)p, strlen(p), 0, 0, match_data, NULL);
-  
-    g_free(p);
-
-    return (rc > 0) ? TRUE : FALSE;
+    if (!regex_subject)
+      regex_subject=g_string_sized_new(128);
+    g_string_assign(regex_subject, _database_name);
+    if (_table_name){
+      g_string_append_c(regex_subject, '.');
+      g_string_append(regex_subject, _table_name);
+    }
+    return regex_match(tre, regex_subject->str, regex_subject->len);
   } return FALSE;
 }
 
@@ -125,11 +145,8 @@ gboolean eval_regex(char * _database_name,char * _table_name){
 }
 
 gboolean eval_pcre_regex(pcre2_code * re, char * word){
-  if (re){
-    pcre2_match_data *match_data = pcre2_match_data_create_from_pattern(re, NULL);
-    int rc = pcre2_match(re, (PCRE2_SPTR)word, strlen(word), 0, 0, match_data, NULL);
-    return (rc > 0) ? TRUE : FALSE;
-  }
+  if (re)
+    return regex_match(re, word, strlen(word));
   return TRUE;
 }
 
@@ -141,7 +158,7 @@ gboolean eval_partition_regex(char * word){
 }
 
 void free_regex(){
-  g_free(filename_re);
+  pcre2_code_free(filename_re);
   filename_re=NULL;
 }
 
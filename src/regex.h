@@ -22,6 +22,7 @@ GOptionGroup * load_regex_entries(GOptionContext *context);
 gboolean eval_partition_regex(char * word);
 void initialize_regex(gchar * partition_regex);
 void init_regex(pcre2_code **r, const char *str);
+pcre2_match_data *get_thread_match_data();
 gboolean eval_pcre_regex(pcre2_code * p, char * word);
 void free_regex();
 gboolean is_regex_being_used();
@@ -0,0 +1,143 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Authors:        David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#include <string.h>
+#include "row_binary.h"
+
+static
+void append_varint(GString *out, guint64 value){
+  while (value >= 0x80){
+    g_string_append_c(out, (gchar)((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+  g_string_append_c(out, (gchar)value);
+}
+
+// returns the bytes used or 0 if the buffer is too short
+static
+gsize read_varint(const gchar *buffer, gsize length, guint64 *value){
+  gsize i=0;
+  guint shift=0;
+  *value=0;
+  while (i < length && shift < 64){
+    guint8 b=buffer[i++];
+    *value|= (guint64)(b & 0x7F) << shift;
+    if (!(b & 0x80))
+      return i;
+    shift+=7;
+  }
+  return 0;
+}
+
+void row_binary_append_header(GString *out, MYSQL_FIELD *fields, guint num_fields){
+  guint i;
+  g_string_append(out, ROW_BINARY_MAGIC);
+  g_string_append_c(out, ROW_BINARY_VERSION);
+  append_varint(out, num_fields);
+  for (i = 0; i < num_fields; i++){
+    append_varint(out, fields[i].name_length);
+    g_string_append_len(out, fields[i].name, fields[i].name_length);
+    append_varint(out, fields[i].type);
+    append_varint(out, fields[i].flags);
+    append_varint(out, fields[i].charsetnr);
+  }
+}
+
+void row_binary_append_value(GString *out, const gchar *value, gulong length){
+  if (value == NULL){
+    g_string_append_c(out, 0);
+    return;
+  }
+  append_varint(out, (guint64)length + 1);
+  g_string_append_len(out, value, length);
+}
+
+/* The readers return 1 when the buffer has a complete header or row and 0
+   when more data is needed. -1 means that the file is not in this format */
+gint row_binary_read_header(const gchar *buffer, gsize length, struct row_binary_header **header, gsize *consumed){
+  gsize pos=strlen(ROW_BINARY_MAGIC) + 1, n;
+  guint64 v;
+  guint i;
+  if (length < pos)
+    return 0;
+  if (memcmp(buffer, ROW_BINARY_MAGIC, pos - 1) || buffer[pos - 1] != ROW_BINARY_VERSION)
+    return -1;
+  if (!(n=read_varint(buffer + pos, length - pos, &v)))
+    return 0;
+  pos+=n;
+  struct row_binary_header *h=g_new0(struct row_binary_header, 1);
+  h->num_columns=v;
+  h->columns=g_new0(struct row_binary_column, h->num_columns);
+  for (i = 0; i < h->num_columns; i++){
+    if (!(n=read_varint(buffer + pos, length - pos, &v)) || length - pos - n < v)
+      goto incomplete;
+    pos+=n;
+    h->columns[i].name=g_strndup(buffer + pos, v);
+    pos+=v;
+    if (!(n=read_varint(buffer + pos, length - pos, &v)))
+      goto incomplete;
+    pos+=n;
+    h->columns[i].type=v;
+    if (!(n=read_varint(buffer + pos, length - pos, &v)))
+      goto incomplete;
+    pos+=n;
+    h->columns[i].flags=v;
+    if (!(n=read_varint(buffer + pos, length - pos, &v)))
+      goto incomplete;
+    pos+=n;
+    h->columns[i].charsetnr=v;
+  }
+  *header=h;
+  *consumed=pos;
+  return 1;
+incomplete:
+  free_row_binary_header(h);
+  return 0;
+}
+
+// values point into buffer, they are valid as long as buffer is
+gint row_binary_read_row(const gchar *buffer, gsize length, guint num_columns, const gchar **values, gulong *lengths, gsize *consumed){
+  gsize pos=0, n;
+  guint64 v;
+  guint i;
+  for (i = 0; i < num_columns; i++){
+    if (!(n=read_varint(buffer + pos, length - pos, &v)))
+      return 0;
+    pos+=n;
+    if (v == 0){
+      values[i]=NULL;
+      lengths[i]=0;
+      continue;
+    }
+    v--;
+    if (length - pos < v)
+      return 0;
+    values[i]=buffer + pos;
+    lengths[i]=v;
+    pos+=v;
+  }
+  *consumed=pos;
+  return 1;
+}
+
+void free_row_binary_header(struct row_binary_header *header){
+  guint i;
+  for (i = 0; i < header->num_columns; i++)
+    g_free(header->columns[i].name);
+  g_free(header->columns);
+  g_free(header);
+}
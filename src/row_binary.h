@@ -0,0 +1,48 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Authors:        David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#ifndef _src_row_binary_h
+#define _src_row_binary_h
+
+#include <mysql.h>
+#include <glib.h>
+
+/* Native row format used between mydumper and myloader. After the header,
+   every value is a varint with length+1 (0 is NULL) followed by the bytes
+   as they were received from the server, nothing is escaped */
+#define ROW_BINARY_MAGIC "MYDB"
+#define ROW_BINARY_VERSION 1
+#define ROW_BINARY_EXTENSION "bin"
+
+struct row_binary_column {
+  gchar *name;
+  guint type;
+  guint flags;
+  guint charsetnr;
+};
+
+struct row_binary_header {
+  guint num_columns;
+  struct row_binary_column *columns;
+};
+
+void row_binary_append_header(GString *out, MYSQL_FIELD *fields, guint num_fields);
+void row_binary_append_value(GString *out, const gchar *value, gulong length);
+gint row_binary_read_header(const gchar *buffer, gsize length, struct row_binary_header **header, gsize *consumed);
+gint row_binary_read_row(const gchar *buffer, gsize length, guint num_columns, const gchar **values, gulong *lengths, gsize *consumed);
+void free_row_binary_header(struct row_binary_header *header);
+#endif
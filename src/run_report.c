@@ -0,0 +1,313 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Authors:        David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "config.h"
+#include "common.h"
+#include "span_trace.h"
+#include "run_report.h"
+
+gboolean run_report=FALSE;
+gchar *run_report_file=NULL;
+gboolean report_enabled=FALSE;
+
+static const gchar *report_phase_name[REPORT_PHASES]={"connect", "lock_wait", "lock_hold", "catalog", "schema", "data", "indexes", "constraints", "post", "checksums"};
+
+struct report_phase_stats {
+  gint64 first_start;
+  gint64 last_end;
+  gint64 busy;
+  gint64 cpu;
+  guint64 jobs;
+  guint64 bytes;
+};
+
+struct report_table {
+  gchar *database;
+  gchar *table;
+  gint64 busy;
+  guint64 bytes;
+  guint64 jobs;
+};
+
+struct report_job {
+  enum report_phase phase;
+  gchar *database;
+  gchar *table;
+  gint64 part;
+  gint64 duration;
+  guint64 bytes;
+};
+
+static GMutex *report_mutex=NULL;
+static const gchar *report_program=NULL;
+static gint64 report_origin=0;
+static struct report_phase_stats phases[REPORT_PHASES];
+// database.table -> report_table, the work of each table over all the phases
+static GHashTable *report_tables=NULL;
+// the slowest jobs, sorted from the slowest
+static struct report_job slowest_jobs[REPORT_TOP];
+static guint num_slowest_jobs=0;
+static gint64 group_cpu[AFFINITY_GROUPS];
+static guint group_threads[AFFINITY_GROUPS];
+static GPrivate *thread_group=NULL;
+
+static
+void free_report_table(gpointer data){
+  struct report_table *rt=data;
+  g_free(rt->database);
+  g_free(rt->table);
+  g_free(rt);
+}
+
+static
+gint64 thread_cpu_usec(){
+#ifdef RUSAGE_THREAD
+  struct rusage usage;
+  if (getrusage(RUSAGE_THREAD, &usage))
+    return 0;
+  return (gint64)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * G_USEC_PER_SEC + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+#else
+  return 0;
+#endif
+}
+
+// Runs on the thread that ends, so RUSAGE_THREAD is its own usage
+static
+void thread_group_end(gpointer data){
+  guint group=GPOINTER_TO_UINT(data) - 1;
+  gint64 cpu=thread_cpu_usec();
+  g_mutex_lock(report_mutex);
+  group_cpu[group]+=cpu;
+  group_threads[group]++;
+  g_mutex_unlock(report_mutex);
+}
+
+void initialize_run_report(const gchar *program){
+  if (!run_report && !run_report_file)
+    return;
+  report_mutex=g_mutex_new();
+  report_tables=g_hash_table_new_full(g_str_hash, g_str_equal, g_free, free_report_table);
+  thread_group=g_private_new(thread_group_end);
+  report_program=program;
+  report_origin=g_get_monotonic_time();
+  memset(phases, 0, sizeof(phases));
+  report_enabled=TRUE;
+}
+
+void report_start(struct report_mark *mark){
+  if (!report_enabled)
+    return;
+  mark->wall=g_get_monotonic_time();
+  mark->cpu=thread_cpu_usec();
+}
+
+// must be called with report_mutex locked
+static
+void add_phase(enum report_phase phase, struct report_mark *mark, gint64 now, gint64 cpu, guint64 bytes){
+  struct report_phase_stats *ps=&(phases[phase]);
+  if (ps->jobs == 0 || mark->wall < ps->first_start)
+    ps->first_start=mark->wall;
+  if (now > ps->last_end)
+    ps->last_end=now;
+  ps->busy+=now - mark->wall;
+  ps->cpu+=cpu - mark->cpu;
+  ps->jobs++;
+  ps->bytes+=bytes;
+}
+
+void report_end(enum report_phase phase, struct report_mark *mark, guint64 bytes){
+  if (!report_enabled)
+    return;
+  gint64 now=g_get_monotonic_time(), cpu=thread_cpu_usec();
+  g_mutex_lock(report_mutex);
+  add_phase(phase, mark, now, cpu, bytes);
+  g_mutex_unlock(report_mutex);
+}
+
+static
+void add_slowest_job(enum report_phase phase, const gchar *database, const gchar *table, gint64 part, gint64 duration, guint64 bytes){
+  guint i;
+  if (num_slowest_jobs == REPORT_TOP){
+    if (duration <= slowest_jobs[REPORT_TOP - 1].duration)
+      return;
+    g_free(slowest_jobs[REPORT_TOP - 1].database);
+    g_free(slowest_jobs[REPORT_TOP - 1].table);
+    num_slowest_jobs--;
+  }
+  for (i=num_slowest_jobs; i > 0 && slowest_jobs[i - 1].duration < duration; i--)
+    slowest_jobs[i]=slowest_jobs[i - 1];
+  slowest_jobs[i].phase=phase;
+  slowest_jobs[i].database=g_strdup(database);
+  slowest_jobs[i].table=g_strdup(table);
+  slowest_jobs[i].part=part;
+  slowest_jobs[i].duration=duration;
+  slowest_jobs[i].bytes=bytes;
+  num_slowest_jobs++;
+}
+
+// A job on a table: a chunk, a data file or the indexes of the table
+void report_chunk(enum report_phase phase, struct report_mark *mark, const gchar *database, const gchar *table, gint64 part, guint64 bytes){
+  if (!report_enabled)
+    return;
+  gint64 now=g_get_monotonic_time(), cpu=thread_cpu_usec();
+  gchar *key=g_strdup_printf("%s.%s", database, table);
+  g_mutex_lock(report_mutex);
+  add_phase(phase, mark, now, cpu, bytes);
+  struct report_table *rt=g_hash_table_lookup(report_tables, key);
+  if (rt == NULL){
+    rt=g_new0(struct report_table, 1);
+    rt->database=g_strdup(database);
+    rt->table=g_strdup(table);
+    g_hash_table_insert(report_tables, key, rt);
+  }else
+    g_free(key);
+  rt->busy+=now - mark->wall;
+  rt->bytes+=bytes;
+  rt->jobs++;
+  add_slowest_job(phase, database, table, part, now - mark->wall, bytes);
+  g_mutex_unlock(report_mutex);
+}
+
+void report_thread_start(enum affinity_group group){
+  if (!report_enabled)
+    return;
+  g_private_set(thread_group, GUINT_TO_POINTER(group + 1));
+}
+
+static
+gint compare_report_tables(gconstpointer a, gconstpointer b){
+  gint64 x=((const struct report_table *)a)->busy, y=((const struct report_table *)b)->busy;
+  return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static
+gdouble seconds(gint64 usec){
+  return (gdouble)usec / G_USEC_PER_SEC;
+}
+
+static
+gdouble phase_wall(struct report_phase_stats *ps){
+  return seconds(ps->last_end - ps->first_start);
+}
+
+static
+gdouble phase_rate(struct report_phase_stats *ps){
+  return ps->last_end > ps->first_start ? ps->bytes / phase_wall(ps) : 0;
+}
+
+static
+void message_run_report(gint64 wall, gint64 cpu, gint64 main_cpu, GList *sorted_tables){
+  guint p, g, i;
+  GList *l;
+  g_message("Run report of %s: %.3fs wall, %.3fs CPU", report_program, seconds(wall), seconds(cpu));
+  g_message("Phase       |       Wall |       Busy |        CPU |     Jobs |       MB/s");
+  for (p=0; p < REPORT_PHASES; p++)
+    if (phases[p].jobs > 0)
+      g_message("%-11s | %9.3fs | %9.3fs | %9.3fs | %8"G_GUINT64_FORMAT" | %10.1f", report_phase_name[p],
+          phase_wall(&phases[p]), seconds(phases[p].busy), seconds(phases[p].cpu), phases[p].jobs, phase_rate(&phases[p]) / 1024 / 1024);
+  g_message("Threads main: %.3fs CPU", seconds(main_cpu));
+  for (g=0; g < AFFINITY_GROUPS; g++)
+    if (group_threads[g] > 0)
+      g_message("Threads %s: %u threads, %.3fs CPU", affinity_group_name[g], group_threads[g], seconds(group_cpu[g]));
+  for (i=0, l=sorted_tables; l && i < REPORT_TOP; l=l->next, i++){
+    struct report_table *rt=l->data;
+    g_message("Slowest table %u: %s.%s, %.3fs in %"G_GUINT64_FORMAT" jobs, %"G_GUINT64_FORMAT" bytes", i + 1, rt->database, rt->table, seconds(rt->busy), rt->jobs, rt->bytes);
+  }
+  for (i=0; i < num_slowest_jobs; i++)
+    g_message("Slowest job %u: %s of %s.%s part %"G_GINT64_FORMAT", %.3fs, %"G_GUINT64_FORMAT" bytes", i + 1, report_phase_name[slowest_jobs[i].phase],
+        slowest_jobs[i].database, slowest_jobs[i].table, slowest_jobs[i].part, seconds(slowest_jobs[i].duration), slowest_jobs[i].bytes);
+}
+
+static
+void write_run_report(gint64 wall, gint64 cpu, gint64 main_cpu, GList *sorted_tables){
+  guint p, g, i;
+  GList *l;
+  gboolean comma=FALSE;
+  GString *json=g_string_sized_new(4096);
+  g_string_append_printf(json, "{\n\"program\":\"%s\",\n\"version\":\"%s\",\n\"wall_seconds\":%.6f,\n\"cpu_seconds\":%.6f,\n\"phases\":[",
+      report_program, VERSION, seconds(wall), seconds(cpu));
+  for (p=0; p < REPORT_PHASES; p++){
+    if (phases[p].jobs == 0)
+      continue;
+    g_string_append_printf(json, "%s\n{\"name\":\"%s\",\"wall_seconds\":%.6f,\"busy_seconds\":%.6f,\"cpu_seconds\":%.6f,\"jobs\":%"G_GUINT64_FORMAT",\"bytes\":%"G_GUINT64_FORMAT",\"bytes_per_second\":%.1f}",
+        comma ? "," : "", report_phase_name[p], phase_wall(&phases[p]), seconds(phases[p].busy), seconds(phases[p].cpu), phases[p].jobs, phases[p].bytes, phase_rate(&phases[p]));
+    comma=TRUE;
+  }
+  g_string_append_printf(json, "\n],\n\"thread_groups\":[\n{\"name\":\"main\",\"threads\":1,\"cpu_seconds\":%.6f}", seconds(main_cpu));
+  for (g=0; g < AFFINITY_GROUPS; g++)
+    if (group_threads[g] > 0)
+      g_string_append_printf(json, ",\n{\"name\":\"%s\",\"threads\":%u,\"cpu_seconds\":%.6f}", affinity_group_name[g], group_threads[g], seconds(group_cpu[g]));
+  g_string_append(json, "\n],\n\"slowest_tables\":[");
+  for (i=0, l=sorted_tables; l && i < REPORT_TOP; l=l->next, i++){
+    struct report_table *rt=l->data;
+    g_string_append(json, i ? ",\n{\"database\":" : "\n{\"database\":");
+    append_json_string(json, rt->database);
+    g_string_append(json, ",\"table\":");
+    append_json_string(json, rt->table);
+    g_string_append_printf(json, ",\"busy_seconds\":%.6f,\"jobs\":%"G_GUINT64_FORMAT",\"bytes\":%"G_GUINT64_FORMAT"}", seconds(rt->busy), rt->jobs, rt->bytes);
+  }
+  g_string_append(json, "\n],\n\"slowest_jobs\":[");
+  for (i=0; i < num_slowest_jobs; i++){
+    g_string_append_printf(json, "%s\n{\"phase\":\"%s\",\"database\":", i ? "," : "", report_phase_name[slowest_jobs[i].phase]);
+    append_json_string(json, slowest_jobs[i].database);
+    g_string_append(json, ",\"table\":");
+    append_json_string(json, slowest_jobs[i].table);
+    g_string_append_printf(json, ",\"part\":%"G_GINT64_FORMAT",\"seconds\":%.6f,\"bytes\":%"G_GUINT64_FORMAT"}",
+        slowest_jobs[i].part, seconds(slowest_jobs[i].duration), slowest_jobs[i].bytes);
+  }
+  g_string_append(json, "\n]\n}\n");
+  GError *error=NULL;
+  if (!g_file_set_contents(run_report_file, json->str, json->len, &error)){
+    g_warning("Could not write the report to %s: %s", run_report_file, error->message);
+    g_error_free(error);
+  }else
+    g_message("Report written to %s", run_report_file);
+  g_string_free(json, TRUE);
+}
+
+// Called by the main thread once the other threads have ended
+void finish_run_report(){
+  if (!report_enabled)
+    return;
+  guint i;
+  struct rusage usage;
+  gint64 cpu=0;
+  if (!getrusage(RUSAGE_SELF, &usage))
+    cpu=(gint64)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * G_USEC_PER_SEC + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+  gint64 wall=g_get_monotonic_time() - report_origin, main_cpu=thread_cpu_usec();
+  g_mutex_lock(report_mutex);
+  report_enabled=FALSE;
+  GList *sorted_tables=g_list_sort(g_hash_table_get_values(report_tables), compare_report_tables);
+  if (run_report)
+    message_run_report(wall, cpu, main_cpu, sorted_tables);
+  if (run_report_file)
+    write_run_report(wall, cpu, main_cpu, sorted_tables);
+  g_list_free(sorted_tables);
+  for (i=0; i < num_slowest_jobs; i++){
+    g_free(slowest_jobs[i].database);
+    g_free(slowest_jobs[i].table);
+  }
+  num_slowest_jobs=0;
+  g_mutex_unlock(report_mutex);
+}
@@ -0,0 +1,62 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Authors:        David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#ifndef _src_run_report_h
+#define _src_run_report_h
+
+#include <glib.h>
+#include "cpu_affinity.h"
+
+/* --report logs a summary of the run when it ends and --report-file writes
+   it as JSON, to compare runs over time. Every phase adds the time between
+   report_start() and report_end() of each job: the wall time goes from the
+   first start to the last end, the busy time and the CPU time of the thread
+   are added over all the jobs. The CPU of each thread group is taken when its
+   threads end */
+#define REPORT_TOP 10
+
+enum report_phase {
+  REPORT_CONNECT,
+  REPORT_LOCK_WAIT,
+  REPORT_LOCK_HOLD,
+  REPORT_CATALOG,
+  REPORT_SCHEMA,
+  REPORT_DATA,
+  REPORT_INDEXES,
+  REPORT_CONSTRAINTS,
+  REPORT_POST,
+  REPORT_CHECKSUMS,
+  REPORT_PHASES
+};
+
+struct report_mark {
+  gint64 wall;
+  gint64 cpu;
+};
+
+extern gboolean run_report;
+extern gchar *run_report_file;
+extern gboolean report_enabled;
+
+void initialize_run_report(const gchar *program);
+void report_start(struct report_mark *mark);
+void report_end(enum report_phase phase, struct report_mark *mark, guint64 bytes);
+void report_chunk(enum report_phase phase, struct report_mark *mark, const gchar *database, const gchar *table, gint64 part, guint64 bytes);
+void report_thread_start(enum affinity_group group);
+void finish_run_report();
+
+#endif
@@ -65,14 +65,18 @@ void set_verbose(guint verbosity) {
   }
 
   free_log_handlers();
+  if (logfile)
+    start_async_log();
 
   switch (verbosity) {
   case 0:
+    log_dropped_levels = G_LOG_LEVEL_MASK;
     log_handlers[use_no_log] = g_log_set_handler(
         NULL, (GLogLevelFlags)(G_LOG_LEVEL_MASK),
         no_log, NULL);
     break;
   case 1:
+    log_dropped_levels = G_LOG_LEVEL_WARNING | G_LOG_LEVEL_MESSAGE;
     log_handlers[use_no_log] = g_log_set_handler(
         NULL, (GLogLevelFlags)(G_LOG_LEVEL_WARNING | G_LOG_LEVEL_MESSAGE),
         no_log, NULL);
@@ -82,6 +86,7 @@ void set_verbose(guint verbosity) {
           write_log_file, NULL);
     break;
   case 2:
+    log_dropped_levels = G_LOG_LEVEL_MESSAGE;
     log_handlers[use_no_log] = g_log_set_handler(
         NULL, (GLogLevelFlags)(G_LOG_LEVEL_MESSAGE),
         no_log, NULL);
@@ -93,6 +98,7 @@ void set_verbose(guint verbosity) {
           write_log_file, NULL);
     break;
   default:
+    log_dropped_levels = 0;
     if (logfile)
       log_handlers[use_write_log_file] = g_log_set_handler(
           NULL, (GLogLevelFlags)(G_LOG_LEVEL_MASK),
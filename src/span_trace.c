@@ -0,0 +1,163 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Authors:        David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+
+#include "common.h"
+#include "span_trace.h"
+
+// each thread fills its own buffer, it is written when it gets bigger than this
+#define SPAN_BUFFER_SIZE 65536
+
+gchar *trace_file=NULL;
+gboolean spans_enabled=FALSE;
+
+struct span_buffer {
+  GString *events;
+  gint tid;
+};
+
+static FILE *span_file=NULL;
+static GMutex *span_mutex=NULL;
+static GList *span_buffers=NULL;
+static gint64 span_origin=0;
+static gint span_last_tid=0;
+static int span_pid=0;
+static const gchar *span_program=NULL;
+static __thread struct span_buffer *thread_span_buffer=NULL;
+
+void append_json_string(GString *events, const gchar *value){
+  g_string_append_c(events, '"');
+  for (; *value; value++){
+    switch (*value){
+      case '"':
+      case '\\':
+        g_string_append_c(events, '\\');
+        g_string_append_c(events, *value);
+        break;
+      case '\n':
+        g_string_append(events, "\\n");
+        break;
+      case '\t':
+        g_string_append(events, "\\t");
+        break;
+      default:
+        if ((guchar)*value < 0x20)
+          g_string_append_printf(events, "\\u%04x", (guchar)*value);
+        else
+          g_string_append_c(events, *value);
+    }
+  }
+  g_string_append_c(events, '"');
+}
+
+// must be called with span_mutex locked
+static
+void flush_span_buffer(struct span_buffer *sb){
+  if (sb->events->len == 0 || span_file == NULL)
+    return;
+  if (fwrite(sb->events->str, 1, sb->events->len, span_file) != sb->events->len)
+    g_warning("Could not write spans to %s: %s", trace_file, strerror(errno));
+  g_string_set_size(sb->events, 0);
+}
+
+static
+struct span_buffer *get_span_buffer(){
+  if (thread_span_buffer)
+    return thread_span_buffer;
+  struct span_buffer *sb=g_new0(struct span_buffer, 1);
+  sb->events=g_string_sized_new(SPAN_BUFFER_SIZE + 1024);
+  sb->tid=g_atomic_int_add(&span_last_tid, 1) + 1;
+  const gchar *name=get_thread_name();
+  g_string_append_printf(sb->events, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":", span_pid, sb->tid);
+  if (name)
+    append_json_string(sb->events, name);
+  else
+    g_string_append_printf(sb->events, "\"%s-%d\"", span_program, sb->tid);
+  g_string_append(sb->events, "}},\n");
+  g_mutex_lock(span_mutex);
+  span_buffers=g_list_prepend(span_buffers, sb);
+  g_mutex_unlock(span_mutex);
+  thread_span_buffer=sb;
+  return sb;
+}
+
+void span_end_full(const gchar *name, gint64 start, const gchar *database, const gchar *table, gint64 part, const gchar *detail){
+  gint64 now=g_get_monotonic_time();
+  struct span_buffer *sb=get_span_buffer();
+  GString *events=sb->events;
+  g_string_append_printf(events, "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%"G_GINT64_FORMAT",\"dur\":%"G_GINT64_FORMAT",\"pid\":%d,\"tid\":%d,\"args\":{",
+      name, start - span_origin, now - start, span_pid, sb->tid);
+  gboolean comma=FALSE;
+  if (database){
+    g_string_append(events, "\"database\":");
+    append_json_string(events, database);
+    comma=TRUE;
+  }
+  if (table){
+    g_string_append(events, comma ? ",\"table\":" : "\"table\":");
+    append_json_string(events, table);
+    comma=TRUE;
+  }
+  if (part >= 0){
+    g_string_append_printf(events, "%s\"part\":%"G_GINT64_FORMAT, comma ? "," : "", part);
+    comma=TRUE;
+  }
+  if (detail){
+    g_string_append(events, comma ? ",\"detail\":" : "\"detail\":");
+    append_json_string(events, detail);
+  }
+  g_string_append(events, "}},\n");
+  if (events->len > SPAN_BUFFER_SIZE){
+    g_mutex_lock(span_mutex);
+    flush_span_buffer(sb);
+    g_mutex_unlock(span_mutex);
+  }
+}
+
+void initialize_spans(const gchar *program){
+  if (!trace_file)
+    return;
+  span_file=g_fopen(trace_file, "w");
+  if (!span_file)
+    m_critical("Could not open trace file %s: %s", trace_file, strerror(errno));
+  span_mutex=g_mutex_new();
+  span_origin=g_get_monotonic_time();
+  span_pid=getpid();
+  span_program=program;
+  fprintf(span_file, "[\n");
+  spans_enabled=TRUE;
+  g_message("Writing spans to %s", trace_file);
+}
+
+void finish_spans(){
+  if (!spans_enabled)
+    return;
+  spans_enabled=FALSE;
+  g_mutex_lock(span_mutex);
+  for (GList *l=span_buffers; l; l=l->next)
+    flush_span_buffer(l->data);
+  // the process name closes the array, so the file is valid JSON
+  fprintf(span_file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"%s\"}}\n]\n", span_pid, span_program);
+  fclose(span_file);
+  span_file=NULL;
+  g_mutex_unlock(span_mutex);
+}
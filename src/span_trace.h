@@ -0,0 +1,38 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Authors:        David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#ifndef _src_span_trace_h
+#define _src_span_trace_h
+
+#include <glib.h>
+
+/* Spans written with --trace-file in the Chrome trace event format, which
+   Perfetto and chrome://tracing open. When it is not used, span_start() and
+   span_end() are only a test of spans_enabled */
+extern gchar *trace_file;
+extern gboolean spans_enabled;
+
+void initialize_spans(const gchar *program);
+void finish_spans();
+void append_json_string(GString *events, const gchar *value);
+void span_end_full(const gchar *name, gint64 start, const gchar *database, const gchar *table, gint64 part, const gchar *detail);
+
+#define span_start() (spans_enabled ? g_get_monotonic_time() : 0)
+#define span_end(name, start, database, table, part, detail) \
+  do { if (spans_enabled) span_end_full(name, start, database, table, part, detail); } while (0)
+
+#endif
@@ -15,18 +15,21 @@
 #include <glib.h>
 #include <string.h>
 
-GSequence *tables_skiplist = NULL;
-GMutex *tables_skiplist_mutex = NULL;
+/* The entries are loaded before any thread uses them and never change after
+ * that, so the lookups do not need a lock. Entries ending with '*' are kept
+ * apart as prefixes, indexed by their length */
+static GHashTable *tables_skiplist = NULL;
+static GHashTable *tables_skiplist_prefixes = NULL;
+static GArray *tables_skiplist_prefix_lengths = NULL;
+static __thread GString *tables_skiplist_key = NULL;
 
-/* Comparison function for skiplist sort and lookup */
-
-int tables_skiplist_cmp(gconstpointer a, gconstpointer b, gpointer user_data) {
-  /* Not using user_data, but needed for function prototype, shutting up
-   * compiler warnings about unused variable */
-  (void)user_data;
-  /* Any sorting function would work, as long as its usage is consistent
-   * between sort and lookup.  strcmp should be one of the fastest. */
-  return strcmp(a, b);
+static
+void add_prefix_length(guint len){
+  guint i=0;
+  for (i=0; i < tables_skiplist_prefix_lengths->len; i++)
+    if (g_array_index(tables_skiplist_prefix_lengths, guint, i) == len)
+      return;
+  g_array_append_val(tables_skiplist_prefix_lengths, len);
 }
 
 /* Read the list of tables to skip from the given filename, and prepares them
@@ -37,10 +40,12 @@ void read_tables_skiplist(const gchar *filename, guint *errors) {
   GIOChannel *tables_skiplist_channel = NULL;
   gchar *buf = NULL;
   GError *error = NULL;
+  gsize len = 0;
   /* Create skiplist if it does not exist */
   if (!tables_skiplist) {
-    tables_skiplist = g_sequence_new(NULL);
-    tables_skiplist_mutex = g_mutex_new();
+    tables_skiplist = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    tables_skiplist_prefixes = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    tables_skiplist_prefix_lengths = g_array_new(FALSE, FALSE, sizeof(guint));
   };
   tables_skiplist_channel = g_io_channel_new_file(filename, "r", &error);
 
@@ -51,38 +56,59 @@ void read_tables_skiplist(const gchar *filename, guint *errors) {
     return;
   };
 
-  /* Read lines, push them to the list */
+  /* Read lines, push them to the sets */
   do {
     g_io_channel_read_line(tables_skiplist_channel, &buf, NULL, NULL, NULL);
     if (buf) {
       g_strchomp(buf);
-      g_sequence_append(tables_skiplist, buf);
+      len = strlen(buf);
+      if (len == 0){
+        g_free(buf);
+      }else if (buf[len - 1] == '*'){
+        buf[len - 1] = '\0';
+        add_prefix_length(len - 1);
+        g_hash_table_add(tables_skiplist_prefixes, buf);
+      }else
+        g_hash_table_add(tables_skiplist, buf);
     };
   } while (buf);
   g_io_channel_shutdown(tables_skiplist_channel, FALSE, NULL);
-  /* Sort the list, so that lookups work */
-  g_sequence_sort(tables_skiplist, tables_skiplist_cmp, NULL);
-  g_message("Omit list file contains %d tables to skip\n",
-            g_sequence_get_length(tables_skiplist));
+  g_message("Omit list file contains %u tables and %u prefixes to skip\n",
+            g_hash_table_size(tables_skiplist), g_hash_table_size(tables_skiplist_prefixes));
   return;
 }
 
+static
+gboolean check_skiplist_key(GString *key){
+  guint i=0, len=0;
+  gchar c;
+  gboolean b=FALSE;
+  if (g_hash_table_contains(tables_skiplist, key->str))
+    return TRUE;
+  /* The key is cut at every prefix length, instead of building new strings */
+  for (i=0; i < tables_skiplist_prefix_lengths->len && !b; i++){
+    len=g_array_index(tables_skiplist_prefix_lengths, guint, i);
+    if (len > key->len)
+      continue;
+    c=key->str[len];
+    key->str[len]='\0';
+    b=g_hash_table_contains(tables_skiplist_prefixes, key->str);
+    key->str[len]=c;
+  }
+  return b;
+}
+
 /* Check database.table string against skip list; returns TRUE if found */
 
 gboolean check_skiplist(char *database, char *table) {
-  g_mutex_lock(tables_skiplist_mutex);
-  gboolean b = g_sequence_lookup(tables_skiplist,
-                        database,
-                        tables_skiplist_cmp, NULL) != NULL;
-  if (!table || b){
-    g_mutex_unlock(tables_skiplist_mutex);
-    return b;
-  }
-  gchar * k=g_strdup_printf("%s.%s", database, table);
-  b = g_sequence_lookup(tables_skiplist,
-                        k,
-                        tables_skiplist_cmp, NULL) != NULL;
-  g_mutex_unlock(tables_skiplist_mutex);
-  g_free(k);
-  return b;
+  if (!tables_skiplist_key)
+    tables_skiplist_key=g_string_sized_new(128);
+  g_string_assign(tables_skiplist_key, database);
+  if (check_skiplist_key(tables_skiplist_key))
+    return TRUE;
+  if (!table)
+    return FALSE;
+  g_string_append_c(tables_skiplist_key, '.');
+  g_string_append(tables_skiplist_key, table);
+  return check_skiplist_key(tables_skiplist_key);
 }
@@ -0,0 +1,335 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Authors:        David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <mysql.h>
+
+#include "common.h"
+#include "connection.h"
+#include "throttle_control.h"
+
+gchar *throttle_control=NULL;
+gboolean auto_threads=FALSE;
+
+enum throttle_signal {
+  THROTTLE_THREADS_RUNNING,
+  THROTTLE_REPLICA_LAG,
+  THROTTLE_HISTORY_LENGTH,
+  THROTTLE_SIGNALS
+};
+
+static const gchar *throttle_signal_name[THROTTLE_SIGNALS]={"threads_running", "replica_lag", "history_length"};
+
+#define THROTTLE_CONTROL_INTERVAL 2
+// below this share of every limit the concurrency grows again
+#define THROTTLE_CONTROL_LOW_WATERMARK 0.8
+// --auto-threads: intervals measured per step, and the gain that a step
+// must give to keep growing
+#define AUTO_THREADS_SAMPLES 2
+#define AUTO_THREADS_MIN_GAIN 1.05
+#define AUTO_THREADS_START 2
+
+static guint64 throttle_limit[THROTTLE_SIGNALS];
+static GMutex *throttle_mutex=NULL;
+static GCond *throttle_cond=NULL;
+static guint throttle_max_threads=0;
+static guint throttle_active_limit=0;
+static guint throttle_active=0;
+static gboolean throttle_enabled=FALSE;
+static GThread *throttle_thread=NULL;
+static gint throttle_shutdown=FALSE;
+
+// rows or bytes done by the jobs, the throughput that --auto-threads follows
+static guint64 auto_threads_work=0;
+// the limit found by --auto-threads, 0 while it is ramping up
+static guint auto_threads_converged=0;
+static guint auto_threads_start=AUTO_THREADS_START;
+// the step of --auto-threads being measured
+static gdouble auto_threads_previous_rate=0;
+static guint auto_threads_previous_limit=0;
+static gdouble auto_threads_rate_sum=0;
+static guint auto_threads_samples=0;
+
+/* Without the gate, --throttle sleeps before the statement as it used to.
+   Both are not stacked, the sleep would fight the limit */
+void throttle_control_acquire(){
+  if (!throttle_enabled){
+    if (throttle_time)
+      g_usleep(throttle_time);
+    return;
+  }
+  g_mutex_lock(throttle_mutex);
+  while (throttle_active >= throttle_active_limit)
+    g_cond_wait(throttle_cond, throttle_mutex);
+  throttle_active++;
+  g_mutex_unlock(throttle_mutex);
+}
+
+// For the statements that are only worth sending when there is room
+gboolean throttle_control_try_acquire(){
+  if (!throttle_enabled)
+    return TRUE;
+  gboolean r=FALSE;
+  g_mutex_lock(throttle_mutex);
+  if (throttle_active < throttle_active_limit){
+    throttle_active++;
+    r=TRUE;
+  }
+  g_mutex_unlock(throttle_mutex);
+  return r;
+}
+
+void throttle_control_release(){
+  if (!throttle_enabled)
+    return;
+  g_mutex_lock(throttle_mutex);
+  // a statement taken before the previous finalize_throttle_control()
+  if (throttle_active > 0)
+    throttle_active--;
+  g_cond_signal(throttle_cond);
+  g_mutex_unlock(throttle_mutex);
+}
+
+void throttle_control_add_work(guint64 units){
+  if (auto_threads)
+    __sync_fetch_and_add(&auto_threads_work, units);
+}
+
+// The first value found by a previous run, like the one of the dump
+void throttle_control_start_from(guint threads){
+  if (!auto_threads || threads == 0)
+    return;
+  if (!throttle_enabled){
+    auto_threads_start=threads;
+    return;
+  }
+  g_mutex_lock(throttle_mutex);
+  if (auto_threads_converged == 0){
+    throttle_active_limit= threads < throttle_max_threads ? threads : throttle_max_threads;
+    g_message("Auto threads: starting from %u active threads", throttle_active_limit);
+    g_cond_broadcast(throttle_cond);
+  }
+  g_mutex_unlock(throttle_mutex);
+}
+
+guint throttle_control_threads(){
+  if (!auto_threads || !throttle_enabled)
+    return 0;
+  g_mutex_lock(throttle_mutex);
+  guint threads= auto_threads_converged > 0 ? auto_threads_converged : throttle_active_limit;
+  g_mutex_unlock(throttle_mutex);
+  return threads;
+}
+
+static
+gboolean get_status_value(MYSQL *conn, const gchar *query, guint64 *value){
+  struct M_ROW *mr=m_store_result_single_row(conn, query, "Throttle control could not execute: %s", query);
+  gboolean r= mr->res && mr->row && mr->row[1];
+  if (r)
+    *value=g_ascii_strtoull(mr->row[1], NULL, 10);
+  m_store_result_row_free(mr);
+  return r;
+}
+
+// NULL Seconds_Behind_Source means that the replica is not running, it is
+// not considered as lag
+static
+gboolean get_replica_lag(MYSQL *conn, guint64 *value){
+  if (show_replica_status == NULL)
+    return FALSE;
+  MYSQL_RES *res=m_store_result(conn, show_replica_status, m_warning, "Throttle control could not execute: %s", show_replica_status);
+  if (!res)
+    return FALSE;
+  MYSQL_ROW row=mysql_fetch_row(res);
+  MYSQL_FIELD *fields=mysql_fetch_fields(res);
+  guint i;
+  gboolean r=FALSE;
+  for (i=0; row && i < mysql_num_fields(res); i++){
+    if (!g_ascii_strcasecmp(fields[i].name, "Seconds_Behind_Source") || !g_ascii_strcasecmp(fields[i].name, "Seconds_Behind_Master")){
+      if (row[i]){
+        *value=g_ascii_strtoull(row[i], NULL, 10);
+        r=TRUE;
+      }
+      break;
+    }
+  }
+  mysql_free_result(res);
+  return r;
+}
+
+static
+gboolean get_signal(MYSQL *conn, enum throttle_signal signal, guint64 *value){
+  switch (signal){
+    case THROTTLE_THREADS_RUNNING:
+      return get_status_value(conn, "SHOW GLOBAL STATUS LIKE 'Threads_running'", value);
+    case THROTTLE_REPLICA_LAG:
+      return get_replica_lag(conn, value);
+    case THROTTLE_HISTORY_LENGTH:
+      return get_status_value(conn, "SELECT NAME, COUNT FROM information_schema.INNODB_METRICS WHERE NAME='trx_rseg_history_len'", value);
+    default:
+      return FALSE;
+  }
+}
+
+/* Ramps up the limit while the throughput improves. A step is measured
+   over AUTO_THREADS_SAMPLES intervals, when it does not give
+   AUTO_THREADS_MIN_GAIN over the previous one, the previous limit is kept.
+   Intervals where the threads did not have enough jobs to reach the limit
+   are not measured */
+static
+void auto_threads_step(gdouble rate, guint active_peak){
+  if (auto_threads_converged > 0 || active_peak < throttle_active_limit)
+    return;
+  auto_threads_rate_sum+=rate;
+  if (++auto_threads_samples < AUTO_THREADS_SAMPLES)
+    return;
+  rate=auto_threads_rate_sum / auto_threads_samples;
+  auto_threads_rate_sum=0;
+  auto_threads_samples=0;
+  if (auto_threads_previous_limit > 0 && rate < auto_threads_previous_rate * AUTO_THREADS_MIN_GAIN){
+    auto_threads_converged=auto_threads_previous_limit;
+    g_message("Auto threads: converged at %u active threads, %u did not improve the throughput", auto_threads_previous_limit, throttle_active_limit);
+    throttle_active_limit=auto_threads_previous_limit;
+    return;
+  }
+  if (throttle_active_limit >= throttle_max_threads){
+    auto_threads_converged=throttle_max_threads;
+    g_message("Auto threads: reached the maximum of %u active threads, use --threads to allow more", throttle_max_threads);
+    return;
+  }
+  auto_threads_previous_rate=rate;
+  auto_threads_previous_limit=throttle_active_limit;
+  throttle_active_limit+= throttle_active_limit / 4 > 1 ? throttle_active_limit / 4 : 1;
+  if (throttle_active_limit > throttle_max_threads)
+    throttle_active_limit=throttle_max_threads;
+  trace("Auto threads: %.0f per second with %u threads, trying %u", rate, auto_threads_previous_limit, throttle_active_limit);
+}
+
+/* Multiplicative decrease when a signal is over its limit, additive
+   increase when all of them are well below. With --auto-threads the
+   increase stops at the converged limit, and a signal over its limit
+   means that the server is saturated, which ends the ramp up. It sleeps by
+   seconds, so finalize_throttle_control() does not wait the interval */
+static
+void *throttle_control_thread(void *data){
+  (void) data;
+  MYSQL *conn=NULL;
+  guint s, limit, max_limit, active_peak, seconds;
+  guint64 value, work, last_work=0;
+  gint64 now, last_time=g_get_monotonic_time();
+  gdouble pressure, worst;
+  enum throttle_signal worst_signal=THROTTLE_THREADS_RUNNING;
+  if (throttle_control){
+    conn=mysql_init(NULL);
+    m_connect(conn);
+  }
+  while (!g_atomic_int_get(&throttle_shutdown)){
+    worst=0;
+    for (s=0; conn && s < THROTTLE_SIGNALS; s++){
+      if (throttle_limit[s] == 0 || !get_signal(conn, s, &value))
+        continue;
+      pressure=(gdouble)value / throttle_limit[s];
+      if (pressure > worst){
+        worst=pressure;
+        worst_signal=s;
+      }
+    }
+    work=__sync_fetch_and_add(&auto_threads_work, 0);
+    now=g_get_monotonic_time();
+    g_mutex_lock(throttle_mutex);
+    limit=throttle_active_limit;
+    // throttle_active is sampled, a limit that was reached once is enough
+    active_peak=throttle_active;
+    max_limit= auto_threads_converged > 0 ? auto_threads_converged : throttle_max_threads;
+    if (worst > 1){
+      if (auto_threads && auto_threads_converged == 0){
+        auto_threads_converged=throttle_active_limit > 1 ? throttle_active_limit / 2 : 1;
+        g_message("Auto threads: %s is over its limit, converged at %u active threads", throttle_signal_name[worst_signal], auto_threads_converged);
+      }
+      throttle_active_limit= throttle_active_limit > 1 ? throttle_active_limit / 2 : 1;
+    }else if (auto_threads && auto_threads_converged == 0)
+      auto_threads_step((gdouble)(work - last_work) * G_USEC_PER_SEC / (now - last_time), active_peak);
+    else if (worst < THROTTLE_CONTROL_LOW_WATERMARK && throttle_active_limit < max_limit)
+      throttle_active_limit++;
+    if (limit != throttle_active_limit){
+      trace("Throttle control: %s at %.0f%% of its limit, %u active threads", throttle_signal_name[worst_signal], worst * 100, throttle_active_limit);
+      g_cond_broadcast(throttle_cond);
+    }
+    g_mutex_unlock(throttle_mutex);
+    last_work=work;
+    last_time=now;
+    for (seconds=0; seconds < THROTTLE_CONTROL_INTERVAL && !g_atomic_int_get(&throttle_shutdown); seconds++)
+      sleep(1);
+  }
+  if (conn)
+    mysql_close(conn);
+  mysql_thread_end();
+  return NULL;
+}
+
+// threads_running=N,replica_lag=SECONDS,history_length=N
+void initialize_throttle_control(guint max_threads){
+  if (throttle_control == NULL && !auto_threads)
+    return;
+  gchar **items=g_strsplit(throttle_control ? throttle_control : "", ",", 0), **kv;
+  guint i, s;
+  for (i=0; items[i]; i++){
+    kv=g_strsplit(g_strstrip(items[i]), "=", 2);
+    for (s=0; s < THROTTLE_SIGNALS; s++)
+      if (kv[0] && kv[1] && !g_ascii_strcasecmp(kv[0], throttle_signal_name[s]))
+        break;
+    if (s == THROTTLE_SIGNALS)
+      m_critical("--throttle-control expects threads_running, replica_lag or history_length with a limit, got: %s", items[i]);
+    throttle_limit[s]=g_ascii_strtoull(kv[1], NULL, 10);
+    g_strfreev(kv);
+  }
+  g_strfreev(items);
+  throttle_mutex=g_mutex_new();
+  throttle_cond=g_cond_new();
+  throttle_max_threads= max_threads > 0 ? max_threads : 1;
+  throttle_active_limit= auto_threads && auto_threads_start < throttle_max_threads ? auto_threads_start : throttle_max_threads;
+  throttle_active=0;
+  auto_threads_work=0;
+  auto_threads_converged=0;
+  auto_threads_previous_rate=0;
+  auto_threads_previous_limit=0;
+  auto_threads_rate_sum=0;
+  auto_threads_samples=0;
+  g_atomic_int_set(&throttle_shutdown, FALSE);
+  throttle_enabled=TRUE;
+  throttle_thread=m_thread_new("throttle_ctl", throttle_control_thread, NULL, "Throttle control thread could not be created");
+}
+
+/* Called once no thread can be in throttle_control_acquire(). In --daemon
+   mode every snapshot initializes it again, --auto-threads starts from the
+   limit that it found on the previous one */
+void finalize_throttle_control(){
+  if (!throttle_enabled)
+    return;
+  g_atomic_int_set(&throttle_shutdown, TRUE);
+  g_thread_join(throttle_thread);
+  throttle_thread=NULL;
+  throttle_enabled=FALSE;
+  if (auto_threads_converged > 0)
+    auto_threads_start=auto_threads_converged;
+  g_mutex_free(throttle_mutex);
+  throttle_mutex=NULL;
+  g_cond_free(throttle_cond);
+  throttle_cond=NULL;
+}
@@ -0,0 +1,44 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Authors:        David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#ifndef _src_throttle_control_h
+#define _src_throttle_control_h
+
+#include <glib.h>
+
+/* --throttle-control: an AIMD controller that limits how many statements
+   can run on the server at the same time, fed by the load of the server.
+   It is taken per statement: each SELECT of a chunk in mydumper, including
+   the one of the next chunk that is prefetched, and each data statement
+   that myloader sends on any connection, also the ones granted by
+   request_another_connection(). Threads over the limit are parked in
+   throttle_control_acquire() */
+extern gchar *throttle_control;
+/* --auto-threads uses the same limit, starting low and growing while the
+   rows or bytes per second that the jobs report keep improving */
+extern gboolean auto_threads;
+
+void initialize_throttle_control(guint max_threads);
+void finalize_throttle_control();
+void throttle_control_acquire();
+gboolean throttle_control_try_acquire();
+void throttle_control_release();
+void throttle_control_add_work(guint64 units);
+void throttle_control_start_from(guint threads);
+guint throttle_control_threads();
+
+#endif
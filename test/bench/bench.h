@@ -0,0 +1,110 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Authors:        David Ducos, Percona (david dot ducos at percona dot com)
+*/
+#ifndef _test_bench_bench_h
+#define _test_bench_bench_h
+
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+
+/* Helpers of the microbenchmarks. The data is generated from a fixed seed so
+   every run measures the same rows */
+#define BENCH_SEED 0x6d7964756d706572ULL
+#define BENCH_REPEAT 5
+
+static guint64 bench_state=BENCH_SEED;
+
+static inline
+guint64 bench_rand(){
+  guint64 z=(bench_state += 0x9e3779b97f4a7c15ULL);
+  z=(z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z=(z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+static inline
+guint bench_range(guint from, guint to){
+  return from + bench_rand() % (to - from + 1);
+}
+
+// Column value distributions
+enum bench_distribution {
+  BENCH_ASCII,
+  BENCH_ESCAPED,
+  BENCH_BINARY,
+  BENCH_NUMBER
+};
+
+static inline
+gchar *bench_value(enum bench_distribution d, guint length){
+  static const gchar ascii[]="abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 ";
+  // one of each 10 bytes needs escaping
+  static const gchar escaped[]="'\"\\\n\r\t";
+  gchar *v=g_malloc(length + 1);
+  guint i;
+  for (i=0; i<length; i++){
+    switch (d){
+      case BENCH_ASCII:
+        v[i]=ascii[bench_rand() % (sizeof(ascii) - 1)];
+        break;
+      case BENCH_ESCAPED:
+        v[i]= bench_rand() % 10 ? ascii[bench_rand() % (sizeof(ascii) - 1)] : escaped[bench_rand() % (sizeof(escaped) - 1)];
+        break;
+      case BENCH_BINARY:
+        v[i]=bench_rand() & 0xff;
+        break;
+      case BENCH_NUMBER:
+        v[i]='0' + (i ? bench_rand() % 10 : 1 + bench_rand() % 9);
+        break;
+    }
+  }
+  v[length]='\0';
+  return v;
+}
+
+struct bench_result {
+  gint64 best;
+  guint64 items;
+  guint64 bytes;
+};
+
+static inline
+void bench_report(const gchar *name, struct bench_result *r){
+  gdouble seconds=(gdouble)r->best / G_USEC_PER_SEC;
+  printf("%-36s %10.1f ns/row %10.1f MB/s %10"G_GUINT64_FORMAT" rows\n", name,
+         r->items ? (gdouble)r->best * 1000 / r->items : 0,
+         seconds > 0 ? r->bytes / seconds / 1024 / 1024 : 0, r->items);
+  fflush(stdout);
+}
+
+// The best of BENCH_REPEAT runs, to leave out the noise of the host
+static inline
+void bench_run(struct bench_result *r, void (*run)(gpointer data, struct bench_result *r), gpointer data){
+  guint i;
+  r->best=G_MAXINT64;
+  for (i=0; i<BENCH_REPEAT; i++){
+    r->items=0;
+    r->bytes=0;
+    gint64 start=g_get_monotonic_time();
+    run(data, r);
+    gint64 elapsed=g_get_monotonic_time() - start;
+    if (elapsed < r->best)
+      r->best=elapsed;
+  }
+}
+
+#endif
@@ -0,0 +1,270 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Authors:        David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+/* Microbenchmarks of the mydumper encoders: the rows are built in memory and
+   encoded with the same functions that the working threads use, so the
+   numbers only depend on the encoding */
+#include <stdlib.h>
+#include <mysql.h>
+#include <glib.h>
+
+#include "src/mydumper/mydumper.h"
+#include "src/mydumper/mydumper_global.h"
+#include "src/mydumper/mydumper_common.h"
+#include "src/mydumper/mydumper_working_thread.h"
+#include "src/mydumper/mydumper_write.h"
+#include "src/mydumper/mydumper_masquerade.h"
+#include "test/bench/bench.h"
+
+#define BENCH_FIELDS 6
+#define BENCH_ENCODED_FLUSH 1024*1024
+
+struct bench_table {
+  guint num_rows;
+  MYSQL_FIELD fields[BENCH_FIELDS];
+  MYSQL_ROW *rows;
+  gulong **lengths;
+  struct db_table dbt;
+  struct thread_data_buffers buffers;
+  GString *to;
+};
+
+// An integer key, short names, texts that need escaping, blobs, JSON and decimals
+static
+void bench_table_fill(struct bench_table *t, guint num_rows){
+  static const enum enum_field_types types[BENCH_FIELDS]={MYSQL_TYPE_LONG, MYSQL_TYPE_VAR_STRING, MYSQL_TYPE_VAR_STRING, MYSQL_TYPE_BLOB, MYSQL_TYPE_JSON, MYSQL_TYPE_NEWDECIMAL};
+  static const gchar *names[BENCH_FIELDS]={"id", "name", "comment", "payload", "doc", "amount"};
+  guint i, j;
+  memset(t, 0, sizeof(*t));
+  for (j=0; j<BENCH_FIELDS; j++){
+    t->fields[j].name=(gchar *)names[j];
+    t->fields[j].type=types[j];
+    t->fields[j].charsetnr= types[j] == MYSQL_TYPE_BLOB ? 63 : 255;
+    if (types[j] == MYSQL_TYPE_LONG || types[j] == MYSQL_TYPE_NEWDECIMAL)
+      t->fields[j].flags=NUM_FLAG;
+  }
+  t->num_rows=num_rows;
+  t->rows=g_new(MYSQL_ROW, num_rows);
+  t->lengths=g_new(gulong *, num_rows);
+  for (i=0; i<num_rows; i++){
+    t->rows[i]=g_new0(gchar *, BENCH_FIELDS);
+    t->lengths[i]=g_new0(gulong, BENCH_FIELDS);
+    t->rows[i][0]=g_strdup_printf("%u", i + 1);
+    t->rows[i][1]=bench_value(BENCH_ASCII, bench_range(8, 32));
+    // 5% of NULL
+    t->rows[i][2]= bench_rand() % 20 ? bench_value(BENCH_ESCAPED, bench_range(0, 200)) : NULL;
+    // the binary values can have a 0 inside, the length is the generated one
+    t->lengths[i][3]=bench_range(16, 256);
+    t->rows[i][3]=bench_value(BENCH_BINARY, t->lengths[i][3]);
+    t->rows[i][4]=g_strdup_printf("{\"k\": \"%s\"}", t->rows[i][1]);
+    t->rows[i][5]=g_strdup_printf("%u.%02u", (guint)bench_range(0, 1000000), (guint)bench_range(0, 99));
+    for (j=0; j<BENCH_FIELDS; j++)
+      if (j != 3)
+        t->lengths[i][j]= t->rows[i][j] ? strlen(t->rows[i][j]) : 0;
+  }
+  t->buffers.statement=g_string_sized_new(BENCH_ENCODED_FLUSH);
+  t->buffers.row=g_string_sized_new(1024);
+  t->buffers.column=g_string_sized_new(1024);
+  t->buffers.escaped=g_string_sized_new(1024);
+  t->to=g_string_sized_new(2 * BENCH_ENCODED_FLUSH);
+}
+
+// The separators that initialize_write() sets for each format, with the default options
+static
+void bench_set_separators(const gchar *enclosed_by, const gchar *terminated_by, const gchar *starting_by, const gchar *line_terminated_by){
+  fields_enclosed_by=enclosed_by;
+  g_free(fields_terminated_by);
+  fields_terminated_by=g_strdup(terminated_by);
+  g_free(lines_starting_by);
+  lines_starting_by=g_strdup(starting_by);
+  g_free(lines_terminated_by);
+  lines_terminated_by=g_strdup(line_terminated_by);
+}
+
+static
+void bench_set_format(guint format){
+  output_format=format;
+  if (!fields_escaped_by)
+    fields_escaped_by=g_strdup("\\\\");
+  switch (format){
+    case LOAD_DATA:
+      bench_set_separators("", "\t", "", "\n");
+      break;
+    case CSV:
+      bench_set_separators("\"", ",", "", "\n");
+      break;
+    default:
+      bench_set_separators("'", ",", "(", ")\n");
+  }
+}
+
+static
+void run_write_row(gpointer data, struct bench_result *r){
+  struct bench_table *t=data;
+  guint i;
+  g_string_set_size(t->to, 0);
+  for (i=0; i<t->num_rows; i++){
+    write_row_into_string(NULL, &(t->dbt), t->rows[i], t->lengths[i], BENCH_FIELDS, &(t->buffers), t->to);
+    if (t->to->len > BENCH_ENCODED_FLUSH){
+      r->bytes+=t->to->len;
+      g_string_set_size(t->to, 0);
+    }
+  }
+  r->bytes+=t->to->len;
+  r->items+=t->num_rows;
+}
+
+static
+void bench_write_row(struct bench_table *t, guint format, const gchar *name){
+  struct bench_result r;
+  bench_set_format(format);
+  g_free(t->dbt.encoder_plan);
+  build_column_encoder_plan(&(t->dbt), t->fields, BENCH_FIELDS);
+  bench_run(&r, run_write_row, t);
+  bench_report(name, &r);
+}
+
+struct bench_values {
+  guint num_values;
+  gchar **values;
+  gulong *lengths;
+  gchar *to;
+  struct function_pointer *fp;
+};
+
+static
+void bench_values_fill(struct bench_values *v, guint num_values, enum bench_distribution d, guint min, guint max){
+  guint i;
+  v->num_values=num_values;
+  v->values=g_new(gchar *, num_values);
+  v->lengths=g_new(gulong, num_values);
+  for (i=0; i<num_values; i++){
+    v->lengths[i]=bench_range(min, max);
+    v->values[i]=bench_value(d, v->lengths[i]);
+  }
+  v->to=g_malloc(max * 2 + 1);
+  v->fp=NULL;
+}
+
+static
+void bench_values_free(struct bench_values *v){
+  guint i;
+  for (i=0; i<v->num_values; i++)
+    g_free(v->values[i]);
+  g_free(v->values);
+  g_free(v->lengths);
+  g_free(v->to);
+}
+
+static
+void run_escape(gpointer data, struct bench_result *r){
+  struct bench_values *v=data;
+  guint i;
+  for (i=0; i<v->num_values; i++)
+    r->bytes+=m_real_escape_string(NULL, v->to, v->values[i], v->lengths[i], '\\');
+  r->items+=v->num_values;
+}
+
+static
+void run_hex(gpointer data, struct bench_result *r){
+  struct bench_values *v=data;
+  guint i;
+  for (i=0; i<v->num_values; i++)
+    r->bytes+=m_hex_string(v->to, v->values[i], v->lengths[i]);
+  r->items+=v->num_values;
+}
+
+static
+void run_client_hex(gpointer data, struct bench_result *r){
+  struct bench_values *v=data;
+  guint i;
+  for (i=0; i<v->num_values; i++)
+    r->bytes+=mysql_hex_string(v->to, v->values[i], v->lengths[i]);
+  r->items+=v->num_values;
+}
+
+// The functions write over the value, so it is copied first as the row buffer would be
+static
+void run_masquerade(gpointer data, struct bench_result *r){
+  struct bench_values *v=data;
+  guint i;
+  for (i=0; i<v->num_values; i++){
+    gulong length=v->lengths[i];
+    memcpy(v->to, v->values[i], length + 1);
+    gchar *value=v->to;
+    gchar *masked=v->fp->function(&value, &length, v->fp);
+    if (masked && masked != v->to)
+      g_free(masked);
+    r->bytes+=length;
+  }
+  r->items+=v->num_values;
+}
+
+static
+void bench_values(struct bench_values *v, void (*run)(gpointer data, struct bench_result *r), const gchar *name){
+  struct bench_result r;
+  bench_run(&r, run, v);
+  bench_report(name, &r);
+}
+
+static
+void bench_masquerade(struct bench_values *v, const gchar *function){
+  gchar *name=g_strdup_printf("masquerade %s", function);
+  v->fp=init_function_pointer(g_strdup(function));
+  bench_values(v, run_masquerade, name);
+  g_free(name);
+}
+
+int main(int argc, char *argv[]){
+  guint num_rows= argc > 1 ? strtoul(argv[1], NULL, 10) : 100000;
+  struct bench_table t;
+  struct bench_values v;
+  g_thread_init(NULL);
+  initialize_hex_string();
+  initialize_masquerade();
+  hex_blob=TRUE;
+  printf("mydumper microbenchmarks, %u rows, best of %u runs\n", num_rows, BENCH_REPEAT);
+
+  bench_table_fill(&t, num_rows);
+  bench_write_row(&t, SQL_INSERT, "write_row_into_string INSERT");
+  bench_write_row(&t, LOAD_DATA, "write_row_into_string LOAD_DATA");
+  bench_write_row(&t, CSV, "write_row_into_string CSV");
+  hex_blob=FALSE;
+  bench_write_row(&t, SQL_INSERT, "write_row_into_string INSERT no hex");
+  hex_blob=TRUE;
+
+  bench_values_fill(&v, num_rows, BENCH_ASCII, 0, 256);
+  bench_values(&v, run_escape, "m_real_escape_string ascii");
+  bench_values_free(&v);
+  bench_values_fill(&v, num_rows, BENCH_ESCAPED, 0, 256);
+  bench_values(&v, run_escape, "m_real_escape_string escaped");
+  bench_values_free(&v);
+  bench_values_fill(&v, num_rows, BENCH_BINARY, 0, 256);
+  bench_values(&v, run_escape, "m_real_escape_string binary");
+  bench_values(&v, run_hex, "m_hex_string binary");
+  bench_values(&v, run_client_hex, "mysql_hex_string binary");
+  bench_values_free(&v);
+
+  bench_values_fill(&v, num_rows, BENCH_ASCII, 8, 32);
+  bench_masquerade(&v, "random_int");
+  bench_masquerade(&v, "random_string");
+  bench_values_free(&v);
+  bench_values_fill(&v, num_rows, BENCH_ASCII, 36, 36);
+  bench_masquerade(&v, "random_uuid");
+  bench_values_free(&v);
+  return 0;
+}
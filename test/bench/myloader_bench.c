@@ -0,0 +1,275 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Authors:        David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+/* Microbenchmarks of the myloader parsers over a synthetic INSERT file: the
+   line reader, the statement reader and the split of the INSERTs into
+   smaller statements done by restore_insert(), and the page splits of the
+   clustered index caused by each --ingest-order */
+#include <stdlib.h>
+#include <unistd.h>
+#include <mysql.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "src/myloader/myloader.h"
+#include "src/myloader/myloader_global.h"
+#include "src/myloader/myloader_restore.h"
+#include "src/myloader/myloader_restore_job.h"
+#include "src/myloader/myloader_table.h"
+#include "test/bench/bench.h"
+
+#define BENCH_ROWS_PER_STATEMENT 1000
+#define BENCH_ROWS_PER_SPLIT 100
+#define BENCH_INGEST_THREADS 8
+#define BENCH_INGEST_PARTS 256
+#define BENCH_PAGE_ROWS 100
+// rows inserted by a thread before the next one gets the server
+#define BENCH_ROWS_PER_TURN 50
+
+struct bench_file {
+  gchar *filename;
+  guint num_rows;
+  guint64 size;
+  GPtrArray *statements;
+};
+
+static
+void bench_file_fill(struct bench_file *f, guint num_rows){
+  GError *error=NULL;
+  gint fd=g_file_open_tmp("myloader_bench_XXXXXX.sql", &(f->filename), &error);
+  if (fd < 0){
+    fprintf(stderr, "Not able to create the data file: %s\n", error->message);
+    exit(1);
+  }
+  FILE *file=fdopen(fd, "w");
+  GString *statement=g_string_sized_new(1024*1024);
+  guint i;
+  f->num_rows=num_rows;
+  f->statements=g_ptr_array_new();
+  for (i=0; i<num_rows; i++){
+    if (statement->len == 0)
+      g_string_append(statement, "INSERT INTO `bench` VALUES");
+    gchar *name=bench_value(BENCH_ASCII, bench_range(8, 32));
+    gchar *comment=bench_value(BENCH_ASCII, bench_range(0, 200));
+    g_string_append_printf(statement, "(%u,'%s','%s',%u.%02u)", i + 1, name, comment, (guint)bench_range(0, 1000000), (guint)bench_range(0, 99));
+    g_free(name);
+    g_free(comment);
+    if ((i + 1) % BENCH_ROWS_PER_STATEMENT == 0 || i + 1 == num_rows){
+      g_string_append(statement, ";\n");
+      fwrite(statement->str, 1, statement->len, file);
+      g_ptr_array_add(f->statements, g_string_new_len(statement->str, statement->len));
+      f->size+=statement->len;
+      g_string_set_size(statement, 0);
+    }else
+      g_string_append(statement, ",\n");
+  }
+  g_string_free(statement, TRUE);
+  fclose(file);
+}
+
+static
+void run_read_data(gpointer data, struct bench_result *r){
+  struct bench_file *f=data;
+  FILE *file=g_fopen(f->filename, "r");
+  GString *line=g_string_sized_new(1024);
+  gboolean eof=FALSE;
+  guint lines=0;
+  while (read_data(file, line, &eof, &lines) && !eof){
+    r->bytes+=line->len;
+    g_string_set_size(line, 0);
+  }
+  r->items+=f->num_rows;
+  g_string_free(line, TRUE);
+  fclose(file);
+}
+
+static
+void run_read_statement(gpointer data, struct bench_result *r){
+  struct bench_file *f=data;
+  FILE *file=g_fopen(f->filename, "r");
+  struct statement_reader *sr=new_statement_reader(file);
+  gchar *statement=NULL;
+  gsize length=0;
+  gboolean eof=FALSE;
+  guint lines=0;
+  while (read_statement(sr, &statement, &length, &eof, &lines) && length > 0)
+    r->bytes+=length;
+  r->items+=f->num_rows;
+  free_statement_reader(sr);
+  fclose(file);
+}
+
+// The sub statements that restore_insert() sends, without sending them
+static
+void run_split_insert(gpointer data, struct bench_result *r){
+  struct bench_file *f=data;
+  GString *new_insert=g_string_sized_new(1024*1024);
+  guint i;
+  for (i=0; i<f->statements->len; i++){
+    GString *s=g_ptr_array_index(f->statements, i);
+    gchar *end=s->str + s->len;
+    gchar *current_line=g_strstr_len(s->str, -1, "VALUES") + 6;
+    gsize prefix_len=current_line - s->str;
+    gchar *next_line=memchr(current_line, '\n', end - current_line);
+    do {
+      g_string_set_size(new_insert, 0);
+      g_string_append_len(new_insert, s->str, prefix_len);
+      gchar *first_line=current_line, *last_line=current_line;
+      r->items+=next_insert_rows(&current_line, &next_line, &last_line, end, BENCH_ROWS_PER_SPLIT);
+      g_string_append_len(new_insert, first_line, current_line - 1 - first_line);
+      r->bytes+=new_insert->len;
+      current_line++;
+    } while (next_line != NULL);
+  }
+  g_string_free(new_insert, TRUE);
+}
+
+struct bench_page {
+  guint64 keys[BENCH_PAGE_ROWS];
+  guint count;
+};
+
+struct bench_ingest {
+  const gchar *order;
+  guint num_rows;
+  guint64 splits;
+  guint pages;
+};
+
+/* Leaf pages of a clustered index: a full page is split at its middle, or a
+   new page is started when the key goes after its last one, as InnoDB does
+   on sequential inserts */
+static
+void bench_page_insert(GPtrArray *pages, guint64 key, struct bench_ingest *bi){
+  guint low=0, high=pages->len, i;
+  while (high - low > 1){
+    guint middle=(low + high) / 2;
+    if (((struct bench_page *)g_ptr_array_index(pages, middle))->keys[0] <= key)
+      low=middle;
+    else
+      high=middle;
+  }
+  struct bench_page *page=g_ptr_array_index(pages, low);
+  if (page->count == BENCH_PAGE_ROWS){
+    struct bench_page *new_page=g_new0(struct bench_page, 1);
+    bi->splits++;
+    if (key > page->keys[page->count - 1]){
+      g_ptr_array_insert(pages, low + 1, new_page);
+      page=new_page;
+    }else{
+      new_page->count=page->count / 2;
+      page->count-=new_page->count;
+      memcpy(new_page->keys, page->keys + page->count, new_page->count * sizeof(guint64));
+      g_ptr_array_insert(pages, low + 1, new_page);
+      if (key >= new_page->keys[0])
+        page=new_page;
+    }
+  }
+  for (i=page->count; i > 0 && page->keys[i - 1] > key; i--)
+    page->keys[i]=page->keys[i - 1];
+  page->keys[i]=key;
+  page->count++;
+}
+
+/* The parts of a table are loaded by BENCH_INGEST_THREADS threads, each one
+   inserts its chunk in primary key order and takes the next job of the table
+   from restore_job_take() when it ends */
+static
+void run_ingest_order(gpointer data, struct bench_result *r){
+  struct bench_ingest *bi=data;
+  guint rows_per_part=MAX(bi->num_rows / BENCH_INGEST_PARTS, 1), i, t, active;
+  struct restore_job *running[BENCH_INGEST_THREADS];
+  guint next_row[BENCH_INGEST_THREADS];
+  struct db_table *dbt=g_new0(struct db_table, 1);
+  GPtrArray *pages=g_ptr_array_new_with_free_func(g_free);
+  memset(running, 0, sizeof(running));
+  ingest_order_str=(gchar *)bi->order;
+  num_threads=BENCH_INGEST_THREADS;
+  initialize_ingest_order();
+  dbt->restore_job_heap=g_ptr_array_new();
+  for (i=0; i < BENCH_INGEST_PARTS; i++){
+    restore_job_heap_push(dbt->restore_job_heap, new_data_restore_job(NULL, JOB_RESTORE_FILENAME, dbt, i, 0));
+    dbt->count++;
+  }
+  g_ptr_array_add(pages, g_new0(struct bench_page, 1));
+  bi->splits=0;
+  do {
+    active=0;
+    for (t=0; t < BENCH_INGEST_THREADS; t++){
+      if (running[t] == NULL || next_row[t] == rows_per_part){
+        if (running[t] != NULL){
+          restore_job_done(dbt, running[t]->data.drj->run);
+          g_free(running[t]->data.drj);
+          g_free(running[t]);
+        }
+        running[t]= dbt->restore_job_heap->len > 0 ? restore_job_take(dbt) : NULL;
+        next_row[t]=0;
+      }
+      if (running[t] == NULL)
+        continue;
+      active++;
+      guint64 first_key=(guint64)running[t]->data.drj->part * rows_per_part;
+      for (i=0; i < BENCH_ROWS_PER_TURN && next_row[t] < rows_per_part; i++, next_row[t]++)
+        bench_page_insert(pages, first_key + next_row[t], bi);
+      r->items+=i;
+      r->bytes+=i * sizeof(guint64);
+    }
+  } while (active > 0);
+  bi->pages=pages->len;
+  g_ptr_array_free(pages, TRUE);
+  g_ptr_array_free(dbt->restore_job_heap, TRUE);
+  g_free(dbt->run_last);
+  g_free(dbt->run_started);
+  g_free(dbt->run_busy);
+  g_free(dbt);
+}
+
+static
+void bench_ingest_order(guint num_rows, const gchar *order){
+  struct bench_ingest bi={order, num_rows, 0, 0};
+  struct bench_result r;
+  gchar *name=g_strdup_printf("ingest order %s", order);
+  bench_run(&r, run_ingest_order, &bi);
+  bench_report(name, &r);
+  printf("%-36s %10"G_GUINT64_FORMAT" splits %9.1f%% fill\n", "", bi.splits, 100.0 * r.items / ((gdouble)bi.pages * BENCH_PAGE_ROWS));
+  g_free(name);
+}
+
+static
+void bench_file(struct bench_file *f, void (*run)(gpointer data, struct bench_result *r), const gchar *name){
+  struct bench_result r;
+  bench_run(&r, run, f);
+  bench_report(name, &r);
+}
+
+int main(int argc, char *argv[]){
+  guint num_rows= argc > 1 ? strtoul(argv[1], NULL, 10) : 100000;
+  struct bench_file f;
+  memset(&f, 0, sizeof(f));
+  g_thread_init(NULL);
+  printf("myloader microbenchmarks, %u rows, best of %u runs\n", num_rows, BENCH_REPEAT);
+
+  bench_file_fill(&f, num_rows);
+  bench_file(&f, run_read_data, "read_data");
+  bench_file(&f, run_read_statement, "read_statement");
+  bench_file(&f, run_split_insert, "restore_insert split");
+  bench_ingest_order(num_rows, "INTERLEAVED");
+  bench_ingest_order(num_rows, "CLUSTERED");
+  g_unlink(f.filename);
+  g_free(f.filename);
+  return 0;
+}
@@ -0,0 +1,7 @@
+#
+# Narrow rows with an integer primary key
+#
+. test/perf_functions.sh
+create_database perf_1
+echo "CREATE TABLE narrow (id INT NOT NULL PRIMARY KEY, a INT NOT NULL, b INT NOT NULL, c SMALLINT NOT NULL) ENGINE=InnoDB;"
+echo "INSERT INTO narrow SELECT n + 1, n * 7 % 100000, n % 1000, n % 32000 FROM ($(numbers $PERF_ROWS)) s;"
@@ -0,0 +1,18 @@
+#
+# Wide rows: 30 columns of integers, strings, dates and decimals
+#
+. test/perf_functions.sh
+create_database perf_2
+columns="id BIGINT NOT NULL PRIMARY KEY"
+values="n + 1"
+for i in $(seq 1 29)
+do
+  case $(( i % 4 )) in
+    0) columns="${columns}, i${i} INT"; values="${values}, n * ${i} % 1000000";;
+    1) columns="${columns}, s${i} VARCHAR(64)"; values="${values}, CONCAT('value ', n, ' of column ${i}')";;
+    2) columns="${columns}, d${i} DATETIME"; values="${values}, '2020-01-01' + INTERVAL (n * ${i} % 100000) MINUTE";;
+    3) columns="${columns}, m${i} DECIMAL(12,2)"; values="${values}, n * ${i} % 10000000 / 100";;
+  esac
+done
+echo "CREATE TABLE wide (${columns}) ENGINE=InnoDB;"
+echo "INSERT INTO wide SELECT ${values} FROM ($(numbers $(( PERF_ROWS / 4 )))) s;"
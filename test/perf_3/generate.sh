@@ -0,0 +1,7 @@
+#
+# String primary key, the chunks are split by the char chunks
+#
+. test/perf_functions.sh
+create_database perf_3
+echo "CREATE TABLE string_pk (id CHAR(32) NOT NULL PRIMARY KEY, name VARCHAR(64) NOT NULL, val INT NOT NULL) ENGINE=InnoDB;"
+echo "INSERT INTO string_pk SELECT MD5(n), CONCAT('name ''', n, '\\\\'), n FROM ($(numbers $PERF_ROWS)) s;"
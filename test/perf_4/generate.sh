@@ -0,0 +1,8 @@
+#
+# BLOB heavy rows, around 16KB each
+#
+. test/perf_functions.sh
+create_database perf_4
+echo "CREATE TABLE blobs (id INT NOT NULL PRIMARY KEY, payload MEDIUMBLOB NOT NULL, doc TEXT) ENGINE=InnoDB;"
+echo "INSERT INTO blobs SELECT n + 1, RANDOM_BYTES(1024), REPEAT(MD5(n), 16) FROM ($(numbers $(( PERF_ROWS / 100 )))) s;"
+echo "UPDATE blobs SET payload=REPEAT(payload, 16);"
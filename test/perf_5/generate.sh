@@ -0,0 +1,12 @@
+#
+# Partitioned table, 16 RANGE partitions over the primary key
+#
+. test/perf_functions.sh
+create_database perf_5
+partitions=""
+for i in $(seq 1 15)
+do
+  partitions="${partitions}PARTITION p${i} VALUES LESS THAN ($(( PERF_ROWS * i / 16 ))), "
+done
+echo "CREATE TABLE partitioned (id INT NOT NULL PRIMARY KEY, a INT NOT NULL, s VARCHAR(32) NOT NULL) ENGINE=InnoDB PARTITION BY RANGE (id) (${partitions}PARTITION p16 VALUES LESS THAN MAXVALUE);"
+echo "INSERT INTO partitioned SELECT n, n % 1000, MD5(n) FROM ($(numbers $PERF_ROWS)) s;"
@@ -0,0 +1,10 @@
+#
+# Many tiny tables, 10 rows each, the cost is in the schema and the files
+#
+. test/perf_functions.sh
+create_database perf_6
+for i in $(seq 1 $PERF_TABLES)
+do
+  echo "CREATE TABLE tiny_${i} (id INT NOT NULL PRIMARY KEY, val VARCHAR(16)) ENGINE=InnoDB;"
+  echo "INSERT INTO tiny_${i} VALUES (1,'a'),(2,'b'),(3,'c'),(4,'d'),(5,'e'),(6,'f'),(7,'g'),(8,'h'),(9,'i'),(10,'j');"
+done
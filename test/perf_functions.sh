@@ -0,0 +1,27 @@
+# Helpers sourced by the generate.sh of the test/perf_* cases. They print SQL,
+# the harness sends it to the server. Sizes come from PERF_ROWS and PERF_TABLES
+
+PERF_ROWS=${PERF_ROWS:-1000000}
+PERF_TABLES=${PERF_TABLES:-10000}
+
+# SELECT with a column n from 0 to $1-1, over as few cross joins of
+# perf_seq.digits as the amount needs
+numbers()
+{
+  local total=$1 joins=1 size=10 expr="d0.d" from="perf_seq.digits d0"
+  while (( size < total ))
+  do
+    expr="${expr} + d${joins}.d * ${size}"
+    from="${from}, perf_seq.digits d${joins}"
+    joins=$(( joins + 1 ))
+    size=$(( size * 10 ))
+  done
+  echo "SELECT ${expr} AS n FROM ${from} HAVING n < ${total}"
+}
+
+create_database()
+{
+  echo "DROP DATABASE IF EXISTS $1;"
+  echo "CREATE DATABASE $1;"
+  echo "USE $1;"
+}
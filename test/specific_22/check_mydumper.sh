@@ -0,0 +1,11 @@
+
+
+num_double=$(grep -F '2.718281828459045' /tmp/data/specific_22.sliced_numbers.* | wc -l)
+num_float=$(grep -F '3.14159' /tmp/data/specific_22.sliced_numbers.* | wc -l)
+
+if [ $num_double == 1 ] && [ $num_float == 1 ]
+then
+  exit 0
+else
+  exit 1
+fi
@@ -0,0 +1,19 @@
+DROP DATABASE IF EXISTS specific_22;
+CREATE DATABASE specific_22;
+
+USE specific_22;
+
+CREATE TABLE `sliced_numbers` (
+  `id` int NOT NULL,
+  `f` float DEFAULT NULL,
+  `d` double DEFAULT NULL,
+  `fd` float(7,3) DEFAULT NULL,
+  `dd` decimal(20,6) DEFAULT NULL,
+  `b` blob,
+  PRIMARY KEY (`id`)
+) ENGINE=InnoDB DEFAULT CHARSET=utf8mb4;
+
+INSERT INTO `sliced_numbers` VALUES (1, 3.14159, 2.718281828459045, 1.5, 12345678901234.123456, REPEAT('a', 10));
+INSERT INTO `sliced_numbers` VALUES (2, -1.17549e-38, 1.7976931348623157e308, -9999.999, -0.000001, REPEAT('b', 100));
+INSERT INTO `sliced_numbers` VALUES (3, 123456, 0.1, 0, 0, NULL);
+INSERT INTO `sliced_numbers` VALUES (4, 1e-10, -2.2250738585072014e-308, 42.125, 1, REPEAT('c', 1000));
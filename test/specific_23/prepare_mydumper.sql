@@ -0,0 +1,17 @@
+DROP DATABASE IF EXISTS specific_23;
+CREATE DATABASE specific_23;
+
+USE specific_23;
+
+CREATE TABLE `binary_json` (
+  `id` int NOT NULL,
+  `doc` json DEFAULT NULL,
+  `name` varchar(32) DEFAULT NULL,
+  `payload` varbinary(16) DEFAULT NULL,
+  PRIMARY KEY (`id`)
+) ENGINE=InnoDB DEFAULT CHARSET=utf8mb4;
+
+INSERT INTO `binary_json` VALUES (1, '{"a": 1, "b": [1, 2, 3]}', 'first', 0x00FF10);
+INSERT INTO `binary_json` VALUES (2, '{"name": "ñandú", "nested": {"x": null}}', 'second', NULL);
+INSERT INTO `binary_json` VALUES (3, '[]', NULL, 0x);
+INSERT INTO `binary_json` VALUES (4, NULL, 'fourth', 0x0A0D27);
@@ -0,0 +1,10 @@
+
+
+num_dat_checksums=$(grep -E '^file_checksum_[0-9]+ = specific_24\.load_data_checksums\..*\.dat' /tmp/data/metadata | wc -l)
+
+if [ $num_dat_checksums -ge 2 ]
+then
+  exit 0
+else
+  exit 1
+fi
@@ -0,0 +1,12 @@
+DROP DATABASE IF EXISTS specific_24;
+CREATE DATABASE specific_24;
+
+USE specific_24;
+
+CREATE TABLE `load_data_checksums` (
+  `id` int NOT NULL,
+  `name` varchar(32) DEFAULT NULL,
+  PRIMARY KEY (`id`)
+) ENGINE=InnoDB DEFAULT CHARSET=utf8mb4;
+
+INSERT INTO `load_data_checksums` VALUES (1, 'first'), (2, 'second'), (3, NULL), (4, 'fourth'), (5, 'fifth');
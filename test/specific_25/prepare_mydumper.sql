@@ -0,0 +1,22 @@
+DROP DATABASE IF EXISTS specific_25;
+CREATE DATABASE specific_25;
+
+USE specific_25;
+
+CREATE TABLE `nullable_index` (
+  `a` int NOT NULL,
+  `b` int DEFAULT NULL,
+  `name` varchar(32) DEFAULT NULL,
+  KEY `a_b` (`a`, `b`)
+) ENGINE=InnoDB DEFAULT CHARSET=utf8mb4;
+
+INSERT INTO `nullable_index` VALUES (1, NULL, 'a1'), (1, NULL, 'a1 again'), (2, 1, 'b1'), (2, 2, 'b2'), (2, NULL, 'b null');
+INSERT INTO `nullable_index` VALUES (3, NULL, 'c1'), (4, 1, 'd1'), (4, 1, 'd1 again'), (5, NULL, 'e1'), (6, 6, 'f6');
+
+CREATE TABLE `nullable_unique` (
+  `a` int NOT NULL,
+  `b` int DEFAULT NULL,
+  UNIQUE KEY `a_b` (`a`, `b`)
+) ENGINE=InnoDB DEFAULT CHARSET=utf8mb4;
+
+INSERT INTO `nullable_unique` VALUES (1, NULL), (1, NULL), (1, NULL), (2, 1), (2, NULL), (3, NULL), (4, 4);
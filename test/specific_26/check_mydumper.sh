@@ -0,0 +1,160 @@
+
+
+# Reads the PARQUET files of each table back and compares the rows with the
+# ones in the server. The reader only knows what mydumper writes: uncompressed
+# data pages v1, PLAIN and RLE_DICTIONARY encodings and optional columns
+read_parquet(){
+python3 - "$@" <<'EOF'
+import struct, sys
+
+def varint(b, pos):
+    shift=result=0
+    while True:
+        byte=b[pos]; pos+=1
+        result|=(byte & 0x7F) << shift
+        shift+=7
+        if byte < 0x80:
+            return result, pos
+
+def zigzag(n):
+    return (n >> 1) ^ -(n & 1)
+
+def thrift_value(b, pos, kind):
+    if kind in (1, 2):
+        return kind == 1, pos
+    if kind == 3:
+        return b[pos], pos + 1
+    if kind in (4, 5, 6):
+        v, pos=varint(b, pos)
+        return zigzag(v), pos
+    if kind == 7:
+        return struct.unpack_from('<d', b, pos)[0], pos + 8
+    if kind == 8:
+        n, pos=varint(b, pos)
+        return bytes(b[pos:pos + n]), pos + n
+    if kind in (9, 10):
+        header=b[pos]; pos+=1
+        size, element=header >> 4, header & 0x0F
+        if size == 15:
+            size, pos=varint(b, pos)
+        values=[]
+        for i in range(size):
+            v, pos=thrift_value(b, pos, element)
+            values.append(v)
+        return values, pos
+    if kind == 12:
+        return thrift_struct(b, pos)
+    raise Exception("unexpected thrift type %d" % kind)
+
+def thrift_struct(b, pos):
+    fields={}
+    last=0
+    while True:
+        header=b[pos]; pos+=1
+        if header == 0:
+            return fields, pos
+        if header >> 4:
+            last+=header >> 4
+        else:
+            v, pos=varint(b, pos)
+            last=zigzag(v)
+        fields[last], pos=thrift_value(b, pos, header & 0x0F)
+
+def rle_hybrid(b, pos, bit_width, count):
+    values=[]
+    while len(values) < count:
+        header, pos=varint(b, pos)
+        if header & 1:
+            size=(header >> 1) * bit_width
+            bits=int.from_bytes(b[pos:pos + size], 'little')
+            pos+=size
+            for i in range((header >> 1) * 8):
+                values.append((bits >> (i * bit_width)) & ((1 << bit_width) - 1))
+        else:
+            width=(bit_width + 7) // 8
+            values.extend([int.from_bytes(b[pos:pos + width], 'little')] * (header >> 1))
+            pos+=width
+    return values[:count], pos
+
+def plain(b, pos, kind, count, unsigned):
+    values=[]
+    for i in range(count):
+        if kind == 2:
+            values.append(struct.unpack_from('<Q' if unsigned else '<q', b, pos)[0]); pos+=8
+        elif kind == 5:
+            values.append(struct.unpack_from('<d', b, pos)[0]); pos+=8
+        else:
+            n=struct.unpack_from('<I', b, pos)[0]
+            values.append(bytes(b[pos + 4:pos + 4 + n])); pos+=4 + n
+    return values
+
+def text(value):
+    if value is None:
+        return 'NULL'
+    if isinstance(value, float):
+        return repr(value)
+    if isinstance(value, bytes):
+        return value.decode('utf-8')
+    return str(value)
+
+def read_column(b, chunk, kind, unsigned, num_rows):
+    dictionary=None
+    pos=chunk.get(11, chunk[9])
+    values=[]
+    while len(values) < num_rows:
+        header, pos=thrift_struct(b, pos)
+        page=b[pos:pos + header[3]]
+        pos+=header[3]
+        if header[1] == 2:
+            dictionary=plain(page, 0, kind, header[7][1], unsigned)
+            continue
+        count, encoding=header[5][1], header[5][2]
+        length=struct.unpack_from('<I', page, 0)[0]
+        levels, _=rle_hybrid(page, 4, 1, count)
+        present=sum(levels)
+        if encoding == 8:
+            indices, _=rle_hybrid(page, 5 + length, page[4 + length], present)
+            data=[dictionary[i] for i in indices]
+        else:
+            data=plain(page, 4 + length, kind, present, unsigned)
+        data.reverse()
+        values.extend(data.pop() if level else None for level in levels)
+    return values
+
+rows=[]
+for filename in sys.argv[1:]:
+    b=open(filename, 'rb').read()
+    if b[:4] != b'PAR1' or b[-4:] != b'PAR1':
+        sys.exit("%s: bad magic" % filename)
+    length=struct.unpack_from('<I', b, len(b) - 8)[0]
+    footer, _=thrift_struct(b, len(b) - 8 - length)
+    schema=footer[2][1:]
+    file_rows=0
+    for row_group in footer[4]:
+        columns=[]
+        for element, chunk in zip(schema, row_group[1]):
+            columns.append(read_column(b, chunk[3], element[1], element.get(6) == 14, row_group[3]))
+        rows.extend(zip(*columns))
+        file_rows+=row_group[3]
+    if file_rows != footer[3]:
+        sys.exit("%s: %d rows in the row groups, %d in the footer" % (filename, file_rows, footer[3]))
+for row in rows:
+    print('\t'.join(text(v) for v in row))
+EOF
+}
+
+for table in typed distinct_strings
+do
+  files=$(ls /tmp/data/specific_26.${table}.*parquet)
+  if [ -z "$files" ] || ! read_parquet $files > /tmp/parquet_rows
+  then
+    exit 1
+  fi
+  mysql -N -B -e "SELECT * FROM specific_26.${table}" | LC_ALL=C sort > /tmp/mysql_rows
+  if ! LC_ALL=C sort /tmp/parquet_rows | diff -q - /tmp/mysql_rows
+  then
+    exit 1
+  fi
+done
+
+exit $1
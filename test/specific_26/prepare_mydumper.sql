@@ -0,0 +1,56 @@
+DROP DATABASE IF EXISTS specific_26;
+CREATE DATABASE specific_26;
+
+USE specific_26;
+
+CREATE TABLE `typed` (
+  `id` int NOT NULL,
+  `t` tinyint DEFAULT NULL,
+  `big` bigint DEFAULT NULL,
+  `ubig` bigint unsigned DEFAULT NULL,
+  `d` double DEFAULT NULL,
+  `dec` decimal(10,2) DEFAULT NULL,
+  `name` varchar(32) DEFAULT NULL,
+  `dt` datetime DEFAULT NULL,
+  `bin` varbinary(8) DEFAULT NULL,
+  PRIMARY KEY (`id`)
+) ENGINE=InnoDB DEFAULT CHARSET=utf8mb4;
+
+INSERT INTO `typed` VALUES (1, -128, -9223372036854775808, 18446744073709551615, 0.5, -12.34, 'same', '2024-02-29 23:59:59', 'ab');
+INSERT INTO `typed` VALUES (2, 127, 9223372036854775807, 0, -2.25, 0.01, 'same', NULL, NULL);
+INSERT INTO `typed` VALUES (3, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL);
+INSERT INTO `typed` VALUES (4, 0, 0, 1, 1.75, 99999999.99, 'ñandú', '1970-01-01 00:00:01', 'cd');
+INSERT INTO `typed` VALUES (5, 1, 1, 2, 1.75, 1, 'same', '1970-01-01 00:00:01', 'ab');
+INSERT INTO `typed` VALUES (6, 1, 1, 2, 1.75, 1, 'same', '1970-01-01 00:00:01', 'ab');
+INSERT INTO `typed` VALUES (7, 1, 1, 2, 1.75, 1, 'same', '1970-01-01 00:00:01', 'ab');
+INSERT INTO `typed` VALUES (8, 1, 1, 2, 1.75, 1, 'same', '1970-01-01 00:00:01', 'ab');
+INSERT INTO `typed` VALUES (9, 1, 1, 2, 1.75, 1, 'same', '1970-01-01 00:00:01', 'ab');
+INSERT INTO `typed` VALUES (10, 1, 1, 2, 1.75, 1, 'same', '1970-01-01 00:00:01', 'ab');
+INSERT INTO `typed` VALUES (11, 1, 1, 2, 1.75, 1, 'same', '1970-01-01 00:00:01', 'ab');
+INSERT INTO `typed` VALUES (12, 1, 1, 2, 1.75, 1, 'same', '1970-01-01 00:00:01', 'ab');
+INSERT INTO `typed` VALUES (13, 2, NULL, 3, NULL, 2, 'other', NULL, 'ef');
+INSERT INTO `typed` VALUES (14, NULL, 2, NULL, 3.5, NULL, NULL, '2000-01-01 00:00:00', NULL);
+
+-- 4096 distinct values of ~600 bytes: the dictionary grows past its limit
+-- and the row group falls back to PLAIN, the next row group of the 2MB
+-- chunks is dictionary encoded again
+CREATE TABLE `distinct_strings` (
+  `id` int NOT NULL AUTO_INCREMENT,
+  `payload` varchar(700) DEFAULT NULL,
+  PRIMARY KEY (`id`)
+) ENGINE=InnoDB DEFAULT CHARSET=utf8mb4;
+
+INSERT INTO `distinct_strings` (`payload`) VALUES (NULL);
+INSERT INTO `distinct_strings` (`payload`) SELECT NULL FROM `distinct_strings`;
+INSERT INTO `distinct_strings` (`payload`) SELECT NULL FROM `distinct_strings`;
+INSERT INTO `distinct_strings` (`payload`) SELECT NULL FROM `distinct_strings`;
+INSERT INTO `distinct_strings` (`payload`) SELECT NULL FROM `distinct_strings`;
+INSERT INTO `distinct_strings` (`payload`) SELECT NULL FROM `distinct_strings`;
+INSERT INTO `distinct_strings` (`payload`) SELECT NULL FROM `distinct_strings`;
+INSERT INTO `distinct_strings` (`payload`) SELECT NULL FROM `distinct_strings`;
+INSERT INTO `distinct_strings` (`payload`) SELECT NULL FROM `distinct_strings`;
+INSERT INTO `distinct_strings` (`payload`) SELECT NULL FROM `distinct_strings`;
+INSERT INTO `distinct_strings` (`payload`) SELECT NULL FROM `distinct_strings`;
+INSERT INTO `distinct_strings` (`payload`) SELECT NULL FROM `distinct_strings`;
+INSERT INTO `distinct_strings` (`payload`) SELECT NULL FROM `distinct_strings`;
+UPDATE `distinct_strings` SET `payload`=CONCAT(`id`, REPEAT(MD5(`id`), 18)) WHERE `id` % 10 != 0;
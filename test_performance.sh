@@ -0,0 +1,215 @@
+#!/bin/bash
+# Throughput benchmark of mydumper and myloader over the synthetic schemas of
+# test/perf_*. Every case is dumped and restored per format and compression,
+# the timings are appended as JSON lines to a report named after the version,
+# so two releases can be compared on the same host
+mydumper_log="/tmp/test_performance_mydumper.log"
+myloader_log="/tmp/test_performance_myloader.log"
+mydumper_stor_dir="/tmp/data"
+time_file="/tmp/test_performance.time"
+mysql_user=root
+docker_name=mydumper_performance
+
+die()
+{
+    [ -n "$1" ] && echo "$1" >&2;
+    exit 1
+}
+
+if [ -x ./mydumper -a -x ./myloader ]
+then
+  mydumper="./mydumper"
+  myloader="./myloader"
+else
+  mydumper=`which mydumper` ||
+    die "mydumper not found!"
+  myloader=`which myloader` ||
+    die "myloader not found!"
+fi
+
+mysql_exe=`which mariadb` ||
+mysql_exe=`which mysql` ||
+  die "mysql client not found!"
+
+[ -x /usr/bin/time ] ||
+  die "GNU time is needed in /usr/bin/time"
+
+optstring_long="case:,formats:,compress:,rows:,tables:,threads:,docker:,report:,keep"
+optstring_short="c:f:z:r:t:"
+
+opts=$(getopt -o "${optstring_short}" --long "${optstring_long}" --name "$0" -- "$@") ||
+    exit $?
+eval set -- "$opts"
+
+cases=""
+formats="INSERT LOAD_DATA CSV"
+compressions="none GZIP ZSTD"
+threads=""
+docker_image=""
+report=""
+unset keep
+
+while true
+do
+  case "$1" in
+  -c|--case)
+    cases="${cases} ${2//,/ }"
+    shift 2;;
+  -f|--formats)
+    formats="${2//,/ }"
+    shift 2;;
+  -z|--compress)
+    compressions="${2//,/ }"
+    shift 2;;
+  -r|--rows)
+    export PERF_ROWS=$2
+    shift 2;;
+  --tables)
+    export PERF_TABLES=$2
+    shift 2;;
+  -t|--threads)
+    threads="--threads $2"
+    shift 2;;
+  --docker)
+    docker_image=$2
+    shift 2;;
+  --report)
+    report=$2
+    shift 2;;
+  --keep)
+    keep=1
+    shift;;
+  --)
+    shift
+    break;;
+  esac
+done
+
+if [ -z "${cases}" ]
+then
+  for dir in test/perf_*/
+  do
+    dir=${dir%/}
+    cases="${cases} ${dir##*_}"
+  done
+fi
+
+version=$($mydumper --version 2>&1 | awk '{print $2}' | tr -d ',')
+version=${version:-unknown}
+report=${report:-/tmp/test_performance.${version}.json}
+
+stop_docker()
+{
+  docker rm -f $docker_name > /dev/null 2>&1
+}
+
+# A disposable server, so the numbers of two versions come from the same
+# configuration and the same empty buffer pool
+if [ -n "${docker_image}" ]
+then
+  stop_docker
+  docker run -d --name $docker_name -e MYSQL_ALLOW_EMPTY_PASSWORD=1 \
+    -e MARIADB_ALLOW_EMPTY_ROOT_PASSWORD=1 -p 127.0.0.1:13306:3306 \
+    ${docker_image} > /dev/null || die "Not able to start ${docker_image}"
+  trap stop_docker EXIT
+  unset MYSQL_UNIX_PORT MYSQLX_UNIX_PORT
+  export MYSQL_HOST=127.0.0.1
+  export MYSQL_TCP_PORT=13306
+fi
+
+if [ -z "$MYSQL_UNIX_PORT" -a -z "$MYSQL_HOST" ]
+then
+  for d in /var/lib/mysql /var/run /tmp
+  do
+    if [ -S $d/mysql.sock ]; then
+      export MYSQL_UNIX_PORT=$d/mysql.sock
+      break
+    elif [ -S $d/mysqld.sock ]; then
+      export MYSQL_UNIX_PORT=$d/mysqld.sock
+      break
+    fi
+  done
+fi
+
+if [ -z "$MYSQL_UNIX_PORT" ]
+then
+  export MYSQL_HOST=${MYSQL_HOST:-127.0.0.1}
+  export MYSQL_TCP_PORT=${MYSQL_TCP_PORT:-3306}
+  echo "Using TCP connection to $MYSQL_HOST:$MYSQL_TCP_PORT"
+else
+  echo "Socket: $MYSQL_UNIX_PORT"
+fi
+
+mysql()
+{
+  $mysql_exe --no-defaults -f --user $mysql_user "$@"
+}
+
+for i in $(seq 1 60)
+do
+  mysql -e "SELECT 1" > /dev/null 2>&1 && break
+  [ $i -eq 60 ] && die "Server is not reachable"
+  sleep 2
+done
+
+# Ignored when the user lacks the privilege, LOAD DATA cases fail then
+mysql -e "SET GLOBAL local_infile=1" > /dev/null 2>&1
+mysql -e "CREATE DATABASE IF NOT EXISTS perf_seq; CREATE TABLE IF NOT EXISTS perf_seq.digits (d TINYINT NOT NULL PRIMARY KEY); REPLACE INTO perf_seq.digits VALUES (0),(1),(2),(3),(4),(5),(6),(7),(8),(9)" ||
+  die "Not able to create perf_seq.digits"
+
+# Rows are the ones mydumper wrote in the metadata, bytes the size of the
+# backup, so the restore of a format is compared with its own dump
+dump_rows()
+{
+  grep -h "^rows = " ${mydumper_stor_dir}/metadata* 2>/dev/null | awk '{s+=$3} END {print s+0}'
+}
+
+dump_bytes()
+{
+  du -sb ${mydumper_stor_dir} | awk '{print $1}'
+}
+
+# $1 case, $2 format, $3 compress, $4 tool, $5 exit status
+record()
+{
+  local wall user sys cpu rss rows bytes rps
+  read wall user sys cpu rss < $time_file
+  rows=$(dump_rows)
+  bytes=$(dump_bytes)
+  rps=$(awk -v r=$rows -v w=$wall 'BEGIN {printf "%.0f", (w > 0 ? r / w : 0)}')
+  echo "{\"version\":\"${version}\",\"case\":\"perf_$1\",\"format\":\"$2\",\"compress\":\"$3\",\"tool\":\"$4\",\"status\":$5,\"wall\":${wall},\"user\":${user},\"sys\":${sys},\"cpu\":\"${cpu}\",\"rss_max_kb\":${rss},\"rows\":${rows},\"rows_per_sec\":${rps},\"bytes\":${bytes}}" >> $report
+  printf "  %-8s %-9s %-5s %8.2fs %9s rows/s cpu %5s rss %8s KB\n" $4 $2 $3 $wall $rps $cpu $rss
+}
+
+timed()
+{
+  /usr/bin/time -o $time_file -f "%e %U %S %P %M" "$@"
+}
+
+for case_num in ${cases}
+do
+  dir=test/perf_${case_num}
+  [ -f ${dir}/generate.sh ] || die "Case ${dir} not found"
+  echo "Preparing perf_${case_num}"
+  bash ${dir}/generate.sh | mysql || die "Not able to prepare perf_${case_num}"
+  for format in ${formats}
+  do
+    for compress in ${compressions}
+    do
+      compress_arg=""
+      [ "${compress}" != "none" ] && compress_arg="--compress=${compress}"
+      rm -rf ${mydumper_stor_dir}
+      timed $mydumper --user $mysql_user $threads --defaults-extra-file=${dir}/mydumper.cnf \
+        --format=${format} ${compress_arg} --logfile $mydumper_log
+      record ${case_num} ${format} ${compress} mydumper $?
+      timed $myloader --user $mysql_user $threads --defaults-extra-file=${dir}/myloader.cnf \
+        --logfile $myloader_log
+      record ${case_num} ${format} ${compress} myloader $?
+    done
+  done
+  [ -z "${keep}" ] && mysql -e "DROP DATABASE IF EXISTS perf_${case_num}"
+done
+
+[ -z "${keep}" ] && mysql -e "DROP DATABASE IF EXISTS perf_seq"
+rm -rf ${mydumper_stor_dir} $time_file
+echo "Report: $report"